@@ -0,0 +1,348 @@
+#include "AssetLoader.h"
+#include "MeshCache.h"
+#include "CubemapConverter.h"
+#include "EnvironmentPrefilter.h"
+#include "Parallel.h"
+
+AssetLoader* AssetLoader::mInstance = 0;
+static std::mutex InstanceMutex;
+
+AssetLoader* AssetLoader::Instance()
+{
+	std::lock_guard<std::mutex> lock(InstanceMutex);
+	if (mInstance == 0)
+	{
+		mInstance = new AssetLoader();
+	}
+	return mInstance;
+}
+
+AssetLoader::AssetLoader() : md3dDevice(NULL), mPendingCount(0), mStopping(false)
+{
+}
+
+AssetLoader::~AssetLoader()
+{
+	Release();
+}
+
+void AssetLoader::Init(ID3D11Device* device, UINT threadCount)
+{
+	Release();
+
+	md3dDevice = device;
+	mStopping = false;
+
+	if (threadCount == AutoThreadCount)
+		threadCount = (std::max)(WorkerThreadCount(), 2u) - 1;
+
+	for (UINT i = 0; i < threadCount; ++i)
+	{
+		mWorkers.push_back(std::thread(&AssetLoader::WorkerMain, this));
+	}
+}
+
+void AssetLoader::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWorkAvailable.notify_all();
+
+	for (std::thread& worker : mWorkers)
+	{
+		worker.join();
+	}
+	mWorkers.clear();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (const std::unique_ptr<AssetJob>& job : mQueue)
+		mStates[job->handle - 1] = ASSET_FAILED;
+	for (const std::unique_ptr<AssetJob>& job : mCompleted)
+		mStates[job->handle - 1] = ASSET_FAILED;
+	mQueue.clear();
+	mCompleted.clear();
+	mPendingCount = 0;
+}
+
+AssetHandle AssetLoader::LoadMesh(Mesh* mesh, const std::string& objFile, const std::string& mtlBaseDir, VertexFormat format,
+	std::function<void(Mesh*)> onReady)
+{
+	std::unique_ptr<AssetJob> job(new AssetJob());
+	job->type = ASSET_MESH;
+	job->filename = objFile;
+	job->mesh = mesh;
+	job->mtlBaseDir = mtlBaseDir;
+	job->format = format;
+	job->faceSize = 0;
+	job->cubeFaceSize = 0;
+	job->onMeshReady = onReady;
+	return Enqueue(std::move(job));
+}
+
+AssetHandle AssetLoader::LoadTexture(const std::string& filename, std::function<void(ID3D11ShaderResourceView*)> onReady)
+{
+	std::unique_ptr<AssetJob> job(new AssetJob());
+	job->type = ASSET_TEXTURE;
+	job->filename = filename;
+	job->mesh = NULL;
+	job->format = VERTEX_FORMAT_FULL;
+	job->faceSize = 0;
+	job->cubeFaceSize = 0;
+	job->onTextureReady = onReady;
+	return Enqueue(std::move(job));
+}
+
+AssetHandle AssetLoader::LoadCubemap(const std::string& equirectFile, UINT faceSize,
+	std::function<void(ID3D11ShaderResourceView*, const SHCoefficients&)> onReady)
+{
+	std::unique_ptr<AssetJob> job(new AssetJob());
+	job->type = ASSET_CUBEMAP;
+	job->filename = equirectFile;
+	job->mesh = NULL;
+	job->format = VERTEX_FORMAT_FULL;
+	job->faceSize = faceSize;
+	job->cubeFaceSize = faceSize;
+	job->onCubemapReady = onReady;
+	return Enqueue(std::move(job));
+}
+
+AssetHandle AssetLoader::LoadSpecularCubemap(const std::string& equirectFile, UINT cubeFaceSize, UINT faceSize,
+	std::function<void(ID3D11ShaderResourceView*)> onReady)
+{
+	std::unique_ptr<AssetJob> job(new AssetJob());
+	job->type = ASSET_SPECULAR_CUBEMAP;
+	job->filename = equirectFile;
+	job->mesh = NULL;
+	job->format = VERTEX_FORMAT_FULL;
+	job->faceSize = faceSize;
+	job->cubeFaceSize = cubeFaceSize;
+	job->onTextureReady = onReady;
+	return Enqueue(std::move(job));
+}
+
+AssetHandle AssetLoader::LoadBrdfLut(const std::string& cacheFile, UINT size, std::function<void(ID3D11ShaderResourceView*)> onReady)
+{
+	std::unique_ptr<AssetJob> job(new AssetJob());
+	job->type = ASSET_BRDF_LUT;
+	job->filename = cacheFile;
+	job->mesh = NULL;
+	job->format = VERTEX_FORMAT_FULL;
+	job->faceSize = size;
+	job->cubeFaceSize = 0;
+	job->onTextureReady = onReady;
+	return Enqueue(std::move(job));
+}
+
+AssetHandle AssetLoader::Enqueue(std::unique_ptr<AssetJob> job)
+{
+	job->loaded = false;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mStates.push_back(ASSET_QUEUED);
+	job->handle = (AssetHandle)mStates.size();
+	AssetHandle handle = job->handle;
+	mPendingCount++;
+
+	// without workers the load runs here, Update still creates it
+	if (mWorkers.empty())
+	{
+		mStates[handle - 1] = ASSET_LOADING;
+		lock.unlock();
+
+		LoadData(*job);
+
+		lock.lock();
+		mStates[handle - 1] = ASSET_LOADED;
+		mCompleted.push_back(std::move(job));
+		return handle;
+	}
+
+	mQueue.push_back(std::move(job));
+	lock.unlock();
+	mWorkAvailable.notify_one();
+
+	return handle;
+}
+
+void AssetLoader::WorkerMain()
+{
+	// WIC decoding needs COM on the worker
+	HRESULT comResult = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+	for (;;)
+	{
+		std::unique_ptr<AssetJob> job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWorkAvailable.wait(lock, [this]() { return mStopping || !mQueue.empty(); });
+			if (mStopping)
+				break;
+
+			job = std::move(mQueue.front());
+			mQueue.pop_front();
+			mStates[job->handle - 1] = ASSET_LOADING;
+		}
+
+		LoadData(*job);
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStates[job->handle - 1] = ASSET_LOADED;
+			mCompleted.push_back(std::move(job));
+		}
+		mWorkDone.notify_all();
+	}
+
+	if (SUCCEEDED(comResult))
+		CoUninitialize();
+}
+
+void AssetLoader::LoadData(AssetJob& job)
+{
+	if (job.type == ASSET_MESH)
+	{
+		job.loaded = MeshCache::LoadMeshData(job.filename, job.mtlBaseDir, job.cacheFile, job.meshData);
+		return;
+	}
+
+	if (job.type == ASSET_CUBEMAP)
+	{
+		// always read, the ambient is baked from the faces
+		job.loaded = TextureManager::LoadCubemapData(job.filename, job.faceSize, job.textureData);
+		if (job.loaded)
+		{
+			const uint16_t* faces = (const uint16_t*)(job.textureData.fileData.data() + CubemapConverter::DdsHeaderSize);
+			SHCoefficients radiance;
+			SphericalHarmonics::ProjectCubemap(faces, job.faceSize, radiance);
+			SphericalHarmonics::AmbientCoefficients(radiance, job.ambient);
+
+			// BC6H once the ambient has the full precision faces
+			TextureManager::CompressTextureData(job.textureData);
+		}
+		return;
+	}
+
+	if (job.type == ASSET_SPECULAR_CUBEMAP)
+	{
+		job.loaded = TextureManager::LoadSpecularData(job.filename, job.cubeFaceSize, job.faceSize, job.textureData);
+		return;
+	}
+
+	if (job.type == ASSET_BRDF_LUT)
+	{
+		job.loaded = TextureManager::LoadBrdfLutData(job.filename, job.faceSize, job.textureData);
+		return;
+	}
+
+	// an already created texture is only looked up by Update. A texture given to a callback
+	// is held by pointer, it is read whole and never evicted.
+	job.loaded = TextureManager::Instance()->GetTexture(job.filename) != NULL ||
+		TextureManager::LoadTextureData(job.filename, job.textureData, !job.onTextureReady);
+	job.textureData.filename = job.filename;
+}
+
+void AssetLoader::CreateResources(AssetJob& job)
+{
+	bool ready = false;
+
+	if (job.type == ASSET_MESH)
+	{
+		if (job.loaded)
+		{
+			MeshCache::CreateMesh(md3dDevice, job.cacheFile, job.meshData, *job.mesh, job.format);
+			job.cacheFile.Close();
+			ready = true;
+
+			for (const auto& kv : job.mesh->mMaterials)
+			{
+				const Material& material = kv.second;
+				if (material.diffuseTextureHandle != InvalidTextureHandle &&
+					TextureManager::Instance()->GetTexture(material.diffuseTextureHandle) == NULL)
+				{
+					LoadTexture(material.diffuseTexture);
+				}
+			}
+
+			if (job.onMeshReady)
+				job.onMeshReady(job.mesh);
+		}
+	}
+	else
+	{
+		ID3D11ShaderResourceView* srv = job.loaded ? TextureManager::Instance()->CreateTexture(job.textureData) : NULL;
+		ready = srv != NULL;
+
+		if (ready && job.onTextureReady)
+			job.onTextureReady(srv);
+		if (ready && job.onCubemapReady)
+			job.onCubemapReady(srv, job.ambient);
+	}
+
+	if (!ready)
+	{
+		char msg[512];
+		snprintf(msg, sizeof(msg), "AssetLoader: could not load %s\n", job.filename.c_str());
+		OutputDebugStringA(msg);
+	}
+
+	SetState(job.handle, ready ? ASSET_READY : ASSET_FAILED);
+}
+
+UINT AssetLoader::Update(UINT maxJobs)
+{
+	UINT created = 0;
+	while (created < maxJobs)
+	{
+		std::unique_ptr<AssetJob> job;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mCompleted.empty())
+				break;
+			job = std::move(mCompleted.front());
+			mCompleted.pop_front();
+		}
+
+		CreateResources(*job);
+		created++;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPendingCount--;
+	}
+
+	return created;
+}
+
+void AssetLoader::Flush()
+{
+	for (;;)
+	{
+		Update();
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		if (mPendingCount == 0)
+			break;
+		mWorkDone.wait(lock, [this]() { return !mCompleted.empty() || mPendingCount == 0; });
+	}
+}
+
+void AssetLoader::SetState(AssetHandle handle, AssetState state)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mStates[handle - 1] = state;
+}
+
+AssetState AssetLoader::GetState(AssetHandle handle)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (handle == InvalidHandle || handle > mStates.size())
+		return ASSET_FAILED;
+	return mStates[handle - 1];
+}
+
+UINT AssetLoader::GetPendingCount()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPendingCount;
+}
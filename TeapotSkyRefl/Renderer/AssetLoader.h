@@ -0,0 +1,149 @@
+#pragma once
+
+#include "Util.h"
+#include "Mesh.h"
+#include "MappedFile.h"
+#include "TextureManager.h"
+#include "SphericalHarmonics.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// AssetLoader
+// Worker pool loading meshes and textures off the main thread. File I/O,
+// .obj parsing, mesh cooking and image decoding run on the workers, the
+// finished CPU data waits until Update creates the D3D resources on the main
+// thread at a frame boundary, so the immediate context is never shared.
+// A mesh also queues the textures of its materials once it is created.
+// usage:
+// AssetLoader::Instance()->Init(device);
+// AssetHandle handle = AssetLoader::Instance()->LoadMesh(mesh, "..\\Assets\\teapot.obj", "..\\Assets\\");
+// every frame: AssetLoader::Instance()->Update();
+// if (AssetLoader::Instance()->GetState(handle) == ASSET_READY) ...
+
+enum AssetState
+{
+	ASSET_QUEUED,
+	ASSET_LOADING,	// on a worker
+	ASSET_LOADED,	// CPU data done, waits for Update
+	ASSET_READY,	// GPU resources created
+	ASSET_FAILED
+};
+
+typedef UINT AssetHandle;
+
+class AssetLoader
+{
+public:
+	static const AssetHandle InvalidHandle = 0;
+
+	// one worker per hardware thread but the main thread
+	static const UINT AutoThreadCount = 0xffffffff;
+
+	static AssetLoader* Instance();
+
+	// Starts threadCount workers. Without workers every load runs inside its Load call,
+	// one after another, and is still created by Update.
+	void Init(ID3D11Device* device, UINT threadCount = AutoThreadCount);
+
+	// Finishes the jobs being loaded and drops the rest, then stops the workers
+	void Release();
+
+	// Loads objFile through MeshCache into mesh, onReady runs on the main thread once mesh is created
+	AssetHandle LoadMesh(Mesh* mesh, const std::string& objFile, const std::string& mtlBaseDir, VertexFormat format = VERTEX_FORMAT_FULL,
+		std::function<void(Mesh*)> onReady = nullptr);
+
+	// Loads a texture into TextureManager, onReady runs on the main thread once it is created
+	AssetHandle LoadTexture(const std::string& filename, std::function<void(ID3D11ShaderResourceView*)> onReady = nullptr);
+
+	// Converts an equirectangular .hdr into a cubemap with faceSize faces, or reads its cached
+	// conversion, into TextureManager. The worker also bakes the ambient spherical harmonics
+	// of the cubemap, onReady gets both on the main thread once the cubemap is created.
+	AssetHandle LoadCubemap(const std::string& equirectFile, UINT faceSize,
+		std::function<void(ID3D11ShaderResourceView*, const SHCoefficients&)> onReady = nullptr);
+
+	// Prefilters the GGX specular mip chain with faceSize faces from the cubeFaceSize cubemap of an
+	// equirectangular .hdr, or reads its cached chain, into TextureManager, see EnvironmentPrefilter
+	AssetHandle LoadSpecularCubemap(const std::string& equirectFile, UINT cubeFaceSize, UINT faceSize,
+		std::function<void(ID3D11ShaderResourceView*)> onReady = nullptr);
+
+	// Integrates the split sum BRDF lookup table of size * size, or reads it from cacheFile
+	AssetHandle LoadBrdfLut(const std::string& cacheFile, UINT size, std::function<void(ID3D11ShaderResourceView*)> onReady = nullptr);
+
+	// Creates the resources of at most maxJobs finished loads, returns how many were created.
+	// Main thread only, call once per frame.
+	UINT Update(UINT maxJobs = UINT_MAX);
+
+	// Blocks until every queued load is created
+	void Flush();
+
+	AssetState GetState(AssetHandle handle);
+
+	// loads not created yet
+	UINT GetPendingCount();
+
+private:
+	enum AssetType
+	{
+		ASSET_MESH,
+		ASSET_TEXTURE,
+		ASSET_CUBEMAP,
+		ASSET_SPECULAR_CUBEMAP,
+		ASSET_BRDF_LUT
+	};
+
+	struct AssetJob
+	{
+		AssetHandle handle;
+		AssetType type;
+		std::string filename;
+		bool loaded;
+
+		// mesh
+		Mesh* mesh;
+		std::string mtlBaseDir;
+		VertexFormat format;
+		MappedFile cacheFile;
+		MeshData meshData;
+		std::function<void(Mesh*)> onMeshReady;
+
+		// texture and cubemaps, faceSize is the size of the lookup table
+		UINT faceSize;
+		UINT cubeFaceSize;
+		TextureData textureData;
+		std::function<void(ID3D11ShaderResourceView*)> onTextureReady;
+
+		// cubemap
+		SHCoefficients ambient;
+		std::function<void(ID3D11ShaderResourceView*, const SHCoefficients&)> onCubemapReady;
+	};
+
+	AssetLoader();
+	~AssetLoader();
+
+	AssetLoader(const AssetLoader& rhs);
+
+	AssetHandle Enqueue(std::unique_ptr<AssetJob> job);
+	void SetState(AssetHandle handle, AssetState state);
+	void WorkerMain();
+	static void LoadData(AssetJob& job);
+	void CreateResources(AssetJob& job);
+
+	static AssetLoader* mInstance;
+
+	ID3D11Device* md3dDevice;
+	std::vector<std::thread> mWorkers;
+
+	std::mutex mMutex;
+	std::condition_variable mWorkAvailable;
+	std::condition_variable mWorkDone;
+	std::deque<std::unique_ptr<AssetJob>> mQueue;
+	std::deque<std::unique_ptr<AssetJob>> mCompleted;
+	std::vector<AssetState> mStates;	// by handle - 1
+	UINT mPendingCount;
+	bool mStopping;
+};
@@ -0,0 +1,1866 @@
+#include "Benchmark.h"
+#include "ObjLoader.h"
+#include "ObjImporter.h"
+#include "MeshWelder.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "VertexPacking.h"
+#include "MeshletBuilder.h"
+#include "ClusterCuller.h"
+#include "Camera.h"
+#include "Parallel.h"
+#include "CubemapConverter.h"
+#include "EnvironmentPrefilter.h"
+#include "BlockCompressor.h"
+#include "MipGenerator.h"
+#include "TextureManager.h"
+#include "StringTable.h"
+#include "SceneBvh.h"
+#include "RenderQueue.h"
+#include "CommandBuffer.h"
+#include "OcclusionCuller.h"
+#include "GeometryGenerator.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+static const char* BenchmarkLogFile = "benchmark.txt";
+
+void BenchmarkLog(const char* format, ...)
+{
+	char buffer[1024];
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	OutputDebugStringA(buffer);
+	OutputDebugStringA("\n");
+
+	std::ofstream log(BenchmarkLogFile, std::ios::app);
+	log << buffer << std::endl;
+}
+
+// Writes a grid of 2 * (n-1)^2 triangles with positions, normals and texcoords
+static bool WriteSyntheticObj(const std::string& fileName, UINT triangleCount)
+{
+	std::ifstream existing(fileName);
+	if (existing)
+		return true;
+
+	std::ofstream file(fileName);
+	if (!file)
+		return false;
+
+	UINT n = (UINT)sqrt(triangleCount / 2.0) + 1;
+	char line[256];
+
+	for (UINT y = 0; y < n; ++y)
+	{
+		for (UINT x = 0; x < n; ++x)
+		{
+			float u = (float)x / (n - 1);
+			float v = (float)y / (n - 1);
+			int len = snprintf(line, sizeof(line), "v %f %f %f\nvn 0.0 1.0 0.0\nvt %f %f\n", u * 100.0f, sinf(u * 40.0f) * cosf(v * 40.0f), v * 100.0f, u, v);
+			file.write(line, len);
+		}
+	}
+
+	for (UINT y = 0; y + 1 < n; ++y)
+	{
+		for (UINT x = 0; x + 1 < n; ++x)
+		{
+			UINT a = y * n + x + 1;
+			UINT b = a + 1;
+			UINT c = a + n;
+			UINT d = c + 1;
+			int len = snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\nf %u/%u/%u %u/%u/%u %u/%u/%u\n",
+				a, a, a, c, c, c, b, b, b, b, b, b, c, c, c, d, d, d);
+			file.write(line, len);
+		}
+	}
+
+	return true;
+}
+
+// Serial and parallel vertex welding of the imported teapot and 10M triangle grid
+static void BenchWeld()
+{
+	const char* syntheticFile = "..\\Assets\\synthetic_10m.obj";
+	WriteSyntheticObj(syntheticFile, 10000000);
+
+	const char* files[] = { "..\\Assets\\teapot.obj", syntheticFile };
+	for (const char* fileName : files)
+	{
+		MeshWelder::WeldMode modes[] = { MeshWelder::WELD_SERIAL, MeshWelder::WELD_PARALLEL };
+		for (MeshWelder::WeldMode mode : modes)
+		{
+			MeshData meshData;
+			ObjImporter importer;
+			if (!importer.Import(fileName, meshData.Vertices, meshData.Indices, meshData.MaterialIndices))
+			{
+				BenchmarkLog("weld: could not import %s", fileName);
+				break;
+			}
+
+			WeldStats stats;
+			MeshWelder::Weld(meshData, mode, &stats);
+
+			BenchmarkLog("weld: %s %s %zu -> %zu vertices (%.1f%%), %zu bytes saved, %.2f ms",
+				fileName, stats.parallel ? "parallel" : "serial", stats.verticesBefore, stats.verticesAfter,
+				100.0 * stats.verticesAfter / std::max<size_t>(stats.verticesBefore, 1), stats.bytesSaved, stats.timeMs);
+		}
+	}
+}
+
+// Startup cost of the teapot: cold .obj import and cache write against a warm .tmesh hit.
+// Runs without a device, so the warm path is measured up to the point where the
+// mapped blobs would be handed to Mesh::Create.
+static void BenchMeshCache()
+{
+	const char* files[] = { "..\\Assets\\teapot.obj", "..\\Assets\\synthetic_10m.obj" };
+	WriteSyntheticObj(files[1], 10000000);
+
+	for (const char* fileName : files)
+	{
+		DeleteFileA(MeshCache::CacheFileName(fileName).c_str());
+
+		BenchmarkTimer timer;
+		MeshData meshData;
+		if (!MeshCache::Cook(fileName, "..\\Assets\\", meshData))
+		{
+			BenchmarkLog("meshcache: could not cook %s", fileName);
+			continue;
+		}
+		double coldMs = timer.ElapsedMs();
+
+		timer.Reset();
+		MappedFile cacheFile;
+		if (!MeshCache::OpenCache(fileName, cacheFile))
+		{
+			BenchmarkLog("meshcache: cache miss after cooking %s", fileName);
+			continue;
+		}
+
+		std::map<UINT, Material> materials;
+		MeshCache::ReadMaterials(cacheFile, materials);
+
+		// touch every page like the buffer upload would
+		const MeshCacheHeader* header = (const MeshCacheHeader*)cacheFile.Data();
+		UINT64 checksum = 0;
+		for (size_t offset = 0; offset < cacheFile.Size(); offset += 4096)
+		{
+			checksum += (unsigned char)cacheFile.Data()[offset];
+		}
+		double warmMs = timer.ElapsedMs();
+
+		BenchmarkLog("meshcache: %s cold import %.2f ms, warm cache %.2f ms, %.1fx faster (%u vertices, checksum %llx)",
+			fileName, coldMs, warmMs, coldMs / (std::max)(warmMs, 0.001), header->vertexCount, checksum);
+	}
+}
+
+// Vertex cache, overdraw and fetch reordering of the welded teapot, the synthetic grids are
+// timed by Tests/MeshOptimizerTest
+static void BenchMeshOptimizer()
+{
+	const char* fileName = "..\\Assets\\teapot.obj";
+	MeshData meshData;
+	ObjImporter importer;
+	if (!importer.Import(fileName, meshData.Vertices, meshData.Indices, meshData.MaterialIndices))
+	{
+		BenchmarkLog("meshopt: could not import %s", fileName);
+		return;
+	}
+	MeshWelder::Weld(meshData);
+
+	MeshOptimizerStats stats;
+	OptimizeMesh(meshData, &stats);
+
+	BenchmarkLog("meshopt: %s %zu triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f, %zu -> %zu vertices, %.2f ms",
+		fileName, meshData.Indices.size() / 3, stats.cacheBefore.acmr, stats.cacheAfter.acmr, stats.cacheBefore.atvr, stats.cacheAfter.atvr,
+		stats.overdrawBefore.overdraw, stats.overdrawAfter.overdraw, stats.verticesBefore, stats.verticesAfter, stats.timeMs);
+}
+
+// Packed vertex encode and decode per kernel. Checks that every kernel matches the
+// scalar reference bit for bit and that the round trip stays within PackedVertexErrorBounds.
+static void BenchVertexPacking()
+{
+	const char* syntheticFile = "..\\Assets\\synthetic_10m.obj";
+	WriteSyntheticObj(syntheticFile, 10000000);
+
+	const char* files[] = { "..\\Assets\\teapot.obj", syntheticFile };
+	for (const char* fileName : files)
+	{
+		MeshData meshData;
+		ObjImporter importer;
+		if (!importer.Import(fileName, meshData.Vertices, meshData.Indices, meshData.MaterialIndices))
+		{
+			BenchmarkLog("vertexpack: could not import %s", fileName);
+			continue;
+		}
+
+		const float* vertices = &meshData.Vertices[0].Position.x;
+		size_t count = meshData.Vertices.size();
+
+		VertexQuantization quantization = ComputeVertexQuantization(vertices, count);
+		PackedVertexErrors bounds = PackedVertexErrorBounds(quantization);
+
+		std::vector<PackedVertex> reference(count);
+		EncodePackedVertices(vertices, count, quantization, reference.data(), VERTEX_PACKING_SCALAR);
+
+		VertexPackingKernel kernels[] = { VERTEX_PACKING_SCALAR, VERTEX_PACKING_SSE2, VERTEX_PACKING_AVX2 };
+		const char* kernelNames[] = { "", "scalar", "sse2", "avx2" };
+		for (VertexPackingKernel kernel : kernels)
+		{
+			if (GetVertexPackingKernel(kernel) != kernel)
+			{
+				BenchmarkLog("vertexpack: %s not supported on this CPU", kernelNames[kernel]);
+				continue;
+			}
+
+			std::vector<PackedVertex> packed(count);
+			std::vector<Vertex> decoded(count);
+
+			BenchmarkTimer timer;
+			EncodePackedVertices(vertices, count, quantization, packed.data(), kernel);
+			double encodeMs = timer.ElapsedMs();
+
+			timer.Reset();
+			DecodePackedVertices(packed.data(), count, quantization, &decoded[0].Position.x, kernel);
+			double decodeMs = timer.ElapsedMs();
+
+			size_t mismatches = 0;
+			PackedVertexErrors errors;
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (memcmp(&packed[i], &reference[i], sizeof(PackedVertex)) != 0)
+					mismatches++;
+
+				const Vertex& a = meshData.Vertices[i];
+				const Vertex& b = decoded[i];
+				errors.position = (std::max)(errors.position, (std::max)(fabsf(a.Position.x - b.Position.x),
+					(std::max)(fabsf(a.Position.y - b.Position.y), fabsf(a.Position.z - b.Position.z))));
+
+				// only unit normals round trip, the decoder renormalizes
+				float length = sqrtf(a.Normal.x * a.Normal.x + a.Normal.y * a.Normal.y + a.Normal.z * a.Normal.z);
+				if (length > 0.0f)
+				{
+					errors.normal = (std::max)(errors.normal, (std::max)(fabsf(a.Normal.x / length - b.Normal.x),
+						(std::max)(fabsf(a.Normal.y / length - b.Normal.y), fabsf(a.Normal.z / length - b.Normal.z))));
+				}
+
+				errors.tex = (std::max)(errors.tex, (std::max)(fabsf(a.Tex.x - b.Tex.x) / (std::max)(1.0f, fabsf(a.Tex.x)),
+					fabsf(a.Tex.y - b.Tex.y) / (std::max)(1.0f, fabsf(a.Tex.y))));
+			}
+
+			bool passed = mismatches == 0 && errors.position <= bounds.position && errors.normal <= bounds.normal && errors.tex <= bounds.tex;
+
+			BenchmarkLog("vertexpack: %s %s %zu vertices, encode %.2f ms, decode %.2f ms, %zu -> %zu bytes, "
+				"max error position %g (bound %g) normal %g (bound %g) uv %g (bound %g), %zu mismatches, %s",
+				fileName, kernelNames[kernel], count, encodeMs, decodeMs, count * sizeof(Vertex), count * sizeof(PackedVertex),
+				errors.position, bounds.position, errors.normal, bounds.normal, errors.tex, bounds.tex, mismatches, passed ? "PASSED" : "FAILED");
+		}
+	}
+}
+
+// Meshlet culling of the teapot from camera positions orbiting it, below, level with
+// and above, at two distances given in bounding radii. Checks that every triangle
+// of a backface culled meshlet really faces away.
+static void BenchMeshletCulling()
+{
+	const char* fileName = "..\\Assets\\teapot.obj";
+	MeshData meshData;
+	ObjImporter importer;
+	if (!importer.Import(fileName, meshData.Vertices, meshData.Indices, meshData.MaterialIndices))
+	{
+		BenchmarkLog("meshlets: could not import %s", fileName);
+		return;
+	}
+	MeshWelder::Weld(meshData);
+	size_t vertexCount = MeshOptimizer::Optimize(meshData.Vertices.data(), meshData.Vertices.size(), sizeof(Vertex),
+		meshData.Indices.data(), meshData.Indices.size());
+	meshData.Vertices.resize(vertexCount);
+
+	BenchmarkTimer timer;
+	std::vector<Meshlet> meshlets;
+	MeshletBuilder::Build(&meshData.Vertices[0].Position.x, sizeof(Vertex), meshData.Vertices.size(),
+		meshData.Indices.data(), meshData.Indices.size(), meshlets);
+	double buildMs = timer.ElapsedMs();
+
+	BenchmarkLog("meshlets: %s %zu triangles in %zu meshlets, %.1f triangles per meshlet, %.2f ms",
+		fileName, meshData.Indices.size() / 3, meshlets.size(), meshData.Indices.size() / 3.0 / std::max<size_t>(meshlets.size(), 1), buildMs);
+
+	XMFLOAT3 boundsMin, boundsMax;
+	ComputeMeshBounds(meshData.Vertices.data(), meshData.Vertices.size(), boundsMin, boundsMax);
+	XMVECTOR center = XMVectorScale(XMVectorAdd(XMLoadFloat3(&boundsMin), XMLoadFloat3(&boundsMax)), 0.5f);
+	float radius = 0.5f * XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&boundsMax), XMLoadFloat3(&boundsMin))));
+
+	Camera camera;
+	camera.SetLens(0.25f * M_PI, 16.0f / 9.0f, 0.01f * radius, 100.0f * radius);
+
+	const int orbitSteps = 16;
+	const float elevations[] = { -0.25f * M_PI, 0.0f, 0.25f * M_PI };
+	const int elevationCount = sizeof(elevations) / sizeof(elevations[0]);
+
+	// the whole teapot in view, then close enough for the frustum to cut it
+	const float distances[] = { 3.0f, 1.2f };
+	for (float distance : distances)
+	{
+		ClusterCullStats total;
+		std::vector<DrawRange> ranges;
+		double cullMs = 0.0;
+		size_t wrongCulls = 0;
+		for (float elevation : elevations)
+		{
+			ClusterCullStats orbit;
+			for (int step = 0; step < orbitSteps; ++step)
+			{
+				float angle = M_PI2 * step / orbitSteps;
+				XMVECTOR offset = XMVectorSet(cosf(angle) * cosf(elevation), sinf(elevation), sinf(angle) * cosf(elevation), 0.0f);
+				XMVECTOR position = XMVectorAdd(center, XMVectorScale(offset, distance * radius));
+				camera.LookAt(position, center, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+				camera.UpdateViewMatrix();
+
+				ClusterCuller culler(XMMatrixIdentity(), camera.View(), camera.Proj());
+
+				timer.Reset();
+				culler.Cull(meshlets, ranges, &orbit);
+				cullMs += timer.ElapsedMs();
+
+				// a backface culled meshlet must not have a front facing triangle
+				for (const Meshlet& meshlet : meshlets)
+				{
+					ClusterCullStats single;
+					if (culler.IsVisible(meshlet, &single) || single.backfaceCulled == 0)
+						continue;
+
+					for (UINT t = 0; t < meshlet.triangleCount; ++t)
+					{
+						const UINT* triangle = &meshData.Indices[meshlet.indexOffset + t * 3];
+						XMVECTOR p0 = XMLoadFloat3(&meshData.Vertices[triangle[0]].Position);
+						XMVECTOR p1 = XMLoadFloat3(&meshData.Vertices[triangle[1]].Position);
+						XMVECTOR p2 = XMLoadFloat3(&meshData.Vertices[triangle[2]].Position);
+						XMVECTOR normal = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+						if (XMVectorGetX(XMVector3Dot(normal, XMVectorSubtract(p0, position))) < 0.0f)
+							wrongCulls++;
+					}
+				}
+			}
+
+			BenchmarkLog("meshlets: distance %.1f elevation %3.0f deg, %.1f%% triangles culled (%.1f%% meshlets, %u frustum, %u backface)",
+				distance, elevation * 180.0f / M_PI, 100.0 * (orbit.triangles - orbit.visibleTriangles) / (std::max)(orbit.triangles, 1u),
+				100.0 * (orbit.meshlets - orbit.visibleMeshlets) / (std::max)(orbit.meshlets, 1u), orbit.frustumCulled, orbit.backfaceCulled);
+
+			total.meshlets += orbit.meshlets;
+			total.visibleMeshlets += orbit.visibleMeshlets;
+			total.triangles += orbit.triangles;
+			total.visibleTriangles += orbit.visibleTriangles;
+		}
+
+		int views = orbitSteps * elevationCount;
+		BenchmarkLog("meshlets: distance %.1f, %d views, %.1f%% triangles culled on average, %.4f ms per cull, %zu front facing triangles culled, %s",
+			distance, views, 100.0 * (total.triangles - total.visibleTriangles) / (std::max)(total.triangles, 1u), cullMs / views, wrongCulls,
+			wrongCulls == 0 ? "PASSED" : "FAILED");
+	}
+}
+
+// Level of detail chain of the teapot and the triangles drawn for a grid of
+// 400 teapots while the camera flies over it, with and without hysteresis.
+static void BenchLod()
+{
+	const char* fileName = "..\\Assets\\teapot.obj";
+	MeshData meshData;
+	ObjImporter importer;
+	if (!importer.Import(fileName, meshData.Vertices, meshData.Indices, meshData.MaterialIndices))
+	{
+		BenchmarkLog("lod: could not import %s", fileName);
+		return;
+	}
+	MeshWelder::Weld(meshData);
+	OptimizeMesh(meshData);
+
+	BenchmarkTimer timer;
+	BuildMeshLods(meshData);
+	double buildMs = timer.ElapsedMs();
+
+	XMFLOAT3 boundsMin, boundsMax;
+	ComputeMeshBounds(meshData.Vertices.data(), meshData.Vertices.size(), boundsMin, boundsMax);
+	float radius = 0.5f * XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&boundsMax), XMLoadFloat3(&boundsMin))));
+
+	BenchmarkLog("lod: %s %zu levels built in %.2f ms", fileName, meshData.Lods.size(), buildMs);
+	for (size_t i = 0; i < meshData.Lods.size(); ++i)
+	{
+		const MeshLod& lod = meshData.Lods[i];
+		BenchmarkLog("lod: level %zu %u triangles, ratio %.3f (target %.3f), error %.4f (%.3f%% of the radius), %u meshlets",
+			i, lod.indexCount / 3, lod.ratio, lod.targetRatio, lod.error, 100.0f * lod.error / radius, lod.meshletCount);
+	}
+
+	// teapots on a grid, the camera flies from one corner over the grid to the other
+	const int gridSize = 20;
+	const float spacing = 4.0f * radius;
+	const int frames = 600;
+	const float viewportHeight = 768.0f;
+	const float pixelError = 1.0f;
+	const int objectCount = gridSize * gridSize;
+
+	std::vector<XMFLOAT3> centers;
+	for (int z = 0; z < gridSize; ++z)
+	{
+		for (int x = 0; x < gridSize; ++x)
+			centers.push_back(XMFLOAT3(x * spacing, 0.0f, z * spacing));
+	}
+
+	Camera camera;
+	camera.SetLens(0.25f * M_PI, 4.0f / 3.0f, 1.0f, 1000.0f);
+
+	const float hysteresisValues[] = { 1.0f, 0.75f };
+	for (float hysteresis : hysteresisValues)
+	{
+		std::vector<UINT> lods(objectCount, 0);
+		UINT64 fullTriangles = 0;
+		UINT64 lodTriangles = 0;
+		UINT64 switches = 0;
+		double selectMs = 0.0;
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			// back and forth so objects cross their thresholds in both directions
+			float t = 0.5f - 0.5f * cosf(M_PI2 * frame / frames);
+			XMVECTOR position = XMVectorSet(-spacing + t * (gridSize + 1) * spacing, 2.0f * radius, -spacing + t * (gridSize + 1) * spacing, 0.0f);
+			XMVECTOR target = XMVectorAdd(position, XMVectorSet(1.0f, -0.2f, 1.0f, 0.0f));
+			camera.LookAt(position, target, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+			camera.UpdateViewMatrix();
+
+			timer.Reset();
+			for (int i = 0; i < objectCount; ++i)
+			{
+				float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&centers[i]), position))) - radius;
+				UINT lod = SelectMeshLod(meshData.Lods, 1.0f, distance, camera.GetFovY(), viewportHeight, pixelError, lods[i], hysteresis);
+				if (lod != lods[i])
+					switches++;
+				lods[i] = lod;
+			}
+			selectMs += timer.ElapsedMs();
+
+			for (int i = 0; i < objectCount; ++i)
+			{
+				fullTriangles += meshData.Lods[0].indexCount / 3;
+				lodTriangles += meshData.Lods[lods[i]].indexCount / 3;
+			}
+		}
+
+		BenchmarkLog("lod: %d teapots, hysteresis %.2f, %.0f -> %.0f triangles per frame, %.2fx triangle throughput, %.1f level switches per frame, %.4f ms selection per frame",
+			objectCount, hysteresis, (double)fullTriangles / frames, (double)lodTriangles / frames, (double)fullTriangles / std::max<UINT64>(lodTriangles, 1),
+			(double)switches / frames, selectMs / frames);
+	}
+}
+
+// Writes a grid like WriteSyntheticObj whose quads cycle through materialCount materials
+// every runLength quads, and its .mtl library
+static bool WriteMaterialObj(const std::string& fileName, const std::string& mtlName, UINT n, UINT materialCount, UINT runLength)
+{
+	std::ofstream mtl(mtlName);
+	std::ofstream file(fileName);
+	if (!mtl || !file)
+		return false;
+
+	char line[256];
+	for (UINT m = 0; m < materialCount; ++m)
+	{
+		int len = snprintf(line, sizeof(line), "newmtl material%u\nKd %f %f %f\nNs 50.0\n", m, (m & 1) ? 1.0f : 0.2f, (m & 2) ? 1.0f : 0.2f, (m & 4) ? 1.0f : 0.2f);
+		mtl.write(line, len);
+	}
+
+	size_t slash = mtlName.find_last_of("\\/");
+	file << "mtllib " << (slash == std::string::npos ? mtlName : mtlName.substr(slash + 1)) << "\n";
+
+	for (UINT y = 0; y < n; ++y)
+	{
+		for (UINT x = 0; x < n; ++x)
+		{
+			float u = (float)x / (n - 1);
+			float v = (float)y / (n - 1);
+			int len = snprintf(line, sizeof(line), "v %f %f %f\nvn 0.0 1.0 0.0\nvt %f %f\n", u * 100.0f, sinf(u * 10.0f) * cosf(v * 10.0f), v * 100.0f, u, v);
+			file.write(line, len);
+		}
+	}
+
+	UINT quad = 0;
+	for (UINT y = 0; y + 1 < n; ++y)
+	{
+		for (UINT x = 0; x + 1 < n; ++x, ++quad)
+		{
+			if (quad % runLength == 0)
+				file << "usemtl material" << (quad / runLength) % materialCount << "\n";
+
+			UINT a = y * n + x + 1;
+			UINT b = a + 1;
+			UINT c = a + n;
+			UINT d = c + 1;
+			int len = snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\nf %u/%u/%u %u/%u/%u %u/%u/%u\n",
+				a, a, a, c, c, c, b, b, b, b, b, b, c, c, c, d, d, d);
+			file.write(line, len);
+		}
+	}
+
+	return true;
+}
+
+// Per face materials: draws of the usemtl runs in file order against one draw per
+// material sorted submesh, and the levels of detail keeping the material borders closed.
+static void BenchMaterials()
+{
+	const char* fileName = "..\\Assets\\synthetic_materials.obj";
+	const char* mtlName = "..\\Assets\\synthetic_materials.mtl";
+	const UINT materialCount = 8;
+	const UINT runLength = 16;
+	if (!WriteMaterialObj(fileName, mtlName, 256, materialCount, runLength))
+	{
+		BenchmarkLog("materials: could not write %s", fileName);
+		return;
+	}
+
+	ObjImporter importer;
+	MeshData imported;
+	if (!importer.Import(fileName, imported.Vertices, imported.Indices, imported.MaterialIndices))
+	{
+		BenchmarkLog("materials: could not import %s", fileName);
+		return;
+	}
+
+	UINT runs = 0;
+	for (size_t t = 0; t < imported.MaterialIndices.size(); ++t)
+	{
+		if (t == 0 || imported.MaterialIndices[t] != imported.MaterialIndices[t - 1])
+			runs++;
+	}
+
+	MeshData meshData;
+	BenchmarkTimer timer;
+	ObjLoader::Instance()->LoadToMesh(fileName, "..\\Assets\\", meshData);
+	double loadMs = timer.ElapsedMs();
+
+	timer.Reset();
+	BuildMeshLods(meshData);
+	double lodMs = timer.ElapsedMs();
+
+	BenchmarkLog("materials: %s %zu triangles, %zu materials, %u usemtl runs -> %zu submeshes (%.1fx fewer draws and material switches), load %.2f ms, levels %.2f ms",
+		fileName, imported.Indices.size() / 3, meshData.materials.size(), runs, (size_t)meshData.Lods[0].submeshCount,
+		(double)runs / std::max<UINT>(meshData.Lods[0].submeshCount, 1), loadMs, lodMs);
+
+	// every level has to keep the vertices on the material borders, or the submeshes crack apart
+	std::vector<UINT> borderVertices;
+	{
+		std::vector<UINT> vertexMaterial(meshData.Vertices.size(), 0xffffffff);
+		std::vector<bool> border(meshData.Vertices.size(), false);
+		const MeshLod& base = meshData.Lods[0];
+		for (UINT s = base.submeshOffset; s < base.submeshOffset + base.submeshCount; ++s)
+		{
+			const Submesh& submesh = meshData.Submeshes[s];
+			for (UINT i = submesh.indexOffset; i < submesh.indexOffset + submesh.indexCount; ++i)
+			{
+				UINT v = meshData.Indices[i];
+				if (vertexMaterial[v] != 0xffffffff && vertexMaterial[v] != submesh.materialId)
+					border[v] = true;
+				vertexMaterial[v] = submesh.materialId;
+			}
+		}
+		for (UINT v = 0; v < (UINT)border.size(); ++v)
+		{
+			if (border[v])
+				borderVertices.push_back(v);
+		}
+	}
+
+	for (size_t i = 1; i < meshData.Lods.size(); ++i)
+	{
+		const MeshLod& lod = meshData.Lods[i];
+		std::vector<bool> used(meshData.Vertices.size(), false);
+		for (UINT j = lod.indexOffset; j < lod.indexOffset + lod.indexCount; ++j)
+			used[meshData.Indices[j]] = true;
+
+		size_t lost = 0;
+		for (UINT v : borderVertices)
+		{
+			if (!used[v])
+				lost++;
+		}
+
+		BenchmarkLog("materials: level %zu %u triangles, %u submeshes, error %.4f, %zu of %zu border vertices lost %s",
+			i, lod.indexCount / 3, lod.submeshCount, lod.error, lost, borderVertices.size(), lost == 0 ? "PASSED" : "FAILED");
+	}
+}
+
+// GGX prefiltered specular chain and split sum lookup table: bake time against the thread count,
+// a constant sky has to stay constant in every mip, and cold bakes against warm cache reads
+static void BenchSpecular()
+{
+	const char* fileName = "..\\Assets\\approaching_storm_1k.hdr";
+	const UINT cubeFaceSize = 512;
+	const UINT faceSize = 128;
+	const UINT lutSize = 128;
+	const int runs = 2;
+
+	std::vector<unsigned char> cube;
+	if (!CubemapConverter::LoadCubemap(fileName, cubeFaceSize, cube))
+	{
+		BenchmarkLog("specular: could not read %s", fileName);
+		return;
+	}
+	const uint16_t* faces = (const uint16_t*)(cube.data() + CubemapConverter::DdsHeaderSize);
+
+	std::vector<uint16_t> reference;
+	double singleThreadMs = 0.0;
+	for (UINT threads = 1; threads <= WorkerThreadCount(); threads *= 2)
+	{
+		std::vector<uint16_t> chain;
+		double best = DBL_MAX;
+		for (int run = 0; run < runs; ++run)
+		{
+			BenchmarkTimer timer;
+			EnvironmentPrefilter::PrefilterSpecular(faces, cubeFaceSize, faceSize, chain, threads);
+			best = (std::min)(best, timer.ElapsedMs());
+		}
+
+		if (threads == 1)
+		{
+			reference = chain;
+			singleThreadMs = best;
+		}
+
+		BenchmarkLog("specular: %u faces from %u, %u mips, %u samples, %u threads %.2f ms, %.2fx, %s",
+			faceSize, cubeFaceSize, EnvironmentPrefilter::MipCount(faceSize), EnvironmentPrefilter::DefaultSampleCount,
+			threads, best, singleThreadMs / best, chain == reference ? "PASSED" : "FAILED");
+	}
+
+	// the lobe weights are normalized, a constant sky keeps its value in every mip
+	const UINT testSize = 64;
+	std::vector<float> constant((size_t)CubemapConverter::FaceCount * testSize * testSize * 4, 0.75f);
+	std::vector<uint16_t> constantFaces(constant.size());
+	ConvertFloatsToHalves(constant.data(), constant.size(), constantFaces.data());
+
+	std::vector<uint16_t> chain;
+	EnvironmentPrefilter::PrefilterSpecular(constantFaces.data(), testSize, testSize / 2, chain);
+	std::vector<float> values(chain.size());
+	ConvertHalvesToFloats(chain.data(), chain.size(), values.data());
+	float maxError = 0.0f;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		if (i % 4 != 3)
+			maxError = (std::max)(maxError, fabsf(values[i] - 0.75f));
+	}
+	BenchmarkLog("specular: constant sky, largest error in the mips %g, %s", maxError, maxError < 1e-3f ? "PASSED" : "FAILED");
+
+	std::vector<uint16_t> lutReference;
+	double lutSingleThreadMs = 0.0;
+	for (UINT threads = 1; threads <= WorkerThreadCount(); threads *= 2)
+	{
+		std::vector<uint16_t> lut;
+		BenchmarkTimer timer;
+		EnvironmentPrefilter::IntegrateBrdf(lutSize, lut, threads);
+		double ms = timer.ElapsedMs();
+
+		if (threads == 1)
+		{
+			lutReference = lut;
+			lutSingleThreadMs = ms;
+		}
+
+		BenchmarkLog("specular: BRDF lookup table %ux%u, %u samples, %u threads %.2f ms, %.2fx, %s",
+			lutSize, lutSize, EnvironmentPrefilter::DefaultLutSampleCount, threads, ms, lutSingleThreadMs / ms,
+			lut == lutReference ? "PASSED" : "FAILED");
+	}
+
+	// a smooth mirror seen head on reflects F0, scale + bias never goes above 1
+	std::vector<float> lut(lutReference.size());
+	ConvertHalvesToFloats(lutReference.data(), lutReference.size(), lut.data());
+	float mirror = lut[(lutSize - 1) * 2] + lut[(lutSize - 1) * 2 + 1];
+	float maxSum = 0.0f;
+	for (size_t i = 0; i < lut.size(); i += 2)
+	{
+		maxSum = (std::max)(maxSum, lut[i] + lut[i + 1]);
+	}
+	BenchmarkLog("specular: BRDF lookup table mirror scale + bias %.4f, largest %.4f, %s",
+		mirror, maxSum, mirror > 0.99f && maxSum < 1.001f ? "PASSED" : "FAILED");
+
+	// cold bakes write the caches, warm loads only hash the source and read them
+	std::string cacheFile = EnvironmentPrefilter::SpecularCacheFileName(fileName, faceSize);
+	remove(cacheFile.c_str());
+
+	std::vector<unsigned char> dds;
+	BenchmarkTimer timer;
+	bool cold = EnvironmentPrefilter::LoadSpecular(fileName, cubeFaceSize, faceSize, dds);
+	double coldMs = timer.ElapsedMs();
+
+	timer.Reset();
+	bool warm = EnvironmentPrefilter::LoadSpecular(fileName, cubeFaceSize, faceSize, dds);
+	double warmMs = timer.ElapsedMs();
+
+	BenchmarkLog("specular: %s cold bake %.2f ms, warm cache %.2f ms, %.1fx faster, %s",
+		cacheFile.c_str(), coldMs, warmMs, coldMs / warmMs, cold && warm ? "PASSED" : "FAILED");
+
+	std::string lutFile = "..\\Assets\\brdf_lut" + std::to_string(lutSize) + ".dds";
+	remove(lutFile.c_str());
+
+	timer.Reset();
+	cold = EnvironmentPrefilter::LoadBrdfLut(lutFile, lutSize, dds);
+	coldMs = timer.ElapsedMs();
+
+	timer.Reset();
+	warm = EnvironmentPrefilter::LoadBrdfLut(lutFile, lutSize, dds);
+	warmMs = timer.ElapsedMs();
+
+	BenchmarkLog("specular: %s cold bake %.2f ms, warm cache %.2f ms, %.1fx faster, %s",
+		lutFile.c_str(), coldMs, warmMs, coldMs / warmMs, cold && warm ? "PASSED" : "FAILED");
+}
+
+// PSNR of the first channels of RGBA8 texels
+static double Psnr(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b, int channels)
+{
+	double sum = 0.0;
+	size_t count = 0;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if ((int)(i % 4) >= channels)
+			continue;
+		double d = (double)a[i] - (double)b[i];
+		sum += d * d;
+		++count;
+	}
+	return sum > 0.0 ? 10.0 * log10(255.0 * 255.0 * count / sum) : 99.0;
+}
+
+// Block compression of synthetic color and normal textures and of the sky cube: encode throughput
+// against the thread count, SSE2 against scalar, PSNR and the memory saved per texture
+static void BenchBlockCompression()
+{
+	const UINT size = 1024;
+	const int runs = 2;
+
+	// smooth color, hard edges and an alpha ramp; a normal map of a bumpy height field
+	std::vector<unsigned char> color((size_t)size * size * 4), normals((size_t)size * size * 4);
+	for (UINT y = 0; y < size; ++y)
+	{
+		for (UINT x = 0; x < size; ++x)
+		{
+			float u = x / (float)size, v = y / (float)size;
+			unsigned char* c = &color[((size_t)y * size + x) * 4];
+			c[0] = (unsigned char)(127.5f + 127.5f * sinf(u * 20.0f + v * 3.0f));
+			c[1] = (unsigned char)(255.0f * v);
+			c[2] = ((x / 32 + y / 32) & 1) ? 200 : 40;
+			c[3] = (unsigned char)(255.0f * u);
+
+			float dx = 0.5f * cosf(u * 300.0f) * sinf(v * 170.0f), dy = -0.3f * sinf(u * 300.0f) * cosf(v * 170.0f);
+			float length = sqrtf(dx * dx + dy * dy + 1.0f);
+			unsigned char* n = &normals[((size_t)y * size + x) * 4];
+			n[0] = (unsigned char)(127.5f + 127.5f * dx / length);
+			n[1] = (unsigned char)(127.5f + 127.5f * dy / length);
+			n[2] = (unsigned char)(127.5f + 127.5f / length);
+			n[3] = 255;
+		}
+	}
+
+	struct Test { BlockFormat format; const char* name; const std::vector<unsigned char>* texels; int channels; double minPsnr; };
+	const Test tests[] =
+	{
+		{ BLOCK_BC1, "BC1", &color, 3, 35.0 },
+		{ BLOCK_BC3, "BC3", &color, 4, 35.0 },
+		{ BLOCK_BC5, "BC5", &normals, 2, 40.0 },
+	};
+
+	for (const Test& test : tests)
+	{
+		std::vector<unsigned char> reference;
+		double singleThreadMs = 0.0;
+		for (UINT threads = 1; threads <= WorkerThreadCount(); threads *= 2)
+		{
+			std::vector<unsigned char> blocks;
+			double best = DBL_MAX;
+			for (int run = 0; run < runs; ++run)
+			{
+				BenchmarkTimer timer;
+				BlockCompressor::Compress(test.format, test.texels->data(), size, size, blocks, threads);
+				best = (std::min)(best, timer.ElapsedMs());
+			}
+
+			if (threads == 1)
+			{
+				reference = blocks;
+				singleThreadMs = best;
+			}
+
+			BenchmarkLog("bc: %s %ux%u, %u threads %.2f ms, %.1f MPixels/s, %.2fx, %s", test.name, size, size, threads, best,
+				size * size / (best * 1000.0), singleThreadMs / best, blocks == reference ? "PASSED" : "FAILED");
+		}
+
+		std::vector<unsigned char> decoded;
+		BlockCompressor::Decompress(test.format, reference.data(), size, size, decoded);
+		double psnr = Psnr(*test.texels, decoded, test.channels);
+		BenchmarkLog("bc: %s PSNR %.2f dB, %u KB to %u KB, %u KB saved, %s", test.name, psnr,
+			(UINT)(test.texels->size() / 1024), (UINT)(reference.size() / 1024), (UINT)((test.texels->size() - reference.size()) / 1024),
+			psnr > test.minPsnr ? "PASSED" : "FAILED");
+	}
+
+	// the SSE2 endpoint search against the scalar reference, block by block
+	const UINT blocksX = size / 4;
+	const UINT blockCount = blocksX * blocksX;
+	std::vector<unsigned char> sse2Blocks(blockCount * 8), scalarBlocks(blockCount * 8);
+	std::vector<unsigned char> texels((size_t)blockCount * 64);
+	for (UINT b = 0; b < blockCount; ++b)
+	{
+		for (UINT y = 0; y < 4; ++y)
+		{
+			memcpy(&texels[(size_t)b * 64 + y * 16], &color[(((size_t)(b / blocksX) * 4 + y) * size + (b % blocksX) * 4) * 4], 16);
+		}
+	}
+
+	BenchmarkTimer timer;
+	for (UINT b = 0; b < blockCount; ++b)
+	{
+		BlockCompressor::EncodeBC1BlockScalar(&texels[(size_t)b * 64], &scalarBlocks[(size_t)b * 8]);
+	}
+	double scalarMs = timer.ElapsedMs();
+
+	timer.Reset();
+	for (UINT b = 0; b < blockCount; ++b)
+	{
+		BlockCompressor::EncodeBC1Block(&texels[(size_t)b * 64], &sse2Blocks[(size_t)b * 8]);
+	}
+	double sse2Ms = timer.ElapsedMs();
+
+	BenchmarkLog("bc: BC1 blocks scalar %.2f ms, sse2 %.2f ms, %.2fx, %s", scalarMs, sse2Ms, scalarMs / sse2Ms,
+		sse2Blocks == scalarBlocks ? "PASSED" : "FAILED");
+
+	// the cooked sky cube as BC6H
+	const char* fileName = "..\\Assets\\approaching_storm_1k.hdr";
+	const UINT cubeFaceSize = 512;
+	std::vector<unsigned char> cube;
+	if (!CubemapConverter::LoadCubemap(fileName, cubeFaceSize, cube))
+	{
+		BenchmarkLog("bc: could not read %s", fileName);
+		return;
+	}
+
+	std::vector<unsigned char> reference;
+	double singleThreadMs = 0.0;
+	for (UINT threads = 1; threads <= WorkerThreadCount(); threads *= 2)
+	{
+		std::vector<unsigned char> dds;
+		timer.Reset();
+		BlockCompressor::CompressHalfDds(cube, dds, threads);
+		double ms = timer.ElapsedMs();
+
+		if (threads == 1)
+		{
+			reference = dds;
+			singleThreadMs = ms;
+		}
+
+		BenchmarkLog("bc: BC6H sky cube %u, %u threads %.2f ms, %.1f MPixels/s, %.2fx, %s", cubeFaceSize, threads, ms,
+			CubemapConverter::FaceCount * cubeFaceSize * cubeFaceSize / (ms * 1000.0), singleThreadMs / ms,
+			dds == reference && !dds.empty() ? "PASSED" : "FAILED");
+	}
+
+	// PSNR of the Reinhard tone mapped radiance, bright sky texels weigh as much as dark ones
+	CookedDds desc;
+	if (!CubemapConverter::ReadDdsDesc(reference, desc))
+	{
+		BenchmarkLog("bc: BC6H sky cube is not a cooked .dds, FAILED");
+		return;
+	}
+
+	const size_t faceTexels = (size_t)cubeFaceSize * cubeFaceSize * 4;
+	std::vector<unsigned char> source(faceTexels * CubemapConverter::FaceCount), decoded(source.size());
+	std::vector<float> values(faceTexels);
+	std::vector<uint16_t> halves;
+	for (UINT face = 0; face < CubemapConverter::FaceCount; ++face)
+	{
+		const uint16_t* faces = (const uint16_t*)(cube.data() + CubemapConverter::DdsHeaderSize);
+		BlockCompressor::DecompressHalf(reference.data() + desc.HeaderSize() + face * desc.MipSize(0), cubeFaceSize, cubeFaceSize, halves);
+
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			ConvertHalvesToFloats(pass == 0 ? faces + face * faceTexels : halves.data(), faceTexels, values.data());
+			unsigned char* out = (pass == 0 ? source.data() : decoded.data()) + face * faceTexels;
+			for (size_t i = 0; i < faceTexels; ++i)
+			{
+				out[i] = (unsigned char)(255.0f * values[i] / (1.0f + values[i]) + 0.5f);
+			}
+		}
+	}
+
+	double psnr = Psnr(source, decoded, 3);
+	BenchmarkLog("bc: BC6H sky cube PSNR %.2f dB tone mapped, %u KB to %u KB, %u KB saved, %s", psnr,
+		(UINT)(cube.size() / 1024), (UINT)(reference.size() / 1024), (UINT)((cube.size() - reference.size()) / 1024),
+		psnr > 40.0 ? "PASSED" : "FAILED");
+
+	// cold compressions write the cache, warm loads read it
+	std::string cacheFile = BlockCompressor::CacheFileName(CubemapConverter::CacheFileName(fileName, cubeFaceSize), BLOCK_BC6H);
+	remove(cacheFile.c_str());
+
+	std::vector<unsigned char> dds;
+	timer.Reset();
+	bool cold = BlockCompressor::LoadHalfDds(cacheFile, cube, dds);
+	double coldMs = timer.ElapsedMs();
+
+	timer.Reset();
+	bool warm = BlockCompressor::LoadHalfDds(cacheFile, cube, dds);
+	double warmMs = timer.ElapsedMs();
+
+	BenchmarkLog("bc: %s cold compression %.2f ms, warm cache %.2f ms, %.1fx faster, %s",
+		cacheFile.c_str(), coldMs, warmMs, coldMs / warmMs, cold && warm && dds == reference ? "PASSED" : "FAILED");
+}
+
+// Gamma correct mip chains of 1K, 4K and 8K textures: box and Kaiser filters per kernel
+// and against the thread count, every kernel and thread count has to give the same bytes
+static void BenchMips()
+{
+	const UINT sizes[] = { 1024, 4096, 8192 };
+	const char* filterNames[] = { "box", "kaiser" };
+	const char* kernelNames[] = { "", "scalar", "sse2", "avx2" };
+
+	for (UINT size : sizes)
+	{
+		// smooth color, hard edges and fine detail that aliases without filtering
+		std::vector<unsigned char> texels((size_t)size * size * 4);
+		for (UINT y = 0; y < size; ++y)
+		{
+			for (UINT x = 0; x < size; ++x)
+			{
+				float u = x / (float)size, v = y / (float)size;
+				unsigned char* c = &texels[((size_t)y * size + x) * 4];
+				c[0] = (unsigned char)(127.5f + 127.5f * sinf(u * 20.0f + v * 3.0f));
+				c[1] = ((x ^ y) & 1) ? 255 : 0;
+				c[2] = ((x / 32 + y / 32) & 1) ? 200 : 40;
+				c[3] = 255;
+			}
+		}
+
+		const int runs = size > 4096 ? 1 : 2;
+		for (int filter = MIP_FILTER_BOX; filter <= MIP_FILTER_KAISER; ++filter)
+		{
+			std::vector<unsigned char> reference;
+			for (int kernel = MIP_KERNEL_SCALAR; kernel <= MIP_KERNEL_AVX2; ++kernel)
+			{
+				if (MipGenerator::GetKernel((MipKernel)kernel) != kernel)
+					continue;
+
+				std::vector<unsigned char> chain;
+				double best = DBL_MAX;
+				for (int run = 0; run < runs; ++run)
+				{
+					BenchmarkTimer timer;
+					MipGenerator::Generate(texels.data(), size, size, true, (MipFilter)filter, chain, 1, (MipKernel)kernel);
+					best = (std::min)(best, timer.ElapsedMs());
+				}
+
+				if (reference.empty())
+					reference = chain;
+
+				BenchmarkLog("mips: %ux%u %s %s, %u mips, 1 thread %.2f ms, %.1f MPixels/s, %s", size, size, filterNames[filter],
+					kernelNames[kernel], MipGenerator::MipCount(size, size), best, size * size / (best * 1000.0),
+					chain == reference ? "PASSED" : "FAILED");
+			}
+
+			double singleThreadMs = 0.0;
+			for (UINT threads = 1; threads <= WorkerThreadCount(); threads *= 2)
+			{
+				std::vector<unsigned char> chain;
+				double best = DBL_MAX;
+				for (int run = 0; run < runs; ++run)
+				{
+					BenchmarkTimer timer;
+					MipGenerator::Generate(texels.data(), size, size, true, (MipFilter)filter, chain, threads);
+					best = (std::min)(best, timer.ElapsedMs());
+				}
+
+				if (threads == 1)
+					singleThreadMs = best;
+
+				BenchmarkLog("mips: %ux%u %s %s, %u threads %.2f ms, %.2fx, %s", size, size, filterNames[filter],
+					kernelNames[MipGenerator::GetKernel()], threads, best, singleThreadMs / best, chain == reference ? "PASSED" : "FAILED");
+			}
+		}
+	}
+
+	// black and white texels average to half the light, sRGB 188 and not 128
+	const UINT testSize = 64;
+	std::vector<unsigned char> checker((size_t)testSize * testSize * 4), constant(checker.size(), 77);
+	for (size_t i = 0; i < checker.size(); ++i)
+	{
+		size_t texel = i / 4;
+		checker[i] = ((texel % testSize + texel / testSize) & 1) ? 255 : 0;
+	}
+
+	std::vector<unsigned char> chain;
+	MipGenerator::Generate(checker.data(), testSize, testSize, true, MIP_FILTER_BOX, chain);
+	const unsigned char* mip1 = &chain[MipGenerator::MipOffset(testSize, testSize, 1)];
+	BenchmarkLog("mips: checkerboard mip 1 color %d, alpha %d, %s", mip1[0], mip1[3], mip1[0] == 188 && mip1[3] == 128 ? "PASSED" : "FAILED");
+
+	// the Kaiser weights add up to 1, a constant texture keeps its value in every mip
+	MipGenerator::Generate(constant.data(), testSize, testSize, true, MIP_FILTER_KAISER, chain);
+	size_t changed = 0;
+	for (unsigned char value : chain)
+	{
+		changed += value != 77;
+	}
+	BenchmarkLog("mips: constant texture, %zu of %zu bytes changed, %s", changed, chain.size(), changed == 0 ? "PASSED" : "FAILED");
+}
+
+// Texture lookups of 10k draws per frame: the string keyed map the renderer used before
+// against the interned handles materials hold now
+static void BenchTextureHandles()
+{
+	const UINT objectCount = 10000;
+	const UINT textureCount = 500;
+	const int frames = 100;
+
+	std::vector<std::string> names(textureCount);
+	for (UINT i = 0; i < textureCount; ++i)
+	{
+		names[i] = "..\\Assets\\Textures\\material_" + std::to_string(i) + "_diffuse.png";
+	}
+
+	// the texture of every object, as the materials hold it
+	std::vector<std::string> objectNames(objectCount);
+	std::vector<TextureHandle> objectHandles(objectCount);
+	TextureManager* textures = TextureManager::Instance();
+	for (UINT i = 0; i < objectCount; ++i)
+	{
+		objectNames[i] = names[(i * 7919) % textureCount];
+		objectHandles[i] = textures->GetHandle(objectNames[i]);
+	}
+
+	// before: a locked std::map<std::string, SRV*> taking the name by value
+	std::map<std::string, ID3D11ShaderResourceView*> map;
+	std::mutex mutex;
+	for (const std::string& name : names)
+	{
+		map[name] = NULL;
+	}
+	auto mapLookup = [&](std::string name)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = map.find(name);
+		return it != map.end() ? it->second : NULL;
+	};
+
+	size_t found = 0;
+	BenchmarkTimer timer;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		for (UINT i = 0; i < objectCount; ++i)
+		{
+			found += mapLookup(objectNames[i]) == NULL;
+		}
+	}
+	double mapMs = timer.ElapsedMs() / frames;
+
+	timer.Reset();
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		for (UINT i = 0; i < objectCount; ++i)
+		{
+			found += textures->GetTexture(objectNames[i]) == NULL;
+		}
+	}
+	double hashMs = timer.ElapsedMs() / frames;
+
+	timer.Reset();
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		for (UINT i = 0; i < objectCount; ++i)
+		{
+			found += textures->GetTexture(objectHandles[i]) == NULL;
+		}
+	}
+	double handleMs = timer.ElapsedMs() / frames;
+
+	BenchmarkLog("textures: %u draws of %u textures, string map %.3f ms (%.1f ns per draw), hashed name %.3f ms (%.1f ns), "
+		"handle %.3f ms (%.1f ns), %.0fx faster", objectCount, textureCount, mapMs, mapMs * 1e6 / objectCount,
+		hashMs, hashMs * 1e6 / objectCount, handleMs, handleMs * 1e6 / objectCount, mapMs / handleMs);
+
+	// every name keeps its handle and the table stays short to walk
+	size_t mismatches = 0;
+	for (UINT i = 0; i < objectCount; ++i)
+	{
+		mismatches += textures->GetHandle(objectNames[i]) != objectHandles[i];
+	}
+
+	StringTable table;
+	for (const std::string& name : names)
+	{
+		table.Intern(name);
+	}
+	for (UINT i = 0; i < textureCount; ++i)
+	{
+		mismatches += table.Find(names[i]) != i + 1 || table.GetString(i + 1) != names[i];
+	}
+	mismatches += table.Find("..\\Assets\\missing.png") != StringTable::InvalidHandle;
+
+	BenchmarkLog("textures: %zu lookups, %zu mismatched handles, %.2f probes per lookup, %s", found, mismatches,
+		table.AverageProbeCount(), mismatches == 0 && found == (size_t)frames * objectCount * 3 ? "PASSED" : "FAILED");
+}
+
+// objects not outside any plane, one box after the other as the scene did before
+static void BvhBruteForceCull(const std::vector<BvhBounds>& bounds, const float planes[6][4], std::vector<uint32_t>& visible)
+{
+	visible.clear();
+	for (uint32_t object = 0; object < bounds.size(); ++object)
+	{
+		const BvhBounds& box = bounds[object];
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; ++p)
+		{
+			const float* plane = planes[p];
+			float x = plane[0] >= 0.0f ? box.max[0] : box.min[0];
+			float y = plane[1] >= 0.0f ? box.max[1] : box.min[1];
+			float z = plane[2] >= 0.0f ? box.max[2] : box.min[2];
+			outside = ((plane[0] * x + plane[1] * y) + plane[2] * z) + plane[3] < 0.0f;
+		}
+		if (!outside)
+			visible.push_back(object);
+	}
+}
+
+// 4x4 row major c = a * b, for the view projection of -bench occlusion
+static void BenchMultiply4x4(const float* a, const float* b, float* c)
+{
+	for (int r = 0; r < 4; ++r)
+	{
+		for (int col = 0; col < 4; ++col)
+		{
+			c[r * 4 + col] = ((a[r * 4] * b[col] + a[r * 4 + 1] * b[4 + col]) + a[r * 4 + 2] * b[8 + col]) + a[r * 4 + 3] * b[12 + col];
+		}
+	}
+}
+
+// the packets of one synthetic pass, the same for the same pass and count
+static void BenchCommandPass(uint32_t pass, uint32_t count, RenderQueue& queue)
+{
+	uint32_t seed = pass * 7919u + 1;
+	auto random = [&seed]()
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return seed >> 8;
+	};
+
+	queue.Clear();
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		DrawPacket packet;
+		packet.pass = pass;
+		packet.shader = random() % 2;
+		packet.texture = pass == 0 ? random() % 256 : 0;
+		packet.mesh = i / 8;
+		packet.constants = i / 8;
+		packet.material = pass == 0 ? i % 8 : 0;
+		packet.rangeOffset = i;
+		packet.rangeCount = 1;
+		packet.key = RenderQueue::MakeKey(packet.pass, packet.shader, packet.texture, packet.mesh, packet.material,
+			(random() & 0xffff) / 65535.0f);
+		queue.Submit(packet);
+	}
+	queue.Sort();
+}
+
+static bool BenchSameDraws(const RecordingRenderBackend& a, const RecordingRenderBackend& b)
+{
+	const std::vector<RecordingRenderBackend::Call>& callsA = a.GetCalls();
+	const std::vector<RecordingRenderBackend::Call>& callsB = b.GetCalls();
+	if (callsA.size() != callsB.size() || a.GetDraws().size() != b.GetDraws().size())
+		return false;
+	for (size_t i = 0; i < callsA.size(); ++i)
+	{
+		if (callsA[i].command != callsB[i].command || callsA[i].value != callsB[i].value)
+			return false;
+	}
+	return a.GetDraws().empty() ||
+		memcmp(a.GetDraws().data(), b.GetDraws().data(), a.GetDraws().size() * sizeof(RecordingRenderBackend::DrawState)) == 0;
+}
+
+static void BenchCommandBuffers()
+{
+	// a GBuffer pass and six shadow passes of a quarter of its draws each
+	const uint32_t counts[] = { 10000, 100000 };
+	const uint32_t passCount = 7;
+	const int frames = 10;
+	bool passed = true;
+
+	for (uint32_t count : counts)
+	{
+		std::vector<uint32_t> passDraws(passCount);
+		size_t totalDraws = 0;
+		for (uint32_t pass = 0; pass < passCount; ++pass)
+		{
+			passDraws[pass] = pass == 0 ? count : count / 4;
+			totalDraws += passDraws[pass];
+		}
+
+		// the passes built and executed straight into the backend, one after the other
+		std::vector<RenderQueue> queues(passCount);
+		RecordingRenderBackend reference;
+		NullRenderBackend nullBackend;
+		double directMs = 0.0;
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			BenchmarkTimer timer;
+			for (uint32_t pass = 0; pass < passCount; ++pass)
+			{
+				BenchCommandPass(pass, passDraws[pass], queues[pass]);
+				queues[pass].Execute(nullBackend);
+			}
+			directMs += timer.ElapsedMs();
+		}
+		for (uint32_t pass = 0; pass < passCount; ++pass)
+		{
+			queues[pass].Execute(reference);
+		}
+		BenchmarkLog("commands: %zu draws in %u passes, built and executed on one thread %.3f ms", totalDraws, passCount, directMs / frames);
+
+		// recorded into a command buffer per pass on worker threads, then replayed in pass order
+		std::vector<std::vector<uint32_t>> referenceWords;
+		for (unsigned int threads = 1; threads <= passCount; threads = threads < WorkerThreadCount() ? WorkerThreadCount() : threads + 3)
+		{
+			std::vector<CommandBuffer> buffers(passCount);
+			double recordMs = 0.0, replayMs = 0.0;
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				BenchmarkTimer timer;
+				ParallelFor(passCount, 1, threads, [&](size_t begin, size_t end)
+				{
+					for (size_t pass = begin; pass < end; ++pass)
+					{
+						BenchCommandPass((uint32_t)pass, passDraws[pass], queues[pass]);
+						buffers[pass].Reset();
+						queues[pass].Execute(buffers[pass]);
+					}
+				});
+				recordMs += timer.ElapsedMs();
+
+				timer.Reset();
+				NullRenderBackend replayBackend;
+				for (const CommandBuffer& buffer : buffers)
+				{
+					buffer.Replay(replayBackend);
+				}
+				replayMs += timer.ElapsedMs();
+			}
+
+			// the replay makes the same calls as executing the queues, whatever the threads
+			RecordingRenderBackend replayed;
+			std::vector<std::vector<uint32_t>> words;
+			size_t commandCount = 0, sizeBytes = 0;
+			for (const CommandBuffer& buffer : buffers)
+			{
+				buffer.Replay(replayed);
+				words.push_back(buffer.GetWords());
+				commandCount += buffer.GetCommandCount();
+				sizeBytes += buffer.GetSizeBytes();
+			}
+			if (referenceWords.empty())
+				referenceWords = words;
+			bool same = BenchSameDraws(reference, replayed) && words == referenceWords;
+			passed &= same;
+
+			BenchmarkLog("commands: %zu draws in %u passes, %u threads, record %.3f ms, replay %.3f ms, %zu commands, %.1f MB, %s",
+				totalDraws, passCount, threads, recordMs / frames, replayMs / frames, commandCount, sizeBytes / 1048576.0,
+				same ? "PASSED" : "FAILED");
+		}
+	}
+
+	BenchmarkLog("commands: %s", passed ? "PASSED" : "FAILED");
+}
+
+// planes of a frustum looking along forward from position, square with the half angle
+// tangent, up any axis perpendicular to forward; like a shadow map projection
+static void ShadowFrustumPlanes(const float position[3], const float forward[3], const float up[3], float tangent, float nearZ,
+	float farZ, float planes[6][4])
+{
+	float right[3] = { up[1] * forward[2] - up[2] * forward[1], up[2] * forward[0] - up[0] * forward[2], up[0] * forward[1] - up[1] * forward[0] };
+	const float* sides[4] = { right, right, up, up };
+	const float signs[4] = { 1.0f, -1.0f, 1.0f, -1.0f };
+	float length = sqrtf(1.0f + tangent * tangent);
+	for (int p = 0; p < 4; ++p)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			planes[p][axis] = (signs[p] * sides[p][axis] + tangent * forward[axis]) / length;
+		}
+	}
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		planes[4][axis] = forward[axis];
+		planes[5][axis] = -forward[axis];
+	}
+	for (int p = 0; p < 6; ++p)
+	{
+		planes[p][3] = -(planes[p][0] * position[0] + planes[p][1] * position[1] + planes[p][2] * position[2]);
+	}
+	planes[4][3] -= nearZ;
+	planes[5][3] += farZ;
+}
+
+// planes of a box along the light direction, like a cascade; extended leaves out the near
+// plane so the box reaches back to the light
+static void ShadowCascadePlanes(const float center[3], const float direction[3], const float side[3], float halfSize, float halfDepth,
+	bool extended, float planes[6][4])
+{
+	float up[3] = { side[1] * direction[2] - side[2] * direction[1], side[2] * direction[0] - side[0] * direction[2],
+		side[0] * direction[1] - side[1] * direction[0] };
+	const float* axes[3] = { side, up, direction };
+	const float halfSizes[3] = { halfSize, halfSize, halfDepth };
+	for (int a = 0; a < 3; ++a)
+	{
+		float centerDistance = axes[a][0] * center[0] + axes[a][1] * center[1] + axes[a][2] * center[2];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			planes[2 * a][axis] = axes[a][axis];
+			planes[2 * a + 1][axis] = -axes[a][axis];
+		}
+		planes[2 * a][3] = halfSizes[a] - centerDistance;
+		planes[2 * a + 1][3] = halfSizes[a] + centerDistance;
+	}
+	if (extended)
+	{
+		planes[4][0] = planes[4][1] = planes[4][2] = 0.0f;
+		planes[4][3] = 1.0f;
+	}
+}
+
+// Shadow caster culling of 100k boxes: a spot light frustum, the six faces of a point
+// light and three cascades extended toward the light, SceneBvh::CullUnion against a
+// brute force loop over every frustum
+static void BenchShadowCulling()
+{
+	const uint32_t objectCount = 100000;
+	const float worldSize = 2000.0f;
+	const int frames = 16;
+
+	uint32_t seed = 1;
+	auto random = [&seed]()
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (1.0f / 16777216.0f);
+	};
+
+	std::vector<BvhBounds> bounds(objectCount);
+	for (BvhBounds& box : bounds)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float center = (random() - 0.5f) * worldSize;
+			float extent = 0.25f + 2.25f * random();
+			box.min[axis] = center - extent;
+			box.max[axis] = center + extent;
+		}
+	}
+
+	// a box between the light and the first cascade, behind all of them, only the
+	// extended cascades keep it
+	const float lightDirection[3] = { 0.0f, -0.8f, 0.6f };
+	const float side[3] = { 1.0f, 0.0f, 0.0f };
+	const uint32_t blocker = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float center = (axis == 2 ? 25.0f : 0.0f) - lightDirection[axis] * 1500.0f;
+		bounds[blocker].min[axis] = center - 2.0f;
+		bounds[blocker].max[axis] = center + 2.0f;
+	}
+
+	SceneBvh bvh;
+	bvh.Build(bounds.data(), bounds.size());
+
+	struct ShadowPass
+	{
+		const char* name;
+		int frustumCount;
+		float planes[6][6][4];
+	};
+	std::vector<ShadowPass> passes(4);
+
+	const float spotPosition[3] = { 100.0f, 50.0f, -200.0f };
+	const float spotForward[3] = { 0.0f, 0.0f, 1.0f };
+	const float spotUp[3] = { 0.0f, 1.0f, 0.0f };
+	passes[0].name = "spot";
+	passes[0].frustumCount = 1;
+	ShadowFrustumPlanes(spotPosition, spotForward, spotUp, tanf(0.4f), 5.0f, 400.0f, passes[0].planes[0]);
+
+	// cube faces +X, -X, +Y, -Y, +Z, -Z
+	const float pointPosition[3] = { -300.0f, 0.0f, 250.0f };
+	const float faceForward[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	const float faceUp[6][3] = { { 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1, 0 } };
+	passes[1].name = "point";
+	passes[1].frustumCount = 6;
+	for (int face = 0; face < 6; ++face)
+	{
+		ShadowFrustumPlanes(pointPosition, faceForward[face], faceUp[face], 1.0f, 5.0f, 300.0f, passes[1].planes[face]);
+	}
+
+	// cascades growing along the view, around the world origin
+	for (int extended = 0; extended < 2; ++extended)
+	{
+		ShadowPass& pass = passes[2 + extended];
+		pass.name = extended ? "cascades extended" : "cascades";
+		pass.frustumCount = 3;
+		for (int cascade = 0; cascade < 3; ++cascade)
+		{
+			float halfSize = 50.0f * (float)(1 << (2 * cascade));
+			float center[3] = { 0.0f, 0.0f, halfSize * 0.5f };
+			ShadowCascadePlanes(center, lightDirection, side, halfSize, halfSize, extended != 0, pass.planes[cascade]);
+		}
+	}
+
+	bool passed = true;
+	std::vector<uint32_t> casters, frustumObjects, reference;
+	std::vector<uint8_t> marks(objectCount);
+	for (const ShadowPass& pass : passes)
+	{
+		// every box tested against every frustum, then the union in id order
+		double bruteMs = 0.0;
+		uint32_t bruteFrustumCounts[6];
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			BenchmarkTimer timer;
+			std::fill(marks.begin(), marks.end(), 0);
+			for (int f = 0; f < pass.frustumCount; ++f)
+			{
+				BvhBruteForceCull(bounds, pass.planes[f], frustumObjects);
+				bruteFrustumCounts[f] = (uint32_t)frustumObjects.size();
+				for (uint32_t object : frustumObjects)
+				{
+					marks[object] = 1;
+				}
+			}
+			reference.clear();
+			for (uint32_t object = 0; object < objectCount; ++object)
+			{
+				if (marks[object])
+					reference.push_back(object);
+			}
+			bruteMs += timer.ElapsedMs();
+		}
+
+		double bvhMs = 0.0;
+		uint32_t frustumCounts[6];
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			BenchmarkTimer timer;
+			bvh.CullUnion(pass.planes, pass.frustumCount, casters, frustumCounts);
+			bvhMs += timer.ElapsedMs();
+		}
+
+		bool same = casters == reference;
+		for (int f = 0; f < pass.frustumCount; ++f)
+		{
+			same &= frustumCounts[f] == bruteFrustumCounts[f];
+		}
+		passed &= same;
+
+		char faces[128] = "";
+		for (int f = 0; f < pass.frustumCount && pass.frustumCount > 1; ++f)
+		{
+			snprintf(faces + strlen(faces), sizeof(faces) - strlen(faces), "%s%u", f == 0 ? ", per frustum " : " ", frustumCounts[f]);
+		}
+		BenchmarkLog("shadowcull: %s, %zu casters, %zu culled%s, brute force %.3f ms, bvh %.3f ms, %.1fx, %s", pass.name, casters.size(),
+			objectCount - casters.size(), faces, bruteMs / frames, bvhMs / frames, bruteMs / bvhMs, same ? "PASSED" : "FAILED");
+	}
+
+	// the box between the light and the cascades casts into them only when they are extended
+	bvh.CullUnion(passes[2].planes, passes[2].frustumCount, casters);
+	bool blockerCulled = std::find(casters.begin(), casters.end(), blocker) == casters.end();
+	bvh.CullUnion(passes[3].planes, passes[3].frustumCount, casters);
+	bool blockerKept = std::find(casters.begin(), casters.end(), blocker) != casters.end();
+	passed &= blockerCulled && blockerKept;
+	BenchmarkLog("shadowcull: caster toward the light %s by the cascades, %s by the extended cascades, %s", blockerCulled ? "culled" : "kept",
+		blockerKept ? "kept" : "culled", blockerCulled && blockerKept ? "PASSED" : "FAILED");
+
+	BenchmarkLog("shadowcull: %s", passed ? "PASSED" : "FAILED");
+}
+
+// row major view projection of a camera at position looking along yaw and pitch, row vectors
+static void OcclusionViewProj(const float position[3], float yaw, float pitch, float fovY, float aspect, float nearZ, float farZ,
+	float viewProj[16])
+{
+	float forward[3] = { sinf(yaw) * cosf(pitch), sinf(pitch), cosf(yaw) * cosf(pitch) };
+	float right[3] = { cosf(yaw), 0.0f, -sinf(yaw) };
+	float up[3] =
+	{
+		forward[1] * right[2] - forward[2] * right[1],
+		forward[2] * right[0] - forward[0] * right[2],
+		forward[0] * right[1] - forward[1] * right[0]
+	};
+
+	float view[16] = {};
+	const float* axes[3] = { right, up, forward };
+	for (int column = 0; column < 3; ++column)
+	{
+		for (int row = 0; row < 3; ++row)
+		{
+			view[row * 4 + column] = axes[column][row];
+		}
+		view[12 + column] = -(axes[column][0] * position[0] + axes[column][1] * position[1] + axes[column][2] * position[2]);
+	}
+	view[15] = 1.0f;
+
+	float yScale = 1.0f / tanf(0.5f * fovY);
+	float proj[16] = {};
+	proj[0] = yScale / aspect;
+	proj[5] = yScale;
+	proj[10] = farZ / (farZ - nearZ);
+	proj[11] = 1.0f;
+	proj[14] = -nearZ * farZ / (farZ - nearZ);
+
+	BenchMultiply4x4(view, proj, viewProj);
+}
+
+// Per pixel depth of the front faces in front of the near plane, pixel centers inside
+// the triangle; the exact buffer the occlusion culler approximates
+static void OcclusionReferenceRaster(const std::vector<float>& positions, const std::vector<uint32_t>& indices, const float viewProj[16],
+	int width, int height, std::vector<float>& depth)
+{
+	std::vector<float> screen(positions.size() / 3 * 4);
+	for (size_t v = 0; v < positions.size() / 3; ++v)
+	{
+		const float* p = &positions[v * 3];
+		float clip[4];
+		for (int c = 0; c < 4; ++c)
+		{
+			clip[c] = p[0] * viewProj[c] + p[1] * viewProj[4 + c] + p[2] * viewProj[8 + c] + viewProj[12 + c];
+		}
+		float* s = &screen[v * 4];
+		s[3] = clip[2] >= 0.0f && clip[3] > 0.0f ? 1.0f : 0.0f;
+		s[0] = (clip[0] / clip[3] * 0.5f + 0.5f) * width;
+		s[1] = (0.5f - clip[1] / clip[3] * 0.5f) * height;
+		s[2] = clip[2] / clip[3];
+	}
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const float* v[3] = { &screen[indices[i] * 4], &screen[indices[i + 1] * 4], &screen[indices[i + 2] * 4] };
+		if (v[0][3] == 0.0f || v[1][3] == 0.0f || v[2][3] == 0.0f)
+			continue;
+		float area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[2][0] - v[0][0]) * (v[1][1] - v[0][1]);
+		if (!(area > 0.0f))
+			continue;
+
+		int x0 = (std::max)(0, (int)std::floor(std::min(v[0][0], (std::min)(v[1][0], v[2][0]))));
+		int x1 = (std::min)(width - 1, (int)std::ceil(std::max(v[0][0], (std::max)(v[1][0], v[2][0]))));
+		int y0 = (std::max)(0, (int)std::floor(std::min(v[0][1], (std::min)(v[1][1], v[2][1]))));
+		int y1 = (std::min)(height - 1, (int)std::ceil(std::max(v[0][1], (std::max)(v[1][1], v[2][1]))));
+		for (int y = y0; y <= y1; ++y)
+		{
+			for (int x = x0; x <= x1; ++x)
+			{
+				float px = x + 0.5f, py = y + 0.5f;
+				float b[3];
+				for (int e = 0; e < 3; ++e)
+				{
+					const float* a = v[(e + 1) % 3];
+					const float* c = v[(e + 2) % 3];
+					b[e] = ((c[0] - a[0]) * (py - a[1]) - (c[1] - a[1]) * (px - a[0])) / area;
+				}
+				if (b[0] < 0.0f || b[1] < 0.0f || b[2] < 0.0f)
+					continue;
+				float z = b[0] * v[0][2] + b[1] * v[1][2] + b[2] * v[2][2];
+				float& pixel = depth[y * width + x];
+				pixel = (std::min)(pixel, z);
+			}
+		}
+	}
+}
+
+// a box is hidden by the reference buffer when every pixel its screen rect touches is nearer
+static bool OcclusionReferenceVisible(const BvhBounds& box, const float viewProj[16], int width, int height, const std::vector<float>& depth)
+{
+	float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		float p[3] = { box.min[0], box.min[1], box.min[2] };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (corner & (1 << axis))
+				p[axis] = box.max[axis];
+		}
+		float clip[4];
+		for (int c = 0; c < 4; ++c)
+		{
+			clip[c] = p[0] * viewProj[c] + p[1] * viewProj[4 + c] + p[2] * viewProj[8 + c] + viewProj[12 + c];
+		}
+		if (clip[3] <= 1e-5f || clip[2] < 0.0f)
+			return true;
+		float x = (clip[0] / clip[3] * 0.5f + 0.5f) * width;
+		float y = (0.5f - clip[1] / clip[3] * 0.5f) * height;
+		minX = (std::min)(minX, x);
+		maxX = (std::max)(maxX, x);
+		minY = (std::min)(minY, y);
+		maxY = (std::max)(maxY, y);
+		minZ = (std::min)(minZ, clip[2] / clip[3]);
+	}
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+		return true;
+
+	for (int y = (std::max)(0, (int)minY); y <= (std::min)(height - 1, (int)maxY); ++y)
+	{
+		for (int x = (std::max)(0, (int)minX); x <= (std::min)(width - 1, (int)maxX); ++x)
+		{
+			if (minZ <= depth[y * width + x])
+				return true;
+		}
+	}
+	return false;
+}
+
+// Occlusion culling of a city of GeometryGenerator boxes from street level: the nearest
+// buildings occlude all of them. Checks that the culler hides no box the exact per pixel
+// depth of the same occluders shows, and that all kernels and thread counts give the same
+// buffer, then times rasterization and the box tests.
+static void BenchOcclusion()
+{
+	const int blocks = 48;
+	const float blockSize = 24.0f;
+	const int width = 256, height = 144;
+	const uint32_t occluderCount = 48;
+	const int frames = 16;
+	const char* kernelNames[] = { "", "scalar", "sse2", "avx2" };
+
+	uint32_t seed = 1;
+	auto random = [&seed]()
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (1.0f / 16777216.0f);
+	};
+
+	// one building per block, lower toward the edges, with streets between them
+	GeometryGenerator generator;
+	std::vector<std::vector<float>> buildings;
+	std::vector<BvhBounds> bounds;
+	std::vector<uint32_t> boxIndices;
+	for (int z = 0; z < blocks; ++z)
+	{
+		for (int x = 0; x < blocks; ++x)
+		{
+			float centerX = (x - blocks / 2 + 0.5f) * blockSize;
+			float centerZ = (z - blocks / 2 + 0.5f) * blockSize;
+			float sizeX = blockSize * (0.55f + 0.2f * random());
+			float sizeZ = blockSize * (0.55f + 0.2f * random());
+			float buildingHeight = 8.0f + 72.0f * random() * random();
+
+			MeshData box;
+			generator.CreateBox(sizeX, buildingHeight, sizeZ, box);
+			std::vector<float> positions;
+			for (const Vertex& vertex : box.Vertices)
+			{
+				positions.push_back(vertex.Position.x + centerX);
+				positions.push_back(vertex.Position.y + 0.5f * buildingHeight);
+				positions.push_back(vertex.Position.z + centerZ);
+			}
+			boxIndices.assign(box.Indices.begin(), box.Indices.end());
+
+			BvhBounds building = { { centerX - 0.5f * sizeX, 0.0f, centerZ - 0.5f * sizeZ }, { centerX + 0.5f * sizeX, buildingHeight, centerZ + 0.5f * sizeZ } };
+			bounds.push_back(building);
+			buildings.push_back(positions);
+		}
+	}
+	uint32_t buildingCount = (uint32_t)buildings.size();
+	BenchmarkLog("occlusion: %u buildings of %zu triangles, %ux%u depth buffer, %u occluders", buildingCount, boxIndices.size() / 3,
+		width, height, occluderCount);
+
+	// walking down a street, looking around and a little up
+	struct Frame
+	{
+		float viewProj[16];
+		std::vector<uint32_t> occluders;
+	};
+	std::vector<Frame> frameViews(frames);
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		Frame& view = frameViews[frame];
+		float position[3] = { 0.0f, 1.8f, (frame - frames / 2) * blockSize * 0.5f };
+		OcclusionViewProj(position, frame * 2.0f * (float)M_PI / frames, 0.1f, (float)M_PI / 3.0f, (float)width / height, 0.5f, 2000.0f,
+			view.viewProj);
+
+		std::vector<std::pair<float, uint32_t>> nearest;
+		for (uint32_t b = 0; b < buildingCount; ++b)
+		{
+			float dx = 0.5f * (bounds[b].min[0] + bounds[b].max[0]) - position[0];
+			float dz = 0.5f * (bounds[b].min[2] + bounds[b].max[2]) - position[2];
+			nearest.push_back(std::make_pair(dx * dx + dz * dz, b));
+		}
+		std::partial_sort(nearest.begin(), nearest.begin() + occluderCount, nearest.end());
+		for (uint32_t o = 0; o < occluderCount; ++o)
+		{
+			view.occluders.push_back(nearest[o].second);
+		}
+	}
+
+	OcclusionCuller culler;
+	culler.Resize(width, height);
+	auto rasterize = [&](const Frame& view, unsigned int threads, OcclusionKernel kernel)
+	{
+		culler.Clear();
+		for (uint32_t b : view.occluders)
+		{
+			culler.AddOccluder(buildings[b].data(), buildings[b].size() / 3, boxIndices.data(), boxIndices.size(), view.viewProj);
+		}
+		culler.Rasterize(threads, kernel);
+	};
+
+	// accuracy against the per pixel depth of the same occluders
+	bool passed = true;
+	size_t falseOcclusions = 0, occluded = 0, referenceOccluded = 0, tested = 0;
+	std::vector<float> referenceDepth;
+	std::vector<uint32_t> occluderIndices;
+	std::vector<float> occluderPositions;
+	for (const Frame& view : frameViews)
+	{
+		occluderPositions.clear();
+		occluderIndices.clear();
+		for (uint32_t b : view.occluders)
+		{
+			uint32_t base = (uint32_t)(occluderPositions.size() / 3);
+			occluderPositions.insert(occluderPositions.end(), buildings[b].begin(), buildings[b].end());
+			for (uint32_t index : boxIndices)
+			{
+				occluderIndices.push_back(base + index);
+			}
+		}
+		referenceDepth.assign(width * height, 1.0f);
+		OcclusionReferenceRaster(occluderPositions, occluderIndices, view.viewProj, width, height, referenceDepth);
+
+		rasterize(view, 1, OCCLUSION_KERNEL_SCALAR);
+		for (uint32_t b = 0; b < buildingCount; ++b)
+		{
+			bool referenceVisible = OcclusionReferenceVisible(bounds[b], view.viewProj, width, height, referenceDepth);
+			bool visible = culler.IsVisible(bounds[b].min, bounds[b].max, view.viewProj);
+			falseOcclusions += referenceVisible && !visible;
+			occluded += !visible;
+			referenceOccluded += !referenceVisible;
+		}
+		tested += buildingCount;
+	}
+	passed &= falseOcclusions == 0;
+	BenchmarkLog("occlusion: %.1f%% of the buildings occluded, %.1f%% by the per pixel depth, %zu hidden wrongly, %s",
+		100.0 * occluded / tested, 100.0 * referenceOccluded / tested, falseOcclusions, falseOcclusions == 0 ? "PASSED" : "FAILED");
+
+	// every kernel and thread count rasterizes the same buffer
+	std::vector<std::vector<float>> reference(frames);
+	unsigned int threadCounts[] = { 1, (std::max)(2u, WorkerThreadCount()) };
+	for (int kernel = OCCLUSION_KERNEL_SCALAR; kernel <= OCCLUSION_KERNEL_AVX2; ++kernel)
+	{
+		if (OcclusionCuller::GetKernel((OcclusionKernel)kernel) != kernel)
+			continue;
+
+		for (unsigned int threads : threadCounts)
+		{
+			size_t mismatches = 0, triangles = 0;
+			double rasterMs = 0.0;
+			const int repeats = 8;
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				BenchmarkTimer timer;
+				for (int repeat = 0; repeat < repeats; ++repeat)
+				{
+					rasterize(frameViews[frame], threads, (OcclusionKernel)kernel);
+				}
+				rasterMs += timer.ElapsedMs() / repeats;
+				triangles += culler.GetStats().rasterizedTriangles;
+
+				std::vector<float> depth(width * height);
+				for (int y = 0; y < height; ++y)
+				{
+					for (int x = 0; x < width; ++x)
+					{
+						depth[y * width + x] = culler.GetPixelDepth(x, y);
+					}
+				}
+				if (reference[frame].empty())
+					reference[frame] = depth;
+				else if (depth != reference[frame])
+					mismatches++;
+			}
+			passed &= mismatches == 0;
+
+			BenchmarkLog("occlusion: %s %u threads, %.3f ms per frame, %.1f triangles per us, %s", kernelNames[kernel], threads,
+				rasterMs / frames, triangles / (rasterMs * 1000.0), mismatches == 0 ? "PASSED" : "FAILED");
+		}
+	}
+
+	// box tests of the whole city
+	rasterize(frameViews[0], 0, OCCLUSION_KERNEL_AUTO);
+	BenchmarkTimer testTimer;
+	size_t visibleCount = 0;
+	const int testRepeats = 16;
+	for (int repeat = 0; repeat < testRepeats; ++repeat)
+	{
+		for (uint32_t b = 0; b < buildingCount; ++b)
+		{
+			visibleCount += culler.IsVisible(bounds[b].min, bounds[b].max, frameViews[0].viewProj);
+		}
+	}
+	double testMs = testTimer.ElapsedMs() / testRepeats;
+	BenchmarkLog("occlusion: %u box tests in %.3f ms, %.0f ns each, %zu visible", buildingCount, testMs, testMs * 1e6 / buildingCount,
+		visibleCount / testRepeats);
+
+	BenchmarkLog("occlusion: %s", passed ? "PASSED" : "FAILED");
+}
+
+struct BenchmarkEntry
+{
+	const char* name;
+	void(*run)();
+};
+
+static const BenchmarkEntry Benchmarks[] =
+{
+	{ "weld", BenchWeld },
+	{ "meshcache", BenchMeshCache },
+	{ "meshopt", BenchMeshOptimizer },
+	{ "vertexpack", BenchVertexPacking },
+	{ "meshlets", BenchMeshletCulling },
+	{ "lod", BenchLod },
+	{ "materials", BenchMaterials },
+	{ "specular", BenchSpecular },
+	{ "bc", BenchBlockCompression },
+	{ "mips", BenchMips },
+	{ "textures", BenchTextureHandles },
+	{ "commands", BenchCommandBuffers },
+	{ "shadowcull", BenchShadowCulling },
+	{ "occlusion", BenchOcclusion },
+};
+
+bool RunBenchmarks(const std::string& cmdLine)
+{
+	std::istringstream args(cmdLine);
+	std::vector<std::string> names;
+	bool benchmarkMode = false;
+
+	std::string arg;
+	while (args >> arg)
+	{
+		if (arg == "-bench")
+			benchmarkMode = true;
+		else if (benchmarkMode)
+			names.push_back(arg);
+	}
+
+	if (!benchmarkMode)
+		return false;
+
+	bool runAll = names.empty() || std::find(names.begin(), names.end(), "all") != names.end();
+
+	for (const BenchmarkEntry& entry : Benchmarks)
+	{
+		if (runAll || std::find(names.begin(), names.end(), entry.name) != names.end())
+		{
+			entry.run();
+		}
+	}
+
+	return true;
+}
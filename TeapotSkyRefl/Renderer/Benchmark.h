@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Util.h"
+
+// Benchmark
+// Offline timing runs started from the command line, no window is created:
+// TeapotSkyRefl.exe -bench weld
+// TeapotSkyRefl.exe -bench all
+// Results are written to the debugger output and appended to benchmark.txt
+// in the working directory.
+
+// Runs the benchmarks named in cmdLine, returns false if cmdLine has no -bench switch
+bool RunBenchmarks(const std::string& cmdLine);
+
+// printf style logging for benchmark results
+void BenchmarkLog(const char* format, ...);
+
+// Simple wall clock timer for benchmarks
+class BenchmarkTimer
+{
+public:
+	BenchmarkTimer() { Reset(); }
+
+	void Reset() { QueryPerformanceCounter(&mStart); }
+
+	// milliseconds since Reset()
+	double ElapsedMs() const
+	{
+		LARGE_INTEGER now, frequency;
+		QueryPerformanceCounter(&now);
+		QueryPerformanceFrequency(&frequency);
+		return (double)(now.QuadPart - mStart.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+	}
+
+private:
+	LARGE_INTEGER mStart;
+};
@@ -0,0 +1,1075 @@
+#include "BlockCompressor.h"
+#include "CubemapConverter.h"
+#include "VertexPacking.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include <emmintrin.h>
+
+// Least squares passes after the principal axis fit, each kept only if it lowers the error
+static const int RefineIterations = 2;
+
+// BC6H interpolation weights of the 4 bit indices, out of 64
+static const int BC6HWeights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// BC6H mode 11: 5 mode bits 00011, six 10 bit endpoints, 63 index bits
+static const uint32_t BC6HMode11 = 0x03;
+
+// 16 texels of a block as floats, channel after channel, in the domain the endpoints are fitted in
+struct BlockColors
+{
+	float c[3][16];
+};
+
+// BC1 endpoints are RGB565, the palette is the two endpoints and two thirds between them
+struct BC1Format
+{
+	static const int PaletteSize = 4;
+
+	static float MaxValue() { return 255.0f; }
+
+	static float Weight(int index)
+	{
+		static const float Weights[PaletteSize] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+		return Weights[index];
+	}
+
+	static void Quantize(const float e[3], int q[3])
+	{
+		q[0] = std::min(std::max((int)(e[0] * (31.0f / 255.0f) + 0.5f), 0), 31);
+		q[1] = std::min(std::max((int)(e[1] * (63.0f / 255.0f) + 0.5f), 0), 63);
+		q[2] = std::min(std::max((int)(e[2] * (31.0f / 255.0f) + 0.5f), 0), 31);
+	}
+
+	static void Expand(const int q[3], float color[3])
+	{
+		color[0] = (float)((q[0] << 3) | (q[0] >> 2));
+		color[1] = (float)((q[1] << 2) | (q[1] >> 4));
+		color[2] = (float)((q[2] << 3) | (q[2] >> 2));
+	}
+
+	static void Palette(const int q0[3], const int q1[3], float palette[PaletteSize][3])
+	{
+		Expand(q0, palette[0]);
+		Expand(q1, palette[1]);
+		for (int k = 0; k < 3; ++k)
+		{
+			palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+			palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+		}
+	}
+};
+
+// BC6H unsigned endpoints are 10 bits, fitted in the 16 bit domain the decoder interpolates in
+// before it scales by 31 / 64 to half float bits
+struct BC6HFormat
+{
+	static const int PaletteSize = 16;
+
+	static float MaxValue() { return 65535.0f; }
+
+	static float Weight(int index) { return BC6HWeights[index] / 64.0f; }
+
+	static void Quantize(const float e[3], int q[3])
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			q[k] = std::min(std::max((int)floorf((e[k] - 32.0f) / 64.0f + 0.5f), 0), 1023);
+		}
+	}
+
+	static int Unquantize(int q)
+	{
+		if (q == 0)
+			return 0;
+		if (q == 1023)
+			return 0xffff;
+		return ((q << 16) + 0x8000) >> 10;
+	}
+
+	static void Palette(const int q0[3], const int q1[3], float palette[PaletteSize][3])
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			int u0 = Unquantize(q0[k]);
+			int u1 = Unquantize(q1[k]);
+			for (int i = 0; i < PaletteSize; ++i)
+			{
+				palette[i][k] = (float)((u0 * (64 - BC6HWeights[i]) + u1 * BC6HWeights[i] + 32) >> 6);
+			}
+		}
+	}
+};
+
+static inline float HorizontalSum(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+static inline float HorizontalMin(__m128 v)
+{
+	v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_min_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+static inline float HorizontalMax(__m128 v)
+{
+	v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+// Mean and covariance (xx, xy, xz, yy, yz, zz) of the texels
+static void MomentsScalar(const BlockColors& block, float mean[3], float covariance[6])
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		float sum = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			sum += block.c[k][i];
+		}
+		mean[k] = sum / 16.0f;
+	}
+
+	memset(covariance, 0, 6 * sizeof(float));
+	for (int i = 0; i < 16; ++i)
+	{
+		float x = block.c[0][i] - mean[0];
+		float y = block.c[1][i] - mean[1];
+		float z = block.c[2][i] - mean[2];
+		covariance[0] += x * x;
+		covariance[1] += x * y;
+		covariance[2] += x * z;
+		covariance[3] += y * y;
+		covariance[4] += y * z;
+		covariance[5] += z * z;
+	}
+}
+
+static void MomentsSSE2(const BlockColors& block, float mean[3], float covariance[6])
+{
+	__m128 centered[3][4];
+	for (int k = 0; k < 3; ++k)
+	{
+		__m128 v[4];
+		for (int g = 0; g < 4; ++g)
+		{
+			v[g] = _mm_loadu_ps(block.c[k] + g * 4);
+		}
+		mean[k] = HorizontalSum(_mm_add_ps(_mm_add_ps(v[0], v[1]), _mm_add_ps(v[2], v[3]))) / 16.0f;
+
+		__m128 m = _mm_set1_ps(mean[k]);
+		for (int g = 0; g < 4; ++g)
+		{
+			centered[k][g] = _mm_sub_ps(v[g], m);
+		}
+	}
+
+	static const int Pairs[6][2] = { { 0, 0 }, { 0, 1 }, { 0, 2 }, { 1, 1 }, { 1, 2 }, { 2, 2 } };
+	for (int p = 0; p < 6; ++p)
+	{
+		const __m128* a = centered[Pairs[p][0]];
+		const __m128* b = centered[Pairs[p][1]];
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])),
+			_mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+		covariance[p] = HorizontalSum(sum);
+	}
+}
+
+// Largest eigenvector of the covariance by power iteration, zero for a flat block
+static void PrincipalAxis(const float covariance[6], float axis[3])
+{
+	// start from the row of the largest variance so the start is not orthogonal to the axis
+	const float rows[3][3] =
+	{
+		{ covariance[0], covariance[1], covariance[2] },
+		{ covariance[1], covariance[3], covariance[4] },
+		{ covariance[2], covariance[4], covariance[5] }
+	};
+	int start = covariance[0] >= covariance[3] && covariance[0] >= covariance[5] ? 0 : (covariance[3] >= covariance[5] ? 1 : 2);
+	float v[3] = { rows[start][0], rows[start][1], rows[start][2] };
+
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		if (length < 1e-12f)
+		{
+			axis[0] = axis[1] = axis[2] = 0.0f;
+			return;
+		}
+
+		float n[3] = { v[0] / length, v[1] / length, v[2] / length };
+		for (int k = 0; k < 3; ++k)
+		{
+			v[k] = rows[k][0] * n[0] + rows[k][1] * n[1] + rows[k][2] * n[2];
+		}
+	}
+
+	float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	float scale = length > 1e-12f ? 1.0f / length : 0.0f;
+	axis[0] = v[0] * scale;
+	axis[1] = v[1] * scale;
+	axis[2] = v[2] * scale;
+}
+
+// Smallest and largest projection of the texels on axis through mean
+static void ProjectRangeScalar(const BlockColors& block, const float mean[3], const float axis[3], float& minProjection, float& maxProjection)
+{
+	minProjection = FLT_MAX;
+	maxProjection = -minProjection;
+	for (int i = 0; i < 16; ++i)
+	{
+		float p = (block.c[0][i] - mean[0]) * axis[0] + (block.c[1][i] - mean[1]) * axis[1] + (block.c[2][i] - mean[2]) * axis[2];
+		minProjection = std::min(minProjection, p);
+		maxProjection = std::max(maxProjection, p);
+	}
+}
+
+static void ProjectRangeSSE2(const BlockColors& block, const float mean[3], const float axis[3], float& minProjection, float& maxProjection)
+{
+	__m128 minimum = _mm_set1_ps(FLT_MAX);
+	__m128 maximum = _mm_set1_ps(-FLT_MAX);
+	for (int g = 0; g < 4; ++g)
+	{
+		__m128 p = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(block.c[0] + g * 4), _mm_set1_ps(mean[0])), _mm_set1_ps(axis[0]));
+		p = _mm_add_ps(p, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(block.c[1] + g * 4), _mm_set1_ps(mean[1])), _mm_set1_ps(axis[1])));
+		p = _mm_add_ps(p, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(block.c[2] + g * 4), _mm_set1_ps(mean[2])), _mm_set1_ps(axis[2])));
+		minimum = _mm_min_ps(minimum, p);
+		maximum = _mm_max_ps(maximum, p);
+	}
+	minProjection = HorizontalMin(minimum);
+	maxProjection = HorizontalMax(maximum);
+}
+
+// Nearest palette entry of every texel, returns the summed squared error
+static float SelectIndicesScalar(const BlockColors& block, const float palette[][3], int paletteSize, int indices[16])
+{
+	float error = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		float best = FLT_MAX;
+		int bestIndex = 0;
+		for (int k = 0; k < paletteSize; ++k)
+		{
+			float dr = block.c[0][i] - palette[k][0];
+			float dg = block.c[1][i] - palette[k][1];
+			float db = block.c[2][i] - palette[k][2];
+			float d = dr * dr + dg * dg + db * db;
+			if (d < best)
+			{
+				best = d;
+				bestIndex = k;
+			}
+		}
+		indices[i] = bestIndex;
+		error += best;
+	}
+	return error;
+}
+
+static float SelectIndicesSSE2(const BlockColors& block, const float palette[][3], int paletteSize, int indices[16])
+{
+	__m128 error = _mm_setzero_ps();
+	for (int g = 0; g < 4; ++g)
+	{
+		__m128 r = _mm_loadu_ps(block.c[0] + g * 4);
+		__m128 gr = _mm_loadu_ps(block.c[1] + g * 4);
+		__m128 b = _mm_loadu_ps(block.c[2] + g * 4);
+
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i bestIndex = _mm_setzero_si128();
+		for (int k = 0; k < paletteSize; ++k)
+		{
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[k][0]));
+			__m128 dg = _mm_sub_ps(gr, _mm_set1_ps(palette[k][1]));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[k][2]));
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+			best = _mm_min_ps(best, d);
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, bestIndex));
+		}
+
+		_mm_storeu_si128((__m128i*)(indices + g * 4), bestIndex);
+		error = _mm_add_ps(error, best);
+	}
+	return HorizontalSum(error);
+}
+
+// Endpoints that fit the texels best in the least squares sense for the chosen indices,
+// false when every texel uses the same weight
+template<typename Format>
+static bool LeastSquaresEndpoints(const BlockColors& block, const int indices[16], float e0[3], float e1[3])
+{
+	float a = 0.0f, b = 0.0f, c = 0.0f;
+	float x[3] = { 0.0f, 0.0f, 0.0f }, y[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i)
+	{
+		float w = Format::Weight(indices[i]);
+		float v = 1.0f - w;
+		a += v * v;
+		b += v * w;
+		c += w * w;
+		for (int k = 0; k < 3; ++k)
+		{
+			x[k] += v * block.c[k][i];
+			y[k] += w * block.c[k][i];
+		}
+	}
+
+	float determinant = a * c - b * b;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+
+	float invDeterminant = 1.0f / determinant;
+	for (int k = 0; k < 3; ++k)
+	{
+		e0[k] = std::min(std::max((c * x[k] - b * y[k]) * invDeterminant, 0.0f), Format::MaxValue());
+		e1[k] = std::min(std::max((a * y[k] - b * x[k]) * invDeterminant, 0.0f), Format::MaxValue());
+	}
+	return true;
+}
+
+// Endpoint codes and indices of a block: the extent of the texels along their principal axis,
+// then least squares refinement. Returns the squared error.
+template<typename Format, bool SSE2>
+static float FitEndpoints(const BlockColors& block, int q0[3], int q1[3], int indices[16])
+{
+	float mean[3], covariance[6], axis[3];
+	if (SSE2)
+		MomentsSSE2(block, mean, covariance);
+	else
+		MomentsScalar(block, mean, covariance);
+	PrincipalAxis(covariance, axis);
+
+	float minProjection, maxProjection;
+	if (SSE2)
+		ProjectRangeSSE2(block, mean, axis, minProjection, maxProjection);
+	else
+		ProjectRangeScalar(block, mean, axis, minProjection, maxProjection);
+
+	float e0[3], e1[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		e0[k] = std::min(std::max(mean[k] + axis[k] * minProjection, 0.0f), Format::MaxValue());
+		e1[k] = std::min(std::max(mean[k] + axis[k] * maxProjection, 0.0f), Format::MaxValue());
+	}
+	Format::Quantize(e0, q0);
+	Format::Quantize(e1, q1);
+
+	float palette[Format::PaletteSize][3];
+	Format::Palette(q0, q1, palette);
+	float error = SSE2 ? SelectIndicesSSE2(block, palette, Format::PaletteSize, indices) :
+		SelectIndicesScalar(block, palette, Format::PaletteSize, indices);
+
+	for (int iteration = 0; iteration < RefineIterations && error > 0.0f; ++iteration)
+	{
+		if (!LeastSquaresEndpoints<Format>(block, indices, e0, e1))
+			break;
+
+		int r0[3], r1[3];
+		Format::Quantize(e0, r0);
+		Format::Quantize(e1, r1);
+		if (memcmp(r0, q0, sizeof(r0)) == 0 && memcmp(r1, q1, sizeof(r1)) == 0)
+			break;
+
+		int candidate[16];
+		Format::Palette(r0, r1, palette);
+		float candidateError = SSE2 ? SelectIndicesSSE2(block, palette, Format::PaletteSize, candidate) :
+			SelectIndicesScalar(block, palette, Format::PaletteSize, candidate);
+		if (candidateError >= error)
+			break;
+
+		error = candidateError;
+		memcpy(q0, r0, sizeof(r0));
+		memcpy(q1, r1, sizeof(r1));
+		memcpy(indices, candidate, sizeof(candidate));
+	}
+
+	return error;
+}
+
+template<bool SSE2>
+static void EncodeBC1(const unsigned char rgba[64], unsigned char block[8])
+{
+	BlockColors colors;
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			colors.c[k][i] = rgba[i * 4 + k];
+		}
+	}
+
+	int q0[3], q1[3], indices[16];
+	FitEndpoints<BC1Format, SSE2>(colors, q0, q1, indices);
+
+	// four color mode needs c0 > c1, swapping the endpoints swaps the indices 0 1 and 2 3
+	uint16_t c0 = (uint16_t)((q0[0] << 11) | (q0[1] << 5) | q0[2]);
+	uint16_t c1 = (uint16_t)((q1[0] << 11) | (q1[1] << 5) | q1[2]);
+	if (c0 < c1)
+	{
+		std::swap(c0, c1);
+		for (int i = 0; i < 16; ++i)
+		{
+			indices[i] ^= 1;
+		}
+	}
+
+	uint32_t bits = 0;
+	if (c0 != c1)
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			bits |= (uint32_t)indices[i] << (i * 2);
+		}
+	}
+
+	block[0] = (unsigned char)c0;
+	block[1] = (unsigned char)(c0 >> 8);
+	block[2] = (unsigned char)c1;
+	block[3] = (unsigned char)(c1 >> 8);
+	memcpy(block + 4, &bits, 4);
+}
+
+// Writes count bits of value at bit position in a block, lowest bit first
+static inline void PutBits(unsigned char* block, unsigned int& position, uint32_t value, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i, ++position)
+	{
+		if (value & (1u << i))
+			block[position >> 3] |= (unsigned char)(1u << (position & 7));
+	}
+}
+
+static inline uint32_t GetBits(const unsigned char* block, unsigned int& position, unsigned int count)
+{
+	uint32_t value = 0;
+	for (unsigned int i = 0; i < count; ++i, ++position)
+	{
+		value |= (uint32_t)((block[position >> 3] >> (position & 7)) & 1) << i;
+	}
+	return value;
+}
+
+template<bool SSE2>
+static void EncodeBC6H(const uint16_t rgba[64], unsigned char block[16])
+{
+	// half float bits in the 16 bit interpolation domain, no negatives, infinity and NaN
+	BlockColors colors;
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			uint16_t half = rgba[i * 4 + k];
+			half = (half & 0x8000) ? 0 : std::min<uint16_t>(half, 0x7bff);
+			colors.c[k][i] = half * (64.0f / 31.0f);
+		}
+	}
+
+	int q0[3], q1[3], indices[16];
+	FitEndpoints<BC6HFormat, SSE2>(colors, q0, q1, indices);
+
+	// the index of the first texel has an implied top bit of 0
+	if (indices[0] >= 8)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			std::swap(q0[k], q1[k]);
+		}
+		for (int i = 0; i < 16; ++i)
+		{
+			indices[i] = 15 - indices[i];
+		}
+	}
+
+	memset(block, 0, 16);
+	unsigned int position = 0;
+	PutBits(block, position, BC6HMode11, 5);
+	for (int k = 0; k < 3; ++k)
+	{
+		PutBits(block, position, q0[k], 10);
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		PutBits(block, position, q1[k], 10);
+	}
+	for (int i = 0; i < 16; ++i)
+	{
+		PutBits(block, position, indices[i], i == 0 ? 3 : 4);
+	}
+}
+
+void BlockCompressor::EncodeBC1Block(const unsigned char rgba[64], unsigned char block[8])
+{
+	EncodeBC1<true>(rgba, block);
+}
+
+void BlockCompressor::EncodeBC1BlockScalar(const unsigned char rgba[64], unsigned char block[8])
+{
+	EncodeBC1<false>(rgba, block);
+}
+
+void BlockCompressor::EncodeBC6HBlock(const uint16_t rgba[64], unsigned char block[16])
+{
+	EncodeBC6H<true>(rgba, block);
+}
+
+void BlockCompressor::EncodeBC6HBlockScalar(const uint16_t rgba[64], unsigned char block[16])
+{
+	EncodeBC6H<false>(rgba, block);
+}
+
+// The 8 value palette of a BC4 block with a0 > a1
+static void BC4Palette(int a0, int a1, int palette[8])
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	for (int i = 2; i < 8; ++i)
+	{
+		palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+	}
+}
+
+void BlockCompressor::EncodeBC4Block(const unsigned char values[16], unsigned char block[8])
+{
+	int a0 = values[0], a1 = values[0];
+	for (int i = 1; i < 16; ++i)
+	{
+		a0 = std::max(a0, (int)values[i]);
+		a1 = std::min(a1, (int)values[i]);
+	}
+
+	memset(block, 0, 8);
+	block[0] = (unsigned char)a0;
+	block[1] = (unsigned char)a1;
+	if (a0 == a1)
+		return;
+
+	int palette[8];
+	BC4Palette(a0, a1, palette);
+
+	unsigned int position = 16;
+	for (int i = 0; i < 16; ++i)
+	{
+		int best = 256;
+		int bestIndex = 0;
+		for (int k = 0; k < 8; ++k)
+		{
+			int d = abs(values[i] - palette[k]);
+			if (d < best)
+			{
+				best = d;
+				bestIndex = k;
+			}
+		}
+		PutBits(block, position, bestIndex, 3);
+	}
+}
+
+static void DecodeBC1Block(const unsigned char block[8], bool alwaysFourColor, unsigned char rgba[64])
+{
+	uint16_t c0 = (uint16_t)(block[0] | (block[1] << 8));
+	uint16_t c1 = (uint16_t)(block[2] | (block[3] << 8));
+	int q0[3] = { c0 >> 11, (c0 >> 5) & 63, c0 & 31 };
+	int q1[3] = { c1 >> 11, (c1 >> 5) & 63, c1 & 31 };
+
+	float e0[3], e1[3];
+	BC1Format::Expand(q0, e0);
+	BC1Format::Expand(q1, e1);
+
+	int palette[4][4];
+	for (int k = 0; k < 3; ++k)
+	{
+		int a = (int)e0[k], b = (int)e1[k];
+		palette[0][k] = a;
+		palette[1][k] = b;
+		if (alwaysFourColor || c0 > c1)
+		{
+			palette[2][k] = (2 * a + b + 1) / 3;
+			palette[3][k] = (a + 2 * b + 1) / 3;
+		}
+		else
+		{
+			palette[2][k] = (a + b) / 2;
+			palette[3][k] = 0;
+		}
+	}
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	palette[3][3] = alwaysFourColor || c0 > c1 ? 255 : 0;
+
+	uint32_t bits;
+	memcpy(&bits, block + 4, 4);
+	for (int i = 0; i < 16; ++i)
+	{
+		const int* color = palette[(bits >> (i * 2)) & 3];
+		for (int k = 0; k < 4; ++k)
+		{
+			rgba[i * 4 + k] = (unsigned char)color[k];
+		}
+	}
+}
+
+static void DecodeBC4Block(const unsigned char block[8], unsigned char values[16], size_t stride)
+{
+	int a0 = block[0], a1 = block[1];
+	int palette[8];
+	if (a0 > a1)
+	{
+		BC4Palette(a0, a1, palette);
+	}
+	else
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		for (int i = 2; i < 6; ++i)
+		{
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	unsigned int position = 16;
+	for (int i = 0; i < 16; ++i)
+	{
+		values[i * stride] = (unsigned char)palette[GetBits(block, position, 3)];
+	}
+}
+
+static void DecodeBC6HBlock(const unsigned char block[16], uint16_t rgba[64])
+{
+	unsigned int position = 0;
+	if (GetBits(block, position, 5) != BC6HMode11)
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			rgba[i * 4 + 0] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = 0;
+			rgba[i * 4 + 3] = 0x3c00;
+		}
+		return;
+	}
+
+	int q0[3], q1[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		q0[k] = (int)GetBits(block, position, 10);
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		q1[k] = (int)GetBits(block, position, 10);
+	}
+
+	float palette[BC6HFormat::PaletteSize][3];
+	BC6HFormat::Palette(q0, q1, palette);
+	for (int i = 0; i < 16; ++i)
+	{
+		int index = (int)GetBits(block, position, i == 0 ? 3 : 4);
+		for (int k = 0; k < 3; ++k)
+		{
+			rgba[i * 4 + k] = (uint16_t)(((int)palette[index][k] * 31) >> 6);
+		}
+		rgba[i * 4 + 3] = 0x3c00;
+	}
+}
+
+size_t BlockCompressor::BlockBytes(BlockFormat format)
+{
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+size_t BlockCompressor::CompressedSize(BlockFormat format, unsigned int width, unsigned int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+}
+
+// The 16 texels of block (bx, by), repeating the edge texels past the image
+template<typename T>
+static void GatherBlock(const T* texels, unsigned int width, unsigned int height, unsigned int bx, unsigned int by, T block[64])
+{
+	for (unsigned int y = 0; y < 4; ++y)
+	{
+		unsigned int sy = std::min(by * 4 + y, height - 1);
+		for (unsigned int x = 0; x < 4; ++x)
+		{
+			unsigned int sx = std::min(bx * 4 + x, width - 1);
+			memcpy(block + (y * 4 + x) * 4, texels + ((size_t)sy * width + sx) * 4, 4 * sizeof(T));
+		}
+	}
+}
+
+void BlockCompressor::Compress(BlockFormat format, const unsigned char* rgba, unsigned int width, unsigned int height,
+	std::vector<unsigned char>& blocks, unsigned int threadCount)
+{
+	blocks.assign(CompressedSize(format, width, height), 0);
+	if (width == 0 || height == 0)
+		return;
+
+	if (format == BLOCK_BC6H)
+	{
+		// BC6H takes half floats, widen the texels
+		std::vector<float> values((size_t)width * height * 4);
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			values[i] = rgba[i] / 255.0f;
+		}
+		std::vector<uint16_t> halves(values.size());
+		ConvertFloatsToHalves(values.data(), values.size(), halves.data());
+		CompressHalf(halves.data(), width, height, blocks, threadCount);
+		return;
+	}
+
+	unsigned int blocksX = (width + 3) / 4;
+	unsigned int blocksY = (height + 3) / 4;
+	size_t blockBytes = BlockBytes(format);
+
+	ParallelFor(blocksY, 4, threadCount, [&](size_t begin, size_t end)
+	{
+		unsigned char texels[64], channel[16];
+		for (size_t by = begin; by < end; ++by)
+		{
+			for (unsigned int bx = 0; bx < blocksX; ++bx)
+			{
+				GatherBlock(rgba, width, height, bx, (unsigned int)by, texels);
+				unsigned char* block = &blocks[(by * blocksX + bx) * blockBytes];
+
+				switch (format)
+				{
+				case BLOCK_BC1:
+					EncodeBC1Block(texels, block);
+					break;
+				case BLOCK_BC3:
+					for (int i = 0; i < 16; ++i)
+					{
+						channel[i] = texels[i * 4 + 3];
+					}
+					EncodeBC4Block(channel, block);
+					EncodeBC1Block(texels, block + 8);
+					break;
+				default:
+					for (int c = 0; c < 2; ++c)
+					{
+						for (int i = 0; i < 16; ++i)
+						{
+							channel[i] = texels[i * 4 + c];
+						}
+						EncodeBC4Block(channel, block + c * 8);
+					}
+					break;
+				}
+			}
+		}
+	});
+}
+
+void BlockCompressor::CompressHalf(const uint16_t* rgba, unsigned int width, unsigned int height, std::vector<unsigned char>& blocks,
+	unsigned int threadCount)
+{
+	blocks.assign(CompressedSize(BLOCK_BC6H, width, height), 0);
+	if (width == 0 || height == 0)
+		return;
+
+	unsigned int blocksX = (width + 3) / 4;
+	unsigned int blocksY = (height + 3) / 4;
+
+	ParallelFor(blocksY, 4, threadCount, [&](size_t begin, size_t end)
+	{
+		uint16_t texels[64];
+		for (size_t by = begin; by < end; ++by)
+		{
+			for (unsigned int bx = 0; bx < blocksX; ++bx)
+			{
+				GatherBlock(rgba, width, height, bx, (unsigned int)by, texels);
+				EncodeBC6HBlock(texels, &blocks[(by * blocksX + bx) * 16]);
+			}
+		}
+	});
+}
+
+// Scatters a decoded block into the image, dropping the texels past the edge
+template<typename T>
+static void ScatterBlock(const T block[64], unsigned int width, unsigned int height, unsigned int bx, unsigned int by, T* texels)
+{
+	for (unsigned int y = 0; y < 4 && by * 4 + y < height; ++y)
+	{
+		for (unsigned int x = 0; x < 4 && bx * 4 + x < width; ++x)
+		{
+			memcpy(texels + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4, block + (y * 4 + x) * 4, 4 * sizeof(T));
+		}
+	}
+}
+
+void BlockCompressor::Decompress(BlockFormat format, const unsigned char* blocks, unsigned int width, unsigned int height,
+	std::vector<unsigned char>& rgba)
+{
+	rgba.assign((size_t)width * height * 4, 0);
+
+	unsigned int blocksX = (width + 3) / 4;
+	unsigned int blocksY = (height + 3) / 4;
+	size_t blockBytes = BlockBytes(format);
+
+	unsigned char texels[64];
+	for (unsigned int by = 0; by < blocksY; ++by)
+	{
+		for (unsigned int bx = 0; bx < blocksX; ++bx)
+		{
+			const unsigned char* block = blocks + ((size_t)by * blocksX + bx) * blockBytes;
+			switch (format)
+			{
+			case BLOCK_BC1:
+				DecodeBC1Block(block, false, texels);
+				break;
+			case BLOCK_BC3:
+				DecodeBC1Block(block + 8, true, texels);
+				DecodeBC4Block(block, texels + 3, 4);
+				break;
+			case BLOCK_BC5:
+				DecodeBC4Block(block, texels, 4);
+				DecodeBC4Block(block + 8, texels + 1, 4);
+				for (int i = 0; i < 16; ++i)
+				{
+					texels[i * 4 + 2] = 0;
+					texels[i * 4 + 3] = 255;
+				}
+				break;
+			default:
+				{
+					uint16_t halves[64];
+					float values[64];
+					DecodeBC6HBlock(block, halves);
+					ConvertHalvesToFloats(halves, 64, values);
+					for (int i = 0; i < 64; ++i)
+					{
+						texels[i] = (unsigned char)std::min(std::max(values[i] * 255.0f + 0.5f, 0.0f), 255.0f);
+					}
+				}
+				break;
+			}
+			ScatterBlock(texels, width, height, bx, by, rgba.data());
+		}
+	}
+}
+
+void BlockCompressor::DecompressHalf(const unsigned char* blocks, unsigned int width, unsigned int height, std::vector<uint16_t>& rgba)
+{
+	rgba.assign((size_t)width * height * 4, 0);
+
+	unsigned int blocksX = (width + 3) / 4;
+	unsigned int blocksY = (height + 3) / 4;
+
+	uint16_t texels[64];
+	for (unsigned int by = 0; by < blocksY; ++by)
+	{
+		for (unsigned int bx = 0; bx < blocksX; ++bx)
+		{
+			DecodeBC6HBlock(blocks + ((size_t)by * blocksX + bx) * 16, texels);
+			ScatterBlock(texels, width, height, bx, by, rgba.data());
+		}
+	}
+}
+
+BlockFormat BlockCompressor::ChooseColorFormat(const unsigned char* rgba, unsigned int width, unsigned int height)
+{
+	size_t count = (size_t)width * height;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (rgba[i * 4 + 3] != 255)
+			return BLOCK_BC3;
+	}
+	return BLOCK_BC1;
+}
+
+// Legacy four character codes of the formats, BC6H needs the DX10 header
+static uint32_t FormatFourCC(BlockFormat format)
+{
+	switch (format)
+	{
+	case BLOCK_BC1: return CubemapConverter::FourCCDxt1;
+	case BLOCK_BC3: return CubemapConverter::FourCCDxt5;
+	case BLOCK_BC5: return CubemapConverter::FourCCAti2;
+	default: return CubemapConverter::FourCCDx10;
+	}
+}
+
+// settings of the caller are kept above the format
+static uint32_t CookedSetting(BlockFormat format, uint32_t setting)
+{
+	return (setting << 8) | format;
+}
+
+bool BlockCompressor::CompressDds(BlockFormat format, const unsigned char* rgba, unsigned int width, unsigned int height, unsigned int mipCount,
+	uint32_t setting, uint64_t sourceHash, uint64_t sourceSize, std::vector<unsigned char>& dds, unsigned int threadCount)
+{
+	dds.clear();
+	if (width == 0 || height == 0 || width % 4 != 0 || height % 4 != 0)
+		return false;
+
+	CookedDds desc;
+	desc.width = width;
+	desc.height = height;
+	desc.mipCount = std::max(mipCount, 1u);
+	desc.fourCC = FormatFourCC(format);
+	desc.dxgiFormat = format == BLOCK_BC6H ? CubemapConverter::DxgiFormatBC6HUF16 : 0;
+	desc.version = Version;
+	desc.setting = CookedSetting(format, setting);
+	desc.sourceHash = sourceHash;
+	desc.sourceSize = sourceSize;
+
+	// mips below 4 x 4 fill one block with repeated texels
+	std::vector<unsigned char> data, blocks;
+	data.reserve(desc.DataSize());
+	for (unsigned int mip = 0; mip < desc.mipCount; ++mip)
+	{
+		unsigned int mipWidth = std::max(width >> mip, 1u);
+		unsigned int mipHeight = std::max(height >> mip, 1u);
+		Compress(format, rgba, mipWidth, mipHeight, blocks, threadCount);
+		data.insert(data.end(), blocks.begin(), blocks.end());
+		rgba += (size_t)mipWidth * mipHeight * 4;
+	}
+
+	CubemapConverter::WriteDds(desc, data.data(), dds);
+	return true;
+}
+
+// The desc of the BC6H .dds of a cooked RGBA16F .dds, false if source is not one
+static bool HalfDdsDesc(const std::vector<unsigned char>& source, CookedDds& sourceDesc, CookedDds& desc)
+{
+	if (!CubemapConverter::ReadDdsDesc(source, sourceDesc) || sourceDesc.fourCC != CubemapConverter::FourCCHalf4 ||
+		sourceDesc.width % 4 != 0 || sourceDesc.height % 4 != 0)
+	{
+		return false;
+	}
+
+	desc = sourceDesc;
+	desc.fourCC = CubemapConverter::FourCCDx10;
+	desc.dxgiFormat = CubemapConverter::DxgiFormatBC6HUF16;
+	desc.version = (BlockCompressor::Version << 16) | sourceDesc.version;
+	return true;
+}
+
+bool BlockCompressor::CompressHalfDds(const std::vector<unsigned char>& source, std::vector<unsigned char>& dds, unsigned int threadCount)
+{
+	dds.clear();
+
+	CookedDds sourceDesc, desc;
+	if (!HalfDdsDesc(source, sourceDesc, desc))
+		return false;
+
+	// every mip of every face on its own, in the order of the source
+	std::vector<unsigned char> data, blocks;
+	data.reserve(desc.DataSize());
+	const unsigned char* texels = source.data() + sourceDesc.HeaderSize();
+	unsigned int faceCount = desc.cube ? CubemapConverter::FaceCount : 1;
+	for (unsigned int face = 0; face < faceCount; ++face)
+	{
+		for (unsigned int mip = 0; mip < desc.mipCount; ++mip)
+		{
+			unsigned int width = std::max(desc.width >> mip, 1u);
+			unsigned int height = std::max(desc.height >> mip, 1u);
+			CompressHalf((const uint16_t*)texels, width, height, blocks, threadCount);
+			data.insert(data.end(), blocks.begin(), blocks.end());
+			texels += sourceDesc.MipSize(mip);
+		}
+	}
+
+	CubemapConverter::WriteDds(desc, data.data(), dds);
+	return true;
+}
+
+bool BlockCompressor::LoadHalfDds(const std::string& cacheFile, const std::vector<unsigned char>& source, std::vector<unsigned char>& dds,
+	unsigned int threadCount)
+{
+	CookedDds sourceDesc, desc;
+	if (!HalfDdsDesc(source, sourceDesc, desc))
+		return false;
+
+	if (CubemapConverter::ReadCache(cacheFile, desc, dds))
+		return true;
+
+	if (!CompressHalfDds(source, dds, threadCount))
+		return false;
+
+	CubemapConverter::WriteCache(cacheFile, dds);
+	return true;
+}
+
+bool BlockCompressor::FindTextureCache(const std::string& sourceFile, uint32_t setting, std::string& cacheFile, CookedDds& desc)
+{
+	uint64_t hash, size;
+	if (!CubemapConverter::HashFile(sourceFile, hash, size))
+		return false;
+
+	// the size of the texture is not known before decoding, the cache tells it
+	const BlockFormat formats[] = { BLOCK_BC1, BLOCK_BC3 };
+	for (BlockFormat format : formats)
+	{
+		std::string fileName = CacheFileName(sourceFile, format);
+		std::ifstream cache(fileName, std::ios::binary | std::ios::ate);
+		if (!cache)
+			continue;
+
+		// the header alone, the largest has the DX10 part
+		uint64_t fileSize = (uint64_t)cache.tellg();
+		unsigned char header[148] = {};
+		cache.seekg(0);
+		cache.read((char*)header, (std::streamsize)std::min<uint64_t>(fileSize, sizeof(header)));
+
+		if (CubemapConverter::ReadDdsHeader(header, (size_t)cache.gcount(), desc) && desc.fourCC == FormatFourCC(format) &&
+			desc.version == Version && desc.setting == CookedSetting(format, setting) && desc.sourceHash == hash &&
+			desc.sourceSize == size && fileSize == desc.HeaderSize() + desc.DataSize())
+		{
+			cacheFile = fileName;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool BlockCompressor::ReadTextureCache(const std::string& sourceFile, uint32_t setting, std::vector<unsigned char>& dds)
+{
+	std::string cacheFile;
+	CookedDds desc;
+	if (FindTextureCache(sourceFile, setting, cacheFile, desc))
+	{
+		std::ifstream cache(cacheFile, std::ios::binary);
+		dds.resize(desc.HeaderSize() + desc.DataSize());
+		if (cache.read((char*)dds.data(), dds.size()))
+			return true;
+	}
+
+	dds.clear();
+	return false;
+}
+
+bool BlockCompressor::CookTexture(const std::string& sourceFile, uint32_t setting, const unsigned char* rgba, unsigned int width,
+	unsigned int height, unsigned int mipCount, std::vector<unsigned char>& dds, unsigned int threadCount)
+{
+	uint64_t hash, size;
+	if (!CubemapConverter::HashFile(sourceFile, hash, size))
+		return false;
+
+	// the mips of opaque texels stay opaque
+	BlockFormat format = ChooseColorFormat(rgba, width, height);
+	if (!CompressDds(format, rgba, width, height, mipCount, setting, hash, size, dds, threadCount))
+		return false;
+
+	CubemapConverter::WriteCache(CacheFileName(sourceFile, format), dds);
+	return true;
+}
+
+std::string BlockCompressor::CacheFileName(const std::string& sourceFile, BlockFormat format)
+{
+	static const char* Suffixes[] = { ".bc1.dds", ".bc3.dds", ".bc5.dds", ".bc6h.dds" };
+	return CubemapConverter::CacheFileName(sourceFile, Suffixes[format]);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct CookedDds;
+
+// BlockCompressor
+// Encodes textures to the D3D block compressed formats, 4 x 4 texels per block:
+// BC1 for opaque color, BC3 for color with alpha, BC5 for two channel data such as
+// normal maps and BC6H (unsigned half float) for HDR sky data. Color endpoints are
+// fitted along the principal axis of the block and refined by least squares on the
+// chosen indices; the covariance, projection and index search run on four texels
+// at a time with SSE2 next to a scalar reference. BC6H is written in its single
+// region mode with 10 bit endpoints (mode 11), the one mode without endpoint deltas.
+// Block rows are spread over threads with ParallelFor. The .dds files are written
+// with CubemapConverter::WriteDds so DDSTextureLoader reads them, and the cooked
+// RGBA16F sky .dds files keep their source key when compressed.
+// Only the standard library is used, as in CubemapConverter.
+// usage:
+// std::vector<unsigned char> blocks;
+// BlockCompressor::Compress(BLOCK_BC1, pixels.data(), width, height, blocks);
+// BlockCompressor::CompressHalfDds(cubeDds, bc6hDds);
+// BlockCompressor::LoadHalfDds(BlockCompressor::CacheFileName(cubeCacheFile, BLOCK_BC6H), cubeDds, bc6hDds);
+
+enum BlockFormat
+{
+	BLOCK_BC1,	// RGB, 8 bytes per block
+	BLOCK_BC3,	// RGBA, 16 bytes per block
+	BLOCK_BC5,	// red and green, 16 bytes per block
+	BLOCK_BC6H	// unsigned half float RGB, 16 bytes per block
+};
+
+class BlockCompressor
+{
+public:
+	static const unsigned int Version = 1;
+
+	static size_t BlockBytes(BlockFormat format);
+	static size_t CompressedSize(BlockFormat format, unsigned int width, unsigned int height);
+
+	// rgba holds width * height RGBA8 texels. BC1 ignores alpha, BC5 keeps red and green.
+	// Blocks over the edge repeat the edge texels. threadCount 0 uses one thread per hardware thread.
+	static void Compress(BlockFormat format, const unsigned char* rgba, unsigned int width, unsigned int height,
+		std::vector<unsigned char>& blocks, unsigned int threadCount = 0);
+
+	// BC6H of width * height RGBA16F texels, negative values become 0
+	static void CompressHalf(const uint16_t* rgba, unsigned int width, unsigned int height, std::vector<unsigned char>& blocks,
+		unsigned int threadCount = 0);
+
+	// Back to RGBA8, alpha 255 for BC1, blue 0 and alpha 255 for BC5
+	static void Decompress(BlockFormat format, const unsigned char* blocks, unsigned int width, unsigned int height,
+		std::vector<unsigned char>& rgba);
+
+	// BC6H back to RGBA16F. Only mode 11, the one written here, is decoded, other blocks are black.
+	static void DecompressHalf(const unsigned char* blocks, unsigned int width, unsigned int height, std::vector<uint16_t>& rgba);
+
+	// Single blocks of 16 texels, row after row
+	static void EncodeBC1Block(const unsigned char rgba[64], unsigned char block[8]);
+	static void EncodeBC1BlockScalar(const unsigned char rgba[64], unsigned char block[8]);
+	static void EncodeBC4Block(const unsigned char values[16], unsigned char block[8]);
+	static void EncodeBC6HBlock(const uint16_t rgba[64], unsigned char block[16]);
+	static void EncodeBC6HBlockScalar(const uint16_t rgba[64], unsigned char block[16]);
+
+	// BC1 for opaque texels, BC3 when any alpha is below 255
+	static BlockFormat ChooseColorFormat(const unsigned char* rgba, unsigned int width, unsigned int height);
+
+	// The RGBA8 texels as a .dds of format, keyed by the size and hash of the source file and by
+	// setting, what the caller made the texels with. rgba holds mipCount mips, mip 0 first as
+	// written by MipGenerator. false when width or height is not a multiple of 4.
+	static bool CompressDds(BlockFormat format, const unsigned char* rgba, unsigned int width, unsigned int height, unsigned int mipCount,
+		uint32_t setting, uint64_t sourceHash, uint64_t sourceSize, std::vector<unsigned char>& dds, unsigned int threadCount = 0);
+
+	// A cooked RGBA16F .dds (CubemapConverter, EnvironmentPrefilter) as BC6H with its mips, faces
+	// and source key, false if source is not one
+	static bool CompressHalfDds(const std::vector<unsigned char>& source, std::vector<unsigned char>& dds, unsigned int threadCount = 0);
+
+	// Reads the BC6H cache of a cooked RGBA16F .dds, compressing source and writing cacheFile
+	// when the cache is missing or stale
+	static bool LoadHalfDds(const std::string& cacheFile, const std::vector<unsigned char>& source, std::vector<unsigned char>& dds,
+		unsigned int threadCount = 0);
+
+	// The BC1 or BC3 cache of an image file and its layout, without reading its texels. false
+	// when there is none for the file as it is now and for setting.
+	static bool FindTextureCache(const std::string& sourceFile, uint32_t setting, std::string& cacheFile, CookedDds& desc);
+
+	// Reads the BC1 or BC3 cache of an image file, false when there is none for the file as it is
+	// now and for setting
+	static bool ReadTextureCache(const std::string& sourceFile, uint32_t setting, std::vector<unsigned char>& dds);
+
+	// Compresses the decoded mips of an image file to BC1 or BC3 and writes the cache next to it.
+	// false when the size is not a multiple of 4, the texels are used as they are then.
+	static bool CookTexture(const std::string& sourceFile, uint32_t setting, const unsigned char* rgba, unsigned int width,
+		unsigned int height, unsigned int mipCount, std::vector<unsigned char>& dds, unsigned int threadCount = 0);
+
+	// "<name>.<format>.dds" next to sourceFile
+	static std::string CacheFileName(const std::string& sourceFile, BlockFormat format);
+};
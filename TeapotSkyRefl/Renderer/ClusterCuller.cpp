@@ -0,0 +1,116 @@
+#include "ClusterCuller.h"
+
+void ClusterCuller::ExtractPlanes(CXMMATRIX worldViewProj, XMFLOAT4 planes[6])
+{
+	// Gribb/Hartmann plane extraction on the columns of the object to clip matrix,
+	// with D3D depth in [0, w]
+	XMMATRIX m = XMMatrixTranspose(worldViewProj);
+	XMVECTOR rows[6];
+	rows[0] = XMVectorAdd(m.r[3], m.r[0]);
+	rows[1] = XMVectorSubtract(m.r[3], m.r[0]);
+	rows[2] = XMVectorAdd(m.r[3], m.r[1]);
+	rows[3] = XMVectorSubtract(m.r[3], m.r[1]);
+	rows[4] = m.r[2];
+	rows[5] = XMVectorSubtract(m.r[3], m.r[2]);
+
+	for (int i = 0; i < 6; ++i)
+	{
+		XMStoreFloat4(&planes[i], XMPlaneNormalize(rows[i]));
+	}
+}
+
+ClusterCuller::ClusterCuller(CXMMATRIX world, CXMMATRIX view, CXMMATRIX proj)
+{
+	ExtractPlanes(world * view * proj, mPlanes);
+
+	XMVECTOR determinant;
+	XMMATRIX invWorld = XMMatrixInverse(&determinant, world);
+	XMMATRIX invView = XMMatrixInverse(NULL, view);
+	XMStoreFloat3(&mCameraPosition, XMVector3TransformCoord(invView.r[3], invWorld));
+
+	mTestCones = XMVectorGetX(determinant) > 0.0f;
+}
+
+bool ClusterCuller::IsVisible(const Meshlet& meshlet, ClusterCullStats* stats) const
+{
+	XMVECTOR center = XMLoadFloat3(&meshlet.center);
+
+	// sphere fully behind any plane
+	for (int i = 0; i < 6; ++i)
+	{
+		float distance = XMVectorGetX(XMPlaneDotCoord(XMLoadFloat4(&mPlanes[i]), center));
+		if (distance < -meshlet.radius)
+		{
+			if (stats)
+				stats->frustumCulled++;
+			return false;
+		}
+	}
+
+	// every triangle faces away from any point of the sphere when the
+	// view direction lies within the cone widened by the sphere
+	if (mTestCones && meshlet.coneCutoff <= 1.0f)
+	{
+		XMVECTOR toCenter = XMVectorSubtract(center, XMLoadFloat3(&mCameraPosition));
+		float d = XMVectorGetX(XMVector3Dot(toCenter, XMLoadFloat3(&meshlet.coneAxis)));
+		float distance = XMVectorGetX(XMVector3Length(toCenter));
+		if (d >= meshlet.coneCutoff * distance + meshlet.radius)
+		{
+			if (stats)
+				stats->backfaceCulled++;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ClusterCuller::Cull(const Meshlet* meshlets, size_t meshletCount, std::vector<DrawRange>& ranges, ClusterCullStats* stats) const
+{
+	ranges.clear();
+
+	for (size_t i = 0; i < meshletCount; ++i)
+	{
+		const Meshlet& meshlet = meshlets[i];
+
+		if (stats)
+		{
+			stats->meshlets++;
+			stats->triangles += meshlet.triangleCount;
+		}
+
+		if (!IsVisible(meshlet, stats))
+			continue;
+
+		if (stats)
+		{
+			stats->visibleMeshlets++;
+			stats->visibleTriangles += meshlet.triangleCount;
+		}
+
+		// meshlets are contiguous in the index buffer, grow the last range when possible
+		UINT indexCount = meshlet.triangleCount * 3;
+		if (!ranges.empty() && ranges.back().indexOffset + ranges.back().indexCount == meshlet.indexOffset)
+		{
+			ranges.back().indexCount += indexCount;
+		}
+		else
+		{
+			DrawRange range = { meshlet.indexOffset, indexCount };
+			ranges.push_back(range);
+		}
+	}
+}
+
+void ClusterCuller::Cull(const std::vector<Meshlet>& meshlets, const UINT* indices, std::vector<UINT>& visibleIndices,
+	ClusterCullStats* stats) const
+{
+	std::vector<DrawRange> ranges;
+	Cull(meshlets, ranges, stats);
+
+	visibleIndices.clear();
+	for (const DrawRange& range : ranges)
+	{
+		visibleIndices.insert(visibleIndices.end(), indices + range.indexOffset, indices + range.indexOffset + range.indexCount);
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Util.h"
+#include "MeshletBuilder.h"
+
+// ClusterCuller
+// Culls the meshlets of a mesh against a camera frustum and their backface
+// normal cones. The tests run in object space: the frustum planes come from
+// world * view * proj and the camera position from the inverse world matrix,
+// so the meshlet bounds never need to be transformed.
+// The result is either a list of index ranges, adjacent visible meshlets merged
+// into one range, or a compacted index list holding only the visible triangles.
+// usage:
+// ClusterCuller culler(world, camera.View(), camera.Proj());
+// culler.Cull(mesh->mMeshlets, ranges, &stats);
+// mesh->RenderRanges(context, ranges);
+
+struct DrawRange
+{
+	UINT indexOffset;
+	UINT indexCount;
+};
+
+struct ClusterCullStats
+{
+	ClusterCullStats() { ZeroMemory(this, sizeof(*this)); }
+
+	UINT meshlets;
+	UINT visibleMeshlets;
+	UINT frustumCulled;		// meshlets
+	UINT backfaceCulled;	// meshlets
+	UINT triangles;
+	UINT visibleTriangles;
+};
+
+class ClusterCuller
+{
+public:
+	ClusterCuller(CXMMATRIX world, CXMMATRIX view, CXMMATRIX proj);
+
+	// false if the meshlet is outside the frustum or all of its triangles face away from the camera
+	bool IsVisible(const Meshlet& meshlet, ClusterCullStats* stats = NULL) const;
+
+	// visible meshlets as draw ranges, stats are accumulated
+	void Cull(const Meshlet* meshlets, size_t meshletCount, std::vector<DrawRange>& ranges, ClusterCullStats* stats = NULL) const;
+	void Cull(const std::vector<Meshlet>& meshlets, std::vector<DrawRange>& ranges, ClusterCullStats* stats = NULL) const
+	{
+		Cull(meshlets.data(), meshlets.size(), ranges, stats);
+	}
+
+	// indices of the visible meshlets copied to visibleIndices, stats are accumulated
+	void Cull(const std::vector<Meshlet>& meshlets, const UINT* indices, std::vector<UINT>& visibleIndices,
+		ClusterCullStats* stats = NULL) const;
+
+	// normalized frustum planes of a world * view * proj matrix, in the order of mPlanes
+	static void ExtractPlanes(CXMMATRIX worldViewProj, XMFLOAT4 planes[6]);
+
+private:
+	// left, right, bottom, top, near, far; normals point inside
+	XMFLOAT4 mPlanes[6];
+
+	XMFLOAT3 mCameraPosition;
+
+	// mirrored world matrices flip the winding, cones are not tested then
+	bool mTestCones;
+};
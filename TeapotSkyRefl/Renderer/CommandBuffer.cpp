@@ -0,0 +1,106 @@
+#include "CommandBuffer.h"
+
+// words of a draw after the command word: the packet key, then its ids and range
+static const size_t DrawWords = 10;
+
+void CommandBuffer::Reset()
+{
+	mCommandCount = 0;
+	mWords.clear();
+}
+
+void CommandBuffer::BeginPass(uint32_t pass)
+{
+	Write(COMMAND_BEGIN_PASS, pass);
+}
+
+void CommandBuffer::SetShader(uint32_t shader)
+{
+	Write(COMMAND_SET_SHADER, shader);
+}
+
+void CommandBuffer::SetTexture(uint32_t texture)
+{
+	Write(COMMAND_SET_TEXTURE, texture);
+}
+
+void CommandBuffer::SetMesh(uint32_t mesh)
+{
+	Write(COMMAND_SET_MESH, mesh);
+}
+
+void CommandBuffer::SetConstants(uint32_t constants)
+{
+	Write(COMMAND_SET_CONSTANTS, constants);
+}
+
+void CommandBuffer::SetMaterial(uint32_t mesh, uint32_t material)
+{
+	Write(COMMAND_SET_MATERIAL, mesh);
+	mWords.push_back(material);
+}
+
+void CommandBuffer::Draw(const DrawPacket& packet)
+{
+	Write(COMMAND_DRAW, (uint32_t)packet.key);
+	const uint32_t words[DrawWords - 1] =
+	{
+		(uint32_t)(packet.key >> 32), packet.pass, packet.shader, packet.texture, packet.mesh, packet.constants, packet.material,
+		packet.rangeOffset, packet.rangeCount
+	};
+	mWords.insert(mWords.end(), words, words + DrawWords - 1);
+}
+
+void CommandBuffer::Replay(RenderBackend& backend) const
+{
+	const uint32_t* words = mWords.data();
+	const uint32_t* end = words + mWords.size();
+	while (words < end)
+	{
+		Command command = (Command)words[0];
+		uint32_t value = words[1];
+		words += 2;
+
+		switch (command)
+		{
+		case COMMAND_BEGIN_PASS:
+			backend.BeginPass(value);
+			break;
+		case COMMAND_SET_SHADER:
+			backend.SetShader(value);
+			break;
+		case COMMAND_SET_TEXTURE:
+			backend.SetTexture(value);
+			break;
+		case COMMAND_SET_MESH:
+			backend.SetMesh(value);
+			break;
+		case COMMAND_SET_CONSTANTS:
+			backend.SetConstants(value);
+			break;
+		case COMMAND_SET_MATERIAL:
+			backend.SetMaterial(value, words[0]);
+			words += 1;
+			break;
+		case COMMAND_DRAW:
+		{
+			DrawPacket packet;
+			packet.key = ((uint64_t)words[0] << 32) | value;
+			packet.pass = words[1];
+			packet.shader = words[2];
+			packet.texture = words[3];
+			packet.mesh = words[4];
+			packet.constants = words[5];
+			packet.material = words[6];
+			packet.rangeOffset = words[7];
+			packet.rangeCount = words[8];
+			backend.Draw(packet);
+			words += DrawWords - 1;
+			break;
+		}
+		default:
+			// a stream out of sync, the rest can not be read
+			return;
+		}
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "RenderQueue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CommandBuffer
+// The binds and draws of a pass recorded as a stream of 32 bit words, to be replayed
+// later on any RenderBackend. A command buffer is a RenderBackend itself, so a pass
+// is recorded by executing its RenderQueue into it; recording needs no device and
+// several passes can be recorded on worker threads at once, one buffer each.
+// Replay calls the backend in recorded order, e.g. a D3D11 backend on the immediate
+// context or on a deferred context. The buffers are replayed one by one in pass order,
+// with the render targets of each pass set in between, so the order of the calls does
+// not depend on which thread finished first. NullRenderBackend only counts the calls,
+// for measuring recording and replay without a device.
+// Only the standard library is used.
+// usage:
+// ParallelFor(passCount, 1, [&](size_t begin, size_t end) { ...
+//     buffers[pass].Reset(); queues[pass].Execute(buffers[pass]); });
+// for every pass: set its targets, buffers[pass].Replay(d3dBackend);
+
+class CommandBuffer : public RenderBackend
+{
+public:
+	enum Command
+	{
+		COMMAND_BEGIN_PASS = 0,
+		COMMAND_SET_SHADER,
+		COMMAND_SET_TEXTURE,
+		COMMAND_SET_MESH,
+		COMMAND_SET_CONSTANTS,
+		COMMAND_SET_MATERIAL,
+		COMMAND_DRAW,
+		COMMAND_COUNT
+	};
+
+	CommandBuffer() : mCommandCount(0) {}
+
+	// drops the recorded commands, the memory is kept for the next recording
+	void Reset();
+
+	size_t GetCommandCount() const { return mCommandCount; }
+	size_t GetSizeBytes() const { return mWords.size() * sizeof(uint32_t); }
+	bool IsEmpty() const { return mCommandCount == 0; }
+
+	// records the calls
+	void BeginPass(uint32_t pass);
+	void SetShader(uint32_t shader);
+	void SetTexture(uint32_t texture);
+	void SetMesh(uint32_t mesh);
+	void SetConstants(uint32_t constants);
+	void SetMaterial(uint32_t mesh, uint32_t material);
+	void Draw(const DrawPacket& packet);
+
+	// calls the backend with every recorded command in order
+	void Replay(RenderBackend& backend) const;
+
+	// the recorded words, equal streams replay the same calls
+	const std::vector<uint32_t>& GetWords() const { return mWords; }
+
+private:
+	void Write(Command command, uint32_t value)
+	{
+		mWords.push_back((uint32_t)command);
+		mWords.push_back(value);
+		mCommandCount++;
+	}
+
+	size_t mCommandCount;
+	std::vector<uint32_t> mWords;
+};
+
+// RenderBackend that only counts the calls
+class NullRenderBackend : public RenderBackend
+{
+public:
+	NullRenderBackend() : mCalls(0), mDraws(0) {}
+
+	void BeginPass(uint32_t /*pass*/) { mCalls++; }
+	void SetShader(uint32_t /*shader*/) { mCalls++; }
+	void SetTexture(uint32_t /*texture*/) { mCalls++; }
+	void SetMesh(uint32_t /*mesh*/) { mCalls++; }
+	void SetConstants(uint32_t /*constants*/) { mCalls++; }
+	void SetMaterial(uint32_t /*mesh*/, uint32_t /*material*/) { mCalls++; }
+	void Draw(const DrawPacket& packet) { mCalls++; mDraws += packet.rangeCount; }
+
+	size_t GetCallCount() const { return mCalls; }
+	size_t GetDrawCount() const { return mDraws; }
+
+private:
+	size_t mCalls;
+	size_t mDraws;
+};
@@ -0,0 +1,363 @@
+#include "CubemapConverter.h"
+#include "VertexPacking.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+static const float Pi = 3.14159265358979f;
+
+// D3D11 limit for the faces of a cube texture
+static const unsigned int MaxFaceSize = 16384;
+
+// Most samples per texel axis when the faces are smaller than the source
+static const unsigned int MaxSamples = 8;
+
+// Legacy DDS header as 32 bit words after the "DDS " magic, see DDS_HEADER
+static const uint32_t DdsMagic = 0x20534444;
+static const size_t DdsHeaderWords = 32;
+static const size_t DdsReservedWord = 8;
+static const size_t DdsHeaderDx10Words = 5;
+
+CookedDds::CookedDds() :
+	width(0), height(0), mipCount(1), cube(false), fourCC(CubemapConverter::FourCCHalf4), dxgiFormat(0), version(0), setting(0),
+	sourceHash(0), sourceSize(0)
+{
+}
+
+size_t CookedDds::HeaderSize() const
+{
+	return (DdsHeaderWords + (fourCC == CubemapConverter::FourCCDx10 ? DdsHeaderDx10Words : 0)) * sizeof(uint32_t);
+}
+
+size_t CookedDds::MipSize(unsigned int mip) const
+{
+	size_t mipWidth = std::max(width >> mip, 1u);
+	size_t mipHeight = std::max(height >> mip, 1u);
+
+	// 4 x 4 texel blocks of 8 or 16 bytes
+	if (fourCC == CubemapConverter::FourCCDxt1 || fourCC == CubemapConverter::FourCCDxt5 || fourCC == CubemapConverter::FourCCAti2 ||
+		fourCC == CubemapConverter::FourCCDx10)
+	{
+		return ((mipWidth + 3) / 4) * ((mipHeight + 3) / 4) * (fourCC == CubemapConverter::FourCCDxt1 ? 8 : 16);
+	}
+
+	return mipWidth * mipHeight * (fourCC == CubemapConverter::FourCCHalf2 ? 4 : 8);
+}
+
+size_t CookedDds::DataSize() const
+{
+	size_t size = 0;
+	for (unsigned int mip = 0; mip < mipCount; ++mip)
+	{
+		size += MipSize(mip);
+	}
+	return cube ? size * CubemapConverter::FaceCount : size;
+}
+
+void CubemapConverter::FaceDirection(unsigned int face, float u, float v, float direction[3])
+{
+	float x, y, z;
+	switch (face)
+	{
+	case 0: x = 1.0f; y = -v; z = -u; break;
+	case 1: x = -1.0f; y = -v; z = u; break;
+	case 2: x = u; y = 1.0f; z = v; break;
+	case 3: x = u; y = -1.0f; z = -v; break;
+	case 4: x = u; y = -v; z = 1.0f; break;
+	default: x = -u; y = -v; z = -1.0f; break;
+	}
+
+	float invLength = 1.0f / sqrtf(x * x + y * y + z * z);
+	direction[0] = x * invLength;
+	direction[1] = y * invLength;
+	direction[2] = z * invLength;
+}
+
+// Bilinear sample of the equirect image in direction, wrapping around in longitude
+static void SampleEquirect(const HdrImage& image, const float direction[3], float color[4])
+{
+	float s = (0.5f + atan2f(direction[0], direction[2]) * (0.5f / Pi)) * image.width - 0.5f;
+	float t = acosf(std::min(std::max(direction[1], -1.0f), 1.0f)) / Pi * image.height - 0.5f;
+
+	float fs = floorf(s);
+	float ft = floorf(t);
+	float wx = s - fs;
+	float wy = t - ft;
+
+	int width = (int)image.width;
+	int height = (int)image.height;
+	int x0 = ((int)fs % width + width) % width;
+	int x1 = (x0 + 1) % width;
+	int y0 = std::min(std::max((int)ft, 0), height - 1);
+	int y1 = std::min(std::max((int)ft + 1, 0), height - 1);
+
+	const float* p00 = &image.pixels[((size_t)y0 * width + x0) * 4];
+	const float* p10 = &image.pixels[((size_t)y0 * width + x1) * 4];
+	const float* p01 = &image.pixels[((size_t)y1 * width + x0) * 4];
+	const float* p11 = &image.pixels[((size_t)y1 * width + x1) * 4];
+
+	for (int k = 0; k < 4; ++k)
+	{
+		float top = p00[k] + (p10[k] - p00[k]) * wx;
+		float bottom = p01[k] + (p11[k] - p01[k]) * wx;
+		color[k] = top + (bottom - top) * wy;
+	}
+}
+
+void CubemapConverter::EquirectToCubemap(const HdrImage& equirect, unsigned int faceSize, std::vector<uint16_t>& faces,
+	unsigned int threadCount)
+{
+	size_t rowTexels = (size_t)faceSize * 4;
+	faces.assign(FaceCount * faceSize * rowTexels, 0);
+	if (faceSize == 0 || equirect.width == 0 || equirect.height == 0)
+		return;
+
+	// a face covers a quarter of the source width
+	unsigned int samples = (equirect.width / 4 + faceSize - 1) / faceSize;
+	samples = std::min(std::max(samples, 1u), MaxSamples);
+	float invSamples = 1.0f / samples;
+	float weight = invSamples * invSamples;
+
+	ParallelFor((size_t)FaceCount * faceSize, 16, threadCount, [&](size_t begin, size_t end)
+	{
+		std::vector<float> row(rowTexels);
+		for (size_t r = begin; r < end; ++r)
+		{
+			unsigned int face = (unsigned int)(r / faceSize);
+			unsigned int y = (unsigned int)(r % faceSize);
+
+			for (unsigned int x = 0; x < faceSize; ++x)
+			{
+				float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (unsigned int sy = 0; sy < samples; ++sy)
+				{
+					float v = (y + (sy + 0.5f) * invSamples) / faceSize * 2.0f - 1.0f;
+					for (unsigned int sx = 0; sx < samples; ++sx)
+					{
+						float u = (x + (sx + 0.5f) * invSamples) / faceSize * 2.0f - 1.0f;
+
+						float direction[3], color[4];
+						FaceDirection(face, u, v, direction);
+						SampleEquirect(equirect, direction, color);
+						for (int k = 0; k < 4; ++k)
+						{
+							sum[k] += color[k];
+						}
+					}
+				}
+
+				for (int k = 0; k < 4; ++k)
+				{
+					row[x * 4 + k] = sum[k] * weight;
+				}
+			}
+
+			ConvertFloatsToHalves(row.data(), rowTexels, &faces[r * rowTexels]);
+		}
+	});
+}
+
+void CubemapConverter::WriteDds(const CookedDds& desc, const void* data, std::vector<unsigned char>& dds)
+{
+	bool compressed = desc.fourCC != FourCCHalf2 && desc.fourCC != FourCCHalf4;
+
+	uint32_t header[DdsHeaderWords + DdsHeaderDx10Words] = {};
+	header[0] = DdsMagic;
+	header[1] = 124;									// size
+	header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000;		// caps, height, width, pixel format, mipmap count
+	header[2] |= compressed ? 0x80000 : 0x8;			// linear size or pitch
+	header[3] = desc.height;
+	header[4] = desc.width;
+	header[5] = compressed ? (uint32_t)desc.MipSize(0) : (uint32_t)(desc.MipSize(0) / desc.height);
+	header[7] = desc.mipCount;
+	header[DdsReservedWord + 0] = Magic;
+	header[DdsReservedWord + 1] = desc.version;
+	header[DdsReservedWord + 2] = desc.setting;
+	header[DdsReservedWord + 3] = (uint32_t)desc.sourceHash;
+	header[DdsReservedWord + 4] = (uint32_t)(desc.sourceHash >> 32);
+	header[DdsReservedWord + 5] = (uint32_t)desc.sourceSize;
+	header[DdsReservedWord + 6] = (uint32_t)(desc.sourceSize >> 32);
+	header[19] = 32;									// pixel format size
+	header[20] = 0x4;									// four cc
+	header[21] = desc.fourCC;
+	header[27] = 0x1000;								// texture
+	if (desc.cube || desc.mipCount > 1)
+		header[27] |= 0x8;								// complex
+	if (desc.mipCount > 1)
+		header[27] |= 0x400000;							// mipmap
+	if (desc.cube)
+		header[28] = 0x200 | 0xfc00;					// cubemap with all faces
+
+	if (desc.fourCC == FourCCDx10)
+	{
+		header[DdsHeaderWords + 0] = desc.dxgiFormat;
+		header[DdsHeaderWords + 1] = 3;					// texture 2D
+		header[DdsHeaderWords + 2] = desc.cube ? 0x4 : 0;	// texture cube
+		header[DdsHeaderWords + 3] = 1;					// array size
+	}
+
+	size_t headerSize = desc.HeaderSize();
+	size_t dataSize = desc.DataSize();
+	dds.resize(headerSize + dataSize);
+	memcpy(dds.data(), header, headerSize);
+	memcpy(dds.data() + headerSize, data, dataSize);
+}
+
+bool CubemapConverter::ReadDdsHeader(const unsigned char* data, size_t size, CookedDds& desc)
+{
+	uint32_t header[DdsHeaderWords + DdsHeaderDx10Words] = {};
+	if (size < DdsHeaderWords * sizeof(uint32_t))
+		return false;
+	memcpy(header, data, DdsHeaderWords * sizeof(uint32_t));
+	if (header[0] != DdsMagic || header[DdsReservedWord] != Magic)
+		return false;
+
+	desc.height = header[3];
+	desc.width = header[4];
+	desc.mipCount = std::max(header[7], 1u);
+	desc.fourCC = header[21];
+	desc.cube = header[28] != 0;
+	desc.dxgiFormat = 0;
+	desc.version = header[DdsReservedWord + 1];
+	desc.setting = header[DdsReservedWord + 2];
+	desc.sourceHash = header[DdsReservedWord + 3] | ((uint64_t)header[DdsReservedWord + 4] << 32);
+	desc.sourceSize = header[DdsReservedWord + 5] | ((uint64_t)header[DdsReservedWord + 6] << 32);
+
+	if (desc.fourCC == FourCCDx10)
+	{
+		if (size < desc.HeaderSize())
+			return false;
+		memcpy(header + DdsHeaderWords, data + DdsHeaderWords * sizeof(uint32_t), DdsHeaderDx10Words * sizeof(uint32_t));
+		desc.dxgiFormat = header[DdsHeaderWords];
+	}
+
+	return true;
+}
+
+bool CubemapConverter::ReadDdsDesc(const std::vector<unsigned char>& dds, CookedDds& desc)
+{
+	return ReadDdsHeader(dds.data(), dds.size(), desc) && dds.size() == desc.HeaderSize() + desc.DataSize();
+}
+
+bool CubemapConverter::IsCacheValid(const std::vector<unsigned char>& dds, const CookedDds& desc)
+{
+	if (dds.size() != desc.HeaderSize() + desc.DataSize())
+		return false;
+
+	uint32_t header[DdsHeaderWords + DdsHeaderDx10Words] = {};
+	memcpy(header, dds.data(), desc.HeaderSize());
+
+	return header[0] == DdsMagic &&
+		(desc.fourCC != FourCCDx10 || header[DdsHeaderWords] == desc.dxgiFormat) &&
+		header[3] == desc.height &&
+		header[4] == desc.width &&
+		header[7] == desc.mipCount &&
+		header[21] == desc.fourCC &&
+		(header[28] != 0) == desc.cube &&
+		header[DdsReservedWord + 0] == Magic &&
+		header[DdsReservedWord + 1] == desc.version &&
+		header[DdsReservedWord + 2] == desc.setting &&
+		header[DdsReservedWord + 3] == (uint32_t)desc.sourceHash &&
+		header[DdsReservedWord + 4] == (uint32_t)(desc.sourceHash >> 32) &&
+		header[DdsReservedWord + 5] == (uint32_t)desc.sourceSize &&
+		header[DdsReservedWord + 6] == (uint32_t)(desc.sourceSize >> 32);
+}
+
+bool CubemapConverter::ReadCache(const std::string& cacheFile, const CookedDds& desc, std::vector<unsigned char>& dds)
+{
+	std::ifstream cache(cacheFile, std::ios::binary | std::ios::ate);
+	if (!cache)
+		return false;
+
+	dds.resize((size_t)cache.tellg());
+	cache.seekg(0);
+	cache.read((char*)dds.data(), dds.size());
+	if (cache && IsCacheValid(dds, desc))
+		return true;
+
+	dds.clear();
+	return false;
+}
+
+bool CubemapConverter::WriteCache(const std::string& cacheFile, const std::vector<unsigned char>& dds)
+{
+	std::ofstream cache(cacheFile, std::ios::binary | std::ios::trunc);
+	if (!cache)
+		return false;
+
+	cache.write((const char*)dds.data(), dds.size());
+	return (bool)cache;
+}
+
+std::string CubemapConverter::CacheFileName(const std::string& equirectFile, unsigned int faceSize)
+{
+	return CacheFileName(equirectFile, ".cube" + std::to_string(faceSize) + ".dds");
+}
+
+std::string CubemapConverter::CacheFileName(const std::string& sourceFile, const std::string& suffix)
+{
+	size_t dot = sourceFile.find_last_of('.');
+	size_t slash = sourceFile.find_last_of("\\/");
+	std::string base = (dot != std::string::npos && (slash == std::string::npos || dot > slash)) ? sourceFile.substr(0, dot) : sourceFile;
+	return base + suffix;
+}
+
+bool CubemapConverter::HashFile(const std::string& filename, uint64_t& hash, uint64_t& size)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	// FNV-1a, as for the mesh cache
+	hash = 14695981039346656037ULL;
+	size = 0;
+
+	std::vector<char> buffer(64 * 1024);
+	while (file)
+	{
+		file.read(buffer.data(), buffer.size());
+		size_t count = (size_t)file.gcount();
+		for (size_t i = 0; i < count; ++i)
+		{
+			hash ^= (unsigned char)buffer[i];
+			hash *= 1099511628211ULL;
+		}
+		size += count;
+	}
+
+	return true;
+}
+
+bool CubemapConverter::LoadCubemap(const std::string& equirectFile, unsigned int faceSize, std::vector<unsigned char>& dds,
+	unsigned int threadCount)
+{
+	dds.clear();
+	if (faceSize == 0 || faceSize > MaxFaceSize)
+		return false;
+
+	CookedDds desc;
+	desc.width = desc.height = faceSize;
+	desc.cube = true;
+	desc.version = Version;
+	desc.setting = faceSize;
+	if (!HashFile(equirectFile, desc.sourceHash, desc.sourceSize))
+		return false;
+
+	std::string cacheFile = CacheFileName(equirectFile, faceSize);
+	if (ReadCache(cacheFile, desc, dds))
+		return true;
+
+	HdrImage image;
+	if (!RadianceHdr::Read(equirectFile, image))
+		return false;
+
+	std::vector<uint16_t> faces;
+	EquirectToCubemap(image, faceSize, faces, threadCount);
+	WriteDds(desc, faces.data(), dds);
+	WriteCache(cacheFile, dds);
+
+	return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "RadianceHdr.h"
+
+// CubemapConverter
+// Resamples an equirectangular (latitude-longitude) image into the six faces
+// of a cubemap with a selectable face size. Face rows are spread over threads
+// with ParallelFor, every texel averages n x n bilinear samples of the source,
+// n growing when the faces are smaller than the source, and is stored as RGBA16F.
+// The result is cooked to a .dds next to the source image, the DDS header keeps
+// the size and hash of the source so a changed .hdr is converted again.
+// Faces are in D3D order +X, -X, +Y, -Y, +Z, -Z with +Y up, the centre of the
+// source image looks down +Z. Only the standard library is used, as in RadianceHdr.
+// usage:
+// std::vector<unsigned char> dds;
+// CubemapConverter::LoadCubemap("..\\Assets\\approaching_storm_1k.hdr", 512, dds);
+
+// Texture cooked to a .dds, RGBA16F, RG16F or block compressed, mip after mip and for a
+// cube face after face. The reserved words of the header keep the cooker version, one
+// cooker setting and the size and hash of the source, a file that does not match them is stale.
+struct CookedDds
+{
+	CookedDds();
+
+	// bytes before and after the data, the DX10 header follows the legacy one for dxgiFormat
+	size_t HeaderSize() const;
+	size_t DataSize() const;
+
+	// bytes of mip of one face
+	size_t MipSize(unsigned int mip) const;
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int mipCount;
+	bool cube;
+	uint32_t fourCC;
+	uint32_t dxgiFormat;	// with fourCC FourCCDx10
+	unsigned int version;
+	unsigned int setting;
+	uint64_t sourceHash;
+	uint64_t sourceSize;
+};
+
+class CubemapConverter
+{
+public:
+	static const unsigned int FaceCount = 6;
+	static const unsigned int Magic = 0x42554354; // "TCUB", in the reserved words of the DDS header
+	static const unsigned int Version = 1;
+
+	// bytes before the faces in the .dds
+	static const size_t DdsHeaderSize = 128;
+
+	// CookedDds formats
+	static const uint32_t FourCCHalf2 = 112;	// D3DFMT_G16R16F
+	static const uint32_t FourCCHalf4 = 113;	// D3DFMT_A16B16G16R16F
+	static const uint32_t FourCCDxt1 = 0x31545844;	// "DXT1", BC1
+	static const uint32_t FourCCDxt5 = 0x35545844;	// "DXT5", BC3
+	static const uint32_t FourCCAti2 = 0x32495441;	// "ATI2", BC5
+	static const uint32_t FourCCDx10 = 0x30315844;	// "DX10", dxgiFormat in the extended header
+	static const uint32_t DxgiFormatBC6HUF16 = 95;
+
+	// Unit direction through the face point (u, v), both in [-1, 1], v down
+	static void FaceDirection(unsigned int face, float u, float v, float direction[3]);
+
+	// faces receives FaceCount * faceSize * faceSize RGBA16F texels, face after face.
+	// threadCount 0 uses one thread per hardware thread.
+	static void EquirectToCubemap(const HdrImage& equirect, unsigned int faceSize, std::vector<uint16_t>& faces,
+		unsigned int threadCount = 0);
+
+	// .dds file in memory, data holds desc.DataSize() bytes
+	static void WriteDds(const CookedDds& desc, const void* data, std::vector<unsigned char>& dds);
+
+	// The layout of a cooked .dds from the first size bytes of it, the header, false if it is not one
+	static bool ReadDdsHeader(const unsigned char* data, size_t size, CookedDds& desc);
+
+	// The layout of a cooked .dds, false if dds is not one
+	static bool ReadDdsDesc(const std::vector<unsigned char>& dds, CookedDds& desc);
+
+	// Reads cacheFile into dds, false when it is missing or does not match desc
+	static bool ReadCache(const std::string& cacheFile, const CookedDds& desc, std::vector<unsigned char>& dds);
+	static bool WriteCache(const std::string& cacheFile, const std::vector<unsigned char>& dds);
+
+	// "<name>.cube<faceSize>.dds" next to equirectFile
+	static std::string CacheFileName(const std::string& equirectFile, unsigned int faceSize);
+
+	// "<name><suffix>" next to sourceFile
+	static std::string CacheFileName(const std::string& sourceFile, const std::string& suffix);
+
+	// Reads the cooked cubemap of equirectFile, converting it and writing the cache when the cache is
+	// missing or stale. A cache that can not be written still leaves the cubemap in dds.
+	static bool LoadCubemap(const std::string& equirectFile, unsigned int faceSize, std::vector<unsigned char>& dds,
+		unsigned int threadCount = 0);
+
+	static bool HashFile(const std::string& filename, uint64_t& hash, uint64_t& size);
+
+private:
+	static bool IsCacheValid(const std::vector<unsigned char>& dds, const CookedDds& desc);
+};
@@ -6,6 +6,7 @@
 
 #include "ScreenGrab.h"
 #include "TextureManager.h"
+#include "AssetLoader.h"
 
 namespace
 {
@@ -13,6 +14,9 @@ namespace
 	// procedure to our member function window procedure because we cannot
 	// assign a member function to WNDCLASS::lpfnWndProc.
 	D3DRendererApp* gD3DRendererApp = 0;
+
+	// video memory the textures may take before the least recently used are evicted
+	const UINT64 TextureBudgetBytes = 512ull << 20;
 }
 
 LRESULT CALLBACK
@@ -43,8 +47,10 @@ D3DRendererApp::D3DRendererApp(HINSTANCE hInstance)
 	mDepthStencilBuffer(0),
 	mRenderTargetView(0),
 	mDepthStencilView(0),
-	mShowRenderStats(true)
+	mShowRenderStats(true),
+	mAsyncLoading(true)
 {
+	QueryPerformanceCounter(&mStartCounter);
 	ZeroMemory(&mScreenViewport, sizeof(D3D11_VIEWPORT));
 
 	gD3DRendererApp = this;
@@ -54,6 +60,9 @@ D3DRendererApp::D3DRendererApp(HINSTANCE hInstance)
 
 D3DRendererApp::~D3DRendererApp()
 {
+	// the workers may still be loading
+	AssetLoader::Instance()->Release();
+
 	ReleaseCOM(mRenderTargetView);
 	ReleaseCOM(mDepthStencilView);
 	ReleaseCOM(mSwapChain);
@@ -72,6 +81,7 @@ D3DRendererApp::~D3DRendererApp()
 int D3DRendererApp::Run()
 {
 	MSG msg = { 0 };
+	bool firstFrame = true;
 
 	mTimer.Reset();
 
@@ -93,6 +103,15 @@ int D3DRendererApp::Run()
 				Update(mTimer.DeltaTime());
 				Render();
 
+				if (firstFrame)
+				{
+					char text[128];
+					snprintf(text, sizeof(text), "D3DRendererApp: first frame after %.1f ms (%s loading)\n", ElapsedSinceStartMs(),
+						mAsyncLoading ? "async" : "sync");
+					OutputDebugStringA(text);
+					firstFrame = false;
+				}
+
 			}
 			else
 			{
@@ -123,6 +142,10 @@ bool D3DRendererApp::Init()
 
 	// Init texture manager
 	TextureManager::Instance()->Init(md3dDevice);
+	TextureManager::Instance()->SetBudget(TextureBudgetBytes);
+
+	// Init asset loader workers
+	AssetLoader::Instance()->Init(md3dDevice, mAsyncLoading ? AssetLoader::AutoThreadCount : 0);
 
 	return true;
 }
@@ -467,9 +490,18 @@ bool D3DRendererApp::InitD3D()
 
 void D3DRendererApp::ShutDown()
 {
+	AssetLoader::Instance()->Release();
 	TextureManager::Instance()->Release();
 }
 
+double D3DRendererApp::ElapsedSinceStartMs() const
+{
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
+	return (double)(now.QuadPart - mStartCounter.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+}
+
 void D3DRendererApp::CalcFrameStats()
 {
 
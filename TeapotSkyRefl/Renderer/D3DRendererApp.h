@@ -35,6 +35,13 @@ public:
 	HWND      MainWnd()const;
 	float     AspectRatio()const;
 
+	// Loads assets on the AssetLoader workers, set before Init. Without it every
+	// asset is loaded one after another on the main thread before the first frame.
+	void SetAsyncLoading(bool async) { mAsyncLoading = async; }
+
+	// milliseconds since the application object was created
+	double ElapsedSinceStartMs() const;
+
 protected:
 	bool InitWindow();
 	bool InitD3D();
@@ -72,4 +79,7 @@ protected:
 
 	bool mShowRenderStats;
 	FrameStats mFrameStats;
+
+	bool mAsyncLoading;
+	LARGE_INTEGER mStartCounter;
 };
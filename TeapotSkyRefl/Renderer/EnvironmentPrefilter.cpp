@@ -0,0 +1,457 @@
+#include "EnvironmentPrefilter.h"
+#include "VertexPacking.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const float Pi = 3.14159265358979f;
+
+// D3D11 limit for the faces of a cube texture, and the largest lookup table
+static const unsigned int MaxFaceSize = 16384;
+static const unsigned int MaxLutSize = 4096;
+
+// The source cubemap as floats, each level a 2 x 2 box filter of the one above, down to 1 x 1
+class SourcePyramid
+{
+public:
+	SourcePyramid(const uint16_t* faces, unsigned int size)
+	{
+		mSizes.push_back(size);
+		mLevels.push_back(std::vector<float>((size_t)CubemapConverter::FaceCount * size * size * 4));
+		ConvertHalvesToFloats(faces, mLevels[0].size(), mLevels[0].data());
+
+		while (size > 1)
+		{
+			unsigned int parentSize = size;
+			size = std::max(size / 2, 1u);
+			const std::vector<float>& parent = mLevels.back();
+			std::vector<float> level((size_t)CubemapConverter::FaceCount * size * size * 4);
+
+			for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+			{
+				const float* in = &parent[(size_t)face * parentSize * parentSize * 4];
+				float* out = &level[(size_t)face * size * size * 4];
+				for (unsigned int y = 0; y < size; ++y)
+				{
+					unsigned int y0 = std::min(y * 2, parentSize - 1);
+					unsigned int y1 = std::min(y * 2 + 1, parentSize - 1);
+					for (unsigned int x = 0; x < size; ++x)
+					{
+						unsigned int x0 = std::min(x * 2, parentSize - 1);
+						unsigned int x1 = std::min(x * 2 + 1, parentSize - 1);
+						for (int k = 0; k < 4; ++k)
+						{
+							out[(y * size + x) * 4 + k] = 0.25f * (in[(y0 * parentSize + x0) * 4 + k] + in[(y0 * parentSize + x1) * 4 + k] +
+								in[(y1 * parentSize + x0) * 4 + k] + in[(y1 * parentSize + x1) * 4 + k]);
+						}
+					}
+				}
+			}
+
+			mSizes.push_back(size);
+			mLevels.push_back(std::move(level));
+		}
+	}
+
+	unsigned int LevelCount() const { return (unsigned int)mLevels.size(); }
+
+	// Trilinear sample in unit direction, lod 0 is the source
+	void Sample(const float direction[3], float lod, float color[3]) const
+	{
+		unsigned int face;
+		float u, v;
+		DirectionToFace(direction, face, u, v);
+
+		lod = std::min(std::max(lod, 0.0f), (float)(LevelCount() - 1));
+		unsigned int level = (unsigned int)lod;
+		float blend = lod - level;
+
+		SampleLevel(level, face, u, v, color);
+		if (blend > 0.0f && level + 1 < LevelCount())
+		{
+			float next[3];
+			SampleLevel(level + 1, face, u, v, next);
+			for (int k = 0; k < 3; ++k)
+			{
+				color[k] += (next[k] - color[k]) * blend;
+			}
+		}
+	}
+
+private:
+	// Inverse of CubemapConverter::FaceDirection, face of the major axis
+	static void DirectionToFace(const float d[3], unsigned int& face, float& u, float& v)
+	{
+		float ax = fabsf(d[0]), ay = fabsf(d[1]), az = fabsf(d[2]);
+		if (ax >= ay && ax >= az)
+		{
+			face = d[0] > 0.0f ? 0 : 1;
+			u = (d[0] > 0.0f ? -d[2] : d[2]) / ax;
+			v = -d[1] / ax;
+		}
+		else if (ay >= az)
+		{
+			face = d[1] > 0.0f ? 2 : 3;
+			u = d[0] / ay;
+			v = (d[1] > 0.0f ? d[2] : -d[2]) / ay;
+		}
+		else
+		{
+			face = d[2] > 0.0f ? 4 : 5;
+			u = (d[2] > 0.0f ? d[0] : -d[0]) / az;
+			v = -d[1] / az;
+		}
+	}
+
+	// Bilinear inside the face, clamped at its edges
+	void SampleLevel(unsigned int level, unsigned int face, float u, float v, float color[3]) const
+	{
+		int size = (int)mSizes[level];
+		const float* texels = &mLevels[level][(size_t)face * size * size * 4];
+
+		float s = (u + 1.0f) * 0.5f * size - 0.5f;
+		float t = (v + 1.0f) * 0.5f * size - 0.5f;
+		float fs = floorf(s);
+		float ft = floorf(t);
+		float wx = s - fs;
+		float wy = t - ft;
+
+		int x0 = std::min(std::max((int)fs, 0), size - 1);
+		int x1 = std::min(std::max((int)fs + 1, 0), size - 1);
+		int y0 = std::min(std::max((int)ft, 0), size - 1);
+		int y1 = std::min(std::max((int)ft + 1, 0), size - 1);
+
+		const float* p00 = texels + (y0 * size + x0) * 4;
+		const float* p10 = texels + (y0 * size + x1) * 4;
+		const float* p01 = texels + (y1 * size + x0) * 4;
+		const float* p11 = texels + (y1 * size + x1) * 4;
+		for (int k = 0; k < 3; ++k)
+		{
+			float top = p00[k] + (p10[k] - p00[k]) * wx;
+			float bottom = p01[k] + (p11[k] - p01[k]) * wx;
+			color[k] = top + (bottom - top) * wy;
+		}
+	}
+
+	std::vector<unsigned int> mSizes;
+	std::vector<std::vector<float> > mLevels;
+};
+
+// Point i of n of the Hammersley set
+static inline void Hammersley(unsigned int i, unsigned int n, float& e1, float& e2)
+{
+	uint32_t bits = i;
+	bits = (bits << 16) | (bits >> 16);
+	bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+	bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+	bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+	bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+
+	e1 = (float)i / n;
+	e2 = bits * 2.3283064365386963e-10f;
+}
+
+// Half vector around +Z distributed as GGX of alpha
+static inline void ImportanceSampleGGX(float e1, float e2, float alpha, float h[3])
+{
+	float a2 = alpha * alpha;
+	float phi = 2.0f * Pi * e1;
+	float cosTheta = sqrtf((1.0f - e2) / (1.0f + (a2 - 1.0f) * e2));
+	float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+	h[0] = sinTheta * cosf(phi);
+	h[1] = sinTheta * sinf(phi);
+	h[2] = cosTheta;
+}
+
+// Light direction around +Z, its n.l weight and the source lod it is read at
+struct LobeSample
+{
+	float direction[3];
+	float weight;
+	float lod;
+};
+
+// Samples of the GGX lobe with n = v = +Z, lod from the solid angle of the sample against
+// that of a source texel (filtered importance sampling, Krivanek 2008)
+static void BuildLobe(float roughness, unsigned int sampleCount, unsigned int sourceSize, float minLod, std::vector<LobeSample>& lobe)
+{
+	float alpha = roughness * roughness;
+	float a2 = alpha * alpha;
+	float texelSolidAngle = 4.0f * Pi / (CubemapConverter::FaceCount * (float)sourceSize * sourceSize);
+
+	lobe.clear();
+	for (unsigned int i = 0; i < sampleCount; ++i)
+	{
+		float e1, e2, h[3];
+		Hammersley(i, sampleCount, e1, e2);
+		ImportanceSampleGGX(e1, e2, alpha, h);
+
+		// l = reflect(-v, h), n.h = v.h so the pdf of l is D(h) / 4
+		float nDotH = h[2];
+		LobeSample sample;
+		sample.direction[0] = 2.0f * nDotH * h[0];
+		sample.direction[1] = 2.0f * nDotH * h[1];
+		sample.direction[2] = 2.0f * nDotH * nDotH - 1.0f;
+		sample.weight = sample.direction[2];
+		if (sample.weight <= 0.0f)
+			continue;
+
+		float d = nDotH * nDotH * (a2 - 1.0f) + 1.0f;
+		float pdf = a2 / (Pi * d * d) * 0.25f;
+		float sampleSolidAngle = 1.0f / (sampleCount * pdf + 1e-6f);
+		sample.lod = std::max(0.5f * log2f(sampleSolidAngle / texelSolidAngle) + 1.0f, minLod);
+		lobe.push_back(sample);
+	}
+}
+
+static unsigned int Gcd(size_t a, size_t b)
+{
+	while (b != 0)
+	{
+		size_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return (unsigned int)a;
+}
+
+unsigned int EnvironmentPrefilter::MipCount(unsigned int faceSize)
+{
+	unsigned int count = 1;
+	while ((faceSize >> count) >= MinMipSize)
+	{
+		count++;
+	}
+	return count;
+}
+
+float EnvironmentPrefilter::MipRoughness(unsigned int mip, unsigned int mipCount)
+{
+	return mipCount > 1 ? (float)mip / (mipCount - 1) : 0.0f;
+}
+
+void EnvironmentPrefilter::PrefilterSpecular(const uint16_t* sourceFaces, unsigned int sourceSize, unsigned int faceSize,
+	std::vector<uint16_t>& chain, unsigned int threadCount, unsigned int sampleCount)
+{
+	unsigned int mipCount = MipCount(faceSize);
+
+	// mip offsets inside a face chain, and the first row of each mip in the row order mip, face, y
+	std::vector<size_t> mipOffsets(mipCount), mipRows(mipCount + 1, 0);
+	size_t faceChainTexels = 0;
+	for (unsigned int mip = 0; mip < mipCount; ++mip)
+	{
+		unsigned int size = std::max(faceSize >> mip, 1u);
+		mipOffsets[mip] = faceChainTexels;
+		faceChainTexels += (size_t)size * size;
+		mipRows[mip + 1] = mipRows[mip] + (size_t)CubemapConverter::FaceCount * size;
+	}
+
+	chain.assign(CubemapConverter::FaceCount * faceChainTexels * 4, 0);
+	if (faceSize == 0 || sourceSize == 0)
+		return;
+
+	SourcePyramid source(sourceFaces, sourceSize);
+
+	// mip 0 is the mirror, one sample at the lod of its texels
+	std::vector<std::vector<LobeSample> > lobes(mipCount);
+	for (unsigned int mip = 0; mip < mipCount; ++mip)
+	{
+		unsigned int size = std::max(faceSize >> mip, 1u);
+		float minLod = std::max(log2f((float)sourceSize / size), 0.0f);
+		if (mip == 0)
+		{
+			LobeSample mirror = { { 0.0f, 0.0f, 1.0f }, 1.0f, minLod };
+			lobes[mip].push_back(mirror);
+		}
+		else
+		{
+			BuildLobe(MipRoughness(mip, mipCount), sampleCount, sourceSize, minLod, lobes[mip]);
+		}
+	}
+
+	// rows are visited with a stride coprime to their count, so every thread gets its share
+	// of the expensive rough mips and the cheap mirror rows
+	size_t rowCount = mipRows[mipCount];
+	size_t stride = 7919;
+	while (Gcd(rowCount, stride) != 1)
+	{
+		stride++;
+	}
+
+	ParallelFor(rowCount, 4, threadCount, [&](size_t begin, size_t end)
+	{
+		std::vector<float> row((size_t)faceSize * 4);
+		for (size_t i = begin; i < end; ++i)
+		{
+			size_t r = i * stride % rowCount;
+			unsigned int mip = 0;
+			while (r >= mipRows[mip + 1])
+			{
+				mip++;
+			}
+			unsigned int size = std::max(faceSize >> mip, 1u);
+			unsigned int face = (unsigned int)((r - mipRows[mip]) / size);
+			unsigned int y = (unsigned int)((r - mipRows[mip]) % size);
+			const std::vector<LobeSample>& lobe = lobes[mip];
+
+			for (unsigned int x = 0; x < size; ++x)
+			{
+				float n[3];
+				CubemapConverter::FaceDirection(face, (x + 0.5f) / size * 2.0f - 1.0f, (y + 0.5f) / size * 2.0f - 1.0f, n);
+
+				// tangent frame around the normal
+				float up[3] = { 0.0f, 0.0f, 1.0f };
+				if (fabsf(n[2]) > 0.999f)
+				{
+					up[0] = 1.0f;
+					up[2] = 0.0f;
+				}
+				float t[3] = { up[1] * n[2] - up[2] * n[1], up[2] * n[0] - up[0] * n[2], up[0] * n[1] - up[1] * n[0] };
+				float invLength = 1.0f / sqrtf(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+				t[0] *= invLength;
+				t[1] *= invLength;
+				t[2] *= invLength;
+				float b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+
+				float sum[3] = { 0.0f, 0.0f, 0.0f };
+				float weight = 0.0f;
+				for (const LobeSample& sample : lobe)
+				{
+					const float* l = sample.direction;
+					float direction[3] =
+					{
+						t[0] * l[0] + b[0] * l[1] + n[0] * l[2],
+						t[1] * l[0] + b[1] * l[1] + n[1] * l[2],
+						t[2] * l[0] + b[2] * l[1] + n[2] * l[2]
+					};
+
+					float color[3];
+					source.Sample(direction, sample.lod, color);
+					for (int k = 0; k < 3; ++k)
+					{
+						sum[k] += color[k] * sample.weight;
+					}
+					weight += sample.weight;
+				}
+
+				float invWeight = weight > 0.0f ? 1.0f / weight : 0.0f;
+				row[x * 4 + 0] = sum[0] * invWeight;
+				row[x * 4 + 1] = sum[1] * invWeight;
+				row[x * 4 + 2] = sum[2] * invWeight;
+				row[x * 4 + 3] = 1.0f;
+			}
+
+			size_t offset = face * faceChainTexels + mipOffsets[mip] + (size_t)y * size;
+			ConvertFloatsToHalves(row.data(), (size_t)size * 4, &chain[offset * 4]);
+		}
+	});
+}
+
+void EnvironmentPrefilter::IntegrateBrdf(unsigned int size, std::vector<uint16_t>& lut, unsigned int threadCount, unsigned int sampleCount)
+{
+	lut.assign((size_t)size * size * 2, 0);
+
+	ParallelFor(size, 4, threadCount, [&](size_t begin, size_t end)
+	{
+		std::vector<float> row((size_t)size * 2);
+		for (size_t y = begin; y < end; ++y)
+		{
+			float roughness = (y + 0.5f) / size;
+			float alpha = roughness * roughness;
+			float k = alpha * 0.5f;
+
+			for (unsigned int x = 0; x < size; ++x)
+			{
+				float nDotV = (x + 0.5f) / size;
+				float v[3] = { sqrtf(1.0f - nDotV * nDotV), 0.0f, nDotV };
+
+				float scale = 0.0f, bias = 0.0f;
+				for (unsigned int i = 0; i < sampleCount; ++i)
+				{
+					float e1, e2, h[3];
+					Hammersley(i, sampleCount, e1, e2);
+					ImportanceSampleGGX(e1, e2, alpha, h);
+
+					float vDotH = v[0] * h[0] + v[1] * h[1] + v[2] * h[2];
+					float nDotL = 2.0f * vDotH * h[2] - v[2];
+					if (nDotL <= 0.0f)
+						continue;
+
+					// Smith G with k = alpha / 2 for image based light, times v.h / (n.h n.v) of the pdf
+					float g = nDotL / (nDotL * (1.0f - k) + k) * nDotV / (nDotV * (1.0f - k) + k);
+					float visibility = g * std::max(vDotH, 0.0f) / (h[2] * nDotV);
+					float fresnel = powf(1.0f - std::max(vDotH, 0.0f), 5.0f);
+					scale += (1.0f - fresnel) * visibility;
+					bias += fresnel * visibility;
+				}
+
+				row[x * 2 + 0] = scale / sampleCount;
+				row[x * 2 + 1] = bias / sampleCount;
+			}
+
+			ConvertFloatsToHalves(row.data(), row.size(), &lut[y * size * 2]);
+		}
+	});
+}
+
+std::string EnvironmentPrefilter::SpecularCacheFileName(const std::string& equirectFile, unsigned int faceSize)
+{
+	return CubemapConverter::CacheFileName(equirectFile, ".specular" + std::to_string(faceSize) + ".dds");
+}
+
+bool EnvironmentPrefilter::LoadSpecular(const std::string& equirectFile, unsigned int cubeFaceSize, unsigned int faceSize,
+	std::vector<unsigned char>& dds, unsigned int threadCount)
+{
+	dds.clear();
+	if (faceSize == 0 || faceSize > MaxFaceSize || cubeFaceSize > MaxFaceSize)
+		return false;
+
+	// the chain depends on the source cubemap size as well, both fit in 16 bits
+	CookedDds desc;
+	desc.width = desc.height = faceSize;
+	desc.mipCount = MipCount(faceSize);
+	desc.cube = true;
+	desc.version = Version;
+	desc.setting = (cubeFaceSize << 16) | faceSize;
+	if (!CubemapConverter::HashFile(equirectFile, desc.sourceHash, desc.sourceSize))
+		return false;
+
+	std::string cacheFile = SpecularCacheFileName(equirectFile, faceSize);
+	if (CubemapConverter::ReadCache(cacheFile, desc, dds))
+		return true;
+
+	std::vector<unsigned char> cube;
+	if (!CubemapConverter::LoadCubemap(equirectFile, cubeFaceSize, cube, threadCount))
+		return false;
+
+	std::vector<uint16_t> chain;
+	PrefilterSpecular((const uint16_t*)(cube.data() + CubemapConverter::DdsHeaderSize), cubeFaceSize, faceSize, chain, threadCount);
+	CubemapConverter::WriteDds(desc, chain.data(), dds);
+	CubemapConverter::WriteCache(cacheFile, dds);
+
+	return true;
+}
+
+bool EnvironmentPrefilter::LoadBrdfLut(const std::string& cacheFile, unsigned int size, std::vector<unsigned char>& dds,
+	unsigned int threadCount)
+{
+	dds.clear();
+	if (size == 0 || size > MaxLutSize)
+		return false;
+
+	CookedDds desc;
+	desc.width = desc.height = size;
+	desc.fourCC = CubemapConverter::FourCCHalf2;
+	desc.version = Version;
+	desc.setting = DefaultLutSampleCount;
+	if (CubemapConverter::ReadCache(cacheFile, desc, dds))
+		return true;
+
+	std::vector<uint16_t> lut;
+	IntegrateBrdf(size, lut, threadCount);
+	CubemapConverter::WriteDds(desc, lut.data(), dds);
+	CubemapConverter::WriteCache(cacheFile, dds);
+
+	return true;
+}
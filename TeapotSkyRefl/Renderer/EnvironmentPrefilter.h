@@ -0,0 +1,63 @@
+#pragma once
+
+#include "CubemapConverter.h"
+
+// EnvironmentPrefilter
+// Bakes the image based specular light of the sky for the split sum approximation
+// (Karis 2013): a cubemap mip chain where every mip is the sky convolved with the
+// GGX lobe of one roughness, rough mips getting smaller, and a lookup table with
+// the scale and bias to F0 of the integrated BRDF. Both are importance sampled,
+// the samples of a mip are the same for every texel since the view is the normal,
+// and each sample reads a box filtered mip of the source picked from its pdf so few
+// samples do not alias. Rows of all mips and faces are spread over threads with
+// ParallelFor in a fixed scattered order so each thread gets a share of the costly
+// rough mips, a row is computed on its own so the result does not depend on the
+// thread count. Both are cooked to .dds files, the chain keyed by the hash of the
+// source .hdr so startup does not convolve again.
+// Only the standard library is used, as in CubemapConverter.
+// usage:
+// std::vector<unsigned char> specular, brdf;
+// EnvironmentPrefilter::LoadSpecular("..\\Assets\\approaching_storm_1k.hdr", 512, 128, specular);
+// EnvironmentPrefilter::LoadBrdfLut("..\\Assets\\brdf_lut.dds", 128, brdf);
+
+class EnvironmentPrefilter
+{
+public:
+	static const unsigned int Version = 1;
+
+	// smallest mip of the chain, rougher lobes cover a few texels of it anyway
+	static const unsigned int MinMipSize = 8;
+
+	static const unsigned int DefaultSampleCount = 128;
+	static const unsigned int DefaultLutSampleCount = 256;
+
+	// mips from faceSize down to MinMipSize, at least one
+	static unsigned int MipCount(unsigned int faceSize);
+
+	// Perceptual roughness of mip, the GGX alpha is its square. 0 at mip 0, 1 at the last mip.
+	static float MipRoughness(unsigned int mip, unsigned int mipCount);
+
+	// sourceFaces holds FaceCount * sourceSize * sourceSize RGBA16F texels as written by
+	// CubemapConverter. chain receives MipCount(faceSize) RGBA16F mips of every face, face
+	// after face with mip 0 first, as laid out in a .dds cube.
+	// threadCount 0 uses one thread per hardware thread.
+	static void PrefilterSpecular(const uint16_t* sourceFaces, unsigned int sourceSize, unsigned int faceSize,
+		std::vector<uint16_t>& chain, unsigned int threadCount = 0, unsigned int sampleCount = DefaultSampleCount);
+
+	// size * size RG16F texels, the scale (red) and bias (green) to F0 of the split sum,
+	// n.v along u and roughness along v
+	static void IntegrateBrdf(unsigned int size, std::vector<uint16_t>& lut, unsigned int threadCount = 0,
+		unsigned int sampleCount = DefaultLutSampleCount);
+
+	// "<name>.specular<faceSize>.dds" next to equirectFile
+	static std::string SpecularCacheFileName(const std::string& equirectFile, unsigned int faceSize);
+
+	// Reads the cooked specular chain of equirectFile, prefiltering its cubeFaceSize cubemap
+	// (CubemapConverter::LoadCubemap) and writing the cache when the cache is missing or stale
+	static bool LoadSpecular(const std::string& equirectFile, unsigned int cubeFaceSize, unsigned int faceSize,
+		std::vector<unsigned char>& dds, unsigned int threadCount = 0);
+
+	// Reads the lookup table from cacheFile, integrating and writing it when missing or stale
+	static bool LoadBrdfLut(const std::string& cacheFile, unsigned int size, std::vector<unsigned char>& dds,
+		unsigned int threadCount = 0);
+};
@@ -1,9 +1,11 @@
 #include "GeometryGenerator.h"
 
 GeometryGenerator *GeometryGenerator::mInstance = 0;
+static std::mutex InstanceMutex;
 
 GeometryGenerator* GeometryGenerator::Instance()
 {
+	std::lock_guard<std::mutex> lock(InstanceMutex);
 	if (mInstance == 0)
 	{
 		mInstance = new GeometryGenerator();
@@ -3,8 +3,11 @@
 #include "Util.h"
 #include "Mesh.h"
 
+#include <mutex>
+
 // GeometryGenerator
-// generates simple mesh objects
+// generates simple mesh objects, the generators only write to the given MeshData
+// and can be called from several threads at once
 class GeometryGenerator
 {
 public:
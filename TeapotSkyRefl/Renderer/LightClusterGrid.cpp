@@ -0,0 +1,546 @@
+#include "LightClusterGrid.h"
+#include "Parallel.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// the bounds are kept by groups of 8 tiles of a row, a plane of 8 floats per BoundsPlane
+static const int GroupColumns = 8;
+static const int GroupFloats = LightClusterGrid::BOUNDS_PLANE_COUNT * GroupColumns;
+
+LightClusterGrid::LightClusterGrid() : mFovY(0.0f), mAspect(0.0f), mNearZ(0.0f), mFarZ(0.0f), mTanX(0.0f), mTanY(0.0f), mTileScaleX(0.0f), mTileScaleY(0.0f),
+mTilesX(0), mTilesY(0), mSlices(0), mSliceScale(0.0f), mSliceBias(0.0f), mRowStride(0)
+{
+}
+
+LightClusterKernel LightClusterGrid::GetKernel(LightClusterKernel kernel)
+{
+	static const bool avx2 = CpuSupportsAvx2();
+
+	if (kernel == LIGHT_CLUSTER_AUTO)
+		return avx2 ? LIGHT_CLUSTER_AVX2 : LIGHT_CLUSTER_SSE2;
+
+	if (kernel == LIGHT_CLUSTER_AVX2 && !avx2)
+		return LIGHT_CLUSTER_SSE2;
+
+	return kernel;
+}
+
+void LightClusterGrid::SetCamera(float fovY, float aspect, float nearZ, float farZ, int tilesX, int tilesY, int slices)
+{
+	tilesX = std::min(std::max(tilesX, 1), (int)MaxTilesX);
+	tilesY = std::max(tilesY, 1);
+	slices = std::max(slices, 1);
+	if (fovY == mFovY && aspect == mAspect && nearZ == mNearZ && farZ == mFarZ && tilesX == mTilesX && tilesY == mTilesY && slices == mSlices)
+		return;
+
+	mFovY = fovY;
+	mAspect = aspect;
+	mNearZ = nearZ;
+	mFarZ = farZ;
+	mTilesX = tilesX;
+	mTilesY = tilesY;
+	mSlices = slices;
+	mTanY = tanf(0.5f * fovY);
+	mTanX = mTanY * aspect;
+
+	float logRatio = logf(farZ / nearZ);
+	mSliceScale = slices / logRatio;
+	mSliceBias = -slices * logf(nearZ) / logRatio;
+	mSliceDepths.resize(slices + 1);
+	for (int s = 0; s <= slices; ++s)
+	{
+		mSliceDepths[s] = nearZ * powf(farZ / nearZ, (float)s / slices);
+	}
+	mSliceDepths[slices] = farZ;
+	mSliceDepthsRcp.resize(slices + 1);
+	for (int s = 0; s <= slices; ++s)
+	{
+		mSliceDepthsRcp[s] = 1.0f / mSliceDepths[s];
+	}
+	mTileScaleX = 0.5f * tilesX / mTanX;
+	mTileScaleY = 0.5f * tilesY / mTanY;
+
+	// the froxel boxes, the padding of the last group of a row out of reach of any light
+	int groupsX = (tilesX + GroupColumns - 1) / GroupColumns;
+	mRowStride = (size_t)groupsX * GroupFloats;
+	mBounds.resize((size_t)slices * tilesY * mRowStride);
+	for (int s = 0; s < slices; ++s)
+	{
+		float zn = mSliceDepths[s];
+		float zf = mSliceDepths[s + 1];
+		for (int y = 0; y < tilesY; ++y)
+		{
+			// tile rows from the top of the screen
+			float top = (1.0f - 2.0f * y / tilesY) * mTanY;
+			float bottom = (1.0f - 2.0f * (y + 1) / tilesY) * mTanY;
+			for (int x = 0; x < groupsX * GroupColumns; ++x)
+			{
+				float* group = &mBounds[((size_t)s * tilesY + y) * mRowStride + x / GroupColumns * GroupFloats];
+				int lane = x % GroupColumns;
+				if (x >= tilesX)
+				{
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						group[(BOUNDS_MIN_X + axis) * GroupColumns + lane] = FLT_MAX;
+						group[(BOUNDS_MAX_X + axis) * GroupColumns + lane] = -FLT_MAX;
+						group[(BOUNDS_CENTER_X + axis) * GroupColumns + lane] = 0.0f;
+					}
+					group[BOUNDS_RADIUS * GroupColumns + lane] = 0.0f;
+					continue;
+				}
+
+				float left = (-1.0f + 2.0f * x / tilesX) * mTanX;
+				float right = (-1.0f + 2.0f * (x + 1) / tilesX) * mTanX;
+				float boundsMin[3] = { std::min(left * zn, left * zf), std::min(bottom * zn, bottom * zf), zn };
+				float boundsMax[3] = { std::max(right * zn, right * zf), std::max(top * zn, top * zf), zf };
+				float radius = 0.0f;
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					group[(BOUNDS_MIN_X + axis) * GroupColumns + lane] = boundsMin[axis];
+					group[(BOUNDS_MAX_X + axis) * GroupColumns + lane] = boundsMax[axis];
+					group[(BOUNDS_CENTER_X + axis) * GroupColumns + lane] = 0.5f * (boundsMin[axis] + boundsMax[axis]);
+					float half = 0.5f * (boundsMax[axis] - boundsMin[axis]);
+					radius += half * half;
+				}
+				group[BOUNDS_RADIUS * GroupColumns + lane] = sqrtf(radius);
+			}
+		}
+	}
+
+	mClusters.assign((size_t)slices * tilesY * tilesX, LightClusterRange());
+	mLightIndices.clear();
+	mSliceLights.resize(slices);
+	mSliceTiles.resize(slices);
+	mSliceMasks.resize(slices);
+	mSliceTests.resize(slices);
+}
+
+int LightClusterGrid::GetSlice(float viewZ) const
+{
+	if (!(viewZ > mNearZ))
+		return 0;
+
+	float slice = logf(viewZ) * mSliceScale + mSliceBias;
+	return std::min((int)slice, mSlices - 1);
+}
+
+void LightClusterGrid::GetClusterBounds(size_t cluster, float boundsMin[3], float boundsMax[3]) const
+{
+	size_t x = cluster % mTilesX;
+	const float* group = &mBounds[cluster / mTilesX * mRowStride + x / GroupColumns * GroupFloats];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		boundsMin[axis] = group[(BOUNDS_MIN_X + axis) * GroupColumns + x % GroupColumns];
+		boundsMax[axis] = group[(BOUNDS_MAX_X + axis) * GroupColumns + x % GroupColumns];
+	}
+}
+
+//////////// Light against froxel tests
+
+// the sphere of the light range touches the box, and a spot cone reaches the bounding
+// sphere of the box: not outside the cone angle, beyond the range or behind the light
+static bool ClusterHit(const float* group, int lane, const ClusterLight& light)
+{
+	const float* bounds = group + lane;
+	float distance[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float p = light.position[axis];
+		float boundsMin = bounds[(LightClusterGrid::BOUNDS_MIN_X + axis) * GroupColumns];
+		float boundsMax = bounds[(LightClusterGrid::BOUNDS_MAX_X + axis) * GroupColumns];
+		distance[axis] = std::max(std::max(boundsMin - p, p - boundsMax), 0.0f);
+	}
+	float distanceSq = (distance[0] * distance[0] + distance[1] * distance[1]) + distance[2] * distance[2];
+	if (!(distanceSq <= light.range * light.range))
+		return false;
+
+	if (light.type != CLUSTER_LIGHT_SPOT)
+		return true;
+
+	float radius = bounds[LightClusterGrid::BOUNDS_RADIUS * GroupColumns];
+	float v[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		v[axis] = bounds[(LightClusterGrid::BOUNDS_CENTER_X + axis) * GroupColumns] - light.position[axis];
+	}
+	float lengthSq = (v[0] * v[0] + v[1] * v[1]) + v[2] * v[2];
+	float alongAxis = (v[0] * light.direction[0] + v[1] * light.direction[1]) + v[2] * light.direction[2];
+	float toCone = light.cosAngle * sqrtf(std::max(lengthSq - alongAxis * alongAxis, 0.0f)) - alongAxis * light.sinAngle;
+	return !(toCone > radius) && !(alongAxis > radius + light.range) && !(alongAxis < 0.0f - radius);
+}
+
+static void TileTestScalar(const float* groups, int groupCount, size_t rowStride, int rows, const ClusterLight& light, uint32_t* masks)
+{
+	for (int y = 0; y < rows; ++y, groups += rowStride)
+	{
+		uint32_t mask = 0;
+		for (int i = 0; i < groupCount * GroupColumns; ++i)
+		{
+			if (ClusterHit(groups + i / GroupColumns * GroupFloats, i % GroupColumns, light))
+				mask |= 1u << i;
+		}
+		masks[y] = mask;
+	}
+}
+
+static void TileTestSSE2(const float* groups, int groupCount, size_t rowStride, int rows, const ClusterLight& light, uint32_t* masks)
+{
+	const __m128 zero = _mm_setzero_ps();
+	__m128 position[3], direction[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		position[axis] = _mm_set1_ps(light.position[axis]);
+		direction[axis] = _mm_set1_ps(light.direction[axis]);
+	}
+	__m128 range = _mm_set1_ps(light.range);
+	__m128 rangeSq = _mm_set1_ps(light.range * light.range);
+	__m128 cosAngle = _mm_set1_ps(light.cosAngle);
+	__m128 sinAngle = _mm_set1_ps(light.sinAngle);
+	bool spot = light.type == CLUSTER_LIGHT_SPOT;
+
+	for (int y = 0; y < rows; ++y, groups += rowStride)
+	{
+		// each group as two halves of 4
+		uint32_t mask = 0;
+		for (int i = 0; i < groupCount * GroupColumns; i += 4)
+		{
+			const float* b = groups + i / GroupColumns * GroupFloats + i % GroupColumns;
+			__m128 distanceSq = zero;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				__m128 boundsMin = _mm_loadu_ps(b + (LightClusterGrid::BOUNDS_MIN_X + axis) * GroupColumns);
+				__m128 boundsMax = _mm_loadu_ps(b + (LightClusterGrid::BOUNDS_MAX_X + axis) * GroupColumns);
+				__m128 distance = _mm_max_ps(_mm_max_ps(_mm_sub_ps(boundsMin, position[axis]), _mm_sub_ps(position[axis], boundsMax)), zero);
+				__m128 square = _mm_mul_ps(distance, distance);
+				distanceSq = axis == 0 ? square : _mm_add_ps(distanceSq, square);
+			}
+			__m128 hit = _mm_cmple_ps(distanceSq, rangeSq);
+
+			if (spot)
+			{
+				__m128 v[3];
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					v[axis] = _mm_sub_ps(_mm_loadu_ps(b + (LightClusterGrid::BOUNDS_CENTER_X + axis) * GroupColumns), position[axis]);
+				}
+				__m128 radius = _mm_loadu_ps(b + LightClusterGrid::BOUNDS_RADIUS * GroupColumns);
+				__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v[0], v[0]), _mm_mul_ps(v[1], v[1])), _mm_mul_ps(v[2], v[2]));
+				__m128 alongAxis = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v[0], direction[0]), _mm_mul_ps(v[1], direction[1])), _mm_mul_ps(v[2], direction[2]));
+				__m128 toCone = _mm_sub_ps(_mm_mul_ps(cosAngle, _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(lengthSq, _mm_mul_ps(alongAxis, alongAxis)), zero))),
+					_mm_mul_ps(alongAxis, sinAngle));
+				__m128 outside = _mm_or_ps(_mm_cmpgt_ps(toCone, radius),
+					_mm_or_ps(_mm_cmpgt_ps(alongAxis, _mm_add_ps(radius, range)), _mm_cmplt_ps(alongAxis, _mm_sub_ps(zero, radius))));
+				hit = _mm_andnot_ps(outside, hit);
+			}
+			mask |= (uint32_t)_mm_movemask_ps(hit) << i;
+		}
+		masks[y] = mask;
+	}
+}
+
+AVX2_TARGET static void TileTestAVX2(const float* groups, int groupCount, size_t rowStride, int rows, const ClusterLight& light, uint32_t* masks)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 position[3], direction[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		position[axis] = _mm256_set1_ps(light.position[axis]);
+		direction[axis] = _mm256_set1_ps(light.direction[axis]);
+	}
+	__m256 range = _mm256_set1_ps(light.range);
+	__m256 rangeSq = _mm256_set1_ps(light.range * light.range);
+	__m256 cosAngle = _mm256_set1_ps(light.cosAngle);
+	__m256 sinAngle = _mm256_set1_ps(light.sinAngle);
+	bool spot = light.type == CLUSTER_LIGHT_SPOT;
+
+	for (int y = 0; y < rows; ++y, groups += rowStride)
+	{
+		uint32_t mask = 0;
+		for (int g = 0; g < groupCount; ++g)
+		{
+			const float* b = groups + g * GroupFloats;
+			__m256 distanceSq = zero;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				__m256 boundsMin = _mm256_loadu_ps(b + (LightClusterGrid::BOUNDS_MIN_X + axis) * GroupColumns);
+				__m256 boundsMax = _mm256_loadu_ps(b + (LightClusterGrid::BOUNDS_MAX_X + axis) * GroupColumns);
+				__m256 distance = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(boundsMin, position[axis]), _mm256_sub_ps(position[axis], boundsMax)), zero);
+				__m256 square = _mm256_mul_ps(distance, distance);
+				distanceSq = axis == 0 ? square : _mm256_add_ps(distanceSq, square);
+			}
+			__m256 hit = _mm256_cmp_ps(distanceSq, rangeSq, _CMP_LE_OQ);
+
+			if (spot)
+			{
+				__m256 v[3];
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					v[axis] = _mm256_sub_ps(_mm256_loadu_ps(b + (LightClusterGrid::BOUNDS_CENTER_X + axis) * GroupColumns), position[axis]);
+				}
+				__m256 radius = _mm256_loadu_ps(b + LightClusterGrid::BOUNDS_RADIUS * GroupColumns);
+				__m256 lengthSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v[0], v[0]), _mm256_mul_ps(v[1], v[1])), _mm256_mul_ps(v[2], v[2]));
+				__m256 alongAxis = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v[0], direction[0]), _mm256_mul_ps(v[1], direction[1])),
+					_mm256_mul_ps(v[2], direction[2]));
+				__m256 toCone = _mm256_sub_ps(_mm256_mul_ps(cosAngle, _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(lengthSq, _mm256_mul_ps(alongAxis, alongAxis)), zero))),
+					_mm256_mul_ps(alongAxis, sinAngle));
+				__m256 outside = _mm256_or_ps(_mm256_cmp_ps(toCone, radius, _CMP_GT_OQ),
+					_mm256_or_ps(_mm256_cmp_ps(alongAxis, _mm256_add_ps(radius, range), _CMP_GT_OQ),
+						_mm256_cmp_ps(alongAxis, _mm256_sub_ps(zero, radius), _CMP_LT_OQ)));
+				hit = _mm256_andnot_ps(outside, hit);
+			}
+			mask |= (uint32_t)_mm256_movemask_ps(hit) << (g * GroupColumns);
+		}
+		masks[y] = mask;
+	}
+}
+
+//////////// Build
+
+static int LowestBit(uint32_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long bit;
+	_BitScanForward(&bit, mask);
+	return (int)bit;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+bool LightClusterGrid::GetLightTiles(const ClusterLight& light, int slice, LightTiles& tiles) const
+{
+	float nearRcp = mSliceDepthsRcp[slice];
+	float farRcp = mSliceDepthsRcp[slice + 1];
+	float r = light.range;
+
+	// the tiles whose boxes overlap the sphere in x and y over the slice depths, a
+	// hundredth of a tile wider as rounding goes
+	float left = light.position[0] - r;
+	float right = light.position[0] + r;
+	float top = light.position[1] + r;
+	float bottom = light.position[1] - r;
+	float tileLeft = (std::min(left * nearRcp, left * farRcp) * mTileScaleX + 0.5f * mTilesX) - 0.01f;
+	float tileRight = (std::max(right * nearRcp, right * farRcp) * mTileScaleX + 0.5f * mTilesX) + 0.01f;
+	float tileTop = (0.5f * mTilesY - std::max(top * nearRcp, top * farRcp) * mTileScaleY) - 0.01f;
+	float tileBottom = (0.5f * mTilesY - std::min(bottom * nearRcp, bottom * farRcp) * mTileScaleY) + 0.01f;
+	if (tileRight < 0.0f || tileBottom < 0.0f || tileLeft >= (float)mTilesX || tileTop >= (float)mTilesY)
+		return false;
+
+	int x0 = (int)std::max(tileLeft, 0.0f);
+	int x1 = (int)std::min(tileRight, (float)(mTilesX - 1));
+	int y0 = (int)std::max(tileTop, 0.0f);
+	int y1 = (int)std::min(tileBottom, (float)(mTilesY - 1));
+	tiles.x = x0 / GroupColumns * GroupColumns;
+	tiles.y = y0;
+	tiles.groups = x1 / GroupColumns - x0 / GroupColumns + 1;
+	tiles.rows = y1 - y0 + 1;
+	return x0 <= x1 && y0 <= y1;
+}
+
+void LightClusterGrid::Build(const ClusterLight* lights, size_t count, unsigned int threads, LightClusterKernel kernel)
+{
+	mStats = LightClusterStats();
+	mStats.lights = (uint32_t)count;
+	if (mSlices == 0)
+		return;
+
+	TileTestFunction test = TileTestScalar;
+	switch (GetKernel(kernel))
+	{
+	case LIGHT_CLUSTER_AVX2:
+		test = TileTestAVX2;
+		break;
+	case LIGHT_CLUSTER_SSE2:
+		test = TileTestSSE2;
+		break;
+	default:
+		break;
+	}
+
+	// the slices whose depths the sphere of each light overlaps, its range a little
+	// longer as rounding goes
+	for (std::vector<uint32_t>& sliceLights : mSliceLights)
+	{
+		sliceLights.clear();
+	}
+	for (size_t l = 0; l < count; ++l)
+	{
+		const ClusterLight& light = lights[l];
+		float zMin = light.position[2] - light.range * 1.001f;
+		float zMax = light.position[2] + light.range * 1.001f;
+		if (zMax < mNearZ || zMin > mFarZ)
+			continue;
+
+		mStats.lightsInRange++;
+		int s0 = GetSlice(zMin);
+		while (s0 > 0 && mSliceDepths[s0] >= zMin)
+		{
+			s0--;
+		}
+		while (s0 + 1 < mSlices && mSliceDepths[s0 + 1] < zMin)
+		{
+			s0++;
+		}
+		int s1 = GetSlice(zMax);
+		while (s1 + 1 < mSlices && mSliceDepths[s1 + 1] <= zMax)
+		{
+			s1++;
+		}
+		while (s1 > s0 && mSliceDepths[s1] > zMax)
+		{
+			s1--;
+		}
+		for (int s = s0; s <= s1; ++s)
+		{
+			mSliceLights[s].push_back((uint32_t)l);
+		}
+	}
+
+	ParallelFor(mSlices, 1, threads, [&](size_t begin, size_t end) { TestSlices((int)begin, (int)end, lights, test); });
+
+	// froxel offsets in order of GetClusterIndex, then the lights written in place
+	uint32_t offset = 0;
+	for (LightClusterRange& cluster : mClusters)
+	{
+		cluster.offset = offset;
+		offset += cluster.count;
+		mStats.occupiedClusters += cluster.count > 0;
+		mStats.maxClusterLights = std::max(mStats.maxClusterLights, cluster.count);
+	}
+	mLightIndices.resize(offset);
+	mStats.indices = offset;
+	for (int s = 0; s < mSlices; ++s)
+	{
+		mStats.tests += mSliceTests[s];
+	}
+
+	ParallelFor(mSlices, 2, threads, [&](size_t begin, size_t end) { FillSlices((int)begin, (int)end); });
+}
+
+void LightClusterGrid::TestSlices(int sliceBegin, int sliceEnd, const ClusterLight* lights, TileTestFunction test)
+{
+	size_t sliceClusters = (size_t)mTilesX * mTilesY;
+	for (int s = sliceBegin; s < sliceEnd; ++s)
+	{
+		LightClusterRange* clusters = &mClusters[s * sliceClusters];
+		for (size_t c = 0; c < sliceClusters; ++c)
+		{
+			clusters[c].count = 0;
+		}
+
+		// the tiles each light hits as a mask per row, kept for FillSlices, and the counts
+		std::vector<LightTiles>& sliceTiles = mSliceTiles[s];
+		std::vector<uint32_t>& masks = mSliceMasks[s];
+		sliceTiles.clear();
+		masks.clear();
+		mSliceTests[s] = 0;
+		for (uint32_t l : mSliceLights[s])
+		{
+			LightTiles tiles;
+			if (!GetLightTiles(lights[l], s, tiles))
+				continue;
+
+			tiles.light = l;
+			tiles.masks = (uint32_t)masks.size();
+			masks.resize(masks.size() + tiles.rows);
+			uint32_t* rowMasks = &masks[tiles.masks];
+			size_t row = ((size_t)s * mTilesY + tiles.y) * mRowStride;
+			test(&mBounds[row + tiles.x / GroupColumns * GroupFloats], tiles.groups, mRowStride, tiles.rows, lights[l], rowMasks);
+			mSliceTests[s] += tiles.groups * GroupColumns * tiles.rows;
+
+			uint32_t hits = 0;
+			for (int y = 0; y < tiles.rows; ++y)
+			{
+				LightClusterRange* rowClusters = clusters + (tiles.y + y) * mTilesX + tiles.x;
+				for (uint32_t mask = rowMasks[y]; mask != 0; mask &= mask - 1)
+				{
+					rowClusters[LowestBit(mask)].count++;
+					hits++;
+				}
+			}
+			if (hits != 0)
+				sliceTiles.push_back(tiles);
+			else
+				masks.resize(tiles.masks);
+		}
+	}
+}
+
+void LightClusterGrid::FillSlices(int sliceBegin, int sliceEnd)
+{
+	size_t sliceClusters = (size_t)mTilesX * mTilesY;
+	std::vector<uint32_t> ends(sliceClusters);
+	for (int s = sliceBegin; s < sliceEnd; ++s)
+	{
+		const LightClusterRange* clusters = &mClusters[s * sliceClusters];
+		for (size_t c = 0; c < sliceClusters; ++c)
+		{
+			ends[c] = clusters[c].offset;
+		}
+
+		// the lights of a slice are in ascending order, and so stay in every froxel
+		const std::vector<uint32_t>& masks = mSliceMasks[s];
+		for (const LightTiles& tiles : mSliceTiles[s])
+		{
+			for (int y = 0; y < tiles.rows; ++y)
+			{
+				uint32_t* rowEnds = &ends[(tiles.y + y) * mTilesX + tiles.x];
+				for (uint32_t mask = masks[tiles.masks + y]; mask != 0; mask &= mask - 1)
+				{
+					mLightIndices[rowEnds[LowestBit(mask)]++] = tiles.light;
+				}
+			}
+		}
+	}
+}
+
+void LightClusterGrid::BuildBruteForce(const ClusterLight* lights, size_t count)
+{
+	mStats = LightClusterStats();
+	mStats.lights = (uint32_t)count;
+	mLightIndices.clear();
+
+	for (int s = 0; s < mSlices; ++s)
+	{
+		for (int y = 0; y < mTilesY; ++y)
+		{
+			for (int x = 0; x < mTilesX; ++x)
+			{
+				LightClusterRange& cluster = mClusters[GetClusterIndex(x, y, s)];
+				cluster.offset = (uint32_t)mLightIndices.size();
+				const float* row = &mBounds[((size_t)s * mTilesY + y) * mRowStride];
+				for (size_t l = 0; l < count; ++l)
+				{
+					if (ClusterHit(row + x / GroupColumns * GroupFloats, x % GroupColumns, lights[l]))
+						mLightIndices.push_back((uint32_t)l);
+				}
+				cluster.count = (uint32_t)mLightIndices.size() - cluster.offset;
+				mStats.tests += (uint32_t)count;
+			}
+		}
+	}
+
+	for (size_t l = 0; l < count; ++l)
+	{
+		mStats.lightsInRange += lights[l].position[2] + lights[l].range >= mNearZ && lights[l].position[2] - lights[l].range <= mFarZ;
+	}
+	mStats.indices = (uint32_t)mLightIndices.size();
+	for (const LightClusterRange& cluster : mClusters)
+	{
+		mStats.occupiedClusters += cluster.count > 0;
+		mStats.maxClusterLights = std::max(mStats.maxClusterLights, cluster.count);
+	}
+}
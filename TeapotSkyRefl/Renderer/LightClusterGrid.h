@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// LightClusterGrid
+// Clustered light assignment: the view frustum is split into froxels, tilesX x tilesY
+// screen tiles by depth slices spaced exponentially from the near to the far plane, and
+// every froxel gets the list of lights that can reach it. A pixel then only shades the
+// lights of its froxel instead of every light volume covering it.
+// Lights are spheres or, for spots, cones in view space. A light is tested against the
+// axis aligned box of a froxel: the sphere of its range must touch the box, and a cone
+// must also reach the bounding sphere of the box. Only the froxels the light's sphere
+// can touch are tested, by groups of 8 froxels of a row, at once with AVX2, 4 at a time
+// with SSE2 or one by one; the kernels give the same lists.
+// The slices are tested in bands over the worker threads, counting the lights of their
+// own froxels; after the offsets are summed up a second pass writes every light index
+// in place. The result is compact: an offset and count per froxel into one index list,
+// lights in ascending order, ready to upload as they are. BuildBruteForce tests every
+// light against every froxel, for checking Build.
+// View space is left handed, x right, y up, z forward, as in Camera. The froxel of a
+// view depth z is slice floor(log(z) * sliceScale + sliceBias).
+// Only the standard library and SSE2/AVX2 intrinsics are used.
+// usage:
+// grid.SetCamera(camera->GetFovY(), camera->GetAspect(), camera->GetNearZ(), camera->GetFarZ());
+// grid.Build(viewSpaceLights.data(), viewSpaceLights.size());
+// upload grid.GetClusters() and grid.GetLightIndices()
+
+enum LightClusterKernel
+{
+	LIGHT_CLUSTER_AUTO = 0,	// best kernel the CPU supports
+	LIGHT_CLUSTER_SCALAR,
+	LIGHT_CLUSTER_SSE2,
+	LIGHT_CLUSTER_AVX2
+};
+
+enum ClusterLightType
+{
+	CLUSTER_LIGHT_POINT = 0,
+	CLUSTER_LIGHT_SPOT
+};
+
+// a light in view space
+struct ClusterLight
+{
+	float position[3];
+	float range;
+	float direction[3];		// spot axis, unit length
+	float cosAngle;			// of the spot outer angle
+	float sinAngle;
+	ClusterLightType type;
+};
+
+// lights of a froxel in the index list
+struct LightClusterRange
+{
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct LightClusterStats
+{
+	LightClusterStats() : lights(0), lightsInRange(0), tests(0), indices(0), occupiedClusters(0), maxClusterLights(0) {}
+
+	uint32_t lights;
+	uint32_t lightsInRange;		// reaching between the near and far plane
+	uint32_t tests;				// light against froxel
+	uint32_t indices;
+	uint32_t occupiedClusters;
+	uint32_t maxClusterLights;
+};
+
+class LightClusterGrid
+{
+public:
+	// widest row of tiles
+	static const int MaxTilesX = 32;
+
+	LightClusterGrid();
+
+	// Sets the froxels of a perspective camera, fovY in radians. Does nothing when the
+	// camera and grid did not change.
+	void SetCamera(float fovY, float aspect, float nearZ, float farZ, int tilesX = 16, int tilesY = 9, int slices = 24);
+
+	int GetTilesX() const { return mTilesX; }
+	int GetTilesY() const { return mTilesY; }
+	int GetSlices() const { return mSlices; }
+	size_t GetClusterCount() const { return mClusters.size(); }
+
+	// froxel of tile x, y from the top left and slice
+	size_t GetClusterIndex(int x, int y, int slice) const { return ((size_t)slice * mTilesY + y) * mTilesX + x; }
+
+	// slice of a view depth is floor(log(z) * sliceScale + sliceBias)
+	float GetSliceScale() const { return mSliceScale; }
+	float GetSliceBias() const { return mSliceBias; }
+	int GetSlice(float viewZ) const;
+
+	// view space box of a froxel
+	void GetClusterBounds(size_t cluster, float boundsMin[3], float boundsMax[3]) const;
+
+	// Assigns the lights to the froxels, threads 0 is one per hardware thread
+	void Build(const ClusterLight* lights, size_t count, unsigned int threads = 0, LightClusterKernel kernel = LIGHT_CLUSTER_AUTO);
+
+	// Build testing every light against every froxel, one at a time
+	void BuildBruteForce(const ClusterLight* lights, size_t count);
+
+	// by froxel, and the light indices they point into
+	const std::vector<LightClusterRange>& GetClusters() const { return mClusters; }
+	const std::vector<uint32_t>& GetLightIndices() const { return mLightIndices; }
+
+	const LightClusterStats& GetStats() const { return mStats; }
+
+	// Resolves LIGHT_CLUSTER_AUTO to the kernel used on this CPU
+	static LightClusterKernel GetKernel(LightClusterKernel kernel = LIGHT_CLUSTER_AUTO);
+
+	// froxels a light hits in groupCount groups of 8 tiles from groups in each of rows
+	// rows rowStride floats apart, bit i of masks[y] for tile i of row y; a group holds
+	// 8 floats per BoundsPlane
+	typedef void(*TileTestFunction)(const float* groups, int groupCount, size_t rowStride, int rows, const ClusterLight& light, uint32_t* masks);
+
+	enum BoundsPlane
+	{
+		BOUNDS_MIN_X = 0, BOUNDS_MIN_Y, BOUNDS_MIN_Z,
+		BOUNDS_MAX_X, BOUNDS_MAX_Y, BOUNDS_MAX_Z,
+		BOUNDS_CENTER_X, BOUNDS_CENTER_Y, BOUNDS_CENTER_Z, BOUNDS_RADIUS,
+		BOUNDS_PLANE_COUNT
+	};
+
+private:
+	// tiles of a slice a light may touch and where their row masks are
+	struct LightTiles
+	{
+		uint32_t light;
+		uint32_t masks;
+		int x, y, groups, rows;		// x at the first tile of a group of 8
+	};
+
+	// false when the light touches no tile of the slice
+	bool GetLightTiles(const ClusterLight& light, int slice, LightTiles& tiles) const;
+
+	// tests the lights of the slices and counts the lights of their froxels
+	void TestSlices(int sliceBegin, int sliceEnd, const ClusterLight* lights, TileTestFunction test);
+
+	// writes the lights of the slices to mLightIndices at the froxel offsets
+	void FillSlices(int sliceBegin, int sliceEnd);
+
+	float mFovY, mAspect, mNearZ, mFarZ;
+	float mTanX, mTanY;
+	float mTileScaleX, mTileScaleY;		// tiles per unit of x / z and y / z
+	int mTilesX, mTilesY, mSlices;
+	float mSliceScale, mSliceBias;
+
+	// slice near depths and the far plane
+	std::vector<float> mSliceDepths;
+	std::vector<float> mSliceDepthsRcp;
+
+	// froxel boxes and bounding spheres by groups of 8 tiles of a row, rows padded to
+	// whole groups
+	size_t mRowStride;
+	std::vector<float> mBounds;
+
+	// lights reaching each slice
+	std::vector<std::vector<uint32_t>> mSliceLights;
+
+	// per slice: the lights hitting any froxel with their tile masks, and the tests
+	std::vector<std::vector<LightTiles>> mSliceTiles;
+	std::vector<std::vector<uint32_t>> mSliceMasks;
+	std::vector<uint32_t> mSliceTests;
+
+	std::vector<LightClusterRange> mClusters;
+	std::vector<uint32_t> mLightIndices;
+	LightClusterStats mStats;
+};
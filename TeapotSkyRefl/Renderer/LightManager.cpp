@@ -2,6 +2,9 @@
 #include "GBuffer.h"
 #include "Camera.h"
 #include "LightManager.h"
+#include "ClusterCuller.h"
+
+#include <algorithm>
 
 const XMFLOAT3 GammaToLinear(const XMFLOAT3& color)
 {
@@ -12,17 +15,14 @@ const XMFLOAT3 GammaToLinear(const XMFLOAT3& color)
 #pragma pack(push,1)
 struct CB_DIRECTIONAL
 {
-	
-	XMFLOAT3 vAmbientLower;
-	float pad;
-	XMFLOAT3 vAmbientRange;
-	float pad2;
 	XMFLOAT3 vDirToLight;
 	float pad3;
 	XMFLOAT3 vDirectionalColor;
 	float pad4;
 	XMMATRIX ToShadowSpace;
 	XMFLOAT4 ToCascadeSpace[3];
+	XMFLOAT4 AmbientSH[SHCoefficients::Count];
+	XMFLOAT4 SpecularEnv;	// last mip, enabled
 };
 
 struct CB_POINT_LIGHT_DOMAIN
@@ -36,8 +36,8 @@ struct CB_POINT_LIGHT_PIXEL
 	float PointLightRangeRcp;
 	XMFLOAT3 PointColor;
 	float pad;
-	XMFLOAT2 LightPerspectiveValues;
-	float pad2[2];
+	XMMATRIX ToShadowmap[6];
+	XMFLOAT4 ShadowTiles[6];
 };
 
 struct CB_SPOT_LIGHT_DOMAIN
@@ -57,17 +57,54 @@ struct CB_SPOT_LIGHT_PIXEL
 	XMFLOAT3 SpotColor;
 	float SpotCosConeAttRange;
 	XMMATRIX ToShadowmap;
+	XMFLOAT4 ShadowTile;
+};
+
+struct CB_CLUSTERED_LIGHTS
+{
+	UINT ClusterGrid[3];
+	UINT pad;
+	XMFLOAT2 ClusterSlice;
+	float pad2[2];
+};
+
+// a light of ClusteredLights.hlsl
+struct CLUSTER_LIGHT_GPU
+{
+	XMFLOAT3 Position;
+	float RangeRcp;
+	XMFLOAT3 DirToLight;
+	float CosOuterCone;
+	XMFLOAT3 Color;
+	float CosConeAttRange;
 };
 #pragma pack(pop)
 
+// From the clip space of a shadow projection to the UV of its tile in the atlas, depth unchanged
+static XMMATRIX ShadowAtlasTileMatrix(const ShadowAtlasTile& tile, int atlasSize)
+{
+	float scale = 0.5f * tile.size / atlasSize;
+	return XMMATRIX(
+		scale, 0.0f, 0.0f, 0.0f,
+		0.0f, -scale, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		(tile.x + 0.5f * tile.size) / atlasSize, (tile.y + 0.5f * tile.size) / atlasSize, 0.0f, 1.0f);
+}
+
+// UV bounds of a tile half a texel in, the PCF filter does not reach the next tile
+static XMFLOAT4 ShadowAtlasTileBounds(const ShadowAtlasTile& tile, int atlasSize)
+{
+	float texel = 1.0f / atlasSize;
+	return XMFLOAT4((tile.x + 0.5f) * texel, (tile.y + 0.5f) * texel,
+		(tile.x + tile.size - 0.5f) * texel, (tile.y + tile.size - 0.5f) * texel);
+}
+
 
 const float LightManager::mShadowNear = 5.0f;
 
 LightManager::LightManager() 
 {
 	mLastShadowLight = -1;
-	mNextFreeSpotShadowmap = -1;
-	mNextFreePointShadowmap = -1;
 
 	mShowLightVolume = false;
 		
@@ -105,6 +142,18 @@ LightManager::LightManager()
 	mSpotLightDomainCB = NULL;
 	mSpotLightPixelCB = NULL;
 
+	mClusteredLightPixelShader = NULL;
+	mClusteredLightCB = NULL;
+	mClusterLightBuffer = NULL;
+	mClusterLightSRV = NULL;
+	mClusterLightCapacity = 0;
+	mClusterRangeBuffer = NULL;
+	mClusterRangeSRV = NULL;
+	mClusterRangeCapacity = 0;
+	mClusterIndexBuffer = NULL;
+	mClusterIndexSRV = NULL;
+	mClusterIndexCapacity = 0;
+
 	mShadowGenVSLayout = NULL;
 
 	mSpotShadowGenVertexShader = NULL;
@@ -114,20 +163,10 @@ LightManager::LightManager()
 	mPCFSamplerState = NULL;
 	mShadowGenDepthState = NULL;
 
-	for (int i = 0; i < mTotalSpotShadowmaps; i++)
-	{
-		mSpotDepthStencilRT[i] = NULL;
-		mSpotDepthStencilDSV[i] = NULL;
-		mSpotDepthStencilSRV[i] = NULL;
-	}
-
-
-	for (int i = 0; i < mTotalPointShadowmaps; i++)
-	{
-		mPointDepthStencilRT[i] = NULL;
-		mPointDepthStencilDSV[i] = NULL;
-		mPointDepthStencilSRV[i] = NULL;
-	}
+	mShadowAtlasRT = NULL;
+	mShadowAtlasDSV = NULL;
+	mShadowAtlasSRV = NULL;
+	mShadowAtlasCleared = false;
 
 	mSampPoint = NULL;
 	mShadowMapVisVertexShader = NULL;
@@ -138,8 +177,11 @@ LightManager::LightManager()
 	mDirectionalColor = XMLoadFloat3(&origin);
 	mDirCastShadows = false;
 
-	mAmbientLowerColor = XMLoadFloat3(&origin);
-	mAmbientUpperColor = XMLoadFloat3(&origin);
+	mAmbientSH = SHCoefficients();
+
+	mSpecularEnvSRV = NULL;
+	mSpecularEnvMipCount = 0;
+	mBrdfLutSRV = NULL;
 
 	mArrLights.clear();
 
@@ -191,6 +233,10 @@ HRESULT LightManager::Init(ID3D11Device* device, Camera* camera)
 	cbDesc.ByteWidth = sizeof(CB_SPOT_LIGHT_PIXEL);
 	V_RETURN(device->CreateBuffer(&cbDesc, NULL, &mSpotLightPixelCB));
 
+	cbDesc.ByteWidth = sizeof(CB_CLUSTERED_LIGHTS);
+	V_RETURN(device->CreateBuffer(&cbDesc, NULL, &mClusteredLightCB));
+	DX_SetDebugName(mClusteredLightCB, "Clustered Lights CB");
+
 	cbDesc.ByteWidth = sizeof(XMMATRIX);
 	V_RETURN(device->CreateBuffer(&cbDesc, NULL, &mSpotShadowGenVertexCB));
 	DX_SetDebugName(mSpotShadowGenVertexCB, "Spot Shadow Gen Vertex CB");
@@ -295,6 +341,14 @@ HRESULT LightManager::Init(ID3D11Device* device, Camera* camera)
 	DX_SetDebugName(mSpotLightShadowPixelShader, "Spot Light Shadow PS");
 	SAFE_RELEASE(pShaderBlob);
 
+	// Load the clustered lights shader, drawn with the directional light vertex shader
+	WCHAR clusteredShaderSrc[MAX_PATH] = L"..\\TeapotSkyRefl\\Shaders\\ClusteredLights.hlsl";
+	V_RETURN(CompileShader(clusteredShaderSrc, NULL, "ClusteredLightsPS", "ps_5_0", dwShaderFlags, &pShaderBlob));
+	V_RETURN(device->CreatePixelShader(pShaderBlob->GetBufferPointer(),
+		pShaderBlob->GetBufferSize(), NULL, &mClusteredLightPixelShader));
+	DX_SetDebugName(mClusteredLightPixelShader, "Clustered Lights PS");
+	SAFE_RELEASE(pShaderBlob);
+
 	// Load the shadow generation shaders
 	WCHAR shadowgenSrc[MAX_PATH] = L"..\\TeapotSkyRefl\\Shaders\\ShadowGen.hlsl";
 	V_RETURN(CompileShader(shadowgenSrc, NULL, "SpotShadowGenVS", "vs_5_0", dwShaderFlags, &pShaderBlob));
@@ -423,10 +477,10 @@ HRESULT LightManager::Init(ID3D11Device* device, Camera* camera)
 	samDesc.ComparisonFunc = D3D11_COMPARISON_ALWAYS;
 	V_RETURN(device->CreateSamplerState(&samDesc, &mSampPoint));
 
-	// Allocate the depth stencil target
+	// Allocate the shadow atlas of the spot and point lights
 	D3D11_TEXTURE2D_DESC dtd = {
-		mShadowMapSize, //UINT Width;
-		mShadowMapSize, //UINT Height;
+		mShadowAtlasSize, //UINT Width;
+		mShadowAtlasSize, //UINT Height;
 		1, //UINT MipLevels;
 		1, //UINT ArraySize;
 		//DXGI_FORMAT_R24G8_TYPELESS,
@@ -456,52 +510,26 @@ HRESULT LightManager::Init(ID3D11Device* device, Camera* camera)
 
 	descShaderView.Texture2D.MipLevels = 1;
 
-	char strResName[32];
-	for (int i = 0; i < mTotalSpotShadowmaps; i++)
-	{
-		sprintf_s(strResName, "Spot Shadowmap Target %d", i);
-		V_RETURN(device->CreateTexture2D(&dtd, NULL, &mSpotDepthStencilRT[i]));
-		DX_SetDebugName(mSpotDepthStencilRT[i], strResName);
+	V_RETURN(device->CreateTexture2D(&dtd, NULL, &mShadowAtlasRT));
+	DX_SetDebugName(mShadowAtlasRT, "Shadow Atlas Target");
 
-		sprintf_s(strResName, "Spot Shadowmap Depth View %d", i);
-		V_RETURN(device->CreateDepthStencilView(mSpotDepthStencilRT[i], &descDepthView, &mSpotDepthStencilDSV[i]));
-		DX_SetDebugName(mSpotDepthStencilDSV[i], strResName);
-		
-		sprintf_s(strResName, "Spot Shadowmap Resource View %d", i);
-		V_RETURN(device->CreateShaderResourceView(mSpotDepthStencilRT[i], &descShaderView, &mSpotDepthStencilSRV[i]));
-		DX_SetDebugName(mSpotDepthStencilSRV[i], strResName);
-	}
+	V_RETURN(device->CreateDepthStencilView(mShadowAtlasRT, &descDepthView, &mShadowAtlasDSV));
+	DX_SetDebugName(mShadowAtlasDSV, "Shadow Atlas Depth View");
 
-	// point shadow targets and views
-	dtd.ArraySize = 6;
-	dtd.MiscFlags = D3D10_RESOURCE_MISC_TEXTURECUBE;
-	descDepthView.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
-	descDepthView.Texture2DArray.FirstArraySlice = 0;
-	descDepthView.Texture2DArray.ArraySize = 6;
-	descShaderView.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
-	descShaderView.TextureCube.MipLevels = 1;
-	descShaderView.TextureCube.MostDetailedMip = 0;
-	for (int i = 0; i < mTotalPointShadowmaps; i++)
-	{
-		sprintf_s(strResName, "Point Shadowmap Target %d", i);
-		V_RETURN(device->CreateTexture2D(&dtd, NULL, &mPointDepthStencilRT[i]));
-		DX_SetDebugName(mPointDepthStencilRT[i], strResName);
-
-		sprintf_s(strResName, "Point Shadowmap Depth View %d", i);
-		V_RETURN(device->CreateDepthStencilView(mPointDepthStencilRT[i], &descDepthView, &mPointDepthStencilDSV[i]));
-		DX_SetDebugName(mPointDepthStencilDSV[i], strResName);
+	V_RETURN(device->CreateShaderResourceView(mShadowAtlasRT, &descShaderView, &mShadowAtlasSRV));
+	DX_SetDebugName(mShadowAtlasSRV, "Shadow Atlas Resource View");
 
-		sprintf_s(strResName, "Point Shadowmap Resource View %d", i);
-		V_RETURN(device->CreateShaderResourceView(mPointDepthStencilRT[i], &descShaderView, &mPointDepthStencilSRV[i]));
-		DX_SetDebugName(mPointDepthStencilSRV[i], strResName);
-	}
+	mShadowAtlas.SetSize(mShadowAtlasSize, mShadowAtlasMinTile, mShadowAtlasMaxTile);
 
 	// Allocate the cascaded shadow maps targets and views
+	dtd.Width = mShadowMapSize;
+	dtd.Height = mShadowMapSize;
 	dtd.ArraySize = CascadedMatrixSet::mTotalCascades;
-	dtd.MiscFlags = 0;
 	V_RETURN(device->CreateTexture2D(&dtd, NULL, &mCascadedDepthStencilRT));
 	DX_SetDebugName(mCascadedDepthStencilRT, "Cascaded Shadow Maps Target");
 
+	descDepthView.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+	descDepthView.Texture2DArray.FirstArraySlice = 0;
 	descDepthView.Texture2DArray.ArraySize = CascadedMatrixSet::mTotalCascades;
 	V_RETURN(device->CreateDepthStencilView(mCascadedDepthStencilRT, &descDepthView, &mCascadedDepthStencilDSV));
 	DX_SetDebugName(mCascadedDepthStencilDSV, "Cascaded Shadow Maps DSV");
@@ -581,6 +609,18 @@ void LightManager::Release()
 	SAFE_RELEASE(mSpotLightDomainCB);
 	SAFE_RELEASE(mSpotLightPixelCB);
 
+	SAFE_RELEASE(mClusteredLightPixelShader);
+	SAFE_RELEASE(mClusteredLightCB);
+	SAFE_RELEASE(mClusterLightBuffer);
+	SAFE_RELEASE(mClusterLightSRV);
+	SAFE_RELEASE(mClusterRangeBuffer);
+	SAFE_RELEASE(mClusterRangeSRV);
+	SAFE_RELEASE(mClusterIndexBuffer);
+	SAFE_RELEASE(mClusterIndexSRV);
+	mClusterLightCapacity = 0;
+	mClusterRangeCapacity = 0;
+	mClusterIndexCapacity = 0;
+
 	SAFE_RELEASE(mShadowGenVSLayout);
 
 	SAFE_RELEASE(mSpotShadowGenVertexShader);
@@ -608,19 +648,9 @@ void LightManager::Release()
 
 	SAFE_RELEASE(mPCFSamplerState);
 
-	for (int i = 0; i < mTotalSpotShadowmaps; i++)
-	{
-		SAFE_RELEASE(mSpotDepthStencilRT[i]);
-		SAFE_RELEASE(mSpotDepthStencilDSV[i]);
-		SAFE_RELEASE(mSpotDepthStencilSRV[i]);
-	}
-
-	for (int i = 0; i < mTotalPointShadowmaps; i++)
-	{
-		SAFE_RELEASE(mPointDepthStencilRT[i]);
-		SAFE_RELEASE(mPointDepthStencilDSV[i]);
-		SAFE_RELEASE(mPointDepthStencilSRV[i]);
-	}
+	SAFE_RELEASE(mShadowAtlasRT);
+	SAFE_RELEASE(mShadowAtlasDSV);
+	SAFE_RELEASE(mShadowAtlasSRV);
 
 	SAFE_RELEASE(mCascadedShadowGenVertexShader);
 	SAFE_RELEASE(mCascadedShadowGenGeometryShader);
@@ -675,6 +705,9 @@ void LightManager::DoLighting(ID3D11DeviceContext* pd3dImmediateContext, GBuffer
 	pd3dImmediateContext->OMGetBlendState(&pPrevBlendState, prevBlendFactor, &prevSampleMask);
 	pd3dImmediateContext->OMSetBlendState(mAdditiveBlendState, prevBlendFactor, prevSampleMask);
 
+	// The lights without shadow maps all at once, still with the directional light depth state
+	ClusteredLights(pd3dImmediateContext, camera);
+
 	// Set the depth state for the rest of the lights
 	pd3dImmediateContext->OMSetDepthStencilState(mNoDepthWriteGreatherStencilMaskState, 2);
 
@@ -682,9 +715,12 @@ void LightManager::DoLighting(ID3D11DeviceContext* pd3dImmediateContext, GBuffer
 	pd3dImmediateContext->RSGetState(&pPrevRSState);
 	pd3dImmediateContext->RSSetState(mNoDepthClipFrontRS);
 
-	// Do the rest of the lights
+	// Do the rest of the lights, those with shadow maps one volume at a time
 	for (std::vector<LIGHT>::iterator itrCurrentLight = mArrLights.begin(); itrCurrentLight != mArrLights.end(); itrCurrentLight++)
 	{
+		if ((*itrCurrentLight).iShadowmapIdx < 0)
+			continue;
+
 		if ((*itrCurrentLight).eLightType == TYPE_POINT)
 		{
 			PointLight(pd3dImmediateContext, (*itrCurrentLight).vPosition, (*itrCurrentLight).fRange, (*itrCurrentLight).vColor, (*itrCurrentLight).iShadowmapIdx, false, camera);
@@ -787,6 +823,82 @@ void LightManager::DoDebugCascadedShadows(ID3D11DeviceContext* pd3dImmediateCont
 	pd3dImmediateContext->OMSetBlendState(pPrevBlendState, prevBlendFactor, prevSampleMask);
 }
 
+void LightManager::PrepareShadowVolumes(Camera* camera)
+{
+	// shadow atlas tiles, the largest for a light as tall as the screen or around the camera;
+	// the lights are added in the same order every frame, their index is their handle
+	XMFLOAT3 eye = camera->GetPosition();
+	float tanY = tanf(0.5f * camera->GetFovY());
+	mShadowAtlasRequests.clear();
+	for (const LIGHT& light : mArrLights)
+	{
+		if (light.iShadowmapIdx < 0)
+			continue;
+
+		float dx = light.vPosition.x - eye.x, dy = light.vPosition.y - eye.y, dz = light.vPosition.z - eye.z;
+		float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+		float screen = distance > light.fRange ? light.fRange / (distance * tanY) : 1.0f;
+		ShadowAtlasRequest request = { (uint32_t)light.iShadowmapIdx, mShadowAtlasMaxTile * (std::min)(screen, 1.0f),
+			light.eLightType == TYPE_POINT ? 6 : 1 };
+		mShadowAtlasRequests.push_back(request);
+	}
+	mShadowAtlas.Update(mShadowAtlasRequests.data(), mShadowAtlasRequests.size());
+	for (LIGHT& light : mArrLights)
+	{
+		if (light.iShadowmapIdx >= 0 && !mShadowAtlas.GetTiles(light.iShadowmapIdx))
+			light.iShadowmapIdx = -1;
+	}
+	mShadowAtlasCleared = false;
+
+	mShadowVolumes.clear();
+
+	// the shadow casting lights, then the cascades, as PrepareNextShadowLight visits them
+	for (const LIGHT& light : mArrLights)
+	{
+		if (light.iShadowmapIdx < 0)
+			continue;
+
+		ShadowCasterVolume volume;
+		if (light.eLightType == TYPE_SPOT)
+		{
+			volume.frustumCount = 1;
+			ClusterCuller::ExtractPlanes(SpotShadowMatrix(light), volume.planes[0]);
+		}
+		else if (light.eLightType == TYPE_POINT)
+		{
+			XMMATRIX faces[6];
+			PointShadowMatrices(light, faces);
+			volume.frustumCount = 6;
+			for (int i = 0; i < 6; i++)
+			{
+				ClusterCuller::ExtractPlanes(faces[i], volume.planes[i]);
+			}
+		}
+		else
+		{
+			continue;
+		}
+		mShadowVolumes.push_back(volume);
+	}
+
+	if (mDirCastShadows)
+	{
+		// Get the cascade matrices for the current camera configuration
+		mCascadedMatrixSet->Update(mDirectionalDir);
+
+		// casters between the light and a cascade shadow into it, so the near plane is
+		// left out: d = 1 is inside everywhere
+		ShadowCasterVolume volume;
+		volume.frustumCount = CascadedMatrixSet::mTotalCascades;
+		for (int i = 0; i < CascadedMatrixSet::mTotalCascades; i++)
+		{
+			ClusterCuller::ExtractPlanes(mCascadedMatrixSet->GetWorldToCascadeProj(i), volume.planes[i]);
+			volume.planes[i][4] = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+		}
+		mShadowVolumes.push_back(volume);
+	}
+}
+
 bool LightManager::PrepareNextShadowLight(ID3D11DeviceContext* pd3dImmediateContext)
 {
 	// Search for the next shadow casting light
@@ -835,8 +947,12 @@ void LightManager::DirectionalLight(ID3D11DeviceContext* pd3dImmediateContext)
 	HR(pd3dImmediateContext->Map(mDirLightCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
 	CB_DIRECTIONAL* pDirectionalValuesCB = (CB_DIRECTIONAL*)MappedResource.pData;
 	// TODO GammaToLinear
-	XMStoreFloat3(&pDirectionalValuesCB->vAmbientLower, mAmbientLowerColor);
-	XMStoreFloat3(&pDirectionalValuesCB->vAmbientRange, mAmbientUpperColor - mAmbientLowerColor);
+	for (int i = 0; i < SHCoefficients::Count; ++i)
+	{
+		pDirectionalValuesCB->AmbientSH[i] = XMFLOAT4(mAmbientSH.rgb[i][0], mAmbientSH.rgb[i][1], mAmbientSH.rgb[i][2], 0.0f);
+	}
+	bool specularEnv = mSpecularEnvSRV != NULL && mBrdfLutSRV != NULL && mSpecularEnvMipCount > 0;
+	pDirectionalValuesCB->SpecularEnv = XMFLOAT4(specularEnv ? (float)(mSpecularEnvMipCount - 1) : 0.0f, specularEnv ? 1.0f : 0.0f, 0.0f, 0.0f);
 	XMStoreFloat3(&pDirectionalValuesCB->vDirToLight, -mDirectionalDir);
 	XMStoreFloat3(&pDirectionalValuesCB->vDirectionalColor, mDirectionalColor);
 
@@ -860,6 +976,13 @@ void LightManager::DirectionalLight(ID3D11DeviceContext* pd3dImmediateContext)
 		pd3dImmediateContext->PSSetShaderResources(5, 1, &mCascadedDepthStencilSRV);
 	}
 
+	// Set the prefiltered sky and the lookup table for the sky reflections
+	if (specularEnv)
+	{
+		ID3D11ShaderResourceView* arrSpecularRV[2] = { mSpecularEnvSRV, mBrdfLutSRV };
+		pd3dImmediateContext->PSSetShaderResources(6, 2, arrSpecularRV);
+	}
+
 	// Primitive settings
 	pd3dImmediateContext->IASetInputLayout(NULL);
 	pd3dImmediateContext->IASetVertexBuffers(0, 0, NULL, NULL, NULL);
@@ -873,14 +996,195 @@ void LightManager::DirectionalLight(ID3D11DeviceContext* pd3dImmediateContext)
 	pd3dImmediateContext->Draw(4, 0);
 
 	// Cleanup
-	ID3D11ShaderResourceView *arrRV[1] = { NULL };
+	ID3D11ShaderResourceView *arrRV[4] = { NULL, NULL, NULL, NULL };
 	pd3dImmediateContext->PSSetShaderResources(4, 1, arrRV);
+	pd3dImmediateContext->PSSetShaderResources(6, 2, arrRV);
 	pd3dImmediateContext->VSSetShader(NULL, NULL, 0);
 	pd3dImmediateContext->PSSetShader(NULL, NULL, 0);
 	pd3dImmediateContext->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 }
 
 
+void LightManager::ClusteredLights(ID3D11DeviceContext* pd3dImmediateContext, Camera* camera)
+{
+	HRESULT hr;
+
+	// Assign the lights without shadow maps to the froxels, in view space
+	XMMATRIX mView = camera->View();
+	mClusterLights.clear();
+	for (std::vector<LIGHT>::const_iterator itrLight = mArrLights.begin(); itrLight != mArrLights.end(); itrLight++)
+	{
+		if ((*itrLight).eLightType == TYPE_DIRECTIONAL || (*itrLight).iShadowmapIdx >= 0)
+			continue;
+
+		ClusterLight clusterLight;
+		XMFLOAT3 position, direction(0.0f, 0.0f, 1.0f);
+		XMStoreFloat3(&position, XMVector3TransformCoord(XMLoadFloat3(&(*itrLight).vPosition), mView));
+		clusterLight.type = CLUSTER_LIGHT_POINT;
+		clusterLight.cosAngle = -1.0f;
+		clusterLight.sinAngle = 0.0f;
+		if ((*itrLight).eLightType == TYPE_SPOT)
+		{
+			XMStoreFloat3(&direction, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&(*itrLight).vDirection), mView)));
+			clusterLight.type = CLUSTER_LIGHT_SPOT;
+			clusterLight.cosAngle = cosf((*itrLight).fOuterAngle);
+			clusterLight.sinAngle = sinf((*itrLight).fOuterAngle);
+		}
+		clusterLight.position[0] = position.x;
+		clusterLight.position[1] = position.y;
+		clusterLight.position[2] = position.z;
+		clusterLight.direction[0] = direction.x;
+		clusterLight.direction[1] = direction.y;
+		clusterLight.direction[2] = direction.z;
+		clusterLight.range = (*itrLight).fRange;
+		mClusterLights.push_back(clusterLight);
+	}
+	mLightClusters.SetCamera(camera->GetFovY(), camera->GetAspect(), camera->GetNearZ(), camera->GetFarZ());
+	mLightClusters.Build(mClusterLights.data(), mClusterLights.size());
+	if (mClusterLights.empty())
+		return;
+
+	// Upload the lights in the same order, the froxel ranges and the light indices
+	void* data;
+	hr = MapClusterBuffer(pd3dImmediateContext, (UINT)mClusterLights.size(), sizeof(CLUSTER_LIGHT_GPU), DXGI_FORMAT_UNKNOWN,
+		&mClusterLightBuffer, &mClusterLightSRV, &mClusterLightCapacity, &data);
+	if (FAILED(hr))
+		return;
+	CLUSTER_LIGHT_GPU* pLight = (CLUSTER_LIGHT_GPU*)data;
+	for (std::vector<LIGHT>::const_iterator itrLight = mArrLights.begin(); itrLight != mArrLights.end(); itrLight++)
+	{
+		if ((*itrLight).eLightType == TYPE_DIRECTIONAL || (*itrLight).iShadowmapIdx >= 0)
+			continue;
+
+		pLight->Position = (*itrLight).vPosition;
+		pLight->RangeRcp = 1.0f / (*itrLight).fRange;
+		pLight->Color = GammaToLinear((*itrLight).vColor);
+		if ((*itrLight).eLightType == TYPE_SPOT)
+		{
+			XMStoreFloat3(&pLight->DirToLight, -XMLoadFloat3(&(*itrLight).vDirection));
+			pLight->CosOuterCone = cosf((*itrLight).fOuterAngle);
+			pLight->CosConeAttRange = cosf((*itrLight).fInnerAngle) - pLight->CosOuterCone;
+		}
+		else
+		{
+			// no cone attenuation
+			pLight->DirToLight = XMFLOAT3(0.0f, 0.0f, 0.0f);
+			pLight->CosOuterCone = -2.0f;
+			pLight->CosConeAttRange = 1.0f;
+		}
+		pLight++;
+	}
+	pd3dImmediateContext->Unmap(mClusterLightBuffer, 0);
+
+	const std::vector<LightClusterRange>& clusters = mLightClusters.GetClusters();
+	hr = MapClusterBuffer(pd3dImmediateContext, (UINT)clusters.size(), sizeof(LightClusterRange), DXGI_FORMAT_R32G32_UINT,
+		&mClusterRangeBuffer, &mClusterRangeSRV, &mClusterRangeCapacity, &data);
+	if (FAILED(hr))
+		return;
+	memcpy(data, clusters.data(), clusters.size() * sizeof(LightClusterRange));
+	pd3dImmediateContext->Unmap(mClusterRangeBuffer, 0);
+
+	const std::vector<uint32_t>& indices = mLightClusters.GetLightIndices();
+	hr = MapClusterBuffer(pd3dImmediateContext, (UINT)indices.size(), sizeof(uint32_t), DXGI_FORMAT_R32_UINT,
+		&mClusterIndexBuffer, &mClusterIndexSRV, &mClusterIndexCapacity, &data);
+	if (FAILED(hr))
+		return;
+	memcpy(data, indices.data(), indices.size() * sizeof(uint32_t));
+	pd3dImmediateContext->Unmap(mClusterIndexBuffer, 0);
+
+	// The grid layout for the lookup of the froxel of a pixel
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	HR(pd3dImmediateContext->Map(mClusteredLightCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
+	CB_CLUSTERED_LIGHTS* pClusteredLightsCB = (CB_CLUSTERED_LIGHTS*)MappedResource.pData;
+	pClusteredLightsCB->ClusterGrid[0] = mLightClusters.GetTilesX();
+	pClusteredLightsCB->ClusterGrid[1] = mLightClusters.GetTilesY();
+	pClusteredLightsCB->ClusterGrid[2] = mLightClusters.GetSlices();
+	pClusteredLightsCB->ClusterSlice = XMFLOAT2(mLightClusters.GetSliceScale(), mLightClusters.GetSliceBias());
+	pd3dImmediateContext->Unmap(mClusteredLightCB, 0);
+	pd3dImmediateContext->PSSetConstantBuffers(1, 1, &mClusteredLightCB);
+
+	ID3D11ShaderResourceView* arrClusterRV[3] = { mClusterLightSRV, mClusterRangeSRV, mClusterIndexSRV };
+	pd3dImmediateContext->PSSetShaderResources(8, 3, arrClusterRV);
+
+	// Primitive settings
+	pd3dImmediateContext->IASetInputLayout(NULL);
+	pd3dImmediateContext->IASetVertexBuffers(0, 0, NULL, NULL, NULL);
+	pd3dImmediateContext->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+
+	// Set the shaders, the full screen quad of the directional light
+	pd3dImmediateContext->VSSetShader(mDirLightVertexShader, NULL, 0);
+	pd3dImmediateContext->GSSetShader(NULL, NULL, 0);
+	pd3dImmediateContext->PSSetShader(mClusteredLightPixelShader, NULL, 0);
+
+	pd3dImmediateContext->Draw(4, 0);
+
+	// Cleanup
+	ZeroMemory(arrClusterRV, sizeof(arrClusterRV));
+	pd3dImmediateContext->PSSetShaderResources(8, 3, arrClusterRV);
+	pd3dImmediateContext->VSSetShader(NULL, NULL, 0);
+	pd3dImmediateContext->PSSetShader(NULL, NULL, 0);
+	pd3dImmediateContext->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+HRESULT LightManager::MapClusterBuffer(ID3D11DeviceContext* pd3dImmediateContext, UINT count, UINT elementSize, DXGI_FORMAT format,
+	ID3D11Buffer** buffer, ID3D11ShaderResourceView** srv, UINT* capacity, void** data)
+{
+	HRESULT hr = S_OK;
+
+	// Grow to twice the size so a changing light count does not create a buffer every frame
+	if (*buffer == NULL || count > *capacity)
+	{
+		SAFE_RELEASE(*srv);
+		SAFE_RELEASE(*buffer);
+		*capacity = (std::max)((std::max)(count, *capacity * 2), 64u);
+
+		ID3D11Device* device = NULL;
+		pd3dImmediateContext->GetDevice(&device);
+
+		// a structured buffer without a format
+		D3D11_BUFFER_DESC bufferDesc;
+		ZeroMemory(&bufferDesc, sizeof(bufferDesc));
+		bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+		bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		bufferDesc.ByteWidth = *capacity * elementSize;
+		if (format == DXGI_FORMAT_UNKNOWN)
+		{
+			bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+			bufferDesc.StructureByteStride = elementSize;
+		}
+		hr = device->CreateBuffer(&bufferDesc, NULL, buffer);
+
+		if (SUCCEEDED(hr))
+		{
+			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+			ZeroMemory(&srvDesc, sizeof(srvDesc));
+			srvDesc.Format = format;
+			srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+			srvDesc.Buffer.FirstElement = 0;
+			srvDesc.Buffer.NumElements = *capacity;
+			hr = device->CreateShaderResourceView(*buffer, &srvDesc, srv);
+		}
+		SAFE_RELEASE(device);
+
+		if (FAILED(hr))
+		{
+			SAFE_RELEASE(*buffer);
+			*capacity = 0;
+			return hr;
+		}
+	}
+
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	hr = pd3dImmediateContext->Map(*buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource);
+	if (FAILED(hr))
+		return hr;
+
+	*data = MappedResource.pData;
+	return S_OK;
+}
+
+
 void LightManager::PointLight(ID3D11DeviceContext* pd3dImmediateContext, const XMFLOAT3& vPos, float fRange, const XMFLOAT3& vColor, int iShadowmapIdx, bool bWireframe, Camera* camera)
 {
 	HRESULT hr;
@@ -909,11 +1213,18 @@ void LightManager::PointLight(ID3D11DeviceContext* pd3dImmediateContext, const X
 		// Set the shadow map if casting shadows
 		if (iShadowmapIdx >= 0)
 		{
-			// Prepare the projection to shadow space for each cube face
-			XMMATRIX matPointProj = XMMatrixPerspectiveFovLH( M_PI * 0.5f, 1.0, mShadowNear, fRange);
-			XMFLOAT4X4 tmp;
-			XMStoreFloat4x4(&tmp, matPointProj);
-			pPointLightPixelCB->LightPerspectiveValues = XMFLOAT2(tmp.m[2][2], tmp.m[3][2]);
+			// Prepare the projection to the atlas tile of each cube face
+			LIGHT light = {};
+			light.vPosition = vPos;
+			light.fRange = fRange;
+			XMMATRIX faces[6];
+			PointShadowMatrices(light, faces);
+			const ShadowAtlasTile* tiles = mShadowAtlas.GetTiles(iShadowmapIdx);
+			for (int i = 0; i < 6; i++)
+			{
+				pPointLightPixelCB->ToShadowmap[i] = XMMatrixTranspose(faces[i] * ShadowAtlasTileMatrix(tiles[i], mShadowAtlasSize));
+				pPointLightPixelCB->ShadowTiles[i] = ShadowAtlasTileBounds(tiles[i], mShadowAtlasSize);
+			}
 		}
 	
 		pd3dImmediateContext->Unmap(mPointLightPixelCB, 0);
@@ -922,7 +1233,7 @@ void LightManager::PointLight(ID3D11DeviceContext* pd3dImmediateContext, const X
 		// Set the shadow map if casting shadows
 		if (iShadowmapIdx >= 0)
 		{
-			pd3dImmediateContext->PSSetShaderResources(4, 1, &mPointDepthStencilSRV[iShadowmapIdx]);
+			pd3dImmediateContext->PSSetShaderResources(4, 1, &mShadowAtlasSRV);
 		}
 	}
 
@@ -1028,8 +1339,10 @@ void LightManager::SpotLight(ID3D11DeviceContext* pd3dImmediateContext, const XM
 			vUp = XMVector3Normalize(vUp);
 			matSpotView = XMMatrixLookAtLH(pos, vLookAt, vUp);
 			XMMATRIX matSpotProj = XMMatrixPerspectiveFovLH( 2.0f * fOuterAngle, 1.0, mShadowNear, fRange);
-			XMMATRIX ToShadowmap = matSpotView * matSpotProj;
+			const ShadowAtlasTile& tile = mShadowAtlas.GetTiles(iShadowmapIdx)[0];
+			XMMATRIX ToShadowmap = matSpotView * matSpotProj * ShadowAtlasTileMatrix(tile, mShadowAtlasSize);
 			pSpotLightPixelCB->ToShadowmap = XMMatrixTranspose(ToShadowmap);
+			pSpotLightPixelCB->ShadowTile = ShadowAtlasTileBounds(tile, mShadowAtlasSize);
 		}
 
 		pd3dImmediateContext->Unmap(mSpotLightPixelCB, 0);
@@ -1038,7 +1351,7 @@ void LightManager::SpotLight(ID3D11DeviceContext* pd3dImmediateContext, const XM
 		// Set the shadow map if casting shadows
 		if (iShadowmapIdx >= 0)
 		{
-			pd3dImmediateContext->PSSetShaderResources(4, 1, &mSpotDepthStencilSRV[iShadowmapIdx]);
+			pd3dImmediateContext->PSSetShaderResources(4, 1, &mShadowAtlasSRV);
 		}
 	}
 
@@ -1060,24 +1373,8 @@ void LightManager::SpotLight(ID3D11DeviceContext* pd3dImmediateContext, const XM
 	pd3dImmediateContext->PSSetShaderResources(4, 1, &nullSRV);
 }
 
-void LightManager::SpotShadowGen(ID3D11DeviceContext* pd3dImmediateContext, const LIGHT& light)
+XMMATRIX LightManager::SpotShadowMatrix(const LIGHT& light) const
 {
-	HRESULT hr;
-
-	D3D11_VIEWPORT vp[1] = { { 0, 0, mShadowMapSize, mShadowMapSize, 0.0f, 1.0f } };
-	pd3dImmediateContext->RSSetViewports(1, vp);
-
-	// Set the depth target
-	ID3D11RenderTargetView* nullRT = NULL;
-	ID3D11DepthStencilView* pDSV = mSpotDepthStencilDSV[light.iShadowmapIdx];
-	pd3dImmediateContext->OMSetRenderTargets(1, &nullRT, pDSV);
-
-	// Clear the depth stencil
-	pd3dImmediateContext->ClearDepthStencilView(pDSV, D3D11_CLEAR_DEPTH, 1.0, 0);
-
-	// Set the shadow rasterizer state with the bias
-	//pd3dImmediateContext->RSSetState(mShadowGenRS);
-
 	// Prepare the projection to shadow space
 	XMMATRIX matSpotView;
 	XMVECTOR vLookAt = XMLoadFloat3(&light.vPosition) + XMLoadFloat3(&light.vDirection) * light.fRange;
@@ -1094,12 +1391,42 @@ void LightManager::SpotShadowGen(ID3D11DeviceContext* pd3dImmediateContext, cons
 	XMMATRIX matSpotProj;
 	matSpotProj = XMMatrixPerspectiveFovLH(2.0f * light.fOuterAngle, 1.0, mShadowNear, light.fRange);
 
+	return matSpotView * matSpotProj;
+}
+
+void LightManager::SetShadowAtlasTarget(ID3D11DeviceContext* pd3dImmediateContext)
+{
+	// Set the depth target
+	ID3D11RenderTargetView* nullRT = NULL;
+	pd3dImmediateContext->OMSetRenderTargets(1, &nullRT, mShadowAtlasDSV);
+
+	// Clear the whole atlas once, every tile is rendered again each frame
+	if (!mShadowAtlasCleared)
+	{
+		pd3dImmediateContext->ClearDepthStencilView(mShadowAtlasDSV, D3D11_CLEAR_DEPTH, 1.0, 0);
+		mShadowAtlasCleared = true;
+	}
+}
+
+void LightManager::SpotShadowGen(ID3D11DeviceContext* pd3dImmediateContext, const LIGHT& light)
+{
+	HRESULT hr;
+
+	// Render to the light's tile of the atlas
+	const ShadowAtlasTile& tile = mShadowAtlas.GetTiles(light.iShadowmapIdx)[0];
+	D3D11_VIEWPORT vp[1] = { { (float)tile.x, (float)tile.y, (float)tile.size, (float)tile.size, 0.0f, 1.0f } };
+	pd3dImmediateContext->RSSetViewports(1, vp);
+
+	SetShadowAtlasTarget(pd3dImmediateContext);
+
+	// Set the shadow rasterizer state with the bias
+	//pd3dImmediateContext->RSSetState(mShadowGenRS);
+
 	// Fill the shadow generation matrix constant buffer
 	D3D11_MAPPED_SUBRESOURCE MappedResource;
 	V(pd3dImmediateContext->Map(mSpotShadowGenVertexCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
 	XMMATRIX * shadowGenMat = (XMMATRIX*)MappedResource.pData;
-	XMMATRIX toShadow = matSpotView * matSpotProj;
-	shadowGenMat = &XMMatrixTranspose(toShadow);
+	*shadowGenMat = XMMatrixTranspose(SpotShadowMatrix(light));
 	pd3dImmediateContext->Unmap(mSpotShadowGenVertexCB, 0);
 	pd3dImmediateContext->VSSetConstantBuffers(0, 1, &mSpotShadowGenVertexCB);
 
@@ -1112,68 +1439,67 @@ void LightManager::SpotShadowGen(ID3D11DeviceContext* pd3dImmediateContext, cons
 	pd3dImmediateContext->PSSetShader(NULL, NULL, 0);
 }
 
-void LightManager::PointShadowGen(ID3D11DeviceContext* pd3dImmediateContext, const LIGHT& light)
+void LightManager::PointShadowMatrices(const LIGHT& light, XMMATRIX faces[6]) const
 {
-	HRESULT hr;
-
-	D3D11_VIEWPORT vp[6] = {	{ 0, 0, mShadowMapSize, mShadowMapSize, 0.0f, 1.0f }, 
-								{ 0, 0, mShadowMapSize, mShadowMapSize, 0.0f, 1.0f }, 
-								{ 0, 0, mShadowMapSize, mShadowMapSize, 0.0f, 1.0f }, 
-								{ 0, 0, mShadowMapSize, mShadowMapSize, 0.0f, 1.0f }, 
-								{ 0, 0, mShadowMapSize, mShadowMapSize, 0.0f, 1.0f }, 
-								{ 0, 0, mShadowMapSize, mShadowMapSize, 0.0f, 1.0f } };
-
-	pd3dImmediateContext->RSSetViewports(6, vp);
-
-	// Set the depth target
-	ID3D11RenderTargetView* nullRT = NULL;
-	ID3D11DepthStencilView* pDSV = mPointDepthStencilDSV[light.iShadowmapIdx];
-	pd3dImmediateContext->OMSetRenderTargets(1, &nullRT, pDSV);
-
-	// Clear the depth stencil
-	pd3dImmediateContext->ClearDepthStencilView(pDSV, D3D11_CLEAR_DEPTH, 1.0, 0);
-
 	// Prepare the projection to shadow space for each cube face
 	XMMATRIX matPointProj = XMMatrixPerspectiveFovLH( M_PI * 0.5f, 1.0, mShadowNear, light.fRange);
 
-	// Fill the shadow generation matrices constant buffer
-	D3D11_MAPPED_SUBRESOURCE MappedResource;
-	V(pd3dImmediateContext->Map(mPointShadowGenGeometryCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
-	XMMATRIX* pShadowGenMat = (XMMATRIX*)MappedResource.pData;
 	XMMATRIX matPointPos = XMMatrixTranslation(-light.vPosition.x, -light.vPosition.y, -light.vPosition.z);
 
 	XMMATRIX matPointView;
-	XMMATRIX toShadow;
 
 	// Cube +X 
 	matPointView = XMMatrixRotationY(M_PI + M_PI * 0.5f);
-	toShadow = matPointPos * matPointView * matPointProj;
-	pShadowGenMat[0] = XMMatrixTranspose(toShadow);
+	faces[0] = matPointPos * matPointView * matPointProj;
 
 	// Cube -X
 	matPointView = XMMatrixRotationY(M_PI * 0.5f);
-	toShadow = matPointPos * matPointView * matPointProj;
-	pShadowGenMat[1] = XMMatrixTranspose(toShadow);
+	faces[1] = matPointPos * matPointView * matPointProj;
 
 	// Cube +Y
 	matPointView = XMMatrixRotationX(M_PI * 0.5f);
-	toShadow = matPointPos * matPointView * matPointProj;
-	pShadowGenMat[2] = XMMatrixTranspose(toShadow);
+	faces[2] = matPointPos * matPointView * matPointProj;
 
 	// Cube -Y
 	matPointView = XMMatrixRotationX(M_PI + M_PI * 0.5f);
-	toShadow = matPointPos * matPointView * matPointProj;
-	pShadowGenMat[3] = XMMatrixTranspose(toShadow);
+	faces[3] = matPointPos * matPointView * matPointProj;
 
 	// Cube +Z
 	// Identity view
-	toShadow = matPointPos * matPointProj;
-	pShadowGenMat[4] = XMMatrixTranspose(toShadow);
+	faces[4] = matPointPos * matPointProj;
 
 	// Cube -Z
 	matPointView = XMMatrixRotationY(M_PI);
-	toShadow = matPointPos * matPointView * matPointProj;
-	pShadowGenMat[5] = XMMatrixTranspose(toShadow);
+	faces[5] = matPointPos * matPointView * matPointProj;
+}
+
+void LightManager::PointShadowGen(ID3D11DeviceContext* pd3dImmediateContext, const LIGHT& light)
+{
+	HRESULT hr;
+
+	// Render each cube face to its tile of the atlas, the geometry shader picks the viewport
+	const ShadowAtlasTile* tiles = mShadowAtlas.GetTiles(light.iShadowmapIdx);
+	D3D11_VIEWPORT vp[6];
+	for (int i = 0; i < 6; i++)
+	{
+		D3D11_VIEWPORT faceVp = { (float)tiles[i].x, (float)tiles[i].y, (float)tiles[i].size, (float)tiles[i].size, 0.0f, 1.0f };
+		vp[i] = faceVp;
+	}
+
+	pd3dImmediateContext->RSSetViewports(6, vp);
+
+	SetShadowAtlasTarget(pd3dImmediateContext);
+
+	// Fill the shadow generation matrices constant buffer
+	XMMATRIX faces[6];
+	PointShadowMatrices(light, faces);
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	V(pd3dImmediateContext->Map(mPointShadowGenGeometryCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
+	XMMATRIX* pShadowGenMat = (XMMATRIX*)MappedResource.pData;
+	for (int i = 0; i < 6; i++)
+	{
+		pShadowGenMat[i] = XMMatrixTranspose(faces[i]);
+	}
 
 	pd3dImmediateContext->Unmap(mPointShadowGenGeometryCB, 0);
 	pd3dImmediateContext->GSSetConstantBuffers(0, 1, &mPointShadowGenGeometryCB);
@@ -1204,9 +1530,7 @@ void LightManager::CascadedShadowsGen(ID3D11DeviceContext* pd3dImmediateContext)
 	// Clear the depth stencil
 	pd3dImmediateContext->ClearDepthStencilView(mCascadedDepthStencilDSV, D3D11_CLEAR_DEPTH, 1.0, 0);
 
-	// Get the cascade matrices for the current camera configuration
-	mCascadedMatrixSet->Update(mDirectionalDir);
-
+	// the cascade matrices for the current camera configuration are updated by PrepareShadowVolumes
 	// Fill the shadow generation matrices constant buffer
 	D3D11_MAPPED_SUBRESOURCE MappedResource;
 	V(pd3dImmediateContext->Map(mCascadedShadowGenGeometryCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
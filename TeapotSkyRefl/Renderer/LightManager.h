@@ -2,9 +2,23 @@
 
 #include <vector>
 #include "CascadedMatrixSet.h"
+#include "SphericalHarmonics.h"
+#include "LightClusterGrid.h"
+#include "ShadowAtlas.h"
 
 class GBuffer;
 class Camera;
+
+// Where the casters of one shadow pass can be: the frusta the pass renders, a spot
+// light cone, the six cube faces of a point light or the cascades extended toward the
+// light. A caster inside any of them is drawn.
+struct ShadowCasterVolume
+{
+	static const int MaxFrusta = 6;
+
+	int frustumCount;
+	XMFLOAT4 planes[MaxFrusta][6];	// a x + b y + c z + d >= 0 inside
+};
  
 // LightManager
 //
@@ -26,11 +40,25 @@ public:
 
 	void Update(float dt);
 
-	// Set the ambient values
+	// Set the ambient values, a hemisphere from the lower to the upper color
 	void SetAmbient(const XMVECTOR& ambientLowerColor, const XMVECTOR& ambientUpperColor)
 	{
-		mAmbientLowerColor = ambientLowerColor;
-		mAmbientUpperColor = ambientUpperColor;
+		XMFLOAT3 lower, upper;
+		XMStoreFloat3(&lower, ambientLowerColor);
+		XMStoreFloat3(&upper, ambientUpperColor);
+		SphericalHarmonics::HemisphereAmbient(&lower.x, &upper.x, mAmbientSH);
+	}
+
+	// Set the ambient from spherical harmonics, see SphericalHarmonics::AmbientCoefficients
+	void SetAmbientSH(const SHCoefficients& ambient) { mAmbientSH = ambient; }
+
+	// Sky reflections of the directional pass from the GGX prefiltered sky with mipCount mips and the
+	// split sum lookup table, see EnvironmentPrefilter. Without them the sky cubemap is reflected as is.
+	void SetSpecularEnvironment(ID3D11ShaderResourceView* specular, UINT mipCount, ID3D11ShaderResourceView* brdfLut)
+	{
+		mSpecularEnvSRV = specular;
+		mSpecularEnvMipCount = mipCount;
+		mBrdfLutSRV = brdfLut;
 	}
 
 	// Set the directional light values
@@ -43,7 +71,7 @@ public:
 	}
 
 	// Clear the lights from the previous frame
-	void ClearLights() { mArrLights.clear();  mLastShadowLight = -1; mNextFreeSpotShadowmap = -1; mNextFreePointShadowmap = -1; }
+	void ClearLights() { mArrLights.clear();  mLastShadowLight = -1; }
 
 	// Add a single point light
 	void AddPointLight(const XMFLOAT3& pointPosition, float pointRange, const XMFLOAT3& pointColor, bool bCastShadow)
@@ -55,7 +83,7 @@ public:
 		pointLight.fRange = pointRange;
 		pointLight.vColor = pointColor;
 
-		pointLight.iShadowmapIdx = bCastShadow ? GetNextFreePointShadowmapIdx() : -1;
+		pointLight.iShadowmapIdx = bCastShadow ? (int)mArrLights.size() : -1;
 
 		mArrLights.push_back(pointLight);
 	}
@@ -72,19 +100,32 @@ public:
 		spotLight.fOuterAngle = M_PI * spotOuterAngle / 180.0f;
 		spotLight.fInnerAngle = M_PI * spotInnerAngle / 180.0f;
 		spotLight.vColor = spotColor;
-		spotLight.iShadowmapIdx = bCastShadow ? GetNextFreeSpotShadowmapIdx() : -1;
+		spotLight.iShadowmapIdx = bCastShadow ? (int)mArrLights.size() : -1;
 
 		mArrLights.push_back(spotLight);
 	}
 
 	void DoLighting(ID3D11DeviceContext* pd3dImmediateContext, GBuffer* gBuffer, Camera* camera);
 
+	// Froxel grid of the lights without shadow maps in the last DoLighting
+	const LightClusterStats& GetLightClusterStats() const { return mLightClusters.GetStats(); }
+
+	// Shadow atlas tiles of the last PrepareShadowVolumes
+	const ShadowAtlasStats& GetShadowAtlasStats() const { return mShadowAtlas.GetStats(); }
+
 	// Render each light colume in wireframe
 	void DoDebugLightVolume(ID3D11DeviceContext* pd3dImmediateContext, Camera* camera);
 
 	// Color the pixels affected by each cascade
 	void DoDebugCascadedShadows(ID3D11DeviceContext* pd3dImmediateContext, GBuffer* gBuffer);
 
+	// Gives the shadow casting lights their shadow atlas tiles, sized by how large they are
+	// from the camera; lights left without a tile lose their shadows for the frame. Then
+	// computes the caster volume of every shadow pass, in the order PrepareNextShadowLight
+	// prepares them, and updates the cascades. Call once per frame before the passes.
+	void PrepareShadowVolumes(Camera* camera);
+	const std::vector<ShadowCasterVolume>& GetShadowVolumes() const { return mShadowVolumes; }
+
 	// Prepare shadow generation for the next shadow casting light
 	bool PrepareNextShadowLight(ID3D11DeviceContext* pd3dImmediateContext);
 
@@ -111,12 +152,19 @@ private:
 		float fOuterAngle;
 		float fInnerAngle;
 		XMFLOAT3 vColor;
-		int iShadowmapIdx;
+		int iShadowmapIdx;	// shadow atlas handle, -1 without shadows
 	} LIGHT;
 
 	// Do the directional light calculation
 	void DirectionalLight(ID3D11DeviceContext* pd3dImmediateContext);
 
+	// Point and spot lights without shadow maps in one full screen pass through the froxel grid
+	void ClusteredLights(ID3D11DeviceContext* pd3dImmediateContext, Camera* camera);
+
+	// Maps a dynamic shader resource buffer of at least count elements, growing it as needed
+	HRESULT MapClusterBuffer(ID3D11DeviceContext* pd3dImmediateContext, UINT count, UINT elementSize, DXGI_FORMAT format,
+		ID3D11Buffer** buffer, ID3D11ShaderResourceView** srv, UINT* capacity, void** data);
+
 	// Based on the value of bWireframe, either do the lighting or render the volume
 	void PointLight(ID3D11DeviceContext* pd3dImmediateContext, const XMFLOAT3& vPos, float fRange, const XMFLOAT3& vColor, int iShadowmapIdx, bool bWireframe, Camera* camera);
 	
@@ -124,11 +172,14 @@ private:
 	// Based on the value of bWireframe, either do the lighting or render the volume
 	void SpotLight(ID3D11DeviceContext* pd3dImmediateContext, const XMFLOAT3& vPos, const XMFLOAT3& vDir, float fRange, float fInnerAngle, float fOuterAngle, const XMFLOAT3& vColor, int iShadowmapIdx, bool bWireframe, Camera* camera);
 
-	// Get a shadowmap index - first come first served
-	int GetNextFreeSpotShadowmapIdx() { return (mNextFreeSpotShadowmap + 1 < mTotalSpotShadowmaps) ? ++mNextFreeSpotShadowmap : -1; }
+	// world to shadow map projection of a spot light
+	XMMATRIX SpotShadowMatrix(const LIGHT& light) const;
+
+	// world to shadow map projections of the cube faces of a point light, +X, -X, +Y, -Y, +Z, -Z
+	void PointShadowMatrices(const LIGHT& light, XMMATRIX faces[6]) const;
 
-	// Get a point shadowmap index - first come first served
-	int GetNextFreePointShadowmapIdx() { return (mNextFreePointShadowmap + 1 < mTotalPointShadowmaps) ? ++mNextFreePointShadowmap : -1; }
+	// Set the shadow atlas as the depth target, cleared before the first light of the frame
+	void SetShadowAtlasTarget(ID3D11DeviceContext* pd3dImmediateContext);
 
 	// Prepare a spot shadowmap for casters rendering
 	void SpotShadowGen(ID3D11DeviceContext* pd3dImmediateContext, const LIGHT& light);
@@ -164,6 +215,19 @@ private:
 	ID3D11Buffer*		mSpotLightDomainCB;
 	ID3D11Buffer*		mSpotLightPixelCB;
 
+	// Clustered lights, the lights, froxel ranges and light indices of LightClusterGrid
+	ID3D11PixelShader*	mClusteredLightPixelShader;
+	ID3D11Buffer*		mClusteredLightCB;
+	ID3D11Buffer*		mClusterLightBuffer;
+	ID3D11ShaderResourceView* mClusterLightSRV;
+	UINT				mClusterLightCapacity;
+	ID3D11Buffer*		mClusterRangeBuffer;
+	ID3D11ShaderResourceView* mClusterRangeSRV;
+	UINT				mClusterRangeCapacity;
+	ID3D11Buffer*		mClusterIndexBuffer;
+	ID3D11ShaderResourceView* mClusterIndexSRV;
+	UINT				mClusterIndexCapacity;
+
 
 	// Shadowmap generation layout
 	ID3D11InputLayout* mShadowGenVSLayout;
@@ -212,30 +276,21 @@ private:
 	// Index to the last shadow casting light a map was generated for
 	int mLastShadowLight;
 
-	// Index to the next avaliable spot shadowmap
-	int mNextFreeSpotShadowmap;
-
-	// Size in pixels of the shadow map
+	// Size in pixels of the cascaded shadow maps
 	static const int mShadowMapSize = 1024;
 
-	// Maximum supported spot shadowmaps
-	static const int mTotalSpotShadowmaps = 3;
-
-	// Spot light shadowmap resources
-	ID3D11Texture2D*			mSpotDepthStencilRT[mTotalSpotShadowmaps];
-	ID3D11DepthStencilView*		mSpotDepthStencilDSV[mTotalSpotShadowmaps];
-	ID3D11ShaderResourceView*	mSpotDepthStencilSRV[mTotalSpotShadowmaps];
+	// Size in pixels of the spot and point light shadow atlas, and of its smallest and largest tiles
+	static const int mShadowAtlasSize = 4096;
+	static const int mShadowAtlasMinTile = 128;
+	static const int mShadowAtlasMaxTile = 1024;
 
-	// Index to the next available point shadowmap
-	int mNextFreePointShadowmap;
-
-	// Maximum supported point shadowmaps
-	static const int mTotalPointShadowmaps = 3;
-
-	// Point light shadowmap resources
-	ID3D11Texture2D* mPointDepthStencilRT[mTotalPointShadowmaps];
-	ID3D11DepthStencilView* mPointDepthStencilDSV[mTotalSpotShadowmaps];
-	ID3D11ShaderResourceView* mPointDepthStencilSRV[mTotalSpotShadowmaps];
+	// Spot and point light shadow atlas, a tile per spot light and per point light cube face
+	ShadowAtlas mShadowAtlas;
+	std::vector<ShadowAtlasRequest> mShadowAtlasRequests;
+	ID3D11Texture2D*			mShadowAtlasRT;
+	ID3D11DepthStencilView*		mShadowAtlasDSV;
+	ID3D11ShaderResourceView*	mShadowAtlasSRV;
+	bool mShadowAtlasCleared;
 
 	// Cascaded shadow maps generation
 	ID3D11VertexShader* mCascadedShadowGenVertexShader;
@@ -258,8 +313,12 @@ private:
 	ID3D11PixelShader*	mShadowMapVisPixelShader;
 
 	// Ambient light information
-	XMVECTOR mAmbientLowerColor;
-	XMVECTOR mAmbientUpperColor;
+	SHCoefficients mAmbientSH;
+
+	// Specular sky information, owned by TextureManager
+	ID3D11ShaderResourceView* mSpecularEnvSRV;
+	UINT mSpecularEnvMipCount;
+	ID3D11ShaderResourceView* mBrdfLutSRV;
 
 	// Directional light information
 	XMVECTOR mDirectionalDir;
@@ -268,4 +327,11 @@ private:
 
 	// Linked list with the active lights
 	std::vector<LIGHT> mArrLights;
+
+	// caster volumes of the shadow passes of this frame
+	std::vector<ShadowCasterVolume> mShadowVolumes;
+
+	// lights without shadow maps in view space and their froxels
+	std::vector<ClusterLight> mClusterLights;
+	LightClusterGrid mLightClusters;
 };
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "MappedFile.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile() : mFile(INVALID_HANDLE_VALUE), mMapping(NULL), mData(NULL), mSize(0)
+{
+}
+
+bool MappedFile::Open(const std::string& fileName)
+{
+	Close();
+
+	mFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	mSize = (size_t)fileSize.QuadPart;
+
+	mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mMapping == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	mData = (const char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (mData == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mData != NULL)
+	{
+		UnmapViewOfFile(mData);
+		mData = NULL;
+	}
+
+	if (mMapping != NULL)
+	{
+		CloseHandle(mMapping);
+		mMapping = NULL;
+	}
+
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+
+	mSize = 0;
+}
+
+#else
+
+MappedFile::MappedFile() : mFile(-1), mData(NULL), mSize(0)
+{
+}
+
+bool MappedFile::Open(const std::string& fileName)
+{
+	Close();
+
+	mFile = open(fileName.c_str(), O_RDONLY);
+	if (mFile < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(mFile, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+	mSize = (size_t)fileStat.st_size;
+
+	void* view = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+	if (view == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	mData = (const char*)view;
+
+	// the readers walk the file front to back, like FILE_FLAG_SEQUENTIAL_SCAN
+	madvise(view, mSize, MADV_SEQUENTIAL);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mData != NULL)
+	{
+		munmap((void*)mData, mSize);
+		mData = NULL;
+	}
+
+	if (mFile >= 0)
+	{
+		close(mFile);
+		mFile = -1;
+	}
+
+	mSize = 0;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+// MappedFile
+// Read only memory mapped view of a whole file, CreateFileMapping on Windows and
+// mmap elsewhere.
+// usage:
+// MappedFile file;
+// if (file.Open("..\\Assets\\teapot.obj")) { parse(file.Data(), file.Size()); }
+// the view is unmapped when Close() is called or the object goes out of scope.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::string& fileName);
+	void Close();
+
+	const char* Data() const { return mData; }
+	size_t Size() const { return mSize; }
+	bool IsOpen() const { return mData != NULL; }
+
+private:
+	MappedFile(const MappedFile& rhs);
+	MappedFile& operator=(const MappedFile& rhs);
+
+#if defined(_WIN32)
+	HANDLE mFile;
+	HANDLE mMapping;
+#else
+	int mFile;
+#endif
+	const char* mData;
+	size_t mSize;
+};
@@ -1,8 +1,282 @@
 #include "Mesh.h"
 
+#include <cfloat>
+#include <cstring>
 
-Mesh::Mesh() : mVB(NULL), mIB(NULL), mIndexCount(0), mVertexCount(0)
+static_assert(sizeof(Vertex) == UnpackedVertexFloats * sizeof(float), "VertexPacking reads Vertex as 8 floats");
+
+
+void ComputeMeshBounds(const Vertex* vertices, size_t vertexCount, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax)
+{
+	if (vertexCount == 0)
+	{
+		boundsMin = boundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		return;
+	}
+
+	XMVECTOR vMin = XMLoadFloat3(&vertices[0].Position);
+	XMVECTOR vMax = vMin;
+	for (size_t i = 1; i < vertexCount; ++i)
+	{
+		XMVECTOR p = XMLoadFloat3(&vertices[i].Position);
+		vMin = XMVectorMin(vMin, p);
+		vMax = XMVectorMax(vMax, p);
+	}
+	XMStoreFloat3(&boundsMin, vMin);
+	XMStoreFloat3(&boundsMax, vMax);
+}
+
+void GroupMeshByMaterial(MeshData& meshData)
+{
+	meshData.Submeshes.clear();
+	UINT triangleCount = (UINT)(meshData.Indices.size() / 3);
+	if (triangleCount == 0)
+		return;
+
+	Submesh submesh;
+	ZeroMemory(&submesh, sizeof(submesh));
+
+	if (meshData.MaterialIndices.size() != triangleCount)
+	{
+		meshData.MaterialIndices.clear();
+		submesh.indexCount = triangleCount * 3;
+		meshData.Submeshes.push_back(submesh);
+		return;
+	}
+
+	// counting sort of the triangles, stable so the source order survives within a material
+	UINT materialCount = *std::max_element(meshData.MaterialIndices.begin(), meshData.MaterialIndices.end()) + 1;
+	std::vector<UINT> offsets(materialCount + 1, 0);
+	for (UINT material : meshData.MaterialIndices)
+		offsets[material + 1]++;
+	for (UINT m = 0; m < materialCount; ++m)
+		offsets[m + 1] += offsets[m];
+
+	std::vector<UINT> indices(meshData.Indices.size());
+	std::vector<UINT> fill(offsets.begin(), offsets.end() - 1);
+	for (UINT t = 0; t < triangleCount; ++t)
+	{
+		UINT target = fill[meshData.MaterialIndices[t]]++;
+		std::copy(&meshData.Indices[t * 3], &meshData.Indices[t * 3] + 3, &indices[target * 3]);
+	}
+	meshData.Indices.swap(indices);
+
+	for (UINT m = 0; m < materialCount; ++m)
+	{
+		if (offsets[m + 1] == offsets[m])
+			continue;
+		submesh.materialId = m;
+		submesh.indexOffset = offsets[m] * 3;
+		submesh.indexCount = (offsets[m + 1] - offsets[m]) * 3;
+		meshData.Submeshes.push_back(submesh);
+	}
+
+	std::sort(meshData.MaterialIndices.begin(), meshData.MaterialIndices.end());
+}
+
+// Builds the meshlets of every submesh and appends them, the submeshes record their ranges
+static void BuildSubmeshMeshlets(const std::vector<Vertex>& vertices, UINT* indices, Submesh* submeshes, size_t submeshCount,
+	std::vector<Meshlet>& meshlets)
+{
+	std::vector<Meshlet> submeshMeshlets;
+	for (size_t s = 0; s < submeshCount; ++s)
+	{
+		Submesh& submesh = submeshes[s];
+		MeshletBuilder::Build(&vertices[0].Position.x, sizeof(Vertex), vertices.size(), indices + submesh.indexOffset,
+			submesh.indexCount, submeshMeshlets);
+
+		submesh.meshletOffset = (UINT)meshlets.size();
+		submesh.meshletCount = (UINT)submeshMeshlets.size();
+		for (Meshlet meshlet : submeshMeshlets)
+		{
+			meshlet.indexOffset += submesh.indexOffset;
+			meshlets.push_back(meshlet);
+		}
+	}
+}
+
+void OptimizeMesh(MeshData& meshData, MeshOptimizerStats* stats)
+{
+	if (meshData.Vertices.empty() || meshData.Indices.empty())
+		return;
+
+	GroupMeshByMaterial(meshData);
+
+	std::vector<unsigned int> groups;
+	for (const Submesh& submesh : meshData.Submeshes)
+		groups.push_back(submesh.indexOffset);
+
+	size_t vertexCount = MeshOptimizer::Optimize(meshData.Vertices.data(), meshData.Vertices.size(), sizeof(Vertex),
+		meshData.Indices.data(), meshData.Indices.size(), stats, &groups);
+	meshData.Vertices.resize(vertexCount);
+
+	meshData.Meshlets.clear();
+	BuildSubmeshMeshlets(meshData.Vertices, meshData.Indices.data(), meshData.Submeshes.data(), meshData.Submeshes.size(),
+		meshData.Meshlets);
+}
+
+// Marks the vertices at positions used by more than one submesh
+static void LockSharedVertices(const MeshData& meshData, std::vector<unsigned char>& vertexLock)
 {
+	size_t vertexCount = meshData.Vertices.size();
+	vertexLock.assign(vertexCount, 0);
+	if (meshData.Submeshes.size() < 2)
+		return;
+
+	// vertices sharing a position use the first of them, as in MeshSimplifier
+	std::vector<UINT> sorted(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		sorted[v] = (UINT)v;
+	std::sort(sorted.begin(), sorted.end(), [&](UINT a, UINT b)
+	{
+		return memcmp(&meshData.Vertices[a].Position, &meshData.Vertices[b].Position, sizeof(XMFLOAT3)) < 0;
+	});
+
+	std::vector<UINT> positionRemap(vertexCount);
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		UINT v = sorted[i];
+		bool samePosition = i > 0 && memcmp(&meshData.Vertices[v].Position, &meshData.Vertices[sorted[i - 1]].Position, sizeof(XMFLOAT3)) == 0;
+		positionRemap[v] = samePosition ? positionRemap[sorted[i - 1]] : v;
+	}
+
+	const UINT NoSubmesh = 0xffffffff;
+	std::vector<UINT> positionSubmesh(vertexCount, NoSubmesh);
+	std::vector<unsigned char> positionShared(vertexCount, 0);
+	for (UINT s = 0; s < (UINT)meshData.Submeshes.size(); ++s)
+	{
+		const Submesh& submesh = meshData.Submeshes[s];
+		for (UINT i = submesh.indexOffset; i < submesh.indexOffset + submesh.indexCount; ++i)
+		{
+			UINT p = positionRemap[meshData.Indices[i]];
+			if (positionSubmesh[p] == NoSubmesh)
+				positionSubmesh[p] = s;
+			else if (positionSubmesh[p] != s)
+				positionShared[p] = 1;
+		}
+	}
+
+	for (size_t v = 0; v < vertexCount; ++v)
+		vertexLock[v] = positionShared[positionRemap[v]];
+}
+
+void BuildMeshLods(MeshData& meshData, UINT maxLevels, float levelRatio)
+{
+	meshData.Lods.clear();
+	if (meshData.Vertices.empty() || meshData.Indices.empty())
+		return;
+
+	if (meshData.Submeshes.empty())
+		GroupMeshByMaterial(meshData);
+
+	MeshLod base;
+	base.indexOffset = 0;
+	base.indexCount = (UINT)meshData.Indices.size();
+	base.meshletOffset = 0;
+	base.meshletCount = (UINT)meshData.Meshlets.size();
+	base.submeshOffset = 0;
+	base.submeshCount = (UINT)meshData.Submeshes.size();
+	base.targetRatio = 1.0f;
+	base.ratio = 1.0f;
+	base.error = 0.0f;
+	meshData.Lods.push_back(base);
+
+	// every level is simplified from level 0 so its error is measured against the source
+	std::vector<UINT> source(meshData.Indices.begin(), meshData.Indices.end());
+	std::vector<Submesh> sourceSubmeshes(meshData.Submeshes.begin(), meshData.Submeshes.end());
+	const float* positions = &meshData.Vertices[0].Position.x;
+	size_t vertexCount = meshData.Vertices.size();
+
+	std::vector<unsigned char> vertexLock;
+	LockSharedVertices(meshData, vertexLock);
+
+	std::vector<UINT> simplified(source.size());
+	std::vector<UINT> ordered(source.size());
+	std::vector<Submesh> submeshes;
+	float targetRatio = 1.0f;
+	for (UINT level = 1; level < maxLevels; ++level)
+	{
+		targetRatio *= levelRatio;
+
+		// submeshes are simplified separately, the vertices between them do not move
+		float error = 0.0f;
+		size_t indexCount = 0;
+		submeshes.clear();
+		for (Submesh submesh : sourceSubmeshes)
+		{
+			size_t targetIndexCount = (size_t)(submesh.indexCount / 3 * targetRatio) * 3;
+
+			float submeshError = 0.0f;
+			size_t submeshIndexCount = MeshSimplifier::Simplify(simplified.data(), source.data() + submesh.indexOffset, submesh.indexCount,
+				positions, vertexCount, sizeof(Vertex), targetIndexCount, FLT_MAX, &submeshError, vertexLock.data());
+			error = (std::max)(error, submeshError);
+			if (submeshIndexCount == 0)
+				continue;
+
+			// the vertex buffer is shared, only the triangle order is optimized
+			MeshOptimizer::OptimizeVertexCache(ordered.data() + indexCount, simplified.data(), submeshIndexCount, vertexCount);
+
+			submesh.indexOffset = (UINT)indexCount;
+			submesh.indexCount = (UINT)submeshIndexCount;
+			submeshes.push_back(submesh);
+			indexCount += submeshIndexCount;
+		}
+
+		if (indexCount == 0 || indexCount > meshData.Lods.back().indexCount * 9 / 10)
+			break;
+
+		MeshLod lod;
+		lod.indexOffset = (UINT)meshData.Indices.size();
+		lod.indexCount = (UINT)indexCount;
+		lod.meshletOffset = (UINT)meshData.Meshlets.size();
+		lod.submeshOffset = (UINT)meshData.Submeshes.size();
+		lod.submeshCount = (UINT)submeshes.size();
+		lod.targetRatio = targetRatio;
+		lod.ratio = (float)indexCount / (float)source.size();
+		lod.error = error;
+
+		meshData.Indices.insert(meshData.Indices.end(), ordered.begin(), ordered.begin() + indexCount);
+		for (Submesh& submesh : submeshes)
+			submesh.indexOffset += lod.indexOffset;
+		BuildSubmeshMeshlets(meshData.Vertices, meshData.Indices.data(), submeshes.data(), submeshes.size(), meshData.Meshlets);
+		meshData.Submeshes.insert(meshData.Submeshes.end(), submeshes.begin(), submeshes.end());
+
+		lod.meshletCount = (UINT)meshData.Meshlets.size() - lod.meshletOffset;
+		meshData.Lods.push_back(lod);
+	}
+}
+
+UINT SelectMeshLod(const std::vector<MeshLod>& lods, float objectScale, float distance, float fovY, float viewportHeight,
+	float pixelError, UINT currentLod, float hysteresis)
+{
+	if (lods.empty() || distance <= 0.0f)
+		return 0;
+
+	// pixels covered by one object space unit at distance
+	float pixelsPerUnit = objectScale * viewportHeight / (2.0f * distance * tanf(0.5f * fovY));
+
+	UINT lod = 0;
+	UINT hysteresisLod = 0;
+	for (UINT i = 1; i < (UINT)lods.size(); ++i)
+	{
+		float projectedError = lods[i].error * pixelsPerUnit;
+		if (projectedError <= pixelError)
+			lod = i;
+		if (projectedError <= pixelError * hysteresis)
+			hysteresisLod = i;
+	}
+
+	// finer levels are taken at once, coarser ones only past the hysteresis band
+	if (lod > currentLod)
+		lod = (std::max)(currentLod, hysteresisLod);
+
+	return lod;
+}
+
+Mesh::Mesh() : mVB(NULL), mIB(NULL), mIndexCount(0), mVertexCount(0), mVertexFormat(VERTEX_FORMAT_FULL), mVertexStride(sizeof(Vertex)),
+mIndexFormat(DXGI_FORMAT_R32_UINT), mTransform(InvalidTransformHandle), mBoundsMin(0.0f, 0.0f, 0.0f), mBoundsMax(0.0f, 0.0f, 0.0f)
+{
+	ZeroMemory(&mQuantization, sizeof(mQuantization));
 }
 
 Mesh::~Mesh()
@@ -10,45 +284,192 @@ Mesh::~Mesh()
 	Destroy();
 }
 
-void Mesh::Create(ID3D11Device* device, MeshData meshData)
+void Mesh::Create(ID3D11Device* device, const MeshData& meshData, VertexFormat format)
 {
 	mMaterials = meshData.materials;
-	mWorld = meshData.world;
-	mIndexCount = meshData.Indices.size();
-	mVertexCount = meshData.Vertices.size();
+	mMeshlets = meshData.Meshlets;
+	mSubmeshes = meshData.Submeshes;
+	mLods = meshData.Lods;
+
+	ComputeMeshBounds(meshData.Vertices.data(), meshData.Vertices.size(), mBoundsMin, mBoundsMax);
+
+	Create(device, meshData.Vertices.data(), (UINT)meshData.Vertices.size(), meshData.Indices.data(), (UINT)meshData.Indices.size(), format);
+	BuildOccluder(meshData.Vertices.data(), meshData.Indices.data());
+}
+
+void Mesh::Create(ID3D11Device* device, const Vertex* vertices, UINT vertexCount, const UINT* indices, UINT indexCount, VertexFormat format)
+{
+	mVertexFormat = format;
+
+	// Encode the packed vertices, the buffer is filled from this copy
+	std::vector<PackedVertex> packed;
+	const void* vertexData = vertices;
+	mVertexStride = sizeof(Vertex);
+	if (format == VERTEX_FORMAT_PACKED && vertexCount > 0)
+	{
+		packed.resize(vertexCount);
+		mQuantization = ComputeVertexQuantization(&vertices[0].Position.x, vertexCount);
+		EncodePackedVertices(&vertices[0].Position.x, vertexCount, mQuantization, packed.data());
+		vertexData = packed.data();
+		mVertexStride = sizeof(PackedVertex);
+	}
+
+	CreateBuffers(device, vertexData, vertexCount, indices, indexCount);
+}
+
+void Mesh::CreatePacked(ID3D11Device* device, const PackedVertex* vertices, const VertexQuantization& quantization, UINT vertexCount,
+	const UINT* indices, UINT indexCount)
+{
+	mVertexFormat = VERTEX_FORMAT_PACKED;
+	mVertexStride = sizeof(PackedVertex);
+	mQuantization = quantization;
+
+	CreateBuffers(device, vertices, vertexCount, indices, indexCount);
+}
+
+void Mesh::CreateBuffers(ID3D11Device* device, const void* vertexData, UINT vertexCount, const UINT* indices, UINT indexCount)
+{
+	mIndexCount = indexCount;
+	mVertexCount = vertexCount;
+
+	if (mSubmeshes.empty())
+	{
+		Submesh submesh;
+		ZeroMemory(&submesh, sizeof(submesh));
+		submesh.indexCount = indexCount;
+		submesh.meshletCount = (UINT)mMeshlets.size();
+		mSubmeshes.push_back(submesh);
+	}
+
+	// 16 bit indices when every vertex can be addressed
+	std::vector<USHORT> shortIndices;
+	const void* indexData = indices;
+	UINT indexSize = sizeof(UINT);
+	mIndexFormat = DXGI_FORMAT_R32_UINT;
+	if (vertexCount <= 0x10000)
+	{
+		shortIndices.assign(indices, indices + indexCount);
+		indexData = shortIndices.data();
+		indexSize = sizeof(USHORT);
+		mIndexFormat = DXGI_FORMAT_R16_UINT;
+	}
 
 	D3D11_BUFFER_DESC vbd;
 	vbd.Usage = D3D11_USAGE_IMMUTABLE;
-	vbd.ByteWidth = sizeof(Vertex)*meshData.Vertices.size();
+	vbd.ByteWidth = mVertexStride * vertexCount;
 	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 	vbd.CPUAccessFlags = 0;
 	vbd.MiscFlags = 0;
 	D3D11_SUBRESOURCE_DATA vinitData;
-	vinitData.pSysMem = &meshData.Vertices[0]; 
+	vinitData.pSysMem = vertexData;
 	HR(device->CreateBuffer(&vbd, &vinitData, &mVB));
 
 	D3D11_BUFFER_DESC ibd;
 	ibd.Usage = D3D11_USAGE_IMMUTABLE;
-	ibd.ByteWidth = sizeof(UINT) * meshData.Indices.size();
+	ibd.ByteWidth = indexSize * indexCount;
 	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
 	ibd.CPUAccessFlags = 0;
 	ibd.MiscFlags = 0;
 	D3D11_SUBRESOURCE_DATA iinitData;
-	iinitData.pSysMem = &meshData.Indices[0];
+	iinitData.pSysMem = indexData;
 	HR(device->CreateBuffer(&ibd, &iinitData, &mIB));
 }
 
-void Mesh::Render(ID3D11DeviceContext* pd3dDeviceContext)
+XMMATRIX Mesh::GetPositionDequantize() const
 {
-	UINT stride = sizeof(Vertex);
+	if (mVertexFormat != VERTEX_FORMAT_PACKED)
+		return XMMatrixIdentity();
+
+	// the shader reads the unorm position as [0, 1]
+	const float unormMax = 65535.0f;
+	return XMMatrixScaling(mQuantization.scale[0] * unormMax, mQuantization.scale[1] * unormMax, mQuantization.scale[2] * unormMax) *
+		XMMatrixTranslation(mQuantization.offset[0], mQuantization.offset[1], mQuantization.offset[2]);
+}
+
+MeshLod Mesh::GetLod(UINT lod) const
+{
+	if (!mLods.empty())
+		return mLods[(std::min)(lod, (UINT)mLods.size() - 1)];
+
+	MeshLod level;
+	ZeroMemory(&level, sizeof(level));
+	level.indexCount = mIndexCount;
+	level.meshletCount = (UINT)mMeshlets.size();
+	level.submeshCount = (UINT)mSubmeshes.size();
+	level.targetRatio = 1.0f;
+	level.ratio = 1.0f;
+	return level;
+}
+
+const Material& Mesh::GetMaterial(UINT materialId) const
+{
+	auto it = mMaterials.find(materialId);
+	if (it != mMaterials.end())
+		return it->second;
+
+	static const Material defaultMaterial;
+	return mMaterials.empty() ? defaultMaterial : mMaterials.begin()->second;
+}
+
+void Mesh::BuildOccluder(const Vertex* vertices, const UINT* indices, UINT maxTriangles)
+{
+	mOccluderVertices.clear();
+	mOccluderIndices.clear();
+
+	MeshLod level = GetLod((UINT)-1);
+	if (level.indexCount == 0 || level.indexCount / 3 > maxTriangles)
+		return;
+
+	// only the vertices the level uses
+	std::map<UINT, UINT> remap;
+	mOccluderIndices.reserve(level.indexCount);
+	for (UINT i = 0; i < level.indexCount; ++i)
+	{
+		UINT vertex = indices[level.indexOffset + i];
+		auto it = remap.find(vertex);
+		if (it == remap.end())
+		{
+			it = remap.insert(std::make_pair(vertex, (UINT)mOccluderVertices.size())).first;
+			mOccluderVertices.push_back(vertices[vertex].Position);
+		}
+		mOccluderIndices.push_back(it->second);
+	}
+}
+
+void Mesh::Render(ID3D11DeviceContext* pd3dDeviceContext, UINT lod)
+{
+	Bind(pd3dDeviceContext);
+
+	MeshLod level = GetLod(lod);
+	pd3dDeviceContext->DrawIndexed(level.indexCount, level.indexOffset, 0);
+}
+
+void Mesh::RenderRanges(ID3D11DeviceContext* pd3dDeviceContext, const std::vector<DrawRange>& ranges)
+{
+	if (ranges.empty())
+		return;
+
+	Bind(pd3dDeviceContext);
+	DrawRanges(pd3dDeviceContext, ranges.data(), ranges.size());
+}
+
+void Mesh::Bind(ID3D11DeviceContext* pd3dDeviceContext)
+{
+	UINT stride = mVertexStride;
 	UINT offset = 0;
 
 	pd3dDeviceContext->IASetVertexBuffers(0, 1, &mVB, &stride, &offset);
-	pd3dDeviceContext->IASetIndexBuffer(mIB, DXGI_FORMAT_R32_UINT, 0);
+	pd3dDeviceContext->IASetIndexBuffer(mIB, mIndexFormat, 0);
 
 	pd3dDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
 
-	pd3dDeviceContext->DrawIndexed(mIndexCount, 0, 0);
+void Mesh::DrawRanges(ID3D11DeviceContext* pd3dDeviceContext, const DrawRange* ranges, size_t rangeCount)
+{
+	for (size_t i = 0; i < rangeCount; ++i)
+	{
+		pd3dDeviceContext->DrawIndexed(ranges[i].indexCount, ranges[i].indexOffset, 0);
+	}
 }
 
 void Mesh::Destroy()
@@ -57,5 +478,10 @@ void Mesh::Destroy()
 	ReleaseCOM(mIB);
 	mIndexCount = 0;
 	mVertexCount = 0;
+	mMeshlets.clear();
+	mSubmeshes.clear();
+	mLods.clear();
 	mMaterials.clear();
+	mOccluderVertices.clear();
+	mOccluderIndices.clear();
 }
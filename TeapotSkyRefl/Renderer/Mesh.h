@@ -1,6 +1,13 @@
 #pragma once
 
 #include "Util.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "VertexPacking.h"
+#include "MeshletBuilder.h"
+#include "ClusterCuller.h"
+#include "TextureManager.h"
+#include "TransformSystem.h"
 
 
 struct Vertex
@@ -27,23 +34,85 @@ struct Material
 {
 	Material() {
 		ZeroMemory(this, sizeof(this));
+		diffuseTextureHandle = InvalidTextureHandle;
 	};
 
 	XMFLOAT4 Diffuse;
 	std::string diffuseTexture;
+	TextureHandle diffuseTextureHandle;	// of diffuseTexture, resolved when the mesh is created
 	float specExp;
 	float specIntensivity;
 
 };
 
+// Triangles of one material: a range of the index buffer and its meshlets
+struct Submesh
+{
+	UINT materialId;	// key of the mesh materials map
+	UINT indexOffset;
+	UINT indexCount;
+	UINT meshletOffset;
+	UINT meshletCount;
+};
+
+// One level of detail: a range of the shared index buffer, its meshlets and its submeshes
+struct MeshLod
+{
+	UINT indexOffset;
+	UINT indexCount;
+	UINT meshletOffset;
+	UINT meshletCount;
+	UINT submeshOffset;
+	UINT submeshCount;
+	float targetRatio;	// triangles asked for, relative to level 0
+	float ratio;		// triangles reached, relative to level 0
+	float error;		// object space distance to level 0
+};
+
 struct MeshData
 {
 	std::vector<Vertex> Vertices;
 	std::vector<UINT> Indices;
+	std::vector<UINT> MaterialIndices;	// material of every level 0 triangle, empty if all use material 0
+	std::vector<Submesh> Submeshes;		// one per material and level, filled by GroupMeshByMaterial
+	std::vector<Meshlet> Meshlets;		// contiguous ranges of Indices, filled by OptimizeMesh
+	std::vector<MeshLod> Lods;			// level 0 is the source mesh, filled by BuildMeshLods
 	std::map<UINT, Material> materials;
 	XMMATRIX world;
 };
 
+// Object space axis aligned bounding box of the vertex positions
+void ComputeMeshBounds(const Vertex* vertices, size_t vertexCount, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax);
+
+// Sorts the triangles by MaterialIndices into one submesh per material, in ascending
+// material order, keeping the triangle order within a material
+void GroupMeshByMaterial(MeshData& meshData);
+
+// Groups meshData by material, reorders every submesh for the vertex cache and overdraw
+// and the vertices for fetch, see MeshOptimizer, then splits the submeshes into meshlets,
+// see MeshletBuilder
+void OptimizeMesh(MeshData& meshData, MeshOptimizerStats* stats = NULL);
+
+// Appends simplified copies of the optimized meshData indices, see MeshSimplifier, every
+// level targets levelRatio of the triangles of the previous one. Levels share the vertices.
+// Submeshes are simplified one by one with the vertices they share with other submeshes
+// locked, so material boundaries do not crack. Stops early when a level can not be
+// reduced by a tenth any more.
+void BuildMeshLods(MeshData& meshData, UINT maxLevels = 5, float levelRatio = 0.5f);
+
+// Coarsest level whose error projects to at most pixelError pixels at distance.
+// A level coarser than currentLod is only taken once its error is below
+// hysteresis * pixelError, so objects near a threshold do not switch every frame.
+UINT SelectMeshLod(const std::vector<MeshLod>& lods, float objectScale, float distance, float fovY, float viewportHeight,
+	float pixelError, UINT currentLod, float hysteresis = 0.75f);
+
+// Vertex buffer layout of a Mesh
+enum VertexFormat
+{
+	VERTEX_FORMAT_FULL = 0,	// Vertex, 32 bytes
+	VERTEX_FORMAT_PACKED	// PackedVertex, 16 bytes, see VertexPacking
+};
+
 class Mesh
 {
 public:
@@ -51,10 +120,48 @@ public:
 	~Mesh();
 
 	// Reads data from Param meshData and creates vertex,Index buffers, Material info.
-	void Create(ID3D11Device* device, MeshData meshData);
+	// Indices are stored as 16 bit whenever the vertex count allows.
+	void Create(ID3D11Device* device, const MeshData& meshData, VertexFormat format = VERTEX_FORMAT_FULL);
+
+	// Creates vertex and index buffers straight from memory, e.g. a memory mapped mesh cache.
+	// Materials, bounds, submeshes, meshlets and levels of detail are left for the caller to set,
+	// until then the mesh is one submesh of material 0.
+	void Create(ID3D11Device* device, const Vertex* vertices, UINT vertexCount, const UINT* indices, UINT indexCount,
+		VertexFormat format = VERTEX_FORMAT_FULL);
+
+	// The same for vertices that are already packed with quantization, e.g. the packed blob of a
+	// mesh cache; the buffer is filled from them as is, nothing is encoded.
+	void CreatePacked(ID3D11Device* device, const PackedVertex* vertices, const VertexQuantization& quantization, UINT vertexCount,
+		const UINT* indices, UINT indexCount);
+
+	// Maps the POSITION attribute to object space: identity for full vertices,
+	// the quantization scale and offset for packed ones.
+	// Shaders get GetPositionDequantize() * world as the position transform.
+	XMMATRIX GetPositionDequantize() const;
+
 
+	// Level of detail clamped to the available ones, a mesh without levels has one covering everything
+	MeshLod GetLod(UINT lod) const;
 
-	void Render(ID3D11DeviceContext* pd3dDeviceContext);
+	// Material of a submesh without inserting into mMaterials, the first material if the id is unknown
+	const Material& GetMaterial(UINT materialId) const;
+
+	// Keeps the triangles of the coarsest level of detail as occluder geometry, see
+	// OcclusionCuller, when there are at most maxTriangles of them; needs the levels set.
+	// indices index the vertices of the whole mesh.
+	void BuildOccluder(const Vertex* vertices, const UINT* indices, UINT maxTriangles = 2048);
+
+	// draws one level of detail, the whole index buffer if the mesh has no levels
+	void Render(ID3D11DeviceContext* pd3dDeviceContext, UINT lod = 0);
+
+	// draws only the given index ranges, see ClusterCuller
+	void RenderRanges(ID3D11DeviceContext* pd3dDeviceContext, const std::vector<DrawRange>& ranges);
+
+	// sets the vertex and index buffers for DrawRanges
+	void Bind(ID3D11DeviceContext* pd3dDeviceContext);
+
+	// draws index ranges with the buffers set by Bind
+	void DrawRanges(ID3D11DeviceContext* pd3dDeviceContext, const DrawRange* ranges, size_t rangeCount);
 	
 	// sets vertex and index buffers and calls draw
 	void Destroy();
@@ -64,13 +171,40 @@ public:
 	UINT mVertexCount;
 	UINT mIndexCount;
 
+	VertexFormat mVertexFormat;
+	UINT mVertexStride;
+	DXGI_FORMAT mIndexFormat;
+
+	// object space meshlets, contiguous ranges of the index buffer, empty if the mesh was not optimized
+	std::vector<Meshlet> mMeshlets;
+
+	// levels of detail, each with its own index and meshlet range
+	std::vector<MeshLod> mLods;
+
+	// packed position quantization, set for VERTEX_FORMAT_PACKED
+	VertexQuantization mQuantization;
+
 	// material indices
 	std::vector<UINT> mMaterialIndices;
 
+	// triangles grouped by material, for every level of detail
+	std::vector<Submesh> mSubmeshes;
+
 	// material list.
 	std::map<UINT, Material> mMaterials;
 
-	// world matrix
-	XMMATRIX mWorld;
+	// world transform in the scene's TransformSystem
+	TransformHandle mTransform;
+
+	// object space bounding box
+	XMFLOAT3 mBoundsMin;
+	XMFLOAT3 mBoundsMax;
+
+	// object space occluder triangles, empty if the mesh is too detailed to occlude cheaply
+	std::vector<XMFLOAT3> mOccluderVertices;
+	std::vector<UINT> mOccluderIndices;
 
+private:
+	// vertex and index buffers from vertexCount vertices of mVertexStride bytes
+	void CreateBuffers(ID3D11Device* device, const void* vertexData, UINT vertexCount, const UINT* indices, UINT indexCount);
 };
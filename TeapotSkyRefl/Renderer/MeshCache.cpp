@@ -0,0 +1,415 @@
+#include "MeshCache.h"
+#include "ObjLoader.h"
+#include "TextureManager.h"
+
+// Blob alignment inside the cache file
+static const UINT64 BlobAlignment = 16;
+
+static UINT64 AlignOffset(UINT64 offset)
+{
+	return (offset + BlobAlignment - 1) & ~(BlobAlignment - 1);
+}
+
+// count records of stride bytes at offset lie inside a file of size bytes, without overflowing
+static bool BlobInside(UINT64 offset, UINT64 count, UINT64 stride, UINT64 size)
+{
+	return offset <= size && count * stride <= size - offset;
+}
+
+// [offset, offset + count) lies inside [0, total)
+static bool RangeInside(UINT64 offset, UINT64 count, UINT64 total)
+{
+	return offset <= total && count <= total - offset;
+}
+
+static void WritePadding(std::ofstream& file, UINT64 alignedOffset)
+{
+	static const char zeros[BlobAlignment] = {};
+	UINT64 position = (UINT64)file.tellp();
+	if (alignedOffset > position)
+		file.write(zeros, (std::streamsize)(alignedOffset - position));
+}
+
+UINT64 MeshCache::HashData(const char* data, size_t size)
+{
+	UINT64 hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+std::string MeshCache::CacheFileName(const std::string& objFile)
+{
+	size_t pos = objFile.find_last_of('.');
+	size_t slash = objFile.find_last_of("\\/");
+	if (pos == std::string::npos || (slash != std::string::npos && pos < slash))
+		return objFile + ".tmesh";
+
+	return objFile.substr(0, pos) + ".tmesh";
+}
+
+bool MeshCache::GetSourceInfo(const std::string& fileName, SourceInfo& info)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &attributes))
+		return false;
+
+	info.timestamp = ((UINT64)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	info.size = ((UINT64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	return true;
+}
+
+bool MeshCache::HashFile(const std::string& fileName, UINT64& hash)
+{
+	MappedFile file;
+	if (!file.Open(fileName))
+		return false;
+
+	hash = HashData(file.Data(), file.Size());
+	return true;
+}
+
+const MeshCacheHeader* MeshCache::GetHeader(const MappedFile& cacheFile)
+{
+	if (!cacheFile.IsOpen() || cacheFile.Size() < sizeof(MeshCacheHeader))
+		return NULL;
+
+	const MeshCacheHeader* header = (const MeshCacheHeader*)cacheFile.Data();
+	if (header->magic != Magic || header->version != Version || header->headerSize != sizeof(MeshCacheHeader))
+		return NULL;
+
+	// records written with another layout
+	if (header->vertexStride != sizeof(Vertex) || header->packedStride != sizeof(PackedVertex) || header->meshletStride != sizeof(Meshlet) ||
+		header->lodStride != sizeof(MeshLod) || header->submeshStride != sizeof(Submesh) || header->materialStride != sizeof(MeshCacheMaterial))
+	{
+		return NULL;
+	}
+
+	// blobs must lie inside the file
+	UINT64 size = cacheFile.Size();
+	if (!BlobInside(header->vertexOffset, header->vertexCount, sizeof(Vertex), size) ||
+		!BlobInside(header->indexOffset, header->indexCount, sizeof(UINT), size) ||
+		!BlobInside(header->packedOffset, header->vertexCount, sizeof(PackedVertex), size) ||
+		!BlobInside(header->materialOffset, 0, 0, size) ||
+		!BlobInside(header->meshletOffset, header->meshletCount, sizeof(Meshlet), size) ||
+		!BlobInside(header->lodOffset, header->lodCount, sizeof(MeshLod), size) ||
+		!BlobInside(header->submeshOffset, header->submeshCount, sizeof(Submesh), size))
+	{
+		return NULL;
+	}
+
+	// the meshlet, level of detail and submesh ranges must lie inside the index and meshlet blobs
+	const char* data = cacheFile.Data();
+	if (header->indexCount % 3 != 0)
+		return NULL;
+
+	const Meshlet* meshlets = (const Meshlet*)(data + header->meshletOffset);
+	for (UINT i = 0; i < header->meshletCount; ++i)
+	{
+		if (!RangeInside(meshlets[i].indexOffset, (UINT64)meshlets[i].triangleCount * 3, header->indexCount))
+			return NULL;
+	}
+
+	const MeshLod* lods = (const MeshLod*)(data + header->lodOffset);
+	for (UINT i = 0; i < header->lodCount; ++i)
+	{
+		if (!RangeInside(lods[i].indexOffset, lods[i].indexCount, header->indexCount) ||
+			!RangeInside(lods[i].meshletOffset, lods[i].meshletCount, header->meshletCount) ||
+			!RangeInside(lods[i].submeshOffset, lods[i].submeshCount, header->submeshCount))
+		{
+			return NULL;
+		}
+	}
+
+	const Submesh* submeshes = (const Submesh*)(data + header->submeshOffset);
+	for (UINT i = 0; i < header->submeshCount; ++i)
+	{
+		if (!RangeInside(submeshes[i].indexOffset, submeshes[i].indexCount, header->indexCount) ||
+			!RangeInside(submeshes[i].meshletOffset, submeshes[i].meshletCount, header->meshletCount))
+		{
+			return NULL;
+		}
+	}
+
+	return header;
+}
+
+bool MeshCache::IndicesInRange(const MappedFile& cacheFile)
+{
+	const MeshCacheHeader* header = GetHeader(cacheFile);
+	if (header == NULL)
+		return false;
+
+	const UINT* indices = (const UINT*)(cacheFile.Data() + header->indexOffset);
+	UINT maxIndex = 0;
+	for (UINT i = 0; i < header->indexCount; ++i)
+		maxIndex = (std::max)(maxIndex, indices[i]);
+
+	return header->indexCount == 0 || maxIndex < header->vertexCount;
+}
+
+bool MeshCache::WriteCache(const std::string& cacheFile, const MeshData& meshData, const SourceInfo& source, UINT64 sourceHash)
+{
+	std::ofstream file(cacheFile, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+
+	MeshCacheHeader header;
+	ZeroMemory(&header, sizeof(header));
+	header.magic = Magic;
+	header.version = Version;
+	header.headerSize = sizeof(MeshCacheHeader);
+	header.sourceHash = sourceHash;
+	header.sourceTimestamp = source.timestamp;
+	header.sourceSize = source.size;
+	header.vertexCount = (UINT)meshData.Vertices.size();
+	header.indexCount = (UINT)meshData.Indices.size();
+	header.vertexStride = sizeof(Vertex);
+	header.packedStride = sizeof(PackedVertex);
+	header.meshletStride = sizeof(Meshlet);
+	header.lodStride = sizeof(MeshLod);
+	header.submeshStride = sizeof(Submesh);
+	header.materialStride = sizeof(MeshCacheMaterial);
+	header.materialCount = (UINT)meshData.materials.size();
+	header.meshletCount = (UINT)meshData.Meshlets.size();
+	header.lodCount = (UINT)meshData.Lods.size();
+	header.submeshCount = (UINT)meshData.Submeshes.size();
+	ComputeMeshBounds(meshData.Vertices.data(), meshData.Vertices.size(), header.boundsMin, header.boundsMax);
+
+	// packed once here instead of on every load
+	std::vector<PackedVertex> packed(meshData.Vertices.size());
+	if (!packed.empty())
+	{
+		header.quantization = ComputeVertexQuantization(&meshData.Vertices[0].Position.x, packed.size());
+		EncodePackedVertices(&meshData.Vertices[0].Position.x, packed.size(), header.quantization, packed.data());
+	}
+
+	header.vertexOffset = AlignOffset(sizeof(MeshCacheHeader));
+	header.indexOffset = AlignOffset(header.vertexOffset + (UINT64)header.vertexCount * sizeof(Vertex));
+	header.packedOffset = AlignOffset(header.indexOffset + (UINT64)header.indexCount * sizeof(UINT));
+	header.meshletOffset = AlignOffset(header.packedOffset + (UINT64)header.vertexCount * sizeof(PackedVertex));
+	header.lodOffset = AlignOffset(header.meshletOffset + (UINT64)header.meshletCount * sizeof(Meshlet));
+	header.submeshOffset = AlignOffset(header.lodOffset + (UINT64)header.lodCount * sizeof(MeshLod));
+	header.materialOffset = AlignOffset(header.submeshOffset + (UINT64)header.submeshCount * sizeof(Submesh));
+
+	file.write((const char*)&header, sizeof(header));
+
+	WritePadding(file, header.vertexOffset);
+	if (header.vertexCount > 0)
+		file.write((const char*)meshData.Vertices.data(), (std::streamsize)header.vertexCount * sizeof(Vertex));
+
+	WritePadding(file, header.indexOffset);
+	if (header.indexCount > 0)
+		file.write((const char*)meshData.Indices.data(), (std::streamsize)header.indexCount * sizeof(UINT));
+
+	WritePadding(file, header.packedOffset);
+	if (header.vertexCount > 0)
+		file.write((const char*)packed.data(), (std::streamsize)header.vertexCount * sizeof(PackedVertex));
+
+	WritePadding(file, header.meshletOffset);
+	if (header.meshletCount > 0)
+		file.write((const char*)meshData.Meshlets.data(), (std::streamsize)header.meshletCount * sizeof(Meshlet));
+
+	WritePadding(file, header.lodOffset);
+	if (header.lodCount > 0)
+		file.write((const char*)meshData.Lods.data(), (std::streamsize)header.lodCount * sizeof(MeshLod));
+
+	WritePadding(file, header.submeshOffset);
+	if (header.submeshCount > 0)
+		file.write((const char*)meshData.Submeshes.data(), (std::streamsize)header.submeshCount * sizeof(Submesh));
+
+	WritePadding(file, header.materialOffset);
+	for (const auto& kv : meshData.materials)
+	{
+		MeshCacheMaterial material;
+		material.id = kv.first;
+		material.diffuse = kv.second.Diffuse;
+		material.specExp = kv.second.specExp;
+		material.specIntensivity = kv.second.specIntensivity;
+		material.textureNameLength = (UINT)kv.second.diffuseTexture.size();
+		file.write((const char*)&material, sizeof(material));
+		file.write(kv.second.diffuseTexture.data(), material.textureNameLength);
+	}
+
+	return file.good();
+}
+
+bool MeshCache::OpenCache(const std::string& objFile, MappedFile& cacheFile)
+{
+	SourceInfo source;
+	if (!GetSourceInfo(objFile, source))
+		return false;
+
+	std::string cacheFileName = CacheFileName(objFile);
+	if (!cacheFile.Open(cacheFileName))
+		return false;
+
+	// a cache whose indices point past its vertices is cooked again
+	const MeshCacheHeader* header = GetHeader(cacheFile);
+	if (header == NULL || header->sourceSize != source.size || !IndicesInRange(cacheFile))
+	{
+		cacheFile.Close();
+		return false;
+	}
+
+	if (header->sourceTimestamp == source.timestamp)
+		return true;
+
+	// The timestamp changed (touched or checked out again), the content hash decides
+	UINT64 sourceHash = 0;
+	if (!HashFile(objFile, sourceHash) || sourceHash != header->sourceHash)
+	{
+		cacheFile.Close();
+		return false;
+	}
+
+	// Still valid, store the new timestamp so the next start skips hashing
+	cacheFile.Close();
+	{
+		std::fstream file(cacheFileName, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(offsetof(MeshCacheHeader, sourceTimestamp));
+		file.write((const char*)&source.timestamp, sizeof(source.timestamp));
+	}
+
+	return cacheFile.Open(cacheFileName) && IndicesInRange(cacheFile);
+}
+
+void MeshCache::ReadMaterials(const MappedFile& cacheFile, std::map<UINT, Material>& materials)
+{
+	const MeshCacheHeader* header = GetHeader(cacheFile);
+	if (header == NULL)
+		return;
+
+	const char* p = cacheFile.Data() + header->materialOffset;
+	const char* end = cacheFile.Data() + cacheFile.Size();
+
+	for (UINT i = 0; i < header->materialCount; ++i)
+	{
+		if (p + sizeof(MeshCacheMaterial) > end)
+			break;
+
+		MeshCacheMaterial record;
+		memcpy(&record, p, sizeof(record));
+		p += sizeof(record);
+
+		if (p + record.textureNameLength > end)
+			break;
+
+		Material material;
+		material.Diffuse = record.diffuse;
+		material.specExp = record.specExp;
+		material.specIntensivity = record.specIntensivity;
+		material.diffuseTexture.assign(p, record.textureNameLength);
+		p += record.textureNameLength;
+
+		materials[record.id] = material;
+	}
+}
+
+bool MeshCache::Cook(const std::string& objFile, const std::string& mtlBaseDir, MeshData& meshData)
+{
+	SourceInfo source;
+	if (!GetSourceInfo(objFile, source))
+		return false;
+
+	UINT64 sourceHash = 0;
+	if (!HashFile(objFile, sourceHash))
+		return false;
+
+	if (!ObjLoader::Instance()->LoadToMesh(objFile, mtlBaseDir, meshData))
+		return false;
+
+	BuildMeshLods(meshData);
+
+	if (!WriteCache(CacheFileName(objFile), meshData, source, sourceHash))
+	{
+		OutputDebugStringA("MeshCache: could not write cache\n");
+	}
+
+	return true;
+}
+
+bool MeshCache::LoadMeshData(const std::string& objFile, const std::string& mtlBaseDir, MappedFile& cacheFile, MeshData& meshData)
+{
+	if (OpenCache(objFile, cacheFile))
+		return true;
+
+	return Cook(objFile, mtlBaseDir, meshData);
+}
+
+void MeshCache::CreateMesh(ID3D11Device* device, const MappedFile& cacheFile, const MeshData& meshData, Mesh& mesh, VertexFormat format)
+{
+	// OpenCache validated the cache, a header that fails now leaves the mesh to meshData
+	const MeshCacheHeader* header = cacheFile.IsOpen() ? GetHeader(cacheFile) : NULL;
+	if (cacheFile.IsOpen() && header == NULL)
+	{
+		OutputDebugStringA("MeshCache: invalid cache passed to CreateMesh\n");
+	}
+
+	if (header != NULL)
+	{
+		const Vertex* vertices = (const Vertex*)(cacheFile.Data() + header->vertexOffset);
+		const UINT* indices = (const UINT*)(cacheFile.Data() + header->indexOffset);
+
+		// the packed vertices were encoded when the cache was cooked
+		if (format == VERTEX_FORMAT_PACKED)
+		{
+			const PackedVertex* packed = (const PackedVertex*)(cacheFile.Data() + header->packedOffset);
+			mesh.CreatePacked(device, packed, header->quantization, header->vertexCount, indices, header->indexCount);
+		}
+		else
+		{
+			mesh.Create(device, vertices, header->vertexCount, indices, header->indexCount, format);
+		}
+		mesh.mBoundsMin = header->boundsMin;
+		mesh.mBoundsMax = header->boundsMax;
+
+		const Meshlet* meshlets = (const Meshlet*)(cacheFile.Data() + header->meshletOffset);
+		mesh.mMeshlets.assign(meshlets, meshlets + header->meshletCount);
+
+		const MeshLod* lods = (const MeshLod*)(cacheFile.Data() + header->lodOffset);
+		mesh.mLods.assign(lods, lods + header->lodCount);
+		mesh.BuildOccluder(vertices, indices);
+
+		const Submesh* submeshes = (const Submesh*)(cacheFile.Data() + header->submeshOffset);
+		mesh.mSubmeshes.assign(submeshes, submeshes + header->submeshCount);
+
+		ReadMaterials(cacheFile, mesh.mMaterials);
+		ResolveTextures(mesh.mMaterials);
+		return;
+	}
+
+	mesh.Create(device, meshData, format);
+	ResolveTextures(mesh.mMaterials);
+}
+
+void MeshCache::ResolveTextures(std::map<UINT, Material>& materials)
+{
+	for (auto& kv : materials)
+	{
+		Material& material = kv.second;
+		material.diffuseTextureHandle = material.diffuseTexture.empty() ? InvalidTextureHandle :
+			TextureManager::Instance()->GetHandle(material.diffuseTexture);
+	}
+}
+
+bool MeshCache::LoadMesh(ID3D11Device* device, const std::string& objFile, const std::string& mtlBaseDir, Mesh& mesh, VertexFormat format)
+{
+	MappedFile cacheFile;
+	MeshData meshData;
+	if (!LoadMeshData(objFile, mtlBaseDir, cacheFile, meshData))
+		return false;
+
+	CreateMesh(device, cacheFile, meshData, mesh, format);
+
+	for (const auto& kv : mesh.mMaterials)
+	{
+		if (!kv.second.diffuseTexture.empty())
+			TextureManager::Instance()->CreateTexture(kv.second.diffuseTexture);
+	}
+
+	return true;
+}
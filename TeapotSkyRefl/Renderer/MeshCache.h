@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Util.h"
+#include "Mesh.h"
+#include "MappedFile.h"
+
+// MeshCache
+// Cooked binary mesh files (.tmesh) written next to the source .obj.
+// A cache holds the welded vertex and index blobs, the same vertices packed for
+// VERTEX_FORMAT_PACKED with their quantization, the material table,
+// the submeshes, the meshlets, the levels of detail, the object space bounds and the size, timestamp and hash of the source file.
+// The header stores the size of every record type, a cache whose sizes do not match the
+// structs of this build is stale and cooked again, as is one whose meshlet, level of detail,
+// submesh or index ranges do not fit its blobs.
+// On a hit the file is memory mapped and the blobs are handed to Mesh::Create
+// as is, without any per vertex conversion.
+// LoadMeshData and CreateMesh are the two halves of LoadMesh, the first one
+// does not touch the device and can run on a worker thread, see AssetLoader.
+// usage:
+// Mesh* mesh = new Mesh();
+// MeshCache::LoadMesh(device, "..\\Assets\\teapot.obj", "..\\Assets\\", *mesh);
+
+#pragma pack(push,1)
+struct MeshCacheHeader
+{
+	UINT magic;
+	UINT version;
+	UINT headerSize;		// sizeof(MeshCacheHeader)
+	UINT64 sourceHash;		// FNV-1a of the source file
+	UINT64 sourceTimestamp;	// last write time of the source file
+	UINT64 sourceSize;
+	UINT vertexCount;
+	UINT indexCount;
+	UINT vertexStride;
+	UINT materialCount;
+	XMFLOAT3 boundsMin;
+	XMFLOAT3 boundsMax;
+	UINT64 vertexOffset;
+	UINT64 indexOffset;
+	UINT64 materialOffset;
+	UINT meshletCount;
+	UINT64 meshletOffset;
+	UINT lodCount;
+	UINT64 lodOffset;
+	UINT submeshCount;
+	UINT64 submeshOffset;
+
+	// the vertices in the VERTEX_FORMAT_PACKED layout, so a hit uploads them without encoding
+	UINT64 packedOffset;
+	VertexQuantization quantization;
+
+	// sizeof of the blob records, a cache written with another layout of any of them is stale
+	UINT packedStride;
+	UINT meshletStride;
+	UINT lodStride;
+	UINT submeshStride;
+	UINT materialStride;
+};
+
+struct MeshCacheMaterial
+{
+	UINT id;
+	XMFLOAT4 diffuse;
+	float specExp;
+	float specIntensivity;
+	UINT textureNameLength;	// followed by the texture name characters
+};
+#pragma pack(pop)
+
+class MeshCache
+{
+public:
+	static const UINT Magic = 0x48534d54; // "TMSH"
+	static const UINT Version = 7;	// 2: optimized vertex and index order, 3: meshlets, 4: levels of detail, 5: submeshes, 6: record sizes, 7: packed vertices
+
+	// Loads objFile into mesh through its cache, the cache is cooked first if it is missing or stale
+	static bool LoadMesh(ID3D11Device* device, const std::string& objFile, const std::string& mtlBaseDir, Mesh& mesh,
+		VertexFormat format = VERTEX_FORMAT_FULL);
+
+	// File side of LoadMesh: maps the cache of objFile into cacheFile, or cooks objFile into meshData
+	// when the cache is missing or stale. Safe to call from any thread.
+	static bool LoadMeshData(const std::string& objFile, const std::string& mtlBaseDir, MappedFile& cacheFile, MeshData& meshData);
+
+	// Device side of LoadMesh: creates mesh from the mapped cacheFile, or from meshData if nothing is mapped.
+	// The material textures are left for the caller to create.
+	static void CreateMesh(ID3D11Device* device, const MappedFile& cacheFile, const MeshData& meshData, Mesh& mesh,
+		VertexFormat format = VERTEX_FORMAT_FULL);
+
+	// Imports objFile with ObjLoader, builds its levels of detail and writes its cache
+	static bool Cook(const std::string& objFile, const std::string& mtlBaseDir, MeshData& meshData);
+
+	// Maps the cache of objFile, returns false if it is missing, invalid or stale
+	static bool OpenCache(const std::string& objFile, MappedFile& cacheFile);
+
+	// Reads the material table of a mapped cache
+	static void ReadMaterials(const MappedFile& cacheFile, std::map<UINT, Material>& materials);
+
+	static std::string CacheFileName(const std::string& objFile);
+
+	// FNV-1a 64 bit hash
+	static UINT64 HashData(const char* data, size_t size);
+
+	// Sets the texture handles of the materials from their filenames, see TextureManager::GetHandle
+	static void ResolveTextures(std::map<UINT, Material>& materials);
+
+private:
+
+	struct SourceInfo
+	{
+		UINT64 timestamp;
+		UINT64 size;
+	};
+
+	static bool GetSourceInfo(const std::string& fileName, SourceInfo& info);
+	static bool HashFile(const std::string& fileName, UINT64& hash);
+	static bool WriteCache(const std::string& cacheFile, const MeshData& meshData, const SourceInfo& source, UINT64 sourceHash);
+
+	// Header of a mapped cache, NULL unless every blob, meshlet, level of detail and submesh range lies inside the file
+	static const MeshCacheHeader* GetHeader(const MappedFile& cacheFile);
+
+	// Every index is below vertexCount, checked once when the cache is opened
+	static bool IndicesInRange(const MappedFile& cacheFile);
+};
@@ -0,0 +1,543 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+const float MeshOptimizer::OverdrawThreshold = 1.05f;
+
+static const unsigned int InvalidIndex = 0xffffffff;
+
+// Triangles using each vertex, stored as one array with per vertex offsets
+struct TriangleAdjacency
+{
+	std::vector<unsigned int> counts;
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> triangles;
+
+	void Build(const unsigned int* indices, size_t indexCount, size_t vertexCount)
+	{
+		counts.assign(vertexCount, 0);
+		offsets.resize(vertexCount);
+		triangles.resize(indexCount);
+
+		for (size_t i = 0; i < indexCount; ++i)
+		{
+			counts[indices[i]]++;
+		}
+
+		unsigned int offset = 0;
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			offsets[v] = offset;
+			offset += counts[v];
+		}
+
+		// counts is rebuilt while filling
+		std::fill(counts.begin(), counts.end(), 0);
+		for (size_t i = 0; i < indexCount; ++i)
+		{
+			unsigned int v = indices[i];
+			triangles[offsets[v] + counts[v]++] = (unsigned int)(i / 3);
+		}
+	}
+};
+
+// FIFO post-transform cache, a vertex is cached while fewer than cacheSize misses followed its own
+class VertexCacheSimulator
+{
+public:
+	VertexCacheSimulator(size_t vertexCount, unsigned int cacheSize)
+		: mTimestamps(vertexCount, 0), mTime(cacheSize + 1), mCacheSize(cacheSize)
+	{
+	}
+
+	// returns the number of misses for the triangle
+	unsigned int Triangle(unsigned int a, unsigned int b, unsigned int c)
+	{
+		return Vertex(a) + Vertex(b) + Vertex(c);
+	}
+
+	void Flush() { mTime += mCacheSize + 1; }
+
+private:
+	unsigned int Vertex(unsigned int v)
+	{
+		if (mTime - mTimestamps[v] <= mCacheSize)
+			return 0;
+
+		mTimestamps[v] = mTime++;
+		return 1;
+	}
+
+	std::vector<unsigned int> mTimestamps;
+	unsigned int mTime;
+	unsigned int mCacheSize;
+};
+
+void MeshOptimizer::OptimizeVertexCache(unsigned int* destination, const unsigned int* indices, size_t indexCount, size_t vertexCount,
+	unsigned int cacheSize, std::vector<unsigned int>* clusters)
+{
+	if (clusters)
+		clusters->clear();
+
+	if (indexCount == 0 || vertexCount == 0)
+		return;
+
+	TriangleAdjacency adjacency;
+	adjacency.Build(indices, indexCount, vertexCount);
+
+	// triangles not yet emitted per vertex
+	std::vector<unsigned int> liveTriangles(adjacency.counts);
+
+	std::vector<unsigned int> cacheTimestamps(vertexCount, 0);
+	std::vector<char> emitted(indexCount / 3, 0);
+
+	std::vector<unsigned int> deadEnd;
+	deadEnd.reserve(indexCount);
+
+	std::vector<unsigned int> candidates;
+	candidates.reserve(64);
+
+	unsigned int time = cacheSize + 1;
+	size_t cursor = 0;
+	size_t outputIndex = 0;
+
+	// start at the first referenced vertex
+	unsigned int fanning = indices[0];
+	if (clusters)
+		clusters->push_back(0);
+
+	while (fanning != InvalidIndex)
+	{
+		candidates.clear();
+
+		// emit every remaining triangle around the fanning vertex
+		const unsigned int* triangles = &adjacency.triangles[adjacency.offsets[fanning]];
+		for (unsigned int t = 0; t < adjacency.counts[fanning]; ++t)
+		{
+			unsigned int triangle = triangles[t];
+			if (emitted[triangle])
+				continue;
+
+			emitted[triangle] = 1;
+
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int v = indices[triangle * 3 + k];
+				destination[outputIndex++] = v;
+
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+
+				if (time - cacheTimestamps[v] > cacheSize)
+				{
+					cacheTimestamps[v] = time++;
+				}
+			}
+		}
+
+		// next fanning vertex: the candidate that stays longest in the cache
+		// and whose remaining triangles fit before it is evicted
+		unsigned int best = InvalidIndex;
+		int bestPriority = -1;
+		for (unsigned int v : candidates)
+		{
+			if (liveTriangles[v] == 0)
+				continue;
+
+			int priority = 0;
+			if (time - cacheTimestamps[v] + 2 * liveTriangles[v] <= cacheSize)
+				priority = (int)(time - cacheTimestamps[v]);
+
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				best = v;
+			}
+		}
+
+		if (best == InvalidIndex)
+		{
+			// dead end, back up to a recently used vertex that still has triangles
+			while (!deadEnd.empty())
+			{
+				unsigned int v = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveTriangles[v] > 0)
+				{
+					best = v;
+					break;
+				}
+			}
+		}
+
+		if (best == InvalidIndex)
+		{
+			// nothing in reach, continue in input order. The cache is cold here
+			// so this starts a new cluster for the overdraw pass
+			while (cursor < vertexCount && liveTriangles[cursor] == 0)
+				cursor++;
+
+			if (cursor < vertexCount)
+			{
+				best = (unsigned int)cursor;
+				if (clusters)
+					clusters->push_back((unsigned int)outputIndex);
+			}
+		}
+
+		fanning = best;
+	}
+}
+
+// Soft cluster boundaries inside the Tipsify clusters, split where the
+// running ACMR comes within threshold of the whole cluster's ACMR
+static void SplitClusters(const unsigned int* indices, size_t indexCount, size_t vertexCount, const std::vector<unsigned int>& clusters,
+	unsigned int cacheSize, float threshold, std::vector<unsigned int>& result)
+{
+	VertexCacheSimulator cache(vertexCount, cacheSize);
+
+	result.clear();
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		size_t start = clusters[c];
+		size_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : indexCount;
+		if (start >= end)
+			continue;
+
+		cache.Flush();
+		unsigned int clusterMisses = 0;
+		for (size_t i = start; i < end; i += 3)
+		{
+			clusterMisses += cache.Triangle(indices[i + 0], indices[i + 1], indices[i + 2]);
+		}
+		float clusterThreshold = threshold * (float)clusterMisses / (float)((end - start) / 3);
+
+		result.push_back((unsigned int)start);
+
+		cache.Flush();
+		unsigned int misses = 0;
+		unsigned int triangles = 0;
+		for (size_t i = start; i < end; i += 3)
+		{
+			misses += cache.Triangle(indices[i + 0], indices[i + 1], indices[i + 2]);
+			triangles++;
+
+			if ((float)misses / (float)triangles <= clusterThreshold && i + 3 < end)
+			{
+				result.push_back((unsigned int)(i + 3));
+				cache.Flush();
+				misses = 0;
+				triangles = 0;
+			}
+		}
+	}
+}
+
+static inline const float* PositionAt(const float* positions, size_t stride, unsigned int v)
+{
+	return (const float*)((const char*)positions + stride * v);
+}
+
+void MeshOptimizer::OptimizeOverdraw(unsigned int* destination, const unsigned int* indices, size_t indexCount,
+	const float* positions, size_t vertexCount, size_t positionStride, const std::vector<unsigned int>& clusters,
+	unsigned int cacheSize, float threshold)
+{
+	if (indexCount == 0)
+		return;
+
+	std::vector<unsigned int> softClusters;
+	SplitClusters(indices, indexCount, vertexCount, clusters.empty() ? std::vector<unsigned int>(1, 0) : clusters,
+		cacheSize, threshold, softClusters);
+
+	// area weighted centroid and normal of every cluster
+	size_t clusterCount = softClusters.size();
+	std::vector<float> clusterData(clusterCount * 6, 0.0f);
+	double meshCentroid[3] = { 0.0, 0.0, 0.0 };
+	double meshArea = 0.0;
+
+	for (size_t c = 0; c < clusterCount; ++c)
+	{
+		size_t start = softClusters[c];
+		size_t end = (c + 1 < clusterCount) ? softClusters[c + 1] : indexCount;
+
+		float centroid[3] = { 0.0f, 0.0f, 0.0f };
+		float normal[3] = { 0.0f, 0.0f, 0.0f };
+		float clusterArea = 0.0f;
+
+		for (size_t i = start; i < end; i += 3)
+		{
+			const float* p0 = PositionAt(positions, positionStride, indices[i + 0]);
+			const float* p1 = PositionAt(positions, positionStride, indices[i + 1]);
+			const float* p2 = PositionAt(positions, positionStride, indices[i + 2]);
+
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int k = 0; k < 3; ++k)
+			{
+				centroid[k] += (p0[k] + p1[k] + p2[k]) * (area / 3.0f);
+				normal[k] += n[k];
+			}
+			clusterArea += area;
+		}
+
+		for (int k = 0; k < 3; ++k)
+		{
+			meshCentroid[k] += centroid[k];
+		}
+		meshArea += clusterArea;
+
+		float invArea = clusterArea > 0.0f ? 1.0f / clusterArea : 0.0f;
+		float normalLength = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float invNormal = normalLength > 0.0f ? 1.0f / normalLength : 0.0f;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			clusterData[c * 6 + k] = centroid[k] * invArea;
+			clusterData[c * 6 + 3 + k] = normal[k] * invNormal;
+		}
+	}
+
+	float center[3] = { 0.0f, 0.0f, 0.0f };
+	if (meshArea > 0.0)
+	{
+		for (int k = 0; k < 3; ++k)
+			center[k] = (float)(meshCentroid[k] / meshArea);
+	}
+
+	// clusters facing away from the center and far out are likely to occlude
+	// the rest, draw them first
+	std::vector<float> sortKeys(clusterCount);
+	for (size_t c = 0; c < clusterCount; ++c)
+	{
+		const float* data = &clusterData[c * 6];
+		sortKeys[c] = (data[0] - center[0]) * data[3] + (data[1] - center[1]) * data[4] + (data[2] - center[2]) * data[5];
+	}
+
+	std::vector<unsigned int> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; ++c)
+		order[c] = (unsigned int)c;
+
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return sortKeys[a] > sortKeys[b]; });
+
+	size_t outputIndex = 0;
+	for (unsigned int c : order)
+	{
+		size_t start = softClusters[c];
+		size_t end = (c + 1 < clusterCount) ? softClusters[c + 1] : indexCount;
+		memcpy(destination + outputIndex, indices + start, (end - start) * sizeof(unsigned int));
+		outputIndex += end - start;
+	}
+}
+
+size_t MeshOptimizer::OptimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexStride, unsigned int* indices, size_t indexCount)
+{
+	std::vector<unsigned int> remap(vertexCount, InvalidIndex);
+	unsigned int nextVertex = 0;
+
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		unsigned int& newIndex = remap[indices[i]];
+		if (newIndex == InvalidIndex)
+			newIndex = nextVertex++;
+
+		indices[i] = newIndex;
+	}
+
+	std::vector<char> reordered((size_t)nextVertex * vertexStride);
+	const char* source = (const char*)vertices;
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		if (remap[v] != InvalidIndex)
+			memcpy(&reordered[(size_t)remap[v] * vertexStride], source + v * vertexStride, vertexStride);
+	}
+
+	if (!reordered.empty())
+		memcpy(vertices, reordered.data(), reordered.size());
+
+	return nextVertex;
+}
+
+VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize)
+{
+	VertexCacheStats stats;
+	if (indexCount < 3 || vertexCount == 0)
+		return stats;
+
+	VertexCacheSimulator cache(vertexCount, cacheSize);
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		stats.verticesTransformed += cache.Triangle(indices[i + 0], indices[i + 1], indices[i + 2]);
+	}
+
+	stats.acmr = (float)stats.verticesTransformed / (float)(indexCount / 3);
+	stats.atvr = (float)stats.verticesTransformed / (float)vertexCount;
+	return stats;
+}
+
+// Depth tested rasterization of one triangle in view space, x and y in pixels.
+// Returns the number of pixels that passed the depth test.
+static size_t RasterizeTriangle(std::vector<float>& depthBuffer, int size, const float* v0, const float* v1, const float* v2)
+{
+	float area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v1[1] - v0[1]) * (v2[0] - v0[0]);
+	if (area <= 0.0f)
+		return 0;	// back facing or degenerate
+
+	int minX = std::max(0, (int)floorf(std::min(v0[0], std::min(v1[0], v2[0]))));
+	int maxX = std::min(size - 1, (int)ceilf(std::max(v0[0], std::max(v1[0], v2[0]))));
+	int minY = std::max(0, (int)floorf(std::min(v0[1], std::min(v1[1], v2[1]))));
+	int maxY = std::min(size - 1, (int)ceilf(std::max(v0[1], std::max(v1[1], v2[1]))));
+
+	float invArea = 1.0f / area;
+	size_t shaded = 0;
+
+	for (int y = minY; y <= maxY; ++y)
+	{
+		float py = y + 0.5f;
+		for (int x = minX; x <= maxX; ++x)
+		{
+			float px = x + 0.5f;
+
+			float w0 = (v2[0] - v1[0]) * (py - v1[1]) - (v2[1] - v1[1]) * (px - v1[0]);
+			float w1 = (v0[0] - v2[0]) * (py - v2[1]) - (v0[1] - v2[1]) * (px - v2[0]);
+			float w2 = (v1[0] - v0[0]) * (py - v0[1]) - (v1[1] - v0[1]) * (px - v0[0]);
+			if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+				continue;
+
+			float depth = (w0 * v0[2] + w1 * v1[2] + w2 * v2[2]) * invArea;
+			float& stored = depthBuffer[(size_t)y * size + x];
+			if (depth < stored)
+			{
+				stored = depth;
+				shaded++;
+			}
+		}
+	}
+
+	return shaded;
+}
+
+OverdrawStats MeshOptimizer::AnalyzeOverdraw(const unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride)
+{
+	OverdrawStats stats;
+	if (indexCount < 3 || vertexCount == 0)
+		return stats;
+
+	float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		const float* p = PositionAt(positions, positionStride, (unsigned int)v);
+		for (int k = 0; k < 3; ++k)
+		{
+			boundsMin[k] = std::min(boundsMin[k], p[k]);
+			boundsMax[k] = std::max(boundsMax[k], p[k]);
+		}
+	}
+
+	float extent = std::max(boundsMax[0] - boundsMin[0], std::max(boundsMax[1] - boundsMin[1], boundsMax[2] - boundsMin[2]));
+	float scale = extent > 0.0f ? (OverdrawViewSize - 1) / extent : 0.0f;
+
+	const int size = OverdrawViewSize;
+	std::vector<float> depthBuffer((size_t)size * size);
+
+	// orthographic views looking along +-X, +-Y and +-Z with clockwise front faces
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		int axisX = (axis + 1) % 3;
+		int axisY = (axis + 2) % 3;
+
+		for (int side = 0; side < 2; ++side)
+		{
+			float direction = side == 0 ? 1.0f : -1.0f;
+			std::fill(depthBuffer.begin(), depthBuffer.end(), FLT_MAX);
+
+			for (size_t i = 0; i + 2 < indexCount; i += 3)
+			{
+				float projected[3][3];
+				for (int k = 0; k < 3; ++k)
+				{
+					const float* p = PositionAt(positions, positionStride, indices[i + k]);
+					projected[k][0] = (p[axisX] - boundsMin[axisX]) * scale;
+					projected[k][1] = (p[axisY] - boundsMin[axisY]) * scale;
+					projected[k][2] = (p[axis] - boundsMin[axis]) * direction;
+				}
+
+				// mirroring the view flips the winding, swap to keep clockwise front faces
+				if (side == 0)
+					stats.pixelsShaded += RasterizeTriangle(depthBuffer, size, projected[0], projected[2], projected[1]);
+				else
+					stats.pixelsShaded += RasterizeTriangle(depthBuffer, size, projected[0], projected[1], projected[2]);
+			}
+
+			for (float depth : depthBuffer)
+			{
+				if (depth != FLT_MAX)
+					stats.pixelsCovered++;
+			}
+		}
+	}
+
+	stats.overdraw = stats.pixelsCovered > 0 ? (float)stats.pixelsShaded / (float)stats.pixelsCovered : 0.0f;
+	return stats;
+}
+
+size_t MeshOptimizer::Optimize(void* vertices, size_t vertexCount, size_t vertexStride, unsigned int* indices, size_t indexCount, MeshOptimizerStats* stats,
+	const std::vector<unsigned int>* groups)
+{
+	const float* positions = (const float*)vertices;
+
+	if (stats)
+	{
+		stats->verticesBefore = vertexCount;
+		stats->cacheBefore = AnalyzeVertexCache(indices, indexCount, vertexCount);
+		stats->overdrawBefore = AnalyzeOverdraw(indices, indexCount, positions, vertexCount, vertexStride);
+	}
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	std::vector<unsigned int> cacheOrder(indexCount);
+	std::vector<unsigned int> clusters;
+	size_t groupCount = groups && !groups->empty() ? groups->size() : 1;
+	for (size_t g = 0; g < groupCount; ++g)
+	{
+		size_t groupStart = groups && !groups->empty() ? (*groups)[g] : 0;
+		size_t groupEnd = g + 1 < groupCount ? (*groups)[g + 1] : indexCount;
+		size_t groupIndexCount = groupEnd - groupStart;
+		if (groupIndexCount == 0)
+			continue;
+
+		unsigned int* groupIndices = indices + groupStart;
+		unsigned int* groupOrder = cacheOrder.data() + groupStart;
+		OptimizeVertexCache(groupOrder, groupIndices, groupIndexCount, vertexCount, CacheSize, &clusters);
+
+		// Meshes exported in patch or strip order can already beat Tipsify,
+		// keep the source order as one cluster then
+		if (AnalyzeVertexCache(groupIndices, groupIndexCount, vertexCount).acmr < AnalyzeVertexCache(groupOrder, groupIndexCount, vertexCount).acmr)
+		{
+			memcpy(groupOrder, groupIndices, groupIndexCount * sizeof(unsigned int));
+			clusters.assign(1, 0);
+		}
+
+		OptimizeOverdraw(groupIndices, groupOrder, groupIndexCount, positions, vertexCount, vertexStride, clusters);
+	}
+
+	size_t newVertexCount = OptimizeVertexFetch(vertices, vertexCount, vertexStride, indices, indexCount);
+
+	if (stats)
+	{
+		stats->timeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		stats->verticesAfter = newVertexCount;
+		stats->cacheAfter = AnalyzeVertexCache(indices, indexCount, newVertexCount);
+		stats->overdrawAfter = AnalyzeOverdraw(indices, indexCount, positions, newVertexCount, vertexStride);
+	}
+
+	return newVertexCount;
+}
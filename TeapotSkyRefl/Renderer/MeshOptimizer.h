@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// MeshOptimizer
+// Reorders an indexed triangle list for the GPU before it is uploaded:
+// 1. triangles are ordered for the post-transform vertex cache with Tipsify
+//    (Sander, Nehab, Barczak 2007),
+// 2. the Tipsify clusters are split where the cache allows it and sorted
+//    front to back from the outside in to reduce overdraw,
+// 3. vertices are renumbered in order of first use for fetch locality.
+// The analyzer reports ACMR (vertices transformed per triangle), ATVR
+// (vertices transformed per vertex) and the overdraw of a software rasterizer
+// looking at the mesh from the six axis directions.
+// Only the standard library is used so the stage runs without a device or
+// Windows headers. Vertex positions are read as three floats at the start of
+// every vertex, as in Vertex.
+// usage:
+// MeshOptimizerStats stats;
+// size_t vertexCount = MeshOptimizer::Optimize(vertices, vertexCount, sizeof(Vertex), indices, indexCount, &stats);
+
+struct VertexCacheStats
+{
+	VertexCacheStats() : verticesTransformed(0), acmr(0.0f), atvr(0.0f) {}
+
+	size_t verticesTransformed;
+	float acmr;	// vertices transformed / triangles, 0.5 is the best a regular grid can reach
+	float atvr;	// vertices transformed / vertices, 1.0 is optimal
+};
+
+struct OverdrawStats
+{
+	OverdrawStats() : pixelsCovered(0), pixelsShaded(0), overdraw(0.0f) {}
+
+	size_t pixelsCovered;
+	size_t pixelsShaded;
+	float overdraw;	// pixels shaded / pixels covered, 1.0 is optimal
+};
+
+struct MeshOptimizerStats
+{
+	MeshOptimizerStats() : verticesBefore(0), verticesAfter(0), timeMs(0.0) {}
+
+	VertexCacheStats cacheBefore;
+	VertexCacheStats cacheAfter;
+	OverdrawStats overdrawBefore;
+	OverdrawStats overdrawAfter;
+	size_t verticesBefore;
+	size_t verticesAfter;	// unreferenced vertices are dropped
+	double timeMs;			// optimization only, the analysis is not timed
+};
+
+class MeshOptimizer
+{
+public:
+
+	// FIFO cache size the reordering targets and the analyzer simulates
+	static const unsigned int CacheSize = 16;
+
+	// Resolution of the overdraw analyzer views
+	static const unsigned int OverdrawViewSize = 256;
+
+	// Overdraw clusters may raise the ACMR of their Tipsify cluster by this factor
+	static const float OverdrawThreshold;
+
+	// Runs all three steps in place, returns the new vertex count.
+	// stats are only analyzed when requested, the analysis costs more than the optimization.
+	// groups holds the first index of every group of triangles that has to stay together,
+	// such as the submeshes of a material; the triangle order steps then run per group.
+	static size_t Optimize(void* vertices, size_t vertexCount, size_t vertexStride, unsigned int* indices, size_t indexCount, MeshOptimizerStats* stats = NULL,
+		const std::vector<unsigned int>* groups = NULL);
+
+	// Tipsify triangle order, clusters receives the first index of every cluster
+	// that starts after a cache flush. destination must not alias indices.
+	static void OptimizeVertexCache(unsigned int* destination, const unsigned int* indices, size_t indexCount, size_t vertexCount,
+		unsigned int cacheSize = CacheSize, std::vector<unsigned int>* clusters = NULL);
+
+	// Sorts the clusters of a vertex cache optimized index list for overdraw.
+	// destination must not alias indices.
+	static void OptimizeOverdraw(unsigned int* destination, const unsigned int* indices, size_t indexCount,
+		const float* positions, size_t vertexCount, size_t positionStride, const std::vector<unsigned int>& clusters,
+		unsigned int cacheSize = CacheSize, float threshold = OverdrawThreshold);
+
+	// Renumbers vertices in order of first use and reorders the vertex buffer to match,
+	// returns the number of referenced vertices
+	static size_t OptimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexStride, unsigned int* indices, size_t indexCount);
+
+	static VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = CacheSize);
+
+	static OverdrawStats AnalyzeOverdraw(const unsigned int* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride);
+};
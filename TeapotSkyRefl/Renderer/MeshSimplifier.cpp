@@ -0,0 +1,464 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+
+const float MeshSimplifier::BorderWeight = 10.0f;
+
+enum SimplifierVertexKind
+{
+	VERTEX_MANIFOLD,	// moves anywhere along its edges
+	VERTEX_BORDER,		// on one open border, moves along it
+	VERTEX_LOCKED		// seam, corner or non-manifold, never moves
+};
+
+struct SimplifierVector
+{
+	double x, y, z;
+};
+
+static SimplifierVector ReadPosition(const float* positions, size_t positionStride, unsigned int v)
+{
+	const float* p = (const float*)((const char*)positions + positionStride * v);
+	SimplifierVector result = { p[0], p[1], p[2] };
+	return result;
+}
+
+static SimplifierVector Subtract(const SimplifierVector& a, const SimplifierVector& b)
+{
+	SimplifierVector result = { a.x - b.x, a.y - b.y, a.z - b.z };
+	return result;
+}
+
+static SimplifierVector Cross(const SimplifierVector& a, const SimplifierVector& b)
+{
+	SimplifierVector result = { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	return result;
+}
+
+static double Dot(const SimplifierVector& a, const SimplifierVector& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static unsigned long long EdgeKey(unsigned int a, unsigned int b)
+{
+	return ((unsigned long long)a << 32) | b;
+}
+
+// Directed edges between positions, an edge without its opposite is on an open border.
+// nonManifold marks the positions of directed edges used twice.
+static void BuildEdges(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& positionRemap,
+	std::unordered_set<unsigned long long>& edges, std::vector<bool>* nonManifold)
+{
+	edges.clear();
+	edges.reserve(indices.size());
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		for (int e = 0; e < 3; ++e)
+		{
+			unsigned int a = positionRemap[indices[i + e]];
+			unsigned int b = positionRemap[indices[i + (e + 1) % 3]];
+			if (!edges.insert(EdgeKey(a, b)).second && nonManifold)
+			{
+				(*nonManifold)[a] = true;
+				(*nonManifold)[b] = true;
+			}
+		}
+	}
+}
+
+// Distance from p to the closest point of triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+static double PointTriangleDistance(const SimplifierVector& p, const SimplifierVector& a, const SimplifierVector& b, const SimplifierVector& c)
+{
+	SimplifierVector ab = Subtract(b, a);
+	SimplifierVector ac = Subtract(c, a);
+	SimplifierVector ap = Subtract(p, a);
+	SimplifierVector closest;
+
+	double d1 = Dot(ab, ap);
+	double d2 = Dot(ac, ap);
+	SimplifierVector bp = Subtract(p, b);
+	double d3 = Dot(ab, bp);
+	double d4 = Dot(ac, bp);
+	SimplifierVector cp = Subtract(p, c);
+	double d5 = Dot(ab, cp);
+	double d6 = Dot(ac, cp);
+	double va = d3 * d6 - d5 * d4;
+	double vb = d5 * d2 - d1 * d6;
+	double vc = d1 * d4 - d3 * d2;
+
+	if (d1 <= 0.0 && d2 <= 0.0)
+		closest = a;
+	else if (d3 >= 0.0 && d4 <= d3)
+		closest = b;
+	else if (d6 >= 0.0 && d5 <= d6)
+		closest = c;
+	else if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+	{
+		double v = d1 / (d1 - d3);
+		SimplifierVector q = { a.x + v * ab.x, a.y + v * ab.y, a.z + v * ab.z };
+		closest = q;
+	}
+	else if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+	{
+		double w = d2 / (d2 - d6);
+		SimplifierVector q = { a.x + w * ac.x, a.y + w * ac.y, a.z + w * ac.z };
+		closest = q;
+	}
+	else if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0)
+	{
+		double w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		SimplifierVector q = { b.x + w * (c.x - b.x), b.y + w * (c.y - b.y), b.z + w * (c.z - b.z) };
+		closest = q;
+	}
+	else
+	{
+		double denominator = 1.0 / (va + vb + vc);
+		double v = vb * denominator;
+		double w = vc * denominator;
+		SimplifierVector q = { a.x + ab.x * v + ac.x * w, a.y + ab.y * v + ac.y * w, a.z + ab.z * v + ac.z * w };
+		closest = q;
+	}
+
+	SimplifierVector d = Subtract(p, closest);
+	return sqrt(Dot(d, d));
+}
+
+// Weighted sum of squared plane distances, Error() is the weighted mean
+struct Quadric
+{
+	double a00, a11, a22, a10, a20, a21;
+	double b0, b1, b2;
+	double c;
+	double w;
+
+	void AddPlane(const SimplifierVector& n, double d, double weight)
+	{
+		a00 += weight * n.x * n.x;
+		a11 += weight * n.y * n.y;
+		a22 += weight * n.z * n.z;
+		a10 += weight * n.y * n.x;
+		a20 += weight * n.z * n.x;
+		a21 += weight * n.z * n.y;
+		b0 += weight * n.x * d;
+		b1 += weight * n.y * d;
+		b2 += weight * n.z * d;
+		c += weight * d * d;
+		w += weight;
+	}
+
+	void Add(const Quadric& q)
+	{
+		a00 += q.a00; a11 += q.a11; a22 += q.a22;
+		a10 += q.a10; a20 += q.a20; a21 += q.a21;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2;
+		c += q.c;
+		w += q.w;
+	}
+
+	double Error(const SimplifierVector& p) const
+	{
+		double e = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z +
+			2.0 * (a10 * p.x * p.y + a20 * p.x * p.z + a21 * p.y * p.z) +
+			2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+		return w > 0.0 ? std::max(e, 0.0) / w : 0.0;
+	}
+};
+
+// Triangles using each vertex of the current index list
+struct SimplifierAdjacency
+{
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> triangles;
+
+	void Build(const unsigned int* indices, size_t indexCount, size_t vertexCount)
+	{
+		offsets.assign(vertexCount + 1, 0);
+		triangles.resize(indexCount);
+
+		for (size_t i = 0; i < indexCount; ++i)
+			offsets[indices[i] + 1]++;
+		for (size_t v = 0; v < vertexCount; ++v)
+			offsets[v + 1] += offsets[v];
+
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indexCount; ++i)
+			triangles[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+};
+
+struct Collapse
+{
+	unsigned int from;
+	unsigned int to;
+	double error;
+
+	bool operator<(const Collapse& other) const { return error < other.error; }
+};
+
+size_t MeshSimplifier::Simplify(unsigned int* destination, const unsigned int* indices, size_t indexCount,
+	const float* positions, size_t vertexCount, size_t positionStride,
+	size_t targetIndexCount, float targetError, float* resultError, const unsigned char* vertexLock)
+{
+	indexCount -= indexCount % 3;
+	std::vector<unsigned int> result(indices, indices + indexCount);
+
+	if (resultError)
+		*resultError = 0.0f;
+
+	// vertices sharing a position use the quadric of the first of them
+	std::vector<unsigned int> sorted(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		sorted[v] = (unsigned int)v;
+	std::sort(sorted.begin(), sorted.end(), [&](unsigned int a, unsigned int b)
+	{
+		return memcmp((const char*)positions + positionStride * a, (const char*)positions + positionStride * b, 3 * sizeof(float)) < 0;
+	});
+
+	std::vector<unsigned int> positionRemap(vertexCount);
+	std::vector<unsigned int> wedgeCount(vertexCount, 0);
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		unsigned int v = sorted[i];
+		bool samePosition = i > 0 &&
+			memcmp((const char*)positions + positionStride * v, (const char*)positions + positionStride * sorted[i - 1], 3 * sizeof(float)) == 0;
+		positionRemap[v] = samePosition ? positionRemap[sorted[i - 1]] : v;
+		wedgeCount[positionRemap[v]]++;
+	}
+
+	std::unordered_set<unsigned long long> edges;
+	std::vector<bool> nonManifold(vertexCount, false);
+	BuildEdges(result, positionRemap, edges, &nonManifold);
+
+	std::vector<unsigned int> borderEdgeCount(vertexCount, 0);
+	for (unsigned long long edge : edges)
+	{
+		unsigned int a = (unsigned int)(edge >> 32);
+		unsigned int b = (unsigned int)(edge & 0xffffffff);
+		if (edges.count(EdgeKey(b, a)) == 0)
+		{
+			borderEdgeCount[a]++;
+			borderEdgeCount[b]++;
+		}
+	}
+
+	std::vector<unsigned char> kind(vertexCount, VERTEX_MANIFOLD);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		unsigned int p = positionRemap[v];
+		if (wedgeCount[p] > 1 || nonManifold[p] || (borderEdgeCount[p] != 0 && borderEdgeCount[p] != 2) || (vertexLock && vertexLock[v]))
+			kind[v] = VERTEX_LOCKED;
+		else if (borderEdgeCount[p] == 2)
+			kind[v] = VERTEX_BORDER;
+	}
+
+	// triangle planes weighted by area, borders get planes through the edge at a right angle to the triangle
+	std::vector<Quadric> quadrics(vertexCount);
+	memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+	for (size_t i = 0; i < indexCount; i += 3)
+	{
+		SimplifierVector p[3];
+		for (int k = 0; k < 3; ++k)
+			p[k] = ReadPosition(positions, positionStride, result[i + k]);
+
+		SimplifierVector normal = Cross(Subtract(p[1], p[0]), Subtract(p[2], p[0]));
+		double length = sqrt(Dot(normal, normal));
+		if (length <= 0.0)
+			continue;
+		normal.x /= length; normal.y /= length; normal.z /= length;
+
+		double d = -Dot(normal, p[0]);
+		for (int k = 0; k < 3; ++k)
+			quadrics[positionRemap[result[i + k]]].AddPlane(normal, d, 0.5 * length);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			unsigned int a = positionRemap[result[i + e]];
+			unsigned int b = positionRemap[result[i + (e + 1) % 3]];
+			if (edges.count(EdgeKey(b, a)) != 0)
+				continue;
+
+			SimplifierVector edge = Subtract(p[(e + 1) % 3], p[e]);
+			SimplifierVector borderNormal = Cross(edge, normal);
+			double borderLength = sqrt(Dot(borderNormal, borderNormal));
+			if (borderLength <= 0.0)
+				continue;
+			borderNormal.x /= borderLength; borderNormal.y /= borderLength; borderNormal.z /= borderLength;
+
+			double borderD = -Dot(borderNormal, p[e]);
+			double weight = Dot(edge, edge) * BorderWeight;
+			quadrics[a].AddPlane(borderNormal, borderD, weight);
+			quadrics[b].AddPlane(borderNormal, borderD, weight);
+		}
+	}
+
+	double errorLimit = (double)targetError * (double)targetError;
+	double maxError = 0.0;
+
+	SimplifierAdjacency adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<unsigned int> collapseRemap(vertexCount);
+	std::vector<bool> collapseLocked(vertexCount, false);
+
+	// the vertex every vertex ended up collapsed into
+	std::vector<unsigned int> finalRemap(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		finalRemap[v] = (unsigned int)v;
+	for (size_t v = 0; v < vertexCount; ++v)
+		collapseRemap[v] = (unsigned int)v;
+
+	while (result.size() > targetIndexCount)
+	{
+		adjacency.Build(result.data(), result.size(), vertexCount);
+
+		// collapses create new edges, the borders are found again every pass
+		if (collapses.size() > 0)
+			BuildEdges(result, positionRemap, edges, NULL);
+
+		// both directions of every edge
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				unsigned int a = result[i + e];
+				unsigned int b = result[i + (e + 1) % 3];
+				bool borderEdge = edges.count(EdgeKey(positionRemap[b], positionRemap[a])) == 0;
+
+				unsigned int pairs[2][2] = { { a, b }, { b, a } };
+				for (int k = 0; k < 2; ++k)
+				{
+					unsigned int from = pairs[k][0];
+					unsigned int to = pairs[k][1];
+					if (kind[from] == VERTEX_LOCKED)
+						continue;
+					if (kind[from] == VERTEX_BORDER && (kind[to] == VERTEX_MANIFOLD || !borderEdge))
+						continue;
+
+					Quadric q = quadrics[positionRemap[from]];
+					q.Add(quadrics[positionRemap[to]]);
+
+					Collapse collapse = { from, to, q.Error(ReadPosition(positions, positionStride, to)) };
+					collapses.push_back(collapse);
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end());
+
+		// a manifold collapse removes two triangles, a border collapse one
+		size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+		size_t trianglesRemoved = 0;
+		size_t applied = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.error > errorLimit || trianglesRemoved >= trianglesToRemove)
+				break;
+
+			if (collapseLocked[collapse.from])
+				continue;
+
+			// moving from onto to must not turn any of the remaining triangles around
+			SimplifierVector target = ReadPosition(positions, positionStride, collapse.to);
+			bool flip = false;
+			for (unsigned int a = adjacency.offsets[collapse.from]; a < adjacency.offsets[collapse.from + 1] && !flip; ++a)
+			{
+				const unsigned int* triangle = &result[adjacency.triangles[a] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+					continue;
+
+				SimplifierVector before[3], after[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					before[k] = ReadPosition(positions, positionStride, triangle[k]);
+					after[k] = triangle[k] == collapse.from ? target : before[k];
+				}
+				SimplifierVector n0 = Cross(Subtract(before[1], before[0]), Subtract(before[2], before[0]));
+				SimplifierVector n1 = Cross(Subtract(after[1], after[0]), Subtract(after[2], after[0]));
+				flip = Dot(n0, n1) <= 0.0;
+			}
+			if (flip)
+				continue;
+
+			// the triangles around from change, none of their vertices may move again this pass
+			for (unsigned int a = adjacency.offsets[collapse.from]; a < adjacency.offsets[collapse.from + 1]; ++a)
+			{
+				const unsigned int* triangle = &result[adjacency.triangles[a] * 3];
+				collapseLocked[triangle[0]] = true;
+				collapseLocked[triangle[1]] = true;
+				collapseLocked[triangle[2]] = true;
+			}
+
+			collapseRemap[collapse.from] = collapse.to;
+			finalRemap[collapse.from] = collapse.to;
+			quadrics[positionRemap[collapse.to]].Add(quadrics[positionRemap[collapse.from]]);
+
+			trianglesRemoved += kind[collapse.from] == VERTEX_BORDER ? 1 : 2;
+			maxError = std::max(maxError, collapse.error);
+			applied++;
+		}
+
+		if (applied == 0)
+			break;
+
+		// apply the collapses and drop the triangles that became degenerate
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			unsigned int a = collapseRemap[result[i + 0]];
+			unsigned int b = collapseRemap[result[i + 1]];
+			unsigned int c = collapseRemap[result[i + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			collapseRemap[v] = (unsigned int)v;
+			collapseLocked[v] = false;
+		}
+	}
+
+	// The quadric error is a mean over the collapsed planes and can be below the real
+	// deviation, so the removed vertices are measured against the triangles around
+	// the vertex they were collapsed into and the larger of both is reported
+	if (resultError)
+	{
+		double error = sqrt(maxError);
+		adjacency.Build(result.data(), result.size(), vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			if (finalRemap[v] == v)
+				continue;
+
+			unsigned int target = finalRemap[v];
+			while (finalRemap[target] != target)
+				target = finalRemap[target];
+
+			SimplifierVector p = ReadPosition(positions, positionStride, (unsigned int)v);
+			double distance = DBL_MAX;
+			for (unsigned int a = adjacency.offsets[target]; a < adjacency.offsets[target + 1]; ++a)
+			{
+				const unsigned int* triangle = &result[adjacency.triangles[a] * 3];
+				distance = std::min(distance, PointTriangleDistance(p, ReadPosition(positions, positionStride, triangle[0]),
+					ReadPosition(positions, positionStride, triangle[1]), ReadPosition(positions, positionStride, triangle[2])));
+			}
+			if (distance < DBL_MAX)
+				error = std::max(error, distance);
+		}
+
+		*resultError = (float)error;
+	}
+
+	std::copy(result.begin(), result.end(), destination);
+	return result.size();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// MeshSimplifier
+// Quadric error metric simplification (Garland, Heckbert 1997) of an indexed
+// triangle list by edge collapses onto existing vertices, so every level of
+// detail shares the vertex buffer of the source mesh and only needs its own
+// indices. Collapses are done in passes, cheapest first, each vertex moving at
+// most once per pass, until the target index count or error is reached.
+// Open borders only collapse along themselves and vertices that share their
+// position with others (attribute seams) stay in place, so the outline and
+// the seams of the mesh are kept. Collapses that flip a triangle are skipped.
+// The error is the distance to the planes of the collapsed triangles, in the
+// units of the positions. Only the standard library is used, as in MeshOptimizer.
+// usage:
+// std::vector<unsigned int> lod(indexCount);
+// float error = 0.0f;
+// lod.resize(MeshSimplifier::Simplify(lod.data(), indices, indexCount, positions, vertexCount, sizeof(Vertex), indexCount / 2, FLT_MAX, &error));
+
+class MeshSimplifier
+{
+public:
+	// Weight of the planes keeping open borders in place against the surface planes
+	static const float BorderWeight;
+
+	// Writes the simplified index list to destination, which has room for indexCount indices
+	// and may alias indices. Returns the simplified index count. resultError receives the
+	// largest error of the collapses done. Vertices with a non zero vertexLock entry stay in
+	// place, such as the ones a submesh shares with its neighbours.
+	static size_t Simplify(unsigned int* destination, const unsigned int* indices, size_t indexCount,
+		const float* positions, size_t vertexCount, size_t positionStride,
+		size_t targetIndexCount, float targetError, float* resultError = NULL, const unsigned char* vertexLock = NULL);
+};
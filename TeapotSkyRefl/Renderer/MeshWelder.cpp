@@ -0,0 +1,259 @@
+#include "MeshWelder.h"
+#include "Parallel.h"
+
+#include <chrono>
+#include <cstring>
+
+static const UINT EmptySlot = 0xffffffff;
+
+// Vertex bits with -0.0 folded into 0.0 so that both weld together
+struct VertexKey
+{
+	UINT bits[8];
+};
+
+static inline VertexKey MakeKey(const Vertex& vertex)
+{
+	float values[8] =
+	{
+		vertex.Position.x + 0.0f, vertex.Position.y + 0.0f, vertex.Position.z + 0.0f,
+		vertex.Normal.x + 0.0f, vertex.Normal.y + 0.0f, vertex.Normal.z + 0.0f,
+		vertex.Tex.x + 0.0f, vertex.Tex.y + 0.0f
+	};
+
+	VertexKey key;
+	memcpy(key.bits, values, sizeof(key.bits));
+	return key;
+}
+
+static inline bool KeyEquals(const VertexKey& a, const VertexKey& b)
+{
+	return memcmp(a.bits, b.bits, sizeof(a.bits)) == 0;
+}
+
+static inline UINT HashKey(const VertexKey& key)
+{
+	// murmur3 style mixing of the 8 words
+	UINT h = 0x9747b28c;
+	for (int i = 0; i < 8; ++i)
+	{
+		UINT k = key.bits[i];
+		k *= 0xcc9e2d51;
+		k = (k << 15) | (k >> 17);
+		k *= 0x1b873593;
+		h ^= k;
+		h = (h << 13) | (h >> 19);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline size_t TableSizeFor(size_t count)
+{
+	size_t size = 16;
+	while (size < count * 2)
+		size <<= 1;
+	return size;
+}
+
+// the top bits of the hash pick the partition of a vertex
+static inline size_t PartitionOf(UINT hash, size_t partitionCount)
+{
+	return (size_t)(((unsigned long long)hash * partitionCount) >> 32);
+}
+
+// Open addressing table with linear probing storing indices into a unique vertex list
+class VertexHashTable
+{
+public:
+	explicit VertexHashTable(size_t expectedCount)
+		: mSlots(TableSizeFor(expectedCount), EmptySlot), mMask(mSlots.size() - 1)
+	{
+		mKeys.reserve(expectedCount);
+	}
+
+	// returns the unique index for key, inserting it as newIndex if not found
+	UINT FindOrInsert(const VertexKey& key, UINT hash, UINT newIndex, bool& inserted)
+	{
+		size_t slot = hash & mMask;
+		while (true)
+		{
+			UINT index = mSlots[slot];
+			if (index == EmptySlot)
+			{
+				mSlots[slot] = newIndex;
+				mKeys.push_back(key);
+				inserted = true;
+				return newIndex;
+			}
+
+			if (KeyEquals(mKeys[index], key))
+			{
+				inserted = false;
+				return index;
+			}
+
+			slot = (slot + 1) & mMask;
+		}
+	}
+
+private:
+	std::vector<UINT> mSlots;
+	std::vector<VertexKey> mKeys;
+	size_t mMask;
+};
+
+void MeshWelder::WeldSerial(const std::vector<Vertex>& vertices, std::vector<Vertex>& unique, std::vector<UINT>& remap)
+{
+	VertexHashTable table(vertices.size());
+
+	unique.clear();
+	unique.reserve(vertices.size());
+	remap.resize(vertices.size());
+
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		VertexKey key = MakeKey(vertices[i]);
+		bool inserted = false;
+		remap[i] = table.FindOrInsert(key, HashKey(key), (UINT)unique.size(), inserted);
+		if (inserted)
+		{
+			unique.push_back(vertices[i]);
+		}
+	}
+}
+
+void MeshWelder::WeldParallel(const std::vector<Vertex>& vertices, std::vector<Vertex>& unique, std::vector<UINT>& remap)
+{
+	const size_t count = vertices.size();
+	const size_t partitionCount = WorkerThreadCount();
+
+	// Hash every vertex, the top bits of the hash pick the partition
+	std::vector<UINT> hashes(count);
+	ParallelFor(count, 4096, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			hashes[i] = HashKey(MakeKey(vertices[i]));
+		}
+	});
+
+	// Bucket the vertex ids by partition with a counting pass, ids stay in order
+	// within a bucket so the result matches a walk over all vertices
+	std::vector<UINT> bucketBase(partitionCount + 1, 0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		bucketBase[PartitionOf(hashes[i], partitionCount) + 1]++;
+	}
+	for (size_t p = 0; p < partitionCount; ++p)
+	{
+		bucketBase[p + 1] += bucketBase[p];
+	}
+
+	std::vector<UINT> bucketed(count);
+	std::vector<UINT> cursor(bucketBase.begin(), bucketBase.end() - 1);
+	for (size_t i = 0; i < count; ++i)
+	{
+		bucketed[cursor[PartitionOf(hashes[i], partitionCount)]++] = (UINT)i;
+	}
+
+	// Each partition welds the vertices of its bucket, so no two partitions can
+	// ever hold the same vertex
+	std::vector<std::vector<UINT>> partitionVertices(partitionCount);
+	remap.resize(count);
+
+	ParallelFor(partitionCount, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t p = begin; p < end; ++p)
+		{
+			const size_t bucketSize = bucketBase[p + 1] - bucketBase[p];
+			VertexHashTable table(bucketSize);
+			std::vector<UINT>& local = partitionVertices[p];
+			local.reserve(bucketSize);
+
+			for (UINT b = bucketBase[p]; b < bucketBase[p + 1]; ++b)
+			{
+				UINT i = bucketed[b];
+				VertexKey key = MakeKey(vertices[i]);
+				bool inserted = false;
+				remap[i] = table.FindOrInsert(key, hashes[i], (UINT)local.size(), inserted);
+				if (inserted)
+				{
+					local.push_back(i);
+				}
+			}
+		}
+	});
+
+	// Concatenate the partitions
+	std::vector<UINT> partitionBase(partitionCount + 1, 0);
+	for (size_t p = 0; p < partitionCount; ++p)
+	{
+		partitionBase[p + 1] = partitionBase[p] + (UINT)partitionVertices[p].size();
+	}
+
+	unique.resize(partitionBase[partitionCount]);
+
+	ParallelFor(partitionCount, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t p = begin; p < end; ++p)
+		{
+			const std::vector<UINT>& local = partitionVertices[p];
+			for (size_t i = 0; i < local.size(); ++i)
+			{
+				unique[partitionBase[p] + i] = vertices[local[i]];
+			}
+		}
+	});
+
+	ParallelFor(count, 4096, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			remap[i] += partitionBase[PartitionOf(hashes[i], partitionCount)];
+		}
+	});
+}
+
+void MeshWelder::Weld(MeshData& meshData, WeldMode mode, WeldStats* stats)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	bool parallel = (mode == WELD_PARALLEL) || (mode == WELD_AUTO && meshData.Vertices.size() >= ParallelThreshold);
+
+	std::vector<Vertex> unique;
+	std::vector<UINT> remap;
+
+	if (parallel)
+		WeldParallel(meshData.Vertices, unique, remap);
+	else
+		WeldSerial(meshData.Vertices, unique, remap);
+
+	// Remap the index buffer to the shared vertices
+	std::vector<UINT>& indices = meshData.Indices;
+	ParallelFor(indices.size(), parallel ? 65536 : indices.size(), [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			indices[i] = remap[indices[i]];
+		}
+	});
+
+	size_t verticesBefore = meshData.Vertices.size();
+	meshData.Vertices.swap(unique);
+
+	if (stats)
+	{
+		stats->verticesBefore = verticesBefore;
+		stats->verticesAfter = meshData.Vertices.size();
+		stats->bytesSaved = (verticesBefore - meshData.Vertices.size()) * sizeof(Vertex);
+		stats->timeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		stats->parallel = parallel;
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Util.h"
+#include "Mesh.h"
+
+// MeshWelder
+// Removes duplicate vertices from a MeshData. Vertices with bit identical
+// position, normal and texcoord are merged with an open addressing hash table
+// and the index buffer is remapped to the shared vertices.
+// usage:
+// WeldStats stats;
+// MeshWelder::Weld(meshData, MeshWelder::WELD_AUTO, &stats);
+
+struct WeldStats
+{
+	WeldStats() : verticesBefore(0), verticesAfter(0), bytesSaved(0), timeMs(0.0), parallel(false) {}
+
+	size_t verticesBefore;
+	size_t verticesAfter;
+	size_t bytesSaved;
+	double timeMs;
+	bool parallel;
+};
+
+class MeshWelder
+{
+public:
+
+	enum WeldMode
+	{
+		WELD_AUTO = 0,	// parallel for meshes over ParallelThreshold vertices
+		WELD_SERIAL,
+		WELD_PARALLEL
+	};
+
+	// Vertex count from which WELD_AUTO uses the parallel path
+	static const size_t ParallelThreshold = 256 * 1024;
+
+	static void Weld(MeshData& meshData, WeldMode mode = WELD_AUTO, WeldStats* stats = NULL);
+
+private:
+
+	// Builds the unique vertex list and the old to new vertex remap table
+	static void WeldSerial(const std::vector<Vertex>& vertices, std::vector<Vertex>& unique, std::vector<UINT>& remap);
+	static void WeldParallel(const std::vector<Vertex>& vertices, std::vector<Vertex>& unique, std::vector<UINT>& remap);
+};
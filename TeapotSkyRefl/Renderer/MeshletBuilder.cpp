@@ -0,0 +1,211 @@
+#include "MeshletBuilder.h"
+
+#include <cfloat>
+
+static const UINT NotInMeshlet = 0xffffffff;
+
+static inline XMVECTOR LoadPosition(const float* positions, size_t stride, UINT index)
+{
+	return XMLoadFloat3((const XMFLOAT3*)((const char*)positions + stride * index));
+}
+
+void MeshletBuilder::Build(const float* positions, size_t positionStride, size_t vertexCount, UINT* indices, size_t indexCount,
+	std::vector<Meshlet>& meshlets)
+{
+	meshlets.clear();
+
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+	meshlets.reserve(triangleCount / MaxTriangles + 1);
+
+	// triangles using each vertex
+	std::vector<UINT> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+		adjacencyOffsets[indices[i] + 1]++;
+	for (size_t v = 0; v < vertexCount; ++v)
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+	std::vector<UINT> adjacency(triangleCount * 3);
+	std::vector<UINT> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+		adjacency[fill[indices[i]]++] = (UINT)(i / 3);
+
+	// unit triangle normals, zero for degenerate triangles
+	std::vector<XMFLOAT3> normals(triangleCount);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		XMVECTOR p0 = LoadPosition(positions, positionStride, indices[t * 3 + 0]);
+		XMVECTOR p1 = LoadPosition(positions, positionStride, indices[t * 3 + 1]);
+		XMVECTOR p2 = LoadPosition(positions, positionStride, indices[t * 3 + 2]);
+		XMVECTOR normal = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+		XMStoreFloat3(&normals[t], XMVector3Normalize(normal));
+	}
+
+	// meshlet local index of every vertex, reset when a meshlet is closed
+	std::vector<UINT> localIndex(vertexCount, NotInMeshlet);
+	std::vector<UINT> vertices;
+	vertices.reserve(MaxVertices);
+
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<UINT> triangles;
+	std::vector<UINT> candidates;
+	triangles.reserve(MaxTriangles);
+
+	std::vector<UINT> reordered;
+	reordered.reserve(triangleCount * 3);
+
+	size_t seed = 0;
+	for (;;)
+	{
+		while (seed < triangleCount && emitted[seed])
+			seed++;
+		if (seed == triangleCount)
+			break;
+
+		XMVECTOR axis = XMVectorZero();
+		UINT triangle = (UINT)seed;
+		for (;;)
+		{
+			emitted[triangle] = true;
+			triangles.push_back(triangle);
+			axis = XMVectorAdd(axis, XMLoadFloat3(&normals[triangle]));
+
+			for (int k = 0; k < 3; ++k)
+			{
+				UINT v = indices[triangle * 3 + k];
+				if (localIndex[v] != NotInMeshlet)
+					continue;
+				localIndex[v] = (UINT)vertices.size();
+				vertices.push_back(v);
+
+				// the triangles of a vertex become candidates once it joins the meshlet
+				for (UINT a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; ++a)
+				{
+					if (!emitted[adjacency[a]])
+						candidates.push_back(adjacency[a]);
+				}
+			}
+
+			if (triangles.size() == MaxTriangles)
+				break;
+
+			// next triangle: fewest new vertices, then closest to the average normal
+			XMVECTOR averageNormal = XMVector3Normalize(axis);
+			float bestScore = FLT_MAX;
+			UINT best = NotInMeshlet;
+			size_t live = 0;
+			for (size_t c = 0; c < candidates.size(); ++c)
+			{
+				UINT candidate = candidates[c];
+				if (emitted[candidate])
+					continue;
+				candidates[live++] = candidate;
+
+				const UINT* corners = indices + candidate * 3;
+				UINT newVertices = (localIndex[corners[0]] == NotInMeshlet) + (localIndex[corners[1]] == NotInMeshlet) +
+					(localIndex[corners[2]] == NotInMeshlet);
+				if (vertices.size() + newVertices > MaxVertices)
+					continue;
+
+				float score = newVertices + (1.0f - XMVectorGetX(XMVector3Dot(averageNormal, XMLoadFloat3(&normals[candidate]))));
+				if (score < bestScore)
+				{
+					bestScore = score;
+					best = candidate;
+				}
+			}
+			candidates.resize(live);
+
+			if (best == NotInMeshlet)
+				break;
+			triangle = best;
+		}
+
+		// keep the optimized triangle order inside the meshlet
+		std::sort(triangles.begin(), triangles.end());
+
+		Meshlet meshlet;
+		ZeroMemory(&meshlet, sizeof(meshlet));
+		meshlet.indexOffset = (UINT)reordered.size();
+		meshlet.triangleCount = (UINT)triangles.size();
+		for (UINT t : triangles)
+			reordered.insert(reordered.end(), indices + t * 3, indices + t * 3 + 3);
+
+		ComputeBounds(positions, positionStride, reordered.data(), vertices, meshlet);
+		meshlets.push_back(meshlet);
+
+		for (UINT v : vertices)
+			localIndex[v] = NotInMeshlet;
+		vertices.clear();
+		triangles.clear();
+		candidates.clear();
+	}
+
+	std::copy(reordered.begin(), reordered.end(), indices);
+}
+
+void MeshletBuilder::ComputeBounds(const float* positions, size_t positionStride, const UINT* indices, const std::vector<UINT>& vertices, Meshlet& meshlet)
+{
+	meshlet.vertexCount = (UINT)vertices.size();
+
+	// sphere around the box center, tight enough for small clusters
+	XMVECTOR boundsMin = LoadPosition(positions, positionStride, vertices[0]);
+	XMVECTOR boundsMax = boundsMin;
+	for (UINT v : vertices)
+	{
+		XMVECTOR p = LoadPosition(positions, positionStride, v);
+		boundsMin = XMVectorMin(boundsMin, p);
+		boundsMax = XMVectorMax(boundsMax, p);
+	}
+
+	XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+	XMVECTOR radiusSq = XMVectorZero();
+	for (UINT v : vertices)
+	{
+		radiusSq = XMVectorMax(radiusSq, XMVector3LengthSq(XMVectorSubtract(LoadPosition(positions, positionStride, v), center)));
+	}
+	XMStoreFloat3(&meshlet.center, center);
+	meshlet.radius = sqrtf(XMVectorGetX(radiusSq));
+
+	// normal cone: average of the unit triangle normals, the widest triangle sets the cutoff.
+	// cross(v1 - v0, v2 - v0) points away from the surface for the clockwise front faces
+	std::vector<XMVECTOR> normals;
+	normals.reserve(meshlet.triangleCount);
+	XMVECTOR axis = XMVectorZero();
+	for (UINT t = 0; t < meshlet.triangleCount; ++t)
+	{
+		const UINT* triangle = indices + meshlet.indexOffset + t * 3;
+		XMVECTOR p0 = LoadPosition(positions, positionStride, triangle[0]);
+		XMVECTOR p1 = LoadPosition(positions, positionStride, triangle[1]);
+		XMVECTOR p2 = LoadPosition(positions, positionStride, triangle[2]);
+		XMVECTOR normal = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+
+		// degenerate triangles do not face anywhere
+		if (XMVectorGetX(XMVector3LengthSq(normal)) <= 0.0f)
+			continue;
+
+		normal = XMVector3Normalize(normal);
+		normals.push_back(normal);
+		axis = XMVectorAdd(axis, normal);
+	}
+
+	meshlet.coneAxis = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	meshlet.coneCutoff = 2.0f;
+
+	if (normals.empty() || XMVectorGetX(XMVector3LengthSq(axis)) <= 0.0f)
+		return;
+
+	axis = XMVector3Normalize(axis);
+	float minDot = 1.0f;
+	for (const XMVECTOR& normal : normals)
+	{
+		minDot = (std::min)(minDot, XMVectorGetX(XMVector3Dot(axis, normal)));
+	}
+
+	XMStoreFloat3(&meshlet.coneAxis, axis);
+
+	// a cone of 90 degrees or more can never be fully back facing
+	if (minDot > 0.0f)
+		meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Util.h"
+
+// MeshletBuilder
+// Splits an indexed triangle list into meshlets of at most MaxVertices unique
+// vertices and MaxTriangles triangles. A meshlet grows from the first unused
+// triangle over shared vertices, preferring triangles that add few vertices and
+// face the same way, which keeps the normal cones narrow enough to cull.
+// The index buffer is reordered so every meshlet is a contiguous index range;
+// inside a meshlet the triangles keep their order, so run it after MeshOptimizer.
+// Every meshlet gets a bounding sphere and a backface normal cone for ClusterCuller.
+// usage:
+// std::vector<Meshlet> meshlets;
+// MeshletBuilder::Build(&vertices[0].Position.x, sizeof(Vertex), vertexCount, indices, indexCount, meshlets);
+
+struct Meshlet
+{
+	UINT indexOffset;	// first index in the mesh index buffer
+	UINT triangleCount;
+	UINT vertexCount;
+
+	// object space bounding sphere
+	XMFLOAT3 center;
+	float radius;
+
+	// every triangle normal lies within the cone around coneAxis,
+	// coneCutoff is the sine of its half angle, above 1 the cone is too wide to cull
+	XMFLOAT3 coneAxis;
+	float coneCutoff;
+};
+
+class MeshletBuilder
+{
+public:
+	static const UINT MaxVertices = 64;
+	static const UINT MaxTriangles = 124;
+
+	// positions are read as three floats every positionStride bytes, indices are reordered in place
+	static void Build(const float* positions, size_t positionStride, size_t vertexCount, UINT* indices, size_t indexCount,
+		std::vector<Meshlet>& meshlets);
+
+private:
+
+	static void ComputeBounds(const float* positions, size_t positionStride, const UINT* indices, const std::vector<UINT>& vertices, Meshlet& meshlet);
+};
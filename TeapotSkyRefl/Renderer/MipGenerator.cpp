@@ -0,0 +1,483 @@
+#include "MipGenerator.h"
+#include "VertexPacking.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// half width of the Kaiser window in destination texels, and its shape
+static const double KaiserRadius = 2.0;
+static const double KaiserAlpha = 4.0;
+
+// linear values are encoded to sRGB through a table of this many steps, fine enough
+// that the rounding of only a few values lands on the other code
+static const unsigned int EncodeSteps = 65535;
+
+// taps with less weight are left out, the sinc is not exactly 0 at its zero crossings
+static const double MinWeight = 1e-9;
+
+// destination rows filtered from one band of decoded source rows
+static const unsigned int BandRows = 16;
+
+// a mip with fewer texels per thread is not split further
+static const size_t MinTexelsPerThread = 16384;
+
+struct SrgbTables
+{
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			double c = i / 255.0;
+			decode[i] = (float)(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+		}
+
+		// the code of each step is the nearest sRGB code, rounded in sRGB space
+		encode.resize(EncodeSteps + 1);
+		for (unsigned int i = 0; i <= EncodeSteps; ++i)
+		{
+			double l = (double)i / EncodeSteps;
+			double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+			encode[i] = (unsigned char)std::min(std::max(c * 255.0 + 0.5, 0.0), 255.0);
+		}
+	}
+
+	float decode[256];
+	std::vector<unsigned char> encode;
+};
+
+static const SrgbTables& Tables()
+{
+	static const SrgbTables tables;
+	return tables;
+}
+
+float MipGenerator::SrgbToLinear(unsigned char value)
+{
+	return Tables().decode[value];
+}
+
+unsigned char MipGenerator::LinearToSrgb(float value)
+{
+	return Tables().encode[(int)(std::min(std::max(value, 0.0f), 1.0f) * (float)EncodeSteps + 0.5f)];
+}
+
+unsigned int MipGenerator::MipCount(unsigned int width, unsigned int height)
+{
+	unsigned int count = 1;
+	while (width > 1 || height > 1)
+	{
+		width = std::max(width >> 1, 1u);
+		height = std::max(height >> 1, 1u);
+		++count;
+	}
+	return count;
+}
+
+size_t MipGenerator::MipOffset(unsigned int width, unsigned int height, unsigned int mip)
+{
+	return ChainSize(width, height, mip);
+}
+
+size_t MipGenerator::ChainSize(unsigned int width, unsigned int height, unsigned int mipCount)
+{
+	size_t size = 0;
+	for (unsigned int mip = 0; mip < mipCount; ++mip)
+	{
+		size += (size_t)std::max(width >> mip, 1u) * std::max(height >> mip, 1u) * 4;
+	}
+	return size;
+}
+
+MipKernel MipGenerator::GetKernel(MipKernel kernel)
+{
+	static const bool avx2 = CpuSupportsAvx2();
+
+	if (kernel == MIP_KERNEL_AUTO)
+		return avx2 ? MIP_KERNEL_AVX2 : MIP_KERNEL_SSE2;
+
+	if (kernel == MIP_KERNEL_AVX2 && !avx2)
+		return MIP_KERNEL_SSE2;
+
+	return kernel;
+}
+
+//////////// Filter taps
+
+// Every destination texel of an axis reads count source texels, padded with zero
+// weights, at clamped indices. The weights of a texel add up to 1.
+struct FilterTaps
+{
+	unsigned int count;
+	std::vector<int> index;
+	std::vector<float> weight;
+};
+
+static double BesselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; ++k)
+	{
+		term *= (x * x) / (4.0 * k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+// weight of source texel i for the destination texel covering [begin, begin + scale)
+static double FilterWeight(MipFilter filter, int i, double begin, double scale)
+{
+	if (filter == MIP_FILTER_BOX)
+	{
+		double overlap = std::min(i + 1.0, begin + scale) - std::max((double)i, begin);
+		return std::max(overlap, 0.0);
+	}
+
+	// in destination texels from the center, the sinc cuts off at the destination Nyquist rate
+	double t = (i + 0.5 - (begin + 0.5 * scale)) / scale;
+	if (fabs(t) >= KaiserRadius)
+		return 0.0;
+
+	const double pi = 3.14159265358979323846;
+	double sinc = t == 0.0 ? 1.0 : sin(pi * t) / (pi * t);
+	double r = t / KaiserRadius;
+	return sinc * BesselI0(KaiserAlpha * sqrt(1.0 - r * r)) / BesselI0(KaiserAlpha);
+}
+
+static void BuildTaps(MipFilter filter, unsigned int sourceSize, unsigned int size, FilterTaps& taps)
+{
+	double scale = (double)sourceSize / size;
+	double support = filter == MIP_FILTER_BOX ? 0.5 * scale : KaiserRadius * scale;
+
+	// the nonzero range of every texel, the widest one sets the count
+	std::vector<int> first(size), last(size);
+	taps.count = 1;
+	for (unsigned int x = 0; x < size; ++x)
+	{
+		double center = (x + 0.5) * scale;
+		int lo = (int)floor(center - support) - 1, hi = (int)ceil(center + support) + 1;
+		while (lo < hi && fabs(FilterWeight(filter, lo, x * scale, scale)) < MinWeight)
+			++lo;
+		while (hi > lo && fabs(FilterWeight(filter, hi, x * scale, scale)) < MinWeight)
+			--hi;
+		first[x] = lo;
+		last[x] = hi;
+		taps.count = std::max(taps.count, (unsigned int)(hi - lo + 1));
+	}
+
+	taps.index.resize((size_t)size * taps.count);
+	taps.weight.resize((size_t)size * taps.count);
+	for (unsigned int x = 0; x < size; ++x)
+	{
+		double weights[64] = {};
+		double sum = 0.0;
+		for (unsigned int t = 0; t < taps.count && t < 64; ++t)
+		{
+			int i = first[x] + (int)t;
+			double weight = i <= last[x] ? FilterWeight(filter, i, x * scale, scale) : 0.0;
+			weights[t] = fabs(weight) >= MinWeight ? weight : 0.0;
+			sum += weights[t];
+		}
+
+		for (unsigned int t = 0; t < taps.count; ++t)
+		{
+			int i = std::min(std::max(first[x] + (int)t, 0), (int)sourceSize - 1);
+			taps.index[x * taps.count + t] = i;
+			taps.weight[x * taps.count + t] = (float)(t < 64 ? weights[t] / sum : 0.0);
+		}
+	}
+}
+
+//////////// Scalar reference
+
+// out[i] = sum of rows[t][i] * weights[t], count floats
+static void VerticalScalar(const float* const* rows, const float* weights, unsigned int taps, size_t count, float* out)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float sum = rows[0][i] * weights[0];
+		for (unsigned int t = 1; t < taps; ++t)
+		{
+			sum += rows[t][i] * weights[t];
+		}
+		out[i] = sum;
+	}
+}
+
+// RGBA texels of column filtered along the row to width texels
+static void HorizontalScalar(const float* column, const FilterTaps& taps, unsigned int width, float* out)
+{
+	for (unsigned int x = 0; x < width; ++x)
+	{
+		const int* index = &taps.index[x * taps.count];
+		const float* weight = &taps.weight[x * taps.count];
+		for (int c = 0; c < 4; ++c)
+		{
+			float sum = column[index[0] * 4 + c] * weight[0];
+			for (unsigned int t = 1; t < taps.count; ++t)
+			{
+				sum += column[index[t] * 4 + c] * weight[t];
+			}
+			out[x * 4 + c] = sum;
+		}
+	}
+}
+
+static void EncodeScalar(const float* values, unsigned int width, bool srgb, unsigned char* out)
+{
+	const unsigned char* encode = Tables().encode.data();
+	for (unsigned int i = 0; i < width * 4; ++i)
+	{
+		float value = std::min(std::max(values[i], 0.0f), 1.0f);
+		out[i] = srgb && i % 4 != 3 ? encode[(int)(value * (float)EncodeSteps + 0.5f)] : (unsigned char)(int)(value * 255.0f + 0.5f);
+	}
+}
+
+//////////// SSE2, one texel or four floats per iteration
+
+static void VerticalSSE2(const float* const* rows, const float* weights, unsigned int taps, size_t count, float* out)
+{
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 sum = _mm_mul_ps(_mm_loadu_ps(rows[0] + i), _mm_set1_ps(weights[0]));
+		for (unsigned int t = 1; t < taps; ++t)
+		{
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[t] + i), _mm_set1_ps(weights[t])));
+		}
+		_mm_storeu_ps(out + i, sum);
+	}
+}
+
+static void HorizontalSSE2(const float* column, const FilterTaps& taps, unsigned int width, float* out)
+{
+	for (unsigned int x = 0; x < width; ++x)
+	{
+		const int* index = &taps.index[x * taps.count];
+		const float* weight = &taps.weight[x * taps.count];
+		__m128 sum = _mm_mul_ps(_mm_loadu_ps(column + index[0] * 4), _mm_set1_ps(weight[0]));
+		for (unsigned int t = 1; t < taps.count; ++t)
+		{
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(column + index[t] * 4), _mm_set1_ps(weight[t])));
+		}
+		_mm_storeu_ps(out + x * 4, sum);
+	}
+}
+
+static void EncodeSSE2(const float* values, unsigned int width, bool srgb, unsigned char* out)
+{
+	const unsigned char* encode = Tables().encode.data();
+
+	// color through the table, alpha straight to 8 bits
+	const __m128 scale = srgb ? _mm_setr_ps((float)EncodeSteps, (float)EncodeSteps, (float)EncodeSteps, 255.0f) : _mm_set1_ps(255.0f);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+
+	for (unsigned int x = 0; x < width; ++x)
+	{
+		__m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + x * 4), zero), one);
+		__m128i codes = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half));
+
+		int32_t code[4];
+		_mm_storeu_si128((__m128i*)code, codes);
+		for (int c = 0; c < 3; ++c)
+		{
+			out[x * 4 + c] = srgb ? encode[code[c]] : (unsigned char)code[c];
+		}
+		out[x * 4 + 3] = (unsigned char)code[3];
+	}
+}
+
+//////////// AVX2, eight floats or two texels per iteration
+
+AVX2_TARGET static void VerticalAVX2(const float* const* rows, const float* weights, unsigned int taps, size_t count, float* out)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 sum = _mm256_mul_ps(_mm256_loadu_ps(rows[0] + i), _mm256_set1_ps(weights[0]));
+		for (unsigned int t = 1; t < taps; ++t)
+		{
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[t] + i), _mm256_set1_ps(weights[t])));
+		}
+		_mm256_storeu_ps(out + i, sum);
+	}
+
+	if (i < count)
+	{
+		const float* tail[64];
+		for (unsigned int t = 0; t < taps && t < 64; ++t)
+		{
+			tail[t] = rows[t] + i;
+		}
+		VerticalSSE2(tail, weights, taps, count - i, out + i);
+	}
+}
+
+AVX2_TARGET static inline __m256 LoadTexels(const float* low, const float* high)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+}
+
+AVX2_TARGET static void HorizontalAVX2(const float* column, const FilterTaps& taps, unsigned int width, float* out)
+{
+	unsigned int x = 0;
+	for (; x + 2 <= width; x += 2)
+	{
+		const int* index0 = &taps.index[x * taps.count];
+		const int* index1 = index0 + taps.count;
+		const float* weight0 = &taps.weight[x * taps.count];
+		const float* weight1 = weight0 + taps.count;
+
+		__m256 sum = _mm256_mul_ps(LoadTexels(column + index0[0] * 4, column + index1[0] * 4),
+			_mm256_setr_ps(weight0[0], weight0[0], weight0[0], weight0[0], weight1[0], weight1[0], weight1[0], weight1[0]));
+		for (unsigned int t = 1; t < taps.count; ++t)
+		{
+			__m256 weight = _mm256_setr_ps(weight0[t], weight0[t], weight0[t], weight0[t], weight1[t], weight1[t], weight1[t], weight1[t]);
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(LoadTexels(column + index0[t] * 4, column + index1[t] * 4), weight));
+		}
+		_mm256_storeu_ps(out + x * 4, sum);
+	}
+
+	for (; x < width; ++x)
+	{
+		const int* index = &taps.index[x * taps.count];
+		const float* weight = &taps.weight[x * taps.count];
+		__m128 sum = _mm_mul_ps(_mm_loadu_ps(column + index[0] * 4), _mm_set1_ps(weight[0]));
+		for (unsigned int t = 1; t < taps.count; ++t)
+		{
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(column + index[t] * 4), _mm_set1_ps(weight[t])));
+		}
+		_mm_storeu_ps(out + x * 4, sum);
+	}
+}
+
+//////////// Mip chain
+
+struct MipKernels
+{
+	void(*vertical)(const float* const*, const float*, unsigned int, size_t, float*);
+	void(*horizontal)(const float*, const FilterTaps&, unsigned int, float*);
+	void(*encode)(const float*, unsigned int, bool, unsigned char*);
+};
+
+static MipKernels SelectKernels(MipKernel kernel)
+{
+	MipKernels kernels;
+	switch (MipGenerator::GetKernel(kernel))
+	{
+	case MIP_KERNEL_AVX2:
+		kernels.vertical = VerticalAVX2;
+		kernels.horizontal = HorizontalAVX2;
+		kernels.encode = EncodeSSE2;
+		break;
+	case MIP_KERNEL_SSE2:
+		kernels.vertical = VerticalSSE2;
+		kernels.horizontal = HorizontalSSE2;
+		kernels.encode = EncodeSSE2;
+		break;
+	default:
+		kernels.vertical = VerticalScalar;
+		kernels.horizontal = HorizontalScalar;
+		kernels.encode = EncodeScalar;
+		break;
+	}
+	return kernels;
+}
+
+static void DecodeRow(const unsigned char* texels, unsigned int width, bool srgb, float* out)
+{
+	const float* decode = Tables().decode;
+	for (unsigned int i = 0; i < width * 4; ++i)
+	{
+		out[i] = srgb && i % 4 != 3 ? decode[texels[i]] : texels[i] * (1.0f / 255.0f);
+	}
+}
+
+void MipGenerator::Generate(const unsigned char* rgba, unsigned int width, unsigned int height, bool srgb, MipFilter filter,
+	std::vector<unsigned char>& chain, unsigned int threadCount, MipKernel kernel)
+{
+	unsigned int mipCount = width > 0 && height > 0 ? MipCount(width, height) : 0;
+	chain.resize(ChainSize(width, height, mipCount));
+	if (mipCount == 0)
+		return;
+
+	memcpy(chain.data(), rgba, (size_t)width * height * 4);
+
+	const MipKernels kernels = SelectKernels(kernel);
+
+	// float texels of the mip above, none for mip 0 which is read from rgba
+	std::vector<float> source, mip;
+	for (unsigned int level = 1; level < mipCount; ++level)
+	{
+		unsigned int sourceWidth = std::max(width >> (level - 1), 1u);
+		unsigned int sourceHeight = std::max(height >> (level - 1), 1u);
+		unsigned int mipWidth = std::max(width >> level, 1u);
+		unsigned int mipHeight = std::max(height >> level, 1u);
+
+		FilterTaps columns, rows;
+		BuildTaps(filter, sourceWidth, mipWidth, columns);
+		BuildTaps(filter, sourceHeight, mipHeight, rows);
+
+		// the last mip is only encoded
+		bool keepFloats = level + 1 < mipCount;
+		mip.resize(keepFloats ? (size_t)mipWidth * mipHeight * 4 : 0);
+		unsigned char* out = chain.data() + MipOffset(width, height, level);
+
+		size_t minRows = std::max<size_t>(MinTexelsPerThread / mipWidth, 1);
+		ParallelFor(mipHeight, minRows, threadCount, [&](size_t begin, size_t end)
+		{
+			std::vector<float> column((size_t)sourceWidth * 4), row(keepFloats ? 0 : (size_t)mipWidth * 4), band;
+			std::vector<const float*> taps(rows.count);
+
+			for (size_t bandBegin = begin; bandBegin < end; bandBegin += BandRows)
+			{
+				size_t bandEnd = std::min(bandBegin + BandRows, end);
+
+				// mip 0 rows are decoded once for the band
+				int firstRow = 0;
+				if (level == 1)
+				{
+					firstRow = rows.index[bandBegin * rows.count];
+					int lastRow = firstRow;
+					for (size_t i = bandBegin * rows.count; i < bandEnd * rows.count; ++i)
+					{
+						firstRow = std::min(firstRow, rows.index[i]);
+						lastRow = std::max(lastRow, rows.index[i]);
+					}
+
+					band.resize((size_t)(lastRow - firstRow + 1) * sourceWidth * 4);
+					for (int y = firstRow; y <= lastRow; ++y)
+					{
+						DecodeRow(rgba + (size_t)y * sourceWidth * 4, sourceWidth, srgb, &band[(size_t)(y - firstRow) * sourceWidth * 4]);
+					}
+				}
+
+				for (size_t y = bandBegin; y < bandEnd; ++y)
+				{
+					for (unsigned int t = 0; t < rows.count; ++t)
+					{
+						int sourceRow = rows.index[y * rows.count + t];
+						taps[t] = level == 1 ? &band[(size_t)(sourceRow - firstRow) * sourceWidth * 4] :
+							&source[(size_t)sourceRow * sourceWidth * 4];
+					}
+
+					float* texels = keepFloats ? &mip[y * mipWidth * 4] : row.data();
+					kernels.vertical(taps.data(), &rows.weight[y * rows.count], rows.count, column.size(), column.data());
+					kernels.horizontal(column.data(), columns, mipWidth, texels);
+					kernels.encode(texels, mipWidth, srgb, out + y * mipWidth * 4);
+				}
+			}
+		});
+
+		source.swap(mip);
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// MipGenerator
+// Builds the full mip chain of an RGBA8 texture on the CPU. Texels are filtered in
+// linear space: sRGB color is decoded through a table, filtered as floats and encoded
+// back with the rounding done in sRGB, alpha and non color data stay linear.
+// The filter is a box or a Kaiser windowed sinc, applied separably with the taps of
+// every destination row and column precomputed, so odd sizes and clamped edges need
+// no special cases. A mip is filtered from the float texels of the one above it and
+// the first mip reads the source bytes in bands, so no float copy of the source is
+// made. The rows of a mip are spread over threads with ParallelFor and each row task
+// also encodes its rows to bytes; small mips stay on one thread.
+// The vertical and horizontal passes have SSE2 and AVX2 kernels, picked at runtime,
+// next to a scalar reference. All of them add in the same order, so every kernel
+// and thread count gives the same bytes.
+// usage:
+// std::vector<unsigned char> chain;
+// MipGenerator::Generate(pixels.data(), width, height, true, MIP_FILTER_KAISER, chain);
+// // mip m starts at chain.data() + MipGenerator::MipOffset(width, height, m)
+
+enum MipFilter
+{
+	MIP_FILTER_BOX,		// average of the covered texels
+	MIP_FILTER_KAISER	// Kaiser windowed sinc, sharper with less aliasing
+};
+
+enum MipKernel
+{
+	MIP_KERNEL_AUTO = 0,	// best kernel the CPU supports
+	MIP_KERNEL_SCALAR,
+	MIP_KERNEL_SSE2,
+	MIP_KERNEL_AVX2
+};
+
+class MipGenerator
+{
+public:
+	static const unsigned int Version = 1;
+
+	// mips down to 1 x 1
+	static unsigned int MipCount(unsigned int width, unsigned int height);
+
+	// byte offset of mip in a chain of RGBA8 mips, mip 0 first
+	static size_t MipOffset(unsigned int width, unsigned int height, unsigned int mip);
+	static size_t ChainSize(unsigned int width, unsigned int height, unsigned int mipCount);
+
+	// Resolves MIP_KERNEL_AUTO to the kernel used on this CPU
+	static MipKernel GetKernel(MipKernel kernel = MIP_KERNEL_AUTO);
+
+	// rgba holds width * height RGBA8 texels. chain receives MipCount(width, height) mips,
+	// mip 0 being a copy of rgba. srgb decodes red, green and blue before filtering.
+	// threadCount 0 uses one thread per hardware thread.
+	static void Generate(const unsigned char* rgba, unsigned int width, unsigned int height, bool srgb, MipFilter filter,
+		std::vector<unsigned char>& chain, unsigned int threadCount = 0, MipKernel kernel = MIP_KERNEL_AUTO);
+
+	// The tables the texels go through
+	static float SrgbToLinear(unsigned char value);
+	static unsigned char LinearToSrgb(float value);
+};
@@ -0,0 +1,505 @@
+#include "ObjImporter.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <map>
+
+const unsigned int ObjImporter::NoMaterial;
+
+// Files smaller than this are parsed in a single chunk
+static const size_t MinChunkSize = 64 * 1024;
+
+static inline bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static inline const char* SkipSpaces(const char* p, const char* end)
+{
+	while (p < end && IsSpace(*p))
+		++p;
+	return p;
+}
+
+// Fast float parser for the plain decimal notation written by modelling tools.
+// Handles sign, fraction and exponent, up to 19 significant digits are kept.
+static const char* ParseFloat(const char* p, const char* end, float& out)
+{
+	static const double powersOf10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	p = SkipSpaces(p, end);
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		++p;
+	}
+
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa != 0)
+				++digits;
+		}
+		else
+		{
+			++exponent;
+		}
+		++p;
+	}
+
+	if (p < end && *p == '.')
+	{
+		++p;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0)
+					++digits;
+				--exponent;
+			}
+			++p;
+		}
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		++p;
+		bool negativeExp = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negativeExp = *p == '-';
+			++p;
+		}
+
+		int exp = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			if (exp < 10000)
+				exp = exp * 10 + (*p - '0');
+			++p;
+		}
+		exponent += negativeExp ? -exp : exp;
+	}
+
+	double value = (double)mantissa;
+	if (exponent < 0)
+	{
+		value = (exponent >= -22) ? value / powersOf10[-exponent] : value * pow(10.0, exponent);
+	}
+	else if (exponent > 0)
+	{
+		value = (exponent <= 22) ? value * powersOf10[exponent] : value * pow(10.0, exponent);
+	}
+
+	out = (float)(negative ? -value : value);
+	return p;
+}
+
+// Returns NULL if the index does not fit an int
+static inline const char* ParseInt(const char* p, const char* end, int& out)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		++p;
+	}
+
+	// accumulate unsigned, the digits after INT_MAX is exceeded are only skipped
+	unsigned long long value = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		if (value <= INT_MAX)
+			value = value * 10 + (*p - '0');
+		++p;
+	}
+
+	if (value > INT_MAX)
+		return NULL;
+
+	out = negative ? -(int)value : (int)value;
+	return p;
+}
+
+// Convert a 1 based .obj index to zero based. Negative indices count back from the
+// number of elements read so far and are flagged as relative to the chunk start.
+static inline int ToZeroBased(int index, size_t localCount, int relativeBit, int& relativeMask)
+{
+	if (index > 0)
+		return index - 1;
+
+	if (index < 0)
+	{
+		relativeMask |= relativeBit;
+		return (int)localCount + index;
+	}
+
+	return -1;
+}
+
+ObjImporter::ObjImporter()
+{
+}
+
+ObjImporter::~ObjImporter()
+{
+}
+
+void ObjImporter::ParseChunk(Chunk& chunk)
+{
+	chunk.valid = true;
+
+	std::vector<Corner> face;
+	face.reserve(8);
+
+	const char* p = chunk.begin;
+	const char* end = chunk.end;
+
+	while (p < end)
+	{
+		p = SkipSpaces(p, end);
+
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+		if (lineEnd == NULL)
+			lineEnd = end;
+
+		size_t lineLength = lineEnd - p;
+
+		if (lineLength > 2 && p[0] == 'v')
+		{
+			if (IsSpace(p[1]))
+			{
+				float x = 0.0f, y = 0.0f, z = 0.0f;
+				const char* s = ParseFloat(p + 1, lineEnd, x);
+				s = ParseFloat(s, lineEnd, y);
+				ParseFloat(s, lineEnd, z);
+				chunk.positions.push_back(x);
+				chunk.positions.push_back(y);
+				chunk.positions.push_back(z);
+			}
+			else if (p[1] == 'n' && IsSpace(p[2]))
+			{
+				float x = 0.0f, y = 0.0f, z = 0.0f;
+				const char* s = ParseFloat(p + 2, lineEnd, x);
+				s = ParseFloat(s, lineEnd, y);
+				ParseFloat(s, lineEnd, z);
+				chunk.normals.push_back(x);
+				chunk.normals.push_back(y);
+				chunk.normals.push_back(z);
+			}
+			else if (p[1] == 't' && IsSpace(p[2]))
+			{
+				float u = 0.0f, v = 0.0f;
+				const char* s = ParseFloat(p + 2, lineEnd, u);
+				ParseFloat(s, lineEnd, v);
+				chunk.texcoords.push_back(u);
+				chunk.texcoords.push_back(v);
+			}
+		}
+		else if (lineLength > 2 && p[0] == 'f' && IsSpace(p[1]))
+		{
+			face.clear();
+
+			size_t positionCount = chunk.positions.size() / 3;
+			size_t normalCount = chunk.normals.size() / 3;
+			size_t texcoordCount = chunk.texcoords.size() / 2;
+
+			const char* s = p + 1;
+			while (true)
+			{
+				s = SkipSpaces(s, lineEnd);
+				if (s >= lineEnd || *s == '\r' || *s == '#')
+					break;
+
+				Corner corner;
+				corner.relativeMask = 0;
+				corner.vt = -1;
+				corner.vn = -1;
+
+				int index = 0;
+				const char* next = ParseInt(s, lineEnd, index);
+				if (next == NULL || next == s)
+				{
+					chunk.valid = false;
+					break;
+				}
+				s = next;
+				corner.v = ToZeroBased(index, positionCount, RELATIVE_V, corner.relativeMask);
+
+				if (s < lineEnd && *s == '/')
+				{
+					++s;
+					if (s < lineEnd && *s != '/')
+					{
+						s = ParseInt(s, lineEnd, index);
+						if (s == NULL)
+						{
+							chunk.valid = false;
+							break;
+						}
+						corner.vt = ToZeroBased(index, texcoordCount, RELATIVE_VT, corner.relativeMask);
+					}
+
+					if (s < lineEnd && *s == '/')
+					{
+						++s;
+						s = ParseInt(s, lineEnd, index);
+						if (s == NULL)
+						{
+							chunk.valid = false;
+							break;
+						}
+						corner.vn = ToZeroBased(index, normalCount, RELATIVE_VN, corner.relativeMask);
+					}
+				}
+
+				face.push_back(corner);
+			}
+
+			// triangulate as a fan
+			for (size_t i = 2; i < face.size(); ++i)
+			{
+				chunk.corners.push_back(face[0]);
+				chunk.corners.push_back(face[i - 1]);
+				chunk.corners.push_back(face[i]);
+				chunk.triangleMaterials.push_back((int)chunk.materialNames.size() - 1);
+			}
+		}
+		else if (lineLength > 7 && strncmp(p, "usemtl", 6) == 0 && IsSpace(p[6]))
+		{
+			const char* nameBegin = SkipSpaces(p + 6, lineEnd);
+			const char* nameEnd = lineEnd;
+			while (nameEnd > nameBegin && (IsSpace(nameEnd[-1]) || nameEnd[-1] == '\r'))
+				--nameEnd;
+			chunk.materialNames.push_back(std::string(nameBegin, nameEnd));
+		}
+		else if (lineLength > 7 && strncmp(p, "mtllib", 6) == 0 && IsSpace(p[6]))
+		{
+			const char* nameBegin = SkipSpaces(p + 6, lineEnd);
+			const char* nameEnd = lineEnd;
+			while (nameEnd > nameBegin && (IsSpace(nameEnd[-1]) || nameEnd[-1] == '\r'))
+				--nameEnd;
+			chunk.materialLibrary.assign(nameBegin, nameEnd);
+		}
+
+		p = lineEnd + 1;
+	}
+}
+
+int ObjImporter::ResolveIndex(int index, bool relative, size_t chunkBase, size_t count)
+{
+	if (!relative && index < 0)
+		return -1;
+
+	long long global = relative ? (long long)chunkBase + index : (long long)index;
+	if (global < 0 || global >= (long long)count)
+		return -1;
+	return (int)global;
+}
+
+bool ObjImporter::Parse(const std::string& fileName, unsigned int threads, size_t& cornerCount)
+{
+	mChunks.clear();
+	mMaterialLibrary.clear();
+	mMaterialNames.clear();
+
+	MappedFile file;
+	if (!file.Open(fileName))
+		return false;
+
+	const char* data = file.Data();
+	const char* dataEnd = data + file.Size();
+
+	// Split the file into line aligned chunks, one per worker thread
+	size_t maxChunks = threads > 0 ? threads : WorkerThreadCount();
+	size_t chunkCount = (std::max)((size_t)1, (std::min)(maxChunks, file.Size() / MinChunkSize));
+	mChunks.resize(chunkCount);
+
+	const char* chunkBegin = data;
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		const char* chunkEnd = (i + 1 == chunkCount) ? dataEnd : data + (file.Size() / chunkCount) * (i + 1);
+		if (chunkEnd < chunkBegin)
+			chunkEnd = chunkBegin;
+
+		if (chunkEnd < dataEnd)
+		{
+			const char* newLine = (const char*)memchr(chunkEnd, '\n', dataEnd - chunkEnd);
+			chunkEnd = newLine ? newLine + 1 : dataEnd;
+		}
+
+		mChunks[i].begin = chunkBegin;
+		mChunks[i].end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	// Parse the chunks in parallel
+	ParallelFor(chunkCount, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			ParseChunk(mChunks[i]);
+		}
+	});
+
+	cornerCount = 0;
+	for (const Chunk& chunk : mChunks)
+	{
+		if (!chunk.valid)
+		{
+			mChunks.clear();
+			return false;
+		}
+		cornerCount += chunk.corners.size();
+	}
+	return true;
+}
+
+bool ObjImporter::Merge(float* vertices, unsigned int* indices, size_t vertexOffset, size_t triangleOffset,
+	std::vector<unsigned int>& materialIndices)
+{
+	std::vector<Chunk> chunks;
+	chunks.swap(mChunks);
+	size_t chunkCount = chunks.size();
+
+	// Prefix sums for the global element offsets of each chunk
+	std::vector<size_t> positionBase(chunkCount + 1, 0);
+	std::vector<size_t> normalBase(chunkCount + 1, 0);
+	std::vector<size_t> texcoordBase(chunkCount + 1, 0);
+	std::vector<size_t> cornerBase(chunkCount + 1, 0);
+
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		if (!chunks[i].materialLibrary.empty())
+			mMaterialLibrary = chunks[i].materialLibrary;
+
+		positionBase[i + 1] = positionBase[i] + chunks[i].positions.size() / 3;
+		normalBase[i + 1] = normalBase[i] + chunks[i].normals.size() / 3;
+		texcoordBase[i + 1] = texcoordBase[i] + chunks[i].texcoords.size() / 2;
+		cornerBase[i + 1] = cornerBase[i] + chunks[i].corners.size();
+	}
+
+	size_t positionCount = positionBase[chunkCount];
+	size_t normalCount = normalBase[chunkCount];
+	size_t texcoordCount = texcoordBase[chunkCount];
+
+	// Merge the attribute streams
+	std::vector<float> positions(positionCount * 3);
+	std::vector<float> normals(normalCount * 3);
+	std::vector<float> texcoords(texcoordCount * 2);
+
+	ParallelFor(chunkCount, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const Chunk& chunk = chunks[i];
+			if (!chunk.positions.empty())
+				memcpy(&positions[positionBase[i] * 3], &chunk.positions[0], chunk.positions.size() * sizeof(float));
+			if (!chunk.normals.empty())
+				memcpy(&normals[normalBase[i] * 3], &chunk.normals[0], chunk.normals.size() * sizeof(float));
+			if (!chunk.texcoords.empty())
+				memcpy(&texcoords[texcoordBase[i] * 2], &chunk.texcoords[0], chunk.texcoords.size() * sizeof(float));
+		}
+	});
+
+	// Build the vertices, one per face corner
+	std::vector<char> chunkValid(chunkCount, 1);
+
+	ParallelFor(chunkCount, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const Chunk& chunk = chunks[i];
+			float* vertex = vertices + cornerBase[i] * 8;
+			unsigned int* chunkIndices = indices + cornerBase[i];
+
+			for (size_t c = 0; c < chunk.corners.size(); ++c, vertex += 8)
+			{
+				const Corner& corner = chunk.corners[c];
+
+				int v = ResolveIndex(corner.v, (corner.relativeMask & RELATIVE_V) != 0, positionBase[i], positionCount);
+				int vt = ResolveIndex(corner.vt, (corner.relativeMask & RELATIVE_VT) != 0, texcoordBase[i], texcoordCount);
+				int vn = ResolveIndex(corner.vn, (corner.relativeMask & RELATIVE_VN) != 0, normalBase[i], normalCount);
+
+				if (v < 0)
+				{
+					chunkValid[i] = 0;
+					break;
+				}
+
+				memcpy(vertex, &positions[3 * v], 3 * sizeof(float));
+				if (vn >= 0)
+					memcpy(vertex + 3, &normals[3 * vn], 3 * sizeof(float));
+				else
+					vertex[3] = vertex[4] = vertex[5] = 0.0f;
+				if (vt >= 0)
+					memcpy(vertex + 6, &texcoords[2 * vt], 2 * sizeof(float));
+				else
+					vertex[6] = vertex[7] = 0.0f;
+
+				chunkIndices[c] = (unsigned int)(vertexOffset + cornerBase[i] + c);
+			}
+		}
+	});
+
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		if (!chunkValid[i])
+			return false;
+	}
+
+	// Material of every triangle, the chunks are walked in order so a
+	// material set at the end of one chunk carries over into the next
+	bool hasMaterials = !materialIndices.empty();
+	for (size_t i = 0; i < chunkCount; ++i)
+		hasMaterials |= !chunks[i].materialNames.empty();
+
+	if (hasMaterials)
+	{
+		materialIndices.resize(triangleOffset, NoMaterial);
+
+		std::map<std::string, unsigned int> nameIndices;
+		unsigned int current = NoMaterial;
+		for (size_t i = 0; i < chunkCount; ++i)
+		{
+			const Chunk& chunk = chunks[i];
+
+			std::vector<unsigned int> slots(chunk.materialNames.size());
+			for (size_t m = 0; m < chunk.materialNames.size(); ++m)
+			{
+				auto inserted = nameIndices.insert(std::make_pair(chunk.materialNames[m], (unsigned int)mMaterialNames.size()));
+				if (inserted.second)
+					mMaterialNames.push_back(chunk.materialNames[m]);
+				slots[m] = inserted.first->second;
+			}
+
+			for (int slot : chunk.triangleMaterials)
+			{
+				materialIndices.push_back(slot < 0 ? current : slots[slot]);
+			}
+
+			if (!slots.empty())
+				current = slots.back();
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// ObjImporter
+// Multithreaded .obj parser used by ObjLoader.
+// The file is memory mapped and split into line aligned chunks. Each chunk
+// parses its positions, normals, texcoords and faces on its own thread and
+// the results are merged into presized vertex and index vectors.
+// Polygons are triangulated as fans, one vertex is written per face corner.
+// Vertices are 8 floats, position, normal and texcoord, the layout of Vertex,
+// missing normals and texcoords are written as 0.
+// usemtl switches are kept per triangle in materialIndices as indices
+// into GetMaterialNames(), the names are resolved by the caller.
+// usage:
+// importer.Import("..\\Assets\\teapot.obj", meshData.Vertices, meshData.Indices, meshData.MaterialIndices);
+class ObjImporter
+{
+public:
+	// Material index of the faces before the first usemtl
+	static const unsigned int NoMaterial = 0xffffffff;
+
+	ObjImporter();
+	~ObjImporter();
+
+	// Appends the vertices and indices of fileName, materialIndices is only filled if the
+	// file uses materials. The file is split into at most threads chunks, 0 is one per
+	// hardware thread.
+	template<typename VertexType>
+	bool Import(const std::string& fileName, std::vector<VertexType>& vertices, std::vector<unsigned int>& indices,
+		std::vector<unsigned int>& materialIndices, unsigned int threads = 0)
+	{
+		static_assert(sizeof(VertexType) == 8 * sizeof(float), "ObjImporter writes 8 floats per vertex");
+
+		size_t cornerCount = 0;
+		if (!Parse(fileName, threads, cornerCount))
+			return false;
+
+		size_t vertexOffset = vertices.size();
+		size_t indexOffset = indices.size();
+		vertices.resize(vertexOffset + cornerCount);
+		indices.resize(indexOffset + cornerCount);
+		return Merge((float*)(vertices.data() + vertexOffset), indices.data() + indexOffset, vertexOffset, indexOffset / 3,
+			materialIndices);
+	}
+
+	// mtllib file name referenced by the last imported file, empty if none
+	const std::string& GetMaterialLibrary() const { return mMaterialLibrary; }
+
+	// usemtl names of the last imported file, in order of first use
+	const std::vector<std::string>& GetMaterialNames() const { return mMaterialNames; }
+
+private:
+
+	// Face corner as read from the file, zero based. Negative (relative) indices
+	// are stored relative to the chunk start and flagged in relativeMask,
+	// they are resolved when the chunks are merged. Missing indices are -1.
+	struct Corner
+	{
+		int v;
+		int vt;
+		int vn;
+		int relativeMask;
+	};
+
+	enum
+	{
+		RELATIVE_V = 1,
+		RELATIVE_VT = 2,
+		RELATIVE_VN = 4
+	};
+
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+
+		std::vector<float> positions;
+		std::vector<float> normals;
+		std::vector<float> texcoords;
+		std::vector<Corner> corners;
+
+		// usemtl names of the chunk and the slot of every triangle in them,
+		// -1 until the chunk has its first usemtl, the material continues from the previous chunk
+		std::vector<std::string> materialNames;
+		std::vector<int> triangleMaterials;
+
+		std::string materialLibrary;
+		bool valid;
+	};
+
+	// Maps fileName and parses its chunks, cornerCount is the number of vertices Merge writes
+	bool Parse(const std::string& fileName, unsigned int threads, size_t& cornerCount);
+
+	// Writes the parsed corners as 8 float vertices numbered from vertexOffset and the
+	// materials of the triangles after the first triangleOffset ones, frees the chunks
+	bool Merge(float* vertices, unsigned int* indices, size_t vertexOffset, size_t triangleOffset,
+		std::vector<unsigned int>& materialIndices);
+
+	// Parse a single chunk of lines
+	static void ParseChunk(Chunk& chunk);
+
+	// Resolve a parsed index to a global zero based index, -1 if missing or out of range
+	static int ResolveIndex(int index, bool relative, size_t chunkBase, size_t count);
+
+	std::vector<Chunk> mChunks;
+	std::string mMaterialLibrary;
+	std::vector<std::string> mMaterialNames;
+};
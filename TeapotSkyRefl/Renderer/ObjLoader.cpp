@@ -1,16 +1,16 @@
-#include "ObjLoader.h"
-
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
-#include "tiny_obj_loader.h"
+#include "ObjLoader.h"
 
 #include <iostream>
 
-#include "TextureManager.h"
+#include "ObjImporter.h"
 
 ObjLoader* ObjLoader::mInstance = 0;
+static std::mutex InstanceMutex;
 
 ObjLoader* ObjLoader::Instance()
 {
+	std::lock_guard<std::mutex> lock(InstanceMutex);
 	if (mInstance == 0)
 	{
 		mInstance = new ObjLoader();
@@ -32,6 +32,104 @@ ObjLoader::~ObjLoader()
 }
 
 bool ObjLoader::LoadToMesh(std::string fileName, std::string mtlBaseDir, MeshData& meshData)
+{
+	// import into a separate mesh so the welded result can be appended to meshData
+	MeshData imported;
+	ObjImporter importer;
+	if (!importer.Import(fileName, imported.Vertices, imported.Indices, imported.MaterialIndices))
+		return false;
+
+	WeldStats weldStats;
+	MeshWelder::Weld(imported, MeshWelder::WELD_AUTO, &weldStats);
+	{
+		std::lock_guard<std::mutex> lock(mStatsMutex);
+		mLastWeldStats = weldStats;
+	}
+
+	char msg[256];
+	snprintf(msg, sizeof(msg), "ObjLoader: %s welded %zu -> %zu vertices, %zu bytes saved, %.2f ms\n",
+		fileName.c_str(), weldStats.verticesBefore, weldStats.verticesAfter, weldStats.bytesSaved, weldStats.timeMs);
+	OutputDebugStringA(msg);
+
+	std::vector<tinyobj::material_t> materials;
+	std::map<std::string, int> materialMap;
+	if (!importer.GetMaterialLibrary().empty())
+	{
+		std::ifstream mtlStream(mtlBaseDir + importer.GetMaterialLibrary());
+		if (mtlStream)
+		{
+			std::string warning;
+			tinyobj::LoadMtl(&materialMap, &materials, &mtlStream, &warning);
+			if (!warning.empty()) {
+				std::cerr << warning << std::endl;
+			}
+		}
+	}
+
+	// usemtl names to material ids, faces without a known material use a default one after the library materials
+	UINT defaultMaterial = (UINT)materials.size();
+	bool useDefault = materials.empty();
+	if (!imported.MaterialIndices.empty())
+	{
+		const std::vector<std::string>& names = importer.GetMaterialNames();
+		std::vector<UINT> ids(names.size(), defaultMaterial);
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			auto it = materialMap.find(names[i]);
+			if (it != materialMap.end())
+				ids[i] = (UINT)it->second;
+		}
+
+		for (UINT& material : imported.MaterialIndices)
+		{
+			material = material == ObjImporter::NoMaterial ? defaultMaterial : ids[material];
+			useDefault |= material == defaultMaterial;
+		}
+	}
+
+	// the analysis is left to -bench meshopt, it costs more than the optimization
+	OptimizeMesh(imported);
+
+	// material ids continue after the ones already in meshData
+	UINT baseMaterial = meshData.materials.empty() ? 0 : meshData.materials.rbegin()->first + 1;
+	UINT baseVertex = (UINT)meshData.Vertices.size();
+	UINT baseIndex = (UINT)meshData.Indices.size();
+	UINT baseMeshlet = (UINT)meshData.Meshlets.size();
+	meshData.Vertices.insert(meshData.Vertices.end(), imported.Vertices.begin(), imported.Vertices.end());
+	meshData.Indices.reserve(meshData.Indices.size() + imported.Indices.size());
+	for (UINT index : imported.Indices)
+	{
+		meshData.Indices.push_back(baseVertex + index);
+	}
+	for (Meshlet meshlet : imported.Meshlets)
+	{
+		meshlet.indexOffset += baseIndex;
+		meshData.Meshlets.push_back(meshlet);
+	}
+	for (Submesh submesh : imported.Submeshes)
+	{
+		submesh.materialId += baseMaterial;
+		submesh.indexOffset += baseIndex;
+		submesh.meshletOffset += baseMeshlet;
+		meshData.Submeshes.push_back(submesh);
+	}
+	if (baseMaterial != 0 || !imported.MaterialIndices.empty() || !meshData.MaterialIndices.empty())
+	{
+		meshData.MaterialIndices.resize(baseIndex / 3, 0);
+		if (imported.MaterialIndices.empty())
+			imported.MaterialIndices.assign(imported.Indices.size() / 3, 0);
+		for (UINT material : imported.MaterialIndices)
+			meshData.MaterialIndices.push_back(baseMaterial + material);
+	}
+
+	SetupMaterial(materials, mtlBaseDir, meshData, baseMaterial, useDefault);
+
+	meshData.world = XMMatrixIdentity();
+
+	return true;
+}
+
+bool ObjLoader::LoadToMeshTinyObj(std::string fileName, std::string mtlBaseDir, MeshData& meshData)
 {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -48,10 +146,13 @@ bool ObjLoader::LoadToMesh(std::string fileName, std::string mtlBaseDir, MeshDat
 		return false;
 	}
 
+	bool useDefault = materials.empty();
+
 	// Loop over shapes
 	for (size_t s = 0; s < shapes.size(); s++) {
 		// Loop over faces(polygon)
 		size_t index_offset = 0;
+		UINT base_vertex = (UINT)meshData.Vertices.size();
 		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
 			int fv = shapes[s].mesh.num_face_vertices[f];
 
@@ -89,42 +190,53 @@ bool ObjLoader::LoadToMesh(std::string fileName, std::string mtlBaseDir, MeshDat
 				vertex.Tex.x = tx;
 				vertex.Tex.y = ty;
 				meshData.Vertices.push_back(vertex);
-				meshData.Indices.push_back(index_offset + v);
+				meshData.Indices.push_back(base_vertex + index_offset + v);
 				
 
 			}
 			index_offset += fv;
 
-			// per-face material
+			// per-face material, faces without one use the default material after the library ones
 			if (!materials.empty())
 			{
-				// TODO support for per-face materials
-				// shapes[s].mesh.material_ids[f];
+				int material = shapes[s].mesh.material_ids[f];
+				useDefault |= material < 0;
+				for (int t = 2; t < fv; ++t)
+					meshData.MaterialIndices.push_back(material < 0 ? (UINT)materials.size() : (UINT)material);
 			}
 		}
 	}
 
-	if (!materials.empty())
+	GroupMeshByMaterial(meshData);
+
+	SetupMaterial(materials, mtlBaseDir, meshData, 0, useDefault);
+
+	meshData.world = XMMatrixIdentity();
+
+	return true;
+}
+
+void ObjLoader::SetupMaterial(const std::vector<tinyobj::material_t>& materials, const std::string& mtlBaseDir, MeshData& meshData,
+	UINT baseMaterial, bool useDefault)
+{
+	for (size_t i = 0; i < materials.size(); ++i)
 	{
 		Material mat;
-		tinyobj::material_t m = materials[0];
-		mat.diffuseTexture = mtlBaseDir + m.diffuse_texname;
-		TextureManager::Instance()->CreateTexture(mat.diffuseTexture);
+		const tinyobj::material_t& m = materials[i];
+		mat.diffuseTexture = m.diffuse_texname.empty() ? "" : mtlBaseDir + m.diffuse_texname;
 		mat.Diffuse = XMFLOAT4(m.diffuse[0], m.diffuse[1], m.diffuse[2], 1.0f);
 		mat.specExp = m.shininess;
 		mat.specIntensivity = 0.25f;
-		meshData.materials[0] = mat;
+		meshData.materials[baseMaterial + (UINT)i] = mat;
 	}
-	else {
+
+	if (useDefault)
+	{
 		Material mat;
 		mat.diffuseTexture = "";
 		mat.Diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 		mat.specExp = 250.0f;
 		mat.specIntensivity = 0.25f;
-		meshData.materials[0] = mat;
+		meshData.materials[baseMaterial + (UINT)materials.size()] = mat;
 	}
-
-	meshData.world = XMMatrixIdentity();
-
-	return true;
 }
@@ -2,12 +2,22 @@
 
 #include "Util.h"
 #include "Mesh.h"
+#include "MeshWelder.h"
+#include "tiny_obj_loader.h"
+
+#include <mutex>
 
 
 // ObjLoader
 // singleton class, usage:
 // ObjLoader::Instance()->LoadToMesh("..\\Assets\\bunny.obj",  "..\\Assets\\", meshData)
 // loads .obj file to MeshData object
+// LoadToMesh uses the multithreaded ObjImporter, welds identical vertices
+// into an indexed mesh and reorders it with MeshOptimizer, LoadToMeshTinyObj is the single threaded
+// tinyobjloader path kept for comparison.
+// Faces are grouped by material into submeshes, material ids are the indices of the .mtl materials,
+// continuing after the ids already in meshData. The textures of the materials are only named, the
+// caller creates them, so loading never touches the device and can run on several threads at once.
 class ObjLoader
 {
 public:
@@ -15,9 +25,26 @@ public:
 
 	bool LoadToMesh(std::string fileName, std::string mtlBaseDir, MeshData& meshData);
 
+	bool LoadToMeshTinyObj(std::string fileName, std::string mtlBaseDir, MeshData& meshData);
+
+	// Welding statistics of the last LoadToMesh call
+	WeldStats GetLastWeldStats()
+	{
+		std::lock_guard<std::mutex> lock(mStatsMutex);
+		return mLastWeldStats;
+	}
+
 private:
 	ObjLoader();
 	~ObjLoader();
 
+	// Fills meshData.materials from baseMaterial on with the library materials, and the
+	// default one after them if useDefault is set
+	void SetupMaterial(const std::vector<tinyobj::material_t>& materials, const std::string& mtlBaseDir, MeshData& meshData,
+		UINT baseMaterial, bool useDefault);
+
 	static ObjLoader* mInstance;
+
+	std::mutex mStatsMutex;
+	WeldStats mLastWeldStats;
 };
\ No newline at end of file
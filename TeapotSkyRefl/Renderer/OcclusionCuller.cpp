@@ -0,0 +1,384 @@
+#include "OcclusionCuller.h"
+#include "Parallel.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// nearest w a box corner may have and still be projected
+static const float MinBoxW = 1e-5f;
+
+// a full working layer
+static const uint32_t FullMask = 0xffffffffu;
+
+OcclusionCuller::OcclusionCuller() : mWidth(0), mHeight(0), mTilesX(0), mTilesY(0)
+{
+}
+
+OcclusionKernel OcclusionCuller::GetKernel(OcclusionKernel kernel)
+{
+	static const bool avx2 = CpuSupportsAvx2();
+
+	if (kernel == OCCLUSION_KERNEL_AUTO)
+		return avx2 ? OCCLUSION_KERNEL_AVX2 : OCCLUSION_KERNEL_SSE2;
+
+	if (kernel == OCCLUSION_KERNEL_AVX2 && !avx2)
+		return OCCLUSION_KERNEL_SSE2;
+
+	return kernel;
+}
+
+void OcclusionCuller::Resize(int width, int height)
+{
+	mTilesX = std::max(1, (width + TileWidth - 1) / TileWidth);
+	mTilesY = std::max(1, (height + TileHeight - 1) / TileHeight);
+	mWidth = mTilesX * TileWidth;
+	mHeight = mTilesY * TileHeight;
+
+	mZMax0.resize(mTilesX * mTilesY);
+	mZMax1.resize(mTilesX * mTilesY);
+	mMasks.resize(mTilesX * mTilesY);
+	Clear();
+}
+
+void OcclusionCuller::Clear()
+{
+	std::fill(mZMax0.begin(), mZMax0.end(), 1.0f);
+	std::fill(mZMax1.begin(), mZMax1.end(), 0.0f);
+	std::fill(mMasks.begin(), mMasks.end(), 0u);
+	mTriangles.clear();
+	mStats = OcclusionStats();
+}
+
+//////////// Triangle setup
+
+void OcclusionCuller::AddOccluder(const float* positions, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+	const float toClip[16])
+{
+	// screen x, y and depth of the vertices, w <= 0 for vertices behind the near plane
+	std::vector<float> screen(vertexCount * 4);
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		const float* p = positions + i * 3;
+		float clip[4];
+		for (int c = 0; c < 4; ++c)
+		{
+			clip[c] = p[0] * toClip[c] + p[1] * toClip[4 + c] + p[2] * toClip[8 + c] + toClip[12 + c];
+		}
+
+		float* s = &screen[i * 4];
+		if (clip[2] < 0.0f || clip[3] <= 0.0f)
+		{
+			s[3] = 0.0f;
+			continue;
+		}
+
+		float invW = 1.0f / clip[3];
+		s[0] = (clip[0] * invW * 0.5f + 0.5f) * mWidth;
+		s[1] = (0.5f - clip[1] * invW * 0.5f) * mHeight;
+		s[2] = clip[2] * invW;
+		s[3] = 1.0f;
+	}
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		mStats.occluderTriangles++;
+
+		if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount)
+			continue;
+
+		const float* v[3] = { &screen[indices[i] * 4], &screen[indices[i + 1] * 4], &screen[indices[i + 2] * 4] };
+		if (v[0][3] <= 0.0f || v[1][3] <= 0.0f || v[2][3] <= 0.0f)
+			continue;
+
+		// clockwise on screen with y down is a positive area
+		float area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[2][0] - v[0][0]) * (v[1][1] - v[0][1]);
+		if (!(area > 0.0f))
+			continue;
+
+		float minX = std::min(v[0][0], std::min(v[1][0], v[2][0]));
+		float maxX = std::max(v[0][0], std::max(v[1][0], v[2][0]));
+		float minY = std::min(v[0][1], std::min(v[1][1], v[2][1]));
+		float maxY = std::max(v[0][1], std::max(v[1][1], v[2][1]));
+		if (maxX <= 0.0f || maxY <= 0.0f || minX >= (float)mWidth || minY >= (float)mHeight)
+			continue;
+
+		Triangle triangle;
+		for (int e = 0; e < 3; ++e)
+		{
+			const float* a = v[e];
+			const float* b = v[(e + 1) % 3];
+			float ex = a[1] - b[1];
+			float ey = b[0] - a[0];
+			// inside by half a pixel, so the pixel is covered whole
+			triangle.edges[e][0] = ex;
+			triangle.edges[e][1] = ey;
+			triangle.edges[e][2] = -(ex * a[0] + ey * a[1]) - 0.5f * (std::fabs(ex) + std::fabs(ey));
+		}
+
+		float dz1 = v[1][2] - v[0][2];
+		float dz2 = v[2][2] - v[0][2];
+		float dzdx = (dz1 * (v[2][1] - v[0][1]) - dz2 * (v[1][1] - v[0][1])) / area;
+		float dzdy = (dz2 * (v[1][0] - v[0][0]) - dz1 * (v[2][0] - v[0][0])) / area;
+		triangle.depth[0] = v[0][2] - dzdx * v[0][0] - dzdy * v[0][1];
+		triangle.depth[1] = dzdx;
+		triangle.depth[2] = dzdy;
+		triangle.minDepth = std::min(v[0][2], std::min(v[1][2], v[2][2]));
+		triangle.maxDepth = std::max(v[0][2], std::max(v[1][2], v[2][2]));
+
+		triangle.tileMinX = (int)std::max(minX, 0.0f) / TileWidth;
+		triangle.tileMaxX = (int)std::min(maxX, (float)(mWidth - 1)) / TileWidth;
+		triangle.tileMinY = (int)std::max(minY, 0.0f) / TileHeight;
+		triangle.tileMaxY = (int)std::min(maxY, (float)(mHeight - 1)) / TileHeight;
+
+		mTriangles.push_back(triangle);
+		mStats.rasterizedTriangles++;
+	}
+}
+
+//////////// Rasterization
+
+static uint32_t TileCoverageScalar(const float edges[3][3], float x, float y)
+{
+	uint32_t mask = 0;
+	for (int row = 0; row < OcclusionCuller::TileHeight; ++row)
+	{
+		float py = y + (float)row;
+		for (int column = 0; column < OcclusionCuller::TileWidth; ++column)
+		{
+			float px = x + (float)column;
+			bool inside = true;
+			for (int e = 0; e < 3; ++e)
+			{
+				inside = inside && edges[e][0] * px + edges[e][1] * py + edges[e][2] >= 0.0f;
+			}
+			if (inside)
+			{
+				mask |= 1u << (row * 8 + column);
+			}
+		}
+	}
+	return mask;
+}
+
+static uint32_t TileCoverageSSE2(const float edges[3][3], float x, float y)
+{
+	const __m128 zero = _mm_setzero_ps();
+	__m128 xs[2];
+	xs[0] = _mm_add_ps(_mm_set1_ps(x), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+	xs[1] = _mm_add_ps(_mm_set1_ps(x), _mm_setr_ps(4.0f, 5.0f, 6.0f, 7.0f));
+
+	uint32_t mask = 0;
+	for (int row = 0; row < OcclusionCuller::TileHeight; ++row)
+	{
+		__m128 py = _mm_set1_ps(y + (float)row);
+		for (int half = 0; half < 2; ++half)
+		{
+			__m128 inside = _mm_cmpeq_ps(zero, zero);
+			for (int e = 0; e < 3; ++e)
+			{
+				__m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edges[e][0]), xs[half]),
+					_mm_mul_ps(_mm_set1_ps(edges[e][1]), py)), _mm_set1_ps(edges[e][2]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(value, zero));
+			}
+			mask |= (uint32_t)_mm_movemask_ps(inside) << (row * 8 + half * 4);
+		}
+	}
+	return mask;
+}
+
+AVX2_TARGET static uint32_t TileCoverageAVX2(const float edges[3][3], float x, float y)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 xs = _mm256_add_ps(_mm256_set1_ps(x), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+	__m256 a[3], b[3], c[3];
+	for (int e = 0; e < 3; ++e)
+	{
+		a[e] = _mm256_mul_ps(_mm256_set1_ps(edges[e][0]), xs);
+		b[e] = _mm256_set1_ps(edges[e][1]);
+		c[e] = _mm256_set1_ps(edges[e][2]);
+	}
+
+	uint32_t mask = 0;
+	for (int row = 0; row < OcclusionCuller::TileHeight; ++row)
+	{
+		__m256 py = _mm256_set1_ps(y + (float)row);
+		__m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_add_ps(a[0], _mm256_mul_ps(b[0], py)), c[0]), zero, _CMP_GE_OQ);
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_add_ps(a[1], _mm256_mul_ps(b[1], py)), c[1]), zero, _CMP_GE_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_add_ps(a[2], _mm256_mul_ps(b[2], py)), c[2]), zero, _CMP_GE_OQ));
+		mask |= (uint32_t)_mm256_movemask_ps(inside) << (row * 8);
+	}
+	return mask;
+}
+
+void OcclusionCuller::Rasterize(unsigned int threads, OcclusionKernel kernel)
+{
+	CoverageFunction coverage = TileCoverageScalar;
+	switch (GetKernel(kernel))
+	{
+	case OCCLUSION_KERNEL_AVX2:
+		coverage = TileCoverageAVX2;
+		break;
+	case OCCLUSION_KERNEL_SSE2:
+		coverage = TileCoverageSSE2;
+		break;
+	default:
+		break;
+	}
+
+	// bands of tile rows, every thread walks all triangles but writes only its rows
+	ParallelFor(mTilesY, 2, threads, [&](size_t begin, size_t end) { RasterizeRows((int)begin, (int)end, coverage); });
+}
+
+void OcclusionCuller::RasterizeRows(int tileBegin, int tileEnd, CoverageFunction coverage)
+{
+	for (const Triangle& triangle : mTriangles)
+	{
+		int tileMinY = std::max(triangle.tileMinY, tileBegin);
+		int tileMaxY = std::min(triangle.tileMaxY, tileEnd - 1);
+		for (int tileY = tileMinY; tileY <= tileMaxY; ++tileY)
+		{
+			float top = (float)(tileY * TileHeight);
+			float bottom = top + (float)TileHeight;
+			float depthY = triangle.depth[2] * (triangle.depth[2] > 0.0f ? bottom : top);
+
+			for (int tileX = triangle.tileMinX; tileX <= triangle.tileMaxX; ++tileX)
+			{
+				int tile = tileY * mTilesX + tileX;
+				if (triangle.minDepth >= mZMax0[tile])
+					continue;
+
+				float left = (float)(tileX * TileWidth);
+				uint32_t mask = coverage(triangle.edges, left + 0.5f, top + 0.5f);
+				if (mask == 0)
+					continue;
+
+				// farthest depth of the plane over the tile, no farther than the triangle
+				float right = left + (float)TileWidth;
+				float depth = triangle.depth[0] + triangle.depth[1] * (triangle.depth[1] > 0.0f ? right : left) + depthY;
+				depth = std::min(depth, triangle.maxDepth);
+
+				float& zMax0 = mZMax0[tile];
+				float& zMax1 = mZMax1[tile];
+				uint32_t& layerMask = mMasks[tile];
+
+				// a working layer far nearer than the triangle would be pushed back
+				// more than it gains, start it over
+				if (depth - zMax1 > zMax0 - zMax1)
+				{
+					zMax1 = 0.0f;
+					layerMask = 0;
+				}
+
+				zMax1 = std::max(zMax1, depth);
+				layerMask |= mask;
+				if (layerMask == FullMask)
+				{
+					zMax0 = std::min(zMax0, zMax1);
+					zMax1 = 0.0f;
+					layerMask = 0;
+				}
+			}
+		}
+	}
+}
+
+//////////// Queries
+
+bool OcclusionCuller::IsVisible(const float boxMin[3], const float boxMax[3], const float viewProj[16])
+{
+	mStats.tests++;
+	if (mTilesX == 0)
+		return true;
+
+	float minX = FLT_MAX, maxX = -FLT_MAX;
+	float minY = FLT_MAX, maxY = -FLT_MAX;
+	float minZ = FLT_MAX;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		float p[3] =
+		{
+			(corner & 1) ? boxMax[0] : boxMin[0],
+			(corner & 2) ? boxMax[1] : boxMin[1],
+			(corner & 4) ? boxMax[2] : boxMin[2]
+		};
+		float clip[4];
+		for (int c = 0; c < 4; ++c)
+		{
+			clip[c] = p[0] * viewProj[c] + p[1] * viewProj[4 + c] + p[2] * viewProj[8 + c] + viewProj[12 + c];
+		}
+
+		// crossing the near plane
+		if (clip[3] <= MinBoxW || clip[2] < 0.0f)
+			return true;
+
+		float invW = 1.0f / clip[3];
+		float x = (clip[0] * invW * 0.5f + 0.5f) * mWidth;
+		float y = (0.5f - clip[1] * invW * 0.5f) * mHeight;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		minZ = std::min(minZ, clip[2] * invW);
+	}
+
+	// off screen boxes are left to frustum culling
+	if (maxX < 0.0f || maxY < 0.0f || minX >= (float)mWidth || minY >= (float)mHeight)
+		return true;
+
+	// pixels the box touches
+	int x0 = (int)std::max(minX, 0.0f);
+	int x1 = (int)std::min(maxX, (float)(mWidth - 1));
+	int y0 = (int)std::max(minY, 0.0f);
+	int y1 = (int)std::min(maxY, (float)(mHeight - 1));
+
+	for (int tileY = y0 / TileHeight; tileY <= y1 / TileHeight; ++tileY)
+	{
+		int rowBegin = std::max(y0 - tileY * TileHeight, 0);
+		int rowEnd = std::min(y1 - tileY * TileHeight, TileHeight - 1);
+		for (int tileX = x0 / TileWidth; tileX <= x1 / TileWidth; ++tileX)
+		{
+			int tile = tileY * mTilesX + tileX;
+			if (minZ > mZMax0[tile])
+				continue;
+
+			if (minZ > mZMax1[tile])
+			{
+				int columnBegin = std::max(x0 - tileX * TileWidth, 0);
+				int columnEnd = std::min(x1 - tileX * TileWidth, TileWidth - 1);
+				uint32_t columns = (0xffu >> (TileWidth - 1 - columnEnd)) & (0xffu << columnBegin);
+				uint32_t boxMask = 0;
+				for (int row = rowBegin; row <= rowEnd; ++row)
+				{
+					boxMask |= columns << (row * 8);
+				}
+				if ((boxMask & ~mMasks[tile]) == 0)
+					continue;
+			}
+
+			return true;
+		}
+	}
+
+	mStats.occluded++;
+	return false;
+}
+
+float OcclusionCuller::GetPixelDepth(int x, int y) const
+{
+	int tile = (y / TileHeight) * mTilesX + x / TileWidth;
+	uint32_t bit = 1u << ((y % TileHeight) * 8 + x % TileWidth);
+	if (mMasks[tile] & bit)
+		return std::min(mZMax0[tile], mZMax1[tile]);
+	return mZMax0[tile];
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// OcclusionCuller
+// Software occlusion culling in the style of masked occlusion culling: a few occluder
+// meshes are rasterized on the CPU into a low resolution depth buffer, then the boxes
+// of the scene objects are tested against it before they are drawn.
+// The buffer is made of 8x4 pixel tiles. A tile keeps no per pixel depth but two
+// layers: zMax0, the farthest depth of the whole tile, and a working layer of the
+// pixels in its coverage mask with their farthest depth zMax1. A triangle adds its
+// coverage to the working layer, which replaces zMax0 once it covers the tile; a
+// working layer much nearer than the triangle is dropped first. Depth is z / w in
+// [0, 1], nearer is smaller.
+// Triangles are set up as they are added, front faces only (clockwise on screen, as
+// D3D draws them), and those crossing the near plane are left out. A pixel is covered
+// when the triangle covers all of it, so occluders never reach beyond their edges. The
+// tiles are rasterized in bands of tile rows over the worker threads, the coverage of
+// a row of 8 pixels at once with AVX2, 4 with SSE2 or a pixel at a time; the kernels
+// give the same buffer.
+// IsVisible projects a box and compares its nearest depth with the tiles it covers:
+// a tile hides it when the box is behind zMax0, or behind zMax1 with all its pixels in
+// the tile in the working layer. Boxes crossing the near plane are visible.
+// Matrices are 4x4 row major in the row vector convention of DirectXMath.
+// Only the standard library and SSE2/AVX2 intrinsics are used.
+// usage:
+// culler.Resize(256, 128);
+// culler.Clear();
+// culler.AddOccluder(positions, vertexCount, indices, indexCount, worldViewProj);
+// culler.Rasterize();
+// if (culler.IsVisible(boxMin, boxMax, viewProj)) ...
+
+enum OcclusionKernel
+{
+	OCCLUSION_KERNEL_AUTO = 0,	// best kernel the CPU supports
+	OCCLUSION_KERNEL_SCALAR,
+	OCCLUSION_KERNEL_SSE2,
+	OCCLUSION_KERNEL_AVX2
+};
+
+struct OcclusionStats
+{
+	OcclusionStats() : occluderTriangles(0), rasterizedTriangles(0), tests(0), occluded(0) {}
+
+	uint32_t occluderTriangles;		// added
+	uint32_t rasterizedTriangles;	// front facing, in front of the near plane and on screen
+	uint32_t tests;
+	uint32_t occluded;
+};
+
+class OcclusionCuller
+{
+public:
+	static const int TileWidth = 8;
+	static const int TileHeight = 4;
+
+	OcclusionCuller();
+
+	// size of the depth buffer in pixels, rounded up to whole tiles
+	void Resize(int width, int height);
+	int GetWidth() const { return mWidth; }
+	int GetHeight() const { return mHeight; }
+
+	// empties the depth buffer, drops the occluders and resets the stats
+	void Clear();
+
+	// Sets up the triangles of an occluder, positions are 3 floats each in the space
+	// toClip transforms to clip space
+	void AddOccluder(const float* positions, size_t vertexCount, const uint32_t* indices, size_t indexCount, const float toClip[16]);
+
+	// Rasterizes the occluders added since Clear, threads 0 is one per hardware thread
+	void Rasterize(unsigned int threads = 0, OcclusionKernel kernel = OCCLUSION_KERNEL_AUTO);
+
+	// false when the box, in the space viewProj transforms to clip space, is hidden
+	bool IsVisible(const float boxMin[3], const float boxMax[3], const float viewProj[16]);
+
+	// farthest depth the buffer allows at a pixel, 1 where nothing was drawn
+	float GetPixelDepth(int x, int y) const;
+
+	const OcclusionStats& GetStats() const { return mStats; }
+
+	// Resolves OCCLUSION_KERNEL_AUTO to the kernel used on this CPU
+	static OcclusionKernel GetKernel(OcclusionKernel kernel = OCCLUSION_KERNEL_AUTO);
+
+private:
+	// coverage mask of a tile, bit x + 8 y set for the pixels whose centers are at
+	// a x + b y + c >= 0 of all three edges, x and y of the tile's top left pixel center
+	typedef uint32_t(*CoverageFunction)(const float edges[3][3], float x, float y);
+
+	// screen space triangle with its edges and depth plane
+	struct Triangle
+	{
+		float edges[3][3];		// a, b, c of a x + b y + c >= 0 inside, moved in by half a pixel
+		float depth[3];			// z = depth[0] + depth[1] x + depth[2] y
+		float minDepth, maxDepth;
+		int tileMinX, tileMaxX, tileMinY, tileMaxY;	// inclusive
+	};
+
+	void RasterizeRows(int tileBegin, int tileEnd, CoverageFunction coverage);
+
+	int mWidth, mHeight;
+	int mTilesX, mTilesY;
+
+	// by tile
+	std::vector<float> mZMax0;
+	std::vector<float> mZMax1;
+	std::vector<uint32_t> mMasks;
+
+	std::vector<Triangle> mTriangles;
+	OcclusionStats mStats;
+};
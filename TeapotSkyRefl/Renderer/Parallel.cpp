@@ -0,0 +1,113 @@
+#include "Parallel.h"
+
+WorkerPool& WorkerPool::Instance()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+WorkerPool::WorkerPool() : mStopping(false)
+{
+	unsigned int workerCount = WorkerThreadCount() - 1;
+	for (unsigned int i = 0; i < workerCount; ++i)
+	{
+		mWorkers.push_back(std::thread(&WorkerPool::WorkerMain, this));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWorkAvailable.notify_all();
+
+	for (std::thread& worker : mWorkers)
+	{
+		worker.join();
+	}
+}
+
+size_t WorkerPool::Take(Batch& batch)
+{
+	size_t index = batch.next++;
+	if (batch.next == batch.count)
+	{
+		mBatches.erase(std::find(mBatches.begin(), mBatches.end(), &batch));
+	}
+	return index;
+}
+
+void WorkerPool::Execute(Batch& batch, size_t index)
+{
+	(*batch.job)(index);
+
+	// the caller may return as soon as done reaches count, batch is not touched after that
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (++batch.done == batch.count)
+		mBatchDone.notify_all();
+}
+
+void WorkerPool::Run(size_t count, const std::function<void(size_t)>& job)
+{
+	if (count == 0)
+		return;
+
+	if (count == 1 || mWorkers.empty())
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			job(i);
+		}
+		return;
+	}
+
+	Batch batch = { &job, count, 0, 0 };
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mBatches.push_back(&batch);
+	}
+	if (count - 1 < mWorkers.size())
+	{
+		for (size_t i = 1; i < count; ++i)
+		{
+			mWorkAvailable.notify_one();
+		}
+	}
+	else
+	{
+		mWorkAvailable.notify_all();
+	}
+
+	// the caller takes its own indices too, those no worker got to
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (batch.next < batch.count)
+	{
+		size_t index = Take(batch);
+		lock.unlock();
+		Execute(batch, index);
+		lock.lock();
+	}
+	mBatchDone.wait(lock, [&batch]() { return batch.done == batch.count; });
+}
+
+void WorkerPool::WorkerMain()
+{
+	for (;;)
+	{
+		Batch* batch;
+		size_t index;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWorkAvailable.wait(lock, [this]() { return mStopping || !mBatches.empty(); });
+			if (mStopping)
+				break;
+
+			batch = mBatches.front();
+			index = Take(*batch);
+		}
+
+		Execute(*batch, index);
+	}
+}
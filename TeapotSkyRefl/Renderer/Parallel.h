@@ -0,0 +1,101 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Parallel helpers
+// ParallelFor splits [0, count) into contiguous ranges, one per hardware thread,
+// and calls func(begin, end) for each range. The calling thread runs ranges itself
+// and returns when every range is done. The overload taking maxThreads uses at most
+// that many threads, 0 is one per hardware thread.
+// The ranges run on WorkerPool, one worker per hardware thread but the calling one,
+// started on the first ParallelFor and kept until exit, so per frame work does not
+// create threads. Any thread may call ParallelFor, also from inside a range: the caller
+// takes ranges of its own call until none are left, so it never waits on a busy pool.
+// usage:
+// ParallelFor(vertices.size(), 4096, [&](size_t begin, size_t end) { ... });
+
+inline unsigned int WorkerThreadCount()
+{
+	unsigned int count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+class WorkerPool
+{
+public:
+	static WorkerPool& Instance();
+
+	// Calls job(i) for every i in [0, count) on the workers and the calling thread,
+	// returns when all are done
+	void Run(size_t count, const std::function<void(size_t)>& job);
+
+	size_t GetWorkerCount() const { return mWorkers.size(); }
+
+private:
+	struct Batch
+	{
+		const std::function<void(size_t)>* job;
+		size_t count;
+		size_t next;		// first index not taken
+		size_t done;
+	};
+
+	WorkerPool();
+	~WorkerPool();
+
+	void WorkerMain();
+
+	// next index of batch, removes it from the queue once every index is taken; mMutex held
+	size_t Take(Batch& batch);
+
+	// runs index of batch and counts it done
+	void Execute(Batch& batch, size_t index);
+
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mWorkAvailable;
+	std::condition_variable mBatchDone;
+	std::deque<Batch*> mBatches;		// with indices left to take
+	bool mStopping;
+};
+
+template<typename Func>
+void ParallelFor(size_t count, size_t minPerThread, unsigned int maxThreads, Func func)
+{
+	if (count == 0)
+		return;
+
+	size_t threadCount = maxThreads > 0 ? maxThreads : WorkerThreadCount();
+	if (minPerThread > 0)
+	{
+		threadCount = (std::min)(threadCount, (count + minPerThread - 1) / minPerThread);
+	}
+	threadCount = std::max<size_t>(threadCount, 1);
+
+	if (threadCount == 1)
+	{
+		func(size_t(0), count);
+		return;
+	}
+
+	size_t perThread = (count + threadCount - 1) / threadCount;
+	size_t rangeCount = (count + perThread - 1) / perThread;
+
+	WorkerPool::Instance().Run(rangeCount, [&](size_t range)
+	{
+		size_t begin = range * perThread;
+		func(begin, (std::min)(count, begin + perThread));
+	});
+}
+
+template<typename Func>
+void ParallelFor(size_t count, size_t minPerThread, Func func)
+{
+	ParallelFor(count, minPerThread, 0, func);
+}
@@ -0,0 +1,323 @@
+#include "RadianceHdr.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <emmintrin.h>
+
+// Largest image accepted, guards the allocation against broken headers
+static const size_t MaxPixels = size_t(1) << 28;
+
+// New style run length encoding is only used for widths in this range
+static const unsigned int MinRleWidth = 8;
+static const unsigned int MaxRleWidth = 0x7fff;
+
+// Buffered reads from the stream, so a scanline never costs one stream call per byte
+class RadianceHdr::Reader
+{
+public:
+	explicit Reader(std::istream& stream) : mStream(stream), mBuffer(64 * 1024), mPosition(0), mSize(0) {}
+
+	bool Byte(unsigned char& value)
+	{
+		if (mPosition == mSize && !Fill())
+			return false;
+		value = mBuffer[mPosition++];
+		return true;
+	}
+
+	bool Read(unsigned char* destination, size_t size)
+	{
+		while (size > 0)
+		{
+			if (mPosition == mSize && !Fill())
+				return false;
+			size_t count = std::min(size, mSize - mPosition);
+			memcpy(destination, &mBuffer[mPosition], count);
+			mPosition += count;
+			destination += count;
+			size -= count;
+		}
+		return true;
+	}
+
+	// text line without the newline, false at the end of the stream or on a line too long for a header
+	bool Line(std::string& line)
+	{
+		line.clear();
+		unsigned char c;
+		while (Byte(c))
+		{
+			if (c == '\n')
+			{
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				return true;
+			}
+			line.push_back((char)c);
+			if (line.size() > 4096)
+				return false;
+		}
+		return !line.empty();
+	}
+
+private:
+	bool Fill()
+	{
+		mStream.read((char*)mBuffer.data(), mBuffer.size());
+		mSize = (size_t)mStream.gcount();
+		mPosition = 0;
+		return mSize > 0;
+	}
+
+	std::istream& mStream;
+	std::vector<unsigned char> mBuffer;
+	size_t mPosition;
+	size_t mSize;
+};
+
+bool RadianceHdr::Read(const std::string& filename, HdrImage& image)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	return Read(file, image);
+}
+
+bool RadianceHdr::Read(std::istream& stream, HdrImage& image)
+{
+	image = HdrImage();
+
+	Reader reader(stream);
+	unsigned int width = 0, height = 0;
+	bool flipX = false, flipY = false;
+	if (!ReadHeader(reader, width, height, flipX, flipY))
+		return false;
+
+	image.width = width;
+	image.height = height;
+	image.pixels.resize((size_t)width * height * 4);
+
+	std::vector<unsigned char> rgbe((size_t)width * 4);
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		if (!ReadScanline(reader, width, rgbe.data()))
+		{
+			image = HdrImage();
+			return false;
+		}
+
+		unsigned int row = flipY ? height - 1 - y : y;
+		float* out = &image.pixels[(size_t)row * width * 4];
+		DecodeRgbe(rgbe.data(), width, out);
+
+		if (flipX)
+		{
+			for (unsigned int x = 0; x < width / 2; ++x)
+			{
+				std::swap_ranges(out + x * 4, out + x * 4 + 4, out + (width - 1 - x) * 4);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool RadianceHdr::ReadHeader(Reader& reader, unsigned int& width, unsigned int& height, bool& flipX, bool& flipY)
+{
+	std::string line;
+	if (!reader.Line(line) || line.compare(0, 2, "#?") != 0)
+		return false;
+
+	// variables up to the empty line, only the pixel format matters here
+	for (;;)
+	{
+		if (!reader.Line(line))
+			return false;
+		if (line.empty())
+			break;
+		if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe")
+			return false;
+	}
+
+	// resolution string, rows first: "-Y height +X width" is top to bottom, left to right
+	if (!reader.Line(line))
+		return false;
+
+	std::istringstream resolution(line);
+	std::string yAxis, xAxis;
+	if (!(resolution >> yAxis >> height >> xAxis >> width) ||
+		(yAxis != "-Y" && yAxis != "+Y") || (xAxis != "+X" && xAxis != "-X"))
+	{
+		return false;
+	}
+
+	if (width == 0 || height == 0 || (size_t)width * height > MaxPixels)
+		return false;
+
+	flipY = yAxis[0] == '+';
+	flipX = xAxis[0] == '-';
+	return true;
+}
+
+bool RadianceHdr::ReadScanline(Reader& reader, unsigned int width, unsigned char* rgbe)
+{
+	unsigned char head[4];
+	if (!reader.Read(head, 4))
+		return false;
+
+	bool newRle = width >= MinRleWidth && width <= MaxRleWidth && head[0] == 2 && head[1] == 2 && (head[2] & 0x80) == 0;
+	if (!newRle)
+	{
+		// flat pixels, (1, 1, 1, n) repeats the previous pixel n times, consecutive runs
+		// shift n by another 8 bits
+		unsigned int x = 0;
+		unsigned int shift = 0;
+		unsigned char* pixel = head;
+		for (;;)
+		{
+			if (pixel[0] == 1 && pixel[1] == 1 && pixel[2] == 1)
+			{
+				size_t run = (size_t)pixel[3] << shift;
+				if (x == 0 || shift > 16 || run > width - x)
+					return false;
+				for (size_t i = 0; i < run; ++i, ++x)
+				{
+					memcpy(rgbe + x * 4, rgbe + (x - 1) * 4, 4);
+				}
+				shift += 8;
+			}
+			else
+			{
+				memcpy(rgbe + x * 4, pixel, 4);
+				x++;
+				shift = 0;
+			}
+
+			if (x == width)
+				return true;
+
+			pixel = rgbe + x * 4;
+			if (!reader.Read(pixel, 4))
+				return false;
+		}
+	}
+
+	if ((((unsigned int)head[2] << 8) | head[3]) != width)
+		return false;
+
+	// new style, the four channels one after another, each as runs (count > 128)
+	// or literal spans (count <= 128)
+	unsigned char literal[128];
+	for (int channel = 0; channel < 4; ++channel)
+	{
+		unsigned int x = 0;
+		while (x < width)
+		{
+			unsigned char count;
+			if (!reader.Byte(count))
+				return false;
+
+			if (count > 128)
+			{
+				count -= 128;
+				unsigned char value;
+				if (count > width - x || !reader.Byte(value))
+					return false;
+				for (unsigned int i = 0; i < count; ++i, ++x)
+				{
+					rgbe[x * 4 + channel] = value;
+				}
+			}
+			else
+			{
+				if (count == 0 || count > width - x || !reader.Read(literal, count))
+					return false;
+				for (unsigned int i = 0; i < count; ++i, ++x)
+				{
+					rgbe[x * 4 + channel] = literal[i];
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// Radiance's colr_color: (mantissa + 0.5) * 2^(exponent - 136), exponent 0 is black
+void RadianceHdr::DecodeRgbeScalar(const unsigned char* rgbe, size_t count, float* rgba)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const unsigned char* in = rgbe + i * 4;
+		float* out = rgba + i * 4;
+
+		if (in[3] == 0)
+		{
+			out[0] = out[1] = out[2] = 0.0f;
+		}
+		else
+		{
+			float scale = ldexpf(1.0f, (int)in[3] - (128 + 8));
+			out[0] = (in[0] + 0.5f) * scale;
+			out[1] = (in[1] + 0.5f) * scale;
+			out[2] = (in[2] + 0.5f) * scale;
+		}
+		out[3] = 1.0f;
+	}
+}
+
+// The scale is built in the float exponent bits, exponents below 10 would be
+// denormal scales and give black like exponent 0 (under 2^-118 in the scalar path)
+void RadianceHdr::DecodeRgbe(const unsigned char* rgbe, size_t count, float* rgba)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i exponentBias = _mm_set1_epi32(128 + 8 - 127);
+	const __m128 rounding = _mm_set1_ps(0.5f);
+	const __m128 rgbMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	const __m128 alpha = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(rgbe + i * 4));
+		__m128i low = _mm_unpacklo_epi8(bytes, zero);
+		__m128i high = _mm_unpackhi_epi8(bytes, zero);
+
+		__m128i pixels[4] =
+		{
+			_mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+			_mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)
+		};
+
+		for (int k = 0; k < 4; ++k)
+		{
+			__m128i exponent = _mm_shuffle_epi32(pixels[k], _MM_SHUFFLE(3, 3, 3, 3));
+			__m128i scaleBits = _mm_slli_epi32(_mm_sub_epi32(exponent, exponentBias), 23);
+			scaleBits = _mm_and_si128(scaleBits, _mm_cmpgt_epi32(exponent, exponentBias));
+
+			__m128 value = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(pixels[k]), rounding), _mm_castsi128_ps(scaleBits));
+			_mm_storeu_ps(rgba + (i + k) * 4, _mm_or_ps(_mm_and_ps(value, rgbMask), alpha));
+		}
+	}
+
+	DecodeRgbeScalar(rgbe + i * 4, count - i, rgba + i * 4);
+}
+
+void RadianceHdr::DecodeRgbeToHalf(const unsigned char* rgbe, size_t count, uint16_t* rgba)
+{
+	const size_t ChunkPixels = 256;
+	float chunk[ChunkPixels * 4];
+
+	for (size_t i = 0; i < count; i += ChunkPixels)
+	{
+		size_t pixels = std::min(ChunkPixels, count - i);
+		DecodeRgbe(rgbe + i * 4, pixels, chunk);
+		ConvertFloatsToHalves(chunk, pixels * 4, rgba + i * 4);
+	}
+}
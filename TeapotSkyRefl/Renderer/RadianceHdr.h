@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+// RadianceHdr
+// Reader for Radiance .hdr (RGBE) images. The file is streamed through a
+// small buffer one scanline at a time, so only the decoded float image is
+// held in memory. Scanlines may be flat, old style run length encoded or new
+// style run length encoded per channel. RGBE pixels are decoded to float with
+// an SSE2 kernel, four pixels per iteration, checked against a scalar reference.
+// Only the standard library and intrinsics are used, so it runs on Linux as well.
+// usage:
+// HdrImage image;
+// if (RadianceHdr::Read("..\\Assets\\approaching_storm_1k.hdr", image)) { image.pixels ... }
+
+// RGBA32F pixels, top row first, alpha is always 1
+struct HdrImage
+{
+	HdrImage() : width(0), height(0) {}
+
+	unsigned int width;
+	unsigned int height;
+	std::vector<float> pixels;
+};
+
+class RadianceHdr
+{
+public:
+	static bool Read(const std::string& filename, HdrImage& image);
+	static bool Read(std::istream& stream, HdrImage& image);
+
+	// count RGBE pixels to RGBA32F
+	static void DecodeRgbe(const unsigned char* rgbe, size_t count, float* rgba);
+	static void DecodeRgbeScalar(const unsigned char* rgbe, size_t count, float* rgba);
+
+	// count RGBE pixels to RGBA16F
+	static void DecodeRgbeToHalf(const unsigned char* rgbe, size_t count, uint16_t* rgba);
+
+private:
+	class Reader;
+
+	static bool ReadHeader(Reader& reader, unsigned int& width, unsigned int& height, bool& flipX, bool& flipY);
+	static bool ReadScanline(Reader& reader, unsigned int width, unsigned char* rgbe);
+};
@@ -0,0 +1,222 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <numeric>
+
+uint64_t RenderQueue::MakeKey(uint32_t pass, uint32_t shader, uint32_t texture, uint32_t mesh, uint32_t material, float depth)
+{
+	const uint32_t depthMax = (1u << DepthBits) - 1;
+	uint32_t depthBits = (uint32_t)((std::min)((std::max)(depth, 0.0f), 1.0f) * depthMax + 0.5f);
+
+	uint64_t key = pass & ((1u << PassBits) - 1);
+	key = (key << ShaderBits) | (shader & ((1u << ShaderBits) - 1));
+	key = (key << TextureBits) | (texture & ((1u << TextureBits) - 1));
+	key = (key << MeshBits) | (mesh & ((1u << MeshBits) - 1));
+	key = (key << MaterialBits) | (material & ((1u << MaterialBits) - 1));
+	key = (key << DepthBits) | (std::min)(depthBits, depthMax);
+	return key;
+}
+
+void RenderQueue::RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, std::vector<uint64_t>& scratchKeys,
+	std::vector<uint32_t>& scratchValues)
+{
+	size_t count = keys.size();
+	if (count < 2)
+		return;
+
+	scratchKeys.resize(count);
+	scratchValues.resize(count);
+
+	// the histograms of all eight digits in one pass, the keys only change order
+	static const int Digits = 8;
+	std::vector<uint32_t> histograms(Digits * 256, 0);
+	for (uint64_t key : keys)
+	{
+		for (int digit = 0; digit < Digits; ++digit)
+		{
+			histograms[digit * 256 + ((key >> (digit * 8)) & 0xff)]++;
+		}
+	}
+
+	for (int digit = 0; digit < Digits; ++digit)
+	{
+		uint32_t* histogram = &histograms[digit * 256];
+		int shift = digit * 8;
+
+		// a digit all keys share leaves the order as it is
+		if (histogram[(keys[0] >> shift) & 0xff] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for (int bucket = 0; bucket < 256; ++bucket)
+		{
+			uint32_t bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint32_t position = histogram[(keys[i] >> shift) & 0xff]++;
+			scratchKeys[position] = keys[i];
+			scratchValues[position] = values[i];
+		}
+		keys.swap(scratchKeys);
+		values.swap(scratchValues);
+	}
+}
+
+void RenderQueue::Sort()
+{
+	mKeys.resize(mPackets.size());
+	mOrder.resize(mPackets.size());
+	for (uint32_t i = 0; i < mPackets.size(); ++i)
+	{
+		mKeys[i] = mPackets[i].key;
+		mOrder[i] = i;
+	}
+
+	RadixSort(mKeys, mOrder, mScratchKeys, mScratchOrder);
+	mSorted = true;
+}
+
+void RenderQueue::GetOrder(std::vector<uint32_t>& order) const
+{
+	if (mSorted)
+	{
+		order = mOrder;
+	}
+	else
+	{
+		order.resize(mPackets.size());
+		std::iota(order.begin(), order.end(), 0u);
+	}
+}
+
+void RenderQueue::Execute(RenderBackend& backend, RenderQueueStats* stats) const
+{
+	RenderQueueStats queueStats;
+	const DrawPacket* previous = NULL;
+	for (size_t i = 0; i < mPackets.size(); ++i)
+	{
+		const DrawPacket& packet = mPackets[mSorted ? mOrder[i] : i];
+
+		// a new pass starts with nothing bound
+		bool newPass = previous == NULL || packet.pass != previous->pass;
+		if (newPass)
+		{
+			backend.BeginPass(packet.pass);
+			queueStats.passes++;
+		}
+		if (newPass || packet.shader != previous->shader)
+		{
+			backend.SetShader(packet.shader);
+			queueStats.shaderBinds++;
+		}
+		if (newPass || packet.texture != previous->texture)
+		{
+			backend.SetTexture(packet.texture);
+			queueStats.textureBinds++;
+		}
+		bool newMesh = newPass || packet.mesh != previous->mesh;
+		if (newMesh)
+		{
+			backend.SetMesh(packet.mesh);
+			queueStats.meshBinds++;
+		}
+		if (newPass || packet.constants != previous->constants)
+		{
+			backend.SetConstants(packet.constants);
+			queueStats.constantsBinds++;
+		}
+		if (newMesh || packet.material != previous->material)
+		{
+			backend.SetMaterial(packet.mesh, packet.material);
+			queueStats.materialBinds++;
+		}
+
+		backend.Draw(packet);
+		queueStats.draws++;
+		previous = &packet;
+	}
+
+	uint32_t binds = queueStats.shaderBinds + queueStats.textureBinds + queueStats.meshBinds + queueStats.constantsBinds +
+		queueStats.materialBinds;
+	queueStats.bindsAvoided = queueStats.draws * 5 - binds;
+	if (stats)
+		*stats = queueStats;
+}
+
+//////////// RecordingRenderBackend
+
+RecordingRenderBackend::RecordingRenderBackend()
+{
+	Clear();
+}
+
+void RecordingRenderBackend::Clear()
+{
+	mCalls.clear();
+	mDraws.clear();
+	memset(&mState, 0xff, sizeof(mState));
+}
+
+void RecordingRenderBackend::BeginPass(uint32_t pass)
+{
+	memset(&mState, 0xff, sizeof(mState));
+	mState.pass = pass;
+	Call call = { COMMAND_BEGIN_PASS, pass };
+	mCalls.push_back(call);
+}
+
+void RecordingRenderBackend::SetShader(uint32_t shader)
+{
+	mState.shader = shader;
+	Call call = { COMMAND_SET_SHADER, shader };
+	mCalls.push_back(call);
+}
+
+void RecordingRenderBackend::SetTexture(uint32_t texture)
+{
+	mState.texture = texture;
+	Call call = { COMMAND_SET_TEXTURE, texture };
+	mCalls.push_back(call);
+}
+
+void RecordingRenderBackend::SetMesh(uint32_t mesh)
+{
+	mState.mesh = mesh;
+	Call call = { COMMAND_SET_MESH, mesh };
+	mCalls.push_back(call);
+}
+
+void RecordingRenderBackend::SetConstants(uint32_t constants)
+{
+	mState.constants = constants;
+	Call call = { COMMAND_SET_CONSTANTS, constants };
+	mCalls.push_back(call);
+}
+
+void RecordingRenderBackend::SetMaterial(uint32_t mesh, uint32_t material)
+{
+	mState.materialMesh = mesh;
+	mState.material = material;
+	Call call = { COMMAND_SET_MATERIAL, material };
+	mCalls.push_back(call);
+}
+
+void RecordingRenderBackend::Draw(const DrawPacket& packet)
+{
+	DrawState state = mState;
+	state.rangeOffset = packet.rangeOffset;
+	mDraws.push_back(state);
+	Call call = { COMMAND_DRAW, packet.rangeOffset };
+	mCalls.push_back(call);
+}
+
+bool RecordingRenderBackend::Matches(const DrawState& state, const DrawPacket& packet)
+{
+	return state.pass == packet.pass && state.shader == packet.shader && state.texture == packet.texture && state.mesh == packet.mesh &&
+		state.constants == packet.constants && state.materialMesh == packet.mesh && state.material == packet.material &&
+		state.rangeOffset == packet.rangeOffset;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// RenderQueue
+// Draw packets of the scene passes sorted by a 64 bit key, then submitted to a
+// backend with only the state that changed from the packet before. The key holds,
+// from the most significant bits down: pass, shader, texture, mesh, material and
+// depth, so a pass is drawn as runs of the same shader, then texture, then mesh.
+// Material ranks below texture, not above it: a material is an index within its mesh
+// (Submesh::materialId) and is bound again on every new mesh, so ranking it higher
+// saves no material bind. In the RenderQueueTest scene of 100k packets a pass, shader,
+// material, texture, depth key binds 4097 textures instead of 513, with 99999 material
+// binds either way. The mesh field keeps the submeshes of a mesh together within a
+// texture, 1134 fewer mesh and constants binds there than without it (98865 of 99999).
+// The key fields are truncated ids and only decide the order; whether a state is
+// bound again is decided on the full ids of the packets.
+// Sort is a least significant digit radix sort of 8 bit digits over the keys,
+// skipping the digits all keys share. It is stable: equal keys keep their
+// submission order.
+// The backend does the actual binds and draws. RecordingRenderBackend records them
+// instead, for tests and benchmarks without a device.
+// Only the standard library is used.
+// usage:
+// queue.Clear();
+// queue.Submit(packet);	// packet.key = RenderQueue::MakeKey(pass, shader, texture, mesh, material, depth)
+// queue.Sort();
+// queue.Execute(backend, &stats);
+
+// one draw and the state it needs
+struct DrawPacket
+{
+	uint64_t key;
+	uint32_t pass;
+	uint32_t shader;
+	uint32_t texture;
+	uint32_t mesh;
+	uint32_t constants;		// object constants, e.g. of one instance of the mesh
+	uint32_t material;		// may be an index within the mesh, it is bound again on a new mesh
+	uint32_t rangeOffset;	// draw data of the backend
+	uint32_t rangeCount;
+};
+
+// binds of each state, and the binds the queue skipped because the state was set
+struct RenderQueueStats
+{
+	RenderQueueStats() { memset(this, 0, sizeof(*this)); }
+
+	uint32_t draws;
+	uint32_t passes;
+	uint32_t shaderBinds;
+	uint32_t textureBinds;
+	uint32_t meshBinds;
+	uint32_t constantsBinds;
+	uint32_t materialBinds;
+	uint32_t bindsAvoided;		// of the five binds per draw without the queue
+};
+
+class RenderBackend
+{
+public:
+	virtual ~RenderBackend() {}
+
+	// the state of a pass starts unset
+	virtual void BeginPass(uint32_t pass) = 0;
+	virtual void SetShader(uint32_t shader) = 0;
+	virtual void SetTexture(uint32_t texture) = 0;
+	virtual void SetMesh(uint32_t mesh) = 0;
+	virtual void SetConstants(uint32_t constants) = 0;
+	virtual void SetMaterial(uint32_t mesh, uint32_t material) = 0;
+	virtual void Draw(const DrawPacket& packet) = 0;
+};
+
+class RenderQueue
+{
+public:
+	// bits of the key fields, the rest of an id is dropped
+	static const int PassBits = 4;
+	static const int ShaderBits = 4;
+	static const int TextureBits = 16;
+	static const int MeshBits = 12;
+	static const int MaterialBits = 8;
+	static const int DepthBits = 20;
+
+	// key of the fields, depth in [0, 1] is quantized, nearer first
+	static uint64_t MakeKey(uint32_t pass, uint32_t shader, uint32_t texture, uint32_t mesh, uint32_t material, float depth);
+
+	RenderQueue() : mSorted(false) {}
+
+	void Clear() { mPackets.clear(); mSorted = false; }
+	void Submit(const DrawPacket& packet) { mPackets.push_back(packet); mSorted = false; }
+
+	size_t GetPacketCount() const { return mPackets.size(); }
+
+	// radix sorts the packet order by key
+	void Sort();
+
+	// Binds the state that changed and draws every packet, in key order after Sort and
+	// in submission order before. Stats are reset.
+	void Execute(RenderBackend& backend, RenderQueueStats* stats = NULL) const;
+
+	// packet indices in the order Execute draws them
+	void GetOrder(std::vector<uint32_t>& order) const;
+
+	// Sorts count keys with their values, a radix sort of 8 bit digits; keys and values
+	// are swapped with scratch buffers of the same size as needed
+	static void RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, std::vector<uint64_t>& scratchKeys,
+		std::vector<uint32_t>& scratchValues);
+
+private:
+	std::vector<DrawPacket> mPackets;
+	bool mSorted;
+
+	// packet keys and indices in key order, and the radix sort buffers
+	std::vector<uint64_t> mKeys;
+	std::vector<uint32_t> mOrder;
+	std::vector<uint64_t> mScratchKeys;
+	std::vector<uint32_t> mScratchOrder;
+};
+
+// RenderBackend recording every call, and the state each draw was made with
+class RecordingRenderBackend : public RenderBackend
+{
+public:
+	enum Command
+	{
+		COMMAND_BEGIN_PASS = 0,
+		COMMAND_SET_SHADER,
+		COMMAND_SET_TEXTURE,
+		COMMAND_SET_MESH,
+		COMMAND_SET_CONSTANTS,
+		COMMAND_SET_MATERIAL,
+		COMMAND_DRAW
+	};
+
+	struct Call
+	{
+		Command command;
+		uint32_t value;
+	};
+
+	// the state bound when a packet was drawn
+	struct DrawState
+	{
+		uint32_t pass;
+		uint32_t shader;
+		uint32_t texture;
+		uint32_t mesh;
+		uint32_t constants;
+		uint32_t materialMesh;	// mesh bound with the material
+		uint32_t material;
+		uint32_t rangeOffset;
+	};
+
+	RecordingRenderBackend();
+
+	void Clear();
+
+	void BeginPass(uint32_t pass);
+	void SetShader(uint32_t shader);
+	void SetTexture(uint32_t texture);
+	void SetMesh(uint32_t mesh);
+	void SetConstants(uint32_t constants);
+	void SetMaterial(uint32_t mesh, uint32_t material);
+	void Draw(const DrawPacket& packet);
+
+	const std::vector<Call>& GetCalls() const { return mCalls; }
+	const std::vector<DrawState>& GetDraws() const { return mDraws; }
+
+	// true when every draw had all the state of its packet bound
+	static bool Matches(const DrawState& state, const DrawPacket& packet);
+
+private:
+	std::vector<Call> mCalls;
+	std::vector<DrawState> mDraws;
+	DrawState mState;
+};
@@ -0,0 +1,479 @@
+#include "SceneBvh.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <numeric>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+const float SceneBvh::RebuildAreaRatio = 2.0f;
+
+SceneBvh::SceneBvh() : mAnyDirty(false), mArea(0.0), mBuiltArea(0.0)
+{
+}
+
+BvhBounds SceneBvh::EmptyBounds()
+{
+	BvhBounds bounds = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+	return bounds;
+}
+
+BvhCullKernel SceneBvh::GetKernel(BvhCullKernel kernel)
+{
+	static const bool avx2 = CpuSupportsAvx2();
+
+	if (kernel == BVH_CULL_AUTO)
+		return avx2 ? BVH_CULL_AVX2 : BVH_CULL_SSE2;
+
+	if (kernel == BVH_CULL_AVX2 && !avx2)
+		return BVH_CULL_SSE2;
+
+	return kernel;
+}
+
+bool SceneBvh::IsEmpty(const BvhBounds& bounds)
+{
+	return bounds.min[0] > bounds.max[0] || bounds.min[1] > bounds.max[1] || bounds.min[2] > bounds.max[2];
+}
+
+void SceneBvh::CountEmpty(uint32_t node, int32_t delta)
+{
+	for (;;)
+	{
+		mNodeEmpty[node] += delta;
+		if (node == 0)
+			break;
+		node = mNodes[node].parent;
+	}
+}
+
+float SceneBvh::SurfaceArea(const BvhBounds& bounds)
+{
+	float x = bounds.max[0] - bounds.min[0];
+	float y = bounds.max[1] - bounds.min[1];
+	float z = bounds.max[2] - bounds.min[2];
+	if (x < 0.0f || y < 0.0f || z < 0.0f)
+		return 0.0f;
+	return 2.0f * (x * y + y * z + z * x);
+}
+
+void SceneBvh::SetSlot(Node& node, uint32_t slot, const BvhBounds& bounds)
+{
+	// a box inverted on any axis is stored as EmptyBounds, which is outside every plane
+	const BvhBounds stored = IsEmpty(bounds) ? EmptyBounds() : bounds;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		node.bounds[axis][slot] = stored.min[axis];
+		node.bounds[3 + axis][slot] = stored.max[axis];
+	}
+}
+
+BvhBounds SceneBvh::NodeBounds(const Node& node) const
+{
+	BvhBounds bounds = EmptyBounds();
+	for (uint32_t slot = 0; slot < Width; ++slot)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			bounds.min[axis] = (std::min)(bounds.min[axis], node.bounds[axis][slot]);
+			bounds.max[axis] = (std::max)(bounds.max[axis], node.bounds[3 + axis][slot]);
+		}
+	}
+	return bounds;
+}
+
+//////////// Build and refit
+
+void SceneBvh::Build(const BvhBounds* bounds, size_t count)
+{
+	mBounds.assign(bounds, bounds + count);
+	mOrder.resize(count);
+	std::iota(mOrder.begin(), mOrder.end(), 0u);
+	mObjectSlots.assign(count, 0);
+	mNodes.clear();
+	mNodes.reserve(count / (Width / 2) + 1);
+
+	if (count > 0)
+		BuildNode(0, (uint32_t)count, 0, 0);
+
+	mNodeAreas.resize(mNodes.size());
+	mNodeEmpty.assign(mNodes.size(), 0);
+	for (size_t object = 0; object < count; ++object)
+	{
+		if (IsEmpty(bounds[object]))
+			CountEmpty((uint32_t)(mObjectSlots[object] >> 8), 1);
+	}
+	mDirty.assign(mNodes.size(), false);
+	mAnyDirty = false;
+	mArea = 0.0;
+	for (size_t i = 0; i < mNodes.size(); ++i)
+	{
+		mNodeAreas[i] = SurfaceArea(NodeBounds(mNodes[i]));
+		mArea += mNodeAreas[i];
+	}
+	mBuiltArea = mArea;
+}
+
+uint32_t SceneBvh::BuildNode(uint32_t first, uint32_t count, uint32_t parent, uint32_t parentSlot)
+{
+	uint32_t index = (uint32_t)mNodes.size();
+	mNodes.push_back(Node());
+	{
+		Node& node = mNodes[index];
+		BvhBounds empty = EmptyBounds();
+		for (uint32_t slot = 0; slot < Width; ++slot)
+		{
+			SetSlot(node, slot, empty);
+			node.child[slot] = EmptyChild;
+		}
+		node.parent = parent;
+		node.parentSlot = parentSlot;
+		node.first = first;
+		node.count = count;
+	}
+
+	// the largest group is split at the median of its centers until there are eight
+	uint32_t groupFirst[Width] = { first };
+	uint32_t groupCount[Width] = { count };
+	uint32_t groups = 1;
+	while (groups < Width)
+	{
+		uint32_t largest = 0;
+		for (uint32_t g = 1; g < groups; ++g)
+		{
+			if (groupCount[g] > groupCount[largest])
+				largest = g;
+		}
+		if (groupCount[largest] <= 1)
+			break;
+
+		std::vector<uint32_t>::iterator begin = mOrder.begin() + groupFirst[largest];
+		std::vector<uint32_t>::iterator end = begin + groupCount[largest];
+
+		// sums of min and max, twice the center
+		float low[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float high[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (std::vector<uint32_t>::iterator it = begin; it != end; ++it)
+		{
+			const BvhBounds& bounds = mBounds[*it];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				float center = bounds.min[axis] + bounds.max[axis];
+				low[axis] = (std::min)(low[axis], center);
+				high[axis] = (std::max)(high[axis], center);
+			}
+		}
+		int axis = 0;
+		for (int a = 1; a < 3; ++a)
+		{
+			if (high[a] - low[a] > high[axis] - low[axis])
+				axis = a;
+		}
+
+		uint32_t half = groupCount[largest] / 2;
+		const std::vector<BvhBounds>& objectBounds = mBounds;
+		std::nth_element(begin, begin + half, end, [&objectBounds, axis](uint32_t a, uint32_t b)
+		{
+			float centerA = objectBounds[a].min[axis] + objectBounds[a].max[axis];
+			float centerB = objectBounds[b].min[axis] + objectBounds[b].max[axis];
+			return centerA != centerB ? centerA < centerB : a < b;
+		});
+
+		groupFirst[groups] = groupFirst[largest] + half;
+		groupCount[groups] = groupCount[largest] - half;
+		groupCount[largest] = half;
+		groups++;
+	}
+
+	// children in the order of their objects, an insertion sort of at most Width groups
+	uint32_t order[Width];
+	for (uint32_t g = 0; g < groups; ++g)
+	{
+		uint32_t slot = g;
+		for (; slot > 0 && groupFirst[order[slot - 1]] > groupFirst[g]; --slot)
+		{
+			order[slot] = order[slot - 1];
+		}
+		order[slot] = g;
+	}
+
+	for (uint32_t slot = 0; slot < groups; ++slot)
+	{
+		uint32_t g = order[slot];
+		if (groupCount[g] == 1)
+		{
+			uint32_t object = mOrder[groupFirst[g]];
+			mNodes[index].child[slot] = ~(int32_t)object;
+			SetSlot(mNodes[index], slot, mBounds[object]);
+			mObjectSlots[object] = ((uint64_t)index << 8) | slot;
+		}
+		else
+		{
+			// mNodes grows, the node is looked up again
+			uint32_t child = BuildNode(groupFirst[g], groupCount[g], index, slot);
+			mNodes[index].child[slot] = (int32_t)child;
+			SetSlot(mNodes[index], slot, NodeBounds(mNodes[child]));
+		}
+	}
+
+	return index;
+}
+
+void SceneBvh::SetBounds(uint32_t object, const BvhBounds& bounds)
+{
+	uint32_t node = (uint32_t)(mObjectSlots[object] >> 8);
+	int32_t emptyChange = (int32_t)IsEmpty(bounds) - (int32_t)IsEmpty(mBounds[object]);
+	if (emptyChange != 0)
+		CountEmpty(node, emptyChange);
+	mBounds[object] = bounds;
+
+	uint32_t slot = (uint32_t)(mObjectSlots[object] & 0xff);
+	SetSlot(mNodes[node], slot, bounds);
+	mDirty[node] = true;
+	mAnyDirty = true;
+}
+
+bool SceneBvh::Refit()
+{
+	if (!mAnyDirty)
+		return false;
+
+	// children come after their parents, one pass from the back reaches the root
+	for (size_t i = mNodes.size(); i-- > 0;)
+	{
+		if (!mDirty[i])
+			continue;
+		mDirty[i] = false;
+
+		const Node& node = mNodes[i];
+		BvhBounds bounds = NodeBounds(node);
+		float area = SurfaceArea(bounds);
+		mArea += area - mNodeAreas[i];
+		mNodeAreas[i] = area;
+
+		if (i > 0)
+		{
+			SetSlot(mNodes[node.parent], node.parentSlot, bounds);
+			mDirty[node.parent] = true;
+		}
+	}
+	mAnyDirty = false;
+
+	if (mArea <= RebuildAreaRatio * mBuiltArea)
+		return false;
+
+	std::vector<BvhBounds> bounds(mBounds);
+	Build(bounds.data(), bounds.size());
+	return true;
+}
+
+//////////// Node tests, a mask of the visible children and one of the children inside every plane
+
+typedef uint32_t(*TestNodeFunction)(const SceneBvh::Node& node, const SceneBvh::CullPlanes& planes, uint32_t& insideMask);
+
+static uint32_t TestNodeScalar(const SceneBvh::Node& node, const SceneBvh::CullPlanes& planes, uint32_t& insideMask)
+{
+	uint32_t visible = 0;
+	insideMask = 0;
+	for (uint32_t slot = 0; slot < SceneBvh::Width; ++slot)
+	{
+		bool outside = false;
+		bool inside = true;
+		for (int p = 0; p < 6; ++p)
+		{
+			const float* plane = planes.plane[p];
+			const int* positive = planes.positiveRow[p];
+			const int* negative = planes.negativeRow[p];
+			float positiveDistance = plane[0] * node.bounds[positive[0]][slot] + plane[1] * node.bounds[positive[1]][slot];
+			positiveDistance = positiveDistance + plane[2] * node.bounds[positive[2]][slot] + plane[3];
+			float negativeDistance = plane[0] * node.bounds[negative[0]][slot] + plane[1] * node.bounds[negative[1]][slot];
+			negativeDistance = negativeDistance + plane[2] * node.bounds[negative[2]][slot] + plane[3];
+			outside |= positiveDistance < 0.0f;
+			inside &= negativeDistance >= 0.0f;
+		}
+		visible |= (uint32_t)!outside << slot;
+		insideMask |= (uint32_t)(!outside && inside) << slot;
+	}
+	return visible;
+}
+
+//////////// SSE2, the children in two halves of four
+
+static uint32_t TestNodeSSE2(const SceneBvh::Node& node, const SceneBvh::CullPlanes& planes, uint32_t& insideMask)
+{
+	uint32_t visible = 0;
+	insideMask = 0;
+	const __m128 zero = _mm_setzero_ps();
+	for (uint32_t half = 0; half < SceneBvh::Width; half += 4)
+	{
+		__m128 outside = zero;
+		__m128 inside = _mm_cmpeq_ps(zero, zero);
+		for (int p = 0; p < 6; ++p)
+		{
+			const float* plane = planes.plane[p];
+			const int* positive = planes.positiveRow[p];
+			const int* negative = planes.negativeRow[p];
+			__m128 a = _mm_set1_ps(plane[0]);
+			__m128 b = _mm_set1_ps(plane[1]);
+			__m128 c = _mm_set1_ps(plane[2]);
+			__m128 d = _mm_set1_ps(plane[3]);
+
+			__m128 positiveDistance = _mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(node.bounds[positive[0]] + half)),
+				_mm_mul_ps(b, _mm_loadu_ps(node.bounds[positive[1]] + half)));
+			positiveDistance = _mm_add_ps(_mm_add_ps(positiveDistance, _mm_mul_ps(c, _mm_loadu_ps(node.bounds[positive[2]] + half))), d);
+			__m128 negativeDistance = _mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(node.bounds[negative[0]] + half)),
+				_mm_mul_ps(b, _mm_loadu_ps(node.bounds[negative[1]] + half)));
+			negativeDistance = _mm_add_ps(_mm_add_ps(negativeDistance, _mm_mul_ps(c, _mm_loadu_ps(node.bounds[negative[2]] + half))), d);
+
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(positiveDistance, zero));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(negativeDistance, zero));
+		}
+		uint32_t outsideBits = (uint32_t)_mm_movemask_ps(outside);
+		uint32_t insideBits = (uint32_t)_mm_movemask_ps(inside);
+		visible |= (~outsideBits & 0xf) << half;
+		insideMask |= (insideBits & ~outsideBits & 0xf) << half;
+	}
+	return visible;
+}
+
+//////////// AVX2, the eight children at once
+
+AVX2_TARGET static uint32_t TestNodeAVX2(const SceneBvh::Node& node, const SceneBvh::CullPlanes& planes, uint32_t& insideMask)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 outside = zero;
+	__m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+	for (int p = 0; p < 6; ++p)
+	{
+		const float* plane = planes.plane[p];
+		const int* positive = planes.positiveRow[p];
+		const int* negative = planes.negativeRow[p];
+		__m256 a = _mm256_set1_ps(plane[0]);
+		__m256 b = _mm256_set1_ps(plane[1]);
+		__m256 c = _mm256_set1_ps(plane[2]);
+		__m256 d = _mm256_set1_ps(plane[3]);
+
+		__m256 positiveDistance = _mm256_add_ps(_mm256_mul_ps(a, _mm256_loadu_ps(node.bounds[positive[0]])),
+			_mm256_mul_ps(b, _mm256_loadu_ps(node.bounds[positive[1]])));
+		positiveDistance = _mm256_add_ps(_mm256_add_ps(positiveDistance, _mm256_mul_ps(c, _mm256_loadu_ps(node.bounds[positive[2]]))), d);
+		__m256 negativeDistance = _mm256_add_ps(_mm256_mul_ps(a, _mm256_loadu_ps(node.bounds[negative[0]])),
+			_mm256_mul_ps(b, _mm256_loadu_ps(node.bounds[negative[1]])));
+		negativeDistance = _mm256_add_ps(_mm256_add_ps(negativeDistance, _mm256_mul_ps(c, _mm256_loadu_ps(node.bounds[negative[2]]))), d);
+
+		outside = _mm256_or_ps(outside, _mm256_cmp_ps(positiveDistance, zero, _CMP_LT_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(negativeDistance, zero, _CMP_GE_OQ));
+	}
+	uint32_t outsideBits = (uint32_t)_mm256_movemask_ps(outside);
+	uint32_t insideBits = (uint32_t)_mm256_movemask_ps(inside);
+	insideMask = insideBits & ~outsideBits & 0xff;
+	return ~outsideBits & 0xff;
+}
+
+//////////// Traversal
+
+void SceneBvh::Cull(const float planes[6][4], std::vector<uint32_t>& visible, BvhCullStats* stats, BvhCullKernel kernel) const
+{
+	visible.clear();
+	if (mNodes.empty())
+		return;
+
+	// the corner furthest along each normal decides outside, the one against it inside
+	CullPlanes cullPlanes;
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			cullPlanes.plane[p][i] = planes[p][i];
+		}
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			bool positive = planes[p][axis] >= 0.0f;
+			cullPlanes.positiveRow[p][axis] = positive ? 3 + axis : axis;
+			cullPlanes.negativeRow[p][axis] = positive ? axis : 3 + axis;
+		}
+	}
+
+	TestNodeFunction test = TestNodeScalar;
+	switch (GetKernel(kernel))
+	{
+	case BVH_CULL_SSE2: test = TestNodeSSE2; break;
+	case BVH_CULL_AVX2: test = TestNodeAVX2; break;
+	default: break;
+	}
+
+	BvhCullStats cullStats;
+	uint32_t stack[256];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node& node = mNodes[stack[--stackSize]];
+		cullStats.nodes++;
+
+		uint32_t insideMask;
+		uint32_t visibleMask = test(node, cullPlanes, insideMask);
+
+		// objects in slot order, child nodes pushed so they pop in slot order
+		for (uint32_t slot = 0; slot < Width; ++slot)
+		{
+			int32_t child = node.child[slot];
+			if (!(visibleMask & (1u << slot)) || child >= 0)
+				continue;
+			visible.push_back((uint32_t)~child);
+		}
+		for (uint32_t slot = Width; slot-- > 0;)
+		{
+			int32_t child = node.child[slot];
+			if (!(visibleMask & (1u << slot)) || child < 0)
+				continue;
+
+			// a subtree with empty boxes is walked so that they are left out
+			const Node& childNode = mNodes[child];
+			if ((insideMask & (1u << slot)) && mNodeEmpty[child] == 0)
+			{
+				visible.insert(visible.end(), mOrder.begin() + childNode.first, mOrder.begin() + childNode.first + childNode.count);
+				cullStats.insideNodes++;
+			}
+			else
+			{
+				stack[stackSize++] = (uint32_t)child;
+			}
+		}
+	}
+
+	cullStats.visibleObjects = (uint32_t)visible.size();
+	if (stats)
+		*stats = cullStats;
+}
+
+void SceneBvh::CullUnion(const float (*planes)[6][4], size_t frustumCount, std::vector<uint32_t>& visible, uint32_t* frustumVisible,
+	BvhCullKernel kernel) const
+{
+	// every frustum marks its objects, an object in several is listed once
+	std::vector<uint8_t> marks(mBounds.size(), 0);
+	for (size_t f = 0; f < frustumCount; ++f)
+	{
+		Cull(planes[f], visible, NULL, kernel);
+		if (frustumVisible)
+			frustumVisible[f] = (uint32_t)visible.size();
+		for (uint32_t object : visible)
+		{
+			marks[object] = 1;
+		}
+	}
+
+	visible.clear();
+	for (uint32_t object = 0; object < marks.size(); ++object)
+	{
+		if (marks[object])
+			visible.push_back(object);
+	}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// SceneBvh
+// Bounding volume hierarchy over the world space boxes of the scene objects, for
+// frustum culling. Every node has eight children whose boxes are kept as arrays of
+// each coordinate, so one node is tested against a plane with one AVX2 compare or
+// two SSE2 ones; a scalar reference gives the same results. A child is an inner node
+// or an object. The tree is built top down, splitting the objects at the median of
+// their centers along the longest axis until there are eight groups.
+// Moving objects only change their boxes: SetBounds marks the path to the root and
+// Refit recomputes it bottom up, the nodes being stored parents first. When the
+// refitted boxes have grown to twice the surface area they had when built the tree
+// is built again from the current boxes.
+// Cull walks the tree from the root: children outside a plane are skipped, children
+// inside all planes add their objects without further tests. The objects of a node
+// are a contiguous range of the build order, so that is a copy; nodes holding empty
+// boxes are walked instead, so those are never returned.
+// Only the standard library and SSE2/AVX2 intrinsics are used.
+// usage:
+// SceneBvh bvh;
+// bvh.Build(bounds.data(), bounds.size());
+// bvh.SetBounds(object, movedBounds); bvh.Refit();	// after objects move
+// bvh.Cull(planes, visible);	// planes a x + b y + c z + d >= 0 inside
+// bvh.CullUnion(frustumPlanes, frustumCount, visible);	// e.g. the faces of a cube shadow map
+
+// axis aligned box, min greater than max on any axis is empty and never visible
+struct BvhBounds
+{
+	float min[3];
+	float max[3];
+};
+
+enum BvhCullKernel
+{
+	BVH_CULL_AUTO = 0,	// best kernel the CPU supports
+	BVH_CULL_SCALAR,
+	BVH_CULL_SSE2,
+	BVH_CULL_AVX2
+};
+
+struct BvhCullStats
+{
+	BvhCullStats() : nodes(0), insideNodes(0), visibleObjects(0) {}
+
+	uint32_t nodes;				// nodes tested
+	uint32_t insideNodes;		// children inside the frustum taken whole
+	uint32_t visibleObjects;
+};
+
+class SceneBvh
+{
+public:
+	static const uint32_t Width = 8;	// children of a node
+
+	// a refit tree is built again when its nodes reach this many times their built area
+	static const float RebuildAreaRatio;
+
+	SceneBvh();
+
+	// builds the tree of count objects, the object ids are the indices of bounds
+	void Build(const BvhBounds* bounds, size_t count);
+
+	size_t GetObjectCount() const { return mObjectSlots.size(); }
+	size_t GetNodeCount() const { return mNodes.size(); }
+	const BvhBounds& GetBounds(uint32_t object) const { return mBounds[object]; }
+
+	// the object moved, the tree is updated by Refit
+	void SetBounds(uint32_t object, const BvhBounds& bounds);
+
+	// updates the boxes of the nodes above moved objects, true when the tree was built again
+	bool Refit();
+
+	// ids of the objects not outside any of the six planes, in tree order
+	void Cull(const float planes[6][4], std::vector<uint32_t>& visible, BvhCullStats* stats = NULL,
+		BvhCullKernel kernel = BVH_CULL_AUTO) const;
+
+	// Ids of the objects not outside any of the six planes of at least one of the frusta,
+	// in id order. frustumVisible, if given, gets the objects of each frustum.
+	void CullUnion(const float (*planes)[6][4], size_t frustumCount, std::vector<uint32_t>& visible, uint32_t* frustumVisible = NULL,
+		BvhCullKernel kernel = BVH_CULL_AUTO) const;
+
+	// Resolves BVH_CULL_AUTO to the kernel used on this CPU
+	static BvhCullKernel GetKernel(BvhCullKernel kernel = BVH_CULL_AUTO);
+
+	static BvhBounds EmptyBounds();
+
+	struct Node
+	{
+		float bounds[6][Width];		// min x, y, z and max x, y, z of the children
+		int32_t child[Width];		// node index, ~object id or EmptyChild
+		uint32_t parent;			// node index, the root is its own parent
+		uint32_t parentSlot;
+		uint32_t first;				// objects of the subtree in mOrder
+		uint32_t count;
+	};
+
+	// the six planes prepared for the node tests
+	struct CullPlanes
+	{
+		float plane[6][4];
+		int positiveRow[6][3];	// bounds row of the corner furthest along the normal, per axis
+		int negativeRow[6][3];	// and of the corner furthest against it
+	};
+
+private:
+	static const int32_t EmptyChild = INT32_MIN;
+
+	uint32_t BuildNode(uint32_t first, uint32_t count, uint32_t parent, uint32_t parentSlot);
+	void SetSlot(Node& node, uint32_t slot, const BvhBounds& bounds);
+	BvhBounds NodeBounds(const Node& node) const;
+	static bool IsEmpty(const BvhBounds& bounds);
+
+	// adds delta to the empty object count of node and the nodes above it
+	void CountEmpty(uint32_t node, int32_t delta);
+	static float SurfaceArea(const BvhBounds& bounds);
+
+	std::vector<Node> mNodes;			// parents before their children
+	std::vector<BvhBounds> mBounds;		// by object id
+	std::vector<uint32_t> mOrder;		// object ids, the ones of a subtree next to each other
+	std::vector<uint64_t> mObjectSlots;	// node << 8 | slot of every object
+	std::vector<float> mNodeAreas;
+	std::vector<uint32_t> mNodeEmpty;	// objects with empty boxes in the subtree
+	std::vector<bool> mDirty;			// nodes with a child box changed
+	bool mAnyDirty;
+	double mArea;						// of every node box
+	double mBuiltArea;
+};
@@ -1,8 +1,15 @@
 #include "SceneManager.h"
 #include "LightManager.h"
 #include "ObjLoader.h"
+#include "MeshCache.h"
 #include "GeometryGenerator.h"
 #include "TextureManager.h"
+#include "AssetLoader.h"
+#include "ClusterCuller.h"
+#include "Parallel.h"
+
+#include <cfloat>
+#include <cstring>
 
 #pragma pack(push,1)
 struct CB_VS_PER_OBJECT
@@ -24,9 +31,58 @@ struct CB_PS_PER_OBJECT
 };
 #pragma pack(pop)
 
+static_assert(sizeof(CB_VS_PER_OBJECT) == sizeof(TransformConstants), "TransformSystem builds CB_VS_PER_OBJECT");
+
+// XMMATRIX of an affine 4x3 TransformSystem matrix and back
+static XMMATRIX LoadAffine(const float m[12])
+{
+	return XMMATRIX(m[0], m[1], m[2], 0.0f, m[3], m[4], m[5], 0.0f, m[6], m[7], m[8], 0.0f, m[9], m[10], m[11], 1.0f);
+}
+
+static void StoreAffine(CXMMATRIX matrix, float m[12])
+{
+	XMFLOAT4X4 values;
+	XMStoreFloat4x4(&values, matrix);
+	for (int r = 0; r < 4; ++r)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			m[r * 3 + c] = values.m[r][c];
+		}
+	}
+}
+
+// Face size of the sky cubemap converted from the equirectangular .hdr
+static const UINT SkyCubeFaceSize = 512;
+
+// Face size of mip 0 of the GGX prefiltered sky reflections
+static const UINT SkySpecularFaceSize = 128;
+
+// World space box of the object space bounds of a mesh, empty until it is loaded
+static BvhBounds MeshWorldBounds(const Mesh& mesh, CXMMATRIX world)
+{
+	if (mesh.mIndexCount == 0)
+		return SceneBvh::EmptyBounds();
+
+	XMVECTOR boundsMin = XMLoadFloat3(&mesh.mBoundsMin);
+	XMVECTOR boundsMax = XMLoadFloat3(&mesh.mBoundsMax);
+	XMVECTOR center = XMVector3TransformCoord(XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f), world);
+	XMVECTOR extent = XMVectorScale(XMVectorSubtract(boundsMax, boundsMin), 0.5f);
+
+	// the extent along each world axis sums the absolute rows
+	XMVECTOR worldExtent = XMVectorMultiply(XMVectorAbs(world.r[0]), XMVectorSplatX(extent));
+	worldExtent = XMVectorMultiplyAdd(XMVectorAbs(world.r[1]), XMVectorSplatY(extent), worldExtent);
+	worldExtent = XMVectorMultiplyAdd(XMVectorAbs(world.r[2]), XMVectorSplatZ(extent), worldExtent);
+
+	BvhBounds bounds;
+	XMStoreFloat3((XMFLOAT3*)bounds.min, XMVectorSubtract(center, worldExtent));
+	XMStoreFloat3((XMFLOAT3*)bounds.max, XMVectorAdd(center, worldExtent));
+	return bounds;
+}
 
 SceneManager::SceneManager() : mSceneVertexShaderCB(NULL), mScenePixelShaderCB(NULL), mSceneVertexShader(NULL), mSceneVSLayout(NULL), mCamera(NULL),
-mScenePixelShader(NULL), mSky(NULL)
+mScenePixelShader(NULL), mScenePackedVertexShader(NULL), mScenePackedVSLayout(NULL), mSky(NULL), mLodPixelError(1.0f), mLoadedMeshCount(0),
+mOccludedMeshCount(0)
 {
 }
 
@@ -41,24 +97,33 @@ bool SceneManager::Init(ID3D11Device* device, Camera* camera)
 
 	mMeshes.clear();
 
-	// Load the models
-	MeshData meshData;
-	if (!ObjLoader::Instance()->LoadToMesh("..\\Assets\\teapot.obj",  "..\\Assets\\", meshData))
-		return false;
-
-	Material material;
-	material.Diffuse = XMFLOAT4(0.9f, 0.9f, 0.9f, 1.0f);
-	material.specExp = 10.0f;
-	material.specIntensivity = 1.0f;
-	meshData.materials[0] = material;
-
+	// Load the models on the asset workers, through the cooked .tmesh cache. The mesh is
+	// empty and not drawn until it is created.
 	Mesh* mesh = new Mesh();
-	mesh->Create(device, meshData);
 	XMMATRIX matTranslate = XMMatrixTranslation(0.0f, 0.0f, 0.0f);
 	XMMATRIX matScale = XMMatrixScaling(1.0f, 1.0f, 1.0f);
 	XMMATRIX matRot = XMMatrixRotationY(M_PI);
-	mesh->mWorld = matTranslate * matScale * matRot; 
+	float local[12];
+	StoreAffine(matTranslate * matScale * matRot, local);
+	mesh->mTransform = mTransforms.Create(local);
+
+	AssetLoader::Instance()->LoadMesh(mesh, "..\\Assets\\teapot.obj", "..\\Assets\\", VERTEX_FORMAT_PACKED, [this](Mesh* mesh)
+	{
+		Material material;
+		material.Diffuse = XMFLOAT4(0.9f, 0.9f, 0.9f, 1.0f);
+		material.specExp = 10.0f;
+		material.specIntensivity = 1.0f;
+		mesh->mMaterials[0] = material;
+
+		// the packed positions are dequantized by the geometry transform
+		XMFLOAT4X4 dequantize;
+		XMStoreFloat4x4(&dequantize, mesh->GetPositionDequantize());
+		const float scale[3] = { dequantize._11, dequantize._22, dequantize._33 };
+		const float offset[3] = { dequantize._41, dequantize._42, dequantize._43 };
+		mTransforms.SetGeometry(mesh->mTransform, scale, offset);
+	});
 	mMeshes.push_back(mesh);
+	mMeshLods.assign(mMeshes.size(), 0);
 		
 	// Create constant buffers
 	D3D11_BUFFER_DESC cbDesc;
@@ -108,6 +173,30 @@ bool SceneManager::Init(ID3D11Device* device, Camera* camera)
 	if (FAILED(hr))
 		return false;
 
+	// Same shader reading the packed vertex format
+	D3D10_SHADER_MACRO packedDefines[] = { { "PACKED_VERTEX", "1" }, { NULL, NULL } };
+	if (FAILED(CompileShader(str, packedDefines, "RenderSceneVS", "vs_5_0", dwShaderFlags, &pShaderBlob)))
+		return false;
+
+	if (FAILED(device->CreateVertexShader(pShaderBlob->GetBufferPointer(),
+		pShaderBlob->GetBufferSize(), NULL, &mScenePackedVertexShader)))
+	{
+		return false;
+	}
+
+	const D3D11_INPUT_ELEMENT_DESC packedLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0,  0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL",   0, DXGI_FORMAT_R16G16_SNORM,       0,  8, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT,       0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+
+	hr = device->CreateInputLayout(packedLayout, ARRAYSIZE(packedLayout), pShaderBlob->GetBufferPointer(),
+		pShaderBlob->GetBufferSize(), &mScenePackedVSLayout);
+	SAFE_RELEASE(pShaderBlob);
+	if (FAILED(hr))
+		return false;
+
 	if (FAILED(CompileShader(str, NULL, "RenderScenePS", "ps_5_0", dwShaderFlags, &pShaderBlob)))
 		return false;
 	hr = device->CreatePixelShader(pShaderBlob->GetBufferPointer(),
@@ -120,8 +209,8 @@ bool SceneManager::Init(ID3D11Device* device, Camera* camera)
 
 	// Create the Sky object
 	mSky = new Sky();
-	std::string skyfileName = "..\\Assets\\grasscube1024.dds"; 
-	if (!mSky->Init(device, skyfileName, 5000))
+	std::string skyfileName = "..\\Assets\\approaching_storm_1k.hdr";
+	if (!mSky->Init(device, skyfileName, 5000, SkyCubeFaceSize, SkySpecularFaceSize))
 	{
 		return false;
 	}
@@ -137,118 +226,335 @@ void SceneManager::Release()
 		{
 			if (mMeshes[i] != NULL)
 			{
+				mTransforms.Destroy(mMeshes[i]->mTransform);
 				mMeshes[i]->Destroy();
 				mMeshes[i] = NULL;
 			}
 		}
 	}
+	mMeshLods.clear();
+	mMeshBounds.clear();
+	mVisibleMeshes.clear();
+	mBvh.Build(NULL, 0);
 
 	SAFE_RELEASE(mSceneVertexShaderCB);
 	SAFE_RELEASE(mScenePixelShaderCB);
 	SAFE_RELEASE(mSceneVertexShader);
 	SAFE_RELEASE(mSceneVSLayout);
 	SAFE_RELEASE(mScenePixelShader);
+	SAFE_RELEASE(mScenePackedVertexShader);
+	SAFE_RELEASE(mScenePackedVSLayout);
 
 	SAFE_DELETE(mSky);
 }
 
 
-// Renders the scene to GBuffer
-void SceneManager::Render(ID3D11DeviceContext* pd3dImmediateContext)
+// Binds the state of the render queue packets on the device context. Packets index the
+// meshes of the scene manager, and the constants and ranges of their pass: mObjectConstants
+// and mDrawRanges, or mShadowConstants and mShadowRanges by mesh.
+class SceneManager::DrawBackend : public RenderBackend
 {
-	// Get the projection & view matrix from the camera class
-	
-	XMMATRIX mView = mCamera->View();
-	XMMATRIX mProj = mCamera->Proj();
+public:
+	DrawBackend(SceneManager* scene, ID3D11DeviceContext* context, SceneDrawStats* stats) :
+		mScene(scene), mContext(context), mStats(stats), mPass(SCENE_PASS_GBUFFER), mMesh(NULL), mTexture(NULL)
+	{
+	}
+
+	void BeginPass(uint32_t pass)
+	{
+		mPass = pass;
+		mMesh = NULL;
+		mTexture = NULL;
+		if (mPass == SCENE_PASS_GBUFFER)
+			mContext->PSSetShader(mScene->mScenePixelShader, NULL, 0);
+	}
+
+	// Set the vertex layout and shader of the mesh vertex format, the shadow pass only
+	// needs the layout of the positions
+	void SetShader(uint32_t shader)
+	{
+		bool packed = shader == SCENE_SHADER_PACKED;
+		mContext->IASetInputLayout(packed ? mScene->mScenePackedVSLayout : mScene->mSceneVSLayout);
+		if (mPass == SCENE_PASS_GBUFFER)
+			mContext->VSSetShader(packed ? mScene->mScenePackedVertexShader : mScene->mSceneVertexShader, NULL, 0);
+	}
+
+	void SetTexture(uint32_t texture)
+	{
+		if (mPass != SCENE_PASS_GBUFFER)
+			return;
+
+		// textures still loading draw untextured
+		mTexture = TextureManager::Instance()->GetTexture(texture);
+		if (mTexture != NULL)
+		{
+			mContext->PSSetShaderResources(0, 1, &mTexture);
+			mStats->textureSwitches++;
+		}
+	}
 
+	void SetMesh(uint32_t mesh)
+	{
+		mMesh = mScene->mMeshes[mesh];
+		mMesh->Bind(mContext);
+	}
+
+	// mesh world matrices, built transposed by BuildConstants
+	void SetConstants(uint32_t constants)
+	{
+		HRESULT hr;
+		D3D11_MAPPED_SUBRESOURCE MappedResource;
+		const std::vector<TransformConstants>& passConstants = mPass == SCENE_PASS_GBUFFER ? mScene->mObjectConstants : mScene->mShadowConstants;
+		HR(mContext->Map(mScene->mSceneVertexShaderCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
+		memcpy(MappedResource.pData, &passConstants[constants], sizeof(CB_VS_PER_OBJECT));
+		mContext->Unmap(mScene->mSceneVertexShaderCB, 0);
+		mContext->VSSetConstantBuffers(0, 1, &mScene->mSceneVertexShaderCB);
+	}
 
-	// Render the meshes
-	for (int i = 0; i < mMeshes.size(); ++i)
+	// materials belong to their mesh, the queue sets it again on a new mesh
+	void SetMaterial(uint32_t mesh, uint32_t material)
 	{
-		// mesh world matrix
-		XMMATRIX mWorld = mMeshes[i]->mWorld;
-		XMMATRIX mWorldViewProjection = mWorld * mView * mProj;
+		if (mPass != SCENE_PASS_GBUFFER)
+			return;
+
+		const Material& meshMaterial = mScene->mMeshes[mesh]->GetMaterial(material);
 
-		// Set the constant buffers
 		HRESULT hr;
 		D3D11_MAPPED_SUBRESOURCE MappedResource;
-		HR(pd3dImmediateContext->Map(mSceneVertexShaderCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
-		CB_VS_PER_OBJECT* pVSPerObject = (CB_VS_PER_OBJECT*)MappedResource.pData;
-		pVSPerObject->mWorldViewProjection = XMMatrixTranspose(mWorldViewProjection);
-		pVSPerObject->mWorld = XMMatrixTranspose(mWorld);
-		pd3dImmediateContext->Unmap(mSceneVertexShaderCB, 0);
-		pd3dImmediateContext->VSSetConstantBuffers(0, 1, &mSceneVertexShaderCB);
-
-		HR(pd3dImmediateContext->Map(mScenePixelShaderCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
+		HR(mContext->Map(mScene->mScenePixelShaderCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
 		CB_PS_PER_OBJECT* pPSPerObject = (CB_PS_PER_OBJECT*)MappedResource.pData;
 		//pPSPerObject->mEyePosition = mCamera->GetPosition();
 		// set per object properties
-		pPSPerObject->mSpecExp = mMeshes[i]->mMaterials[0].specExp;
-		pPSPerObject->mSpecIntensity = mMeshes[i]->mMaterials[0].specIntensivity;
-		pPSPerObject->mdiffuseColor = mMeshes[i]->mMaterials[0].Diffuse;
-		
-		if (TextureManager::Instance()->GetTexture(mMeshes[i]->mMaterials[0].diffuseTexture) != NULL)
-		{
-			 
-			ID3D11ShaderResourceView* srv = TextureManager::Instance()->GetTexture(mMeshes[i]->mMaterials[0].diffuseTexture);
-			pd3dImmediateContext->PSSetShaderResources(0, 1, &srv);
-
-			
-			pPSPerObject->mUseDiffuseTexture = true;
-		}
-		else {
-			pPSPerObject->mUseDiffuseTexture = false;
-		
-		}
-
+		pPSPerObject->mSpecExp = meshMaterial.specExp;
+		pPSPerObject->mSpecIntensity = meshMaterial.specIntensivity;
+		pPSPerObject->mdiffuseColor = meshMaterial.Diffuse;
+		pPSPerObject->mUseDiffuseTexture = mTexture != NULL;
 		pPSPerObject->mUseSpecularTexture = false;
 		pPSPerObject->mUseNormalMapTexture = false;
 		pPSPerObject->mUseAlphaTexture = false;
+		mContext->Unmap(mScene->mScenePixelShaderCB, 0);
+		mContext->PSSetConstantBuffers(0, 1, &mScene->mScenePixelShaderCB);
+	}
 
-		pd3dImmediateContext->Unmap(mScenePixelShaderCB, 0);
-		pd3dImmediateContext->PSSetConstantBuffers(0, 1, &mScenePixelShaderCB);
+	// render the visible meshlets
+	void Draw(const DrawPacket& packet)
+	{
+		const std::vector<DrawRange>& ranges = mPass == SCENE_PASS_GBUFFER ? mScene->mDrawRanges : mScene->mShadowRanges;
+		mMesh->DrawRanges(mContext, ranges.data() + packet.rangeOffset, packet.rangeCount);
+		mStats->draws += packet.rangeCount;
+	}
+
+private:
+	SceneManager* mScene;
+	ID3D11DeviceContext* mContext;
+	SceneDrawStats* mStats;
+	uint32_t mPass;
+	Mesh* mMesh;
+	ID3D11ShaderResourceView* mTexture;
+};
 
-		// Set the vertex layout
-		pd3dImmediateContext->IASetInputLayout(mSceneVSLayout);
+float SceneManager::GetSortDepth(UINT meshIndex) const
+{
+	const BvhBounds& bounds = mMeshBounds[meshIndex];
+	XMVECTOR center = XMVectorSet(bounds.min[0] + bounds.max[0], bounds.min[1] + bounds.max[1], bounds.min[2] + bounds.max[2], 0.0f);
+	center = XMVectorScale(center, 0.5f);
+	float distance = XMVectorGetX(XMVector3Length(center - mCamera->GetPositionXM()));
+	return distance / mCamera->GetFarZ();
+}
 
-		// Set the shaders
-		pd3dImmediateContext->VSSetShader(mSceneVertexShader, NULL, 0);
-		pd3dImmediateContext->PSSetShader(mScenePixelShader, NULL, 0);
+void SceneManager::RecordPasses(const ShadowCasterVolume* shadowVolumes, size_t shadowPassCount)
+{
+	PrepareShadowCasters();
+	mShadowPasses.resize(shadowPassCount);
+	mShadowStats.assign(shadowPassCount, ShadowPassStats());
 
-		// render
-		mMeshes[i]->Render(pd3dImmediateContext);
+	// the GBuffer then the shadow passes, one pass per range on the worker pool
+	size_t passCount = 1 + shadowPassCount;
+	ParallelFor(passCount, 1, [this, shadowVolumes](size_t begin, size_t end)
+	{
+		for (size_t pass = begin; pass < end; ++pass)
+		{
+			if (pass == 0)
+				RecordGBuffer();
+			else
+				RecordShadowCasters((UINT)pass - 1, shadowVolumes[pass - 1]);
+		}
+	});
+}
+
+void SceneManager::RecordGBuffer()
+{
+	// Get the projection & view matrix from the camera class
+	
+	XMMATRIX mView = mCamera->View();
+	XMMATRIX mProj = mCamera->Proj();
+
+	mClusterCullStats = ClusterCullStats();
+	mDrawStats = SceneDrawStats();
+	mDrawRanges.clear();
+	mRenderQueue.Clear();
+	mDrawStats.meshes = (UINT)mMeshes.size();
+	mDrawStats.visibleMeshes = (UINT)mVisibleMeshes.size();
+	mDrawStats.occludedMeshes = mOccludedMeshCount;
+
+	// vertex shader constants of every visible mesh in one batch, the position
+	// dequantization only applies to the world view projection
+	mObjectTransforms.clear();
+	for (UINT i : mVisibleMeshes)
+	{
+		mObjectTransforms.push_back(mMeshes[i]->mTransform);
+	}
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, mView * mProj);
+	mObjectConstants.resize(mObjectTransforms.size());
+	mTransforms.BuildConstants(mObjectTransforms.data(), mObjectTransforms.size(), &viewProj.m[0][0], mObjectConstants.data());
+
+	// Collect the visible submeshes of the selected levels of the meshes in the frustum
+	for (UINT v = 0; v < mVisibleMeshes.size(); ++v)
+	{
+		UINT i = mVisibleMeshes[v];
+		Mesh* mesh = mMeshes[i];
+		MeshLod lod = mesh->GetLod(mMeshLods[i]);
+		uint32_t shader = mesh->mVertexFormat == VERTEX_FORMAT_PACKED ? SCENE_SHADER_PACKED : SCENE_SHADER_FULL;
+		float depth = GetSortDepth(i);
+
+		// Cull the meshlets outside the view or facing away, submeshes with nothing left
+		// are skipped. Meshes without meshlets are drawn whole.
+		bool hasMeshlets = !mesh->mMeshlets.empty();
+		ClusterCuller culler(GetWorld(mesh), mView, mProj);
+
+		for (UINT s = lod.submeshOffset; s < lod.submeshOffset + lod.submeshCount; ++s)
+		{
+			const Submesh& submesh = mesh->mSubmeshes[s];
+
+			DrawPacket packet;
+			packet.pass = SCENE_PASS_GBUFFER;
+			packet.shader = shader;
+			packet.texture = mesh->GetMaterial(submesh.materialId).diffuseTextureHandle;
+			packet.mesh = i;
+			packet.constants = v;
+			packet.material = submesh.materialId;
+			packet.rangeOffset = (UINT)mDrawRanges.size();
+
+			if (hasMeshlets)
+			{
+				culler.Cull(mesh->mMeshlets.data() + submesh.meshletOffset, submesh.meshletCount, mSubmeshRanges, &mClusterCullStats);
+				mDrawRanges.insert(mDrawRanges.end(), mSubmeshRanges.begin(), mSubmeshRanges.end());
+			}
+			else
+			{
+				DrawRange range = { submesh.indexOffset, submesh.indexCount };
+				mDrawRanges.push_back(range);
+			}
+
+			packet.rangeCount = (UINT)mDrawRanges.size() - packet.rangeOffset;
+			if (packet.rangeCount == 0)
+				continue;
+
+			packet.key = RenderQueue::MakeKey(packet.pass, packet.shader, packet.texture, packet.mesh, packet.material, depth);
+			mRenderQueue.Submit(packet);
+		}
 	}
 
+	mDrawStats.submeshes = (UINT)mRenderQueue.GetPacketCount();
+
+	// Sort so the shaders, textures, vertex buffers and constant buffers change as seldom as possible
+	mRenderQueue.Sort();
 
+	mGBufferCommands.Reset();
+	RenderQueueStats queueStats;
+	mRenderQueue.Execute(mGBufferCommands, &queueStats);
+	mDrawStats.meshSwitches = queueStats.meshBinds;
+	mDrawStats.materialSwitches = queueStats.materialBinds;
+	mDrawStats.stateChangesAvoided = queueStats.bindsAvoided;
 }
 
-void SceneManager::RenderSceneNoShaders(ID3D11DeviceContext * pd3dImmediateContext)
+// Renders the scene to GBuffer
+void SceneManager::Render(ID3D11DeviceContext* pd3dImmediateContext)
 {
+	// draws and textures are counted as they are bound
+	mDrawStats.draws = 0;
+	mDrawStats.textureSwitches = 0;
+
+	DrawBackend backend(this, pd3dImmediateContext, &mDrawStats);
+	mGBufferCommands.Replay(backend);
+}
 
+void SceneManager::PrepareShadowCasters()
+{
 	XMMATRIX mView = mCamera->View();
 	XMMATRIX mProj = mCamera->Proj();
 
-	// render meshes
-	for (int i = 0; i < mMeshes.size(); ++i)
+	// object constants of every mesh, the shadow shaders only transform positions so the
+	// world matrix dequantizes them as well
+	mShadowTransforms.clear();
+	for (const Mesh* mesh : mMeshes)
 	{
-		// set object world matrix
-		XMMATRIX mWorld = mMeshes[i]->mWorld;
-		XMMATRIX mWorldViewProjection = mWorld * mView * mProj;
+		mShadowTransforms.push_back(mesh->mTransform);
+	}
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, mView * mProj);
+	mShadowConstants.resize(mShadowTransforms.size());
+	mTransforms.BuildConstants(mShadowTransforms.data(), mShadowTransforms.size(), &viewProj.m[0][0], mShadowConstants.data(), true);
+
+	// meshes are drawn at the level selected for the camera
+	mShadowRanges.resize(mMeshes.size());
+	mLoadedMeshCount = 0;
+	for (UINT i = 0; i < mMeshes.size(); ++i)
+	{
+		MeshLod lod = mMeshes[i]->GetLod(mMeshLods[i]);
+		DrawRange range = { lod.indexOffset, lod.indexCount };
+		mShadowRanges[i] = range;
+		mLoadedMeshCount += mMeshes[i]->mIndexCount > 0;
+	}
+}
 
-		// Set the constant buffers
-		HRESULT hr;
-		D3D11_MAPPED_SUBRESOURCE MappedResource;
-		HR(pd3dImmediateContext->Map(mSceneVertexShaderCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource));
-		CB_VS_PER_OBJECT* pVSPerObject = (CB_VS_PER_OBJECT*)MappedResource.pData;
-		pVSPerObject->mWorldViewProjection = XMMatrixTranspose(mWorldViewProjection);
-		pVSPerObject->mWorld = XMMatrixTranspose(mWorld);
-		pd3dImmediateContext->Unmap(mSceneVertexShaderCB, 0);
-		pd3dImmediateContext->VSSetConstantBuffers(0, 1, &mSceneVertexShaderCB);
-
-		// render mesh, sets vertex and index buffers
-		mMeshes[i]->Render(pd3dImmediateContext);
+void SceneManager::RecordShadowCasters(UINT shadowPass, const ShadowCasterVolume& volume)
+{
+	ShadowPass& pass = mShadowPasses[shadowPass];
+	ShadowPassStats& stats = mShadowStats[shadowPass];
+
+	// the meshes in any frustum of the pass, the ones still loading have empty bounds
+	stats.frustums = volume.frustumCount;
+	mBvh.CullUnion(reinterpret_cast<const float(*)[6][4]>(volume.planes), volume.frustumCount, pass.casters, stats.frustumCasters);
+
+	pass.queue.Clear();
+	for (uint32_t i : pass.casters)
+	{
+		Mesh* mesh = mMeshes[i];
+		if (mesh->mIndexCount == 0)
+			continue;
+
+		// the scene layouts hold the position the shadow shaders read
+		DrawPacket packet;
+		packet.pass = SCENE_PASS_SHADOW;
+		packet.shader = mesh->mVertexFormat == VERTEX_FORMAT_PACKED ? SCENE_SHADER_PACKED : SCENE_SHADER_FULL;
+		packet.texture = 0;
+		packet.mesh = i;
+		packet.constants = i;
+		packet.material = 0;
+		packet.rangeOffset = i;
+		packet.rangeCount = 1;
+		packet.key = RenderQueue::MakeKey(packet.pass, packet.shader, packet.texture, packet.mesh, packet.material, 0.0f);
+		pass.queue.Submit(packet);
 	}
+	stats.casters = (UINT)pass.queue.GetPacketCount();
+	stats.culled = mLoadedMeshCount - stats.casters;
+
+	pass.queue.Sort();
 
+	pass.commands.Reset();
+	pass.queue.Execute(pass.commands);
+}
+
+void SceneManager::RenderSceneNoShaders(ID3D11DeviceContext * pd3dImmediateContext, UINT shadowPass)
+{
+	if (shadowPass >= mShadowPasses.size())
+		return;
+
+	SceneDrawStats shadowStats;
+	DrawBackend backend(this, pd3dImmediateContext, &shadowStats);
+	mShadowPasses[shadowPass].commands.Replay(backend);
 }
 
 void SceneManager::RenderSky(ID3D11DeviceContext* pd3dImmediateContext, XMVECTOR sunDirection, XMVECTOR sunColor)
@@ -261,11 +567,151 @@ void SceneManager::RenderSky(ID3D11DeviceContext* pd3dImmediateContext, XMVECTOR
 
 }
 
+XMMATRIX SceneManager::GetWorld(const Mesh* mesh) const
+{
+	float world[12];
+	mTransforms.GetWorld(mesh->mTransform, world);
+	return LoadAffine(world);
+}
+
+void SceneManager::CullMeshes()
+{
+	mTransforms.Update();
+
+	// the meshes that moved or finished loading since the last frame are refitted
+	bool build = mBvh.GetObjectCount() != mMeshes.size();
+	mMeshBounds.resize(mMeshes.size(), SceneBvh::EmptyBounds());
+	for (uint32_t i = 0; i < mMeshes.size(); ++i)
+	{
+		const Mesh* mesh = mMeshes[i];
+		bool wasLoaded = mMeshBounds[i].min[0] <= mMeshBounds[i].max[0];
+		if (!build && !mTransforms.WorldChanged(mesh->mTransform) && wasLoaded == (mesh->mIndexCount > 0))
+			continue;
+
+		mMeshBounds[i] = MeshWorldBounds(*mesh, GetWorld(mesh));
+		if (!build)
+			mBvh.SetBounds(i, mMeshBounds[i]);
+	}
+
+	if (build)
+		mBvh.Build(mMeshBounds.data(), mMeshBounds.size());
+	else
+		mBvh.Refit();
+
+	XMMATRIX viewProj = mCamera->View() * mCamera->Proj();
+	XMFLOAT4 planes[6];
+	ClusterCuller::ExtractPlanes(viewProj, planes);
+	mBvh.Cull(reinterpret_cast<const float(*)[4]>(planes), mVisibleMeshes);
+
+	OccludeMeshes(viewProj);
+}
+
+void SceneManager::OccludeMeshes(const XMMATRIX& viewProj)
+{
+	// a few large occluders hide most of what is hidden
+	const size_t maxOccluders = 16;
+	const int depthWidth = 256;
+
+	mOccludedMeshCount = 0;
+	// the aspect of the camera, in whole tiles
+	int depthHeight = (int)(depthWidth / mCamera->GetAspect()) + OcclusionCuller::TileHeight - 1;
+	depthHeight = (std::max)(1, depthHeight / OcclusionCuller::TileHeight) * OcclusionCuller::TileHeight;
+	if (mOcclusionCuller.GetWidth() != depthWidth || mOcclusionCuller.GetHeight() != depthHeight)
+		mOcclusionCuller.Resize(depthWidth, depthHeight);
+	mOcclusionCuller.Clear();
+
+	// by the size of the bounding sphere over its distance, a mesh the camera is in first
+	XMVECTOR cameraPosition = mCamera->GetPositionXM();
+	mOccluderCandidates.clear();
+	for (uint32_t i : mVisibleMeshes)
+	{
+		if (mMeshes[i]->mOccluderIndices.empty())
+			continue;
+
+		const BvhBounds& bounds = mMeshBounds[i];
+		XMVECTOR boundsMin = XMVectorSet(bounds.min[0], bounds.min[1], bounds.min[2], 0.0f);
+		XMVECTOR boundsMax = XMVectorSet(bounds.max[0], bounds.max[1], bounds.max[2], 0.0f);
+		float radius = 0.5f * XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin)));
+		float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f), cameraPosition)));
+		mOccluderCandidates.push_back(std::make_pair(distance > radius ? radius / distance : FLT_MAX, i));
+	}
+	if (mOccluderCandidates.empty())
+		return;
+
+	size_t occluderCount = (std::min)(maxOccluders, mOccluderCandidates.size());
+	std::partial_sort(mOccluderCandidates.begin(), mOccluderCandidates.begin() + occluderCount, mOccluderCandidates.end(),
+		[](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) { return a.first > b.first; });
+
+	for (size_t o = 0; o < occluderCount; ++o)
+	{
+		const Mesh* mesh = mMeshes[mOccluderCandidates[o].second];
+		XMFLOAT4X4 toClip;
+		XMStoreFloat4x4(&toClip, GetWorld(mesh) * viewProj);
+		mOcclusionCuller.AddOccluder(&mesh->mOccluderVertices[0].x, mesh->mOccluderVertices.size(), mesh->mOccluderIndices.data(),
+			mesh->mOccluderIndices.size(), &toClip.m[0][0]);
+	}
+	mOcclusionCuller.Rasterize();
+
+	XMFLOAT4X4 viewProjMatrix;
+	XMStoreFloat4x4(&viewProjMatrix, viewProj);
+	size_t visibleCount = 0;
+	for (uint32_t i : mVisibleMeshes)
+	{
+		if (mOcclusionCuller.IsVisible(mMeshBounds[i].min, mMeshBounds[i].max, &viewProjMatrix.m[0][0]))
+			mVisibleMeshes[visibleCount++] = i;
+	}
+	mOccludedMeshCount = (UINT)(mVisibleMeshes.size() - visibleCount);
+	mVisibleMeshes.resize(visibleCount);
+}
+
+void SceneManager::SelectLods(float viewportHeight)
+{
+	CullMeshes();
+
+	XMVECTOR cameraPosition = mCamera->GetPositionXM();
+	float tanHalfFovY = tanf(0.5f * mCamera->GetFovY());
+
+	for (UINT i : mVisibleMeshes)
+	{
+		const Mesh* mesh = mMeshes[i];
+		XMMATRIX world = GetWorld(mesh);
+
+		// world space bounding sphere of the object space bounds
+		XMVECTOR boundsMin = XMLoadFloat3(&mesh->mBoundsMin);
+		XMVECTOR boundsMax = XMLoadFloat3(&mesh->mBoundsMax);
+		XMVECTOR center = XMVector3TransformCoord(XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f), world);
+		float scale = (std::max)(XMVectorGetX(XMVector3Length(world.r[0])),
+			(std::max)(XMVectorGetX(XMVector3Length(world.r[1])), XMVectorGetX(XMVector3Length(world.r[2]))));
+		float radius = 0.5f * scale * XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin)));
+
+		// distance to the nearest point of the sphere, inside it the full level is used
+		float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(center, cameraPosition))) - radius;
+
+		// the textures are taken to span the object once, their mips stream down to the
+		// projected size of the sphere
+		float screenPixels = distance > 0.0f ? radius * viewportHeight / (distance * tanHalfFovY) : FLT_MAX;
+		for (const auto& kv : mesh->mMaterials)
+		{
+			if (kv.second.diffuseTextureHandle != InvalidTextureHandle)
+				TextureManager::Instance()->RequestMip(kv.second.diffuseTextureHandle, screenPixels);
+		}
+
+		if (mesh->mLods.size() < 2)
+		{
+			mMeshLods[i] = 0;
+			continue;
+		}
+
+		mMeshLods[i] = SelectMeshLod(mesh->mLods, scale, distance, mCamera->GetFovY(), viewportHeight, mLodPixelError, mMeshLods[i]);
+	}
+}
+
 void SceneManager::RotateObjects(float dx, float dy, float dz)
 {
+	float rotation[12];
+	StoreAffine(XMMatrixRotationRollPitchYaw(dx, dy, dz), rotation);
 	for (Mesh* mesh : mMeshes)
 	{
-		XMMATRIX matRot = XMMatrixRotationRollPitchYaw(dx, dy, dz);
-		mesh->mWorld *= matRot;
+		mTransforms.Multiply(mesh->mTransform, rotation);
 	}
 }
@@ -2,9 +2,41 @@
 
 #include "Camera.h"
 #include "Mesh.h"
+#include "CommandBuffer.h"
+#include "OcclusionCuller.h"
+#include "SceneBvh.h"
 #include "Sky.h"
 #include "Util.h"
 
+// Draw call counters of one GBuffer pass
+struct SceneDrawStats
+{
+	SceneDrawStats() { ZeroMemory(this, sizeof(*this)); }
+
+	UINT submeshes;			// submeshes with visible meshlets
+	UINT draws;				// DrawIndexed calls
+	UINT meshSwitches;		// vertex buffer and vertex shader constant buffer changes
+	UINT materialSwitches;	// pixel shader constant buffer changes
+	UINT textureSwitches;	// diffuse texture changes
+	UINT stateChangesAvoided;	// binds the render queue skipped, of five per submesh
+	UINT meshes;
+	UINT visibleMeshes;		// meshes in the camera frustum and not occluded
+	UINT occludedMeshes;	// meshes in the camera frustum hidden by the occluders
+};
+
+// Caster counters of one shadow pass
+struct ShadowPassStats
+{
+	ShadowPassStats() { ZeroMemory(this, sizeof(*this)); }
+
+	UINT frustums;
+	UINT casters;				// meshes submitted, in any frustum of the pass
+	UINT culled;				// loaded meshes outside every frustum
+	UINT frustumCasters[6];		// meshes in each frustum, e.g. cube face or cascade
+};
+
+struct ShadowCasterVolume;
+
 // SceneManager class
 // Simple scenemanager that holds Scenes meshes and camera
 // Just for testing simple scene this holds hardcoded
@@ -15,26 +47,127 @@ public:
 	SceneManager();
 	~SceneManager();
 
+	// Creates the shaders and queues the meshes and the sky cubemap on AssetLoader,
+	// they are drawn once AssetLoader::Update has created them
 	bool Init(ID3D11Device* device, Camera* camera);
 	void Release();
 
-	// Renders the scene meshes into the GBuffer
+	// Records the GBuffer draws and the casters of every shadow pass into their command
+	// buffers, the passes on worker threads in parallel. A shadow pass draws the meshes
+	// in its caster volume, see LightManager::PrepareShadowVolumes. No device calls are
+	// made; the buffers are replayed by RenderSceneNoShaders and Render. Call after
+	// SelectLods.
+	void RecordPasses(const ShadowCasterVolume* shadowVolumes, size_t shadowPassCount);
+
+	// Renders the visible meshes into the GBuffer, meshlets are culled against the camera.
+	// Every submesh is one draw packet of mRenderQueue, sorted by vertex format, texture,
+	// mesh, material and then front to back so state is only set when it changes.
+	// Replays the commands recorded by RecordPasses.
 	void Render(ID3D11DeviceContext* pd3dImmediateContext);
 
-	// Renders the scene with no shaders
-	void RenderSceneNoShaders(ID3D11DeviceContext* pd3dImmediateContext);
+	// Renders the casters of a shadow pass with no shaders, the loaded meshes in its caster
+	// volume whether the camera sees them or not. The meshes go through the queue of the
+	// pass, sorted by vertex format. Replays the commands recorded by RecordPasses.
+	void RenderSceneNoShaders(ID3D11DeviceContext* pd3dImmediateContext, UINT shadowPass);
 	
 	// Renders sky and sun
 	void RenderSky(ID3D11DeviceContext* pd3dImmediateContext, XMVECTOR sunDirection, XMVECTOR sunColor);
 
+	// ambient spherical harmonics of the sky, false until the sky is loaded
+	bool GetSkyAmbient(SHCoefficients& ambient) const { return mSky != NULL && mSky->GetAmbient(ambient); }
+
+	// prefiltered sky reflections, NULL without a sky
+	const Sky* GetSky() const { return mSky; }
+
+	// Culls the meshes against the camera frustum and the occluders, see CullMeshes, then picks the level
+	// of detail of every visible mesh from the camera, see SelectMeshLod, and requests
+	// the mips of its textures from its size on screen.
+	// Call once per frame before the shadow and GBuffer passes.
+	void SelectLods(float viewportHeight);
+
+	// rotates every mesh about the world origin
 	void RotateObjects(float dx, float dy, float dz);
 	Mesh* GetMesh(int index) { return mMeshes[index]; }
 
+	// world matrix of a mesh, as of the last SelectLods
+	XMMATRIX GetWorld(const Mesh* mesh) const;
+
+	UINT GetMeshLod(int index) const { return mMeshLods[index]; }
+
+	// meshlet culling results of the last Render
+	const ClusterCullStats& GetClusterCullStats() const { return mClusterCullStats; }
+
+	// draw call counters of the last Render
+	const SceneDrawStats& GetDrawStats() const { return mDrawStats; }
+
+	// caster counters of the shadow passes of the last RecordPasses
+	const std::vector<ShadowPassStats>& GetShadowStats() const { return mShadowStats; }
+
 private:
 
+	// passes of the render queue
+	enum ScenePass
+	{
+		SCENE_PASS_GBUFFER = 0,
+		SCENE_PASS_SHADOW
+	};
+
+	// shaders of the render queue, by vertex format
+	enum SceneShader
+	{
+		SCENE_SHADER_FULL = 0,
+		SCENE_SHADER_PACKED
+	};
+
+	// RenderBackend of the scene passes, binds the state on the device context
+	class DrawBackend;
+
+	// key depth of a mesh, the distance of its bounds from the camera over the far plane
+	float GetSortDepth(UINT meshIndex) const;
+
+	// the passes of RecordPasses, each only writes its own members
+	void RecordGBuffer();
+	void RecordShadowCasters(UINT shadowPass, const ShadowCasterVolume& volume);
+
+	// the constants and ranges of every mesh the shadow passes share
+	void PrepareShadowCasters();
+
+	// Updates the transforms, refits the mesh bounding volume hierarchy to the world
+	// space boxes of the meshes that moved or loaded and collects the meshes in the
+	// camera frustum into mVisibleMeshes, then drops the occluded ones, see OccludeMeshes
+	void CullMeshes();
+
+	// Rasterizes the largest visible meshes with occluder geometry into mOcclusionCuller
+	// and removes the meshes behind them from mVisibleMeshes. The shadow passes still
+	// draw the occluded meshes.
+	void OccludeMeshes(const XMMATRIX& viewProj);
+
 	// Scene meshes
 	std::vector<Mesh*> mMeshes;
 
+	// local and world transforms of the meshes
+	TransformSystem mTransforms;
+
+	// vertex shader constants of the meshes drawn by a pass, built in one batch
+	std::vector<TransformHandle> mObjectTransforms;
+	std::vector<TransformConstants> mObjectConstants;
+
+	// world space boxes of the meshes, empty while loading, and the visible meshes
+	SceneBvh mBvh;
+	std::vector<BvhBounds> mMeshBounds;
+	std::vector<uint32_t> mVisibleMeshes;
+
+	// depth buffer of the occluders, the meshes it hid in the last CullMeshes
+	OcclusionCuller mOcclusionCuller;
+	std::vector<std::pair<float, uint32_t>> mOccluderCandidates;
+	UINT mOccludedMeshCount;
+
+	// selected level of detail of every mesh
+	std::vector<UINT> mMeshLods;
+
+	// largest screen space error of a level of detail, in pixels
+	float mLodPixelError;
+
 	// Scene meshes shader constant buffers
 	ID3D11Buffer* mSceneVertexShaderCB;
 	ID3D11Buffer* mScenePixelShaderCB;
@@ -42,9 +175,40 @@ private:
 	// Depth prepass vertex shader
 	ID3D11VertexShader* mSceneVertexShader;
 	ID3D11InputLayout* mSceneVSLayout;
+
+	// Vertex shader and layout for VERTEX_FORMAT_PACKED meshes
+	ID3D11VertexShader* mScenePackedVertexShader;
+	ID3D11InputLayout* mScenePackedVSLayout;
 	ID3D11PixelShader* mScenePixelShader;
 
 	Camera* mCamera;
 
+	// index ranges of all draw packets, and of the submesh being culled
+	std::vector<DrawRange> mDrawRanges;
+	std::vector<DrawRange> mSubmeshRanges;
+	RenderQueue mRenderQueue;
+
+	// constants and ranges of the shadow casters by mesh, apart from the GBuffer ones so
+	// the passes record alongside it
+	std::vector<TransformHandle> mShadowTransforms;
+	std::vector<TransformConstants> mShadowConstants;
+	std::vector<DrawRange> mShadowRanges;
+	UINT mLoadedMeshCount;
+
+	// the culled casters of a shadow pass, its queue and its commands
+	struct ShadowPass
+	{
+		std::vector<uint32_t> casters;
+		RenderQueue queue;
+		CommandBuffer commands;
+	};
+	std::vector<ShadowPass> mShadowPasses;
+	std::vector<ShadowPassStats> mShadowStats;
+
+	// commands recorded by RecordPasses
+	CommandBuffer mGBufferCommands;
+	ClusterCullStats mClusterCullStats;
+	SceneDrawStats mDrawStats;
+
 	Sky* mSky;
 };
\ No newline at end of file
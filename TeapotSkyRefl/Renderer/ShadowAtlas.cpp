@@ -0,0 +1,387 @@
+#include "ShadowAtlas.h"
+
+#include <algorithm>
+
+// the implementation stays private to this file, imgui_draw.cpp has its own
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "stb_rect_pack.h"
+
+ShadowAtlas::ShadowAtlas() : mAtlasSize(0), mMinTileSize(0), mMaxTileSize(0), mCellsPerSide(0), mUsedCells(0), mHysteresis(0.25f), mFrame(1)
+{
+}
+
+void ShadowAtlas::SetSize(int atlasSize, int minTileSize, int maxTileSize)
+{
+	mAtlasSize = atlasSize;
+	mMinTileSize = minTileSize;
+	mMaxTileSize = (std::min)(maxTileSize, atlasSize);
+	mCellsPerSide = atlasSize / minTileSize;
+
+	mEntries.clear();
+	mCells.assign((size_t)mCellsPerSide * mCellsPerSide, 0);
+	mUsedCells = 0;
+	mStats = ShadowAtlasStats();
+	mStats.atlasTexels = (uint64_t)atlasSize * atlasSize;
+}
+
+void ShadowAtlas::Resize(uint32_t light)
+{
+	if (light >= mEntries.size())
+	{
+		Entry entry = {};
+		entry.limit = mMaxTileSize;
+		mEntries.resize(light + 1, entry);
+	}
+}
+
+int ShadowAtlas::GetTileSizeFor(float texels, int currentSize) const
+{
+	float clamped = (std::max)((std::min)(texels, (float)mMaxTileSize), (float)mMinTileSize);
+
+	// keep the current size unless the wanted one is well outside it
+	if (currentSize > 0 && clamped <= currentSize * (1.0f + mHysteresis) && clamped > currentSize * 0.5f * (1.0f - mHysteresis))
+		return currentSize;
+
+	int size = mMinTileSize;
+	while (size < clamped)
+	{
+		size *= 2;
+	}
+	return size;
+}
+
+void ShadowAtlas::SetCells(const ShadowAtlasTile& tile, uint8_t used)
+{
+	int cells = tile.size / mMinTileSize;
+	int x = tile.x / mMinTileSize;
+	int y = tile.y / mMinTileSize;
+	for (int row = y; row < y + cells; ++row)
+	{
+		std::fill_n(mCells.begin() + (size_t)row * mCellsPerSide + x, cells, used);
+	}
+	mUsedCells = used ? mUsedCells + cells * cells : mUsedCells - cells * cells;
+}
+
+void ShadowAtlas::Free(Entry& entry)
+{
+	for (int face = 0; face < entry.faces && entry.size > 0; ++face)
+	{
+		SetCells(entry.tiles[face], 0);
+	}
+	entry.size = 0;
+}
+
+bool ShadowAtlas::FindFree(int size, int& x, int& y) const
+{
+	// positions on the tile size first, so the free space stays in whole tiles
+	int cells = size / mMinTileSize;
+	for (int step = cells; step >= 1; step = step > 1 ? 1 : 0)
+	{
+		for (int cellY = 0; cellY + cells <= mCellsPerSide; cellY += step)
+		{
+			for (int cellX = 0; cellX + cells <= mCellsPerSide;)
+			{
+				// the used cell furthest right, the next position to try is past it
+				int blocked = -1;
+				for (int row = cellY; row < cellY + cells; ++row)
+				{
+					const uint8_t* cell = &mCells[(size_t)row * mCellsPerSide + cellX];
+					for (int column = cells - 1; column > blocked; --column)
+					{
+						if (cell[column])
+						{
+							blocked = column;
+							break;
+						}
+					}
+				}
+
+				if (blocked < 0)
+				{
+					x = cellX * mMinTileSize;
+					y = cellY * mMinTileSize;
+					return true;
+				}
+				cellX += (blocked / step + 1) * step;
+			}
+		}
+	}
+	return false;
+}
+
+void ShadowAtlas::Update(const ShadowAtlasRequest* requests, size_t count)
+{
+	mFrame++;
+	mStats.resized = 0;
+	mStats.placed = 0;
+	mStats.moved = 0;
+	uint32_t packs = mStats.packs;
+
+	if (mCellsPerSide <= 0)
+		return;
+
+	// the sizes the lights want, around the sizes they have
+	bool freed = false;
+	mRequested.clear();
+	for (size_t i = 0; i < count; ++i)
+	{
+		const ShadowAtlasRequest& request = requests[i];
+		Resize(request.light);
+		Entry& entry = mEntries[request.light];
+		if (entry.frame == mFrame)
+			continue;
+
+		int faces = (std::max)(1, (std::min)(request.faces, (int)MaxFaces));
+		if (entry.size > 0 && entry.faces != faces)
+		{
+			Free(entry);
+			freed = true;
+		}
+		entry.frame = mFrame;
+		entry.faces = faces;
+		entry.texels = request.texels;
+		entry.wanted = GetTileSizeFor(request.texels, entry.size);
+		entry.lastSize = entry.size;
+		std::copy(entry.tiles, entry.tiles + MaxFaces, entry.lastTiles);
+		mRequested.push_back(request.light);
+	}
+
+	// the lights that are gone give their tiles back
+	for (Entry& entry : mEntries)
+	{
+		if (entry.size > 0 && entry.frame != mFrame)
+		{
+			Free(entry);
+			freed = true;
+		}
+	}
+
+	// smaller tiles keep their top left corner
+	for (uint32_t light : mRequested)
+	{
+		Entry& entry = mEntries[light];
+		if (entry.size > 0 && entry.wanted < entry.size)
+		{
+			for (int face = 0; face < entry.faces; ++face)
+			{
+				SetCells(entry.tiles[face], 0);
+				entry.tiles[face].size = entry.wanted;
+				SetCells(entry.tiles[face], 1);
+			}
+			entry.size = entry.wanted;
+			freed = true;
+		}
+	}
+
+	// once half of the atlas is free the lights a pack made smaller may grow again
+	if (freed && mUsedCells * 2 <= mCells.size())
+	{
+		for (Entry& entry : mEntries)
+		{
+			entry.limit = mMaxTileSize;
+		}
+	}
+
+	// new and larger tiles in free space, the larger first
+	mPlace.clear();
+	for (uint32_t light : mRequested)
+	{
+		const Entry& entry = mEntries[light];
+		if ((std::min)(entry.wanted, entry.limit) > entry.size)
+		{
+			mPlace.push_back(light);
+		}
+	}
+	std::sort(mPlace.begin(), mPlace.end(), [this](uint32_t a, uint32_t b)
+	{
+		const Entry& entryA = mEntries[a];
+		const Entry& entryB = mEntries[b];
+		int sizeA = (std::min)(entryA.wanted, entryA.limit);
+		int sizeB = (std::min)(entryB.wanted, entryB.limit);
+		if (sizeA != sizeB)
+			return sizeA > sizeB;
+		if (entryA.texels != entryB.texels)
+			return entryA.texels > entryB.texels;
+		return a < b;
+	});
+
+	// a light without tiles that finds no room needs a full pack, a larger tile that
+	// finds none keeps the one it has
+	bool fits = true;
+	for (size_t i = 0; i < mPlace.size() && fits; ++i)
+	{
+		Entry& entry = mEntries[mPlace[i]];
+		int size = (std::min)(entry.wanted, entry.limit);
+		ShadowAtlasTile tiles[MaxFaces];
+		int placed = 0;
+		int current = entry.size;
+		Free(entry);
+		for (; placed < entry.faces; ++placed)
+		{
+			if (!FindFree(size, tiles[placed].x, tiles[placed].y))
+				break;
+			tiles[placed].size = size;
+			SetCells(tiles[placed], 1);
+		}
+
+		if (placed == entry.faces)
+		{
+			std::copy(tiles, tiles + MaxFaces, entry.tiles);
+			entry.size = size;
+			mStats.placed += placed;
+		}
+		else if (current > 0)
+		{
+			for (int face = 0; face < placed; ++face)
+			{
+				SetCells(tiles[face], 0);
+			}
+			for (int face = 0; face < entry.faces; ++face)
+			{
+				SetCells(entry.tiles[face], 1);
+			}
+			entry.size = current;
+			entry.limit = current;
+		}
+		else
+		{
+			fits = false;
+		}
+	}
+
+	if (!fits)
+	{
+		Pack();
+	}
+
+	mStats.lights = 0;
+	mStats.dropped = 0;
+	mStats.tiles = 0;
+	mStats.usedTexels = 0;
+	for (uint32_t light : mRequested)
+	{
+		const Entry& entry = mEntries[light];
+		if (entry.size == 0)
+		{
+			mStats.dropped++;
+			continue;
+		}
+
+		mStats.lights++;
+		mStats.tiles += entry.faces;
+		mStats.usedTexels += (uint64_t)entry.faces * entry.size * entry.size;
+		mStats.resized += entry.lastSize > 0 && entry.lastSize != entry.size;
+		if (mStats.packs != packs && entry.lastSize > 0)
+		{
+			for (int face = 0; face < entry.faces; ++face)
+			{
+				mStats.moved += entry.tiles[face].x != entry.lastTiles[face].x || entry.tiles[face].y != entry.lastTiles[face].y;
+			}
+		}
+	}
+}
+
+void ShadowAtlas::Pack()
+{
+	mStats.packs++;
+
+	// most important first
+	std::vector<uint32_t> order(mRequested);
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+	{
+		if (mEntries[a].texels != mEntries[b].texels)
+			return mEntries[a].texels > mEntries[b].texels;
+		return a < b;
+	});
+
+	// sizes in cells; over the atlas area the least important get smaller, then are dropped
+	std::vector<int> sizes(order.size());
+	uint64_t area = 0;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const Entry& entry = mEntries[order[i]];
+		sizes[i] = entry.wanted / mMinTileSize;
+		area += (uint64_t)entry.faces * sizes[i] * sizes[i];
+	}
+	const uint64_t capacity = (uint64_t)mCellsPerSide * mCellsPerSide;
+	int shrink = (int)order.size() - 1;
+	size_t kept = order.size();
+	auto halve = [&]()
+	{
+		while (shrink >= 0 && sizes[shrink] <= 1)
+		{
+			--shrink;
+		}
+		if (shrink < 0)
+			return false;
+
+		uint64_t faces = mEntries[order[shrink]].faces;
+		area -= faces * sizes[shrink] * sizes[shrink];
+		sizes[shrink] /= 2;
+		area += faces * sizes[shrink] * sizes[shrink];
+		return true;
+	};
+	auto reduce = [&]()
+	{
+		if (!halve())
+		{
+			--kept;
+			area -= (uint64_t)mEntries[order[kept]].faces;
+		}
+	};
+
+	// a full atlas is made smaller to a quarter free for the lights that come next,
+	// lights are only dropped when all the smallest tiles do not fit
+	if (area > capacity)
+	{
+		while (area > capacity - capacity / 4 && halve());
+		while (area > capacity)
+		{
+			reduce();
+		}
+	}
+
+	// the area fitting does not mean stb_rect_pack finds a place for all, then shrink on
+	std::vector<stbrp_rect> rects;
+	std::vector<stbrp_node> nodes(mCellsPerSide);
+	for (;;)
+	{
+		rects.clear();
+		for (size_t i = 0; i < kept; ++i)
+		{
+			for (int face = 0; face < mEntries[order[i]].faces; ++face)
+			{
+				stbrp_rect rect = {};
+				rect.id = (int)(i * MaxFaces + face);
+				rect.w = (stbrp_coord)sizes[i];
+				rect.h = (stbrp_coord)sizes[i];
+				rects.push_back(rect);
+			}
+		}
+
+		stbrp_context context;
+		stbrp_init_target(&context, mCellsPerSide, mCellsPerSide, nodes.data(), (int)nodes.size());
+		if (rects.empty() || stbrp_pack_rects(&context, rects.data(), (int)rects.size()))
+			break;
+		reduce();
+	}
+
+	std::fill(mCells.begin(), mCells.end(), (uint8_t)0);
+	mUsedCells = 0;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		Entry& entry = mEntries[order[i]];
+		entry.size = i < kept ? sizes[i] * mMinTileSize : 0;
+		entry.limit = entry.size < entry.wanted ? entry.size : mMaxTileSize;
+	}
+	for (const stbrp_rect& rect : rects)
+	{
+		Entry& entry = mEntries[order[rect.id / MaxFaces]];
+		ShadowAtlasTile& tile = entry.tiles[rect.id % MaxFaces];
+		tile.x = rect.x * mMinTileSize;
+		tile.y = rect.y * mMinTileSize;
+		tile.size = entry.size;
+		SetCells(tile, 1);
+	}
+}
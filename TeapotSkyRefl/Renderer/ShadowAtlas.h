@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ShadowAtlas
+// Tiles of one shadow map atlas for the shadow casting lights, one tile for a spot
+// light and one per cube face for a point light. Each frame the caller gives every
+// light the tile size it wants, from how large the light is on screen; the size is
+// rounded up to a power of two between the smallest and largest tile, and only
+// changes when the wanted size leaves the current one by more than the hysteresis,
+// so a light moving a little does not flip between two sizes.
+// Tiles stay where they are from frame to frame: lights that are gone free their
+// tiles, smaller tiles shrink in place and new or larger tiles go to free space, a
+// larger tile without room keeps the one it has. Only when a new light finds no room is
+// the whole atlas packed again with stb_rect_pack, most important lights first. When
+// everything does not fit the least important lights get smaller tiles until a quarter
+// of the atlas is free for the lights that come next, and are only dropped when even
+// the smallest tiles do not fit. Lights kept smaller do not grow again before half of
+// the atlas is free, so a full atlas is not packed every frame.
+// Tile sizes and positions are multiples of the smallest tile, the free space is kept
+// in cells of that size. No device calls are made: the caller renders the depth of each
+// tile into its viewport of the atlas texture.
+// Only the standard library and stb_rect_pack are used.
+// usage:
+// atlas.SetSize(4096, 128, 1024);
+// ShadowAtlasRequest request = { lightHandle, 1024.0f * screenSize, 6 };
+// atlas.Update(&request, 1);
+// const ShadowAtlasTile* tiles = atlas.GetTiles(lightHandle);	// NULL when dropped
+
+struct ShadowAtlasRequest
+{
+	uint32_t light;		// handle of the light, the same from frame to frame
+	float texels;		// wanted tile size
+	int faces;			// tiles of the light, 1 for a spot light, 6 for a point light
+};
+
+// in texels from the top left of the atlas
+struct ShadowAtlasTile
+{
+	int x, y, size;
+};
+
+struct ShadowAtlasStats
+{
+	ShadowAtlasStats() : lights(0), dropped(0), tiles(0), resized(0), placed(0), moved(0), packs(0), usedTexels(0), atlasTexels(0) {}
+
+	uint32_t lights;		// with tiles in the last Update
+	uint32_t dropped;		// requested and left without tiles
+	uint32_t tiles;
+	uint32_t resized;		// lights whose tile size changed in the last Update
+	uint32_t placed;		// tiles put in free space, nothing else moved
+	uint32_t moved;			// tiles a full pack moved, of lights that had tiles
+	uint32_t packs;			// full packs since SetSize
+	uint64_t usedTexels;
+	uint64_t atlasTexels;
+};
+
+class ShadowAtlas
+{
+public:
+	// tiles of a point light
+	static const int MaxFaces = 6;
+
+	ShadowAtlas();
+
+	// Sizes in texels, powers of two. Frees every tile.
+	void SetSize(int atlasSize, int minTileSize = 128, int maxTileSize = 1024);
+	int GetSize() const { return mAtlasSize; }
+	int GetMinTileSize() const { return mMinTileSize; }
+	int GetMaxTileSize() const { return mMaxTileSize; }
+
+	// Relative change of the wanted size, over the current size or under half of it,
+	// that makes a light change its tile size
+	void SetHysteresis(float hysteresis) { mHysteresis = hysteresis; }
+
+	// Gives tiles to the lights of this frame, lights not given since the last Update lose theirs
+	void Update(const ShadowAtlasRequest* requests, size_t count);
+
+	// tile size of a light, 0 without tiles
+	int GetTileSize(uint32_t light) const { return light < mEntries.size() ? mEntries[light].size : 0; }
+
+	// the faces tiles of a light, NULL without tiles
+	const ShadowAtlasTile* GetTiles(uint32_t light) const { return GetTileSize(light) > 0 ? mEntries[light].tiles : NULL; }
+
+	const ShadowAtlasStats& GetStats() const { return mStats; }
+
+	// Tile size for wanted texels of a light with a tile of currentSize, 0 when it has none
+	int GetTileSizeFor(float texels, int currentSize) const;
+
+private:
+	struct Entry
+	{
+		uint32_t frame;		// last requested, 0 is never
+		int faces;
+		int size;			// 0 without tiles
+		int wanted;			// size of this frame's request
+		int limit;			// largest size the last full pack could give
+		float texels;
+		ShadowAtlasTile tiles[MaxFaces];
+		int lastSize;		// before this frame's Update
+		ShadowAtlasTile lastTiles[MaxFaces];
+	};
+
+	void Resize(uint32_t light);
+
+	// marks the cells of a tile used or free
+	void SetCells(const ShadowAtlasTile& tile, uint8_t used);
+	void Free(Entry& entry);
+
+	// top left of size free texels, false when there is no room
+	bool FindFree(int size, int& x, int& y) const;
+
+	// packs every requested light again with stb_rect_pack
+	void Pack();
+
+	int mAtlasSize, mMinTileSize, mMaxTileSize;
+	int mCellsPerSide;
+	size_t mUsedCells;
+	float mHysteresis;
+
+	std::vector<Entry> mEntries;			// by light
+	std::vector<uint8_t> mCells;			// smallest tiles, row by row
+	std::vector<uint32_t> mRequested;		// lights of this frame
+	std::vector<uint32_t> mPlace;
+	uint32_t mFrame;
+	ShadowAtlasStats mStats;
+};
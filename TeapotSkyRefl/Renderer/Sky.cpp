@@ -2,7 +2,9 @@
 #include "Mesh.h"
 #include "GeometryGenerator.h"
 #include "TextureManager.h"
+#include "AssetLoader.h"
 #include "Camera.h"
+#include "EnvironmentPrefilter.h"
 
 
 #pragma pack(push,1)
@@ -12,9 +14,16 @@ struct CB_VS_PER_FRAME
 };
 #pragma pack(pop)
 
+// size of the split sum lookup table, cooked next to the sky
+static const UINT BrdfLutSize = 128;
+
 Sky::Sky()
 {
 	mCubeMapSRV = NULL;
+	mSpecularSRV = NULL;
+	mBrdfLutSRV = NULL;
+	mSpecularMipCount = 0;
+	mHasAmbient = false;
 	mIndexCount = 0;
 	mVB = NULL;
 	mIB = NULL;
@@ -25,14 +34,42 @@ Sky::Sky()
 	mSkyNoDepthStencilMaskState = NULL;
 }
 
-bool Sky::Init(ID3D11Device* device, const std::string& cubemapFilename, float skySphereRadius)
+bool Sky::Init(ID3D11Device* device, const std::string& cubemapFilename, float skySphereRadius, UINT cubeFaceSize,
+	UINT specularFaceSize)
 {
-	// load cubemap from file
-	mCubeMapSRV = TextureManager::Instance()->CreateTexture(cubemapFilename);
-
-	if (mCubeMapSRV == NULL)
+	// load cubemap from file on the asset workers, the sky is drawn once it is created
+	mCubeMapSRV = NULL;
+	mSpecularSRV = NULL;
+	mBrdfLutSRV = NULL;
+	mSpecularMipCount = 0;
+	mHasAmbient = false;
+	size_t dot = cubemapFilename.find_last_of('.');
+	if (dot != std::string::npos && cubemapFilename.substr(dot) == ".hdr")
 	{
-		return false;
+		// the specular chain is queued once the cubemap cache it is prefiltered from is written
+		AssetLoader::Instance()->LoadCubemap(cubemapFilename, cubeFaceSize,
+			[this, cubemapFilename, cubeFaceSize, specularFaceSize](ID3D11ShaderResourceView* srv, const SHCoefficients& ambient)
+		{
+			mCubeMapSRV = srv;
+			mAmbient = ambient;
+			mHasAmbient = true;
+
+			AssetLoader::Instance()->LoadSpecularCubemap(cubemapFilename, cubeFaceSize, specularFaceSize,
+				[this, specularFaceSize](ID3D11ShaderResourceView* specular)
+			{
+				mSpecularSRV = specular;
+				mSpecularMipCount = EnvironmentPrefilter::MipCount(specularFaceSize);
+			});
+		});
+
+		size_t slash = cubemapFilename.find_last_of("\\/");
+		std::string directory = slash != std::string::npos ? cubemapFilename.substr(0, slash + 1) : std::string();
+		AssetLoader::Instance()->LoadBrdfLut(directory + "brdf_lut" + std::to_string(BrdfLutSize) + ".dds", BrdfLutSize,
+			[this](ID3D11ShaderResourceView* srv) { mBrdfLutSRV = srv; });
+	}
+	else
+	{
+		AssetLoader::Instance()->LoadTexture(cubemapFilename, [this](ID3D11ShaderResourceView* srv) { mCubeMapSRV = srv; });
 	}
 
 	MeshData sphere;
@@ -146,7 +183,6 @@ Sky::~Sky()
 {
 	ReleaseCOM(mVB);
 	ReleaseCOM(mIB);
-	ReleaseCOM(mCubeMapSRV);
 
 	SAFE_RELEASE(mSkyPixelShader);
 	SAFE_RELEASE(mSkyVertexShader);
@@ -161,8 +197,17 @@ ID3D11ShaderResourceView* Sky::CubeMapSRV()
 	return mCubeMapSRV;
 }
 
+bool Sky::GetAmbient(SHCoefficients& ambient) const
+{
+	if (mHasAmbient)
+		ambient = mAmbient;
+	return mHasAmbient;
+}
+
 void Sky::Render(ID3D11DeviceContext* deviceContext, const Camera* camera)
 {
+	if (mCubeMapSRV == NULL)
+		return;
 
 	// Store the previous depth state
 	ID3D11DepthStencilState* pPrevDepthState;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Util.h"
+#include "SphericalHarmonics.h"
 
 class Camera;
 
@@ -10,10 +11,22 @@ public:
 	Sky();
 	~Sky();
 
-	bool Init(ID3D11Device* device, const std::string& cubemapFilename, float skySphereRadius);
+	// the cubemap is loaded through AssetLoader, the sky is not drawn before it is created.
+	// An equirectangular .hdr is converted to a cubemap with cubeFaceSize faces, which is then
+	// prefiltered into a specular mip chain with specularFaceSize faces.
+	bool Init(ID3D11Device* device, const std::string& cubemapFilename, float skySphereRadius, UINT cubeFaceSize = 512,
+		UINT specularFaceSize = 128);
 
 	ID3D11ShaderResourceView* CubeMapSRV();
 
+	// GGX prefiltered sky and split sum lookup table of a .hdr sky, NULL until they are ready
+	ID3D11ShaderResourceView* SpecularSRV() const { return mSpecularSRV; }
+	ID3D11ShaderResourceView* BrdfLutSRV() const { return mBrdfLutSRV; }
+	UINT GetSpecularMipCount() const { return mSpecularMipCount; }
+
+	// ambient spherical harmonics baked from a .hdr sky, false until they are ready
+	bool GetAmbient(SHCoefficients& ambient) const;
+
 	void Render(ID3D11DeviceContext* deviceContext, const Camera* camera);
 
 private:
@@ -25,7 +38,14 @@ private:
 	ID3D11Buffer* mVB;
 	ID3D11Buffer* mIB;
 
+	// owned by TextureManager, NULL until the cubemap is loaded
 	ID3D11ShaderResourceView* mCubeMapSRV;
+	ID3D11ShaderResourceView* mSpecularSRV;
+	ID3D11ShaderResourceView* mBrdfLutSRV;
+	UINT mSpecularMipCount;
+
+	SHCoefficients mAmbient;
+	bool mHasAmbient;
 
 	UINT mIndexCount;
 
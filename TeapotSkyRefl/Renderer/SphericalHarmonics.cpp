@@ -0,0 +1,408 @@
+#include "SphericalHarmonics.h"
+#include "CubemapConverter.h"
+#include "VertexPacking.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <emmintrin.h>
+
+static const float Pi = 3.14159265358979f;
+
+// Basis constants of the bands 0 to 2
+static const float BasisConstants[SHCoefficients::Count] =
+{
+	0.282095f,
+	0.488603f, 0.488603f, 0.488603f,
+	1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f
+};
+
+// Clamped cosine convolution per band divided by pi: 1, 2/3, 1/4
+static const float BandScales[SHCoefficients::Count] =
+{
+	1.0f,
+	2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f,
+	0.25f, 0.25f, 0.25f, 0.25f, 0.25f
+};
+
+// Face rows projected as one block, the blocks are summed in order
+static const unsigned int RowsPerBlock = 16;
+
+SHCoefficients::SHCoefficients()
+{
+	memset(rgb, 0, sizeof(rgb));
+}
+
+SHCoefficients& SHCoefficients::operator+=(const SHCoefficients& rhs)
+{
+	for (int i = 0; i < Count; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			rgb[i][c] += rhs.rgb[i][c];
+		}
+	}
+	return *this;
+}
+
+// The basis polynomials without their constants
+static inline void BasisPolynomials(float x, float y, float z, float basis[SHCoefficients::Count])
+{
+	basis[0] = 1.0f;
+	basis[1] = y;
+	basis[2] = z;
+	basis[3] = x;
+	basis[4] = x * y;
+	basis[5] = y * z;
+	basis[6] = 3.0f * z * z - 1.0f;
+	basis[7] = x * z;
+	basis[8] = x * x - y * y;
+}
+
+void SphericalHarmonics::EvaluateBasis(const float direction[3], float basis[SHCoefficients::Count])
+{
+	BasisPolynomials(direction[0], direction[1], direction[2], basis);
+	for (int i = 0; i < SHCoefficients::Count; ++i)
+	{
+		basis[i] *= BasisConstants[i];
+	}
+}
+
+// Unnormalized direction of face point (u, v) as in CubemapConverter::FaceDirection
+static inline void FaceVector(unsigned int face, float u, float v, float& x, float& y, float& z)
+{
+	switch (face)
+	{
+	case 0: x = 1.0f; y = -v; z = -u; break;
+	case 1: x = -1.0f; y = -v; z = u; break;
+	case 2: x = u; y = 1.0f; z = v; break;
+	case 3: x = u; y = -1.0f; z = -v; break;
+	case 4: x = u; y = -v; z = 1.0f; break;
+	default: x = -u; y = -v; z = -1.0f; break;
+	}
+}
+
+static inline void FaceVectorSSE2(unsigned int face, __m128 u, __m128 v, __m128& x, __m128& y, __m128& z)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	__m128 minusU = _mm_xor_ps(u, sign);
+	__m128 minusV = _mm_xor_ps(v, sign);
+
+	switch (face)
+	{
+	case 0: x = one; y = minusV; z = minusU; break;
+	case 1: x = _mm_xor_ps(one, sign); y = minusV; z = u; break;
+	case 2: x = u; y = one; z = v; break;
+	case 3: x = u; y = _mm_xor_ps(one, sign); z = minusV; break;
+	case 4: x = u; y = minusV; z = one; break;
+	default: x = minusU; y = minusV; z = _mm_xor_ps(one, sign); break;
+	}
+}
+
+// Raw sums of one face row: polynomials times color times the differential solid angle 1 / (1 + u^2 + v^2)^(3/2),
+// the texel area and the basis constants are applied once per face
+struct RowSums
+{
+	RowSums() : weight(0.0f) {}
+
+	SHCoefficients sh;
+	float weight;
+};
+
+static void ProjectTexelsScalar(unsigned int face, float v, const float* rgba, unsigned int begin, unsigned int end,
+	unsigned int faceSize, RowSums& sums)
+{
+	float scale = 2.0f / faceSize;
+	for (unsigned int x = begin; x < end; ++x)
+	{
+		float u = (x + 0.5f) * scale - 1.0f;
+		float dx, dy, dz;
+		FaceVector(face, u, v, dx, dy, dz);
+
+		float invLengthSq = 1.0f / (1.0f + u * u + v * v);
+		float invLength = sqrtf(invLengthSq);
+		float weight = invLengthSq * invLength;
+
+		float basis[SHCoefficients::Count];
+		BasisPolynomials(dx * invLength, dy * invLength, dz * invLength, basis);
+
+		const float* texel = rgba + x * 4;
+		for (int i = 0; i < SHCoefficients::Count; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				sums.sh.rgb[i][c] += basis[i] * texel[c] * weight;
+			}
+		}
+		sums.weight += weight;
+	}
+}
+
+static void ProjectRowSSE2(unsigned int face, float v, const float* rgba, unsigned int faceSize, RowSums& sums)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 three = _mm_set1_ps(3.0f);
+	const __m128 scale = _mm_set1_ps(2.0f / faceSize);
+	const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 vv = _mm_set1_ps(v);
+	const __m128 oneV2 = _mm_add_ps(one, _mm_mul_ps(vv, vv));
+
+	__m128 accumulators[SHCoefficients::Count][3];
+	for (int i = 0; i < SHCoefficients::Count; ++i)
+	{
+		accumulators[i][0] = accumulators[i][1] = accumulators[i][2] = _mm_setzero_ps();
+	}
+	__m128 weightSum = _mm_setzero_ps();
+
+	unsigned int x = 0;
+	for (; x + 4 <= faceSize; x += 4)
+	{
+		__m128 u = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), offsets), scale), one);
+
+		__m128 invLengthSq = _mm_div_ps(one, _mm_add_ps(oneV2, _mm_mul_ps(u, u)));
+		__m128 invLength = _mm_sqrt_ps(invLengthSq);
+		__m128 weight = _mm_mul_ps(invLengthSq, invLength);
+
+		__m128 dx, dy, dz;
+		FaceVectorSSE2(face, u, vv, dx, dy, dz);
+		dx = _mm_mul_ps(dx, invLength);
+		dy = _mm_mul_ps(dy, invLength);
+		dz = _mm_mul_ps(dz, invLength);
+
+		__m128 r = _mm_loadu_ps(rgba + x * 4 + 0);
+		__m128 g = _mm_loadu_ps(rgba + x * 4 + 4);
+		__m128 b = _mm_loadu_ps(rgba + x * 4 + 8);
+		__m128 a = _mm_loadu_ps(rgba + x * 4 + 12);
+		_MM_TRANSPOSE4_PS(r, g, b, a);
+
+		__m128 color[3] = { _mm_mul_ps(r, weight), _mm_mul_ps(g, weight), _mm_mul_ps(b, weight) };
+		__m128 basis[SHCoefficients::Count] =
+		{
+			one, dy, dz, dx,
+			_mm_mul_ps(dx, dy), _mm_mul_ps(dy, dz), _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dz, dz)), one),
+			_mm_mul_ps(dx, dz), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))
+		};
+
+		for (int i = 0; i < SHCoefficients::Count; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				accumulators[i][c] = _mm_add_ps(accumulators[i][c], _mm_mul_ps(basis[i], color[c]));
+			}
+		}
+		weightSum = _mm_add_ps(weightSum, weight);
+	}
+
+	float lanes[4];
+	for (int i = 0; i < SHCoefficients::Count; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			_mm_storeu_ps(lanes, accumulators[i][c]);
+			sums.sh.rgb[i][c] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		}
+	}
+	_mm_storeu_ps(lanes, weightSum);
+	sums.weight += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+	ProjectTexelsScalar(face, v, rgba, x, faceSize, faceSize, sums);
+}
+
+// Raw sums to coefficients, the weights of a face add up to its solid angle 4 pi / 6
+static void NormalizeFace(const RowSums& sums, SHCoefficients& radiance)
+{
+	float normalization = sums.weight > 0.0f ? (4.0f * Pi / 6.0f) / sums.weight : 0.0f;
+	for (int i = 0; i < SHCoefficients::Count; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			radiance.rgb[i][c] = sums.sh.rgb[i][c] * BasisConstants[i] * normalization;
+		}
+	}
+}
+
+void SphericalHarmonics::ProjectFace(unsigned int face, const uint16_t* texels, unsigned int faceSize, SHCoefficients& radiance,
+	unsigned int threadCount)
+{
+	radiance = SHCoefficients();
+	if (faceSize == 0)
+		return;
+
+	size_t blockCount = (faceSize + RowsPerBlock - 1) / RowsPerBlock;
+	std::vector<RowSums> blocks(blockCount);
+
+	ParallelFor(blockCount, 1, threadCount, [&](size_t begin, size_t end)
+	{
+		std::vector<float> row((size_t)faceSize * 4);
+		for (size_t block = begin; block < end; ++block)
+		{
+			unsigned int firstRow = (unsigned int)block * RowsPerBlock;
+			unsigned int lastRow = std::min(firstRow + RowsPerBlock, faceSize);
+			for (unsigned int y = firstRow; y < lastRow; ++y)
+			{
+				ConvertHalvesToFloats(texels + (size_t)y * faceSize * 4, row.size(), row.data());
+				ProjectRowSSE2(face, (y + 0.5f) * 2.0f / faceSize - 1.0f, row.data(), faceSize, blocks[block]);
+			}
+		}
+	});
+
+	RowSums sums;
+	for (const RowSums& block : blocks)
+	{
+		sums.sh += block.sh;
+		sums.weight += block.weight;
+	}
+	NormalizeFace(sums, radiance);
+}
+
+void SphericalHarmonics::ProjectFaceScalar(unsigned int face, const uint16_t* texels, unsigned int faceSize, SHCoefficients& radiance)
+{
+	radiance = SHCoefficients();
+
+	RowSums sums;
+	std::vector<float> row((size_t)faceSize * 4);
+	for (unsigned int y = 0; y < faceSize; ++y)
+	{
+		ConvertHalvesToFloats(texels + (size_t)y * faceSize * 4, row.size(), row.data());
+		ProjectTexelsScalar(face, (y + 0.5f) * 2.0f / faceSize - 1.0f, row.data(), 0, faceSize, faceSize, sums);
+	}
+	NormalizeFace(sums, radiance);
+}
+
+void SphericalHarmonics::ProjectCubemap(const uint16_t* faces, unsigned int faceSize, SHCoefficients& radiance, unsigned int threadCount)
+{
+	radiance = SHCoefficients();
+
+	size_t faceTexels = (size_t)faceSize * faceSize * 4;
+	for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+	{
+		SHCoefficients faceRadiance;
+		ProjectFace(face, faces + face * faceTexels, faceSize, faceRadiance, threadCount);
+		radiance += faceRadiance;
+	}
+}
+
+void SphericalHarmonics::AmbientCoefficients(const SHCoefficients& radiance, SHCoefficients& ambient)
+{
+	for (int i = 0; i < SHCoefficients::Count; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			ambient.rgb[i][c] = radiance.rgb[i][c] * BandScales[i] * BasisConstants[i];
+		}
+	}
+}
+
+void SphericalHarmonics::HemisphereAmbient(const float lower[3], const float upper[3], SHCoefficients& ambient)
+{
+	ambient = SHCoefficients();
+	for (int c = 0; c < 3; ++c)
+	{
+		ambient.rgb[0][c] = 0.5f * (lower[c] + upper[c]);
+		ambient.rgb[1][c] = 0.5f * (upper[c] - lower[c]);
+	}
+}
+
+void SphericalHarmonics::EvaluateAmbient(const SHCoefficients& ambient, const float normal[3], float rgb[3])
+{
+	float basis[SHCoefficients::Count];
+	BasisPolynomials(normal[0], normal[1], normal[2], basis);
+
+	for (int c = 0; c < 3; ++c)
+	{
+		float sum = 0.0f;
+		for (int i = 0; i < SHCoefficients::Count; ++i)
+		{
+			sum += ambient.rgb[i][c] * basis[i];
+		}
+		rgb[c] = std::max(sum, 0.0f);
+	}
+}
+
+// Solid angle of the face rectangle from (0, 0) to (u, v), for the exact texel solid angles
+static double AreaElement(double u, double v)
+{
+	return atan2(u * v, sqrt(u * u + v * v + 1.0));
+}
+
+void SphericalHarmonics::IntegrateAmbient(const uint16_t* faces, unsigned int faceSize, const float normal[3], float rgb[3])
+{
+	double sum[3] = { 0.0, 0.0, 0.0 };
+	double step = 2.0 / faceSize;
+
+	std::vector<float> row((size_t)faceSize * 4);
+	for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+	{
+		for (unsigned int y = 0; y < faceSize; ++y)
+		{
+			ConvertHalvesToFloats(faces + ((size_t)face * faceSize + y) * faceSize * 4, row.size(), row.data());
+
+			double v0 = y * step - 1.0;
+			double v1 = v0 + step;
+			for (unsigned int x = 0; x < faceSize; ++x)
+			{
+				double u0 = x * step - 1.0;
+				double u1 = u0 + step;
+				double solidAngle = AreaElement(u0, v0) - AreaElement(u0, v1) - AreaElement(u1, v0) + AreaElement(u1, v1);
+
+				float direction[3];
+				CubemapConverter::FaceDirection(face, (float)(u0 + 0.5 * step), (float)(v0 + 0.5 * step), direction);
+				double cosine = direction[0] * normal[0] + direction[1] * normal[1] + direction[2] * normal[2];
+				if (cosine <= 0.0)
+					continue;
+
+				for (int c = 0; c < 3; ++c)
+				{
+					sum[c] += row[x * 4 + c] * cosine * solidAngle;
+				}
+			}
+		}
+	}
+
+	for (int c = 0; c < 3; ++c)
+	{
+		rgb[c] = (float)(sum[c] / Pi);
+	}
+}
+
+SHIrradianceBaker::SHIrradianceBaker() : mFaceSize(0)
+{
+}
+
+void SHIrradianceBaker::Bake(const uint16_t* faces, unsigned int faceSize, unsigned int threadCount)
+{
+	mFaceSize = faceSize;
+
+	size_t faceTexels = (size_t)faceSize * faceSize * 4;
+	for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+	{
+		SphericalHarmonics::ProjectFace(face, faces + face * faceTexels, faceSize, mFaces[face], threadCount);
+	}
+}
+
+void SHIrradianceBaker::UpdateFace(unsigned int face, const uint16_t* texels, unsigned int threadCount)
+{
+	if (face < CubemapConverter::FaceCount)
+		SphericalHarmonics::ProjectFace(face, texels, mFaceSize, mFaces[face], threadCount);
+}
+
+SHCoefficients SHIrradianceBaker::GetRadiance() const
+{
+	SHCoefficients radiance;
+	for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+	{
+		radiance += mFaces[face];
+	}
+	return radiance;
+}
+
+SHCoefficients SHIrradianceBaker::GetAmbient() const
+{
+	SHCoefficients ambient;
+	SphericalHarmonics::AmbientCoefficients(GetRadiance(), ambient);
+	return ambient;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// SphericalHarmonics
+// Projection of an RGBA16F cubemap, as written by CubemapConverter, onto the
+// 9 coefficients of the spherical harmonics bands 0 to 2, and the irradiance
+// (Ramamoorthi, Hanrahan 2001) the deferred directional light pass uses as
+// its ambient term. Texels are weighted by their solid angle; the SSE2 loop
+// projects four texels of a face row at a time and is checked against a scalar
+// reference. Face rows are spread over threads in fixed blocks, so the result
+// does not depend on the thread count. Each face is projected on its own and
+// the faces are summed, SHIrradianceBaker keeps the faces so a changed face is
+// the only one projected again. Only the standard library is used, as in CubemapConverter.
+// usage:
+// SHCoefficients radiance, ambient;
+// SphericalHarmonics::ProjectCubemap(faces, faceSize, radiance);
+// SphericalHarmonics::AmbientCoefficients(radiance, ambient);
+// lightManager.SetAmbientSH(ambient);
+
+// Band 0 to 2 coefficients, red green blue each
+struct SHCoefficients
+{
+	static const int Count = 9;
+
+	SHCoefficients();
+
+	SHCoefficients& operator+=(const SHCoefficients& rhs);
+
+	float rgb[Count][3];
+};
+
+class SphericalHarmonics
+{
+public:
+	// The 9 basis functions in unit direction
+	static void EvaluateBasis(const float direction[3], float basis[SHCoefficients::Count]);
+
+	// Radiance of the faces, FaceCount * faceSize * faceSize RGBA16F texels, face after face.
+	// threadCount 0 uses one thread per hardware thread.
+	static void ProjectCubemap(const uint16_t* faces, unsigned int faceSize, SHCoefficients& radiance, unsigned int threadCount = 0);
+
+	// Contribution of one face of faceSize * faceSize texels to ProjectCubemap
+	static void ProjectFace(unsigned int face, const uint16_t* texels, unsigned int faceSize, SHCoefficients& radiance,
+		unsigned int threadCount = 0);
+	static void ProjectFaceScalar(unsigned int face, const uint16_t* texels, unsigned int faceSize, SHCoefficients& radiance);
+
+	// Radiance coefficients convolved with the clamped cosine and divided by pi, premultiplied
+	// by the basis constants: the ambient light of a white Lambert surface with normal n is
+	// c0 + c1 y + c2 z + c3 x + c4 xy + c5 yz + c6 (3z^2 - 1) + c7 xz + c8 (x^2 - y^2)
+	static void AmbientCoefficients(const SHCoefficients& radiance, SHCoefficients& ambient);
+
+	// The hemisphere ambient lower + (n.y * 0.5 + 0.5) * (upper - lower) as ambient coefficients
+	static void HemisphereAmbient(const float lower[3], const float upper[3], SHCoefficients& ambient);
+
+	// Evaluates ambient coefficients for unit normal as the shader does, negative values clamped
+	static void EvaluateAmbient(const SHCoefficients& ambient, const float normal[3], float rgb[3]);
+
+	// Reference ambient for unit normal, the cosine weighted sum over every texel of the faces
+	// with its exact solid angle, divided by pi
+	static void IntegrateAmbient(const uint16_t* faces, unsigned int faceSize, const float normal[3], float rgb[3]);
+};
+
+// Radiance of a cubemap kept per face, so a change in some faces only projects those again
+class SHIrradianceBaker
+{
+public:
+	SHIrradianceBaker();
+
+	void Bake(const uint16_t* faces, unsigned int faceSize, unsigned int threadCount = 0);
+
+	// texels of face changed, the other faces keep their projection
+	void UpdateFace(unsigned int face, const uint16_t* texels, unsigned int threadCount = 0);
+
+	unsigned int GetFaceSize() const { return mFaceSize; }
+
+	SHCoefficients GetRadiance() const;
+	SHCoefficients GetAmbient() const;
+
+private:
+	unsigned int mFaceSize;
+	SHCoefficients mFaces[6];
+};
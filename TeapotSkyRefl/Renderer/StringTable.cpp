@@ -0,0 +1,91 @@
+#include "StringTable.h"
+
+const uint32_t StringTable::InvalidHandle;
+
+static const size_t InitialSlots = 64;
+
+StringTable::StringTable() : mSlots(InitialSlots, InvalidHandle), mStrings(1), mHashes(1, 0)
+{
+}
+
+uint64_t StringTable::Hash(const char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+size_t StringTable::FindSlot(const std::string& s, uint64_t hash) const
+{
+	size_t mask = mSlots.size() - 1;
+	size_t slot = (size_t)hash & mask;
+
+	// the table is never full, an empty slot ends every walk
+	while (mSlots[slot] != InvalidHandle)
+	{
+		uint32_t handle = mSlots[slot];
+		if (mHashes[handle] == hash && mStrings[handle] == s)
+			break;
+
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+uint32_t StringTable::Find(const std::string& s) const
+{
+	return mSlots[FindSlot(s, Hash(s.data(), s.size()))];
+}
+
+uint32_t StringTable::Intern(const std::string& s)
+{
+	uint64_t hash = Hash(s.data(), s.size());
+	size_t slot = FindSlot(s, hash);
+	if (mSlots[slot] != InvalidHandle)
+		return mSlots[slot];
+
+	uint32_t handle = (uint32_t)mStrings.size();
+	mStrings.push_back(s);
+	mHashes.push_back(hash);
+	mSlots[slot] = handle;
+
+	if (Size() * 2 > mSlots.size())
+		Grow();
+
+	return handle;
+}
+
+void StringTable::Grow()
+{
+	mSlots.assign(mSlots.size() * 2, InvalidHandle);
+
+	size_t mask = mSlots.size() - 1;
+	for (uint32_t handle = 1; handle < mStrings.size(); ++handle)
+	{
+		size_t slot = (size_t)mHashes[handle] & mask;
+		while (mSlots[slot] != InvalidHandle)
+		{
+			slot = (slot + 1) & mask;
+		}
+		mSlots[slot] = handle;
+	}
+}
+
+double StringTable::AverageProbeCount() const
+{
+	if (Size() == 0)
+		return 0.0;
+
+	size_t mask = mSlots.size() - 1;
+	size_t probes = 0;
+	for (uint32_t handle = 1; handle < mStrings.size(); ++handle)
+	{
+		size_t home = (size_t)mHashes[handle] & mask;
+		probes += ((FindSlot(mStrings[handle], mHashes[handle]) - home) & mask) + 1;
+	}
+	return (double)probes / Size();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// StringTable
+// Interns strings to dense 32 bit handles: 1, 2, 3... in the order they are first
+// seen, 0 is no string. Handles index arrays kept next to the table, so the lookup
+// done every frame is an array index and strings are only hashed when resolving them.
+// The string to handle lookup is an open addressing hash table with linear probing
+// that stores only handles, at most half full; the strings and their FNV-1a hashes
+// are kept by handle so growing the table does not hash them again.
+// Only the standard library is used.
+// usage:
+// StringTable table;
+// uint32_t handle = table.Intern("..\\Assets\\bricks.png");
+// srvs.resize(table.Size() + 1); srvs[handle] = srv;
+
+class StringTable
+{
+public:
+	static const uint32_t InvalidHandle = 0;
+
+	StringTable();
+
+	// handle of s, added to the table the first time
+	uint32_t Intern(const std::string& s);
+
+	// InvalidHandle if s is not in the table
+	uint32_t Find(const std::string& s) const;
+
+	// the interned string, empty for InvalidHandle
+	const std::string& GetString(uint32_t handle) const { return mStrings[handle < mStrings.size() ? handle : 0]; }
+
+	// strings in the table, the largest handle
+	size_t Size() const { return mStrings.size() - 1; }
+
+	// slots a Find of an interned string reads on average, 1 when every string is in its first slot
+	double AverageProbeCount() const;
+
+	// FNV-1a 64 bit hash
+	static uint64_t Hash(const char* data, size_t size);
+
+private:
+	// the slot holding s or the empty slot it goes to
+	size_t FindSlot(const std::string& s, uint64_t hash) const;
+	void Grow();
+
+	std::vector<uint32_t> mSlots;		// handles, power of two size, InvalidHandle when empty
+	std::vector<std::string> mStrings;	// by handle, 0 is the empty string
+	std::vector<uint64_t> mHashes;		// by handle
+};
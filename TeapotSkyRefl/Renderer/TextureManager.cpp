@@ -1,12 +1,33 @@
 #include "TextureManager.h"
+#include "MappedFile.h"
+#include "CubemapConverter.h"
+#include "EnvironmentPrefilter.h"
+#include "BlockCompressor.h"
+#include "MipGenerator.h"
+#include "AssetLoader.h"
 
-#include "../DirectXTex/WICTextureLoader/WICTextureLoader.h"
 #include "DirectXTex/DDSTextureLoader/DDSTextureLoader.h"
 
+#include <wincodec.h>
+
 TextureManager *TextureManager::mInstance = 0;
+static std::mutex InstanceMutex;
+
+// decoded textures are sRGB color, their mips are Kaiser filtered in linear space
+static const MipFilter TextureMipFilter = MIP_FILTER_KAISER;
+
+// the texture caches are made again when the mips are made differently
+static const uint32_t TextureCookSetting = (MipGenerator::Version << 4) | TextureMipFilter;
+
+// textures larger than this many texels start with the mips of up to this size and stream the rest
+static const UINT StreamTailSize = 128;
+
+// bytes of streamed mips uploaded in a frame
+static const uint64_t StreamUploadBudget = 4 << 20;
 
 TextureManager* TextureManager::Instance()
 {
+	std::lock_guard<std::mutex> lock(InstanceMutex);
 	if (mInstance == 0)
 	{
 		mInstance = new TextureManager();
@@ -14,15 +35,16 @@ TextureManager* TextureManager::Instance()
 	return mInstance;
 }
 
-TextureManager::TextureManager() : md3dDevice(0)
+TextureManager::TextureManager() : md3dDevice(0), mTextureSRVs(1, (ID3D11ShaderResourceView*)NULL)
 {
+	mStreamer.SetUploadBudget(StreamUploadBudget);
 }
 
 TextureManager::~TextureManager()
 {
-	for (auto it = mTextureSRVs.begin(); it != mTextureSRVs.end(); ++it)
+	for (ID3D11ShaderResourceView*& srv : mTextureSRVs)
 	{
-		ReleaseCOM(it->second);
+		ReleaseCOM(srv);
 	}
 
 	mTextureSRVs.clear();
@@ -33,64 +55,518 @@ void TextureManager::Init(ID3D11Device* device)
 	md3dDevice = device;
 }
 
-ID3D11ShaderResourceView* TextureManager::CreateTexture(std::string filename)
+bool TextureManager::IsDDS(const std::string& filename)
+{
+	size_t pos = filename.find_last_of('.');
+	return pos != std::string::npos && filename.substr(pos) == ".dds";
+}
+
+TextureHandle TextureManager::Intern(const std::string& filename)
+{
+	TextureHandle handle = mFilenames.Intern(filename);
+	if (handle >= mTextureSRVs.size())
+		mTextureSRVs.resize(handle + 1, NULL);
+	return handle;
+}
+
+TextureHandle TextureManager::GetHandle(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return Intern(filename);
+}
+
+ID3D11ShaderResourceView* TextureManager::CreateTexture(const std::string& filename)
+{
+	if (!md3dDevice)
+		return NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		ID3D11ShaderResourceView* srv = mTextureSRVs[Intern(filename)];
+		if (srv != NULL)
+			return srv;
+	}
+
+	TextureData data;
+	LoadTextureData(filename, data);
+	return CreateTexture(data);
+}
+
+// Bits of a texel, of a 4 x 4 block divided by 16 for the block compressed formats
+static UINT BitsPerTexel(DXGI_FORMAT format, bool& blockCompressed)
+{
+	blockCompressed = false;
+	switch (format)
+	{
+	case DXGI_FORMAT_BC1_TYPELESS:
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_TYPELESS:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC4_SNORM:
+		blockCompressed = true;
+		return 4;
+	case DXGI_FORMAT_BC2_TYPELESS:
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_TYPELESS:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC5_TYPELESS:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC5_SNORM:
+	case DXGI_FORMAT_BC6H_TYPELESS:
+	case DXGI_FORMAT_BC6H_UF16:
+	case DXGI_FORMAT_BC6H_SF16:
+	case DXGI_FORMAT_BC7_TYPELESS:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		blockCompressed = true;
+		return 8;
+	case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+	case DXGI_FORMAT_R32G32B32A32_UINT:
+	case DXGI_FORMAT_R32G32B32A32_SINT:
+		return 128;
+	case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+	case DXGI_FORMAT_R16G16B16A16_UINT:
+	case DXGI_FORMAT_R16G16B16A16_SNORM:
+	case DXGI_FORMAT_R16G16B16A16_SINT:
+	case DXGI_FORMAT_R32G32_TYPELESS:
+	case DXGI_FORMAT_R32G32_FLOAT:
+	case DXGI_FORMAT_R32G32_UINT:
+	case DXGI_FORMAT_R32G32_SINT:
+		return 64;
+	case DXGI_FORMAT_R8G8_TYPELESS:
+	case DXGI_FORMAT_R8G8_UNORM:
+	case DXGI_FORMAT_R8G8_UINT:
+	case DXGI_FORMAT_R8G8_SNORM:
+	case DXGI_FORMAT_R8G8_SINT:
+	case DXGI_FORMAT_R16_TYPELESS:
+	case DXGI_FORMAT_R16_FLOAT:
+	case DXGI_FORMAT_R16_UNORM:
+	case DXGI_FORMAT_R16_UINT:
+	case DXGI_FORMAT_R16_SNORM:
+	case DXGI_FORMAT_R16_SINT:
+		return 16;
+	case DXGI_FORMAT_R8_TYPELESS:
+	case DXGI_FORMAT_R8_UNORM:
+	case DXGI_FORMAT_R8_UINT:
+	case DXGI_FORMAT_R8_SNORM:
+	case DXGI_FORMAT_R8_SINT:
+	case DXGI_FORMAT_A8_UNORM:
+		return 8;
+	default:
+		// RGBA8, BGRA8, RG16, R32, R11G11B10 and the other 32 bit formats
+		return 32;
+	}
+}
+
+// bytes of a row of texels, of 4 x 4 blocks when block compressed, and of a whole mip
+static void MipPitch(DXGI_FORMAT format, UINT width, UINT height, UINT& rowPitch, UINT& mipBytes)
 {
-	if (md3dDevice)
+	bool blockCompressed;
+	UINT bits = BitsPerTexel(format, blockCompressed);
+	if (blockCompressed)
+	{
+		rowPitch = ((width + 3) / 4) * 2 * bits;
+		mipBytes = rowPitch * ((height + 3) / 4);
+	}
+	else
+	{
+		rowPitch = (width * bits + 7) / 8;
+		mipBytes = rowPitch * height;
+	}
+}
+
+ID3D11ShaderResourceView* TextureManager::CreateTexture(const TextureData& data)
+{
+	if (!md3dDevice)
+		return NULL;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	TextureHandle handle = Intern(data.filename);
+	ID3D11ShaderResourceView*& srv = mTextureSRVs[handle];
+	if (srv != NULL)
+		return srv;
+
+	ID3D11Resource* texture = 0;
+	if (!data.fileData.empty())
+	{
+		DirectX::CreateDDSTextureFromMemory(md3dDevice, data.fileData.data(), data.fileData.size(), &texture, &srv);
+	}
+	else if (!data.pixels.empty())
 	{
-		ID3D11ShaderResourceView* srv = 0;
+		// a streamed texture gets its finer mips later, the texture can be updated then
+		bool streamed = data.firstMip > 0;
+
+		D3D11_TEXTURE2D_DESC desc;
+		ZeroMemory(&desc, sizeof(desc));
+		desc.Width = data.width;
+		desc.Height = data.height;
+		desc.MipLevels = data.mipCount;
+		desc.ArraySize = 1;
+		desc.Format = data.format;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = streamed ? D3D11_USAGE_DEFAULT : D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 
-		if (mTextureSRVs.find(filename) != mTextureSRVs.end())
+		std::vector<D3D11_SUBRESOURCE_DATA> initData(data.mipCount);
+		size_t offset = 0;
+		for (UINT mip = data.firstMip; mip < data.mipCount; ++mip)
 		{
-			srv = mTextureSRVs[filename];
+			UINT rowPitch, mipBytes;
+			MipPitch(data.format, (std::max)(data.width >> mip, 1u), (std::max)(data.height >> mip, 1u), rowPitch, mipBytes);
+			initData[mip].pSysMem = data.pixels.data() + offset;
+			initData[mip].SysMemPitch = rowPitch;
+			initData[mip].SysMemSlicePitch = 0;
+			offset += mipBytes;
 		}
-		else
-		{
-			ID3D11Resource* texture = 0;
-			std::wstring wstrFilename = std::wstring(filename.begin(), filename.end());
 
-			size_t pos = 0;
-			pos = filename.find_last_of('.');
-			std::string strEnding = filename.substr(pos, filename.length());
+		// every mip in the one call when the texture is immutable
+		ID3D11Texture2D* texture2D = NULL;
+		if (SUCCEEDED(md3dDevice->CreateTexture2D(&desc, streamed ? NULL : initData.data(), &texture2D)))
+		{
+			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+			ZeroMemory(&srvDesc, sizeof(srvDesc));
+			srvDesc.Format = desc.Format;
+			srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+			srvDesc.Texture2D.MostDetailedMip = data.firstMip;
+			srvDesc.Texture2D.MipLevels = data.mipCount - data.firstMip;
+			md3dDevice->CreateShaderResourceView(texture2D, &srvDesc, &srv);
+			texture = texture2D;
+		}
 
-			if (strEnding == ".dds")
+		if (srv != NULL && streamed)
+		{
+			ID3D11DeviceContext* context = NULL;
+			md3dDevice->GetImmediateContext(&context);
+			for (UINT mip = data.firstMip; mip < data.mipCount; ++mip)
 			{
-				DirectX::CreateDDSTextureFromFile(md3dDevice, wstrFilename.c_str(), &texture, &srv);
-				/*
-				size_t maxsize = 0;
-				DDS_ALPHA_MODE* alphaMode = nullptr;
-				DirectX::CreateDDSTextureFromFileEx(md3dDevice, nullptr,
-					wstrFilename.c_str(),
-					maxsize,
-					D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, D3D11_RESOURCE_MISC_TEXTURECUBE,
-					false,
-					&texture, &srv, alphaMode);
-					*/
-			}
-			else {
-				DirectX::CreateWICTextureFromFile(md3dDevice, wstrFilename.c_str(), &texture, &srv);
+				context->UpdateSubresource(texture, mip, NULL, initData[mip].pSysMem, initData[mip].SysMemPitch, 0);
 			}
+			ReleaseCOM(context);
 
-			mTextureSRVs[filename] = srv;
+			mStreamer.Add(handle, data.streamFile, data.width, data.height, data.streamMips, data.firstMip);
 		}
+	}
 
-		return srv;
+	// the view holds its own reference to the texture
+	ReleaseCOM(texture);
+
+	if (srv != NULL)
+		mResidency.OnCreated(handle, TextureBytes(srv), data.evictable);
+
+	return srv;
+}
+
+UINT64 TextureManager::TextureBytes(ID3D11ShaderResourceView* srv)
+{
+	ID3D11Resource* resource = NULL;
+	srv->GetResource(&resource);
+
+	ID3D11Texture2D* texture2D = NULL;
+	UINT64 bytes = 0;
+	if (resource != NULL && SUCCEEDED(resource->QueryInterface(__uuidof(ID3D11Texture2D), (void**)&texture2D)))
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		texture2D->GetDesc(&desc);
+
+		bool blockCompressed;
+		UINT bits = BitsPerTexel(desc.Format, blockCompressed);
+		bytes = TextureResidency::TextureBytes(desc.Width, desc.Height, desc.MipLevels, desc.ArraySize, bits, blockCompressed);
 	}
+
+	SAFE_RELEASE(texture2D);
+	SAFE_RELEASE(resource);
+	return bytes;
 }
 
-ID3D11ShaderResourceView* TextureManager::GetTexture(std::string filename)
+void TextureManager::SetBudget(UINT64 bytes)
 {
-	return mTextureSRVs[filename];
+	mResidency.SetBudget(bytes);
 }
 
-void TextureManager::Release()
+void TextureManager::RequestMip(TextureHandle handle, float screenPixels)
 {
-	for (auto& kv : mTextureSRVs)
+	mStreamer.RequestScreenSize(handle, screenPixels);
+}
+
+void TextureManager::Update()
+{
+	std::vector<std::string> reloadFiles;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mResidency.EndFrame(mEvict, mReload);
+
+		for (uint32_t handle : mEvict)
+		{
+			ReleaseCOM(mTextureSRVs[handle]);
+			mStreamer.Remove(handle);
+		}
+
+		for (uint32_t handle : mReload)
+		{
+			reloadFiles.push_back(mFilenames.GetString(handle));
+		}
+	}
+
+	// the workers read the files again, CreateTexture brings them back
+	for (const std::string& filename : reloadFiles)
+	{
+		AssetLoader::Instance()->LoadTexture(filename);
+	}
+
+	UploadStreamedMips();
+}
+
+void TextureManager::UploadStreamedMips()
+{
+	mStreamer.Update(mUploads);
+	if (mUploads.empty() || !md3dDevice)
+		return;
+
+	ID3D11DeviceContext* context = NULL;
+	md3dDevice->GetImmediateContext(&context);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (const TextureMipUpload& upload : mUploads)
+	{
+		ID3D11ShaderResourceView* srv = mTextureSRVs[upload.handle];
+		if (srv == NULL)
+			continue;
+
+		ID3D11Resource* texture = NULL;
+		srv->GetResource(&texture);
+		context->UpdateSubresource(texture, upload.mip, NULL, upload.data.data(), upload.rowPitch, 0);
+		ReleaseCOM(texture);
+	}
+
+	// the views are widened once a texture has all its mips of the frame
+	for (const TextureMipUpload& upload : mUploads)
 	{
-		if (kv.second != NULL)
+		ID3D11ShaderResourceView*& srv = mTextureSRVs[upload.handle];
+		if (srv == NULL)
+			continue;
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		srv->GetDesc(&srvDesc);
+		UINT residentMip = mStreamer.GetResidentMip(upload.handle);
+		if (srvDesc.Texture2D.MostDetailedMip == residentMip)
+			continue;
+
+		srvDesc.Texture2D.MipLevels += srvDesc.Texture2D.MostDetailedMip - residentMip;
+		srvDesc.Texture2D.MostDetailedMip = residentMip;
+
+		ID3D11Resource* texture = NULL;
+		srv->GetResource(&texture);
+		ID3D11ShaderResourceView* finerSRV = NULL;
+		if (SUCCEEDED(md3dDevice->CreateShaderResourceView(texture, &srvDesc, &finerSRV)))
 		{
-			ReleaseCOM(kv.second);
-			kv.second = NULL;
+			ReleaseCOM(srv);
+			srv = finerSRV;
 		}
+		ReleaseCOM(texture);
+	}
+
+	ReleaseCOM(context);
+}
+
+// The mips of a block compressed cache from the one of StreamTailSize on, the layout of all
+// of them for the streamer. false when the cache is missing or the texture is small.
+static bool LoadTextureTail(const std::string& filename, TextureData& data)
+{
+	std::string cacheFile;
+	CookedDds desc;
+	if (!BlockCompressor::FindTextureCache(filename, TextureCookSetting, cacheFile, desc) || desc.cube ||
+		(std::max)(desc.width, desc.height) <= StreamTailSize)
+	{
+		return false;
+	}
+
+	UINT firstMip = 0;
+	while (firstMip + 1 < desc.mipCount && (std::max)(desc.width >> firstMip, desc.height >> firstMip) > StreamTailSize)
+	{
+		firstMip++;
+	}
+
+	DXGI_FORMAT format = desc.fourCC == CubemapConverter::FourCCDxt1 ? DXGI_FORMAT_BC1_UNORM : DXGI_FORMAT_BC3_UNORM;
+	data.streamMips.resize(desc.mipCount);
+	uint64_t offset = desc.HeaderSize();
+	for (UINT mip = 0; mip < desc.mipCount; ++mip)
+	{
+		UINT rowPitch, mipBytes;
+		MipPitch(format, (std::max)(desc.width >> mip, 1u), (std::max)(desc.height >> mip, 1u), rowPitch, mipBytes);
+
+		TextureMipLayout& layout = data.streamMips[mip];
+		layout.offset = offset;
+		layout.bytes = mipBytes;
+		layout.rowPitch = rowPitch;
+		offset += mipBytes;
+	}
+
+	// the tail is the end of the file
+	uint64_t tailOffset = data.streamMips[firstMip].offset;
+	data.pixels.resize((size_t)(offset - tailOffset));
+	if (!TextureStreamer::ReadFile(cacheFile, tailOffset, data.pixels.size(), data.pixels.data()))
+	{
+		data.pixels.clear();
+		data.streamMips.clear();
+		return false;
+	}
+
+	data.width = desc.width;
+	data.height = desc.height;
+	data.mipCount = desc.mipCount;
+	data.format = format;
+	data.firstMip = firstMip;
+	data.streamFile = cacheFile;
+	return true;
+}
+
+bool TextureManager::LoadTextureData(const std::string& filename, TextureData& data, bool byHandle)
+{
+	// read from the file as is, it can be read again after an eviction
+	data.filename = filename;
+	data.evictable = byHandle;
+
+	MappedFile file;
+	if (!file.Open(filename))
+		return false;
+
+	if (IsDDS(filename))
+	{
+		data.fileData.assign((const BYTE*)file.Data(), (const BYTE*)file.Data() + file.Size());
+		return true;
+	}
+
+	// large textures start small, the rest of the cache streams in
+	if (byHandle && LoadTextureTail(filename, data))
+		return true;
+
+	// block compressed the last time it was decoded
+	if (BlockCompressor::ReadTextureCache(filename, TextureCookSetting, data.fileData))
+		return true;
+
+	// WIC decode to RGBA8, COM is initialized for the calling thread if needed
+	HRESULT comResult = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+	IWICImagingFactory* factory = NULL;
+	IWICStream* stream = NULL;
+	IWICBitmapDecoder* decoder = NULL;
+	IWICBitmapFrameDecode* frame = NULL;
+	IWICFormatConverter* converter = NULL;
+
+	HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+	if (SUCCEEDED(hr))
+		hr = factory->CreateStream(&stream);
+	if (SUCCEEDED(hr))
+		hr = stream->InitializeFromMemory((BYTE*)file.Data(), (DWORD)file.Size());
+	if (SUCCEEDED(hr))
+		hr = factory->CreateDecoderFromStream(stream, NULL, WICDecodeMetadataCacheOnDemand, &decoder);
+	if (SUCCEEDED(hr))
+		hr = decoder->GetFrame(0, &frame);
+	if (SUCCEEDED(hr))
+		hr = factory->CreateFormatConverter(&converter);
+	if (SUCCEEDED(hr))
+		hr = converter->Initialize(frame, GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom);
+	if (SUCCEEDED(hr))
+		hr = converter->GetSize(&data.width, &data.height);
+	if (SUCCEEDED(hr) && (data.width == 0 || data.height == 0 ||
+		data.width > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || data.height > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION))
+	{
+		hr = E_INVALIDARG;
+	}
+	if (SUCCEEDED(hr))
+	{
+		UINT stride = data.width * 4;
+		data.pixels.resize((size_t)stride * data.height);
+		hr = converter->CopyPixels(NULL, stride, (UINT)data.pixels.size(), data.pixels.data());
+	}
+
+	SAFE_RELEASE(converter);
+	SAFE_RELEASE(frame);
+	SAFE_RELEASE(decoder);
+	SAFE_RELEASE(stream);
+	SAFE_RELEASE(factory);
+
+	if (SUCCEEDED(comResult))
+		CoUninitialize();
+
+	if (FAILED(hr))
+	{
+		data.pixels.clear();
+		return false;
+	}
+
+	std::vector<BYTE> chain;
+	MipGenerator::Generate(data.pixels.data(), data.width, data.height, true, TextureMipFilter, chain);
+	data.pixels.swap(chain);
+	data.mipCount = MipGenerator::MipCount(data.width, data.height);
+
+	CompressTextureData(data);
+	return true;
+}
+
+bool TextureManager::CompressTextureData(TextureData& data)
+{
+	if (!data.pixels.empty())
+	{
+		if (!BlockCompressor::CookTexture(data.filename, TextureCookSetting, data.pixels.data(), data.width, data.height, data.mipCount,
+			data.fileData))
+			return false;
+
+		data.pixels.clear();
+		return true;
+	}
+
+	std::vector<unsigned char> dds;
+	if (!BlockCompressor::LoadHalfDds(BlockCompressor::CacheFileName(data.filename, BLOCK_BC6H), data.fileData, dds))
+		return false;
+
+	data.fileData.swap(dds);
+	return true;
+}
+
+bool TextureManager::LoadCubemapData(const std::string& equirectFile, UINT faceSize, TextureData& data)
+{
+	data.filename = CubemapConverter::CacheFileName(equirectFile, faceSize);
+	return CubemapConverter::LoadCubemap(equirectFile, faceSize, data.fileData);
+}
+
+bool TextureManager::LoadSpecularData(const std::string& equirectFile, UINT cubeFaceSize, UINT faceSize, TextureData& data)
+{
+	data.filename = EnvironmentPrefilter::SpecularCacheFileName(equirectFile, faceSize);
+	if (!EnvironmentPrefilter::LoadSpecular(equirectFile, cubeFaceSize, faceSize, data.fileData))
+		return false;
+
+	CompressTextureData(data);
+	return true;
+}
+
+bool TextureManager::LoadBrdfLutData(const std::string& cacheFile, UINT size, TextureData& data)
+{
+	data.filename = cacheFile;
+	return EnvironmentPrefilter::LoadBrdfLut(cacheFile, size, data.fileData);
+}
+
+ID3D11ShaderResourceView* TextureManager::GetTexture(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mTextureSRVs[mFilenames.Find(filename)];
+}
+
+void TextureManager::Release()
+{
+	// the handles stay valid, only the textures go
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (TextureHandle handle = 0; handle < mTextureSRVs.size(); ++handle)
+	{
+		ReleaseCOM(mTextureSRVs[handle]);
+		mResidency.OnReleased(handle);
+		mStreamer.Remove(handle);
 	}
-	
-}
\ No newline at end of file
+}
@@ -1,14 +1,59 @@
 #pragma once
 
 #include "Util.h"
-#include <map>
+#include "StringTable.h"
+#include "TextureResidency.h"
+#include "TextureStreamer.h"
+#include <mutex>
+
+// Interned filename of a texture, see TextureManager::GetHandle
+typedef uint32_t TextureHandle;
+static const TextureHandle InvalidTextureHandle = StringTable::InvalidHandle;
+
+// CPU side of a texture, see TextureManager::LoadTextureData
+struct TextureData
+{
+	TextureData() : width(0), height(0), mipCount(1), format(DXGI_FORMAT_R8G8B8A8_UNORM), firstMip(0), evictable(false) {}
+
+	std::string filename;
+	std::vector<BYTE> fileData;	// .dds files are created from the file as is
+	std::vector<BYTE> pixels;	// other formats are decoded to RGBA8 rows, mips firstMip to mipCount - 1 one after another
+	UINT width;
+	UINT height;
+	UINT mipCount;
+	DXGI_FORMAT format;	// of pixels
+	UINT firstMip;		// finest mip in pixels, the finer ones stream from streamFile
+	std::string streamFile;
+	std::vector<TextureMipLayout> streamMips;	// every mip in streamFile
+	bool evictable;	// may be released over the texture budget and read again from filename, see LoadTextureData
+};
 
 // TextureManager
-// Loads texture from file using WICTextureLoader and saves
-// textures as ID3D11ShaderResourceView to textures std::map object
+// Loads texture from file using WIC or DDSTextureLoader and saves
+// textures as ID3D11ShaderResourceView by the handle of the filename
 // so that for each filename there is only one texture and it is not loaded multiple times
-// new texture is created only if map does not hold texture with filename if there is value in map
+// new texture is created only if there is none with the filename, if there is one
 // the createTexture method returns it without loading new one from disk.
+// Filenames are interned to 32 bit handles (StringTable) that materials resolve
+// once when they are loaded; GetTexture(handle) is then an array index per draw.
+// Loading is split in two: LoadTextureData reads and decodes the file on any
+// thread, CreateTexture(data) creates the GPU texture, see AssetLoader.
+// The texture table is locked so the manager can be used from several threads.
+// It only changes on the thread creating the textures, the render thread, so
+// GetTexture(handle) reads it there without the lock.
+// Decoded textures get a gamma correct mip chain (MipGenerator) and are created
+// with all their mips in one initialized texture. They and the sky cubemaps are
+// block compressed on load and the .dds is cached next to the source, see
+// CompressTextureData.
+// The bytes of every texture are accounted against a budget (TextureResidency).
+// Update evicts the least recently used textures read by LoadTextureData, the ones
+// materials use by handle, and loads evicted ones again through AssetLoader when
+// GetTexture(handle) asks for them; until then the material draws untextured.
+// Large textures with a block compressed cache start with their mips up to
+// StreamTailSize texels only, so they are drawn right away. Their finer mips
+// stream in (TextureStreamer) down to the mip the materials request from their
+// screen size, a few megabytes a frame, and the view is widened to every mip that
+// has arrived.
 class TextureManager
 {
 public:
@@ -16,9 +61,60 @@ public:
 
 	void Init(ID3D11Device* device);
 
-	ID3D11ShaderResourceView* CreateTexture(std::string filename);
+	ID3D11ShaderResourceView* CreateTexture(const std::string& filename);
+
+	// creates the texture of data, or returns the existing one with its filename
+	ID3D11ShaderResourceView* CreateTexture(const TextureData& data);
+
+	// Reads and decodes filename without the device, false if it can not be read. byHandle
+	// textures are only drawn through GetTexture(handle): they may be evicted, and large ones
+	// are read from their smallest mips and stream the rest. Textures held by pointer are
+	// read whole and kept.
+	static bool LoadTextureData(const std::string& filename, TextureData& data, bool byHandle = true);
+
+	// Block compresses data through a cache next to its file: decoded mips to BC1 or BC3 and
+	// cooked RGBA16F .dds data to BC6H, see BlockCompressor. data keeps its filename, false
+	// leaves data as it was.
+	static bool CompressTextureData(TextureData& data);
+
+	// cubemap with faceSize faces converted from an equirectangular .hdr through its .dds cache,
+	// data is named after the cache file, see CubemapConverter
+	static bool LoadCubemapData(const std::string& equirectFile, UINT faceSize, TextureData& data);
+
+	// GGX prefiltered specular mip chain and split sum lookup table through their .dds caches,
+	// see EnvironmentPrefilter
+	static bool LoadSpecularData(const std::string& equirectFile, UINT cubeFaceSize, UINT faceSize, TextureData& data);
+	static bool LoadBrdfLutData(const std::string& cacheFile, UINT size, TextureData& data);
 
-	ID3D11ShaderResourceView* GetTexture(std::string filename);
+	// Handle of filename, the same for the life of the manager and valid before the texture
+	// is created. Render thread only.
+	TextureHandle GetHandle(const std::string& filename);
+
+	// NULL if the texture is not created (yet) or evicted. Marks the texture used in this frame,
+	// for the render thread.
+	ID3D11ShaderResourceView* GetTexture(TextureHandle handle)
+	{
+		mResidency.Touch(handle);
+		return handle < mTextureSRVs.size() ? mTextureSRVs[handle] : NULL;
+	}
+	ID3D11ShaderResourceView* GetTexture(const std::string& filename);
+
+	// Ends the frame of the residency: releases the textures evicted over the budget and
+	// queues the evicted textures used in the frame to be loaded again. Uploads the streamed
+	// mips that fit the frame. Once per frame.
+	void Update();
+
+	// the texture of handle spans screenPixels on screen, its mips stream down to the one
+	// that has a texel for every pixel. Render thread only.
+	void RequestMip(TextureHandle handle, float screenPixels);
+
+	// bytes the textures may take, 0 for no budget
+	void SetBudget(UINT64 bytes);
+	const TextureResidencyStats& GetResidencyStats() const { return mResidency.GetStats(); }
+	const TextureStreamerStats& GetStreamerStats() const { return mStreamer.GetStats(); }
+
+	// bytes of the texture behind a view, by format, mips and slices
+	static UINT64 TextureBytes(ID3D11ShaderResourceView* srv);
 
 	void Release();
 
@@ -31,6 +127,20 @@ private:
 
 	TextureManager(const TextureManager& rhs);
 
+	static bool IsDDS(const std::string& filename);
+
+	// handle of filename with a slot in mTextureSRVs, mMutex held
+	TextureHandle Intern(const std::string& filename);
+
+	// the mips the streamer read, and views of them
+	void UploadStreamedMips();
+
 	ID3D11Device* md3dDevice;
-	std::map<std::string, ID3D11ShaderResourceView*> mTextureSRVs;
-};
\ No newline at end of file
+	std::mutex mMutex;
+	StringTable mFilenames;
+	std::vector<ID3D11ShaderResourceView*> mTextureSRVs;	// by handle
+	TextureResidency mResidency;
+	std::vector<uint32_t> mEvict, mReload;
+	TextureStreamer mStreamer;
+	std::vector<TextureMipUpload> mUploads;
+};
@@ -0,0 +1,127 @@
+#include "TextureResidency.h"
+
+#include <algorithm>
+
+TextureResidency::TextureResidency() : mFrame(1)
+{
+}
+
+void TextureResidency::Resize(uint32_t handle)
+{
+	if (handle >= mEntries.size())
+	{
+		Entry entry = { 0, 0, STATE_NONE, false };
+		mEntries.resize(handle + 1, entry);
+	}
+}
+
+void TextureResidency::OnCreated(uint32_t handle, uint64_t bytes, bool evictable)
+{
+	Resize(handle);
+	Entry& entry = mEntries[handle];
+	if (entry.state == STATE_RESIDENT)
+		OnReleased(handle);
+
+	if (entry.state == STATE_EVICTED || entry.state == STATE_RELOADING)
+	{
+		mStats.evictedCount--;
+		mStats.reloads++;
+	}
+
+	// a new texture is used in the frame it arrives, it is not evicted right away
+	entry.bytes = bytes;
+	entry.lastUsed = mFrame;
+	entry.state = STATE_RESIDENT;
+	entry.evictable = evictable;
+
+	mStats.residentBytes += bytes;
+	mStats.peakResidentBytes = std::max(mStats.peakResidentBytes, mStats.residentBytes);
+	mStats.evictableBytes += evictable ? bytes : 0;
+	mStats.residentCount++;
+}
+
+void TextureResidency::OnReleased(uint32_t handle)
+{
+	if (handle >= mEntries.size())
+		return;
+
+	Entry& entry = mEntries[handle];
+	if (entry.state == STATE_RESIDENT)
+	{
+		mStats.residentBytes -= entry.bytes;
+		mStats.evictableBytes -= entry.evictable ? entry.bytes : 0;
+		mStats.residentCount--;
+	}
+	else if (entry.state == STATE_EVICTED || entry.state == STATE_RELOADING)
+	{
+		mStats.evictedCount--;
+	}
+	entry.state = STATE_NONE;
+}
+
+void TextureResidency::EndFrame(std::vector<uint32_t>& evict, std::vector<uint32_t>& reload)
+{
+	evict.clear();
+	reload.clear();
+
+	for (uint32_t handle = 0; handle < mEntries.size(); ++handle)
+	{
+		Entry& entry = mEntries[handle];
+		if (entry.state == STATE_EVICTED && entry.lastUsed == mFrame)
+		{
+			entry.state = STATE_RELOADING;
+			reload.push_back(handle);
+		}
+	}
+
+	// least recently used first, the textures of this frame stay
+	if (mStats.budgetBytes > 0 && mStats.residentBytes > mStats.budgetBytes)
+	{
+		mCandidates.clear();
+		for (uint32_t handle = 0; handle < mEntries.size(); ++handle)
+		{
+			const Entry& entry = mEntries[handle];
+			if (entry.state == STATE_RESIDENT && entry.evictable && entry.lastUsed < mFrame)
+				mCandidates.push_back(handle);
+		}
+
+		std::sort(mCandidates.begin(), mCandidates.end(), [this](uint32_t a, uint32_t b)
+		{
+			return mEntries[a].lastUsed != mEntries[b].lastUsed ? mEntries[a].lastUsed < mEntries[b].lastUsed : a < b;
+		});
+
+		for (uint32_t handle : mCandidates)
+		{
+			if (mStats.residentBytes <= mStats.budgetBytes)
+				break;
+
+			Entry& entry = mEntries[handle];
+			mStats.residentBytes -= entry.bytes;
+			mStats.evictableBytes -= entry.bytes;
+			mStats.residentCount--;
+			mStats.evictedCount++;
+			mStats.evictions++;
+			mStats.evictedBytes += entry.bytes;
+			entry.state = STATE_EVICTED;
+			evict.push_back(handle);
+		}
+	}
+
+	++mFrame;
+}
+
+uint64_t TextureResidency::TextureBytes(uint32_t width, uint32_t height, uint32_t mipCount, uint32_t arraySize, uint32_t bitsPerTexel,
+	bool blockCompressed)
+{
+	uint64_t bytes = 0;
+	for (uint32_t mip = 0; mip < std::max(mipCount, 1u); ++mip)
+	{
+		uint64_t mipWidth = std::max(width >> mip, 1u);
+		uint64_t mipHeight = std::max(height >> mip, 1u);
+		if (blockCompressed)
+			bytes += ((mipWidth + 3) / 4) * ((mipHeight + 3) / 4) * 2 * bitsPerTexel;
+		else
+			bytes += (mipWidth * mipHeight * bitsPerTexel + 7) / 8;
+	}
+	return bytes * std::max(arraySize, 1u);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// TextureResidency
+// Residency policy of the textures of TextureManager, by texture handle: the
+// bytes each texture takes, a budget for them and the frame each one was last
+// used. When a frame ends over the budget the least recently used textures that
+// may be evicted and were not used in that frame are given back to the caller to
+// release, until the rest fits. Evicted textures used again are given back to be
+// loaded again. Textures that can not be evicted, such as the sky held by
+// pointer, are only accounted. The policy does not touch the device, the caller
+// releases and loads; the counters are kept for the statistics overlay.
+// Only the standard library is used.
+// usage:
+// residency.SetBudget(256 << 20);
+// residency.OnCreated(handle, TextureResidency::TextureBytes(512, 512, 10, 1, 4, true), true);
+// residency.Touch(handle);	// every draw using it
+// residency.EndFrame(evict, reload);	// release evict, load reload
+
+struct TextureResidencyStats
+{
+	TextureResidencyStats() :
+		budgetBytes(0), residentBytes(0), peakResidentBytes(0), evictableBytes(0), residentCount(0), evictedCount(0),
+		evictions(0), reloads(0), evictedBytes(0) {}
+
+	uint64_t budgetBytes;		// 0 is no budget
+	uint64_t residentBytes;		// of every texture created and not released
+	uint64_t peakResidentBytes;
+	uint64_t evictableBytes;	// of the resident textures that may be evicted
+	uint32_t residentCount;
+	uint32_t evictedCount;		// evicted and not loaded again yet
+	uint64_t evictions;			// since the start
+	uint64_t reloads;
+	uint64_t evictedBytes;
+};
+
+class TextureResidency
+{
+public:
+	TextureResidency();
+
+	// 0 turns eviction off
+	void SetBudget(uint64_t bytes) { mStats.budgetBytes = bytes; }
+	uint64_t GetBudget() const { return mStats.budgetBytes; }
+
+	// handle got a texture of bytes, counted as a reload when it had been evicted
+	void OnCreated(uint32_t handle, uint64_t bytes, bool evictable);
+
+	// the texture of handle was released by the caller, not evicted
+	void OnReleased(uint32_t handle);
+
+	// marks the texture of handle used in this frame, evicted or not
+	void Touch(uint32_t handle)
+	{
+		if (handle < mEntries.size())
+			mEntries[handle].lastUsed = mFrame;
+	}
+
+	// Ends the frame. evict receives the textures to release, least recently used first,
+	// reload the evicted textures used in the frame. Textures given to reload are not
+	// given again before they are created.
+	void EndFrame(std::vector<uint32_t>& evict, std::vector<uint32_t>& reload);
+
+	bool IsResident(uint32_t handle) const { return handle < mEntries.size() && mEntries[handle].state == STATE_RESIDENT; }
+	uint64_t GetBytes(uint32_t handle) const { return handle < mEntries.size() ? mEntries[handle].bytes : 0; }
+	uint32_t GetFrame() const { return mFrame; }
+	const TextureResidencyStats& GetStats() const { return mStats; }
+
+	// Bytes of a texture with mipCount mips of arraySize slices, 6 for a cube. Block compressed
+	// formats store 4 x 4 texel blocks of 16 * bitsPerTexel / 8 bytes, mips below 4 x 4 take one block.
+	static uint64_t TextureBytes(uint32_t width, uint32_t height, uint32_t mipCount, uint32_t arraySize, uint32_t bitsPerTexel,
+		bool blockCompressed);
+
+private:
+	enum State
+	{
+		STATE_NONE,			// no texture created yet, or released
+		STATE_RESIDENT,
+		STATE_EVICTED,
+		STATE_RELOADING		// evicted, given back to be loaded again
+	};
+
+	struct Entry
+	{
+		uint64_t bytes;
+		uint32_t lastUsed;	// frame, 0 is never
+		uint8_t state;
+		bool evictable;
+	};
+
+	void Resize(uint32_t handle);
+
+	std::vector<Entry> mEntries;	// by handle
+	std::vector<uint32_t> mCandidates;
+	uint32_t mFrame;
+	TextureResidencyStats mStats;
+};
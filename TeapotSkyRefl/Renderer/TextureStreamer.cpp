@@ -0,0 +1,256 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <queue>
+
+static const uint32_t NoRequest = 0xffffffffu;
+
+TextureStreamer::TextureStreamer(ReadFunction read) : mRead(read), mUploadBudget(0), mNextStreamId(1), mQuit(false)
+{
+	if (!mRead)
+		mRead = ReadFile;
+
+	mReader = std::thread(&TextureStreamer::ReaderThread, this);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+	mReader.join();
+}
+
+bool TextureStreamer::ReadFile(const std::string& file, uint64_t offset, size_t bytes, unsigned char* data)
+{
+	std::ifstream stream(file, std::ios::binary);
+	if (!stream)
+		return false;
+
+	stream.seekg((std::streamoff)offset);
+	stream.read((char*)data, bytes);
+	return stream && (size_t)stream.gcount() == bytes;
+}
+
+void TextureStreamer::Add(uint32_t handle, const std::string& file, uint32_t width, uint32_t height,
+	const std::vector<TextureMipLayout>& mips, uint32_t residentMip)
+{
+	Remove(handle);
+	if (handle >= mEntries.size())
+		mEntries.resize(handle + 1);
+
+	Entry& entry = mEntries[handle];
+	entry.streamId = mNextStreamId++;
+	entry.file = file;
+	entry.width = width;
+	entry.height = height;
+	entry.mips = mips;
+	entry.read.assign(mips.size(), std::vector<unsigned char>());
+	entry.isRead.assign(mips.size(), false);
+	entry.residentMip = std::min(residentMip, (uint32_t)mips.size() - 1);
+	entry.queuedMip = entry.residentMip;
+	entry.targetMip = entry.residentMip;
+	entry.frameMip = NoRequest;
+	entry.finestMip = 0;
+}
+
+void TextureStreamer::Remove(uint32_t handle)
+{
+	if (handle >= mEntries.size() || mEntries[handle].streamId == 0)
+		return;
+
+	Entry& entry = mEntries[handle];
+	uint32_t streamId = entry.streamId;
+	entry = Entry();
+	entry.streamId = 0;
+
+	// the reads in flight are dropped by Update, the queued ones right away
+	std::lock_guard<std::mutex> lock(mMutex);
+	mQueue.erase(std::remove_if(mQueue.begin(), mQueue.end(), [streamId](const ReadRequest& request)
+	{
+		return request.streamId == streamId;
+	}), mQueue.end());
+}
+
+void TextureStreamer::RequestMip(uint32_t handle, uint32_t mip)
+{
+	if (handle < mEntries.size() && mEntries[handle].streamId != 0)
+		mEntries[handle].frameMip = std::min(mEntries[handle].frameMip, mip);
+}
+
+void TextureStreamer::RequestScreenSize(uint32_t handle, float screenPixels)
+{
+	if (handle < mEntries.size() && mEntries[handle].streamId != 0)
+	{
+		const Entry& entry = mEntries[handle];
+		RequestMip(handle, DesiredMip(entry.width, entry.height, (uint32_t)entry.mips.size(), screenPixels));
+	}
+}
+
+uint32_t TextureStreamer::GetResidentMip(uint32_t handle) const
+{
+	return IsStreamed(handle) ? mEntries[handle].residentMip : 0;
+}
+
+uint32_t TextureStreamer::DesiredMip(uint32_t width, uint32_t height, uint32_t mipCount, float screenPixels)
+{
+	uint32_t size = std::max(width, height);
+	if (mipCount == 0 || screenPixels >= (float)size)
+		return 0;
+	if (screenPixels < 1.0f)
+		return mipCount - 1;
+
+	uint32_t mip = (uint32_t)std::floor(std::log2((float)size / screenPixels));
+	return std::min(mip, mipCount - 1);
+}
+
+void TextureStreamer::Update(std::vector<TextureMipUpload>& uploads)
+{
+	uploads.clear();
+
+	// the mips read since the last frame, the ones of removed textures are dropped
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mFinished.swap(mResults);
+	}
+	for (ReadResult& result : mFinished)
+	{
+		mStats.bytesRead += result.data.size();
+		if (result.handle >= mEntries.size())
+			continue;
+
+		Entry& entry = mEntries[result.handle];
+		if (entry.streamId != result.streamId || result.mip >= entry.residentMip)
+			continue;
+
+		// a failed read ends the streaming of the texture at the mips it has
+		if (result.data.empty())
+		{
+			entry.finestMip = entry.residentMip;
+			entry.targetMip = entry.residentMip;
+			continue;
+		}
+
+		entry.read[result.mip].swap(result.data);
+		entry.isRead[result.mip] = true;
+	}
+	mFinished.clear();
+
+	// the mips requested in the frame, the reads of mips no longer wanted finish anyway
+	std::vector<ReadRequest> requests;
+	for (uint32_t handle = 0; handle < mEntries.size(); ++handle)
+	{
+		Entry& entry = mEntries[handle];
+		if (entry.streamId == 0)
+			continue;
+
+		if (entry.frameMip != NoRequest)
+			entry.targetMip = std::min(entry.targetMip, std::max(entry.frameMip, entry.finestMip));
+		entry.frameMip = NoRequest;
+
+		while (entry.queuedMip > entry.targetMip)
+		{
+			entry.queuedMip--;
+			const TextureMipLayout& layout = entry.mips[entry.queuedMip];
+			ReadRequest request = { handle, entry.streamId, entry.queuedMip, entry.file, layout.offset, layout.bytes };
+			requests.push_back(request);
+		}
+	}
+	if (!requests.empty())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQueue.insert(mQueue.end(), requests.begin(), requests.end());
+		}
+		mWake.notify_one();
+	}
+
+	// the next finer mip of every texture that has it read, coarsest mips first
+	std::priority_queue<std::pair<uint32_t, uint32_t>> next;
+	for (uint32_t handle = 0; handle < mEntries.size(); ++handle)
+	{
+		const Entry& entry = mEntries[handle];
+		if (entry.streamId != 0 && entry.residentMip > 0 && entry.isRead[entry.residentMip - 1])
+			next.push(std::make_pair(entry.residentMip - 1, handle));
+	}
+
+	uint64_t uploadBytes = 0;
+	while (!next.empty())
+	{
+		uint32_t mip = next.top().first;
+		uint32_t handle = next.top().second;
+		next.pop();
+
+		Entry& entry = mEntries[handle];
+		size_t bytes = entry.read[mip].size();
+		if (mUploadBudget > 0 && !uploads.empty() && uploadBytes + bytes > mUploadBudget)
+			break;
+
+		TextureMipUpload upload;
+		upload.handle = handle;
+		upload.mip = mip;
+		upload.rowPitch = entry.mips[mip].rowPitch;
+		upload.data.swap(entry.read[mip]);
+		uploads.push_back(std::move(upload));
+
+		entry.isRead[mip] = false;
+		entry.residentMip = mip;
+		uploadBytes += bytes;
+
+		if (mip > 0 && entry.isRead[mip - 1])
+			next.push(std::make_pair(mip - 1, handle));
+	}
+
+	mStats.streamingCount = 0;
+	mStats.pendingReads = 0;
+	for (const Entry& entry : mEntries)
+	{
+		if (entry.streamId != 0 && entry.residentMip > entry.targetMip)
+		{
+			mStats.streamingCount++;
+			mStats.pendingReads += entry.residentMip - entry.queuedMip;
+		}
+	}
+	mStats.frameUploads = (uint32_t)uploads.size();
+	mStats.frameUploadBytes = uploadBytes;
+	mStats.bytesUploaded += uploadBytes;
+}
+
+void TextureStreamer::ReaderThread()
+{
+	for (;;)
+	{
+		ReadRequest request;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this]() { return mQuit || !mQueue.empty(); });
+			if (mQuit)
+				return;
+
+			// coarsest mip first, in the order queued
+			size_t best = 0;
+			for (size_t i = 1; i < mQueue.size(); ++i)
+			{
+				if (mQueue[i].mip > mQueue[best].mip)
+					best = i;
+			}
+			request = mQueue[best];
+			mQueue.erase(mQueue.begin() + best);
+		}
+
+		ReadResult result;
+		result.handle = request.handle;
+		result.streamId = request.streamId;
+		result.mip = request.mip;
+		result.data.resize(request.bytes);
+		if (!mRead(request.file, request.offset, request.bytes, result.data.data()))
+			result.data.clear();
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mResults.push_back(std::move(result));
+	}
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// TextureStreamer
+// Streams the finer mips of textures that were created with only their smallest
+// mips, by texture handle. A texture is added with where each of its mips lies in
+// its file and the finest mip it has; materials ask for the mip their screen size
+// needs with RequestMip. Update queues the missing mips on a background reader,
+// coarsest mips of all textures first, and hands out the mips that have been read,
+// one after the other from the resident mip down, until the per frame upload
+// budget is spent. At least one mip goes out every frame, so a mip larger than the
+// budget still arrives. Mips are not dropped again when a texture is asked for at
+// a coarser mip, whole textures are evicted by TextureResidency.
+// The streamer does not touch the device, the caller uploads the mips; the read
+// function can be replaced, e.g. by a simulated disk.
+// Only the standard library is used.
+// usage:
+// streamer.SetUploadBudget(4 << 20);
+// streamer.Add(handle, cacheFile, width, height, mips, firstMip);
+// streamer.RequestScreenSize(handle, screenPixels);	// every frame it is drawn
+// streamer.Update(uploads);	// once per frame, upload every mip of uploads
+
+// where a mip is in the file of its texture
+struct TextureMipLayout
+{
+	uint64_t offset;
+	uint32_t bytes;
+	uint32_t rowPitch;	// bytes of a row of texels, of blocks when block compressed
+};
+
+// a mip to upload, the next finer one of its texture
+struct TextureMipUpload
+{
+	uint32_t handle;
+	uint32_t mip;
+	uint32_t rowPitch;
+	std::vector<unsigned char> data;
+};
+
+struct TextureStreamerStats
+{
+	TextureStreamerStats() :
+		streamingCount(0), pendingReads(0), bytesRead(0), bytesUploaded(0), frameUploads(0), frameUploadBytes(0) {}
+
+	uint32_t streamingCount;	// textures with mips on the way to their requested mip
+	uint32_t pendingReads;		// mips queued on the reader or read and not uploaded
+	uint64_t bytesRead;			// since the start
+	uint64_t bytesUploaded;
+	uint32_t frameUploads;		// of the last Update
+	uint64_t frameUploadBytes;
+};
+
+class TextureStreamer
+{
+public:
+	// Reads bytes at offset of file into data, called on the reader thread
+	typedef std::function<bool(const std::string& file, uint64_t offset, size_t bytes, unsigned char* data)> ReadFunction;
+
+	// ReadFile is used without a read function. Starts the reader thread.
+	explicit TextureStreamer(ReadFunction read = ReadFunction());
+	~TextureStreamer();
+
+	// bytes uploaded per Update, 0 for no limit
+	void SetUploadBudget(uint64_t bytesPerFrame) { mUploadBudget = bytesPerFrame; }
+	uint64_t GetUploadBudget() const { return mUploadBudget; }
+
+	// handle's texture of width x height has mips.size() mips in file, the ones from
+	// residentMip on are uploaded. Nothing is streamed before the texture is requested.
+	void Add(uint32_t handle, const std::string& file, uint32_t width, uint32_t height, const std::vector<TextureMipLayout>& mips,
+		uint32_t residentMip);
+
+	// stops streaming the texture, the mips still being read are dropped
+	void Remove(uint32_t handle);
+
+	// the texture should have mip, the finest mip asked for counts
+	void RequestMip(uint32_t handle, uint32_t mip);
+
+	// RequestMip of the DesiredMip of the texture spanning screenPixels
+	void RequestScreenSize(uint32_t handle, float screenPixels);
+
+	// Ends the frame: queues the reads of the requested mips and gives the read mips to
+	// upload, coarsest first, within the upload budget. The resident mips are updated.
+	void Update(std::vector<TextureMipUpload>& uploads);
+
+	// finest mip uploaded, 0 for textures not streamed
+	uint32_t GetResidentMip(uint32_t handle) const;
+	bool IsStreamed(uint32_t handle) const { return handle < mEntries.size() && mEntries[handle].streamId != 0; }
+
+	const TextureStreamerStats& GetStats() const { return mStats; }
+
+	// Coarsest mip that still has a texel for every pixel when the texture spans screenPixels
+	static uint32_t DesiredMip(uint32_t width, uint32_t height, uint32_t mipCount, float screenPixels);
+
+	// ReadFunction of the files on disk
+	static bool ReadFile(const std::string& file, uint64_t offset, size_t bytes, unsigned char* data);
+
+private:
+	TextureStreamer(const TextureStreamer& rhs);
+	TextureStreamer& operator=(const TextureStreamer& rhs);
+
+	struct Entry
+	{
+		uint32_t streamId;		// 0 when not streamed, reads of an older stream are dropped
+		std::string file;
+		uint32_t width;
+		uint32_t height;
+		std::vector<TextureMipLayout> mips;
+		std::vector<std::vector<unsigned char>> read;	// by mip, read and not uploaded
+		std::vector<bool> isRead;
+		uint32_t residentMip;
+		uint32_t queuedMip;		// finest mip queued on the reader
+		uint32_t targetMip;		// finest mip requested
+		uint32_t frameMip;		// finest mip requested since the last Update
+		uint32_t finestMip;		// 0, the resident mip after a failed read
+	};
+
+	struct ReadRequest
+	{
+		uint32_t handle;
+		uint32_t streamId;
+		uint32_t mip;
+		std::string file;
+		uint64_t offset;
+		uint32_t bytes;
+	};
+
+	struct ReadResult
+	{
+		uint32_t handle;
+		uint32_t streamId;
+		uint32_t mip;
+		std::vector<unsigned char> data;
+	};
+
+	void ReaderThread();
+
+	ReadFunction mRead;
+	uint64_t mUploadBudget;
+	std::vector<Entry> mEntries;	// by handle, touched only by the caller's thread
+	uint32_t mNextStreamId;
+	TextureStreamerStats mStats;
+
+	// the reader thread takes the coarsest queued mip first
+	std::thread mReader;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::vector<ReadRequest> mQueue;
+	std::vector<ReadResult> mResults;
+	std::vector<ReadResult> mFinished;
+	bool mQuit;
+};
@@ -0,0 +1,501 @@
+#include "TransformSystem.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <emmintrin.h>
+
+// transforms per thread of a level update
+static const size_t UpdateMinPerThread = 4096;
+
+// floats of a world matrix and of a geometry transform, scale and offset padded to four each
+static const size_t WorldStride = 12;
+static const size_t GeometryStride = 8;
+
+TransformSystem::TransformSystem() : mLiveCount(0), mLayoutDirty(false), mAnyDirty(false)
+{
+}
+
+TransformKernel TransformSystem::GetKernel(TransformKernel kernel)
+{
+	// SSE2 is part of x64
+	return kernel == TRANSFORM_KERNEL_AUTO ? TRANSFORM_KERNEL_SSE2 : kernel;
+}
+
+void TransformSystem::MultiplyAffine(const float a[12], const float b[12], float c[12])
+{
+	float result[12];
+	for (int r = 0; r < 4; ++r)
+	{
+		for (int col = 0; col < 3; ++col)
+		{
+			float value = (a[r * 3] * b[col] + a[r * 3 + 1] * b[3 + col]) + a[r * 3 + 2] * b[6 + col];
+			result[r * 3 + col] = r == 3 ? value + b[9 + col] : value;
+		}
+	}
+	memcpy(c, result, sizeof(result));
+}
+
+//////////// Handles
+
+TransformHandle TransformSystem::Create(const float local[12], TransformHandle parent)
+{
+	uint32_t parentIndex = parent != InvalidTransformHandle ? Index(parent) : NoParent;
+	uint32_t depth = parentIndex != NoParent ? mDepths[parentIndex] + 1 : 0;
+	uint32_t index = (uint32_t)mHandles.size();
+
+	TransformHandle handle;
+	if (!mFreeHandles.empty())
+	{
+		handle = mFreeHandles.back();
+		mFreeHandles.pop_back();
+	}
+	else
+	{
+		handle = (TransformHandle)mIndices.size();
+		mIndices.push_back(index);
+	}
+	mIndices[handle] = index;
+
+	// a shallower transform after a deeper one breaks the level order, an earlier
+	// parent than the one before the order by parent within the level
+	if (!mDepths.empty() && (depth < mDepths.back() || (depth == mDepths.back() && parentIndex < mParents.back())))
+		mLayoutDirty = true;
+
+	static const float identityGeometry[GeometryStride] = { 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int k = 0; k < 12; ++k)
+	{
+		mLocal[k].push_back(local[k]);
+	}
+	mWorld.insert(mWorld.end(), local, local + WorldStride);
+	mGeometry.insert(mGeometry.end(), identityGeometry, identityGeometry + GeometryStride);
+	mParents.push_back(parentIndex);
+	mDepths.push_back(depth);
+	mHandles.push_back(handle);
+	mDirty.push_back(1);
+	mChanged.push_back(1);
+	mDestroyed.push_back(0);
+
+	mLiveCount++;
+	mAnyDirty = true;
+	return handle;
+}
+
+void TransformSystem::Destroy(TransformHandle handle)
+{
+	if (!IsValid(handle))
+		return;
+
+	// the children follow in Compact
+	mDestroyed[Index(handle)] = 1;
+	mIndices[handle] = Dead;
+	mFreeHandles.push_back(handle);
+	mLiveCount--;
+	mLayoutDirty = true;
+}
+
+void TransformSystem::SetLocal(TransformHandle handle, const float local[12])
+{
+	uint32_t index = Index(handle);
+	for (int k = 0; k < 12; ++k)
+	{
+		mLocal[k][index] = local[k];
+	}
+	mDirty[index] = 1;
+	mAnyDirty = true;
+}
+
+void TransformSystem::GetLocal(TransformHandle handle, float local[12]) const
+{
+	uint32_t index = Index(handle);
+	for (int k = 0; k < 12; ++k)
+	{
+		local[k] = mLocal[k][index];
+	}
+}
+
+void TransformSystem::Multiply(TransformHandle handle, const float transform[12])
+{
+	float local[12];
+	GetLocal(handle, local);
+	MultiplyAffine(local, transform, local);
+	SetLocal(handle, local);
+}
+
+void TransformSystem::GetWorld(TransformHandle handle, float world[12]) const
+{
+	memcpy(world, &mWorld[Index(handle) * WorldStride], WorldStride * sizeof(float));
+}
+
+void TransformSystem::SetGeometry(TransformHandle handle, const float scale[3], const float offset[3])
+{
+	float* geometry = &mGeometry[Index(handle) * GeometryStride];
+	for (int k = 0; k < 3; ++k)
+	{
+		geometry[k] = scale[k];
+		geometry[4 + k] = offset[k];
+	}
+}
+
+//////////// Storage order
+
+// runs of stride values moved to their new indices, the ones without are dropped
+template<typename T>
+static void Permute(std::vector<T>& values, const std::vector<uint32_t>& newIndices, size_t newCount, size_t stride = 1)
+{
+	std::vector<T> sorted(newCount * stride);
+	for (size_t i = 0; i < newIndices.size(); ++i)
+	{
+		if (newIndices[i] != 0xffffffffu)
+			std::copy(values.begin() + i * stride, values.begin() + (i + 1) * stride, sorted.begin() + newIndices[i] * stride);
+	}
+	values.swap(sorted);
+}
+
+void TransformSystem::Compact()
+{
+	size_t count = mHandles.size();
+
+	// children of destroyed transforms are destroyed, parents come first
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (mDestroyed[i] || mParents[i] == NoParent || !mDestroyed[mParents[i]])
+			continue;
+
+		mDestroyed[i] = 1;
+		mIndices[mHandles[i]] = Dead;
+		mFreeHandles.push_back(mHandles[i]);
+		mLiveCount--;
+	}
+
+	// counting sort by depth, then by parent within a level so children read their
+	// parents' world matrices in order
+	uint32_t maxDepth = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!mDestroyed[i])
+			maxDepth = std::max(maxDepth, mDepths[i]);
+	}
+	std::vector<uint32_t> levelStarts(maxDepth + 2, 0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!mDestroyed[i])
+			levelStarts[mDepths[i] + 1]++;
+	}
+	for (uint32_t depth = 0; depth <= maxDepth; ++depth)
+	{
+		levelStarts[depth + 1] += levelStarts[depth];
+	}
+	mLevels = levelStarts;
+
+	std::vector<uint32_t> order(mLevels.back());
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!mDestroyed[i])
+			order[levelStarts[mDepths[i]]++] = (uint32_t)i;
+	}
+
+	std::vector<uint32_t> newIndices(count, (uint32_t)Dead);
+	for (uint32_t depth = 0; depth <= maxDepth; ++depth)
+	{
+		// the parents have their new indices from the level before
+		std::vector<uint32_t>::iterator begin = order.begin() + mLevels[depth];
+		std::vector<uint32_t>::iterator end = order.begin() + mLevels[depth + 1];
+		if (depth > 0)
+		{
+			std::stable_sort(begin, end, [this, &newIndices](uint32_t a, uint32_t b)
+			{
+				return newIndices[mParents[a]] < newIndices[mParents[b]];
+			});
+		}
+		for (std::vector<uint32_t>::iterator it = begin; it != end; ++it)
+		{
+			newIndices[*it] = (uint32_t)(it - order.begin());
+		}
+	}
+
+	size_t liveCount = mLevels.back();
+	for (int k = 0; k < 12; ++k)
+	{
+		Permute(mLocal[k], newIndices, liveCount);
+	}
+	Permute(mWorld, newIndices, liveCount, WorldStride);
+	Permute(mGeometry, newIndices, liveCount, GeometryStride);
+	Permute(mParents, newIndices, liveCount);
+	Permute(mDepths, newIndices, liveCount);
+	Permute(mHandles, newIndices, liveCount);
+	Permute(mDirty, newIndices, liveCount);
+	Permute(mChanged, newIndices, liveCount);
+	mDestroyed.assign(liveCount, 0);
+
+	for (uint32_t i = 0; i < liveCount; ++i)
+	{
+		if (mParents[i] != NoParent)
+			mParents[i] = newIndices[mParents[i]];
+		mIndices[mHandles[i]] = i;
+	}
+
+	mLayoutDirty = false;
+}
+
+void TransformSystem::ExtendLevels()
+{
+	// transforms created in depth order since the last Update
+	uint32_t end = mLevels.empty() ? 0 : mLevels.back();
+	if (!mLevels.empty())
+		mLevels.pop_back();
+
+	for (uint32_t i = end; i < (uint32_t)mHandles.size(); ++i)
+	{
+		while (mLevels.size() <= mDepths[i])
+		{
+			mLevels.push_back(i);
+		}
+	}
+	mLevels.push_back((uint32_t)mHandles.size());
+}
+
+//////////// Update
+
+void TransformSystem::Update(unsigned int threads, TransformKernel kernel)
+{
+	if (mLayoutDirty)
+		Compact();
+	else if (mLevels.empty() || mLevels.back() != mHandles.size())
+		ExtendLevels();
+
+	if (!mAnyDirty)
+	{
+		std::fill(mChanged.begin(), mChanged.end(), 0);
+		return;
+	}
+
+	kernel = GetKernel(kernel);
+	for (size_t level = 0; level + 1 < mLevels.size(); ++level)
+	{
+		uint32_t begin = mLevels[level];
+		ParallelFor(mLevels[level + 1] - begin, UpdateMinPerThread, threads, [this, begin, kernel](size_t rangeBegin, size_t rangeEnd)
+		{
+			UpdateRange(begin + (uint32_t)rangeBegin, begin + (uint32_t)rangeEnd, kernel);
+		});
+	}
+
+	std::fill(mDirty.begin(), mDirty.end(), 0);
+	mAnyDirty = false;
+}
+
+// groups of four floats of four matrices, matrices + indices[lane] * stride, as one vector per float
+static void LoadLanes(const float* matrices, const uint32_t indices[4], size_t stride, int groups, __m128* values)
+{
+	for (int g = 0; g < groups; ++g)
+	{
+		__m128 r0 = _mm_loadu_ps(matrices + indices[0] * stride + g * 4);
+		__m128 r1 = _mm_loadu_ps(matrices + indices[1] * stride + g * 4);
+		__m128 r2 = _mm_loadu_ps(matrices + indices[2] * stride + g * 4);
+		__m128 r3 = _mm_loadu_ps(matrices + indices[3] * stride + g * 4);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		values[g * 4] = r0;
+		values[g * 4 + 1] = r1;
+		values[g * 4 + 2] = r2;
+		values[g * 4 + 3] = r3;
+	}
+}
+
+// the inverse of LoadLanes
+static void StoreLanes(float* matrices, const uint32_t indices[4], size_t stride, int groups, const __m128* values)
+{
+	for (int g = 0; g < groups; ++g)
+	{
+		__m128 r0 = values[g * 4], r1 = values[g * 4 + 1], r2 = values[g * 4 + 2], r3 = values[g * 4 + 3];
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_storeu_ps(matrices + indices[0] * stride + g * 4, r0);
+		_mm_storeu_ps(matrices + indices[1] * stride + g * 4, r1);
+		_mm_storeu_ps(matrices + indices[2] * stride + g * 4, r2);
+		_mm_storeu_ps(matrices + indices[3] * stride + g * 4, r3);
+	}
+}
+
+void TransformSystem::UpdateRange(uint32_t begin, uint32_t end, TransformKernel kernel)
+{
+	const uint32_t* parents = mParents.data();
+	const uint8_t* dirty = mDirty.data();
+	uint8_t* changed = mChanged.data();
+
+	uint32_t i = begin;
+	if (kernel == TRANSFORM_KERNEL_SSE2)
+	{
+		for (; i + 4 <= end; i += 4)
+		{
+			bool any = false;
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				uint32_t parent = parents[i + lane];
+				changed[i + lane] = dirty[i + lane] || (parent != NoParent && changed[parent]);
+				any |= changed[i + lane] != 0;
+			}
+			if (!any)
+				continue;
+
+			const uint32_t lanes[4] = { i, i + 1, i + 2, i + 3 };
+			__m128 a[12], b[12], world[12];
+			for (int k = 0; k < 12; ++k)
+			{
+				a[k] = _mm_loadu_ps(&mLocal[k][i]);
+			}
+
+			// a level holds only roots or only children, the world of a root is its local
+			if (parents[i] == NoParent)
+			{
+				StoreLanes(mWorld.data(), lanes, WorldStride, 3, a);
+				continue;
+			}
+
+			// the unchanged lanes compute the world they already have
+			LoadLanes(mWorld.data(), parents + i, WorldStride, 3, b);
+			for (int r = 0; r < 4; ++r)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					__m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[r * 3], b[c]), _mm_mul_ps(a[r * 3 + 1], b[3 + c])),
+						_mm_mul_ps(a[r * 3 + 2], b[6 + c]));
+					world[r * 3 + c] = r == 3 ? _mm_add_ps(value, b[9 + c]) : value;
+				}
+			}
+			StoreLanes(mWorld.data(), lanes, WorldStride, 3, world);
+		}
+	}
+
+	for (; i < end; ++i)
+	{
+		uint32_t parent = parents[i];
+		changed[i] = dirty[i] || (parent != NoParent && changed[parent]);
+		if (!changed[i])
+			continue;
+
+		float local[12];
+		for (int k = 0; k < 12; ++k)
+		{
+			local[k] = mLocal[k][i];
+		}
+		float* world = &mWorld[i * WorldStride];
+		if (parent == NoParent)
+			memcpy(world, local, sizeof(local));
+		else
+			MultiplyAffine(local, &mWorld[parent * WorldStride], world);
+	}
+}
+
+//////////// Constant buffer data
+
+// constants of one object, the same operations in the same order as the SSE2 lanes
+static void ScalarConstants(const float world[12], const float geometry[8], const float viewProj[16], bool geometryInWorld,
+	TransformConstants& constants)
+{
+	float a[12];
+	for (int r = 0; r < 3; ++r)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			a[r * 3 + c] = geometry[r] * world[r * 3 + c];
+		}
+	}
+	for (int c = 0; c < 3; ++c)
+	{
+		a[9 + c] = ((geometry[4] * world[c] + geometry[5] * world[3 + c]) + geometry[6] * world[6 + c]) + world[9 + c];
+	}
+
+	for (int r = 0; r < 4; ++r)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			float value = (a[r * 3] * viewProj[c] + a[r * 3 + 1] * viewProj[4 + c]) + a[r * 3 + 2] * viewProj[8 + c];
+			constants.worldViewProj[c * 4 + r] = r == 3 ? value + viewProj[12 + c] : value;
+		}
+	}
+
+	const float* w = geometryInWorld ? a : world;
+	for (int c = 0; c < 4; ++c)
+	{
+		for (int r = 0; r < 4; ++r)
+		{
+			constants.world[c * 4 + r] = c < 3 ? w[r * 3 + c] : (r == 3 ? 1.0f : 0.0f);
+		}
+	}
+}
+
+void TransformSystem::BuildConstants(const TransformHandle* handles, size_t count, const float viewProj[16], TransformConstants* constants,
+	bool geometryInWorld, TransformKernel kernel) const
+{
+	size_t i = 0;
+	if (GetKernel(kernel) == TRANSFORM_KERNEL_SSE2)
+	{
+		// four objects at once, one lane each, transposed into their constants at the end
+		__m128 m[16];
+		for (int k = 0; k < 16; ++k)
+		{
+			m[k] = _mm_set1_ps(viewProj[k]);
+		}
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			const uint32_t indices[4] = { Index(handles[i]), Index(handles[i + 1]), Index(handles[i + 2]), Index(handles[i + 3]) };
+			__m128 w[12], g[8], a[12];
+			LoadLanes(mWorld.data(), indices, WorldStride, 3, w);
+			LoadLanes(mGeometry.data(), indices, GeometryStride, 2, g);
+
+			for (int r = 0; r < 3; ++r)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					a[r * 3 + c] = _mm_mul_ps(g[r], w[r * 3 + c]);
+				}
+			}
+			for (int c = 0; c < 3; ++c)
+			{
+				a[9 + c] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(g[4], w[c]), _mm_mul_ps(g[5], w[3 + c])), _mm_mul_ps(g[6], w[6 + c])),
+					w[9 + c]);
+			}
+
+			for (int c = 0; c < 4; ++c)
+			{
+				__m128 p[4];
+				for (int r = 0; r < 4; ++r)
+				{
+					p[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[r * 3], m[c]), _mm_mul_ps(a[r * 3 + 1], m[4 + c])), _mm_mul_ps(a[r * 3 + 2], m[8 + c]));
+				}
+				p[3] = _mm_add_ps(p[3], m[12 + c]);
+
+				// column c of the four matrices becomes row c of their transposes
+				_MM_TRANSPOSE4_PS(p[0], p[1], p[2], p[3]);
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					_mm_storeu_ps(constants[i + lane].worldViewProj + c * 4, p[lane]);
+				}
+			}
+
+			const __m128* source = geometryInWorld ? a : w;
+			for (int c = 0; c < 4; ++c)
+			{
+				__m128 column[4];
+				for (int r = 0; r < 4; ++r)
+				{
+					column[r] = c < 3 ? source[r * 3 + c] : (r == 3 ? one : zero);
+				}
+				_MM_TRANSPOSE4_PS(column[0], column[1], column[2], column[3]);
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					_mm_storeu_ps(constants[i + lane].world + c * 4, column[lane]);
+				}
+			}
+		}
+	}
+
+	for (; i < count; ++i)
+	{
+		uint32_t index = Index(handles[i]);
+		ScalarConstants(&mWorld[index * WorldStride], &mGeometry[index * GeometryStride], viewProj, geometryInWorld, constants[i]);
+	}
+}
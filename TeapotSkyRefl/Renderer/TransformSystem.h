@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// TransformSystem
+// Local and world transforms of the scene objects, with parents. The transforms are
+// affine 4x3 matrices in the row vector convention of DirectXMath, the rows x, y, z
+// and translation, 12 floats. The local matrices are stored as arrays of each
+// component, the world matrices, which children and draw lists read in any order,
+// one after the other. The transforms are kept ordered by depth in the hierarchy and
+// by parent within a depth, so one level is a contiguous range whose parents are all
+// updated before it and read mostly in order.
+// SetLocal and Multiply mark a transform dirty; Update recomputes the world matrices
+// of the dirty transforms and of everything below them, four at a time with SSE2,
+// the ranges of a level split over the worker threads. WorldChanged tells which world
+// matrices the last Update changed.
+// BuildConstants writes the per object constant buffer data of a list of objects in
+// one pass: the world view projection and world matrices, transposed for HLSL. The
+// geometry transform of an object, a scale and offset its vertex positions go
+// through first, only applies to the world view projection unless asked.
+// Handles stay valid until destroyed, the storage order changes on Update.
+// Only the standard library and SSE2 intrinsics are used.
+// usage:
+// TransformHandle handle = transforms.Create(local);
+// transforms.Multiply(handle, rotation);	// local = local * rotation
+// transforms.Update();	// once per frame, before the world matrices are read
+// transforms.BuildConstants(visible.data(), visible.size(), viewProj, constants.data());
+
+typedef uint32_t TransformHandle;
+static const TransformHandle InvalidTransformHandle = 0xffffffffu;
+
+enum TransformKernel
+{
+	TRANSFORM_KERNEL_AUTO = 0,	// best kernel the CPU supports
+	TRANSFORM_KERNEL_SCALAR,
+	TRANSFORM_KERNEL_SSE2
+};
+
+// per object constant buffer data, both matrices transposed
+struct TransformConstants
+{
+	float worldViewProj[16];
+	float world[16];
+};
+
+class TransformSystem
+{
+public:
+	TransformSystem();
+
+	// new transform below parent, whose world it is relative to, or a root
+	TransformHandle Create(const float local[12], TransformHandle parent = InvalidTransformHandle);
+
+	// destroys the transform and every transform below it
+	void Destroy(TransformHandle handle);
+
+	bool IsValid(TransformHandle handle) const { return handle < mIndices.size() && mIndices[handle] != Dead; }
+	size_t GetCount() const { return mLiveCount; }
+
+	void SetLocal(TransformHandle handle, const float local[12]);
+	void GetLocal(TransformHandle handle, float local[12]) const;
+
+	// local = local * transform
+	void Multiply(TransformHandle handle, const float transform[12]);
+
+	// world matrix of the last Update
+	void GetWorld(TransformHandle handle, float world[12]) const;
+
+	// vertex positions are scaled and offset into the space of the transform, e.g. dequantized
+	void SetGeometry(TransformHandle handle, const float scale[3], const float offset[3]);
+
+	// Updates the world matrices of the dirty transforms and their children, threads 0
+	// is one per hardware thread
+	void Update(unsigned int threads = 0, TransformKernel kernel = TRANSFORM_KERNEL_AUTO);
+
+	// the world matrix changed in the last Update, new transforms count as changed
+	bool WorldChanged(TransformHandle handle) const { return mChanged[mIndices[handle]] != 0; }
+
+	// Constant buffer data of count objects for viewProj, a 4x4 row major matrix. With
+	// geometryInWorld the world matrix includes the geometry transform as well, for
+	// passes that only transform positions.
+	void BuildConstants(const TransformHandle* handles, size_t count, const float viewProj[16], TransformConstants* constants,
+		bool geometryInWorld = false, TransformKernel kernel = TRANSFORM_KERNEL_AUTO) const;
+
+	// Resolves TRANSFORM_KERNEL_AUTO to the kernel used on this CPU
+	static TransformKernel GetKernel(TransformKernel kernel = TRANSFORM_KERNEL_AUTO);
+
+	// c = a * b of affine 4x3 matrices, c may be a or b
+	static void MultiplyAffine(const float a[12], const float b[12], float c[12]);
+
+private:
+	static const uint32_t Dead = 0xffffffffu;
+	static const uint32_t NoParent = 0xffffffffu;
+
+	// storage index of a handle
+	uint32_t Index(TransformHandle handle) const { return mIndices[handle]; }
+
+	// drops destroyed transforms and sorts by depth
+	void Compact();
+
+	// adds the levels of the transforms created since the last Update
+	void ExtendLevels();
+
+	void UpdateRange(uint32_t begin, uint32_t end, TransformKernel kernel);
+
+	// by storage index
+	std::vector<float> mLocal[12];
+	std::vector<float> mWorld;				// 12 floats each
+	std::vector<float> mGeometry;			// scale x, y, z, 0 and offset x, y, z, 0
+	std::vector<uint32_t> mParents;			// storage index of the parent, NoParent for roots
+	std::vector<uint32_t> mDepths;
+	std::vector<TransformHandle> mHandles;
+	std::vector<uint8_t> mDirty;			// local changed
+	std::vector<uint8_t> mChanged;			// world changed in the last Update
+	std::vector<uint8_t> mDestroyed;
+
+	// storage index by handle, Dead once destroyed
+	std::vector<uint32_t> mIndices;
+	std::vector<TransformHandle> mFreeHandles;
+
+	// first storage index of every depth, and the end
+	std::vector<uint32_t> mLevels;
+	size_t mLiveCount;
+	bool mLayoutDirty;	// destroyed transforms or a level out of order
+	bool mAnyDirty;
+};
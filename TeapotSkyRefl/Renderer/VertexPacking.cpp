@@ -0,0 +1,713 @@
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2,f16c")))
+#endif
+
+static const float UnormMax = 65535.0f;
+static const float SnormMax = 32767.0f;
+
+bool CpuSupportsAvx2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// AVX, F16C and OS support for the ymm registers
+	__cpuid(info, 1);
+	const int avxBits = (1 << 27) | (1 << 28) | (1 << 29);
+	if ((info[2] & avxBits) != avxBits)
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+#endif
+}
+
+VertexPackingKernel GetVertexPackingKernel(VertexPackingKernel kernel)
+{
+	static const bool avx2 = CpuSupportsAvx2();
+
+	if (kernel == VERTEX_PACKING_AUTO)
+		return avx2 ? VERTEX_PACKING_AVX2 : VERTEX_PACKING_SSE2;
+
+	if (kernel == VERTEX_PACKING_AVX2 && !avx2)
+		return VERTEX_PACKING_SSE2;
+
+	return kernel;
+}
+
+VertexQuantization ComputeVertexQuantization(const float* vertices, size_t count)
+{
+	VertexQuantization quantization;
+
+	float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < count; ++i)
+	{
+		const float* p = vertices + i * UnpackedVertexFloats;
+		for (int k = 0; k < 3; ++k)
+		{
+			boundsMin[k] = std::min(boundsMin[k], p[k]);
+			boundsMax[k] = std::max(boundsMax[k], p[k]);
+		}
+	}
+
+	for (int k = 0; k < 3; ++k)
+	{
+		quantization.offset[k] = count > 0 ? boundsMin[k] : 0.0f;
+		quantization.scale[k] = count > 0 ? (boundsMax[k] - boundsMin[k]) / UnormMax : 0.0f;
+	}
+
+	return quantization;
+}
+
+PackedVertexErrors PackedVertexErrorBounds(const VertexQuantization& quantization)
+{
+	PackedVertexErrors errors;
+
+	// half a quantization step, plus float rounding of offset + q * scale
+	for (int k = 0; k < 3; ++k)
+	{
+		float extent = quantization.scale[k] * UnormMax;
+		float magnitude = std::max(fabsf(quantization.offset[k]), fabsf(quantization.offset[k] + extent));
+		errors.position = std::max(errors.position, 0.5f * quantization.scale[k] + 2.0f * magnitude * FLT_EPSILON);
+	}
+
+	// rounding moves the octahedral coordinates by half a snorm16 step each,
+	// the map back to the sphere stretches that to under 2 steps per component
+	errors.normal = 2.0f / SnormMax + 4.0f * FLT_EPSILON;
+
+	// half floats round to 11 significant bits
+	errors.tex = 1.0f / 2048.0f;
+
+	return errors;
+}
+
+//////////// Scalar reference
+
+// float to half with round to nearest even, after Fabian Giesen's float_to_half_fast3_rtne
+static inline uint16_t FloatToHalf(float value)
+{
+	const uint32_t f32Infinity = 255u << 23;
+	const uint32_t f16Max = (127u + 16u) << 23;
+	const uint32_t denormMagicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+	uint32_t f;
+	memcpy(&f, &value, sizeof(f));
+
+	uint32_t sign = f & 0x80000000u;
+	f ^= sign;
+
+	uint32_t result;
+	if (f >= f16Max)
+	{
+		// Inf or NaN
+		result = (f > f32Infinity) ? 0x7e00 : 0x7c00;
+	}
+	else if (f < (113u << 23))
+	{
+		// subnormal or zero, the float add does the rounding
+		float denormMagic;
+		memcpy(&denormMagic, &denormMagicBits, sizeof(denormMagic));
+
+		float absValue;
+		memcpy(&absValue, &f, sizeof(absValue));
+		absValue += denormMagic;
+		memcpy(&f, &absValue, sizeof(f));
+		result = f - denormMagicBits;
+	}
+	else
+	{
+		uint32_t mantissaOdd = (f >> 13) & 1;
+		f += ((uint32_t)(15 - 127) << 23) + 0xfff;
+		f += mantissaOdd;
+		result = f >> 13;
+	}
+
+	return (uint16_t)(result | (sign >> 16));
+}
+
+static inline float HalfToFloat(uint16_t half)
+{
+	const uint32_t shiftedExponent = 0x7c00u << 13;
+	const uint32_t magicBits = 113u << 23;
+
+	uint32_t o = (uint32_t)(half & 0x7fff) << 13;
+	uint32_t exponent = o & shiftedExponent;
+	o += (127u - 15u) << 23;
+
+	float result;
+	if (exponent == shiftedExponent)
+	{
+		// Inf or NaN
+		o += (128u - 16u) << 23;
+		memcpy(&result, &o, sizeof(result));
+	}
+	else if (exponent == 0)
+	{
+		// zero or subnormal, renormalize
+		o += 1u << 23;
+		float magic;
+		memcpy(&magic, &magicBits, sizeof(magic));
+		memcpy(&result, &o, sizeof(result));
+		result -= magic;
+	}
+	else
+	{
+		memcpy(&result, &o, sizeof(result));
+	}
+
+	uint32_t bits;
+	memcpy(&bits, &result, sizeof(bits));
+	bits |= (uint32_t)(half & 0x8000) << 16;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+static inline int RoundToInt(float value)
+{
+	return _mm_cvtss_si32(_mm_set_ss(value));
+}
+
+static inline float Clamp(float value, float low, float high)
+{
+	return std::min(std::max(value, low), high);
+}
+
+static inline float SignNotZero(float value)
+{
+	return value < 0.0f ? -1.0f : 1.0f;
+}
+
+static void EncodeScalar(const float* vertices, size_t begin, size_t end, const VertexQuantization& quantization, PackedVertex* packed)
+{
+	float invScale[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		invScale[k] = quantization.scale[k] > 0.0f ? 1.0f / quantization.scale[k] : 0.0f;
+	}
+
+	for (size_t i = begin; i < end; ++i)
+	{
+		const float* v = vertices + i * UnpackedVertexFloats;
+		PackedVertex& out = packed[i];
+
+		for (int k = 0; k < 3; ++k)
+		{
+			out.Position[k] = (uint16_t)RoundToInt(Clamp((v[k] - quantization.offset[k]) * invScale[k], 0.0f, UnormMax));
+		}
+		out.Position[3] = 0xffff;
+
+		// octahedral projection, the lower hemisphere is folded over the diagonals
+		float l1 = (fabsf(v[3]) + fabsf(v[4])) + fabsf(v[5]);
+		float invL1 = l1 > 0.0f ? 1.0f / l1 : 0.0f;
+		float x = v[3] * invL1;
+		float y = v[4] * invL1;
+		float z = v[5] * invL1;
+		if (z < 0.0f)
+		{
+			float foldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+			float foldedY = (1.0f - fabsf(x)) * SignNotZero(y);
+			x = foldedX;
+			y = foldedY;
+		}
+		out.Normal[0] = (int16_t)RoundToInt(Clamp(x, -1.0f, 1.0f) * SnormMax);
+		out.Normal[1] = (int16_t)RoundToInt(Clamp(y, -1.0f, 1.0f) * SnormMax);
+
+		out.Tex[0] = FloatToHalf(v[6]);
+		out.Tex[1] = FloatToHalf(v[7]);
+	}
+}
+
+static void DecodeScalar(const PackedVertex* packed, size_t begin, size_t end, const VertexQuantization& quantization, float* vertices)
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		const PackedVertex& in = packed[i];
+		float* v = vertices + i * UnpackedVertexFloats;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			v[k] = quantization.offset[k] + (float)in.Position[k] * quantization.scale[k];
+		}
+
+		float x = std::max((float)in.Normal[0] / SnormMax, -1.0f);
+		float y = std::max((float)in.Normal[1] / SnormMax, -1.0f);
+		float z = (1.0f - fabsf(x)) - fabsf(y);
+		float t = std::max(-z, 0.0f);
+		x += x >= 0.0f ? -t : t;
+		y += y >= 0.0f ? -t : t;
+
+		float length = sqrtf((x * x + y * y) + z * z);
+		v[3] = x / length;
+		v[4] = y / length;
+		v[5] = z / length;
+
+		v[6] = HalfToFloat(in.Tex[0]);
+		v[7] = HalfToFloat(in.Tex[1]);
+	}
+}
+
+//////////// SSE2, 4 vertices per iteration
+
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// FloatToHalf for 4 values, the results are in the low 16 bits of each lane
+static inline __m128i FloatToHalfSSE2(__m128 value)
+{
+	const __m128i f32Infinity = _mm_set1_epi32(255 << 23);
+	const __m128i f16Max = _mm_set1_epi32((127 + 16) << 23);
+	const __m128i denormMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128i normalLimit = _mm_set1_epi32(113 << 23);
+
+	__m128i f = _mm_castps_si128(value);
+	__m128i sign = _mm_and_si128(f, _mm_set1_epi32((int)0x80000000));
+	f = _mm_xor_si128(f, sign);
+
+	__m128i infNan = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(_mm_cmpgt_epi32(f, f32Infinity), _mm_set1_epi32(0x200)));
+
+	__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(f), _mm_castsi128_ps(denormMagic))), denormMagic);
+
+	__m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(f, 13), _mm_set1_epi32(1));
+	__m128i normal = _mm_add_epi32(f, _mm_set1_epi32((int)(((uint32_t)(15 - 127) << 23) + 0xfff)));
+	normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissaOdd), 13);
+
+	__m128i isBig = _mm_cmpgt_epi32(f, _mm_sub_epi32(f16Max, _mm_set1_epi32(1)));
+	__m128i isSmall = _mm_cmplt_epi32(f, normalLimit);
+
+	__m128i result = Select(isBig, infNan, Select(isSmall, subnormal, normal));
+	return _mm_or_si128(result, _mm_srli_epi32(sign, 16));
+}
+
+// HalfToFloat for the low 16 bits of each lane
+static inline __m128 HalfToFloatSSE2(__m128i half)
+{
+	const __m128i shiftedExponent = _mm_set1_epi32(0x7c00 << 13);
+
+	__m128i o = _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x7fff)), 13);
+	__m128i exponent = _mm_and_si128(o, shiftedExponent);
+	o = _mm_add_epi32(o, _mm_set1_epi32((127 - 15) << 23));
+
+	__m128i infNan = _mm_add_epi32(o, _mm_set1_epi32((128 - 16) << 23));
+	__m128 subnormal = _mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(o, _mm_set1_epi32(1 << 23))), _mm_castsi128_ps(_mm_set1_epi32(113 << 23)));
+
+	__m128i result = Select(_mm_cmpeq_epi32(exponent, shiftedExponent), infNan, o);
+	result = Select(_mm_cmpeq_epi32(exponent, _mm_setzero_si128()), _mm_castps_si128(subnormal), result);
+
+	__m128i sign = _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x8000)), 16);
+	return _mm_castsi128_ps(_mm_or_si128(result, sign));
+}
+
+static inline __m128 SignNotZeroSSE2(__m128 value)
+{
+	return Select(_mm_cmplt_ps(value, _mm_setzero_ps()), _mm_set1_ps(-1.0f), _mm_set1_ps(1.0f));
+}
+
+static inline __m128 AbsSSE2(__m128 value)
+{
+	return _mm_and_ps(value, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+}
+
+static inline __m128 ClampSSE2(__m128 value, float low, float high)
+{
+	return _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(low)), _mm_set1_ps(high));
+}
+
+static void EncodeSSE2(const float* vertices, size_t count, const VertexQuantization& quantization, PackedVertex* packed)
+{
+	__m128 offset[3], invScale[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		offset[k] = _mm_set1_ps(quantization.offset[k]);
+		invScale[k] = _mm_set1_ps(quantization.scale[k] > 0.0f ? 1.0f / quantization.scale[k] : 0.0f);
+	}
+
+	const __m128i lowMask = _mm_set1_epi32(0xffff);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const float* v = vertices + i * UnpackedVertexFloats;
+
+		__m128 px = _mm_loadu_ps(v + 0), py = _mm_loadu_ps(v + 8), pz = _mm_loadu_ps(v + 16), nx = _mm_loadu_ps(v + 24);
+		__m128 ny = _mm_loadu_ps(v + 4), nz = _mm_loadu_ps(v + 12), u = _mm_loadu_ps(v + 20), t = _mm_loadu_ps(v + 28);
+		_MM_TRANSPOSE4_PS(px, py, pz, nx);
+		_MM_TRANSPOSE4_PS(ny, nz, u, t);
+
+		__m128i qx = _mm_cvtps_epi32(ClampSSE2(_mm_mul_ps(_mm_sub_ps(px, offset[0]), invScale[0]), 0.0f, UnormMax));
+		__m128i qy = _mm_cvtps_epi32(ClampSSE2(_mm_mul_ps(_mm_sub_ps(py, offset[1]), invScale[1]), 0.0f, UnormMax));
+		__m128i qz = _mm_cvtps_epi32(ClampSSE2(_mm_mul_ps(_mm_sub_ps(pz, offset[2]), invScale[2]), 0.0f, UnormMax));
+
+		__m128 l1 = _mm_add_ps(_mm_add_ps(AbsSSE2(nx), AbsSSE2(ny)), AbsSSE2(nz));
+		__m128 invL1 = _mm_and_ps(_mm_div_ps(one, l1), _mm_cmpgt_ps(l1, _mm_setzero_ps()));
+		__m128 x = _mm_mul_ps(nx, invL1);
+		__m128 y = _mm_mul_ps(ny, invL1);
+		__m128 z = _mm_mul_ps(nz, invL1);
+
+		__m128 foldedX = _mm_mul_ps(_mm_sub_ps(one, AbsSSE2(y)), SignNotZeroSSE2(x));
+		__m128 foldedY = _mm_mul_ps(_mm_sub_ps(one, AbsSSE2(x)), SignNotZeroSSE2(y));
+		__m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+		x = Select(lower, foldedX, x);
+		y = Select(lower, foldedY, y);
+
+		__m128i ox = _mm_cvtps_epi32(_mm_mul_ps(ClampSSE2(x, -1.0f, 1.0f), _mm_set1_ps(SnormMax)));
+		__m128i oy = _mm_cvtps_epi32(_mm_mul_ps(ClampSSE2(y, -1.0f, 1.0f), _mm_set1_ps(SnormMax)));
+
+		__m128i hu = FloatToHalfSSE2(u);
+		__m128i hv = FloatToHalfSSE2(t);
+
+		// one dword per attribute pair and vertex, transposed into one row per vertex
+		__m128 xy = _mm_castsi128_ps(_mm_or_si128(qx, _mm_slli_epi32(qy, 16)));
+		__m128 zw = _mm_castsi128_ps(_mm_or_si128(qz, _mm_slli_epi32(lowMask, 16)));
+		__m128 oct = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(ox, lowMask), _mm_slli_epi32(oy, 16)));
+		__m128 uv = _mm_castsi128_ps(_mm_or_si128(hu, _mm_slli_epi32(hv, 16)));
+		_MM_TRANSPOSE4_PS(xy, zw, oct, uv);
+
+		_mm_storeu_ps((float*)(packed + i + 0), xy);
+		_mm_storeu_ps((float*)(packed + i + 1), zw);
+		_mm_storeu_ps((float*)(packed + i + 2), oct);
+		_mm_storeu_ps((float*)(packed + i + 3), uv);
+	}
+
+	EncodeScalar(vertices, i, count, quantization, packed);
+}
+
+static void DecodeSSE2(const PackedVertex* packed, size_t count, const VertexQuantization& quantization, float* vertices)
+{
+	__m128 offset[3], scale[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		offset[k] = _mm_set1_ps(quantization.offset[k]);
+		scale[k] = _mm_set1_ps(quantization.scale[k]);
+	}
+
+	const __m128i lowMask = _mm_set1_epi32(0xffff);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minusOne = _mm_set1_ps(-1.0f);
+	const __m128 snormMax = _mm_set1_ps(SnormMax);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 xy = _mm_loadu_ps((const float*)(packed + i + 0));
+		__m128 zw = _mm_loadu_ps((const float*)(packed + i + 1));
+		__m128 oct = _mm_loadu_ps((const float*)(packed + i + 2));
+		__m128 uv = _mm_loadu_ps((const float*)(packed + i + 3));
+		_MM_TRANSPOSE4_PS(xy, zw, oct, uv);
+
+		__m128i ixy = _mm_castps_si128(xy);
+		__m128i ioct = _mm_castps_si128(oct);
+		__m128i iuv = _mm_castps_si128(uv);
+
+		__m128 px = _mm_add_ps(offset[0], _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(ixy, lowMask)), scale[0]));
+		__m128 py = _mm_add_ps(offset[1], _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(ixy, 16)), scale[1]));
+		__m128 pz = _mm_add_ps(offset[2], _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_castps_si128(zw), lowMask)), scale[2]));
+
+		// sign extend the snorm16 pairs
+		__m128 x = _mm_max_ps(_mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(ioct, 16), 16)), snormMax), minusOne);
+		__m128 y = _mm_max_ps(_mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(ioct, 16)), snormMax), minusOne);
+		__m128 z = _mm_sub_ps(_mm_sub_ps(one, AbsSSE2(x)), AbsSSE2(y));
+		__m128 t = _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), z), _mm_setzero_ps());
+		x = _mm_add_ps(x, Select(_mm_cmpge_ps(x, _mm_setzero_ps()), _mm_sub_ps(_mm_setzero_ps(), t), t));
+		y = _mm_add_ps(y, Select(_mm_cmpge_ps(y, _mm_setzero_ps()), _mm_sub_ps(_mm_setzero_ps(), t), t));
+
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+		__m128 nx = _mm_div_ps(x, length);
+		__m128 ny = _mm_div_ps(y, length);
+		__m128 nz = _mm_div_ps(z, length);
+
+		__m128 u = HalfToFloatSSE2(_mm_and_si128(iuv, lowMask));
+		__m128 v = HalfToFloatSSE2(_mm_srli_epi32(iuv, 16));
+
+		_MM_TRANSPOSE4_PS(px, py, pz, nx);
+		_MM_TRANSPOSE4_PS(ny, nz, u, v);
+
+		float* out = vertices + i * UnpackedVertexFloats;
+		_mm_storeu_ps(out + 0, px);
+		_mm_storeu_ps(out + 4, ny);
+		_mm_storeu_ps(out + 8, py);
+		_mm_storeu_ps(out + 12, nz);
+		_mm_storeu_ps(out + 16, pz);
+		_mm_storeu_ps(out + 20, u);
+		_mm_storeu_ps(out + 24, nx);
+		_mm_storeu_ps(out + 28, v);
+	}
+
+	DecodeScalar(packed, i, count, quantization, vertices);
+}
+
+//////////// AVX2 + F16C, 8 vertices per iteration.
+// Vertex k and k + 4 share a row, one per 128 bit lane, so the in-lane
+// shuffles transpose both groups of 4 at once.
+
+AVX2_TARGET static inline void TransposeLanes(__m256& r0, __m256& r1, __m256& r2, __m256& r3)
+{
+	__m256 t0 = _mm256_shuffle_ps(r0, r1, 0x44);
+	__m256 t2 = _mm256_shuffle_ps(r0, r1, 0xEE);
+	__m256 t1 = _mm256_shuffle_ps(r2, r3, 0x44);
+	__m256 t3 = _mm256_shuffle_ps(r2, r3, 0xEE);
+	r0 = _mm256_shuffle_ps(t0, t1, 0x88);
+	r1 = _mm256_shuffle_ps(t0, t1, 0xDD);
+	r2 = _mm256_shuffle_ps(t2, t3, 0x88);
+	r3 = _mm256_shuffle_ps(t2, t3, 0xDD);
+}
+
+AVX2_TARGET static inline __m256 LoadRow(const float* low, const float* high)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+}
+
+AVX2_TARGET static inline void StoreRow(float* low, float* high, __m256 row)
+{
+	_mm_storeu_ps(low, _mm256_castps256_ps128(row));
+	_mm_storeu_ps(high, _mm256_extractf128_ps(row, 1));
+}
+
+AVX2_TARGET static inline __m256 Select(__m256 mask, __m256 a, __m256 b)
+{
+	return _mm256_blendv_ps(b, a, mask);
+}
+
+AVX2_TARGET static inline __m256 AbsAVX2(__m256 value)
+{
+	return _mm256_and_ps(value, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+}
+
+AVX2_TARGET static inline __m256 ClampAVX2(__m256 value, float low, float high)
+{
+	return _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(low)), _mm256_set1_ps(high));
+}
+
+AVX2_TARGET static void EncodeAVX2(const float* vertices, size_t count, const VertexQuantization& quantization, PackedVertex* packed)
+{
+	__m256 offset[3], invScale[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		offset[k] = _mm256_set1_ps(quantization.offset[k]);
+		invScale[k] = _mm256_set1_ps(quantization.scale[k] > 0.0f ? 1.0f / quantization.scale[k] : 0.0f);
+	}
+
+	const __m256i lowMask = _mm256_set1_epi32(0xffff);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const float* v = vertices + i * UnpackedVertexFloats;
+		const size_t high = 4 * UnpackedVertexFloats;
+
+		__m256 px = LoadRow(v + 0, v + high + 0), py = LoadRow(v + 8, v + high + 8);
+		__m256 pz = LoadRow(v + 16, v + high + 16), nx = LoadRow(v + 24, v + high + 24);
+		__m256 ny = LoadRow(v + 4, v + high + 4), nz = LoadRow(v + 12, v + high + 12);
+		__m256 u = LoadRow(v + 20, v + high + 20), t = LoadRow(v + 28, v + high + 28);
+		TransposeLanes(px, py, pz, nx);
+		TransposeLanes(ny, nz, u, t);
+
+		__m256i qx = _mm256_cvtps_epi32(ClampAVX2(_mm256_mul_ps(_mm256_sub_ps(px, offset[0]), invScale[0]), 0.0f, UnormMax));
+		__m256i qy = _mm256_cvtps_epi32(ClampAVX2(_mm256_mul_ps(_mm256_sub_ps(py, offset[1]), invScale[1]), 0.0f, UnormMax));
+		__m256i qz = _mm256_cvtps_epi32(ClampAVX2(_mm256_mul_ps(_mm256_sub_ps(pz, offset[2]), invScale[2]), 0.0f, UnormMax));
+
+		__m256 l1 = _mm256_add_ps(_mm256_add_ps(AbsAVX2(nx), AbsAVX2(ny)), AbsAVX2(nz));
+		__m256 invL1 = _mm256_and_ps(_mm256_div_ps(one, l1), _mm256_cmp_ps(l1, zero, _CMP_GT_OQ));
+		__m256 x = _mm256_mul_ps(nx, invL1);
+		__m256 y = _mm256_mul_ps(ny, invL1);
+		__m256 z = _mm256_mul_ps(nz, invL1);
+
+		__m256 signX = Select(_mm256_cmp_ps(x, zero, _CMP_LT_OQ), _mm256_set1_ps(-1.0f), one);
+		__m256 signY = Select(_mm256_cmp_ps(y, zero, _CMP_LT_OQ), _mm256_set1_ps(-1.0f), one);
+		__m256 foldedX = _mm256_mul_ps(_mm256_sub_ps(one, AbsAVX2(y)), signX);
+		__m256 foldedY = _mm256_mul_ps(_mm256_sub_ps(one, AbsAVX2(x)), signY);
+		__m256 lower = _mm256_cmp_ps(z, zero, _CMP_LT_OQ);
+		x = Select(lower, foldedX, x);
+		y = Select(lower, foldedY, y);
+
+		__m256i ox = _mm256_cvtps_epi32(_mm256_mul_ps(ClampAVX2(x, -1.0f, 1.0f), _mm256_set1_ps(SnormMax)));
+		__m256i oy = _mm256_cvtps_epi32(_mm256_mul_ps(ClampAVX2(y, -1.0f, 1.0f), _mm256_set1_ps(SnormMax)));
+
+		__m256i hu = _mm256_cvtepu16_epi32(_mm256_cvtps_ph(u, _MM_FROUND_TO_NEAREST_INT));
+		__m256i hv = _mm256_cvtepu16_epi32(_mm256_cvtps_ph(t, _MM_FROUND_TO_NEAREST_INT));
+
+		__m256 xy = _mm256_castsi256_ps(_mm256_or_si256(qx, _mm256_slli_epi32(qy, 16)));
+		__m256 zw = _mm256_castsi256_ps(_mm256_or_si256(qz, _mm256_slli_epi32(lowMask, 16)));
+		__m256 oct = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(ox, lowMask), _mm256_slli_epi32(oy, 16)));
+		__m256 uv = _mm256_castsi256_ps(_mm256_or_si256(hu, _mm256_slli_epi32(hv, 16)));
+		TransposeLanes(xy, zw, oct, uv);
+
+		StoreRow((float*)(packed + i + 0), (float*)(packed + i + 4), xy);
+		StoreRow((float*)(packed + i + 1), (float*)(packed + i + 5), zw);
+		StoreRow((float*)(packed + i + 2), (float*)(packed + i + 6), oct);
+		StoreRow((float*)(packed + i + 3), (float*)(packed + i + 7), uv);
+	}
+
+	EncodeSSE2(vertices + i * UnpackedVertexFloats, count - i, quantization, packed + i);
+}
+
+// Low or high 16 bits of every dword as 8 halves in vertex order
+AVX2_TARGET static inline __m256 HalfToFloatAVX2(__m256i dwords)
+{
+	__m256i words = _mm256_packus_epi32(dwords, dwords);
+	words = _mm256_permute4x64_epi64(words, 0x08);
+	return _mm256_cvtph_ps(_mm256_castsi256_si128(words));
+}
+
+AVX2_TARGET static void DecodeAVX2(const PackedVertex* packed, size_t count, const VertexQuantization& quantization, float* vertices)
+{
+	__m256 offset[3], scale[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		offset[k] = _mm256_set1_ps(quantization.offset[k]);
+		scale[k] = _mm256_set1_ps(quantization.scale[k]);
+	}
+
+	const __m256i lowMask = _mm256_set1_epi32(0xffff);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 minusOne = _mm256_set1_ps(-1.0f);
+	const __m256 snormMax = _mm256_set1_ps(SnormMax);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 xy = LoadRow((const float*)(packed + i + 0), (const float*)(packed + i + 4));
+		__m256 zw = LoadRow((const float*)(packed + i + 1), (const float*)(packed + i + 5));
+		__m256 oct = LoadRow((const float*)(packed + i + 2), (const float*)(packed + i + 6));
+		__m256 uv = LoadRow((const float*)(packed + i + 3), (const float*)(packed + i + 7));
+		TransposeLanes(xy, zw, oct, uv);
+
+		__m256i ixy = _mm256_castps_si256(xy);
+		__m256i ioct = _mm256_castps_si256(oct);
+		__m256i iuv = _mm256_castps_si256(uv);
+
+		__m256 px = _mm256_add_ps(offset[0], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(ixy, lowMask)), scale[0]));
+		__m256 py = _mm256_add_ps(offset[1], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(ixy, 16)), scale[1]));
+		__m256 pz = _mm256_add_ps(offset[2], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_castps_si256(zw), lowMask)), scale[2]));
+
+		__m256 x = _mm256_max_ps(_mm256_div_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(ioct, 16), 16)), snormMax), minusOne);
+		__m256 y = _mm256_max_ps(_mm256_div_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(ioct, 16)), snormMax), minusOne);
+		__m256 z = _mm256_sub_ps(_mm256_sub_ps(one, AbsAVX2(x)), AbsAVX2(y));
+		__m256 t = _mm256_max_ps(_mm256_sub_ps(zero, z), zero);
+		x = _mm256_add_ps(x, Select(_mm256_cmp_ps(x, zero, _CMP_GE_OQ), _mm256_sub_ps(zero, t), t));
+		y = _mm256_add_ps(y, Select(_mm256_cmp_ps(y, zero, _CMP_GE_OQ), _mm256_sub_ps(zero, t), t));
+
+		__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+		__m256 nx = _mm256_div_ps(x, length);
+		__m256 ny = _mm256_div_ps(y, length);
+		__m256 nz = _mm256_div_ps(z, length);
+
+		__m256 u = HalfToFloatAVX2(_mm256_and_si256(iuv, lowMask));
+		__m256 v = HalfToFloatAVX2(_mm256_srli_epi32(iuv, 16));
+
+		TransposeLanes(px, py, pz, nx);
+		TransposeLanes(ny, nz, u, v);
+
+		float* out = vertices + i * UnpackedVertexFloats;
+		const size_t high = 4 * UnpackedVertexFloats;
+		StoreRow(out + 0, out + high + 0, px);
+		StoreRow(out + 4, out + high + 4, ny);
+		StoreRow(out + 8, out + high + 8, py);
+		StoreRow(out + 12, out + high + 12, nz);
+		StoreRow(out + 16, out + high + 16, pz);
+		StoreRow(out + 20, out + high + 20, u);
+		StoreRow(out + 24, out + high + 24, nx);
+		StoreRow(out + 28, out + high + 28, v);
+	}
+
+	DecodeSSE2(packed + i, count - i, quantization, vertices + i * UnpackedVertexFloats);
+}
+
+void EncodePackedVertices(const float* vertices, size_t count, const VertexQuantization& quantization, PackedVertex* packed, VertexPackingKernel kernel)
+{
+	switch (GetVertexPackingKernel(kernel))
+	{
+	case VERTEX_PACKING_AVX2:
+		EncodeAVX2(vertices, count, quantization, packed);
+		break;
+	case VERTEX_PACKING_SSE2:
+		EncodeSSE2(vertices, count, quantization, packed);
+		break;
+	default:
+		EncodeScalar(vertices, 0, count, quantization, packed);
+		break;
+	}
+}
+
+void DecodePackedVertices(const PackedVertex* packed, size_t count, const VertexQuantization& quantization, float* vertices, VertexPackingKernel kernel)
+{
+	switch (GetVertexPackingKernel(kernel))
+	{
+	case VERTEX_PACKING_AVX2:
+		DecodeAVX2(packed, count, quantization, vertices);
+		break;
+	case VERTEX_PACKING_SSE2:
+		DecodeSSE2(packed, count, quantization, vertices);
+		break;
+	default:
+		DecodeScalar(packed, 0, count, quantization, vertices);
+		break;
+	}
+}
+
+void ConvertFloatsToHalves(const float* values, size_t count, uint16_t* halves)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		// sign extend the low 16 bits so the saturating pack keeps them as they are
+		__m128i low = FloatToHalfSSE2(_mm_loadu_ps(values + i));
+		__m128i high = FloatToHalfSSE2(_mm_loadu_ps(values + i + 4));
+		low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+		high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+		_mm_storeu_si128((__m128i*)(halves + i), _mm_packs_epi32(low, high));
+	}
+
+	for (; i < count; ++i)
+	{
+		halves[i] = FloatToHalf(values[i]);
+	}
+}
+
+void ConvertHalvesToFloats(const uint16_t* halves, size_t count, float* values)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i*)(halves + i));
+		_mm_storeu_ps(values + i, HalfToFloatSSE2(_mm_unpacklo_epi16(packed, zero)));
+		_mm_storeu_ps(values + i + 4, HalfToFloatSSE2(_mm_unpackhi_epi16(packed, zero)));
+	}
+
+	for (; i < count; ++i)
+	{
+		values[i] = HalfToFloat(halves[i]);
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// VertexPacking
+// Compact 16 byte vertex format for Mesh next to the 32 byte float Vertex:
+// position  R16G16B16A16_UNORM, relative to the mesh bounds, w is always 1
+// normal    R16G16_SNORM, octahedral encoding
+// texcoord  R16G16_FLOAT
+// Encode and decode have SSE2 and AVX2/F16C kernels, picked at runtime, and a
+// scalar reference they are checked against. The kernels read and write the
+// Vertex layout (position, normal, texcoord as 8 floats) and only use the
+// standard library and intrinsics, so they run on Linux as well.
+// usage:
+// VertexQuantization quantization = ComputeVertexQuantization(positions, stride, count);
+// EncodePackedVertices(&vertices[0].Position.x, count, quantization, packed);
+
+#pragma pack(push,1)
+struct PackedVertex
+{
+	uint16_t Position[4];
+	int16_t Normal[2];
+	uint16_t Tex[2];
+};
+#pragma pack(pop)
+
+// Object space position = offset + unorm position * scale
+struct VertexQuantization
+{
+	float offset[3];
+	float scale[3];
+};
+
+// Worst case errors of a packed vertex, see PackedVertexErrorBounds
+struct PackedVertexErrors
+{
+	PackedVertexErrors() : position(0.0f), normal(0.0f), tex(0.0f) {}
+
+	float position;	// per axis, object space units
+	float normal;	// per component of the unit normal
+	float tex;		// per component relative to max(1, |uv|)
+};
+
+enum VertexPackingKernel
+{
+	VERTEX_PACKING_AUTO = 0,	// best kernel the CPU supports
+	VERTEX_PACKING_SCALAR,
+	VERTEX_PACKING_SSE2,
+	VERTEX_PACKING_AVX2
+};
+
+// Size in floats of one unpacked vertex
+static const size_t UnpackedVertexFloats = 8;
+
+// Quantization of the bounding box of the positions
+VertexQuantization ComputeVertexQuantization(const float* vertices, size_t count);
+
+// Error bounds every packed vertex stays within for quantization
+PackedVertexErrors PackedVertexErrorBounds(const VertexQuantization& quantization);
+
+// AVX2 and F16C with OS support for the ymm registers, for the kernels picked at runtime
+bool CpuSupportsAvx2();
+
+// Resolves VERTEX_PACKING_AUTO to the kernel used on this CPU
+VertexPackingKernel GetVertexPackingKernel(VertexPackingKernel kernel = VERTEX_PACKING_AUTO);
+
+// vertices holds count vertices of UnpackedVertexFloats floats
+void EncodePackedVertices(const float* vertices, size_t count, const VertexQuantization& quantization, PackedVertex* packed,
+	VertexPackingKernel kernel = VERTEX_PACKING_AUTO);
+
+// Decoded normals are renormalized
+void DecodePackedVertices(const PackedVertex* packed, size_t count, const VertexQuantization& quantization, float* vertices,
+	VertexPackingKernel kernel = VERTEX_PACKING_AUTO);
+
+// Rounds count floats to half floats, round to nearest even like the texcoords
+void ConvertFloatsToHalves(const float* values, size_t count, uint16_t* halves);
+
+// Widens count half floats to floats
+void ConvertHalvesToFloats(const uint16_t* halves, size_t count, float* values);
@@ -0,0 +1,90 @@
+#include "Common.hlsl"
+
+// Point and spot lights without shadow maps in one full screen pass: each pixel finds
+// the froxel of its screen tile and view depth, see LightClusterGrid, and adds up the
+// lights of the froxel.
+
+struct ClusterLight
+{
+	float3 Position;
+	float RangeRcp;
+	float3 DirToLight;
+	float CosOuterCone;			// below -1 for point lights
+	float3 Color;
+	float CosConeAttRange;
+};
+
+StructuredBuffer<ClusterLight> ClusterLights	: register(t8);
+Buffer<uint2> ClusterRanges						: register(t9);		// offset and count of each froxel
+Buffer<uint> ClusterLightIndices				: register(t10);
+
+cbuffer cbClusteredLights : register(b1)
+{
+	uint3 ClusterGrid			: packoffset(c0);		// tiles x, tiles y, slices
+	float2 ClusterSlice			: packoffset(c1);		// slice = log(depth) * x + y
+}
+
+// full screen quad of DirLightVS
+struct VS_OUTPUT
+{
+	float4 Position : SV_Position;
+	float2 cpPos	: TEXCOORD0;
+};
+
+// Point or spot light, as CalcPoint and CalcSpot without shadows
+float3 CalcClusterLight(float3 position, Material material, ClusterLight light)
+{
+	float3 ToLight = light.Position - position;
+	float3 ToEye = EyePosition - position;
+	float DistToLight = length(ToLight);
+
+	// Phong diffuse
+	ToLight /= DistToLight; // Normalize
+	float NDotL = saturate(dot(ToLight, material.normal));
+	float3 finalColor = material.diffuseColor.rgb * NDotL;
+
+	// Blinn specular
+	ToEye = normalize(ToEye);
+	float3 HalfWay = normalize(ToEye + ToLight);
+	float NDotH = saturate(dot(HalfWay, material.normal));
+	finalColor += pow(NDotH, material.specPow) * material.specIntensity;
+
+	// Cone attenuation, always one for point lights
+	float cosAng = dot(light.DirToLight, ToLight);
+	float conAtt = saturate((cosAng - light.CosOuterCone) / light.CosConeAttRange);
+	conAtt *= conAtt;
+
+	// Attenuation
+	float DistToLightNorm = 1.0 - saturate(DistToLight * light.RangeRcp);
+	float Attn = DistToLightNorm * DistToLightNorm;
+	finalColor *= light.Color.rgb * Attn * conAtt;
+
+	return finalColor;
+}
+
+float4 ClusteredLightsPS(VS_OUTPUT In) : SV_TARGET
+{
+	// Unpack the GBuffer
+	SURFACE_DATA gbd = UnpackGBuffer_Loc(In.Position.xy);
+
+	// Convert the data into the material structure
+	Material mat;
+	MaterialFromGBuffer(gbd, mat);
+
+	// Reconstruct the world position
+	float3 position = CalcWorldPos(In.cpPos, gbd.LinearDepth);
+
+	// Froxel of the pixel, tiles from the top left
+	uint2 tile = min((uint2)((In.cpPos * float2(0.5, -0.5) + 0.5) * ClusterGrid.xy), ClusterGrid.xy - 1);
+	uint slice = (uint)clamp(log(gbd.LinearDepth) * ClusterSlice.x + ClusterSlice.y, 0.0, (float)ClusterGrid.z - 1.0);
+	uint2 range = ClusterRanges[(slice * ClusterGrid.y + tile.y) * ClusterGrid.x + tile.x];
+
+	// Add up the lights of the froxel
+	float3 finalColor = 0.0;
+	for (uint i = 0; i < range.y; ++i)
+	{
+		finalColor += CalcClusterLight(position, mat, ClusterLights[ClusterLightIndices[range.x + i]]);
+	}
+
+	return float4(finalColor, 1.0);
+}
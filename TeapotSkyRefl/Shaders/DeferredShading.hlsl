@@ -28,10 +28,16 @@ SamplerState LinearSampler  : register(s0);
 
 
 // shader input/output structure
+// PACKED_VERTEX: positions are unorm16 relative to the mesh bounds, the
+// dequantization is part of WorldViewProjection. Normals are octahedral snorm16.
 struct VS_INPUT
 {
     float4 Position : POSITION;
+#ifdef PACKED_VERTEX
+    float2 Normal   : NORMAL;
+#else
     float3 Normal   : NORMAL;
+#endif
     float2 UV       : TEXCOORD0;
 };
 
@@ -42,6 +48,15 @@ struct VS_OUTPUT
     float3 Normal   : TEXCOORD1;
 };
 
+// Octahedral normal decoding, the lower hemisphere is folded over the diagonals
+float3 DecodeOctahedralNormal(float2 e)
+{
+    float3 n = float3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 // Vertex shader
 VS_OUTPUT RenderSceneVS(VS_INPUT input)
 {
@@ -54,7 +69,11 @@ VS_OUTPUT RenderSceneVS(VS_INPUT input)
     Output.UV = input.UV;
 
 	// Transform the normal to world space
+#ifdef PACKED_VERTEX
+	Output.Normal = mul(DecodeOctahedralNormal(input.Normal), (float3x3) World);
+#else
 	Output.Normal = mul(input.Normal, (float3x3) World);
+#endif
     
     return Output;
 }
@@ -2,19 +2,26 @@
 
 Texture2DArray<float> CascadeShadowMapTexture : register(t5);
 
+// GGX prefiltered sky and split sum lookup table, see EnvironmentPrefilter
+TextureCube SpecularEnvMap : register(t6);
+Texture2D<float2> BrdfLut : register(t7);
+
 // shader input/output structure
 cbuffer cbDirLight : register(b1)
 {
-    float3 AmbientDown			: packoffset(c0);
-    float3 AmbientRange			: packoffset(c1);
-    float3 DirToLight			: packoffset(c2);
-    float3 DirLightColor		: packoffset(c3);
-	float4x4 ToShadowSpace		: packoffset(c4);
-	float4 ToCascadeOffsetX		: packoffset(c8);
-	float4 ToCascadeOffsetY		: packoffset(c9);
-	float4 ToCascadeScale		: packoffset(c10);
+    float3 DirToLight			: packoffset(c0);
+    float3 DirLightColor		: packoffset(c1);
+	float4x4 ToShadowSpace		: packoffset(c2);
+	float4 ToCascadeOffsetX		: packoffset(c6);
+	float4 ToCascadeOffsetY		: packoffset(c7);
+	float4 ToCascadeScale		: packoffset(c8);
+	float4 AmbientSH[9]			: packoffset(c9);
+	float4 SpecularEnv			: packoffset(c18);	// last mip, enabled
 }
 
+// F0 of the sky reflections
+static const float SkyReflectance = 0.8;
+
 static const float2 arrBasePos[4] =
 {
     float2(-1.0, 1.0),
@@ -54,16 +61,36 @@ VS_OUTPUT DirLightVS(uint VertexID : SV_VertexID)
 // Ambient light calculation helper function
 float3 CalcAmbient(float3 normal, float3 color)
 {
-	// Convert from [-1, 1] to [0, 1]
-    float up = normal.y * 0.5 + 0.5;
-
-	// Calculate the ambient value
-    float3 ambient = AmbientDown + up * AmbientRange;
+	// Irradiance of the spherical harmonics bands 0 to 2, see SphericalHarmonics::AmbientCoefficients
+    float3 ambient = AmbientSH[0].rgb
+        + AmbientSH[1].rgb * normal.y + AmbientSH[2].rgb * normal.z + AmbientSH[3].rgb * normal.x
+        + AmbientSH[4].rgb * (normal.x * normal.y) + AmbientSH[5].rgb * (normal.y * normal.z)
+        + AmbientSH[6].rgb * (3.0 * normal.z * normal.z - 1.0) + AmbientSH[7].rgb * (normal.x * normal.z)
+        + AmbientSH[8].rgb * (normal.x * normal.x - normal.y * normal.y);
+    ambient = max(ambient, 0.0);
 
 	// Apply the ambient value to the color
     return ambient * color;
 }
 
+// Image based specular light of the prefiltered sky with the split sum approximation
+float3 CalcSpecularEnvironment(float3 normal, float3 toEye, float3 reflectionVector, float specPow)
+{
+	// Blinn-Phong exponent to GGX alpha, the mips are spaced by its square root
+	float roughness = sqrt(sqrt(2.0 / (specPow + 2.0)));
+	float3 prefiltered = SpecularEnvMap.SampleLevel(samAnisotropic, reflectionVector, roughness * SpecularEnv.x).rgb;
+
+	// keep the lookup inside the texel centers, the sampler wraps
+	uint lutWidth, lutHeight;
+	BrdfLut.GetDimensions(lutWidth, lutHeight);
+	float2 lutSize = float2(lutWidth, lutHeight);
+	float2 lutUV = float2(saturate(dot(normal, toEye)), roughness);
+	lutUV = lutUV * (1.0 - 1.0 / lutSize) + 0.5 / lutSize;
+	float2 scaleBias = BrdfLut.SampleLevel(samAnisotropic, lutUV, 0.0);
+
+	return prefiltered * (SkyReflectance * scaleBias.x + scaleBias.y);
+}
+
 float CascadedShadow(float3 position)
 {
 	float4 posShadowSpace = mul(float4(position, 1.0), ToShadowSpace);
@@ -122,9 +149,17 @@ float3 CalcDirectional(float3 position, Material material, bool bUseShadow)
 	// reflection from cubemap
 	float3 incident = -ToEye;
 	float3 reflectionVector = reflect(incident, normal);
-	float4 reflectionColor  = float4(0.8, 0.8, 0.8, 1.0) * gCubeMap.Sample(samAnisotropic, reflectionVector);
+	float3 reflectionColor;
+	if (SpecularEnv.y > 0.0)
+	{
+		reflectionColor = CalcSpecularEnvironment(normal, ToEye, reflectionVector, material.specPow);
+	}
+	else
+	{
+		reflectionColor = SkyReflectance * gCubeMap.Sample(samAnisotropic, reflectionVector).rgb;
+	}
 
-	finalColor += reflectionColor.xyz;
+	finalColor += reflectionColor;
 
 	// Shadows
 	float shadowAtt;
@@ -1,6 +1,7 @@
 #include "Common.hlsl"
 
-TextureCube<float> PointShadowMapTexture : register(t4);
+// shadow atlas of the spot and point lights, a tile per cube face
+Texture2D<float> PointShadowMapTexture : register(t4);
 
 // constants
 cbuffer cbPointLightDomain : register(b0)
@@ -13,7 +14,8 @@ cbuffer cbPointLightPixel : register(b1)
     float3 PointLightPos            : packoffset(c0);
     float  PointLightRangeRcp       : packoffset(c0.w);
     float3 PointColor               : packoffset(c1);
-    float2 LightPerspectiveValues   : packoffset(c2);
+    float4x4 ToShadowmap[6]         : packoffset(c2);		// to the atlas UV and depth, +X, -X, +Y, -Y, +Z, -Z
+    float4 ShadowTiles[6]           : packoffset(c26);		// UV bounds of the face tiles
 }
 
 // Vertex shader
@@ -99,12 +101,23 @@ DS_OUTPUT PointLightDS(HS_CONSTANT_DATA_OUTPUT input, float2 UV : SV_DomainLocat
 //
 // Pixel shader
 //
-float PointShadowPCF(float3 ToPixel)
+float PointShadowPCF(float3 position, float3 ToPixel)
 {
+	// The cube face of the major axis
 	float3 ToPixelAbs = abs(ToPixel);
-	float Z = max(ToPixelAbs.x, max(ToPixelAbs.y, ToPixelAbs.z));
-	float Depth = (LightPerspectiveValues.x * Z + LightPerspectiveValues.y) / Z;
-	return PointShadowMapTexture.SampleCmpLevelZero(PCFSampler, ToPixel, Depth);
+	uint face;
+	if (ToPixelAbs.x >= ToPixelAbs.y && ToPixelAbs.x >= ToPixelAbs.z)
+		face = ToPixel.x > 0.0 ? 0 : 1;
+	else if (ToPixelAbs.y >= ToPixelAbs.z)
+		face = ToPixel.y > 0.0 ? 2 : 3;
+	else
+		face = ToPixel.z > 0.0 ? 4 : 5;
+
+	// Transform to the atlas UV and depth of the face, the filter stays inside the tile
+	float4 posShadowMap = mul(float4(position, 1.0), ToShadowmap[face]);
+	float3 UVD = posShadowMap.xyz / posShadowMap.w;
+	UVD.xy = clamp(UVD.xy, ShadowTiles[face].xy, ShadowTiles[face].zw);
+	return PointShadowMapTexture.SampleCmpLevelZero(PCFSampler, UVD.xy, UVD.z);
 }
 
 float3 CalcPoint(float3 position, Material material, bool bUseShadow)
@@ -130,7 +143,7 @@ float3 CalcPoint(float3 position, Material material, bool bUseShadow)
 	if (bUseShadow)
 	{
 		// Find the shadow attenuation for the pixels world position
-		shadowAtt = PointShadowPCF(position - PointLightPos);
+		shadowAtt = PointShadowPCF(position, position - PointLightPos);
 	}
 	else
 	{
@@ -33,14 +33,21 @@ struct GS_OUTPUT
 	uint RTIndex	: SV_RenderTargetArrayIndex;
 };
 
+// the cube faces are viewports on the tiles of the shadow atlas
+struct GS_ATLAS_OUTPUT
+{
+	float4 Pos		: SV_POSITION;
+	uint Viewport	: SV_ViewportArrayIndex;
+};
+
 [maxvertexcount(18)]
-void PointShadowGenGS(triangle float4 InPos[3] : SV_Position, inout TriangleStream<GS_OUTPUT> OutStream)
+void PointShadowGenGS(triangle float4 InPos[3] : SV_Position, inout TriangleStream<GS_ATLAS_OUTPUT> OutStream)
 {
 	for (int iFace = 0; iFace < 6; iFace++)
 	{
-		GS_OUTPUT output;
+		GS_ATLAS_OUTPUT output;
 
-		output.RTIndex = iFace;
+		output.Viewport = iFace;
 
 		for (int v = 0; v < 3; v++)
 		{
@@ -1,6 +1,6 @@
 #include "Common.hlsl"
 
-// spot light shadowmap texture
+// shadow atlas of the spot and point lights
 Texture2D<float> SpotShadowMapTexture : register(t4);
 
 
@@ -20,7 +20,8 @@ cbuffer cbSpotLightPixel : register(b1)
 	float SpotCosOuterCone		: packoffset(c1.w);
 	float3 SpotColor			: packoffset(c2);
 	float SpotCosConeAttRange	: packoffset(c2.w);
-	float4x4 ToShadowmap		: packoffset(c3);
+	float4x4 ToShadowmap		: packoffset(c3);		// to the atlas UV and depth
+	float4 ShadowTile			: packoffset(c7);		// UV bounds of the atlas tile
 }
 
 // Vertex Shader
@@ -119,12 +120,9 @@ float SpotShadowPCF(float3 position)
 	// Transform the world position to shadow projected space
 	float4 posShadowMap = mul(float4(position, 1.0), ToShadowmap);
 
-	// Transform to shadow clip space
+	// Transform to the atlas UV and depth, the filter stays inside the tile
 	float3 UVD = posShadowMap.xyz / posShadowMap.w;
-
-	// Convert to shadow map UV values
-	UVD.xy = 0.5 * UVD.xy + 0.5;
-	UVD.y = 1.0 - UVD.y;
+	UVD.xy = clamp(UVD.xy, ShadowTile.xy, ShadowTile.zw);
 
 	// Compute the hardware PCF value
 	return SpotShadowMapTexture.SampleCmpLevelZero(PCFSampler, UVD.xy, UVD.z);
@@ -9,6 +9,9 @@
 #include "Renderer/GBuffer.h"
 #include "Renderer/SceneManager.h"
 #include "Renderer/LightManager.h"
+#include "Renderer/Benchmark.h"
+#include "Renderer/AssetLoader.h"
+#include "Renderer/TextureManager.h"
 #include "Renderer/Util.h"
 
 enum RENDER_STATE { BACKBUFFERRT, DEPTHRT, COLSPECRT, NORMALRT, SPECPOWRT };
@@ -28,6 +31,9 @@ public:
 	void OnMouseUp(WPARAM btnState, int x, int y) override;
 	void OnMouseMove(WPARAM btnState, int x, int y) override;
 
+	// point and spot lights circling the teapot, see AddDemoLights
+	void SetDemoLightCount(int count) { mDemoLightCount = count; }
+
 private:
 	POINT mLastMousePos;
 
@@ -59,6 +65,8 @@ private:
 	bool mVisualizeLightVolume;
 	XMVECTOR mAmbientLowerColor;
 	XMVECTOR mAmbientUpperColor;
+	bool mSkyAmbient;	// spherical harmonics of the sky instead of the hemisphere colors
+	bool mSkySpecular;	// prefiltered sky reflections instead of the plain cubemap
 	XMVECTOR mDirLightDir;
 	XMVECTOR mDirLightColor;
 
@@ -66,12 +74,20 @@ private:
 	bool mAntiFlickerOn;
 	bool mVisualizeCascades;
 
+	// demo lights, added again every frame at their positions at time
+	int mDemoLightCount;
+	bool mDemoLightShadows;
+	void AddDemoLights(float time);
+
 	
 	void RenderGUI();
 	bool mShowSettings;
 	bool mShowShadowMap;
 
 	RENDER_STATE mRenderState;
+
+	// time to the first frame with every asset created is logged once
+	bool mAssetsReady;
 };
 
 
@@ -84,8 +100,20 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance, PSTR cmdLine, in
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	// Offline benchmarks, no window is created
+	if (RunBenchmarks(cmdLine))
+		return 0;
+
 	DeferredShaderApp shaderApp(hInstance);
 
+	// -syncload loads every asset before the first frame, to compare the time to first frame
+	shaderApp.SetAsyncLoading(strstr(cmdLine, "-syncload") == NULL);
+
+	// -lights N adds N demo point and spot lights, to see the clustered lights and the shadow atlas at work
+	const char* lights = strstr(cmdLine, "-lights");
+	if (lights != NULL)
+		shaderApp.SetDemoLightCount((std::max)(0, atoi(lights + strlen("-lights"))));
+
 	if (!shaderApp.Init())
 		return 0;
 
@@ -107,13 +135,18 @@ DeferredShaderApp::DeferredShaderApp(HINSTANCE hInstance)
 	// init light values
 	mAmbientLowerColor = XMVectorSet(0.1f, 0.1f, 0.1f, 1.0f);
 	mAmbientUpperColor = XMVectorSet(0.6f, 0.6f, 0.6f, 1.0f);
+	mSkyAmbient = true;
+	mSkySpecular = true;
 	mDirLightDir = XMVectorSet(-0.1, -0.4f, -0.9f, 1.0f);
 	mDirLightColor = XMVectorSet(0.8f, 0.8f, 0.8f, 1.0f);
 	mDirCastShadows = false;
 	mAntiFlickerOn = true;
 	mVisualizeCascades = false;
+	mDemoLightCount = 0;
+	mDemoLightShadows = true;
 
 	mRenderState = RENDER_STATE::BACKBUFFERRT;
+	mAssetsReady = false;
 }
 
 DeferredShaderApp::~DeferredShaderApp()
@@ -266,6 +299,9 @@ bool DeferredShaderApp::Init()
 	if (!mSceneManager.Init(md3dDevice, mCamera))
 		return false;
 
+	if (!mAsyncLoading)
+		AssetLoader::Instance()->Flush();
+
 	V_RETURN(mLightManager.Init(md3dDevice, mCamera));
 
 	return true;
@@ -287,13 +323,39 @@ void DeferredShaderApp::OnResize()
 
 void DeferredShaderApp::Update(float dt)
 {
-	// set ambient colors
-	mLightManager.SetAmbient(mAmbientLowerColor, mAmbientUpperColor);
+	// create the assets the workers finished since the last frame
+	AssetLoader::Instance()->Update();
+
+	// evict the textures over the budget after the last frame, load the evicted ones it drew
+	TextureManager::Instance()->Update();
+
+	if (!mAssetsReady && AssetLoader::Instance()->GetPendingCount() == 0)
+	{
+		char text[128];
+		snprintf(text, sizeof(text), "DeferredShaderApp: assets ready after %.1f ms\n", ElapsedSinceStartMs());
+		OutputDebugStringA(text);
+		mAssetsReady = true;
+	}
+
+	// set ambient colors, the hemisphere is used until the sky is loaded
+	SHCoefficients skyAmbient;
+	if (mSkyAmbient && mSceneManager.GetSkyAmbient(skyAmbient))
+		mLightManager.SetAmbientSH(skyAmbient);
+	else
+		mLightManager.SetAmbient(mAmbientLowerColor, mAmbientUpperColor);
+
+	// sky reflections, the plain cubemap is reflected until the prefiltered sky is baked
+	const Sky* sky = mSceneManager.GetSky();
+	if (mSkySpecular && sky != NULL)
+		mLightManager.SetSpecularEnvironment(sky->SpecularSRV(), sky->GetSpecularMipCount(), sky->BrdfLutSRV());
+	else
+		mLightManager.SetSpecularEnvironment(NULL, 0, NULL);
 
 	///// sun / directional light
 	mLightManager.SetDirectional(mDirLightDir, mDirLightColor, mDirCastShadows, mAntiFlickerOn);
 
 	mCamera->UpdateViewMatrix();
+	mSceneManager.SelectLods((float)mClientHeight);
 
 	if (GetAsyncKeyState(VK_F2) & 0x01)
 		mVisualizeGBuffer = !mVisualizeGBuffer;
@@ -329,12 +391,45 @@ void DeferredShaderApp::Update(float dt)
 		mRenderState = RENDER_STATE::SPECPOWRT;
 
 	mLightManager.ClearLights();
+	AddDemoLights(mTimer.TotalTime());
+}
 
+// of every group of this many demo lights, the first point and the first spot light cast shadows
+static const int DemoShadowLightGroup = 16;
+
+void DeferredShaderApp::AddDemoLights(float time)
+{
+	for (int i = 0; i < mDemoLightCount; ++i)
+	{
+		// spread over a disc around the teapot by the golden angle, each ring at its own speed
+		float ring = fmodf(i * 0.618034f, 1.0f);
+		float radius = 4.0f + 12.0f * ring;
+		float angle = i * 2.399963f + time * (0.2f + 0.3f * (1.0f - ring));
+		XMFLOAT3 position(radius * cosf(angle), 1.0f + 5.0f * fmodf(i * 0.381966f, 1.0f), radius * sinf(angle));
+		XMFLOAT3 color(0.6f + 0.4f * cosf(i * 0.7f), 0.6f + 0.4f * cosf(i * 0.7f + 2.1f), 0.6f + 0.4f * cosf(i * 0.7f + 4.2f));
+		bool castShadow = mDemoLightShadows && i % DemoShadowLightGroup < 2;
+
+		if (i % 2 == 0)
+		{
+			mLightManager.AddPointLight(position, 4.0f + 0.5f * radius, color, castShadow);
+		}
+		else
+		{
+			// aimed at the teapot
+			XMFLOAT3 direction;
+			XMStoreFloat3(&direction, XMVector3Normalize(XMVectorNegate(XMLoadFloat3(&position))));
+			mLightManager.AddSpotLight(position, direction, radius + 8.0f, 35.0f, 20.0f, color, castShadow);
+		}
+	}
 }
 
 void DeferredShaderApp::Render()
 {
-	
+	// Record the GBuffer draws and the casters of each shadow pass on worker threads, replayed below
+	mLightManager.PrepareShadowVolumes(mCamera);
+	const std::vector<ShadowCasterVolume>& shadowVolumes = mLightManager.GetShadowVolumes();
+	mSceneManager.RecordPasses(shadowVolumes.data(), shadowVolumes.size());
+
 	// Store the current states
 	D3D11_VIEWPORT oldvp;
 	UINT num = 1;
@@ -343,9 +438,10 @@ void DeferredShaderApp::Render()
 	md3dImmediateContext->RSGetState(&pPrevRSState);
 
 	// Generate the shadow maps
+	UINT shadowPass = 0;
 	while (mLightManager.PrepareNextShadowLight(md3dImmediateContext))
 	{
-		mSceneManager.RenderSceneNoShaders(md3dImmediateContext);
+		mSceneManager.RenderSceneNoShaders(md3dImmediateContext, shadowPass++);
 	}
 
 	// Restore the states
@@ -568,9 +664,33 @@ void DeferredShaderApp::RenderGUI()
 		if (mShowRenderStats)
 		{
 			ImGui::Begin("Framerate", 0, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoTitleBar);
-			ImGui::SetWindowSize(ImVec2(200, 30), ImGuiSetCond_FirstUseEver);
+			ImGui::SetWindowSize(ImVec2(240, 96), ImGuiSetCond_FirstUseEver);
 			ImGui::SetWindowPos(ImVec2(2, 2), ImGuiSetCond_FirstUseEver);
 			ImGui::Text("%.3f ms/frame (%.1f FPS)", mFrameStats.mspf, mFrameStats.fps);
+			const SceneDrawStats& drawStats = mSceneManager.GetDrawStats();
+			ImGui::Text("%u / %u meshes, %u draws, %u material switches", drawStats.visibleMeshes, drawStats.meshes,
+				drawStats.draws, drawStats.materialSwitches);
+			ImGui::Text("%u submeshes, %u state changes avoided", drawStats.submeshes, drawStats.stateChangesAvoided);
+			ImGui::Text("%u meshes occluded", drawStats.occludedMeshes);
+			const LightClusterStats& clusterStats = mLightManager.GetLightClusterStats();
+			ImGui::Text("%u clustered lights, %u indices, up to %u a froxel", clusterStats.lights, clusterStats.indices,
+				clusterStats.maxClusterLights);
+			const ShadowAtlasStats& atlasStats = mLightManager.GetShadowAtlasStats();
+			ImGui::Text("shadow atlas %u lights, %u tiles, %.0f%% used, %u packs", atlasStats.lights, atlasStats.tiles,
+				atlasStats.atlasTexels ? 100.0 * atlasStats.usedTexels / atlasStats.atlasTexels : 0.0, atlasStats.packs);
+			const std::vector<ShadowPassStats>& shadowStats = mSceneManager.GetShadowStats();
+			for (size_t i = 0; i < shadowStats.size(); ++i)
+			{
+				ImGui::Text("shadow pass %u: %u casters, %u culled", (UINT)i, shadowStats[i].casters, shadowStats[i].culled);
+			}
+			const TextureResidencyStats& textureStats = TextureManager::Instance()->GetResidencyStats();
+			ImGui::Text("textures %.1f / %.0f MB, %u resident", textureStats.residentBytes / 1048576.0,
+				textureStats.budgetBytes / 1048576.0, textureStats.residentCount);
+			ImGui::Text("%u evicted, %llu evictions, %llu reloads", textureStats.evictedCount,
+				(unsigned long long)textureStats.evictions, (unsigned long long)textureStats.reloads);
+			const TextureStreamerStats& streamStats = TextureManager::Instance()->GetStreamerStats();
+			ImGui::Text("streaming %u textures, %.1f MB uploaded", streamStats.streamingCount,
+				streamStats.bytesUploaded / 1048576.0);
 			ImGui::End();
 		}
 
@@ -589,6 +709,12 @@ void DeferredShaderApp::RenderGUI()
 			ImGui::ColorEdit3("DirLightColor##dcol1", (float*)&color, ImGuiColorEditFlags_NoLabel);
 			mDirLightColor = XMLoadFloat3(&XMFLOAT3((float*)&color));
 			ImGui::Checkbox("Shadows##dirshadow", &mDirCastShadows); 
+			ImGui::Checkbox("Sky ambient##skyambient", &mSkyAmbient);
+			ImGui::Checkbox("Sky reflections##skyspecular", &mSkySpecular);
+
+			ImGui::Text("Demo Lights");
+			ImGui::SliderInt("Count##demolights", &mDemoLightCount, 0, 1024);
+			ImGui::Checkbox("Shadows##demoshadows", &mDemoLightShadows);
 			
 			ImGui::Text("Material");
 			Mesh* mesh = mSceneManager.GetMesh(0);
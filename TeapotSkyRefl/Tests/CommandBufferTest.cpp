@@ -0,0 +1,170 @@
+#include "Test.h"
+#include "CommandBuffer.h"
+#include "Parallel.h"
+
+#include <cstring>
+#include <vector>
+
+// the packets of one synthetic pass, the same for the same pass and count
+static void BuildPass(uint32_t pass, uint32_t count, RenderQueue& queue)
+{
+	TestRandom random(pass * 7919u + 1);
+
+	queue.Clear();
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		DrawPacket packet;
+		packet.pass = pass;
+		packet.shader = (random.Next() >> 8) % 2;
+		packet.texture = pass == 0 ? (random.Next() >> 8) % 256 : 0;
+		packet.mesh = i / 8;
+		packet.constants = i / 8;
+		packet.material = pass == 0 ? i % 8 : 0;
+		packet.rangeOffset = i;
+		packet.rangeCount = 1 + i % 3;
+		packet.key = RenderQueue::MakeKey(packet.pass, packet.shader, packet.texture, packet.mesh, packet.material,
+			((random.Next() >> 8) & 0xffff) / 65535.0f);
+		queue.Submit(packet);
+	}
+	queue.Sort();
+}
+
+static bool SameCalls(const RecordingRenderBackend& a, const RecordingRenderBackend& b)
+{
+	const std::vector<RecordingRenderBackend::Call>& callsA = a.GetCalls();
+	const std::vector<RecordingRenderBackend::Call>& callsB = b.GetCalls();
+	if (callsA.size() != callsB.size() || a.GetDraws().size() != b.GetDraws().size())
+		return false;
+	for (size_t i = 0; i < callsA.size(); ++i)
+	{
+		if (callsA[i].command != callsB[i].command || callsA[i].value != callsB[i].value)
+			return false;
+	}
+	return a.GetDraws().empty() ||
+		memcmp(a.GetDraws().data(), b.GetDraws().data(), a.GetDraws().size() * sizeof(RecordingRenderBackend::DrawState)) == 0;
+}
+
+// one pass recorded and replayed makes the calls executing its queue makes
+static void TestReplay()
+{
+	RenderQueue queue;
+	BuildPass(0, 5000, queue);
+
+	RecordingRenderBackend direct;
+	queue.Execute(direct);
+
+	CommandBuffer buffer;
+	queue.Execute(buffer);
+	RecordingRenderBackend replayed;
+	buffer.Replay(replayed);
+	CHECK(SameCalls(direct, replayed));
+	CHECK(buffer.GetCommandCount() == direct.GetCalls().size());
+
+	// the null backend counts every call and the ranges of the draws
+	NullRenderBackend counter;
+	buffer.Replay(counter);
+	size_t ranges = 0;
+	for (uint32_t i = 0; i < 5000; ++i)
+	{
+		ranges += 1 + i % 3;
+	}
+	CHECK(counter.GetCallCount() == buffer.GetCommandCount());
+	CHECK(counter.GetDrawCount() == ranges);
+
+	// a reset buffer records from scratch
+	size_t words = buffer.GetWords().size();
+	buffer.Reset();
+	CHECK(buffer.IsEmpty() && buffer.GetSizeBytes() == 0);
+	queue.Execute(buffer);
+	CHECK(buffer.GetWords().size() == words);
+
+	// nothing recorded replays nothing
+	CommandBuffer empty;
+	RecordingRenderBackend none;
+	empty.Replay(none);
+	CHECK(none.GetCalls().empty());
+}
+
+// passes recorded on the worker pool and replayed in pass order make the calls of
+// executing them one after the other, whatever the threads
+static void TestParallelRecording()
+{
+	const uint32_t counts[] = { 10000, 100000 };
+	const uint32_t passCount = 7;
+	const int frames = 5;
+
+	for (uint32_t count : counts)
+	{
+		std::vector<uint32_t> passDraws(passCount);
+		size_t totalDraws = 0;
+		for (uint32_t pass = 0; pass < passCount; ++pass)
+		{
+			passDraws[pass] = pass == 0 ? count : count / 4;
+			totalDraws += passDraws[pass];
+		}
+
+		std::vector<RenderQueue> queues(passCount);
+		RecordingRenderBackend reference;
+		NullRenderBackend nullBackend;
+		TestTimer timer;
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			for (uint32_t pass = 0; pass < passCount; ++pass)
+			{
+				BuildPass(pass, passDraws[pass], queues[pass]);
+				queues[pass].Execute(nullBackend);
+			}
+		}
+		double directMs = timer.ElapsedMs();
+		for (uint32_t pass = 0; pass < passCount; ++pass)
+		{
+			queues[pass].Execute(reference);
+		}
+		TestLog("commands: %zu draws in %u passes, built and executed on one thread %.3f ms", totalDraws, passCount, directMs / frames);
+
+		for (unsigned int threads = 1; threads <= passCount; threads += 3)
+		{
+			std::vector<CommandBuffer> buffers(passCount);
+			double recordMs = 0.0, replayMs = 0.0;
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				timer.Reset();
+				ParallelFor(passCount, 1, threads, [&](size_t begin, size_t end)
+				{
+					for (size_t pass = begin; pass < end; ++pass)
+					{
+						BuildPass((uint32_t)pass, passDraws[pass], queues[pass]);
+						buffers[pass].Reset();
+						queues[pass].Execute(buffers[pass]);
+					}
+				});
+				recordMs += timer.ElapsedMs();
+
+				timer.Reset();
+				NullRenderBackend replayBackend;
+				for (const CommandBuffer& buffer : buffers)
+				{
+					buffer.Replay(replayBackend);
+				}
+				replayMs += timer.ElapsedMs();
+			}
+
+			RecordingRenderBackend replayed;
+			for (const CommandBuffer& buffer : buffers)
+			{
+				buffer.Replay(replayed);
+			}
+			CHECK(SameCalls(reference, replayed));
+
+			TestLog("commands: %zu draws in %u passes, %u threads, record %.3f ms, replay %.3f ms", totalDraws, passCount, threads,
+				recordMs / frames, replayMs / frames);
+		}
+	}
+}
+
+int main()
+{
+	TestReplay();
+	TestParallelRecording();
+	return TestResult();
+}
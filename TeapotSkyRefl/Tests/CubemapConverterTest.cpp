@@ -0,0 +1,248 @@
+#include "Test.h"
+#include "CubemapConverter.h"
+#include "Parallel.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// RGBA32F equirect of width x 2 width: a sky brightening towards +Y over a dark ground,
+// and a sun of sunColor around the direction the centre of the image looks at, +Z
+static HdrImage MakeSky(unsigned int width, float sunColor)
+{
+	HdrImage image;
+	image.width = width;
+	image.height = width / 2;
+	image.pixels.resize((size_t)image.width * image.height * 4);
+	for (unsigned int y = 0; y < image.height; ++y)
+	{
+		for (unsigned int x = 0; x < image.width; ++x)
+		{
+			float dx = (x + 0.5f) / image.width - 0.5f, dy = (y + 0.5f) / image.height - 0.5f;
+			float* pixel = &image.pixels[((size_t)y * image.width + x) * 4];
+			TestSkyColor(1.0f - 2.0f * (y + 0.5f) / image.height, pixel);
+			if (dx * dx + dy * dy < 0.0004f)
+				pixel[0] = pixel[1] = pixel[2] = sunColor;
+			pixel[3] = 1.0f;
+		}
+	}
+	return image;
+}
+
+// The texel of a face in float, x and y from the top left
+static void FaceTexel(const std::vector<uint16_t>& faces, unsigned int faceSize, unsigned int face, unsigned int x, unsigned int y, float color[4])
+{
+	ConvertHalvesToFloats(&faces[(((size_t)face * faceSize + y) * faceSize + x) * 4], 4, color);
+}
+
+// face centres look down the axes, and every direction is unit length
+static void TestFaceDirections()
+{
+	const float axes[CubemapConverter::FaceCount][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+	{
+		float direction[3];
+		CubemapConverter::FaceDirection(face, 0.0f, 0.0f, direction);
+		CHECK(direction[0] == axes[face][0] && direction[1] == axes[face][1] && direction[2] == axes[face][2]);
+
+		// v is down on every side face, the top row of +Y looks at -Z
+		CubemapConverter::FaceDirection(face, 0.3f, -0.7f, direction);
+		float length = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+		CHECK(fabsf(length - 1.0f) < 1e-6f);
+		if (face != 2 && face != 3)
+			CHECK(direction[1] > 0.0f);
+	}
+	float top[3];
+	CubemapConverter::FaceDirection(2, 0.0f, -1.0f, top);
+	CHECK(top[2] < 0.0f);
+}
+
+// A constant image gives that colour everywhere, the sun lands in the middle of +Z, the sky
+// on +Y and the ground on -Y, and the faces are the same whatever the thread count
+static void TestConvert()
+{
+	HdrImage flat;
+	flat.width = 64;
+	flat.height = 32;
+	flat.pixels.resize(flat.width * flat.height * 4);
+	for (size_t i = 0; i < flat.pixels.size(); i += 4)
+	{
+		flat.pixels[i + 0] = 0.5f;
+		flat.pixels[i + 1] = 1.0f;
+		flat.pixels[i + 2] = 2.0f;
+		flat.pixels[i + 3] = 1.0f;
+	}
+	std::vector<uint16_t> faces;
+	CubemapConverter::EquirectToCubemap(flat, 16, faces);
+	CHECK(faces.size() == CubemapConverter::FaceCount * 16 * 16 * 4);
+	std::vector<float> texels(faces.size());
+	ConvertHalvesToFloats(faces.data(), faces.size(), texels.data());
+	bool constant = true;
+	for (size_t i = 0; i < texels.size(); i += 4)
+	{
+		constant &= fabsf(texels[i] - 0.5f) < 1e-3f && fabsf(texels[i + 1] - 1.0f) < 2e-3f && fabsf(texels[i + 2] - 2.0f) < 4e-3f &&
+			texels[i + 3] == 1.0f;
+	}
+	CHECK(constant);
+
+	const unsigned int faceSize = 32;
+	HdrImage sky = MakeSky(256, 100.0f);
+	std::vector<uint16_t> reference;
+	CubemapConverter::EquirectToCubemap(sky, faceSize, reference, 1);
+	float sun[4], behind[4], up[4], down[4];
+	FaceTexel(reference, faceSize, 4, faceSize / 2, faceSize / 2, sun);
+	FaceTexel(reference, faceSize, 5, faceSize / 2, faceSize / 2, behind);
+	FaceTexel(reference, faceSize, 2, faceSize / 2, faceSize / 2, up);
+	FaceTexel(reference, faceSize, 3, faceSize / 2, faceSize / 2, down);
+	CHECK(sun[0] > 50.0f && behind[0] < 1.0f);
+	CHECK(fabsf(up[2] - 1.4f) < 0.05f && fabsf(down[2] - 0.05f) < 0.01f);
+
+	const unsigned int threadCounts[] = { 2, 3, 0 };
+	for (unsigned int threads : threadCounts)
+	{
+		CubemapConverter::EquirectToCubemap(sky, faceSize, faces, threads);
+		CHECK(faces == reference);
+	}
+}
+
+// the header of a written .dds reads back, and a cooked file with another source or
+// setting is stale
+static void TestDds()
+{
+	CookedDds desc;
+	desc.width = desc.height = 8;
+	desc.cube = true;
+	desc.version = CubemapConverter::Version;
+	desc.setting = 8;
+	desc.sourceHash = 0x0123456789abcdefull;
+	desc.sourceSize = 12345;
+	std::vector<uint16_t> faces(desc.DataSize() / sizeof(uint16_t));
+	for (size_t i = 0; i < faces.size(); ++i)
+	{
+		faces[i] = (uint16_t)i;
+	}
+
+	std::vector<unsigned char> dds;
+	CubemapConverter::WriteDds(desc, faces.data(), dds);
+	CHECK(dds.size() == desc.HeaderSize() + desc.DataSize() && desc.HeaderSize() == CubemapConverter::DdsHeaderSize);
+	CHECK(memcmp(dds.data() + desc.HeaderSize(), faces.data(), desc.DataSize()) == 0);
+
+	CookedDds read;
+	CHECK(CubemapConverter::ReadDdsDesc(dds, read));
+	CHECK(read.width == 8 && read.height == 8 && read.mipCount == 1 && read.cube && read.fourCC == CubemapConverter::FourCCHalf4);
+	CHECK(read.version == desc.version && read.setting == desc.setting && read.sourceHash == desc.sourceHash &&
+		read.sourceSize == desc.sourceSize);
+	CHECK(!CubemapConverter::ReadDdsDesc(std::vector<unsigned char>(dds.begin(), dds.begin() + 64), read));
+
+	const char* cacheFile = "CubemapConverterTest.dds";
+	std::vector<unsigned char> cached;
+	CHECK(CubemapConverter::WriteCache(cacheFile, dds));
+	CHECK(CubemapConverter::ReadCache(cacheFile, desc, cached) && cached == dds);
+	CookedDds other = desc;
+	other.sourceHash++;
+	CHECK(!CubemapConverter::ReadCache(cacheFile, other, cached) && cached.empty());
+	other = desc;
+	other.setting = 16;
+	CHECK(!CubemapConverter::ReadCache(cacheFile, other, cached));
+	remove(cacheFile);
+	CHECK(!CubemapConverter::ReadCache(cacheFile, desc, cached));
+
+	CHECK(CubemapConverter::CacheFileName("../Assets/sky.hdr", 512) == "../Assets/sky.cube512.dds");
+	CHECK(CubemapConverter::CacheFileName("..\\Assets.v2\\sky", ".sh") == "..\\Assets.v2\\sky.sh");
+}
+
+// flat RGBE scanlines of image, what RadianceHdr::Read takes back
+static bool WriteHdr(const std::string& filename, const HdrImage& image)
+{
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	file << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << image.height << " +X " << image.width << "\n";
+	for (size_t i = 0; i < image.pixels.size(); i += 4)
+	{
+		const float* in = &image.pixels[i];
+		float maxComponent = (std::max)(in[0], (std::max)(in[1], in[2]));
+		int exponent = 0;
+		float scale = maxComponent > 1e-32f ? frexpf(maxComponent, &exponent) * 256.0f / maxComponent : 0.0f;
+		char rgbe[4];
+		for (int k = 0; k < 3; ++k)
+		{
+			rgbe[k] = (char)(unsigned char)(std::min)(in[k] * scale, 255.0f);
+		}
+		rgbe[3] = scale > 0.0f ? (char)(exponent + 128) : 0;
+		file.write(rgbe, 4);
+	}
+	return (bool)file;
+}
+
+// A sky the size of approaching_storm_1k.hdr to cubemaps of a few face sizes against the
+// thread count, then loading it cold, from the cache, and converted again once the
+// source changed
+static void TimeConvert()
+{
+	const int runs = 3;
+	HdrImage sky = MakeSky(1024, 1000.0f);
+
+	const unsigned int faceSizes[] = { 256, 512, 1024 };
+	for (unsigned int faceSize : faceSizes)
+	{
+		std::vector<uint16_t> reference;
+		double singleThreadMs = 0.0;
+		for (unsigned int threads = 1; threads <= WorkerThreadCount(); threads *= 2)
+		{
+			std::vector<uint16_t> faces;
+			double best = DBL_MAX;
+			for (int run = 0; run < runs; ++run)
+			{
+				TestTimer timer;
+				CubemapConverter::EquirectToCubemap(sky, faceSize, faces, threads);
+				best = (std::min)(best, timer.ElapsedMs());
+			}
+			if (threads == 1)
+			{
+				reference = faces;
+				singleThreadMs = best;
+			}
+			CHECK(faces == reference);
+			TestLog("cubemap: %ux%u to %u faces, %u threads %.2f ms, %.2fx", sky.width, sky.height, faceSize, threads, best,
+				singleThreadMs / best);
+		}
+	}
+
+	const std::string sourceFile = "CubemapConverterTest.hdr";
+	const std::string cacheFile = CubemapConverter::CacheFileName(sourceFile, 512);
+	CHECK(WriteHdr(sourceFile, sky));
+	remove(cacheFile.c_str());
+
+	std::vector<unsigned char> cold, warm, changed;
+	TestTimer timer;
+	CHECK(CubemapConverter::LoadCubemap(sourceFile, 512, cold));
+	double coldMs = timer.ElapsedMs();
+	timer.Reset();
+	CHECK(CubemapConverter::LoadCubemap(sourceFile, 512, warm));
+	double warmMs = timer.ElapsedMs();
+	CHECK(!cold.empty() && warm == cold);
+	TestLog("cubemap: 512 faces cold conversion %.2f ms, warm cache %.2f ms, %.1fx faster", coldMs, warmMs, coldMs / warmMs);
+
+	CHECK(WriteHdr(sourceFile, MakeSky(1024, 10.0f)));
+	CHECK(CubemapConverter::LoadCubemap(sourceFile, 512, changed));
+	CookedDds coldDesc, changedDesc;
+	CHECK(CubemapConverter::ReadDdsDesc(cold, coldDesc) && CubemapConverter::ReadDdsDesc(changed, changedDesc));
+	CHECK(changed.size() == cold.size() && changed != cold && changedDesc.sourceHash != coldDesc.sourceHash);
+
+	CHECK(!CubemapConverter::LoadCubemap("CubemapConverterTest.missing.hdr", 512, changed) && changed.empty());
+	remove(cacheFile.c_str());
+	remove(sourceFile.c_str());
+}
+
+int main()
+{
+	TestFaceDirections();
+	TestConvert();
+	TestDds();
+	TimeConvert();
+	return TestResult();
+}
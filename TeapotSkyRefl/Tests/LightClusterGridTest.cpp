@@ -0,0 +1,197 @@
+#include "Test.h"
+#include "LightClusterGrid.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+static const float Pi = 3.14159265f;
+static const char* KernelNames[] = { "auto", "scalar", "sse2", "avx2" };
+
+// lights spread evenly in depth over the first depth units of the frustum and a little
+// beyond its sides, like street lights along a city, a third of them spots
+static std::vector<ClusterLight> MakeLights(uint32_t count, float fovY, float aspect, float depth, uint32_t seed)
+{
+	TestRandom random(seed);
+
+	float tanY = tanf(0.5f * fovY);
+	std::vector<ClusterLight> lights(count);
+	for (ClusterLight& light : lights)
+	{
+		float z = depth * random.Float();
+		light.position[0] = (random.Float() * 2.4f - 1.2f) * z * tanY * aspect;
+		light.position[1] = (random.Float() * 2.4f - 1.2f) * z * tanY;
+		light.position[2] = z;
+		light.range = 1.0f + 7.0f * random.Float() * random.Float();
+		light.type = random.Float() < 0.33f ? CLUSTER_LIGHT_SPOT : CLUSTER_LIGHT_POINT;
+
+		float direction[3] = { random.Float() - 0.5f, random.Float() - 0.5f, random.Float() - 0.5f };
+		float length = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]) + 1e-6f;
+		float angle = (15.0f + 30.0f * random.Float()) * Pi / 180.0f;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			light.direction[axis] = direction[axis] / length;
+		}
+		light.cosAngle = cosf(angle);
+		light.sinAngle = sinf(angle);
+	}
+	return lights;
+}
+
+static bool SameClusters(const LightClusterGrid& grid, const std::vector<LightClusterRange>& clusters, const std::vector<uint32_t>& indices)
+{
+	if (grid.GetLightIndices() != indices || grid.GetClusters().size() != clusters.size())
+		return false;
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		if (grid.GetClusters()[c].offset != clusters[c].offset || grid.GetClusters()[c].count != clusters[c].count)
+			return false;
+	}
+	return true;
+}
+
+// Build with every kernel the CPU has and several thread counts gives the lists of
+// BuildBruteForce, for a few light counts and froxel grids
+static void TestBuildMatchesBruteForce()
+{
+	const float fovY = 0.25f * Pi, aspect = 16.0f / 9.0f;
+	const uint32_t lightCounts[] = { 0, 1, 100, 2000 };
+	const int grids[][3] = { { 16, 9, 24 }, { 32, 18, 32 }, { 5, 3, 7 } };
+	const unsigned int threadCounts[] = { 1, 2, 0 };
+
+	for (const int* size : grids)
+	{
+		for (uint32_t count : lightCounts)
+		{
+			std::vector<ClusterLight> lights = MakeLights(count, fovY, aspect, 200.0f, count + 1);
+			LightClusterGrid grid;
+			grid.SetCamera(fovY, aspect, 1.0f, 1000.0f, size[0], size[1], size[2]);
+			grid.BuildBruteForce(lights.data(), lights.size());
+			std::vector<LightClusterRange> clusters = grid.GetClusters();
+			std::vector<uint32_t> indices = grid.GetLightIndices();
+			CHECK(grid.GetStats().indices == indices.size());
+
+			for (int kernel = LIGHT_CLUSTER_SCALAR; kernel <= LIGHT_CLUSTER_AVX2; ++kernel)
+			{
+				if (LightClusterGrid::GetKernel((LightClusterKernel)kernel) != kernel)
+					continue;
+
+				for (unsigned int threads : threadCounts)
+				{
+					grid.Build(lights.data(), lights.size(), threads, (LightClusterKernel)kernel);
+					bool same = SameClusters(grid, clusters, indices);
+					CHECK(same);
+					if (!same)
+						TestLog("lightclusters: %s %u threads, %u lights, %dx%dx%d froxels differ from brute force", KernelNames[kernel], threads,
+							count, size[0], size[1], size[2]);
+				}
+			}
+		}
+	}
+}
+
+// points inside each light, looked up through the froxel of their tile and depth the
+// way the shader does, find the light
+static void TestPointsFindTheirLights()
+{
+	const float fovY = 0.25f * Pi, aspect = 16.0f / 9.0f, nearZ = 1.0f, farZ = 1000.0f;
+	const uint32_t lightCount = 5000;
+	std::vector<ClusterLight> lights = MakeLights(lightCount, fovY, aspect, 500.0f, 7);
+
+	LightClusterGrid grid;
+	grid.SetCamera(fovY, aspect, nearZ, farZ);
+	grid.Build(lights.data(), lights.size());
+
+	TestRandom random(3);
+
+	float tanY = tanf(0.5f * fovY);
+	size_t samples = 0, missed = 0;
+	const std::vector<LightClusterRange>& clusters = grid.GetClusters();
+	const std::vector<uint32_t>& indices = grid.GetLightIndices();
+	for (uint32_t l = 0; l < lightCount; ++l)
+	{
+		const ClusterLight& light = lights[l];
+		for (int sample = 0; sample < 8; ++sample)
+		{
+			float offset[3] = { random.Float() * 2.0f - 1.0f, random.Float() * 2.0f - 1.0f, random.Float() * 2.0f - 1.0f };
+			float p[3];
+			float along = 0.0f, lengthSq = 0.0f;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				p[axis] = light.position[axis] + offset[axis] * light.range * 0.577f;
+				along += (p[axis] - light.position[axis]) * light.direction[axis];
+				lengthSq += (p[axis] - light.position[axis]) * (p[axis] - light.position[axis]);
+			}
+			if (light.type == CLUSTER_LIGHT_SPOT && along < light.cosAngle * sqrtf(lengthSq))
+				continue;
+			if (p[2] <= nearZ || p[2] >= farZ)
+				continue;
+
+			float ndcX = p[0] / (p[2] * tanY * aspect);
+			float ndcY = p[1] / (p[2] * tanY);
+			if (fabsf(ndcX) >= 1.0f || fabsf(ndcY) >= 1.0f)
+				continue;
+
+			int x = (std::min)((int)((ndcX * 0.5f + 0.5f) * grid.GetTilesX()), grid.GetTilesX() - 1);
+			int y = (std::min)((int)((0.5f - ndcY * 0.5f) * grid.GetTilesY()), grid.GetTilesY() - 1);
+			const LightClusterRange& cluster = clusters[grid.GetClusterIndex(x, y, grid.GetSlice(p[2]))];
+			const uint32_t* first = indices.data() + cluster.offset;
+			const uint32_t* last = first + cluster.count;
+			samples++;
+			missed += std::find(first, last, l) == last;
+		}
+	}
+	CHECK(samples > 0);
+	CHECK(missed == 0);
+	TestLog("lightclusters: %zu points inside the lights, %zu missed by their froxel", samples, missed);
+}
+
+// 10k lights in front of the camera of the demo, every kernel and thread count against brute force
+static void TimeBuild()
+{
+	const float fovY = 0.25f * Pi, aspect = 16.0f / 9.0f;
+	const uint32_t lightCount = 10000;
+	const int repeats = 8;
+	std::vector<ClusterLight> lights = MakeLights(lightCount, fovY, aspect, 500.0f, 1);
+
+	LightClusterGrid grid;
+	grid.SetCamera(fovY, aspect, 1.0f, 1000.0f);
+	TestTimer bruteTimer;
+	grid.BuildBruteForce(lights.data(), lights.size());
+	double bruteMs = bruteTimer.ElapsedMs();
+	std::vector<LightClusterRange> clusters = grid.GetClusters();
+	std::vector<uint32_t> indices = grid.GetLightIndices();
+	TestLog("lightclusters: %u lights, %dx%dx%d froxels, brute force %.1f ms, %u indices", lightCount, grid.GetTilesX(), grid.GetTilesY(),
+		grid.GetSlices(), bruteMs, grid.GetStats().indices);
+
+	std::vector<unsigned int> threadCounts(1, 1);
+	if (WorkerThreadCount() > 1)
+		threadCounts.push_back(WorkerThreadCount());
+	for (int kernel = LIGHT_CLUSTER_SCALAR; kernel <= LIGHT_CLUSTER_AVX2; ++kernel)
+	{
+		if (LightClusterGrid::GetKernel((LightClusterKernel)kernel) != kernel)
+			continue;
+
+		for (unsigned int threads : threadCounts)
+		{
+			TestTimer timer;
+			for (int repeat = 0; repeat < repeats; ++repeat)
+			{
+				grid.Build(lights.data(), lights.size(), threads, (LightClusterKernel)kernel);
+			}
+			double buildMs = timer.ElapsedMs() / repeats;
+			CHECK(SameClusters(grid, clusters, indices));
+			TestLog("lightclusters: %s %u threads, %.3f ms, %.1fx brute force, %u froxel tests", KernelNames[kernel], threads, buildMs,
+				bruteMs / buildMs, grid.GetStats().tests);
+		}
+	}
+}
+
+int main()
+{
+	TestBuildMatchesBruteForce();
+	TestPointsFindTheirLights();
+	TimeBuild();
+	return TestResult();
+}
@@ -0,0 +1,227 @@
+#include "Test.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// position first, as MeshOptimizer reads it, and the original vertex number to follow the
+// vertices through the reordering
+struct TestVertex
+{
+	float position[3];
+	float uv[2];
+	uint32_t id;
+};
+
+struct TestMesh
+{
+	std::vector<TestVertex> vertices;
+	std::vector<unsigned int> indices;
+};
+
+static void AddVertex(TestMesh& mesh, float x, float y, float z, float u, float v)
+{
+	TestVertex vertex = { { x, y, z }, { u, v }, (uint32_t)mesh.vertices.size() };
+	mesh.vertices.push_back(vertex);
+}
+
+// n x n vertices of a wavy surface, like the synthetic grid of the OBJ importer
+static void AddGrid(TestMesh& mesh, unsigned int n)
+{
+	unsigned int first = (unsigned int)mesh.vertices.size();
+	for (unsigned int y = 0; y < n; ++y)
+	{
+		for (unsigned int x = 0; x < n; ++x)
+		{
+			float u = (float)x / (n - 1), v = (float)y / (n - 1);
+			AddVertex(mesh, u * 100.0f, sinf(u * 40.0f) * cosf(v * 40.0f), v * 100.0f, u, v);
+		}
+	}
+	for (unsigned int y = 0; y + 1 < n; ++y)
+	{
+		for (unsigned int x = 0; x + 1 < n; ++x)
+		{
+			unsigned int a = first + y * n + x, b = a + 1, c = a + n, d = c + 1;
+			unsigned int quad[6] = { a, c, b, b, c, d };
+			mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+		}
+	}
+}
+
+// closed sphere of rings x segments quads around center
+static void AddSphere(TestMesh& mesh, float cx, float cy, float cz, float radius, unsigned int rings, unsigned int segments)
+{
+	unsigned int first = (unsigned int)mesh.vertices.size();
+	for (unsigned int r = 0; r <= rings; ++r)
+	{
+		float theta = 3.14159265f * r / rings;
+		for (unsigned int s = 0; s <= segments; ++s)
+		{
+			float phi = 2.0f * 3.14159265f * s / segments;
+			AddVertex(mesh, cx + radius * sinf(theta) * cosf(phi), cy + radius * cosf(theta), cz + radius * sinf(theta) * sinf(phi),
+				(float)s / segments, (float)r / rings);
+		}
+	}
+	for (unsigned int r = 0; r < rings; ++r)
+	{
+		for (unsigned int s = 0; s < segments; ++s)
+		{
+			unsigned int a = first + r * (segments + 1) + s, b = a + 1, c = a + segments + 1, d = c + 1;
+			unsigned int quad[6] = { a, b, c, b, d, c };
+			mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+		}
+	}
+}
+
+// triangles from begin to end in random order, the worst case for the vertex cache
+static void ShuffleTriangles(TestMesh& mesh, size_t begin, size_t end, uint32_t seed)
+{
+	TestRandom random(seed);
+
+	for (size_t t = (end - begin) / 3; t > 1; --t)
+	{
+		size_t other = (random.Next() >> 8) % t;
+		std::swap_ranges(mesh.indices.begin() + begin + (t - 1) * 3, mesh.indices.begin() + begin + t * 3, mesh.indices.begin() + begin + other * 3);
+	}
+}
+
+// The triangles from begin to end by the original numbers of their vertices, each rotated to
+// start at the smallest so the winding is kept, sorted
+static std::vector<uint64_t> TriangleSet(const TestMesh& mesh, size_t begin, size_t end)
+{
+	std::vector<uint64_t> triangles;
+	for (size_t i = begin; i < end; i += 3)
+	{
+		uint64_t ids[3] = { mesh.vertices[mesh.indices[i]].id, mesh.vertices[mesh.indices[i + 1]].id, mesh.vertices[mesh.indices[i + 2]].id };
+		int smallest = ids[0] < ids[1] ? (ids[0] < ids[2] ? 0 : 2) : (ids[1] < ids[2] ? 1 : 2);
+		triangles.push_back((ids[smallest] << 42) | (ids[(smallest + 1) % 3] << 21) | ids[(smallest + 2) % 3]);
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+// vertices numbered in order of first use, every one used
+static bool InFetchOrder(const TestMesh& mesh, size_t vertexCount)
+{
+	unsigned int next = 0;
+	for (unsigned int index : mesh.indices)
+	{
+		if (index > next)
+			return false;
+		next += index == next;
+	}
+	return next == vertexCount;
+}
+
+static size_t Optimize(TestMesh& mesh, MeshOptimizerStats* stats, const std::vector<unsigned int>* groups = NULL)
+{
+	size_t vertexCount = MeshOptimizer::Optimize(mesh.vertices.data(), mesh.vertices.size(), sizeof(TestVertex), mesh.indices.data(),
+		mesh.indices.size(), stats, groups);
+	mesh.vertices.resize(vertexCount);
+	return vertexCount;
+}
+
+// A shuffled grid gets a near optimal cache order, keeps every triangle with its winding,
+// drops the vertices nothing uses and has them numbered in order of first use
+static void TestGrid()
+{
+	TestMesh mesh;
+	AddGrid(mesh, 64);
+	size_t usedVertices = mesh.vertices.size();
+	AddVertex(mesh, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+	AddVertex(mesh, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f);
+	ShuffleTriangles(mesh, 0, mesh.indices.size(), 1);
+	std::vector<uint64_t> triangles = TriangleSet(mesh, 0, mesh.indices.size());
+
+	MeshOptimizerStats stats;
+	size_t vertexCount = Optimize(mesh, &stats);
+	CHECK(vertexCount == usedVertices && stats.verticesBefore == usedVertices + 2 && stats.verticesAfter == usedVertices);
+	CHECK(TriangleSet(mesh, 0, mesh.indices.size()) == triangles);
+	CHECK(InFetchOrder(mesh, vertexCount));
+	CHECK(stats.cacheBefore.acmr > 2.0f && stats.cacheAfter.acmr < 0.8f && stats.cacheAfter.atvr < 1.4f);
+	CHECK(stats.overdrawAfter.overdraw >= 1.0f && stats.overdrawAfter.overdraw <= stats.overdrawBefore.overdraw);
+
+	// the analyzer agrees with a cache simulated here
+	VertexCacheStats cache = MeshOptimizer::AnalyzeVertexCache(mesh.indices.data(), mesh.indices.size(), vertexCount);
+	std::vector<unsigned int> fifo;
+	size_t misses = 0;
+	for (unsigned int index : mesh.indices)
+	{
+		if (std::find(fifo.begin(), fifo.end(), index) != fifo.end())
+			continue;
+		misses++;
+		fifo.push_back(index);
+		if (fifo.size() > MeshOptimizer::CacheSize)
+			fifo.erase(fifo.begin());
+	}
+	CHECK(cache.verticesTransformed == misses && cache.acmr == stats.cacheAfter.acmr);
+}
+
+// A row of spheres hiding each other along X: every sphere is a group that keeps its triangles
+// in its index range, and sorting the clusters does not raise the overdraw
+static void TestGroups()
+{
+	TestMesh mesh;
+	std::vector<unsigned int> groups;
+	for (int sphere = 0; sphere < 4; ++sphere)
+	{
+		groups.push_back((unsigned int)mesh.indices.size());
+		AddSphere(mesh, sphere * 1.5f, 0.0f, 0.0f, 1.0f, 24, 48);
+		ShuffleTriangles(mesh, groups.back(), mesh.indices.size(), sphere + 1);
+	}
+
+	std::vector<std::vector<uint64_t>> triangles;
+	for (size_t g = 0; g < groups.size(); ++g)
+	{
+		triangles.push_back(TriangleSet(mesh, groups[g], g + 1 < groups.size() ? groups[g + 1] : mesh.indices.size()));
+	}
+
+	MeshOptimizerStats stats;
+	size_t vertexCount = Optimize(mesh, &stats, &groups);
+	for (size_t g = 0; g < groups.size(); ++g)
+	{
+		CHECK(TriangleSet(mesh, groups[g], g + 1 < groups.size() ? groups[g + 1] : mesh.indices.size()) == triangles[g]);
+	}
+	CHECK(InFetchOrder(mesh, vertexCount));
+	CHECK(stats.cacheAfter.acmr < 0.5f * stats.cacheBefore.acmr);
+	CHECK(stats.overdrawBefore.overdraw > 1.0f && stats.overdrawAfter.overdraw <= stats.overdrawBefore.overdraw);
+	TestLog("meshopt: 4 spheres in groups, %zu triangles, ACMR %.3f -> %.3f, overdraw %.3f -> %.3f", mesh.indices.size() / 3,
+		stats.cacheBefore.acmr, stats.cacheAfter.acmr, stats.overdrawBefore.overdraw, stats.overdrawAfter.overdraw);
+
+	// nothing to do
+	TestMesh empty;
+	CHECK(Optimize(empty, &stats) == 0 && stats.cacheAfter.verticesTransformed == 0);
+}
+
+// A grid of 1M triangles in the order the OBJ importer gives it and shuffled
+static void TimeOptimize()
+{
+	const char* names[] = { "in row order", "shuffled" };
+	for (int shuffled = 0; shuffled < 2; ++shuffled)
+	{
+		TestMesh mesh;
+		AddGrid(mesh, 708);
+		if (shuffled)
+			ShuffleTriangles(mesh, 0, mesh.indices.size(), 7);
+		std::vector<uint64_t> triangles = TriangleSet(mesh, 0, mesh.indices.size());
+
+		MeshOptimizerStats stats;
+		Optimize(mesh, &stats);
+		CHECK(TriangleSet(mesh, 0, mesh.indices.size()) == triangles);
+		CHECK(stats.cacheAfter.acmr <= stats.cacheBefore.acmr && stats.cacheAfter.acmr < 0.8f);
+		TestLog("meshopt: grid %s, %zu triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f, %zu -> %zu vertices, %.2f ms",
+			names[shuffled], mesh.indices.size() / 3, stats.cacheBefore.acmr, stats.cacheAfter.acmr, stats.cacheBefore.atvr,
+			stats.cacheAfter.atvr, stats.overdrawBefore.overdraw, stats.overdrawAfter.overdraw, stats.verticesBefore, stats.verticesAfter,
+			stats.timeMs);
+	}
+}
+
+int main()
+{
+	TestGrid();
+	TestGroups();
+	TimeOptimize();
+	return TestResult();
+}
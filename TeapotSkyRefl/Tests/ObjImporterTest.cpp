@@ -0,0 +1,329 @@
+#include "Test.h"
+#include "ObjImporter.h"
+#include "Parallel.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// the layout of Vertex
+struct TestVertex
+{
+	float position[3];
+	float normal[3];
+	float tex[2];
+};
+
+struct TestMesh
+{
+	std::vector<TestVertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<unsigned int> materials;
+};
+
+static const char* TestFile = "ObjImporterTest.obj";
+
+static bool WriteText(const std::string& fileName, const std::string& text)
+{
+	std::ofstream file(fileName, std::ios::binary);
+	file << text;
+	return (bool)file;
+}
+
+static bool ImportText(const std::string& text, TestMesh& mesh, ObjImporter& importer)
+{
+	WriteText(TestFile, text);
+	return importer.Import(TestFile, mesh.vertices, mesh.indices, mesh.materials);
+}
+
+// Grid of 2 * (n-1)^2 triangles with positions, normals and texcoords like the synthetic
+// grid of the benchmarks. withMaterials switches between three materials every row and
+// writes the faces with relative indices.
+static bool WriteGrid(const std::string& fileName, size_t triangleCount, bool withMaterials)
+{
+	FILE* file = fopen(fileName.c_str(), "wb");
+	if (!file)
+		return false;
+
+	unsigned int n = (unsigned int)sqrt(triangleCount / 2.0) + 1;
+	for (unsigned int y = 0; y < n; ++y)
+	{
+		for (unsigned int x = 0; x < n; ++x)
+		{
+			float u = (float)x / (n - 1);
+			float v = (float)y / (n - 1);
+			fprintf(file, "v %f %f %f\nvn 0.0 1.0 0.0\nvt %f %f\n", u * 100.0f, sinf(u * 40.0f) * cosf(v * 40.0f), v * 100.0f, u, v);
+		}
+	}
+
+	const char* materialNames[] = { "stone", "grass", "water" };
+	int total = (int)(n * n);
+	for (unsigned int y = 0; y + 1 < n; ++y)
+	{
+		if (withMaterials)
+			fprintf(file, "usemtl %s\n", materialNames[y % 3]);
+		for (unsigned int x = 0; x + 1 < n; ++x)
+		{
+			unsigned int a = y * n + x + 1;
+			unsigned int b = a + 1;
+			unsigned int c = a + n;
+			unsigned int d = c + 1;
+			if (withMaterials)
+			{
+				int ra = (int)a - 1 - total, rb = (int)b - 1 - total, rc = (int)c - 1 - total, rd = (int)d - 1 - total;
+				fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\nf %d/%d/%d %d/%d/%d %d/%d/%d\n",
+					ra, ra, ra, rc, rc, rc, rb, rb, rb, rb, rb, rb, rc, rc, rc, rd, rd, rd);
+			}
+			else
+			{
+				fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\nf %u/%u/%u %u/%u/%u %u/%u/%u\n",
+					a, a, a, c, c, c, b, b, b, b, b, b, c, c, c, d, d, d);
+			}
+		}
+	}
+
+	bool written = ferror(file) == 0;
+	fclose(file);
+	return written;
+}
+
+// The tinyobjloader path of ObjLoader::LoadToMeshTinyObj, one vertex per face corner
+static bool LoadTinyObj(const std::string& fileName, TestMesh& mesh)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), NULL))
+		return false;
+
+	for (const tinyobj::shape_t& shape : shapes)
+	{
+		size_t indexOffset = 0;
+		for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); ++f)
+		{
+			int faceVertices = shape.mesh.num_face_vertices[f];
+			for (int v = 0; v < faceVertices; ++v)
+			{
+				tinyobj::index_t idx = shape.mesh.indices[indexOffset + v];
+				TestVertex vertex = {};
+				for (int k = 0; k < 3; ++k)
+				{
+					vertex.position[k] = attrib.vertices[3 * idx.vertex_index + k];
+					if (idx.normal_index >= 0)
+						vertex.normal[k] = attrib.normals[3 * idx.normal_index + k];
+				}
+				if (idx.texcoord_index >= 0)
+				{
+					vertex.tex[0] = attrib.texcoords[2 * idx.texcoord_index + 0];
+					vertex.tex[1] = attrib.texcoords[2 * idx.texcoord_index + 1];
+				}
+				mesh.indices.push_back((unsigned int)mesh.vertices.size());
+				mesh.vertices.push_back(vertex);
+			}
+			indexOffset += faceVertices;
+		}
+	}
+	return true;
+}
+
+static bool SameVertex(const TestVertex& a, const TestVertex& b)
+{
+	const float* fa = a.position;
+	const float* fb = b.position;
+	for (int k = 0; k < 8; ++k)
+	{
+		if (fabsf(fa[k] - fb[k]) > 1e-6f * (1.0f + fabsf(fb[k])))
+			return false;
+	}
+	return true;
+}
+
+// Every kind of face line of a small file: a quad, corners without texcoords or with only
+// positions, relative indices, materials switched back and forth, CRLF and comments.
+// Importing again appends.
+static void TestParse()
+{
+	const std::string text =
+		"mtllib scene.mtl\n"
+		"# a quad and three triangles\n"
+		"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1.5e1 -2.25\n"
+		"vt 0 0\nvt 1 0\nvt 0.5 1\n"
+		"vn 0 0 1\n"
+		"f 1/1/1 2/2/1 3/3/1 4/3/1\r\n"
+		"usemtl red\n"
+		"f 1//1 2//1 3//1 # comment\n"
+		"usemtl blue\r\n"
+		"f -4 -3 -1\n"
+		"usemtl red\n"
+		"f 1/2 3/3 4/1\n";
+
+	ObjImporter importer;
+	TestMesh mesh;
+	CHECK(ImportText(text, mesh, importer));
+	CHECK(mesh.vertices.size() == 15 && mesh.indices.size() == 15);
+	bool inOrder = true;
+	for (unsigned int i = 0; i < mesh.indices.size(); ++i)
+	{
+		inOrder &= mesh.indices[i] == i;
+	}
+	CHECK(inOrder);
+	CHECK(importer.GetMaterialLibrary() == "scene.mtl");
+	CHECK(importer.GetMaterialNames().size() == 2 && importer.GetMaterialNames()[0] == "red" && importer.GetMaterialNames()[1] == "blue");
+	const unsigned int expectedMaterials[] = { ObjImporter::NoMaterial, ObjImporter::NoMaterial, 0, 1, 0 };
+	CHECK(mesh.materials == std::vector<unsigned int>(expectedMaterials, expectedMaterials + 5));
+
+	// the quad as a fan 0 1 2, 0 2 3
+	const TestVertex& quadLast = mesh.vertices[5];
+	CHECK(quadLast.position[0] == 0.0f && quadLast.position[1] == 15.0f && quadLast.position[2] == -2.25f);
+	CHECK(quadLast.normal[2] == 1.0f && quadLast.tex[0] == 0.5f && quadLast.tex[1] == 1.0f);
+	CHECK(mesh.vertices[3].position[0] == 0.0f && mesh.vertices[4].position[0] == 1.0f && mesh.vertices[4].position[1] == 1.0f);
+
+	// missing texcoords and normals are 0, relative indices count back from the last vertex
+	CHECK(mesh.vertices[7].tex[0] == 0.0f && mesh.vertices[7].tex[1] == 0.0f && mesh.vertices[7].normal[2] == 1.0f);
+	CHECK(mesh.vertices[9].position[0] == 0.0f && mesh.vertices[10].position[0] == 1.0f && mesh.vertices[11].position[1] == 15.0f);
+	CHECK(mesh.vertices[9].normal[2] == 0.0f);
+	CHECK(mesh.vertices[12].tex[0] == 1.0f && mesh.vertices[12].normal[2] == 0.0f);
+
+	// a second file goes after the first one
+	CHECK(ImportText("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n", mesh, importer));
+	CHECK(mesh.vertices.size() == 18 && mesh.indices[15] == 15 && mesh.indices[17] == 17);
+	CHECK(mesh.materials.size() == 6 && mesh.materials[5] == ObjImporter::NoMaterial);
+	CHECK(importer.GetMaterialNames().empty() && importer.GetMaterialLibrary().empty());
+
+	remove(TestFile);
+}
+
+// Files the importer rejects, and one it reads as nothing
+static void TestBroken()
+{
+	ObjImporter importer;
+	TestMesh mesh;
+	CHECK(!importer.Import("ObjImporterTest_missing.obj", mesh.vertices, mesh.indices, mesh.materials));
+	CHECK(!ImportText("", mesh, importer));
+
+	const char* broken[] =
+	{
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n",		// past the last position
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 -4\n",	// before the first one
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf a b c\n",
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 0 1 2\n",
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4294967299\n",		// 3 if it wrapped at 32 bits
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 2147483648\n",		// INT_MAX + 1
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 -2147483649\n",
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nf 1/1 2/1 3/4294967297\n",
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//1 3//99999999999999999999999\n",
+	};
+	for (const char* text : broken)
+	{
+		CHECK(!ImportText(text, mesh, importer));
+	}
+
+	TestMesh empty;
+	CHECK(ImportText("# nothing\n", empty, importer) && empty.vertices.empty() && empty.indices.empty());
+	remove(TestFile);
+}
+
+// A grid with materials and relative indices split into many chunks gives what one chunk
+// gives, and both give the corners tinyobjloader reads
+static void TestChunks()
+{
+	CHECK(WriteGrid(TestFile, 60000, true));
+
+	ObjImporter single, split;
+	TestMesh singleMesh, splitMesh, tinyObjMesh;
+	CHECK(single.Import(TestFile, singleMesh.vertices, singleMesh.indices, singleMesh.materials, 1));
+	CHECK(split.Import(TestFile, splitMesh.vertices, splitMesh.indices, splitMesh.materials, 16));
+	CHECK(LoadTinyObj(TestFile, tinyObjMesh));
+
+	CHECK(singleMesh.vertices.size() > 0 && singleMesh.vertices.size() == splitMesh.vertices.size());
+	CHECK(singleMesh.indices == splitMesh.indices && singleMesh.materials == splitMesh.materials);
+	CHECK(single.GetMaterialNames() == split.GetMaterialNames() && split.GetMaterialNames().size() == 3);
+	CHECK(splitMesh.materials.size() == splitMesh.indices.size() / 3);
+
+	bool same = singleMesh.vertices.size() == tinyObjMesh.vertices.size();
+	for (size_t i = 0; same && i < splitMesh.vertices.size(); ++i)
+	{
+		same = memcmp(&singleMesh.vertices[i], &splitMesh.vertices[i], sizeof(TestVertex)) == 0 &&
+			SameVertex(splitMesh.vertices[i], tinyObjMesh.vertices[i]);
+	}
+	CHECK(same);
+
+	// the quads of row y use material y % 3
+	unsigned int n = (unsigned int)sqrt(60000 / 2.0) + 1;
+	bool rows = true;
+	for (size_t t = 0; t < splitMesh.materials.size(); ++t)
+	{
+		rows &= splitMesh.materials[t] == (t / 2 / (n - 1)) % 3;
+	}
+	CHECK(rows);
+
+	remove(TestFile);
+}
+
+// ObjImporter against tinyobjloader on the teapot and a grid, 1M triangles unless the
+// triangle count is given on the command line: ObjImporterTest 10000000
+static void TimeImport(size_t gridTriangles)
+{
+	const std::string teapotFile = std::string(ASSET_DIR) + "teapot.obj";
+	const std::string gridFile = "ObjImporterTest_grid.obj";
+	TestTimer writeTimer;
+	CHECK(WriteGrid(gridFile, gridTriangles, false));
+	TestLog("objimport: wrote %s in %.0f ms", gridFile.c_str(), writeTimer.ElapsedMs());
+
+	const std::string files[] = { teapotFile, gridFile };
+	for (const std::string& fileName : files)
+	{
+		const int runs = 3;
+		double bestTinyObj = 1e30, bestImporter = 1e30;
+		TestMesh tinyObjMesh, importerMesh;
+		for (int run = 0; run < runs; ++run)
+		{
+			tinyObjMesh = TestMesh();
+			TestTimer timer;
+			CHECK(LoadTinyObj(fileName, tinyObjMesh));
+			bestTinyObj = (std::min)(bestTinyObj, timer.ElapsedMs());
+		}
+
+		size_t tinyObjVertices = tinyObjMesh.vertices.size();
+		std::vector<TestVertex> tinyObjCorners;
+		tinyObjCorners.swap(tinyObjMesh.vertices);
+		tinyObjMesh = TestMesh();
+
+		for (int run = 0; run < runs; ++run)
+		{
+			importerMesh = TestMesh();
+			ObjImporter importer;
+			TestTimer timer;
+			CHECK(importer.Import(fileName, importerMesh.vertices, importerMesh.indices, importerMesh.materials));
+			bestImporter = (std::min)(bestImporter, timer.ElapsedMs());
+		}
+
+		bool same = importerMesh.vertices.size() == tinyObjVertices;
+		for (size_t i = 0; same && i < tinyObjVertices; ++i)
+		{
+			same = SameVertex(importerMesh.vertices[i], tinyObjCorners[i]);
+		}
+		CHECK(same);
+
+		TestLog("objimport: %s %zu triangles, tinyobj %.2f ms, ObjImporter %.2f ms (%u threads), speedup %.2fx", fileName.c_str(),
+			importerMesh.indices.size() / 3, bestTinyObj, bestImporter, WorkerThreadCount(), bestTinyObj / bestImporter);
+	}
+
+	remove(gridFile.c_str());
+}
+
+int main(int argc, char** argv)
+{
+	TestParse();
+	TestBroken();
+	TestChunks();
+	TimeImport(argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 1000000);
+	return TestResult();
+}
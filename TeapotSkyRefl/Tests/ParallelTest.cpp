@@ -0,0 +1,120 @@
+#include "Test.h"
+#include "Parallel.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// every index is visited once, in ranges of at least minPerThread but the last
+static void TestRanges()
+{
+	const size_t counts[] = { 0, 1, 2, 7, 64, 1000, 4097 };
+	const size_t minimums[] = { 0, 1, 16, 4096 };
+	const unsigned int threads[] = { 0, 1, 2, 3, 16 };
+
+	for (size_t count : counts)
+	{
+		for (size_t minPerThread : minimums)
+		{
+			for (unsigned int maxThreads : threads)
+			{
+				std::vector<std::atomic<int>> visits(count);
+				for (std::atomic<int>& visit : visits)
+				{
+					visit = 0;
+				}
+				std::atomic<int> ranges(0);
+				ParallelFor(count, minPerThread, maxThreads, [&](size_t begin, size_t end)
+				{
+					ranges++;
+					for (size_t i = begin; i < end; ++i)
+					{
+						visits[i]++;
+					}
+				});
+
+				bool once = true;
+				for (const std::atomic<int>& visit : visits)
+				{
+					once &= visit == 1;
+				}
+				CHECK(once);
+				CHECK(maxThreads == 0 || ranges <= (int)maxThreads);
+			}
+		}
+	}
+}
+
+// ParallelFor inside a range and from several threads at once finishes, with every index once
+static void TestNested()
+{
+	std::atomic<int> wrong(0);
+	std::vector<std::thread> callers;
+	for (int caller = 0; caller < 3; ++caller)
+	{
+		callers.push_back(std::thread([&wrong, caller]()
+		{
+			for (int round = 0; round < 200; ++round)
+			{
+				size_t count = 1 + (round * 37 + caller * 11) % 2000;
+				std::vector<int> outer(count, 0);
+				ParallelFor(count, 16, [&](size_t begin, size_t end)
+				{
+					std::vector<int> inner(100, 0);
+					ParallelFor(inner.size(), 10, [&](size_t innerBegin, size_t innerEnd)
+					{
+						for (size_t i = innerBegin; i < innerEnd; ++i)
+						{
+							inner[i]++;
+						}
+					});
+					for (int value : inner)
+					{
+						wrong += value != 1;
+					}
+					for (size_t i = begin; i < end; ++i)
+					{
+						outer[i]++;
+					}
+				});
+				for (int value : outer)
+				{
+					wrong += value != 1;
+				}
+			}
+		}));
+	}
+	for (std::thread& caller : callers)
+	{
+		caller.join();
+	}
+	CHECK(wrong == 0);
+}
+
+// the cost of a call with little work, what per frame callers pay
+static void TimeCalls()
+{
+	const int calls = 10000;
+	std::vector<float> values(4096, 1.0f);
+	TestTimer timer;
+	for (int call = 0; call < calls; ++call)
+	{
+		ParallelFor(values.size(), 256, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				values[i] = values[i] * 0.5f + 0.5f;
+			}
+		});
+	}
+	TestLog("parallel: %u hardware threads, %zu pool workers, %.2f us per call of %zu values", WorkerThreadCount(),
+		WorkerPool::Instance().GetWorkerCount(), timer.ElapsedMs() * 1000.0 / calls, values.size());
+}
+
+int main()
+{
+	TestRanges();
+	TestNested();
+	TimeCalls();
+	return TestResult();
+}
@@ -0,0 +1,261 @@
+#include "Test.h"
+#include "RadianceHdr.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+enum HdrEncoding
+{
+	HDR_FLAT,		// raw RGBE pixels
+	HDR_OLD_RLE,	// (1, 1, 1, n) repeating the previous pixel
+	HDR_NEW_RLE		// channel after channel, runs and literal spans
+};
+
+// RGBE of a sky of width x height: a noisy gradient with a bright sun above and a flat
+// ground below, so the scanlines have both runs and literal spans
+static std::vector<unsigned char> MakeSky(unsigned int width, unsigned int height)
+{
+	TestRandom random(1);
+
+	std::vector<unsigned char> rgbe((size_t)width * height * 4);
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			float color[3];
+			TestSkyColor(1.0f - (float)y / (height / 2), color);
+			if (y < height / 2)
+			{
+				float dx = (float)x / width - 0.3f, dy = (float)y / height - 0.2f;
+				float sun = 5000.0f * expf(-(dx * dx + dy * dy) * 4000.0f);
+				for (int k = 0; k < 3; ++k)
+					color[k] += 0.05f * random.Float() + sun;
+			}
+
+			float maxComponent = (std::max)(color[0], (std::max)(color[1], color[2]));
+			int exponent = 0;
+			float scale = frexpf(maxComponent, &exponent) * 256.0f / maxComponent;
+			unsigned char* out = &rgbe[((size_t)y * width + x) * 4];
+			for (int k = 0; k < 3; ++k)
+			{
+				out[k] = (unsigned char)(std::min)(color[k] * scale, 255.0f);
+			}
+			out[3] = (unsigned char)(exponent + 128);
+		}
+	}
+	return rgbe;
+}
+
+static std::string WriteHdr(const std::vector<unsigned char>& rgbe, unsigned int width, unsigned int height, HdrEncoding encoding)
+{
+	std::ostringstream out;
+	out << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\nEXPOSURE=1.0\n\n-Y " << height << " +X " << width << "\n";
+
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		const unsigned char* row = &rgbe[(size_t)y * width * 4];
+		// like Radiance, scanlines too short for new style runs are written flat
+		if (encoding == HDR_FLAT || (encoding == HDR_NEW_RLE && width < 8))
+		{
+			out.write((const char*)row, (std::streamsize)width * 4);
+		}
+		else if (encoding == HDR_OLD_RLE)
+		{
+			unsigned int x = 0;
+			while (x < width)
+			{
+				out.write((const char*)row + x * 4, 4);
+				unsigned int run = 0;
+				while (x + 1 + run < width && run < 255 && std::equal(row + x * 4, row + x * 4 + 4, row + (x + 1 + run) * 4))
+				{
+					run++;
+				}
+				if (run > 0)
+				{
+					const char repeat[4] = { 1, 1, 1, (char)run };
+					out.write(repeat, 4);
+				}
+				x += 1 + run;
+			}
+		}
+		else
+		{
+			const char head[4] = { 2, 2, (char)(width >> 8), (char)(width & 0xff) };
+			out.write(head, 4);
+			for (int channel = 0; channel < 4; ++channel)
+			{
+				unsigned int x = 0;
+				while (x < width)
+				{
+					// runs of at least 3, literal spans up to the next one
+					unsigned int run = 1;
+					while (x + run < width && run < 127 && row[(x + run) * 4 + channel] == row[x * 4 + channel])
+					{
+						run++;
+					}
+					if (run >= 3)
+					{
+						out.put((char)(128 + run));
+						out.put((char)row[x * 4 + channel]);
+						x += run;
+						continue;
+					}
+
+					unsigned int span = 0;
+					while (x + span < width && span < 128)
+					{
+						unsigned int next = x + span;
+						if (next + 2 < width && row[next * 4 + channel] == row[(next + 1) * 4 + channel] &&
+							row[next * 4 + channel] == row[(next + 2) * 4 + channel])
+							break;
+						span++;
+					}
+					out.put((char)span);
+					for (unsigned int i = 0; i < span; ++i)
+					{
+						out.put((char)row[(x + i) * 4 + channel]);
+					}
+					x += span;
+				}
+			}
+		}
+	}
+	return out.str();
+}
+
+// every encoding reads back to the pixels the scalar reference decodes, and broken files fail
+static void TestRead()
+{
+	const unsigned int sizes[][2] = { { 64, 32 }, { 7, 5 }, { 300, 17 } };
+	const HdrEncoding encodings[] = { HDR_FLAT, HDR_OLD_RLE, HDR_NEW_RLE };
+
+	for (const unsigned int* size : sizes)
+	{
+		std::vector<unsigned char> rgbe = MakeSky(size[0], size[1]);
+		std::vector<float> expected(rgbe.size());
+		RadianceHdr::DecodeRgbeScalar(rgbe.data(), rgbe.size() / 4, expected.data());
+
+		for (HdrEncoding encoding : encodings)
+		{
+			std::string file = WriteHdr(rgbe, size[0], size[1], encoding);
+			std::istringstream in(file);
+			HdrImage image;
+			CHECK(RadianceHdr::Read(in, image));
+			CHECK(image.width == size[0] && image.height == size[1] && image.pixels == expected);
+
+			// cut short anywhere after the header fails and leaves no image
+			std::istringstream shortIn(file.substr(0, file.size() - 3));
+			CHECK(!RadianceHdr::Read(shortIn, image) && image.pixels.empty());
+		}
+	}
+
+	// "+Y" rows are bottom to top, "-X" columns right to left
+	std::vector<unsigned char> rgbe = MakeSky(16, 8);
+	std::string file = WriteHdr(rgbe, 16, 8, HDR_FLAT);
+	std::string flipped = file;
+	std::string resolution = "-Y 8 +X 16";
+	flipped.replace(flipped.find(resolution), resolution.size(), "+Y 8 -X 16");
+	std::istringstream in(file), flippedIn(flipped);
+	HdrImage image, flippedImage;
+	CHECK(RadianceHdr::Read(in, image) && RadianceHdr::Read(flippedIn, flippedImage));
+	bool mirrored = true;
+	for (unsigned int y = 0; y < 8; ++y)
+	{
+		for (unsigned int x = 0; x < 16; ++x)
+		{
+			const float* a = &image.pixels[(y * 16 + x) * 4];
+			const float* b = &flippedImage.pixels[((7 - y) * 16 + 15 - x) * 4];
+			mirrored &= std::equal(a, a + 4, b);
+		}
+	}
+	CHECK(mirrored);
+
+	const char* broken[] = { "", "P6\n16 8\n", "#?RADIANCE\nFORMAT=32-bit_rle_xyze\n\n-Y 1 +X 1\n\x80\x80\x80\x80",
+		"#?RADIANCE\n\n-Y 0 +X 4\n", "#?RADIANCE\n\n+X 4 -Y 1\n\x80\x80\x80\x80" };
+	for (const char* text : broken)
+	{
+		std::istringstream brokenIn(text);
+		CHECK(!RadianceHdr::Read(brokenIn, image));
+	}
+}
+
+// every exponent and mantissa through the SSE2 kernel, the scalar one and to half; the
+// kernel gives black below exponent 10, which the scalar path leaves denormal
+static void TestDecode()
+{
+	std::vector<unsigned char> rgbe(256 * 256 * 4 + 3 * 4);
+	for (size_t i = 0; i < rgbe.size() / 4; ++i)
+	{
+		rgbe[i * 4 + 0] = (unsigned char)i;
+		rgbe[i * 4 + 1] = (unsigned char)(255 - i);
+		rgbe[i * 4 + 2] = (unsigned char)(i * 7);
+		rgbe[i * 4 + 3] = (i >> 8) < 10 ? 0 : (unsigned char)(i >> 8);
+	}
+	size_t count = rgbe.size() / 4;
+	std::vector<float> simd(count * 4), scalar(count * 4);
+	RadianceHdr::DecodeRgbe(rgbe.data(), count, simd.data());
+	RadianceHdr::DecodeRgbeScalar(rgbe.data(), count, scalar.data());
+	CHECK(simd == scalar);
+
+	// exponent 0 is black, alpha always 1
+	CHECK(scalar[0] == 0.0f && scalar[1] == 0.0f && scalar[2] == 0.0f && scalar[3] == 1.0f);
+	// (128 + 0.5) * 2^(129 - 136)
+	CHECK(scalar[129 * 256 * 4 + 128 * 4] == 128.5f / 128.0f);
+
+	std::vector<uint16_t> halves(count * 4);
+	RadianceHdr::DecodeRgbeToHalf(rgbe.data(), count, halves.data());
+	CHECK(halves[3] == 0x3c00);
+	CHECK(halves[129 * 256 * 4 + 128 * 4] == 0x3c04);
+}
+
+// a sky the size of approaching_storm_1k.hdr: reading each encoding, and SSE2 against
+// scalar RGBE to float
+static void TimeRead()
+{
+	const unsigned int width = 1024, height = 512;
+	const int runs = 5;
+	const char* names[] = { "flat", "old rle", "new rle" };
+	std::vector<unsigned char> rgbe = MakeSky(width, height);
+
+	for (int encoding = HDR_FLAT; encoding <= HDR_NEW_RLE; ++encoding)
+	{
+		std::string file = WriteHdr(rgbe, width, height, (HdrEncoding)encoding);
+		double best = DBL_MAX;
+		HdrImage image;
+		for (int run = 0; run < runs; ++run)
+		{
+			std::istringstream in(file);
+			TestTimer timer;
+			CHECK(RadianceHdr::Read(in, image));
+			best = (std::min)(best, timer.ElapsedMs());
+		}
+		TestLog("hdr: %ux%u %s, %.0f KB, read and decode %.2f ms", width, height, names[encoding], file.size() / 1024.0, best);
+	}
+
+	size_t count = (size_t)width * height;
+	std::vector<float> simd(count * 4), scalar(count * 4);
+	double bestSimd = DBL_MAX, bestScalar = DBL_MAX;
+	for (int run = 0; run < runs; ++run)
+	{
+		TestTimer timer;
+		RadianceHdr::DecodeRgbe(rgbe.data(), count, simd.data());
+		bestSimd = (std::min)(bestSimd, timer.ElapsedMs());
+
+		timer.Reset();
+		RadianceHdr::DecodeRgbeScalar(rgbe.data(), count, scalar.data());
+		bestScalar = (std::min)(bestScalar, timer.ElapsedMs());
+	}
+	CHECK(simd == scalar);
+	TestLog("hdr: RGBE to float SSE2 %.3f ms, scalar %.3f ms (%.2fx)", bestSimd, bestScalar, bestScalar / bestSimd);
+}
+
+int main()
+{
+	TestRead();
+	TestDecode();
+	TimeRead();
+	return TestResult();
+}
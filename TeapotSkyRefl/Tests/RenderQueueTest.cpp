@@ -0,0 +1,186 @@
+#include "Test.h"
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <vector>
+
+// the key orders pass first and depth last, nearer first, with the depth clamped
+static void TestKey()
+{
+	CHECK(RenderQueue::MakeKey(0, 15, 65535, 4095, 255, 1.0f) < RenderQueue::MakeKey(1, 0, 0, 0, 0, 0.0f));
+	CHECK(RenderQueue::MakeKey(0, 1, 2, 3, 4, 0.25f) < RenderQueue::MakeKey(0, 1, 2, 3, 4, 0.5f));
+	CHECK(RenderQueue::MakeKey(0, 1, 2, 3, 4, 2.0f) == RenderQueue::MakeKey(0, 1, 2, 3, 4, 1.0f));
+	CHECK(RenderQueue::MakeKey(0, 1, 0, 0, 0, 0.0f) > RenderQueue::MakeKey(0, 0, 65535, 4095, 255, 1.0f));
+	CHECK(RenderQueue::MakeKey(0, 0, 1, 0, 0, 0.0f) > RenderQueue::MakeKey(0, 0, 0, 4095, 255, 1.0f));
+	CHECK(RenderQueue::MakeKey(0, 0, 0, 1, 0, 0.0f) > RenderQueue::MakeKey(0, 0, 0, 0, 255, 1.0f));
+}
+
+// RadixSort gives the order of a stable comparison sort, for keys differing in every digit,
+// in a few low bits only so most digits are skipped, and none at all
+static void TestRadixSort()
+{
+	TestRandom random(1);
+
+	const size_t counts[] = { 0, 1, 2, 100, 5000 };
+	const uint64_t masks[] = { ~0ull, 0xf00ull, 0ull };
+	for (size_t count : counts)
+	{
+		for (uint64_t mask : masks)
+		{
+			std::vector<uint64_t> keys(count), scratchKeys;
+			std::vector<uint32_t> values(count), scratchValues;
+			for (size_t i = 0; i < count; ++i)
+			{
+				keys[i] = (((uint64_t)random.Next() << 32) | random.Next()) & mask;
+				values[i] = (uint32_t)i;
+			}
+			std::vector<uint32_t> expected = values;
+			std::vector<uint64_t> unsorted = keys;
+			std::stable_sort(expected.begin(), expected.end(), [&unsorted](uint32_t a, uint32_t b) { return unsorted[a] < unsorted[b]; });
+
+			RenderQueue::RadixSort(keys, values, scratchKeys, scratchValues);
+			CHECK(values == expected);
+			CHECK(std::is_sorted(keys.begin(), keys.end()));
+		}
+	}
+}
+
+// A scene of meshes with eight submeshes each, in two vertex formats, whose materials use 256
+// textures; the shadow pass draws every mesh once, the GBuffer pass every submesh, both in
+// mesh order like SceneManager submits them. The radix sort gives the order of a stable sort,
+// every draw sees the state of its packet in either order, and key order binds fewer shaders
+// and textures. Ranking the material above the texture binds more textures and no fewer
+// materials, see the RenderQueue header.
+static void TestScene()
+{
+	const uint32_t counts[] = { 10000, 100000 };
+	const int frames = 20;
+
+	TestRandom random(1);
+
+	for (uint32_t count : counts)
+	{
+		uint32_t meshCount = count / 9;
+		RenderQueue queue;
+		std::vector<DrawPacket> packets;
+		for (uint32_t pass = 0; pass < 2; ++pass)
+		{
+			for (uint32_t mesh = 0; mesh < meshCount; ++mesh)
+			{
+				float depth = random.Float();
+				uint32_t submeshes = pass == 0 ? 8 : 1;
+				for (uint32_t submesh = 0; submesh < submeshes; ++submesh)
+				{
+					DrawPacket packet;
+					packet.pass = 1 - pass;
+					packet.shader = mesh % 3 == 0;
+					packet.texture = pass == 0 ? (uint32_t)(random.Float() * 256) : 0;
+					packet.mesh = mesh;
+					packet.constants = mesh;
+					packet.material = pass == 0 ? submesh : 0;
+					packet.rangeOffset = (uint32_t)packets.size();
+					packet.rangeCount = 1;
+					packet.key = RenderQueue::MakeKey(packet.pass, packet.shader, packet.texture, packet.mesh, packet.material, depth);
+					packets.push_back(packet);
+				}
+			}
+		}
+		for (const DrawPacket& packet : packets)
+		{
+			queue.Submit(packet);
+		}
+
+		std::vector<uint32_t> order(packets.size()), radixOrder;
+		double stableMs = 0.0, radixMs = 0.0;
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			TestTimer timer;
+			for (uint32_t i = 0; i < order.size(); ++i)
+			{
+				order[i] = i;
+			}
+			std::stable_sort(order.begin(), order.end(), [&packets](uint32_t a, uint32_t b) { return packets[a].key < packets[b].key; });
+			stableMs += timer.ElapsedMs();
+
+			timer.Reset();
+			queue.Sort();
+			radixMs += timer.ElapsedMs();
+		}
+		queue.GetOrder(radixOrder);
+		CHECK(order == radixOrder);
+		TestLog("renderqueue: %zu packets, std::stable_sort %.3f ms, radix sort %.3f ms, %.2fx", packets.size(), stableMs / frames,
+			radixMs / frames, stableMs / radixMs);
+
+		RenderQueue unsorted;
+		for (const DrawPacket& packet : packets)
+		{
+			unsorted.Submit(packet);
+		}
+		const RenderQueue* queues[] = { &unsorted, &queue };
+		const char* orderNames[] = { "submission order", "key order" };
+		RecordingRenderBackend backend;
+		RenderQueueStats queueStats[2];
+		for (int q = 0; q < 2; ++q)
+		{
+			backend.Clear();
+			RenderQueueStats& stats = queueStats[q];
+			TestTimer timer;
+			queues[q]->Execute(backend, &stats);
+			double executeMs = timer.ElapsedMs();
+
+			std::vector<uint32_t> executeOrder;
+			queues[q]->GetOrder(executeOrder);
+			const std::vector<RecordingRenderBackend::DrawState>& draws = backend.GetDraws();
+			bool drawsMatch = draws.size() == packets.size() && stats.draws == packets.size();
+			for (size_t i = 0; drawsMatch && i < draws.size(); ++i)
+			{
+				drawsMatch = RecordingRenderBackend::Matches(draws[i], packets[executeOrder[i]]);
+			}
+			CHECK(drawsMatch);
+			CHECK(stats.passes == 2);
+
+			TestLog("renderqueue: %zu packets, %s, %u shader, %u texture, %u mesh, %u constants, %u material binds, "
+				"%u of %u binds avoided, execute %.3f ms", packets.size(), orderNames[q], stats.shaderBinds, stats.textureBinds,
+				stats.meshBinds, stats.constantsBinds, stats.materialBinds, stats.bindsAvoided, stats.draws * 5, executeMs);
+		}
+		// Submission order keeps the submeshes of a mesh together, key order trades those mesh
+		// and constants binds for the shader and texture binds it ranks first:
+		// 513 + 4 against 88529 + 14816, for 98865 mesh binds against 22222 at 100k packets
+		CHECK(queueStats[1].shaderBinds + queueStats[1].textureBinds < queueStats[0].shaderBinds + queueStats[0].textureBinds);
+		CHECK(queueStats[1].meshBinds > queueStats[0].meshBinds);
+
+		// pass, shader, material, texture, depth
+		RenderQueue materialFirst;
+		const uint64_t depthMask = (1ull << RenderQueue::DepthBits) - 1;
+		for (DrawPacket packet : packets)
+		{
+			packet.key = ((uint64_t)packet.pass << 60) | ((uint64_t)packet.shader << 56) | ((uint64_t)packet.material << 48) |
+				((uint64_t)packet.texture << 32) | (packet.key & depthMask);
+			materialFirst.Submit(packet);
+		}
+		materialFirst.Sort();
+		backend.Clear();
+		RenderQueueStats materialStats;
+		materialFirst.Execute(backend, &materialStats);
+		TestLog("renderqueue: %zu packets, material above texture, %u texture, %u mesh, %u material binds", packets.size(),
+			materialStats.textureBinds, materialStats.meshBinds, materialStats.materialBinds);
+		CHECK(materialStats.textureBinds > queueStats[1].textureBinds);
+		CHECK(materialStats.materialBinds >= queueStats[1].materialBinds);
+	}
+
+	// nothing submitted draws nothing
+	RenderQueue empty;
+	empty.Sort();
+	RecordingRenderBackend backend;
+	RenderQueueStats stats;
+	empty.Execute(backend, &stats);
+	CHECK(backend.GetCalls().empty() && stats.draws == 0);
+}
+
+int main()
+{
+	TestKey();
+	TestRadixSort();
+	TestScene();
+	return TestResult();
+}
@@ -0,0 +1,421 @@
+#include "Test.h"
+#include "SceneBvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+static const float Pi = 3.14159265f;
+
+static const char* KernelNames[] = { "", "scalar", "sse2", "avx2" };
+
+// frustum planes a x + b y + c z + d >= 0 inside of a camera at position looking along yaw
+static void FrustumPlanes(const float position[3], float yaw, float fovY, float aspect, float nearZ, float farZ, float planes[6][4])
+{
+	float forward[3] = { sinf(yaw), 0.0f, cosf(yaw) };
+	float right[3] = { cosf(yaw), 0.0f, -sinf(yaw) };
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+	float tanY = tanf(0.5f * fovY);
+	float tanX = tanY * aspect;
+
+	// left, right, bottom, top: the side axis plus the forward axis scaled by the half angle
+	const float* sides[4] = { right, right, up, up };
+	const float signs[4] = { 1.0f, -1.0f, 1.0f, -1.0f };
+	for (int p = 0; p < 4; ++p)
+	{
+		float tangent = p < 2 ? tanX : tanY;
+		float length = sqrtf(1.0f + tangent * tangent);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			planes[p][axis] = (signs[p] * sides[p][axis] + tangent * forward[axis]) / length;
+		}
+	}
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		planes[4][axis] = forward[axis];
+		planes[5][axis] = -forward[axis];
+	}
+
+	for (int p = 0; p < 6; ++p)
+	{
+		planes[p][3] = -(planes[p][0] * position[0] + planes[p][1] * position[1] + planes[p][2] * position[2]);
+	}
+	planes[4][3] -= nearZ;
+	planes[5][3] += farZ;
+}
+
+// the camera in the middle of the world turning around, a sixth of the world at a time
+static void FramePlanes(int frame, int frames, float planes[6][4])
+{
+	const float position[3] = { 0.0f, 0.0f, 0.0f };
+	FrustumPlanes(position, frame * 2.0f * Pi / frames, Pi / 3.0f, 16.0f / 9.0f, 1.0f, 1000.0f, planes);
+}
+
+// objects not outside any plane, one box after the other, boxes inverted on any axis are empty
+static void BruteForceCull(const std::vector<BvhBounds>& bounds, const float planes[6][4], std::vector<uint32_t>& visible)
+{
+	visible.clear();
+	for (uint32_t object = 0; object < bounds.size(); ++object)
+	{
+		const BvhBounds& box = bounds[object];
+		bool outside = box.min[0] > box.max[0] || box.min[1] > box.max[1] || box.min[2] > box.max[2];
+		for (int p = 0; p < 6 && !outside; ++p)
+		{
+			const float* plane = planes[p];
+			float x = plane[0] >= 0.0f ? box.max[0] : box.min[0];
+			float y = plane[1] >= 0.0f ? box.max[1] : box.min[1];
+			float z = plane[2] >= 0.0f ? box.max[2] : box.min[2];
+			outside = ((plane[0] * x + plane[1] * y) + plane[2] * z) + plane[3] < 0.0f;
+		}
+		if (!outside)
+			visible.push_back(object);
+	}
+}
+
+static void RandomBox(TestRandom& random, float worldSize, BvhBounds& box)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float center = (random.Float() - 0.5f) * worldSize;
+		float extent = 0.25f + 2.25f * random.Float();
+		box.min[axis] = center - extent;
+		box.max[axis] = center + extent;
+	}
+}
+
+static std::vector<BvhBounds> RandomBoxes(uint32_t count, float worldSize, uint32_t seed)
+{
+	TestRandom random(seed);
+	std::vector<BvhBounds> bounds(count);
+	for (BvhBounds& box : bounds)
+	{
+		RandomBox(random, worldSize, box);
+	}
+	return bounds;
+}
+
+// Every kernel gives the objects of the brute force loop, and every kernel the same order.
+// Mismatching frames are counted.
+static int CountMismatches(const SceneBvh& bvh, const std::vector<BvhBounds>& bounds, int frames)
+{
+	int mismatches = 0;
+	std::vector<uint32_t> expected, visible, reference, sorted;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		float planes[6][4];
+		FramePlanes(frame, frames, planes);
+		BruteForceCull(bounds, planes, expected);
+
+		for (int kernel = BVH_CULL_SCALAR; kernel <= BVH_CULL_AVX2; ++kernel)
+		{
+			if (SceneBvh::GetKernel((BvhCullKernel)kernel) != kernel)
+				continue;
+
+			BvhCullStats stats;
+			bvh.Cull(planes, visible, &stats, (BvhCullKernel)kernel);
+			sorted = visible;
+			std::sort(sorted.begin(), sorted.end());
+			mismatches += sorted != expected || stats.visibleObjects != visible.size();
+			if (kernel == BVH_CULL_SCALAR)
+				reference = visible;
+			else
+				mismatches += visible != reference;
+		}
+	}
+	return mismatches;
+}
+
+// The kernels against brute force for a few tree sizes, built and after a tenth of the
+// objects moved a few units and were refitted
+static void TestCull()
+{
+	const uint32_t counts[] = { 0, 1, 8, 9, 65, 5000 };
+	for (uint32_t count : counts)
+	{
+		std::vector<BvhBounds> bounds = RandomBoxes(count, 200.0f, count + 1);
+		SceneBvh bvh;
+		bvh.Build(bounds.data(), bounds.size());
+		CHECK(bvh.GetObjectCount() == count);
+		CHECK(CountMismatches(bvh, bounds, 12) == 0);
+
+		TestRandom random(7);
+		for (uint32_t object = 0; object < count; object += 10)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				float offset = (random.Float() - 0.5f) * 10.0f;
+				bounds[object].min[axis] += offset;
+				bounds[object].max[axis] += offset;
+			}
+			bvh.SetBounds(object, bounds[object]);
+		}
+		CHECK(!bvh.Refit());
+		CHECK(CountMismatches(bvh, bounds, 12) == 0);
+	}
+
+	// a camera inside every box sees them all, taken whole without testing the leaves
+	std::vector<BvhBounds> around(100);
+	for (uint32_t i = 0; i < around.size(); ++i)
+	{
+		BvhBounds box = { { -1.0f - i, -1.0f, -1.0f - i }, { 1.0f + i, 1.0f, 1.0f + i } };
+		around[i] = box;
+	}
+	SceneBvh bvh;
+	bvh.Build(around.data(), around.size());
+	CHECK(CountMismatches(bvh, around, 12) == 0);
+}
+
+// Refit keeps the tree until the node boxes reach RebuildAreaRatio times the area they had
+// when built. Eight unit boxes in a row fit one node of 2 (8 + 1 + 8) = 34, stretching the
+// last one by d along x makes it 34 + 4 d: 66 at d = 8 is refitted, 70 at d = 9 is built again.
+static void TestRefit()
+{
+	std::vector<BvhBounds> bounds(8);
+	for (uint32_t i = 0; i < bounds.size(); ++i)
+	{
+		BvhBounds box = { { (float)i, 0.0f, 0.0f }, { i + 1.0f, 1.0f, 1.0f } };
+		bounds[i] = box;
+	}
+
+	SceneBvh bvh;
+	bvh.Build(bounds.data(), bounds.size());
+	CHECK(bvh.GetNodeCount() == 1);
+	CHECK(!bvh.Refit());
+
+	// the same box again leaves the area as built
+	bvh.SetBounds(7, bounds[7]);
+	CHECK(!bvh.Refit());
+
+	bounds[7].max[0] = 16.0f;
+	bvh.SetBounds(7, bounds[7]);
+	CHECK(!bvh.Refit());
+	CHECK(bvh.GetBounds(7).max[0] == 16.0f);
+
+	bounds[7].max[0] = 17.0f;
+	bvh.SetBounds(7, bounds[7]);
+	CHECK(bvh.Refit());
+
+	// built again from the current boxes, so the next doubling is measured from 70
+	bounds[7].max[0] = 25.0f;
+	bvh.SetBounds(7, bounds[7]);
+	CHECK(!bvh.Refit());
+
+	// a tenth of a larger world scattered across it grows the loose nodes past the ratio
+	std::vector<BvhBounds> world = RandomBoxes(20000, 2000.0f, 3);
+	SceneBvh worldBvh;
+	worldBvh.Build(world.data(), world.size());
+	TestRandom random(5);
+	for (uint32_t object = 5; object < world.size(); object += 10)
+	{
+		RandomBox(random, 2000.0f, world[object]);
+		worldBvh.SetBounds(object, world[object]);
+	}
+	CHECK(worldBvh.Refit());
+	CHECK(CountMismatches(worldBvh, world, 8) == 0);
+}
+
+// A box inverted on a single axis is empty: never visible, also inside a node taken whole,
+// and visible again once it gets a valid box
+static void TestInverted()
+{
+	std::vector<BvhBounds> bounds = RandomBoxes(2000, 100.0f, 11);
+	for (uint32_t object = 0; object < bounds.size(); object += 7)
+	{
+		int axis = object % 3;
+		std::swap(bounds[object].min[axis], bounds[object].max[axis]);
+	}
+
+	SceneBvh bvh;
+	bvh.Build(bounds.data(), bounds.size());
+	CHECK(CountMismatches(bvh, bounds, 12) == 0);
+
+	// a frustum holding the whole world, only the valid boxes come back
+	const float position[3] = { 0.0f, 0.0f, -1000.0f };
+	float planes[6][4];
+	FrustumPlanes(position, 0.0f, Pi / 2.0f, 1.0f, 1.0f, 5000.0f, planes);
+	std::vector<uint32_t> visible;
+	BvhCullStats stats;
+	bvh.Cull(planes, visible, &stats);
+	bool anyInverted = false;
+	for (uint32_t object : visible)
+	{
+		anyInverted |= object % 7 == 0;
+	}
+	CHECK(!anyInverted && visible.size() == bounds.size() - (bounds.size() + 6) / 7);
+	CHECK(stats.insideNodes > 0);
+
+	// inverting and restoring through SetBounds
+	for (uint32_t object = 0; object < bounds.size(); object += 7)
+	{
+		int axis = object % 3;
+		std::swap(bounds[object].min[axis], bounds[object].max[axis]);
+		bvh.SetBounds(object, bounds[object]);
+	}
+	for (uint32_t object = 3; object < bounds.size(); object += 7)
+	{
+		std::swap(bounds[object].min[1], bounds[object].max[1]);
+		bvh.SetBounds(object, bounds[object]);
+	}
+	bvh.Refit();
+	CHECK(CountMismatches(bvh, bounds, 12) == 0);
+	bvh.Cull(planes, visible);
+	CHECK(visible.size() == bounds.size() - (bounds.size() + 3) / 7);
+}
+
+// The six faces of a cube shadow map: the union in id order and the count of every face
+// against brute force
+static void TestCullUnion()
+{
+	std::vector<BvhBounds> bounds = RandomBoxes(5000, 200.0f, 13);
+	SceneBvh bvh;
+	bvh.Build(bounds.data(), bounds.size());
+
+	// +x, -x, +z, -z by yaw, +y and -y by swapping y and z into the forward axis
+	const float position[3] = { 10.0f, 5.0f, -20.0f };
+	float faces[6][6][4];
+	for (int f = 0; f < 4; ++f)
+	{
+		FrustumPlanes(position, f * 0.5f * Pi, 0.5f * Pi, 1.0f, 0.1f, 60.0f, faces[f]);
+	}
+	for (int f = 4; f < 6; ++f)
+	{
+		float swapped[3] = { position[0], position[2], position[1] };
+		FrustumPlanes(swapped, f == 4 ? 0.0f : Pi, 0.5f * Pi, 1.0f, 0.1f, 60.0f, faces[f]);
+		for (int p = 0; p < 6; ++p)
+		{
+			std::swap(faces[f][p][1], faces[f][p][2]);
+		}
+	}
+
+	std::vector<uint8_t> marks(bounds.size(), 0);
+	uint32_t expectedCounts[6];
+	std::vector<uint32_t> faceObjects;
+	for (int f = 0; f < 6; ++f)
+	{
+		BruteForceCull(bounds, faces[f], faceObjects);
+		expectedCounts[f] = (uint32_t)faceObjects.size();
+		for (uint32_t object : faceObjects)
+		{
+			marks[object] = 1;
+		}
+	}
+	std::vector<uint32_t> expected;
+	for (uint32_t object = 0; object < marks.size(); ++object)
+	{
+		if (marks[object])
+			expected.push_back(object);
+	}
+	CHECK(expected.size() > 0 && expected.size() < bounds.size());
+
+	for (int kernel = BVH_CULL_SCALAR; kernel <= BVH_CULL_AVX2; ++kernel)
+	{
+		if (SceneBvh::GetKernel((BvhCullKernel)kernel) != kernel)
+			continue;
+
+		std::vector<uint32_t> visible;
+		uint32_t counts[6];
+		bvh.CullUnion(faces, 6, visible, counts, (BvhCullKernel)kernel);
+		CHECK(visible == expected);
+		CHECK(std::equal(counts, counts + 6, expectedCounts));
+	}
+
+	std::vector<uint32_t> none;
+	bvh.CullUnion(faces, 0, none);
+	CHECK(none.empty());
+}
+
+// 100k boxes: build, brute force against each kernel per frame, then refits after moving
+// a tenth of the boxes a little and after scattering them
+static void TimeCull()
+{
+	const uint32_t objectCount = 100000;
+	const float worldSize = 2000.0f;
+	const int frames = 32;
+
+	std::vector<BvhBounds> bounds = RandomBoxes(objectCount, worldSize, 1);
+	TestTimer buildTimer;
+	SceneBvh bvh;
+	bvh.Build(bounds.data(), bounds.size());
+	TestLog("bvh: %u objects, %zu nodes built in %.2f ms", objectCount, bvh.GetNodeCount(), buildTimer.ElapsedMs());
+
+	auto timeFrames = [&](const char* phase)
+	{
+		std::vector<uint32_t> visible;
+		double bruteMs = 0.0;
+		size_t visibleSum = 0;
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			float planes[6][4];
+			FramePlanes(frame, frames, planes);
+			TestTimer timer;
+			BruteForceCull(bounds, planes, visible);
+			bruteMs += timer.ElapsedMs();
+			visibleSum += visible.size();
+		}
+		TestLog("bvh: %s brute force %.3f ms per frame, %.0f visible", phase, bruteMs / frames, (double)visibleSum / frames);
+
+		for (int kernel = BVH_CULL_SCALAR; kernel <= BVH_CULL_AVX2; ++kernel)
+		{
+			if (SceneBvh::GetKernel((BvhCullKernel)kernel) != kernel)
+				continue;
+
+			double cullMs = 0.0;
+			size_t nodes = 0, insideNodes = 0;
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				float planes[6][4];
+				FramePlanes(frame, frames, planes);
+				BvhCullStats stats;
+				TestTimer timer;
+				bvh.Cull(planes, visible, &stats, (BvhCullKernel)kernel);
+				cullMs += timer.ElapsedMs();
+				nodes += stats.nodes;
+				insideNodes += stats.insideNodes;
+			}
+			TestLog("bvh: %s %s %.3f ms per frame, %.1fx, %.0f nodes tested, %.0f taken whole", phase, KernelNames[kernel],
+				cullMs / frames, bruteMs / cullMs, (double)nodes / frames, (double)insideNodes / frames);
+		}
+		CHECK(CountMismatches(bvh, bounds, frames) == 0);
+	};
+
+	timeFrames("built");
+
+	TestRandom random(2);
+	TestTimer refitTimer;
+	for (uint32_t object = 0; object < objectCount; object += 10)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float offset = (random.Float() - 0.5f) * 10.0f;
+			bounds[object].min[axis] += offset;
+			bounds[object].max[axis] += offset;
+		}
+		bvh.SetBounds(object, bounds[object]);
+	}
+	bool rebuilt = bvh.Refit();
+	TestLog("bvh: %u objects moved, refit in %.2f ms%s", objectCount / 10, refitTimer.ElapsedMs(), rebuilt ? ", built again" : "");
+	CHECK(!rebuilt);
+	timeFrames("refit");
+
+	refitTimer.Reset();
+	for (uint32_t object = 5; object < objectCount; object += 10)
+	{
+		RandomBox(random, worldSize, bounds[object]);
+		bvh.SetBounds(object, bounds[object]);
+	}
+	rebuilt = bvh.Refit();
+	TestLog("bvh: %u objects scattered, refit in %.2f ms%s", objectCount / 10, refitTimer.ElapsedMs(), rebuilt ? ", built again" : "");
+	CHECK(rebuilt);
+	timeFrames("scattered");
+}
+
+int main()
+{
+	TestCull();
+	TestRefit();
+	TestInverted();
+	TestCullUnion();
+	TimeCull();
+	return TestResult();
+}
@@ -0,0 +1,258 @@
+#include "Test.h"
+#include "ShadowAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+static const int AtlasSize = 4096, MinTile = 128, MaxTile = 1024;
+static const uint32_t LightCount = 400;
+
+// lights along both sides of a 2000 unit street, a third of them point lights
+struct StreetLight
+{
+	float x, z, range;
+	int faces;
+};
+
+static std::vector<StreetLight> MakeStreet()
+{
+	TestRandom random(1);
+
+	std::vector<StreetLight> lights(LightCount);
+	for (StreetLight& light : lights)
+	{
+		light.x = (random.Float() < 0.5f ? -1.0f : 1.0f) * (8.0f + 20.0f * random.Float());
+		light.z = 2000.0f * random.Float();
+		light.range = 10.0f + 30.0f * random.Float();
+		light.faces = random.Float() < 0.33f ? 6 : 1;
+	}
+	return lights;
+}
+
+// the lights in view distance of a camera at cameraZ, with the largest tile for a light
+// as tall as the screen
+static void RequestStreet(const std::vector<StreetLight>& lights, float cameraZ, std::vector<ShadowAtlasRequest>& requests)
+{
+	const float viewDistance = 150.0f;
+	const float tanY = tanf(0.125f * 3.14159265f);
+
+	requests.clear();
+	for (uint32_t i = 0; i < lights.size(); ++i)
+	{
+		const StreetLight& light = lights[i];
+		float distance = sqrtf(light.x * light.x + (light.z - cameraZ) * (light.z - cameraZ));
+		if (distance > viewDistance)
+			continue;
+		float screen = distance > light.range ? light.range / (distance * tanY) : 1.0f;
+		ShadowAtlasRequest request = { i, MaxTile * (std::min)(screen, 1.0f), light.faces };
+		requests.push_back(request);
+	}
+}
+
+// every tile of the atlas inside it, a power of two between the smallest and largest
+// size on the cells, the faces of a light the same size, no two tiles overlapping, and
+// the stats counting them
+static bool AtlasValid(const ShadowAtlas& atlas, const std::vector<ShadowAtlasRequest>& requests)
+{
+	std::vector<ShadowAtlasTile> tiles;
+	size_t lights = 0, dropped = 0;
+	uint64_t usedTexels = 0;
+	bool valid = true;
+	for (const ShadowAtlasRequest& request : requests)
+	{
+		const ShadowAtlasTile* lightTiles = atlas.GetTiles(request.light);
+		if (!lightTiles)
+		{
+			dropped++;
+			continue;
+		}
+		lights++;
+		int size = atlas.GetTileSize(request.light);
+		valid &= (size & (size - 1)) == 0 && size >= atlas.GetMinTileSize() && size <= atlas.GetMaxTileSize();
+		for (int face = 0; face < request.faces; ++face)
+		{
+			const ShadowAtlasTile& tile = lightTiles[face];
+			valid &= tile.size == size && tile.x >= 0 && tile.y >= 0 && tile.x + size <= atlas.GetSize() && tile.y + size <= atlas.GetSize();
+			valid &= tile.x % atlas.GetMinTileSize() == 0 && tile.y % atlas.GetMinTileSize() == 0;
+			usedTexels += (uint64_t)size * size;
+			tiles.push_back(tile);
+		}
+	}
+
+	for (size_t i = 0; i < tiles.size(); ++i)
+	{
+		for (size_t j = i + 1; j < tiles.size(); ++j)
+		{
+			const ShadowAtlasTile& a = tiles[i];
+			const ShadowAtlasTile& b = tiles[j];
+			valid &= a.x + a.size <= b.x || b.x + b.size <= a.x || a.y + a.size <= b.y || b.y + b.size <= a.y;
+		}
+	}
+
+	const ShadowAtlasStats& stats = atlas.GetStats();
+	valid &= stats.lights == lights && stats.dropped == dropped && stats.tiles == tiles.size() && stats.usedTexels == usedTexels;
+	return valid;
+}
+
+// tiles of lights with tiles in both frames that moved or changed size
+static size_t CountChanges(const ShadowAtlas& atlas, const std::vector<ShadowAtlasTile>& last, const std::vector<ShadowAtlasRequest>& requests)
+{
+	size_t changed = 0;
+	for (const ShadowAtlasRequest& request : requests)
+	{
+		const ShadowAtlasTile* tiles = atlas.GetTiles(request.light);
+		for (int face = 0; face < request.faces && tiles && last[request.light * ShadowAtlas::MaxFaces].size > 0; ++face)
+		{
+			const ShadowAtlasTile& a = tiles[face];
+			const ShadowAtlasTile& b = last[request.light * ShadowAtlas::MaxFaces + face];
+			changed += a.x != b.x || a.y != b.y || a.size != b.size;
+		}
+	}
+	return changed;
+}
+
+static void StoreTiles(const ShadowAtlas& atlas, std::vector<ShadowAtlasTile>& last, const std::vector<ShadowAtlasRequest>& requests)
+{
+	ShadowAtlasTile none = { 0, 0, 0 };
+	std::fill(last.begin(), last.end(), none);
+	for (const ShadowAtlasRequest& request : requests)
+	{
+		const ShadowAtlasTile* tiles = atlas.GetTiles(request.light);
+		for (int face = 0; face < request.faces && tiles; ++face)
+		{
+			last[request.light * ShadowAtlas::MaxFaces + face] = tiles[face];
+		}
+	}
+}
+
+// rounding of the wanted sizes and the hysteresis around the current size
+static void TestTileSizes()
+{
+	ShadowAtlas atlas;
+	atlas.SetSize(AtlasSize, MinTile, MaxTile);
+	CHECK(atlas.GetTileSizeFor(1.0f, 0) == MinTile);
+	CHECK(atlas.GetTileSizeFor(300.0f, 0) == 512);
+	CHECK(atlas.GetTileSizeFor(100000.0f, 0) == MaxTile);
+	CHECK(atlas.GetTileSizeFor(540.0f, 512) == 512);
+	CHECK(atlas.GetTileSizeFor(900.0f, 512) == MaxTile);
+	CHECK(atlas.GetTileSizeFor(200.0f, 512) == 512);
+	CHECK(atlas.GetTileSizeFor(150.0f, 512) == 256);
+
+	// nothing requested gives nothing, a light not given again loses its tiles
+	atlas.Update(NULL, 0);
+	CHECK(atlas.GetStats().lights == 0 && atlas.GetStats().usedTexels == 0);
+	ShadowAtlasRequest request = { 3, 600.0f, 6 };
+	atlas.Update(&request, 1);
+	CHECK(atlas.GetTiles(3) != NULL && atlas.GetTileSize(3) == MaxTile);
+	atlas.Update(NULL, 0);
+	CHECK(atlas.GetTiles(3) == NULL && atlas.GetStats().usedTexels == 0);
+}
+
+// A camera driving through the street, every frame checked, and the tiles that move or
+// change size from frame to frame against packing the atlas anew each frame without
+// hysteresis. Then the same lights again change nothing.
+static void TestStreet()
+{
+	const int frames = 2000;
+	std::vector<StreetLight> lights = MakeStreet();
+
+	ShadowAtlas atlas;
+	atlas.SetSize(AtlasSize, MinTile, MaxTile);
+	std::vector<ShadowAtlasRequest> requests;
+	std::vector<ShadowAtlasTile> last(LightCount * ShadowAtlas::MaxFaces), lastFresh(LightCount * ShadowAtlas::MaxFaces);
+	size_t invalidFrames = 0, changed = 0, freshChanged = 0, resized = 0, placed = 0, moved = 0;
+	size_t requested = 0, served = 0, dropped = 0, maxServed = 0, overFixedFrames = 0;
+	double updateMs = 0.0;
+
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		RequestStreet(lights, frame * 1000.0f / frames, requests);
+
+		TestTimer timer;
+		atlas.Update(requests.data(), requests.size());
+		updateMs += timer.ElapsedMs();
+
+		const ShadowAtlasStats& stats = atlas.GetStats();
+		invalidFrames += !AtlasValid(atlas, requests);
+		changed += CountChanges(atlas, last, requests);
+		StoreTiles(atlas, last, requests);
+		resized += stats.resized;
+		placed += stats.placed;
+		moved += stats.moved;
+		requested += requests.size();
+		served += stats.lights;
+		dropped += stats.dropped;
+		maxServed = (std::max)(maxServed, (size_t)stats.lights);
+
+		// more than the three spot and three point shadow maps of LightManager
+		size_t spots = 0, points = 0;
+		for (const ShadowAtlasRequest& request : requests)
+		{
+			spots += request.faces == 1;
+			points += request.faces == 6;
+		}
+		overFixedFrames += spots > 3 || points > 3;
+
+		ShadowAtlas fresh;
+		fresh.SetSize(AtlasSize, MinTile, MaxTile);
+		fresh.SetHysteresis(0.0f);
+		fresh.Update(requests.data(), requests.size());
+		invalidFrames += !AtlasValid(fresh, requests);
+		freshChanged += CountChanges(fresh, lastFresh, requests);
+		StoreTiles(fresh, lastFresh, requests);
+	}
+	CHECK(invalidFrames == 0);
+	CHECK(changed * 4 < freshChanged);
+
+	TestLog("shadowatlas: %d frames, %.1f of %.1f lights a frame given tiles, up to %zu, %zu light frames dropped",
+		frames, (double)served / frames, (double)requested / frames, maxServed, dropped);
+	TestLog("shadowatlas: %.4f ms an Update, %u full packs, %zu tiles placed in free space, %zu moved by packs, %zu light resizes",
+		updateMs / frames, atlas.GetStats().packs, placed, moved, resized);
+	TestLog("shadowatlas: %zu tile changes between frames against %zu packing each frame without hysteresis", changed, freshChanged);
+
+	// R32 depth of three spot maps and three point cube maps against the atlas
+	const uint64_t fixedBytes = 3ull * 1024 * 1024 * 4 + 3ull * 6 * 1024 * 1024 * 4;
+	const uint64_t atlasBytes = (uint64_t)AtlasSize * AtlasSize * 4;
+	TestLog("shadowatlas: %.0f MB of fixed maps for 3 spot and 3 point lights, %.0f MB atlas for %.1f lights a frame; %zu of %d frames wanted more than the fixed maps",
+		fixedBytes / 1048576.0, atlasBytes / 1048576.0, (double)served / frames, overFixedFrames, frames);
+
+	ShadowAtlasStats before = atlas.GetStats();
+	StoreTiles(atlas, last, requests);
+	atlas.Update(requests.data(), requests.size());
+	CHECK(CountChanges(atlas, last, requests) == 0);
+	CHECK(atlas.GetStats().packs == before.packs && atlas.GetStats().placed == 0 && atlas.GetStats().resized == 0);
+	CHECK(AtlasValid(atlas, requests));
+}
+
+// every light at once, all want the largest tile: the least important are dropped, the
+// rest fill the atlas with the smallest tiles, but for less than a point light
+static void TestOverflow()
+{
+	std::vector<StreetLight> lights = MakeStreet();
+	std::vector<ShadowAtlasRequest> requests;
+	for (uint32_t i = 0; i < LightCount; ++i)
+	{
+		ShadowAtlasRequest request = { i, (float)MaxTile - i, lights[i].faces };
+		requests.push_back(request);
+	}
+
+	ShadowAtlas atlas;
+	atlas.SetSize(AtlasSize, MinTile, MaxTile);
+	atlas.Update(requests.data(), requests.size());
+	const ShadowAtlasStats& full = atlas.GetStats();
+	CHECK(AtlasValid(atlas, requests));
+	CHECK(full.dropped > 0);
+	CHECK(full.atlasTexels - full.usedTexels < 6ull * MinTile * MinTile);
+	CHECK(atlas.GetTiles(0) != NULL && atlas.GetTiles(LightCount - 1) == NULL);
+	TestLog("shadowatlas: %u lights, %u given tiles, %u dropped, %.0f%% of the atlas used", LightCount, full.lights, full.dropped,
+		100.0 * full.usedTexels / full.atlasTexels);
+}
+
+int main()
+{
+	TestTileSizes();
+	TestStreet();
+	TestOverflow();
+	return TestResult();
+}
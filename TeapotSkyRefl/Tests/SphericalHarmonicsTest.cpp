@@ -0,0 +1,237 @@
+#include "Test.h"
+#include "SphericalHarmonics.h"
+#include "CubemapConverter.h"
+#include "Parallel.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// RGBA16F faces with color(direction) in every texel
+template<typename Color>
+static std::vector<uint16_t> MakeFaces(unsigned int faceSize, Color color)
+{
+	std::vector<float> texels((size_t)CubemapConverter::FaceCount * faceSize * faceSize * 4);
+	for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+	{
+		for (unsigned int y = 0; y < faceSize; ++y)
+		{
+			for (unsigned int x = 0; x < faceSize; ++x)
+			{
+				float d[3];
+				CubemapConverter::FaceDirection(face, (x + 0.5f) * 2.0f / faceSize - 1.0f, (y + 0.5f) * 2.0f / faceSize - 1.0f, d);
+				float* texel = &texels[(((size_t)face * faceSize + y) * faceSize + x) * 4];
+				color(d, texel);
+				texel[3] = 1.0f;
+			}
+		}
+	}
+
+	std::vector<uint16_t> faces(texels.size());
+	ConvertFloatsToHalves(texels.data(), texels.size(), faces.data());
+	return faces;
+}
+
+// a sky brightening towards +Y over a dark ground, with a small bright sun
+static void SkyColor(const float d[3], float rgb[3])
+{
+	float sun = d[0] * 0.3f + d[1] * 0.5f + d[2] * 0.81f > 0.995f ? 200.0f : 0.0f;
+	TestSkyColor(d[1], rgb);
+	for (int c = 0; c < 3; ++c)
+		rgb[c] += sun;
+}
+
+// only bands 0 to 2, which the 9 coefficients hold exactly
+static void BandLimitedColor(const float d[3], float rgb[3])
+{
+	rgb[0] = 1.0f + 0.5f * d[1] + 0.3f * d[0] * d[2];
+	rgb[1] = 1.0f - 0.7f * d[0] + 0.4f * (d[0] * d[0] - d[1] * d[1]);
+	rgb[2] = 2.0f + d[2] * d[1];
+}
+
+// Largest relative error of the SH ambient against the brute force integral over normals
+static float MaxAmbientError(const std::vector<uint16_t>& faces, unsigned int faceSize, const SHCoefficients& ambient, int normalCount,
+	float& meanError)
+{
+	float maxError = 0.0f;
+	double sum = 0.0;
+	for (int i = 0; i < normalCount; ++i)
+	{
+		// spiral over the sphere
+		float y = 1.0f - (i + 0.5f) * 2.0f / normalCount;
+		float r = sqrtf((std::max)(0.0f, 1.0f - y * y));
+		float phi = i * 2.39996323f;
+		float normal[3] = { r * cosf(phi), y, r * sinf(phi) };
+
+		float sh[3], reference[3];
+		SphericalHarmonics::EvaluateAmbient(ambient, normal, sh);
+		SphericalHarmonics::IntegrateAmbient(faces.data(), faceSize, normal, reference);
+		for (int c = 0; c < 3; ++c)
+		{
+			float error = fabsf(sh[c] - reference[c]) / (std::max)(reference[c], 1e-4f);
+			maxError = (std::max)(maxError, error);
+			sum += error;
+		}
+	}
+	meanError = (float)(sum / (normalCount * 3));
+	return maxError;
+}
+
+static float MaxDifference(const SHCoefficients& a, const SHCoefficients& b)
+{
+	float difference = 0.0f;
+	for (int i = 0; i < SHCoefficients::Count; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			difference = (std::max)(difference, fabsf(a.rgb[i][c] - b.rgb[i][c]));
+		}
+	}
+	return difference;
+}
+
+// A constant sky lights every normal with its radiance, the hemisphere ambient gives its
+// two colours straight up and down, and a band limited sky matches brute force integration
+static void TestAmbient()
+{
+	const unsigned int faceSize = 32;
+	std::vector<uint16_t> faces = MakeFaces(faceSize, [](const float*, float* rgb) { rgb[0] = 0.5f; rgb[1] = 1.0f; rgb[2] = 2.0f; });
+	SHCoefficients radiance, ambient;
+	SphericalHarmonics::ProjectCubemap(faces.data(), faceSize, radiance);
+	SphericalHarmonics::AmbientCoefficients(radiance, ambient);
+	float meanError = 0.0f;
+	CHECK(MaxAmbientError(faces, faceSize, ambient, 32, meanError) < 1e-3f);
+	const float up[3] = { 0.0f, 1.0f, 0.0f };
+	float rgb[3];
+	SphericalHarmonics::EvaluateAmbient(ambient, up, rgb);
+	CHECK(fabsf(rgb[0] - 0.5f) < 1e-3f && fabsf(rgb[1] - 1.0f) < 1e-3f && fabsf(rgb[2] - 2.0f) < 2e-3f);
+
+	const float lower[3] = { 0.1f, 0.2f, 0.3f }, upper[3] = { 1.0f, 0.8f, 0.6f };
+	const float down[3] = { 0.0f, -1.0f, 0.0f }, side[3] = { 1.0f, 0.0f, 0.0f };
+	SphericalHarmonics::HemisphereAmbient(lower, upper, ambient);
+	float rgbUp[3], rgbDown[3], rgbSide[3];
+	SphericalHarmonics::EvaluateAmbient(ambient, up, rgbUp);
+	SphericalHarmonics::EvaluateAmbient(ambient, down, rgbDown);
+	SphericalHarmonics::EvaluateAmbient(ambient, side, rgbSide);
+	for (int c = 0; c < 3; ++c)
+	{
+		CHECK(fabsf(rgbUp[c] - upper[c]) < 1e-5f && fabsf(rgbDown[c] - lower[c]) < 1e-5f);
+		CHECK(fabsf(rgbSide[c] - 0.5f * (lower[c] + upper[c])) < 1e-5f);
+	}
+
+	// the brute force integral is O(texels) per normal, so the faces are small
+	faces = MakeFaces(64, BandLimitedColor);
+	SphericalHarmonics::ProjectCubemap(faces.data(), 64, radiance);
+	SphericalHarmonics::AmbientCoefficients(radiance, ambient);
+	float maxError = MaxAmbientError(faces, 64, ambient, 64, meanError);
+	CHECK(maxError < 1e-3f);
+	TestLog("sh: band limited environment, ambient error against brute force mean %.4f%% max %.4f%%", meanError * 100.0f,
+		maxError * 100.0f);
+
+	// a sky only up to the truncation of the 9 coefficients, reported
+	faces = MakeFaces(64, SkyColor);
+	SphericalHarmonics::ProjectCubemap(faces.data(), 64, radiance);
+	SphericalHarmonics::AmbientCoefficients(radiance, ambient);
+	maxError = MaxAmbientError(faces, 64, ambient, 64, meanError);
+	TestLog("sh: sky with a sun, ambient error against brute force mean %.2f%% max %.2f%% (9 coefficients)", meanError * 100.0f,
+		maxError * 100.0f);
+}
+
+// SSE2 against scalar, the same radiance for every thread count, and a face baked again on
+// its own against a full bake
+static void TestProjection()
+{
+	const unsigned int faceSizes[] = { 1, 3, 16, 37 };
+	for (unsigned int faceSize : faceSizes)
+	{
+		std::vector<uint16_t> faces = MakeFaces(faceSize, SkyColor);
+		size_t faceTexels = (size_t)faceSize * faceSize * 4;
+
+		SHCoefficients reference, scalar;
+		SphericalHarmonics::ProjectCubemap(faces.data(), faceSize, reference, 1);
+		for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+		{
+			SHCoefficients faceRadiance;
+			SphericalHarmonics::ProjectFaceScalar(face, faces.data() + face * faceTexels, faceSize, faceRadiance);
+			scalar += faceRadiance;
+		}
+		CHECK(MaxDifference(reference, scalar) < 1e-3f * fabsf(scalar.rgb[0][0]));
+
+		const unsigned int threadCounts[] = { 2, 3, 0 };
+		for (unsigned int threads : threadCounts)
+		{
+			SHCoefficients radiance;
+			SphericalHarmonics::ProjectCubemap(faces.data(), faceSize, radiance, threads);
+			CHECK(memcmp(&radiance, &reference, sizeof(radiance)) == 0);
+		}
+
+		SHIrradianceBaker baker;
+		baker.Bake(faces.data(), faceSize);
+		CHECK(baker.GetFaceSize() == faceSize && MaxDifference(baker.GetRadiance(), reference) < 1e-4f);
+		std::fill(faces.begin() + 2 * faceTexels, faces.begin() + 3 * faceTexels, (uint16_t)0);
+		baker.UpdateFace(2, faces.data() + 2 * faceTexels);
+		SHCoefficients full;
+		SphericalHarmonics::ProjectCubemap(faces.data(), faceSize, full);
+		CHECK(MaxDifference(baker.GetRadiance(), full) < 1e-4f);
+	}
+}
+
+// The projection of 512 faces, the size the sky uses, against the thread count, SSE2
+// against scalar, and one face baked again
+static void TimeProjection()
+{
+	const unsigned int faceSize = 512;
+	const int runs = 3;
+	std::vector<uint16_t> faces = MakeFaces(faceSize, SkyColor);
+	size_t faceTexels = (size_t)faceSize * faceSize * 4;
+
+	SHCoefficients reference;
+	double singleThreadMs = 0.0;
+	for (unsigned int threads = 1; threads <= WorkerThreadCount(); threads *= 2)
+	{
+		SHCoefficients radiance;
+		double best = DBL_MAX;
+		for (int run = 0; run < runs; ++run)
+		{
+			TestTimer timer;
+			SphericalHarmonics::ProjectCubemap(faces.data(), faceSize, radiance, threads);
+			best = (std::min)(best, timer.ElapsedMs());
+		}
+		if (threads == 1)
+		{
+			reference = radiance;
+			singleThreadMs = best;
+		}
+		CHECK(memcmp(&radiance, &reference, sizeof(radiance)) == 0);
+		TestLog("sh: %u faces, %u threads %.2f ms, %.2fx", faceSize, threads, best, singleThreadMs / best);
+	}
+
+	SHCoefficients scalar;
+	TestTimer timer;
+	for (unsigned int face = 0; face < CubemapConverter::FaceCount; ++face)
+	{
+		SHCoefficients faceRadiance;
+		SphericalHarmonics::ProjectFaceScalar(face, faces.data() + face * faceTexels, faceSize, faceRadiance);
+		scalar += faceRadiance;
+	}
+	double scalarMs = timer.ElapsedMs();
+	TestLog("sh: scalar %.2f ms, SSE2 %.2fx faster, largest difference %g of the DC term", scalarMs, scalarMs / singleThreadMs,
+		MaxDifference(reference, scalar) / fabsf(scalar.rgb[0][0]));
+
+	SHIrradianceBaker baker;
+	baker.Bake(faces.data(), faceSize);
+	timer.Reset();
+	baker.UpdateFace(2, faces.data() + 2 * faceTexels);
+	TestLog("sh: one face baked again in %.2f ms", timer.ElapsedMs());
+}
+
+int main()
+{
+	TestAmbient();
+	TestProjection();
+	TimeProjection();
+	return TestResult();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+
+// Test
+// Checks and timing for the portable tests of the Renderer modules that only use the
+// standard library. Every test is one executable run by ctest: CHECK prints the failed
+// condition and TestResult makes main return non zero when any failed. Timings are
+// printed to compare runs and machines, they are never checked. TestRandom and TestSkyColor
+// are the test data shared by the tests.
+// usage:
+// CHECK(welded.Vertices.size() == 24);
+// TestTimer timer; ... TestLog("weld: %.2f ms", timer.ElapsedMs());
+// return TestResult();
+
+inline int& TestFailureCount()
+{
+	static int count = 0;
+	return count;
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			TestFailureCount()++; \
+			printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+		} \
+	} while (0)
+
+// printf style, one line
+inline void TestLog(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	fflush(stdout);
+}
+
+// exit code of main
+inline int TestResult()
+{
+	TestLog(TestFailureCount() == 0 ? "PASSED" : "FAILED, %d checks", TestFailureCount());
+	return TestFailureCount() == 0 ? 0 : 1;
+}
+
+// wall clock timer for the timings
+class TestTimer
+{
+public:
+	TestTimer() { Reset(); }
+
+	void Reset() { mStart = std::chrono::steady_clock::now(); }
+
+	// milliseconds since Reset()
+	double ElapsedMs() const { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mStart).count(); }
+
+private:
+	std::chrono::steady_clock::time_point mStart;
+};
+
+// linear congruential generator, the same test data on every platform and compiler
+class TestRandom
+{
+public:
+	explicit TestRandom(uint32_t seed) : mSeed(seed) {}
+
+	// next 32 bit state
+	uint32_t Next()
+	{
+		mSeed = mSeed * 1664525u + 1013904223u;
+		return mSeed;
+	}
+
+	// uniform in [0, 1), the top 24 bits of the state
+	float Float() { return (Next() >> 8) * (1.0f / 16777216.0f); }
+
+private:
+	uint32_t mSeed;
+};
+
+// The sky of the environment tests without its sun: brightening towards up = 1 over a
+// dark ground below up = 0
+inline void TestSkyColor(float up, float rgb[3])
+{
+	rgb[0] = up > 0.0f ? 0.3f + 0.2f * up : 0.1f;
+	rgb[1] = up > 0.0f ? 0.4f + 0.3f * up : 0.08f;
+	rgb[2] = up > 0.0f ? 0.8f + 0.6f * up : 0.05f;
+}
@@ -0,0 +1,200 @@
+#include "Test.h"
+#include "TextureResidency.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+// known sizes: RGBA8 256 x 256, a BC1 block, the one block of a 1 x 1 BC1 mip, a BC3 chain, an RGBA16F cube
+static void TestTextureBytes()
+{
+	CHECK(TextureResidency::TextureBytes(256, 256, 1, 1, 32, false) == 262144);
+	CHECK(TextureResidency::TextureBytes(4, 4, 1, 1, 4, true) == 8);
+	CHECK(TextureResidency::TextureBytes(1, 1, 1, 1, 4, true) == 8);
+	CHECK(TextureResidency::TextureBytes(8, 8, 4, 1, 8, true) == 64 + 16 + 16 + 16);
+	CHECK(TextureResidency::TextureBytes(16, 16, 1, 6, 64, false) == 16 * 16 * 8 * 6);
+}
+
+// Four textures of 100 bytes under a budget of 250: the least recently used evictable ones
+// go, never one used in the frame or one that may not be evicted, and an evicted one used
+// again is given back once until it is created
+static void TestPolicy()
+{
+	TextureResidency residency;
+	residency.SetBudget(250);
+	for (uint32_t handle = 1; handle <= 4; ++handle)
+	{
+		residency.OnCreated(handle, 100, handle != 1);
+	}
+	CHECK(residency.GetStats().residentBytes == 400 && residency.GetStats().evictableBytes == 300);
+
+	std::vector<uint32_t> evict, reload;
+	residency.Touch(3);
+	residency.EndFrame(evict, reload);
+	residency.Touch(4);
+	residency.Touch(1);
+	residency.EndFrame(evict, reload);
+	CHECK(evict.size() == 2 && evict[0] == 2 && evict[1] == 3 && reload.empty());
+	CHECK(!residency.IsResident(2) && !residency.IsResident(3) && residency.IsResident(1) && residency.IsResident(4));
+	CHECK(residency.GetStats().residentBytes == 200 && residency.GetStats().evictedCount == 2 && residency.GetStats().evictions == 2);
+
+	residency.Touch(3);
+	residency.EndFrame(evict, reload);
+	CHECK(evict.empty() && reload.size() == 1 && reload[0] == 3);
+	residency.Touch(3);
+	residency.EndFrame(evict, reload);
+	CHECK(reload.empty());
+
+	// created again it counts as a reload and brings the total over the budget, texture 4
+	// unused since goes
+	residency.OnCreated(3, 100, true);
+	CHECK(residency.GetStats().reloads == 1 && residency.IsResident(3));
+	residency.Touch(3);
+	residency.EndFrame(evict, reload);
+	CHECK(evict.size() == 1 && evict[0] == 4);
+
+	// released by the caller is neither resident nor evicted, and no budget evicts nothing
+	residency.OnReleased(3);
+	CHECK(!residency.IsResident(3) && residency.GetStats().residentBytes == 100);
+	residency.SetBudget(0);
+	residency.OnCreated(5, 1000, true);
+	residency.EndFrame(evict, reload);
+	residency.EndFrame(evict, reload);
+	CHECK(evict.empty() && residency.IsResident(5));
+	CHECK(residency.GetStats().peakResidentBytes == 1100);
+}
+
+// 300 textures of a level loaded at the start and a view moving over them, with a mock
+// device and loads that take two frames: the device stays under the budget, nothing drawn
+// in a frame is evicted after it, and the stats follow the device
+static void TestScene()
+{
+	const uint32_t textureCount = 300;
+	const uint32_t drawsPerFrame = 400;
+	const uint32_t workingSet = 60;		// textures a view draws, most of the draws go to a few of them
+	const int loadFrames = 2;			// frames from the request to the created texture
+	const uint64_t budget = 48ull << 20;
+	const int frames = 2000;
+
+	// BC1 1024, BC3 512 and RGBA8 256 textures with their mips, and a sky that stays
+	std::vector<uint64_t> bytes(textureCount + 1);
+	for (uint32_t handle = 1; handle < textureCount; ++handle)
+	{
+		switch (handle % 3)
+		{
+		case 0: bytes[handle] = TextureResidency::TextureBytes(1024, 1024, 11, 1, 4, true); break;
+		case 1: bytes[handle] = TextureResidency::TextureBytes(512, 512, 10, 1, 8, true); break;
+		default: bytes[handle] = TextureResidency::TextureBytes(256, 256, 9, 1, 32, false); break;
+		}
+	}
+	const uint32_t skyHandle = textureCount;
+	bytes[skyHandle] = TextureResidency::TextureBytes(256, 256, 9, 6, 64, false);
+
+	TextureResidency residency;
+	residency.SetBudget(budget);
+
+	std::map<uint32_t, uint64_t> device;
+	auto create = [&](uint32_t handle, bool evictable)
+	{
+		device[handle] = bytes[handle];
+		residency.OnCreated(handle, bytes[handle], evictable);
+	};
+	for (uint32_t handle = 1; handle < textureCount; ++handle)
+	{
+		create(handle, true);
+	}
+	create(skyHandle, false);
+
+	std::vector<std::pair<int, uint32_t>> loading;	// frame the texture is created, handle
+	std::vector<uint32_t> evict, reload;
+	std::vector<int> usedFrame(textureCount + 1, -1), requestFrame(textureCount + 1, -1);
+	size_t draws = 0, texturedDraws = 0, overBudgetFrames = 0, usedEvictions = 0, statMismatches = 0;
+	size_t reloadCount = 0, reloadLatency = 0;
+	double endFrameMs = 0.0;
+	TestRandom random(1);
+
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		// AssetLoader::Update, the loads that finished
+		for (size_t i = 0; i < loading.size();)
+		{
+			if (loading[i].first <= frame)
+			{
+				uint32_t handle = loading[i].second;
+				create(handle, true);
+				reloadLatency += frame - requestFrame[handle];
+				reloadCount++;
+				loading[i] = loading.back();
+				loading.pop_back();
+			}
+			else
+			{
+				++i;
+			}
+		}
+
+		// TextureManager::Update, ends the frame drawn last
+		TestTimer timer;
+		residency.EndFrame(evict, reload);
+		endFrameMs += timer.ElapsedMs();
+
+		for (uint32_t handle : evict)
+		{
+			usedEvictions += usedFrame[handle] == frame - 1;
+			device.erase(handle);
+		}
+		for (uint32_t handle : reload)
+		{
+			requestFrame[handle] = frame;
+			loading.push_back(std::make_pair(frame + loadFrames, handle));
+		}
+
+		uint64_t deviceBytes = 0;
+		for (const auto& kv : device)
+		{
+			deviceBytes += kv.second;
+		}
+		const TextureResidencyStats& stats = residency.GetStats();
+		statMismatches += deviceBytes != stats.residentBytes || device.size() != stats.residentCount;
+
+		// the working set fits the budget once the start is evicted
+		overBudgetFrames += frame > 1 && stats.residentBytes > budget;
+
+		// render, a draw without its texture draws untextured
+		uint32_t first = (uint32_t)frame / 8;
+		residency.Touch(skyHandle);
+		for (uint32_t i = 0; i < drawsPerFrame; ++i)
+		{
+			float u = random.Float();
+			uint32_t rank = (uint32_t)(workingSet * u * u);
+			uint32_t handle = 1 + (first + rank) % (textureCount - 1);
+
+			residency.Touch(handle);
+			usedFrame[handle] = frame;
+			draws++;
+			texturedDraws += device.count(handle) != 0;
+		}
+	}
+
+	const TextureResidencyStats& stats = residency.GetStats();
+	CHECK(statMismatches == 0);
+	CHECK(overBudgetFrames == 0);
+	CHECK(usedEvictions == 0);
+	CHECK(stats.evictions > 0 && stats.reloads > 0 && stats.reloads == reloadCount);
+	CHECK(device.count(skyHandle) != 0);
+
+	TestLog("residency: %u textures, %d frames, budget %.0f MB, peak %.1f MB, now %.1f MB in %u textures, %u evicted",
+		textureCount, frames, budget / 1048576.0, stats.peakResidentBytes / 1048576.0, stats.residentBytes / 1048576.0,
+		stats.residentCount, stats.evictedCount);
+	TestLog("residency: %llu evictions (%.1f MB), %llu reloads after %.1f frames, %.2f%% of the draws textured, EndFrame %.4f ms",
+		(unsigned long long)stats.evictions, stats.evictedBytes / 1048576.0, (unsigned long long)stats.reloads,
+		reloadCount > 0 ? (double)reloadLatency / reloadCount : 0.0, 100.0 * texturedDraws / draws, endFrameMs / frames);
+}
+
+int main()
+{
+	TestTextureBytes();
+	TestPolicy();
+	TestScene();
+	return TestResult();
+}
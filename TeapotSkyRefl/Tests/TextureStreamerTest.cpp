@@ -0,0 +1,314 @@
+#include "Test.h"
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// byte of a simulated texture file
+static unsigned char StreamedByte(uint32_t file, uint64_t offset)
+{
+	return (unsigned char)((uint32_t)(offset * 2654435761u) >> 24) ^ (unsigned char)file;
+}
+
+// reads of file "<n>" give the bytes of StreamedByte(n), the file "missing" fails
+static bool ReadSimulated(const std::string& file, uint64_t offset, size_t bytes, unsigned char* data)
+{
+	if (file == "missing")
+		return false;
+	uint32_t fileIndex = (uint32_t)atoi(file.c_str());
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		data[i] = StreamedByte(fileIndex, offset + i);
+	}
+	return true;
+}
+
+// BC1 or BC3 mips of a square texture one after another after a .dds header
+static std::vector<TextureMipLayout> MipLayout(uint32_t size, uint32_t blockBytes)
+{
+	std::vector<TextureMipLayout> mips;
+	uint64_t offset = 128;
+	for (uint32_t mipSize = size;; mipSize /= 2)
+	{
+		TextureMipLayout layout;
+		layout.offset = offset;
+		layout.rowPitch = ((mipSize + 3) / 4) * blockBytes;
+		layout.bytes = layout.rowPitch * ((mipSize + 3) / 4);
+		mips.push_back(layout);
+		offset += layout.bytes;
+		if (mipSize == 1)
+			break;
+	}
+	return mips;
+}
+
+// Updates until nothing streams any more or frames ran out, uploads of every Update appended
+static void UpdateUntilDone(TextureStreamer& streamer, std::vector<TextureMipUpload>& all, int frames = 1000)
+{
+	std::vector<TextureMipUpload> uploads;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		streamer.Update(uploads);
+		for (TextureMipUpload& upload : uploads)
+		{
+			all.push_back(std::move(upload));
+		}
+		if (streamer.GetStats().streamingCount == 0)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+static void TestDesiredMip()
+{
+	CHECK(TextureStreamer::DesiredMip(1024, 1024, 11, 2000.0f) == 0);
+	CHECK(TextureStreamer::DesiredMip(1024, 1024, 11, 1024.0f) == 0);
+	CHECK(TextureStreamer::DesiredMip(1024, 1024, 11, 1000.0f) == 0);
+	CHECK(TextureStreamer::DesiredMip(1024, 1024, 11, 200.0f) == 2);
+	CHECK(TextureStreamer::DesiredMip(1024, 512, 11, 256.0f) == 2);
+	CHECK(TextureStreamer::DesiredMip(1024, 1024, 11, 0.5f) == 10);
+	CHECK(TextureStreamer::DesiredMip(1024, 1024, 4, 1.0f) == 3);
+	CHECK(TextureStreamer::DesiredMip(1024, 1024, 0, 1.0f) == 0);
+}
+
+// The mips requested arrive one after the other down to the request and no finer, with the
+// bytes of the file; a failed read ends the streaming at the mips the texture has, a removed
+// texture gets nothing, and a texture not requested reads nothing
+static void TestRequests()
+{
+	TextureStreamer streamer(ReadSimulated);
+	std::vector<TextureMipLayout> mips = MipLayout(256, 8);
+	streamer.Add(1, "1", 256, 256, mips, 5);
+	streamer.Add(2, "missing", 256, 256, mips, 5);
+	streamer.Add(3, "3", 256, 256, mips, 5);
+	streamer.Add(4, "4", 256, 256, mips, 5);
+	CHECK(streamer.IsStreamed(1) && streamer.GetResidentMip(1) == 5 && !streamer.IsStreamed(7) && streamer.GetResidentMip(7) == 0);
+
+	streamer.RequestMip(1, 2);
+	streamer.RequestMip(1, 3);
+	streamer.RequestMip(2, 0);
+	streamer.RequestMip(3, 0);
+	streamer.Remove(3);
+	std::vector<TextureMipUpload> uploads;
+	UpdateUntilDone(streamer, uploads);
+
+	uint32_t expectedMip = 4;
+	bool inOrder = true, sameBytes = true;
+	for (const TextureMipUpload& upload : uploads)
+	{
+		inOrder &= upload.handle == 1 && upload.mip == expectedMip--;
+		const TextureMipLayout& layout = mips[upload.mip];
+		sameBytes &= upload.data.size() == layout.bytes && upload.rowPitch == layout.rowPitch;
+		for (size_t i = 0; i < upload.data.size(); ++i)
+		{
+			sameBytes &= upload.data[i] == StreamedByte(1, layout.offset + i);
+		}
+	}
+	CHECK(uploads.size() == 3 && inOrder && sameBytes);
+	CHECK(streamer.GetResidentMip(1) == 2 && streamer.GetResidentMip(2) == 5 && streamer.GetResidentMip(4) == 5);
+	CHECK(!streamer.IsStreamed(3) && streamer.GetStats().streamingCount == 0 && streamer.GetStats().pendingReads == 0);
+
+	// a coarser request keeps the finer mips
+	streamer.RequestMip(1, 4);
+	uploads.clear();
+	UpdateUntilDone(streamer, uploads);
+	CHECK(uploads.empty() && streamer.GetResidentMip(1) == 2);
+	streamer.RequestScreenSize(1, 256.0f);
+	UpdateUntilDone(streamer, uploads);
+	CHECK(streamer.GetResidentMip(1) == 0 && streamer.GetStats().bytesUploaded == streamer.GetStats().bytesRead);
+}
+
+// A level of 24 textures of 2048 and 1024 texels added with their 128 texel tails on a
+// simulated disk with a seek time and a bandwidth, frames of 16.7 ms: the first frame against
+// loading every texture whole, and every upload in order, within budget and matching the file
+static void TestStreaming()
+{
+	const uint32_t textureCount = 24;
+	const uint32_t tailSize = 128;
+	const uint64_t uploadBudget = 4 << 20;
+	const double seekMs = 0.2;
+	const double bytesPerMs = 300.0 * 1048576.0 / 1000.0;
+	const double frameMs = 1000.0 / 60.0;
+	const int maxFrames = 600;
+
+	typedef std::chrono::steady_clock Clock;
+
+	// the disk serves one read at a time
+	std::atomic<uint64_t> diskReads(0);
+	auto busyWait = [](double ms)
+	{
+		Clock::time_point end = Clock::now() + std::chrono::microseconds((long long)(ms * 1000.0));
+		while (Clock::now() < end)
+		{
+			std::this_thread::yield();
+		}
+	};
+	auto readDisk = [&](const std::string& file, uint64_t offset, size_t bytes, unsigned char* data)
+	{
+		busyWait(seekMs + bytes / bytesPerMs);
+		diskReads++;
+		return ReadSimulated(file, offset, bytes, data);
+	};
+
+	struct SimTexture
+	{
+		uint32_t size;
+		std::vector<TextureMipLayout> mips;
+		uint32_t firstMip;
+		uint32_t desiredMip;
+		uint32_t residentMip;
+		bool removed;
+		double addMs;
+		double fullMs;
+		int fullFrame;
+	};
+	std::vector<SimTexture> textures(textureCount + 1);
+	uint64_t fullBytes = 0, tailBytes = 0;
+	for (uint32_t handle = 1; handle <= textureCount; ++handle)
+	{
+		SimTexture& texture = textures[handle];
+		bool bc1 = handle % 3 != 0;
+		texture.size = bc1 ? 2048 : 1024;
+		texture.mips = MipLayout(texture.size, bc1 ? 8 : 16);
+		texture.firstMip = 0;
+		for (uint32_t mip = 0; mip < texture.mips.size(); ++mip)
+		{
+			if ((texture.size >> mip) > tailSize)
+				texture.firstMip = mip + 1;
+			else
+				tailBytes += texture.mips[mip].bytes;
+		}
+		fullBytes += texture.mips.back().offset + texture.mips.back().bytes - 128;
+
+		// every fourth one is far away, a fifth of its size on screen needs mip 2
+		texture.desiredMip = handle % 4 == 0 ?
+			TextureStreamer::DesiredMip(texture.size, texture.size, (uint32_t)texture.mips.size(), texture.size / 5.0f) : 0;
+		texture.residentMip = texture.firstMip;
+		texture.removed = false;
+		texture.fullMs = 0.0;
+		texture.fullFrame = -1;
+	}
+
+	// loading everything before the first frame, read whole from the same disk
+	double blockingMs = textureCount * seekMs + fullBytes / bytesPerMs;
+
+	TextureStreamer streamer(readDisk);
+	streamer.SetUploadBudget(uploadBudget);
+
+	// the tails are read when loading, the first frame follows
+	TestTimer timer;
+	std::vector<unsigned char> tail;
+	for (uint32_t handle = 1; handle <= textureCount; ++handle)
+	{
+		SimTexture& texture = textures[handle];
+		const TextureMipLayout& first = texture.mips[texture.firstMip];
+		tail.resize((size_t)(texture.mips.back().offset + texture.mips.back().bytes - first.offset));
+		readDisk(std::to_string(handle), first.offset, tail.size(), tail.data());
+		streamer.Add(handle, std::to_string(handle), texture.size, texture.size, texture.mips, texture.firstMip);
+		texture.addMs = timer.ElapsedMs();
+	}
+	double firstFrameMs = timer.ElapsedMs();
+
+	const uint32_t removedHandle = 5;
+	std::vector<TextureMipUpload> uploads;
+	size_t mismatches = 0, outOfOrder = 0, overBudget = 0, tooFine = 0, afterRemove = 0;
+	uint64_t maxFrameBytes = 0;
+	int frame = 0;
+	for (; frame < maxFrames; ++frame)
+	{
+		double frameStart = timer.ElapsedMs();
+
+		// the texture of an object that went away stops streaming
+		if (frame == 3)
+		{
+			streamer.Remove(removedHandle);
+			textures[removedHandle].removed = true;
+		}
+
+		streamer.Update(uploads);
+
+		uint64_t frameBytes = 0;
+		for (const TextureMipUpload& upload : uploads)
+		{
+			SimTexture& texture = textures[upload.handle];
+			const TextureMipLayout& layout = texture.mips[upload.mip];
+			outOfOrder += upload.mip + 1 != texture.residentMip;
+			tooFine += upload.mip < texture.desiredMip;
+			afterRemove += texture.removed;
+			mismatches += upload.data.size() != layout.bytes || upload.rowPitch != layout.rowPitch;
+			for (size_t i = 0; i < upload.data.size() && i < layout.bytes; i += 4093)
+			{
+				mismatches += upload.data[i] != StreamedByte(upload.handle, layout.offset + i);
+			}
+			texture.residentMip = upload.mip;
+			frameBytes += upload.data.size();
+			if (upload.mip == texture.desiredMip)
+			{
+				texture.fullMs = timer.ElapsedMs() - texture.addMs;
+				texture.fullFrame = frame;
+			}
+		}
+		overBudget += uploads.size() > 1 && frameBytes > uploadBudget;
+		maxFrameBytes = (std::max)(maxFrameBytes, frameBytes);
+
+		bool done = true;
+		for (uint32_t handle = 1; handle <= textureCount; ++handle)
+		{
+			mismatches += !textures[handle].removed && streamer.GetResidentMip(handle) != textures[handle].residentMip;
+			done &= textures[handle].removed || textures[handle].residentMip == textures[handle].desiredMip;
+		}
+		if (done)
+			break;
+
+		// render: every object asks for the mip of its size on screen
+		for (uint32_t handle = 1; handle <= textureCount; ++handle)
+		{
+			streamer.RequestMip(handle, textures[handle].desiredMip);
+		}
+
+		busyWait(frameStart + frameMs - timer.ElapsedMs());
+	}
+
+	double sumMs = 0.0, maxMs = 0.0;
+	int maxFrame = 0;
+	size_t unfinished = 0;
+	for (uint32_t handle = 1; handle <= textureCount; ++handle)
+	{
+		const SimTexture& texture = textures[handle];
+		if (texture.removed)
+			continue;
+		unfinished += texture.fullFrame < 0;
+		sumMs += texture.fullMs;
+		maxMs = (std::max)(maxMs, texture.fullMs);
+		maxFrame = (std::max)(maxFrame, texture.fullFrame);
+	}
+
+	CHECK(mismatches == 0);
+	CHECK(outOfOrder == 0);
+	CHECK(overBudget == 0);
+	CHECK(tooFine == 0);
+	CHECK(afterRemove == 0);
+	CHECK(unfinished == 0 && frame < maxFrames);
+
+	const TextureStreamerStats& stats = streamer.GetStats();
+	TestLog("streaming: %u textures, %.1f MB of mips, disk %.0f MB/s, upload budget %.0f MB a frame",
+		textureCount, fullBytes / 1048576.0, bytesPerMs * 1000.0 / 1048576.0, uploadBudget / 1048576.0);
+	TestLog("streaming: first frame after %.1f ms (%.0f KB of tails), loading whole %.1f ms, full detail after %.1f ms on "
+		"average, %.1f ms (%d frames) at most", firstFrameMs, tailBytes / 1024.0, blockingMs, sumMs / (textureCount - 1), maxMs,
+		maxFrame + 1);
+	TestLog("streaming: %.1f MB read in %llu reads, %.1f MB uploaded, at most %.2f MB in a frame",
+		stats.bytesRead / 1048576.0, (unsigned long long)diskReads.load(), stats.bytesUploaded / 1048576.0, maxFrameBytes / 1048576.0);
+}
+
+int main()
+{
+	TestDesiredMip();
+	TestRequests();
+	TestStreaming();
+	return TestResult();
+}
@@ -0,0 +1,332 @@
+#include "Test.h"
+#include "TransformSystem.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+static void Multiply4x4(const float* a, const float* b, float* c)
+{
+	for (int r = 0; r < 4; ++r)
+	{
+		for (int col = 0; col < 4; ++col)
+		{
+			c[r * 4 + col] = ((a[r * 4] * b[col] + a[r * 4 + 1] * b[4 + col]) + a[r * 4 + 2] * b[8 + col]) + a[r * 4 + 3] * b[12 + col];
+		}
+	}
+}
+
+// rotation about y of angle, affine 4x3
+static void RotationY(float angle, float m[12])
+{
+	const float rotation[12] = { cosf(angle), 0.0f, -sinf(angle), 0.0f, 1.0f, 0.0f, sinf(angle), 0.0f, cosf(angle), 0.0f, 0.0f, 0.0f };
+	memcpy(m, rotation, sizeof(rotation));
+}
+
+static void Translation(float x, float y, float z, float m[12])
+{
+	const float translation[12] = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, x, y, z };
+	memcpy(m, translation, sizeof(translation));
+}
+
+static bool Near(const float* a, const float* b, int count, float tolerance = 1e-5f)
+{
+	for (int k = 0; k < count; ++k)
+	{
+		if (fabsf(a[k] - b[k]) > tolerance * (1.0f + fabsf(b[k])))
+			return false;
+	}
+	return true;
+}
+
+// The world of a child is its local times its parent's world, only what moved changes,
+// the geometry transform goes into the world view projection, destroying a parent drops
+// its children, and handles of destroyed transforms are given out again
+static void TestHierarchy()
+{
+	TransformSystem transforms;
+	float root[12], child[12], grandchild[12], other[12];
+	Translation(10.0f, 0.0f, 0.0f, root);
+	RotationY(1.0f, child);
+	child[9] = 2.0f;
+	Translation(0.0f, 3.0f, 0.0f, grandchild);
+	Translation(-5.0f, 0.0f, 1.0f, other);
+
+	TransformHandle rootHandle = transforms.Create(root);
+	TransformHandle childHandle = transforms.Create(child, rootHandle);
+	TransformHandle grandchildHandle = transforms.Create(grandchild, childHandle);
+	TransformHandle otherHandle = transforms.Create(other);
+	transforms.Update();
+	CHECK(transforms.GetCount() == 4 && transforms.WorldChanged(grandchildHandle) && transforms.WorldChanged(otherHandle));
+
+	float expected[12], world[12];
+	TransformSystem::MultiplyAffine(child, root, expected);
+	transforms.GetWorld(childHandle, world);
+	CHECK(Near(world, expected, 12));
+	TransformSystem::MultiplyAffine(grandchild, expected, expected);
+	transforms.GetWorld(grandchildHandle, world);
+	CHECK(Near(world, expected, 12));
+
+	// local = local * transform, moving the root changes everything below it and nothing else
+	float rotation[12];
+	RotationY(0.5f, rotation);
+	transforms.Multiply(rootHandle, rotation);
+	transforms.Update();
+	float local[12];
+	transforms.GetLocal(rootHandle, local);
+	TransformSystem::MultiplyAffine(root, rotation, expected);
+	CHECK(Near(local, expected, 12));
+	CHECK(transforms.WorldChanged(rootHandle) && transforms.WorldChanged(childHandle) && transforms.WorldChanged(grandchildHandle));
+	CHECK(!transforms.WorldChanged(otherHandle));
+	transforms.Update();
+	CHECK(!transforms.WorldChanged(rootHandle));
+
+	// a point (1, 1, 1) of geometry scaled by 2 and offset by (1, 0, 0) at (10, 0, 0) is at (13, 2, 2)
+	const float scale[3] = { 2.0f, 2.0f, 2.0f }, offset[3] = { 1.0f, 0.0f, 0.0f };
+	const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	transforms.SetLocal(rootHandle, root);
+	transforms.SetGeometry(rootHandle, scale, offset);
+	transforms.Update();
+	for (int kernel = TRANSFORM_KERNEL_SCALAR; kernel <= TRANSFORM_KERNEL_SSE2; ++kernel)
+	{
+		// four of the same for the SSE2 path, then one more for the scalar tail
+		TransformHandle handles[5] = { rootHandle, rootHandle, rootHandle, rootHandle, rootHandle };
+		for (int geometryInWorld = 0; geometryInWorld < 2; ++geometryInWorld)
+		{
+			TransformConstants constants[5];
+			transforms.BuildConstants(handles, 5, identity, constants, geometryInWorld != 0, (TransformKernel)kernel);
+			for (const TransformConstants& constant : constants)
+			{
+				const float point[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+				float clip[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, position[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (int c = 0; c < 4; ++c)
+				{
+					for (int r = 0; r < 4; ++r)
+					{
+						clip[c] += point[r] * constant.worldViewProj[c * 4 + r];
+						position[c] += point[r] * constant.world[c * 4 + r];
+					}
+				}
+				const float geometryPoint[4] = { 13.0f, 2.0f, 2.0f, 1.0f }, plainPoint[4] = { 11.0f, 1.0f, 1.0f, 1.0f };
+				CHECK(Near(clip, geometryPoint, 4));
+				CHECK(Near(position, geometryInWorld ? geometryPoint : plainPoint, 4));
+			}
+		}
+	}
+
+	transforms.Destroy(childHandle);
+	transforms.Update();
+	CHECK(transforms.GetCount() == 2 && !transforms.IsValid(childHandle) && !transforms.IsValid(grandchildHandle));
+	CHECK(transforms.IsValid(rootHandle) && transforms.IsValid(otherHandle));
+	transforms.GetWorld(otherHandle, world);
+	CHECK(Near(world, other, 12));
+	TransformHandle reused = transforms.Create(child, otherHandle);
+	CHECK(reused == childHandle || reused == grandchildHandle);
+	transforms.Update();
+	TransformSystem::MultiplyAffine(child, other, expected);
+	transforms.GetWorld(reused, world);
+	CHECK(Near(world, expected, 12));
+}
+
+// TransformSystem against one 4x4 world matrix per object: a hierarchy of roots, children
+// and grandchildren whose roots all rotate every frame, then the constants of every object
+// in the shuffled order of a culled draw list. The kernels and thread counts match each other
+// exactly and the 4x4 matrices up to rounding.
+static void TestAgainst4x4()
+{
+	const uint32_t counts[] = { 1000, 100000, 1000000 };
+	const char* kernelNames[] = { "", "scalar", "sse2" };
+
+	TestRandom random(1);
+
+	float viewProj[16] = { 1.3f, 0.0f, 0.0f, 0.0f, 0.0f, 2.3f, 0.0f, 0.0f, 0.0f, 0.0f, 1.001f, 1.0f, 0.0f, 0.0f, -0.1f, 5.0f };
+
+	for (uint32_t count : counts)
+	{
+		// an eighth roots, three eighths children of a root, the rest grandchildren
+		uint32_t rootCount = count / 8, childEnd = count / 2;
+		std::vector<uint32_t> parents(count);
+		std::vector<float> locals(count * 12);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			parents[i] = i < rootCount ? 0xffffffffu : (i < childEnd ? (uint32_t)(random.Float() * rootCount) :
+				rootCount + (uint32_t)(random.Float() * (childEnd - rootCount)));
+			float scale = 0.5f + random.Float();
+			RotationY(random.Float() * 6.28f, &locals[i * 12]);
+			for (int k = 0; k < 9; ++k)
+			{
+				locals[i * 12 + k] *= scale;
+			}
+			for (int k = 9; k < 12; ++k)
+			{
+				locals[i * 12 + k] = (random.Float() - 0.5f) * 20.0f;
+			}
+		}
+
+		TransformSystem transforms;
+		std::vector<TransformHandle> handles(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			handles[i] = transforms.Create(&locals[i * 12], parents[i] != 0xffffffffu ? handles[parents[i]] : InvalidTransformHandle);
+		}
+		transforms.Update();
+
+		std::vector<uint32_t> drawList(count);
+		std::vector<TransformHandle> drawHandles(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			drawList[i] = i;
+		}
+		for (uint32_t i = count - 1; i > 0; --i)
+		{
+			std::swap(drawList[i], drawList[(uint32_t)(random.Float() * (i + 1))]);
+		}
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			drawHandles[i] = handles[drawList[i]];
+		}
+
+		// the same hierarchy as 4x4 matrices, each world its local times its parent's world
+		std::vector<float> local4(count * 16), world4(count * 16);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			for (int r = 0; r < 4; ++r)
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					local4[i * 16 + r * 4 + c] = c < 3 ? locals[i * 12 + r * 3 + c] : (r == 3 ? 1.0f : 0.0f);
+				}
+			}
+		}
+
+		const int frames = count > 100000 ? 4 : (count > 1000 ? 16 : 256);
+		float rotation[12], rotation4[16] = { 0 };
+		RotationY(0.01f, rotation);
+		for (int r = 0; r < 4; ++r)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				rotation4[r * 4 + c] = rotation[r * 3 + c];
+			}
+		}
+		rotation4[15] = 1.0f;
+
+		double baselineMs = 0.0;
+		std::vector<float> baselineConstants(count * 32);
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			TestTimer timer;
+			for (uint32_t i = 0; i < rootCount; ++i)
+			{
+				float rotated[16];
+				Multiply4x4(&local4[i * 16], rotation4, rotated);
+				memcpy(&local4[i * 16], rotated, sizeof(rotated));
+			}
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (parents[i] == 0xffffffffu)
+					memcpy(&world4[i * 16], &local4[i * 16], 16 * sizeof(float));
+				else
+					Multiply4x4(&local4[i * 16], &world4[parents[i] * 16], &world4[i * 16]);
+			}
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const float* world = &world4[drawList[i] * 16];
+				float wvp[16];
+				Multiply4x4(world, viewProj, wvp);
+				for (int r = 0; r < 4; ++r)
+				{
+					for (int c = 0; c < 4; ++c)
+					{
+						baselineConstants[i * 32 + c * 4 + r] = wvp[r * 4 + c];
+						baselineConstants[i * 32 + 16 + c * 4 + r] = world[r * 4 + c];
+					}
+				}
+			}
+			baselineMs += timer.ElapsedMs();
+		}
+		TestLog("transforms: %u objects, 4x4 matrix per object %.3f ms per frame", count, baselineMs / frames);
+
+		std::vector<unsigned int> threadCounts(1, 1);
+		if (WorkerThreadCount() > 1)
+			threadCounts.push_back(WorkerThreadCount());
+
+		std::vector<TransformConstants> constants(count), reference;
+		for (int kernel = TRANSFORM_KERNEL_SCALAR; kernel <= TRANSFORM_KERNEL_SSE2; ++kernel)
+		{
+			for (unsigned int threads : threadCounts)
+			{
+				// every kernel starts from the same locals, rotated as often as the baseline
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					transforms.SetLocal(handles[i], &locals[i * 12]);
+				}
+				transforms.Update();
+
+				double updateMs = 0.0, constantsMs = 0.0;
+				for (int frame = 0; frame < frames; ++frame)
+				{
+					TestTimer timer;
+					for (uint32_t i = 0; i < rootCount; ++i)
+					{
+						transforms.Multiply(handles[i], rotation);
+					}
+					transforms.Update(threads, (TransformKernel)kernel);
+					updateMs += timer.ElapsedMs();
+
+					timer.Reset();
+					transforms.BuildConstants(drawHandles.data(), count, viewProj, constants.data(), false, (TransformKernel)kernel);
+					constantsMs += timer.ElapsedMs();
+				}
+
+				double maxError = 0.0;
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					const float* values = constants[i].worldViewProj;
+					for (int k = 0; k < 32; ++k)
+					{
+						maxError = (std::max)(maxError, (double)fabsf(values[k] - baselineConstants[i * 32 + k]) / (1.0 + fabsf(baselineConstants[i * 32 + k])));
+					}
+				}
+				if (reference.empty())
+					reference = constants;
+				CHECK(memcmp(reference.data(), constants.data(), count * sizeof(TransformConstants)) == 0);
+				CHECK(maxError < 1e-4);
+
+				TestLog("transforms: %u objects, %s %u threads, update %.3f ms, constants %.3f ms, %.2fx, error %.1e", count,
+					kernelNames[kernel], threads, updateMs / frames, constantsMs / frames, baselineMs / (updateMs + constantsMs), maxError);
+			}
+		}
+
+		// moving one child changes only it and its children, destroying a root drops its subtree
+		uint32_t child = rootCount;
+		transforms.Multiply(handles[child], rotation);
+		transforms.Update();
+		uint32_t changed = 0, expectedChanged = 1;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			changed += transforms.WorldChanged(handles[i]);
+			expectedChanged += parents[i] == child;
+		}
+		CHECK(changed == expectedChanged);
+
+		uint32_t subtree = 1;
+		for (uint32_t i = rootCount; i < count; ++i)
+		{
+			uint32_t root = i < childEnd ? parents[i] : parents[parents[i]];
+			subtree += root == 0;
+		}
+		transforms.Destroy(handles[0]);
+		transforms.Update();
+		CHECK(transforms.GetCount() == count - subtree && !transforms.IsValid(handles[0]));
+	}
+}
+
+int main()
+{
+	TestHierarchy();
+	TestAgainst4x4();
+	return TestResult();
+}